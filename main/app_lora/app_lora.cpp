@@ -1,12 +1,14 @@
 #include "app_lora.h"
-#include "lora.h"
+#include "radio_hal.h"
 #include "lora_crypto.h"
+#include "lora_rx_ring.h"
 #include "rgb/rgb.h"
 #include "health_engine/health_engine.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h" // Required for Mutex
@@ -25,9 +27,9 @@ static const char *TAG = "APP_LORA";
 #define PIN_NUM_MOSI    11
 #define PIN_NUM_CLK     12
 #define PIN_NUM_CS      10
-#define PIN_NUM_DIO     2   
+#define PIN_NUM_DIO     2   // SX127x DIO0 / SX1262 DIO1
 #define RESET_PIN       9   
-#define PIN_NUM_BUSY    14  
+#define PIN_NUM_BUSY    14  // SX1262 only
 
 // -----------------------------------------------------------------------------
 // LoRa Configuration
@@ -38,13 +40,53 @@ static const char *TAG = "APP_LORA";
 #define LORA_CR_DEN         5
 #define LORA_PREAMBLE_LEN   8
 #define LORA_CRC_ON         true
+#define LORA_TX_POWER_DBM   17
 #define STM32_PAYLOAD_LEN   64
 
+// -----------------------------------------------------------------------------
+// IRQ-driven RX
+// -----------------------------------------------------------------------------
+// lora_task sleeps on a task notification from the DIO0 (RxDone) ISR. The
+// watchdog timeout only samples the DIO0 GPIO level (no SPI) to recover an
+// edge that was missed while the mutex was held elsewhere.
+#define LORA_IRQ_WATCHDOG_MS    1000
+#define LORA_STATS_LOG_MS       (10 * 60 * 1000)
+// Cost of the old parsePacket() poll loop, kept only to report the savings:
+// 10 ms period, 5 register transactions per idle poll.
+#define LORA_LEGACY_POLL_MS     10
+#define LORA_LEGACY_SPI_PER_POLL 5
+
+// lora_task notification bits
+#define LORA_EVT_DIO0           (1UL << 0)  // DIO0 edge: RxDone, or TxDone while an ACK is on air
+#define LORA_EVT_ACK_DUE        (1UL << 1)  // ack_timer expired
+#define LORA_EVT_RX_LOCK        (1UL << 2)  // rx_lock_timer expired
+
+// -----------------------------------------------------------------------------
+// Multi-SF reception
+// -----------------------------------------------------------------------------
+// With more than one SF in CONFIG_EFLO_LORA_SF_SET the radio is not left in
+// RX continuous: CAD runs on each SF in turn and, on activity, RX locks onto
+// that SF for one frame. Near sensors keep SF7 airtime, far ones use SF9/10.
+// A single-entry set is plain RX continuous, exactly as before.
+#define LORA_SF_MAX_SET         6
+#define LORA_SF_SLOTS           13    // counters indexed by SF
+#define LORA_LOCK_MARGIN_US     2000
+
+// -----------------------------------------------------------------------------
+// Asynchronous ACK transmitter
+// -----------------------------------------------------------------------------
+// ACKs are queued with a due time (RX edge + ackDelayMs) and sent from an
+// esp_timer wakeup; TxDone comes back on DIO0. The radio keeps listening
+// during the delay and is deaf only for the ACK airtime.
+#define LORA_ACK_QUEUE_LEN      4
+#define LORA_ACK_STALE_MS       400  // sensor RX window long gone: drop instead of send
+#define LORA_ACK_DEFER_MS       10   // frame on air at due time: retry after this
+#define LORA_ACK_TX_TIMEOUT_MS  500  // TxDone never arrived: force back to RX
+
 // -----------------------------------------------------------------------------
 // Global Resources
 // -----------------------------------------------------------------------------
-static LoRa* lora_driver = nullptr;
-QueueHandle_t lora_rx_queue = NULL;
+static RadioHal* lora_driver = nullptr;
 static SemaphoreHandle_t lora_mutex = NULL; // Protects access to lora_driver
 
 // Runtime State
@@ -56,6 +98,24 @@ static struct {
     uint32_t ackSentCount;
     uint32_t lastRxTimeMs;
     uint64_t startTime;
+    // IRQ path statistics
+    uint32_t irqCount;          // DIO0 notifications handled
+    uint32_t irqSpurious;       // woke, but no RxDone (e.g. TxDone of a test TX)
+    uint32_t irqRecovered;      // missed edge picked up by the watchdog level check
+    uint32_t crcErrorCount;
+    uint32_t latLastUs;         // DIO0 edge -> lora_rx_ring
+    uint32_t latMaxUs;
+    uint64_t latSumUs;
+    uint32_t latSamples;
+    uint32_t spiAtStart;        // driver SPI counter when RX was armed
+    // ACK scheduler statistics
+    uint32_t ackQueued;
+    uint32_t ackDropped;        // queue full or stale before it could be sent
+    uint32_t ackDeferred;       // due while a frame was on air
+    uint32_t ackTxTimeout;
+    uint32_t rxWhileAckPending; // frames heard during an ACK delay (lost by the old blocking path)
+    uint32_t framesMissed;      // FrameSentCnt gaps: frames the hub never heard
+    uint64_t txDeafUs;          // total time the receiver was in TX
 } lora_state = {
     .syncWord = 0x12,
     .sendAck = true,
@@ -63,9 +123,64 @@ static struct {
     .rxCount = 0,
     .ackSentCount = 0,
     .lastRxTimeMs = 0,
-    .startTime = 0
+    .startTime = 0,
+    .irqCount = 0,
+    .irqSpurious = 0,
+    .irqRecovered = 0,
+    .crcErrorCount = 0,
+    .latLastUs = 0,
+    .latMaxUs = 0,
+    .latSumUs = 0,
+    .latSamples = 0,
+    .spiAtStart = 0,
+    .ackQueued = 0,
+    .ackDropped = 0,
+    .ackDeferred = 0,
+    .ackTxTimeout = 0,
+    .rxWhileAckPending = 0,
+    .framesMissed = 0,
+    .txDeafUs = 0
 };
 
+typedef struct {
+    lora_packet_t packet;
+    int64_t dueUs;
+    uint8_t sf;          // ACK goes out on the SF the frame came in on
+} lora_ack_entry_t;
+
+static struct {
+    lora_ack_entry_t q[LORA_ACK_QUEUE_LEN];
+    uint8_t head;
+    uint8_t count;
+    bool txBusy;
+    int64_t txStartUs;
+    esp_timer_handle_t timer;
+} ack_sched = {};
+
+typedef enum {
+    RX_MODE_CONTINUOUS,  // single SF, RX continuous
+    RX_MODE_CAD,         // CAD running on sfSet[idx]
+    RX_MODE_LOCKED,      // activity detected, receiving on curSf
+    RX_MODE_TX,          // ACK on air
+} rx_mode_t;
+
+static struct {
+    uint8_t sfSet[LORA_SF_MAX_SET];
+    uint8_t sfCount;
+    uint8_t idx;
+    int curSf;
+    rx_mode_t mode;
+    bool lockExtended;   // preamble window passed with a frame in progress
+    esp_timer_handle_t lockTimer;
+    uint32_t cadRuns;
+    uint32_t cadHits[LORA_SF_SLOTS];
+    uint32_t cadFalse[LORA_SF_SLOTS];  // activity, but no frame followed
+    uint32_t rxBySf[LORA_SF_SLOTS];
+    uint32_t crcBySf[LORA_SF_SLOTS];
+} rx_sched = {};
+
+static TaskHandle_t lora_task_handle = NULL;
+
 // -----------------------------------------------------------------------------
 // Helpers
 // -----------------------------------------------------------------------------
@@ -73,6 +188,142 @@ static uint32_t get_millis() {
     return (uint32_t)(esp_timer_get_time() / 1000ULL);
 }
 
+static uint32_t lora_symbol_us(int sf) {
+    return (uint32_t)(((uint64_t)1000000 << sf) / LORA_BW_HZ);
+}
+
+// LoRa time on air (explicit header, CRC on), Semtech AN1200.13
+static uint32_t lora_airtime_us(int sf, int payloadLen) {
+    uint32_t tSym = lora_symbol_us(sf);
+    int de = (tSym > 16000) ? 1 : 0;
+    int num = 8 * payloadLen - 4 * sf + 28 + 16;
+    int den = 4 * (sf - 2 * de);
+    int nPayload = 8 + ((num > 0) ? ((num + den - 1) / den) * LORA_CR_DEN : 0);
+    // preamble + 4.25 symbols, in quarter symbols to stay integer
+    return (uint32_t)(((uint64_t)(LORA_PREAMBLE_LEN * 4 + 17 + nPayload * 4) * tSym) / 4);
+}
+
+// -----------------------------------------------------------------------------
+// Multi-SF receive scheduler (all functions: lora_mutex held)
+// -----------------------------------------------------------------------------
+
+static void rx_lock_timer_cb(void* arg) {
+    if (lora_task_handle) xTaskNotify(lora_task_handle, LORA_EVT_RX_LOCK, eSetBits);
+}
+
+// Parse CONFIG_EFLO_LORA_SF_SET ("7,9,10"); falls back to LORA_SF.
+static void rx_sched_init(void) {
+    const char* p = CONFIG_EFLO_LORA_SF_SET;
+    rx_sched.sfCount = 0;
+
+    while (*p && rx_sched.sfCount < LORA_SF_MAX_SET) {
+        if (*p < '0' || *p > '9') { p++; continue; }
+        int sf = 0;
+        while (*p >= '0' && *p <= '9') sf = sf * 10 + (*p++ - '0');
+        if (sf < 7 || sf > 12) {
+            ESP_LOGW(TAG, "SF%d not supported in SF set, ignored", sf);
+            continue;
+        }
+        bool dup = false;
+        for (int i = 0; i < rx_sched.sfCount; i++) dup |= (rx_sched.sfSet[i] == sf);
+        if (!dup) rx_sched.sfSet[rx_sched.sfCount++] = (uint8_t)sf;
+    }
+    if (rx_sched.sfCount == 0) {
+        rx_sched.sfSet[rx_sched.sfCount++] = LORA_SF;
+    }
+    rx_sched.curSf = LORA_SF;
+
+    if (rx_sched.sfCount > 1) {
+        const esp_timer_create_args_t args = {
+            .callback = rx_lock_timer_cb,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "lora_rx_lock",
+            .skip_unhandled_events = true,
+        };
+        if (esp_timer_create(&args, &rx_sched.lockTimer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create RX lock timer, single SF only");
+            rx_sched.sfCount = 1;
+        }
+    }
+
+    char list[32];
+    int pos = 0;
+    for (int i = 0; i < rx_sched.sfCount; i++) {
+        pos += snprintf(list + pos, sizeof(list) - pos, "%sSF%d", i ? "," : "", rx_sched.sfSet[i]);
+    }
+    ESP_LOGI(TAG, "RX SF set: %s (%s)", list, rx_sched.sfCount > 1 ? "CAD rotation" : "continuous");
+}
+
+static void rx_set_sf(int sf) {
+    if (sf == rx_sched.curSf) return;
+    lora_driver->standby();
+    lora_driver->setSpreadingFactor(sf);
+    rx_sched.curSf = sf;
+}
+
+static void rx_arm_lock_timer(uint32_t us) {
+    esp_timer_stop(rx_sched.lockTimer);
+    esp_timer_start_once(rx_sched.lockTimer, us);
+}
+
+// Put the radio back to listening: RX continuous, or the next CAD step.
+static void rx_resume(void) {
+    if (rx_sched.lockTimer) esp_timer_stop(rx_sched.lockTimer);
+
+    if (rx_sched.sfCount <= 1) {
+        rx_set_sf(rx_sched.sfSet[0]);
+        rx_sched.mode = RX_MODE_CONTINUOUS;
+        lora_driver->startReceive();
+        return;
+    }
+
+    rx_set_sf(rx_sched.sfSet[rx_sched.idx]);
+    rx_sched.mode = RX_MODE_CAD;
+    rx_sched.cadRuns++;
+    lora_driver->startCad();
+}
+
+// CadDone: lock onto the SF on activity, else rotate to the next one.
+static void rx_handle_cad(void) {
+    int r = lora_driver->handleCadDone();
+    if (r < 0) {
+        lora_state.irqSpurious++;
+        return;
+    }
+
+    if (r > 0) {
+        int sf = rx_sched.curSf;
+        rx_sched.cadHits[sf]++;
+        rx_sched.mode = RX_MODE_LOCKED;
+        rx_sched.lockExtended = false;
+
+        // Rest of the preamble plus header; the SX1262 closes the window in
+        // hardware, the software timer is the SX127x path and a backstop.
+        uint32_t windowUs = (LORA_PREAMBLE_LEN + 13) * lora_symbol_us(sf);
+        lora_driver->startReceive(windowUs / 1000 + 1);
+        rx_arm_lock_timer(windowUs + LORA_LOCK_MARGIN_US);
+        return;
+    }
+
+    rx_sched.idx = (rx_sched.idx + 1) % rx_sched.sfCount;
+    rx_resume();
+}
+
+static void rx_lock_expired(void) {
+    if (rx_sched.mode != RX_MODE_LOCKED) return;
+
+    if (!rx_sched.lockExtended && lora_driver->isReceiving()) {
+        // Header seen: give the frame its full airtime
+        rx_sched.lockExtended = true;
+        rx_arm_lock_timer(lora_airtime_us(rx_sched.curSf, STM32_PAYLOAD_LEN) + LORA_LOCK_MARGIN_US);
+        return;
+    }
+
+    rx_sched.cadFalse[rx_sched.curSf]++;
+    rx_resume();
+}
+
 // -----------------------------------------------------------------------------
 // Core Logic
 // -----------------------------------------------------------------------------
@@ -105,19 +356,7 @@ static bool decode_frame(const uint8_t* buf, int len, lora_packet_t* out_packet)
     return true;
 }
 
-static void send_ack(const lora_packet_t* packet) {
-    if (!lora_state.sendAck || !lora_driver) return;
-
-    ESP_LOGD(TAG, "Sending ACK...");
-    vTaskDelay(pdMS_TO_TICKS(lora_state.ackDelayMs));
-
-    // SAFETY: We assume the caller holds the Mutex, or this is called from the main task
-    // Since this is called from lora_task (which holds the mutex logic implicitly by ownership), 
-    // we need to be careful if we move it. Currently, it's fine.
-
-    lora_driver->beginPacket(0);
-
-    uint8_t ackBuffer[20];
+static int build_ack_frame(const lora_packet_t* packet, uint8_t* ackBuffer) {
     int idx = 0;
 
     ackBuffer[idx++] = 0xAA; // Header
@@ -150,20 +389,192 @@ static void send_ack(const lora_packet_t* packet) {
     for(int i=0; i<19; i++) checksum ^= ackBuffer[i];
     ackBuffer[idx++] = checksum;
 
-    lora_driver->write(ackBuffer, 20);
-    lora_driver->endPacket(false);
-    lora_driver->receive(0); // Return to RX
+    return idx;
+}
+
+static void ack_timer_cb(void* arg) {
+    if (lora_task_handle) xTaskNotify(lora_task_handle, LORA_EVT_ACK_DUE, eSetBits);
+}
+
+// Arm ack_timer for the head of the queue, or for the TX timeout while busy.
+static void ack_arm_timer(void) {
+    if (!ack_sched.timer) return;
+    esp_timer_stop(ack_sched.timer);
+
+    int64_t dueUs;
+    if (ack_sched.txBusy) {
+        dueUs = ack_sched.txStartUs + LORA_ACK_TX_TIMEOUT_MS * 1000LL;
+    } else if (ack_sched.count > 0) {
+        dueUs = ack_sched.q[ack_sched.head].dueUs;
+    } else {
+        return;
+    }
+
+    int64_t waitUs = dueUs - esp_timer_get_time();
+    esp_timer_start_once(ack_sched.timer, waitUs > 0 ? (uint64_t)waitUs : 1);
+}
+
+// Queue an ACK for a verified frame. Never blocks; the radio stays in RX.
+static void schedule_ack(const lora_packet_t* packet, int64_t rxTimeUs) {
+    if (!lora_state.sendAck || !lora_driver) return;
+
+    if (ack_sched.count >= LORA_ACK_QUEUE_LEN) {
+        lora_state.ackDropped++;
+        ESP_LOGW(TAG, "ACK queue full, ACK for 0x%lX dropped", (unsigned long)packet->sensorId);
+        return;
+    }
+
+    uint8_t tail = (ack_sched.head + ack_sched.count) % LORA_ACK_QUEUE_LEN;
+    ack_sched.q[tail].packet = *packet;
+    ack_sched.q[tail].dueUs = rxTimeUs + lora_state.ackDelayMs * 1000LL;
+    ack_sched.q[tail].sf = (uint8_t)rx_sched.curSf;
+    ack_sched.count++;
+    lora_state.ackQueued++;
 
-    lora_state.ackSentCount++;
+    if (ack_sched.count == 1) ack_arm_timer();
+}
+
+// Called with lora_mutex held. Sends the head ACK if it is due and the
+// channel is free; stale entries are dropped.
+static void service_ack_queue(void) {
+    int64_t now = esp_timer_get_time();
+
+    while (!ack_sched.txBusy && ack_sched.count > 0) {
+        lora_ack_entry_t* e = &ack_sched.q[ack_sched.head];
+
+        if (now - e->dueUs > LORA_ACK_STALE_MS * 1000LL) {
+            lora_state.ackDropped++;
+            ESP_LOGW(TAG, "Stale ACK for 0x%lX dropped", (unsigned long)e->packet.sensorId);
+            ack_sched.head = (ack_sched.head + 1) % LORA_ACK_QUEUE_LEN;
+            ack_sched.count--;
+            continue;
+        }
+        if (e->dueUs > now) break;
+
+        if (rx_sched.mode == RX_MODE_LOCKED || lora_driver->isReceiving()) {
+            // Don't cut off a frame that is on air; retry shortly
+            lora_state.ackDeferred++;
+            esp_timer_stop(ack_sched.timer);
+            esp_timer_start_once(ack_sched.timer, LORA_ACK_DEFER_MS * 1000ULL);
+            return;
+        }
+
+        uint8_t ackBuffer[20];
+        int len = build_ack_frame(&e->packet, ackBuffer);
+
+        ESP_LOGD(TAG, "Sending ACK to 0x%lX", (unsigned long)e->packet.sensorId);
+        ack_sched.head = (ack_sched.head + 1) % LORA_ACK_QUEUE_LEN;
+        ack_sched.count--;
+
+        if (rx_sched.lockTimer) esp_timer_stop(rx_sched.lockTimer);
+        rx_set_sf(e->sf);
+        rx_sched.mode = RX_MODE_TX;
+        if (!lora_driver->startTransmit(ackBuffer, len)) {
+            lora_state.ackDropped++;
+            rx_resume();
+            continue;
+        }
+
+        ack_sched.txBusy = true;
+        ack_sched.txStartUs = esp_timer_get_time();
+    }
+
+    ack_arm_timer();
+}
+
+// Called with lora_mutex held when DIO0 fired (or timed out) during an ACK TX.
+static void finish_ack_tx(bool timedOut) {
+    if (!timedOut && !lora_driver->handleTxDone()) {
+        lora_state.irqSpurious++;
+        return;
+    }
+
+    if (timedOut) {
+        lora_state.ackTxTimeout++;
+        ESP_LOGW(TAG, "ACK TxDone timeout, forcing RX");
+    } else {
+        lora_state.ackSentCount++;
+    }
+
+    lora_state.txDeafUs += (uint64_t)(esp_timer_get_time() - ack_sched.txStartUs);
+    ack_sched.txBusy = false;
+    rx_resume(); // Return to RX
+
+    service_ack_queue();
+}
+
+static void record_irq_latency(int64_t irqTimeUs) {
+    int64_t lat = esp_timer_get_time() - irqTimeUs;
+    if (lat < 0) return;
+
+    lora_state.latLastUs = (uint32_t)lat;
+    if (lora_state.latLastUs > lora_state.latMaxUs) lora_state.latMaxUs = lora_state.latLastUs;
+    lora_state.latSumUs += (uint64_t)lat;
+    lora_state.latSamples++;
+}
+
+static void log_rx_stats(void) {
+    uint32_t elapsedMs = (uint32_t)((esp_timer_get_time() - lora_state.startTime) / 1000ULL);
+    uint32_t spiActual = lora_driver ? lora_driver->getSpiTransactions() - lora_state.spiAtStart : 0;
+    uint32_t spiLegacy = (elapsedMs / LORA_LEGACY_POLL_MS) * LORA_LEGACY_SPI_PER_POLL;
+    uint32_t spiSaved  = (spiLegacy > spiActual) ? (spiLegacy - spiActual) : 0;
+    uint32_t latAvgUs  = lora_state.latSamples ?
+                         (uint32_t)(lora_state.latSumUs / lora_state.latSamples) : 0;
+
+    ESP_LOGI(TAG, "Stats: RX=%lu, ACKs=%lu, IRQ=%lu (spurious=%lu, recovered=%lu), CRCerr=%lu",
+             (unsigned long)lora_state.rxCount, (unsigned long)lora_state.ackSentCount,
+             (unsigned long)lora_state.irqCount, (unsigned long)lora_state.irqSpurious,
+             (unsigned long)lora_state.irqRecovered, (unsigned long)lora_state.crcErrorCount);
+    ESP_LOGI(TAG, "SPI: actual=%lu, legacy-poll estimate=%lu, idle txns eliminated=%lu",
+             (unsigned long)spiActual, (unsigned long)spiLegacy, (unsigned long)spiSaved);
+    ESP_LOGI(TAG, "IRQ->queue latency: last=%luus avg=%luus max=%luus (n=%lu)",
+             (unsigned long)lora_state.latLastUs, (unsigned long)latAvgUs,
+             (unsigned long)lora_state.latMaxUs, (unsigned long)lora_state.latSamples);
+    ESP_LOGI(TAG, "ACK: queued=%lu sent=%lu dropped=%lu deferred=%lu txTimeout=%lu, TX deaf=%lums",
+             (unsigned long)lora_state.ackQueued, (unsigned long)lora_state.ackSentCount,
+             (unsigned long)lora_state.ackDropped, (unsigned long)lora_state.ackDeferred,
+             (unsigned long)lora_state.ackTxTimeout, (unsigned long)(lora_state.txDeafUs / 1000ULL));
+    ESP_LOGI(TAG, "Missed frames (counter gaps)=%lu, RX during ACK delay=%lu",
+             (unsigned long)lora_state.framesMissed, (unsigned long)lora_state.rxWhileAckPending);
+
+    lora_rx_ring_stats_t ring;
+    lora_rx_ring_get_stats(&ring);
+    ESP_LOGI(TAG, "RX ring: depth=%u high-water=%u pushed=%lu overflow=%lu coalesced=%lu dropped=%lu",
+             ring.depth, ring.high_water, (unsigned long)ring.pushed,
+             (unsigned long)ring.overflow, (unsigned long)ring.coalesced,
+             (unsigned long)ring.dropped);
+
+    lora_crypto_replay_stats_t rs;
+    lora_crypto_get_replay_stats(&rs);
+    ESP_LOGI(TAG, "Replay: rejected=%lu (too old=%lu), out-of-order accepted=%lu, "
+             "NVS flushes=%lu for %lu updates, pending=%lu",
+             (unsigned long)rs.rejected, (unsigned long)rs.too_old,
+             (unsigned long)rs.out_of_order, (unsigned long)rs.flushes,
+             (unsigned long)rs.flushed_updates, (unsigned long)rs.pending_updates);
+
+    if (rx_sched.sfCount > 1) {
+        ESP_LOGI(TAG, "CAD runs=%lu", (unsigned long)rx_sched.cadRuns);
+    }
+    for (int i = 0; i < rx_sched.sfCount; i++) {
+        int sf = rx_sched.sfSet[i];
+        ESP_LOGI(TAG, "  SF%d: RX=%lu CRCerr=%lu CAD hits=%lu no-frame=%lu", sf,
+                 (unsigned long)rx_sched.rxBySf[sf], (unsigned long)rx_sched.crcBySf[sf],
+                 (unsigned long)rx_sched.cadHits[sf], (unsigned long)rx_sched.cadFalse[sf]);
+    }
 }
 
 static void switch_sync_word(uint8_t newSync) {
     if (xSemaphoreTake(lora_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        if (ack_sched.txBusy) {
+            // idle() below aborts the ACK on air
+            ack_sched.txBusy = false;
+            lora_state.ackDropped++;
+        }
         ESP_LOGI(TAG, "Switching Sync Word: 0x%02X -> 0x%02X", lora_state.syncWord, newSync);
         lora_state.syncWord = newSync;
-        lora_driver->idle();
+        lora_driver->standby();
         lora_driver->setSyncWord(newSync);
-        lora_driver->receive(0);
+        rx_resume();
         xSemaphoreGive(lora_mutex);
     } else {
         ESP_LOGE(TAG, "Failed to take mutex for SyncWord switch");
@@ -196,19 +607,17 @@ void uart_command_task(void *pvParameters) {
             if (xSemaphoreTake(lora_mutex, pdMS_TO_TICKS(500)) == pdTRUE) {
                 switch(cmd) {
                     case 's': 
+                        if (ack_sched.txBusy) break;
                         ESP_LOGI(TAG, "Sending Test Packet");
-                        lora_driver->beginPacket(0);
-                        lora_driver->write((uint8_t*)"Test", 4);
-                        lora_driver->endPacket(false);
-                        lora_driver->receive(0);
+                        lora_driver->transmit((const uint8_t*)"Test", 4);
+                        rx_resume();
                         break;
                     case 'r': 
                         ESP_LOGI(TAG, "Restarting RX...");
-                        lora_driver->receive(0); 
+                        rx_resume();
                         break;
                     case 'd':
-                        ESP_LOGI(TAG, "Stats: RX=%ld, ACKs=%ld, LastRSSI=%d", 
-                                 lora_state.rxCount, lora_state.ackSentCount, 0);
+                        log_rx_stats();
                         break;
                 }
                 xSemaphoreGive(lora_mutex);
@@ -218,36 +627,151 @@ void uart_command_task(void *pvParameters) {
             if (cmd == 'a') {
                 lora_state.sendAck = !lora_state.sendAck;
                 ESP_LOGI(TAG, "ACK %s", lora_state.sendAck ? "ENABLED" : "DISABLED");
+            } else if (cmd == 'k') {
+                lora_crypto_benchmark(200);
             }
         }
         vTaskDelay(pdMS_TO_TICKS(50));
     }
 }
 
+// Called with lora_mutex held after DIO0 fired. One IRQ-flag read decides
+// whether there is anything to fetch; idle time costs no SPI traffic at all.
+static void handle_rx_irq(bool fromIsr, uint8_t* buffer, size_t bufLen) {
+    int64_t irqTimeUs = lora_driver->getIrqTimeUs();
+    radio_rx_info_t info = {};
+
+    // 1. Fetch flags, payload and metadata (burst SPI)
+    int idx = lora_driver->receivePacket(buffer, (int)bufLen, &info);
+
+    if (info.rxTimeout) {
+        // Hardware RX window after CAD closed without a header
+        rx_sched.cadFalse[rx_sched.curSf]++;
+        return;
+    }
+    if (info.crcError) {
+        lora_state.crcErrorCount++;
+        rx_sched.crcBySf[rx_sched.curSf]++;
+        ESP_LOGW(TAG, "RX CRC error - frame discarded");
+        return;
+    }
+    if (idx <= 0) {
+        lora_state.irqSpurious++;
+        return;
+    }
+
+    lora_state.rxCount++;
+    rx_sched.rxBySf[rx_sched.curSf]++;
+    lora_state.lastRxTimeMs = get_millis();
+
+    // 2. Collect Packet Metadata
+    lora_packet_t packet = {};
+    packet.rssi = (int8_t)info.rssi;
+    packet.snr = info.snr;
+
+    ESP_LOGI(TAG, "Packet Received. Size: %d, RSSI: %d, SNR: %.1f",
+             idx, packet.rssi, packet.snr);
+
+    if (ack_sched.count > 0) lora_state.rxWhileAckPending++;
+
+    // Last counter for this sensor, before decrypt updates it
+    uint16_t prevCnt = 0;
+    if (idx >= 4) {
+        uint32_t rawId = ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+                         ((uint32_t)buffer[2] << 8) | buffer[3];
+        prevCnt = lora_crypto_get_last_counter(rawId);
+    }
+
+    // 3. Decrypt, Verify & Process
+    if (decode_frame(buffer, idx, &packet)) {
+        // Schedule Physical ACK (sent from the ACK timer, radio stays in RX)
+        schedule_ack(&packet, irqTimeUs);
+
+        uint16_t gap = (uint16_t)(packet.frameSent - prevCnt);
+        if (prevCnt != 0 && gap > 1 && gap < 0x8000) {
+            lora_state.framesMissed += gap - 1;
+        }
+
+        // Hand to iothub_task (coalesced per sensor if the ring is full)
+        if (lora_rx_ring_push(&packet) && fromIsr) {
+            record_irq_latency(irqTimeUs);
+        }
+
+        // Health engine: sensor check-in
+        health_post_lora_checkin(packet.sensorId, packet.batteryPercentage,
+                                packet.rssi, packet.snr);
+
+        // Trigger LED
+        uint8_t ledCmd = 'G';
+        if (ledQueue != NULL) xQueueSend(ledQueue, &ledCmd, 0);
+    } else {
+        // Packet failed crypto â€” log raw hex for debugging
+        ESP_LOGW(TAG, "Rejected packet (%d bytes):", idx);
+        char hex_line[128];
+        int pos = 0;
+        int print_len = (idx < 20) ? idx : 20;
+        for (int i = 0; i < print_len; i++) {
+            pos += snprintf(hex_line + pos, sizeof(hex_line) - pos, "%02X ", buffer[i]);
+        }
+        ESP_LOGW(TAG, "  %s", hex_line);
+    }
+}
+
 extern "C" void lora_task(void* param)
 {
     // 1. Initialize Objects
     lora_mutex = xSemaphoreCreateMutex();
-    lora_rx_queue = xQueueCreate(10, sizeof(lora_packet_t)); // Holds 10 packets
     
     // 2. Hardware Init
     ESP_LOGI(TAG, "Initializing LoRa Driver...");
     
-    // Choose your driver here (SX1262 vs SX1276 logic handled inside LoRa class via #define)
-    // lora_driver = new LoRa(PIN_NUM_MOSI, PIN_NUM_MISO, PIN_NUM_CLK, PIN_NUM_CS, RESET_PIN, PIN_NUM_DIO, PIN_NUM_BUSY, 17);
-    lora_driver = new LoRa(PIN_NUM_MOSI, PIN_NUM_MISO, PIN_NUM_CLK, PIN_NUM_CS, RESET_PIN, PIN_NUM_DIO, 17);
-
-    lora_driver->setFrequency(LORA_FREQ_HZ);
-    lora_driver->setSpreadingFactor(LORA_SF);
-    lora_driver->setSignalBandwidth(LORA_BW_HZ);
-    lora_driver->setCodingRate4(LORA_CR_DEN);
-    lora_driver->setPreambleLength(LORA_PREAMBLE_LEN);
-    lora_driver->setSyncWord(lora_state.syncWord);
-    lora_driver->setCRC(LORA_CRC_ON);
-    lora_driver->disableInvertIQ();
+    const radio_pins_t pins = {
+        .mosi = PIN_NUM_MOSI,
+        .miso = PIN_NUM_MISO,
+        .clk = PIN_NUM_CLK,
+        .cs = PIN_NUM_CS,
+        .reset = RESET_PIN,
+        .irq = PIN_NUM_DIO,
+        .busy = PIN_NUM_BUSY,
+    };
+    const radio_config_t radio_cfg = {
+        .frequencyHz = LORA_FREQ_HZ,
+        .spreadingFactor = LORA_SF,
+        .bandwidthHz = LORA_BW_HZ,
+        .codingRateDen = LORA_CR_DEN,
+        .preambleLen = LORA_PREAMBLE_LEN,
+        .syncWord = lora_state.syncWord,
+        .crcOn = LORA_CRC_ON,
+        .txPowerDbm = LORA_TX_POWER_DBM,
+    };
+
+    lora_driver = radio_hal_create(&pins, LORA_TX_POWER_DBM);
+    if (!lora_driver || !lora_driver->configure(&radio_cfg)) {
+        ESP_LOGE(TAG, "LoRa radio init failed - LoRa disabled");
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Radio: %s", lora_driver->name());
     
-    lora_driver->receive(0);
+    // DIO0 ISR wakes this task from here on
+    lora_task_handle = xTaskGetCurrentTaskHandle();
+    lora_driver->setIrqTask(lora_task_handle, LORA_EVT_DIO0);
+    rx_sched_init();
+    rx_resume();
     lora_state.startTime = esp_timer_get_time();
+    lora_state.spiAtStart = lora_driver->getSpiTransactions();
+
+    const esp_timer_create_args_t ack_timer_args = {
+        .callback = ack_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "lora_ack",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&ack_timer_args, &ack_sched.timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create ACK timer, ACKs disabled");
+        lora_state.sendAck = false;
+    }
 
     // 3. Initialize Crypto Module
     lora_crypto_init();
@@ -255,75 +779,70 @@ extern "C" void lora_task(void* param)
     // 4. Start Aux Task
     xTaskCreate(uart_command_task, "uart_cmd_task", 4096, NULL, 5, NULL);
 
-    ESP_LOGI(TAG, "LoRa Task Started. Listening (encrypted mode)...");
+    ESP_LOGI(TAG, "LoRa Task Started. Listening (encrypted mode, IRQ-driven)...");
 
     uint8_t buffer[256];
+    uint32_t lastStatsMs = get_millis();
     
     while (1) {
-        // LOCK: Protect driver access
-        if (xSemaphoreTake(lora_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            
-            int packetSize = lora_driver->parsePacket(0);
-
-            if (packetSize) {
-                lora_state.rxCount++;
-                lora_state.lastRxTimeMs = get_millis();
-
-                // 1. Collect Packet Metadata
-                lora_packet_t packet = {};
-                packet.rssi = (int8_t)lora_driver->getPacketRssi();
-                packet.snr = lora_driver->getPacketSnr();
-                
-                ESP_LOGI(TAG, "Packet Received. Size: %d, RSSI: %d, SNR: %.1f", 
-                         packetSize, packet.rssi, packet.snr);
-
-                // 2. Read Payload
-                int idx = 0;
-                while(lora_driver->available() && idx < (int)sizeof(buffer)) {
-                    buffer[idx++] = (uint8_t)lora_driver->read();
-                }
-
-                // 3. Decrypt, Verify & Process
-                if (decode_frame(buffer, idx, &packet)) {
-                    // Send Physical ACK immediately (Time critical)
-                    send_ack(&packet);
+        // Sleep until DIO0 (RxDone / CRC error / TxDone / CadDone) or a timer fires
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(LORA_IRQ_WATCHDOG_MS));
+        bool fromIsr = (events & LORA_EVT_DIO0) != 0;
+        bool ackDue = (events & LORA_EVT_ACK_DUE) != 0;
+        bool lockDue = (events & LORA_EVT_RX_LOCK) != 0;
+
+        if (get_millis() - lastStatsMs >= LORA_STATS_LOG_MS) {
+            lastStatsMs = get_millis();
+            log_rx_stats();
+        }
 
-                    // Send Data to IoT Task via Queue
-                    if (xQueueSend(lora_rx_queue, &packet, 0) != pdTRUE) {
-                        ESP_LOGW(TAG, "Rx Queue Full! Packet dropped.");
-                    }
+        bool dio0 = fromIsr;
+        if (!fromIsr && !ackDue && !lockDue) {
+            // DIO0 stays high until IRQ flags are cleared, so a level check
+            // catches an edge we could not service (mutex busy) without SPI.
+            if (gpio_get_level((gpio_num_t)lora_driver->irqPin()) == 0) continue;
+            lora_state.irqRecovered++;
+            dio0 = true;
+        }
 
-                    // Health engine: sensor check-in
-                    health_post_lora_checkin(packet.sensorId, packet.batteryPercentage,
-                                            packet.rssi, packet.snr);
-
-                    // Trigger LED
-                    uint8_t ledCmd = 'G';
-                    if (ledQueue != NULL) xQueueSend(ledQueue, &ledCmd, 0);
-                } else {
-                    // Packet failed crypto â€” log raw hex for debugging
-                    ESP_LOGW(TAG, "Rejected packet (%d bytes):", idx);
-                    char hex_line[128];
-                    int pos = 0;
-                    int print_len = (idx < 20) ? idx : 20;
-                    for (int i = 0; i < print_len; i++) {
-                        pos += snprintf(hex_line + pos, sizeof(hex_line) - pos, "%02X ", buffer[i]);
+        // LOCK: Protect driver access
+        if (xSemaphoreTake(lora_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+            if (fromIsr) lora_state.irqCount++;
+
+            if (ack_sched.txBusy) {
+                bool timedOut = !dio0 &&
+                    (esp_timer_get_time() - ack_sched.txStartUs) >= LORA_ACK_TX_TIMEOUT_MS * 1000LL;
+                if (dio0 || timedOut) finish_ack_tx(timedOut);
+            } else {
+                if (dio0) {
+                    if (rx_sched.mode == RX_MODE_CAD) {
+                        rx_handle_cad();
+                    } else {
+                        handle_rx_irq(fromIsr, buffer, sizeof(buffer));
+                        if (rx_sched.mode == RX_MODE_LOCKED) rx_resume();
                     }
-                    ESP_LOGW(TAG, "  %s", hex_line);
+                } else if (lockDue) {
+                    rx_lock_expired();
                 }
+                service_ack_queue();
             }
-            
+
             // UNLOCK
             xSemaphoreGive(lora_mutex);
+        } else if (dio0 || ackDue || lockDue) {
+            // Retry on the next loop; the DIO0 level check / timer re-notify covers us
+            xTaskNotify(lora_task_handle, events, eSetBits);
+            vTaskDelay(pdMS_TO_TICKS(1));
         }
 
-
-        // Yield to other tasks
-        vTaskDelay(pdMS_TO_TICKS(10));
+        // Replay counter write-behind; NVS cost stays off the RX/ACK path
+        lora_crypto_journal_service(false);
     }
 }
 
 void configurelora(void)
 {
+    lora_rx_ring_init();    // before iothub_task adds the doorbell to its QueueSet
     xTaskCreate(lora_task, "lora_task", 10240, NULL, 4, NULL);
 }
\ No newline at end of file
@@ -22,9 +22,7 @@ typedef struct {
     uint64_t timestamp; // Changed to 64-bit for system time
 } lora_packet_t;
 
-// Queue handle to retrieve received packets
-// Other tasks can extern this to read data
-extern QueueHandle_t lora_rx_queue;
+// Decoded packets are delivered through lora_rx_ring (lora_rx_ring.h)
 
 // Main entry point to configure and start LoRa services
 void configurelora(void);
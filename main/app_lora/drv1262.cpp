@@ -1,622 +0,0 @@
-// #include <stdio.h>
-// #include "sdkconfig.h"
-// #include "lora.h"
-
-// #define LORA_TAG "LoRa"
-// #define ESP_INTR_FLAG_DEFAULT 0
-
-// // SX126X Constants for LoRa
-// #define LORA_BW_7   0x00 // 7.81 kHz
-// #define LORA_BW_10  0x08 // 10.42 kHz
-// #define LORA_BW_15  0x01 // 15.63 kHz
-// #define LORA_BW_20  0x09 // 20.83 kHz
-// #define LORA_BW_31  0x02 // 31.25 kHz
-// #define LORA_BW_41  0x0A // 41.67 kHz
-// #define LORA_BW_62  0x03 // 62.50 kHz
-// #define LORA_BW_125 0x04 // 125 kHz
-// #define LORA_BW_250 0x05 // 250 kHz
-// #define LORA_BW_500 0x06 // 500 kHz
-
-// #define LORA_CR_4_5 0x01
-// #define LORA_CR_4_6 0x02
-// #define LORA_CR_4_7 0x03
-// #define LORA_CR_4_8 0x04
-
-// #define LORA_SF5    0x05
-// #define LORA_SF6    0x06
-// #define LORA_SF7    0x07
-// #define LORA_SF8    0x08
-// #define LORA_SF9    0x09
-// #define LORA_SF10   0x0A
-// #define LORA_SF11   0x0B
-// #define LORA_SF12   0x0C
-
-// LoRa::LoRa( int mosi, int miso, int clk, int cs, int reset, int dio, int busy, int power )
-// {
-//     // Defaults
-//     _sf = LORA_SF7;
-//     _bw = LORA_BW_125;
-//     _cr = LORA_CR_4_5;
-//     _preambleLen = 8;
-//     _crcOn = true;
-//     _invertIq = false;
-//     _syncWord = 0x1424; // Private Network default (0x12)
-//     _implicitHeader = false;
-
-// 	initializeSPI( mosi, miso, clk, cs );
-// 	initializeReset( reset );
-// 	initializeDIO( dio );
-//     initializeBUSY( busy );
-// 	initialize( power );
-// }
-
-// void LoRa::initializeSPI( int mosi, int miso, int clk, int cs )
-// {
-//     esp_err_t ret;
-//     spi_bus_config_t buscfg = {};
-//     buscfg.mosi_io_num = mosi;
-//     buscfg.miso_io_num = miso;
-// 	buscfg.sclk_io_num = clk;
-// 	buscfg.quadwp_io_num = -1;
-// 	buscfg.quadhd_io_num = -1;
-// 	buscfg.max_transfer_sz = 0;
-
-//     spi_device_interface_config_t devcfg = {};
-//    	devcfg.address_bits = 0; // SX126x handles address in command buffer
-//     devcfg.command_bits = 0;
-//     devcfg.mode = 0; 
-// 	devcfg.clock_speed_hz = 8000000; // 8 MHz
-// 	devcfg.spics_io_num = cs;
-// 	devcfg.flags = 0;
-// 	devcfg.queue_size = 1;
-
-//     // Initialize SPI
-//     ret = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
-//     if(ret != ESP_OK) printf("SPI Bus Init Failed: %d\n", ret);
-
-//     ret = spi_bus_add_device(SPI2_HOST, &devcfg, &_spi);
-//     if(ret != ESP_OK) printf("SPI Device Add Failed: %d\n", ret);
-// }
-
-// void LoRa::initializeReset( int reset )
-// {
-// 	_resetPin = (gpio_num_t) reset;
-//     gpio_set_direction(_resetPin, GPIO_MODE_OUTPUT);
-//     gpio_set_level(_resetPin, 1);
-// }
-
-// void LoRa::initializeBUSY( int busy )
-// {
-//     _busyPin = (gpio_num_t) busy;
-//     gpio_set_direction(_busyPin, GPIO_MODE_INPUT);
-//     // No pullup needed usually, module drives it
-// }
-
-// extern "C" {
-// static void IRAM_ATTR gpio_isr_handler(void* arg)
-// {
-//     LoRa *s = (LoRa*) arg;
-//     s->setDataReceived(true);
-// }
-// }
-
-// void LoRa::initializeDIO( int dio )
-// {
-//     gpio_config_t io_conf = {};
-//     io_conf.intr_type = GPIO_INTR_POSEDGE;
-//     io_conf.pin_bit_mask = (1ULL << dio );
-//     io_conf.mode = GPIO_MODE_INPUT;
-//     io_conf.pull_up_en = GPIO_PULLUP_ENABLE; 
-    
-//     gpio_config(&io_conf);
-//     gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-//     gpio_isr_handler_add( (gpio_num_t)dio, gpio_isr_handler, (void*) this );
-// }
-
-// void LoRa::waitForBusy() 
-// {
-//     // Wait for BUSY pin to go LOW
-//     int timeout = 1000;
-//     while(gpio_get_level(_busyPin) == 1 && timeout > 0) {
-//         vTaskDelay(1); // 1 tick wait (or busy loop for shorter)
-//         timeout--;
-//         // If timing is critical use ets_delay_us(10);
-//     }
-// }
-
-// void LoRa::initialize( int power )
-// {
-//     // 1. Hardware Reset
-//     gpio_set_level(_resetPin, 0);
-//     delay(10); 
-//     gpio_set_level(_resetPin, 1);
-//     delay(20); 
-//     waitForBusy();
-
-//     // 2. Set Standby
-//     uint8_t stdbyConfig = STDBY_RC;
-//     writeCommand(SX126X_CMD_SET_STANDBY, &stdbyConfig, 1);
-    
-//     // 3. Set Packet Type to LoRa
-//     uint8_t packetType = PACKET_TYPE_LORA;
-//     writeCommand(SX126X_CMD_SET_PACKET_TYPE, &packetType, 1);
-
-//     // 4. Set RF Frequency (915MHz default)
-//     setFrequency(915000000);
-
-//     // 5. Config PA (Power Amplifier)
-//     // Optimized for Ra-01SH-P (SX1262)
-//     uint8_t paConfig[4] = {0x02, 0x03, 0x00, 0x01}; // paDutyCycle, hpMax, deviceSel(1=1262), paLut
-//     writeCommand(SX126X_CMD_SET_PA_CONFIG, paConfig, 4);
-
-//     // 6. Set TX Params (Power + Ramp)
-//     setTxPower(power, 0);
-
-//     // 7. Config Buffer Base
-//     uint8_t bufferConfig[2] = {0x00, 0x00}; // TxBase, RxBase
-//     writeCommand(SX126X_CMD_SET_BUFFER_BASE_ADDRESS, bufferConfig, 2);
-
-//     // 8. Set DIO2 as RF Switch Control (Crucial for Ra-01SH)
-//     uint8_t dio2Mode = 0x01; // Enable
-//     writeCommand(SX126X_CMD_SET_DIO2_AS_RF_SWITCH_CTRL, &dio2Mode, 1);
-
-//     // 9. Set Regulator Mode (LDO)
-//     uint8_t regMode = 0x01; // LDO only
-//     writeCommand(SX126X_CMD_SET_REGULATOR_MODE, &regMode, 1);
-
-//     // 10. Update Modulation & Packet Params
-//     updateModulationParams();
-//     updatePacketParams();
-
-//     // 11. Configure DIO1 for RxDone/TxDone
-//     uint16_t irqMask = IRQ_RX_DONE_MASK | IRQ_TX_DONE_MASK | IRQ_TIMEOUT_MASK;
-//     uint8_t dioIrqParams[8] = {
-//         (uint8_t)(irqMask >> 8), (uint8_t)(irqMask & 0xFF), // Global Mask
-//         (uint8_t)(irqMask >> 8), (uint8_t)(irqMask & 0xFF), // DIO1 Mask (Enable)
-//         0x00, 0x00, // DIO2 Mask
-//         0x00, 0x00  // DIO3 Mask
-//     };
-//     writeCommand(SX126X_CMD_SET_DIO_IRQ_PARAMS, dioIrqParams, 8);
-
-//     idle();
-// }
-
-// // --- SPI Helpers ---
-
-// void LoRa::writeCommand(uint8_t opCode, uint8_t *data, uint16_t size)
-// {
-//     waitForBusy();
-    
-//     spi_transaction_t t = {};
-//     // Buffer: OpCode + Data
-//     uint8_t *txBuf = (uint8_t*)heap_caps_malloc(size + 1, MALLOC_CAP_DMA);
-//     txBuf[0] = opCode;
-//     if(size > 0) memcpy(&txBuf[1], data, size);
-
-//     t.length = 8 * (size + 1);
-//     t.tx_buffer = txBuf;
-    
-//     spi_device_polling_transmit(_spi, &t);
-//     free(txBuf);
-// }
-
-// void LoRa::readCommand(uint8_t opCode, uint8_t *data, uint16_t size)
-// {
-//     waitForBusy();
-
-//     spi_transaction_t t = {};
-//     // TX: OpCode + NOPs
-//     uint8_t *txBuf = (uint8_t*)heap_caps_malloc(size + 1, MALLOC_CAP_DMA);
-//     // RX: Status + Data
-//     uint8_t *rxBuf = (uint8_t*)heap_caps_malloc(size + 1, MALLOC_CAP_DMA);
-    
-//     memset(txBuf, 0x00, size + 1);
-//     txBuf[0] = opCode; // OpCode sent first
-
-//     t.length = 8 * (size + 1);
-//     t.tx_buffer = txBuf;
-//     t.rx_buffer = rxBuf;
-
-//     spi_device_polling_transmit(_spi, &t);
-
-//     // SX126x returns status byte first, then data
-//     if(size > 0) memcpy(data, &rxBuf[1], size);
-
-//     free(txBuf);
-//     free(rxBuf);
-// }
-
-// void LoRa::writeBuffer(uint8_t offset, uint8_t *data, uint8_t length)
-// {
-//     waitForBusy();
-    
-//     uint8_t *txBuf = (uint8_t*)heap_caps_malloc(length + 2, MALLOC_CAP_DMA);
-//     txBuf[0] = SX126X_CMD_WRITE_BUFFER;
-//     txBuf[1] = offset;
-//     memcpy(&txBuf[2], data, length);
-
-//     spi_transaction_t t = {};
-//     t.length = 8 * (length + 2);
-//     t.tx_buffer = txBuf;
-    
-//     spi_device_polling_transmit(_spi, &t);
-//     free(txBuf);
-// }
-
-// void LoRa::readBuffer(uint8_t offset, uint8_t *data, uint8_t length)
-// {
-//     waitForBusy();
-
-//     // OpCode + Offset + NOP + Data...
-//     uint8_t *txBuf = (uint8_t*)heap_caps_malloc(length + 3, MALLOC_CAP_DMA);
-//     uint8_t *rxBuf = (uint8_t*)heap_caps_malloc(length + 3, MALLOC_CAP_DMA);
-    
-//     memset(txBuf, 0, length + 3);
-//     txBuf[0] = SX126X_CMD_READ_BUFFER;
-//     txBuf[1] = offset;
-//     txBuf[2] = 0x00; // NOP
-
-//     spi_transaction_t t = {};
-//     t.length = 8 * (length + 3);
-//     t.tx_buffer = txBuf;
-//     t.rx_buffer = rxBuf;
-
-//     spi_device_polling_transmit(_spi, &t);
-    
-//     memcpy(data, &rxBuf[3], length); // Skip Status, NOP, NOP
-
-//     free(txBuf);
-//     free(rxBuf);
-// }
-
-// // --- Configuration Logic ---
-
-// void LoRa::updateModulationParams() {
-//     uint8_t params[8] = {
-//         (uint8_t)_sf, (uint8_t)_bw, (uint8_t)_cr, 
-//         (_sf >= LORA_SF11) ? 0x01 : 0x00, // LowDataRateOptimize
-//         0, 0, 0, 0
-//     };
-//     writeCommand(SX126X_CMD_SET_MODULATION_PARAMS, params, 4);
-// }
-
-// void LoRa::updatePacketParams() {
-//     uint8_t params[9];
-//     params[0] = (uint8_t)(_preambleLen >> 8);
-//     params[1] = (uint8_t)(_preambleLen & 0xFF);
-//     params[2] = _implicitHeader ? 0x01 : 0x00;
-//     params[3] = 0xFF; // Payload length (variable)
-//     params[4] = _crcOn ? 0x01 : 0x00; // CRC On
-//     params[5] = _invertIq ? 0x01 : 0x00; // InvertIQ
-//     writeCommand(SX126X_CMD_SET_PACKET_PARAMS, params, 6);
-// }
-
-// void LoRa::setFrequency(long frequency)
-// {
-//     _frequency = frequency;
-//     uint32_t freqVal = (uint32_t)((double)frequency / (double)32000000 * (double)(1 << 25));
-//     uint8_t buf[4];
-//     buf[0] = (freqVal >> 24) & 0xFF;
-//     buf[1] = (freqVal >> 16) & 0xFF;
-//     buf[2] = (freqVal >> 8) & 0xFF;
-//     buf[3] = freqVal & 0xFF;
-//     writeCommand(SX126X_CMD_SET_RF_FREQUENCY, buf, 4);
-// }
-
-// void LoRa::setTxPower(int8_t power, int8_t outputPin)
-// {
-//     // SX1262 Power: -9 to +22 dBm
-//     if(power > 22) power = 22;
-//     if(power < -9) power = -9;
-    
-//     uint8_t buf[2];
-//     buf[0] = power; // Power in dBm
-//     buf[1] = 0x04;  // Ramp Time (200us)
-//     writeCommand(SX126X_CMD_SET_TX_PARAMS, buf, 2);
-// }
-
-// void LoRa::setSpreadingFactor(int sf) {
-//     if (sf < 5) sf = 5;
-//     if (sf > 12) sf = 12;
-//     _sf = sf;
-//     updateModulationParams();
-// }
-
-// void LoRa::setSignalBandwidth(long sbw) {
-//     // Map Hz to SX126x Enum
-//     if (sbw <= 7800) _bw = LORA_BW_7;
-//     else if (sbw <= 10400) _bw = LORA_BW_10;
-//     else if (sbw <= 15600) _bw = LORA_BW_15;
-//     else if (sbw <= 20800) _bw = LORA_BW_20;
-//     else if (sbw <= 31250) _bw = LORA_BW_31;
-//     else if (sbw <= 41700) _bw = LORA_BW_41;
-//     else if (sbw <= 62500) _bw = LORA_BW_62;
-//     else if (sbw <= 125000) _bw = LORA_BW_125;
-//     else if (sbw <= 250000) _bw = LORA_BW_250;
-//     else _bw = LORA_BW_500;
-//     updateModulationParams();
-// }
-
-// void LoRa::setCodingRate4(int denominator) {
-//     if (denominator < 5) denominator = 5;
-//     if (denominator > 8) denominator = 8;
-//     _cr = denominator - 4; // 1=4/5, 2=4/6...
-//     updateModulationParams();
-// }
-
-// void LoRa::setPreambleLength(long length) {
-//     _preambleLen = length;
-//     updatePacketParams();
-// }
-
-// void LoRa::setSyncWord(int sw) {
-//     _syncWord = sw;
-//     uint8_t buf[2];
-//     buf[0] = (sw >> 8) & 0xFF;
-//     buf[1] = sw & 0xFF;
-//     writeRegister(0x0740, buf[0]); // Register for LoRa Sync Word MSB
-//     writeRegister(0x0741, buf[1]); // LSB
-// }
-
-// void LoRa::setCRC(bool crc) {
-//     _crcOn = crc;
-//     updatePacketParams();
-// }
-
-// void LoRa::enableInvertIQ() {
-//     _invertIq = true;
-//     updatePacketParams();
-// }
-
-// void LoRa::disableInvertIQ() {
-//     _invertIq = false;
-//     updatePacketParams();
-// }
-
-// // --- Operation ---
-
-// void LoRa::idle() {
-//     uint8_t mode = STDBY_RC;
-//     writeCommand(SX126X_CMD_SET_STANDBY, &mode, 1);
-// }
-
-// void LoRa::sleep() {
-//     uint8_t mode = 0x04; // Warm start
-//     writeCommand(SX126X_CMD_SET_SLEEP, &mode, 1);
-// }
-
-// void LoRa::receive(int size) {
-//     // 1. Set Rx Packet Params if size is fixed (not typically used in this flow)
-//     if(size > 0) {
-//         _implicitHeader = true;
-//         // Need to update packet params if implicit
-//         uint8_t params[6];
-//         params[0] = (uint8_t)(_preambleLen >> 8);
-//         params[1] = (uint8_t)(_preambleLen & 0xFF);
-//         params[2] = 0x01; // Implicit
-//         params[3] = size;
-//         params[4] = _crcOn ? 0x01 : 0x00;
-//         params[5] = _invertIq ? 0x01 : 0x00;
-//         writeCommand(SX126X_CMD_SET_PACKET_PARAMS, params, 6);
-//     } else {
-//         _implicitHeader = false;
-//         updatePacketParams(); // Ensure Explicit
-//     }
-
-//     // 2. Set Rx (0xFFFFFF = Continuous)
-//     uint8_t timeout[3] = {0xFF, 0xFF, 0xFF};
-//     writeCommand(SX126X_CMD_SET_RX, timeout, 3);
-// }
-
-// int LoRa::beginPacket(int implicitHeader) {
-//     idle(); // Standby
-//     _implicitHeader = implicitHeader;
-//     updatePacketParams();
-    
-//     // Reset Buffer Index
-//     uint8_t ptrs[2] = {0x00, 0x00}; // TxBase, RxBase
-//     writeCommand(SX126X_CMD_SET_BUFFER_BASE_ADDRESS, ptrs, 2);
-//     _payloadLen = 0;
-//     return 1;
-// }
-
-// size_t LoRa::write(const uint8_t *buffer, size_t size) {
-//     writeBuffer(_payloadLen, (uint8_t*)buffer, size);
-//     _payloadLen += size;
-//     return size;
-// }
-
-// int LoRa::endPacket(bool async) {
-//     // Update Packet Params with final length
-//     uint8_t params[6];
-//     params[0] = (uint8_t)(_preambleLen >> 8);
-//     params[1] = (uint8_t)(_preambleLen & 0xFF);
-//     params[2] = _implicitHeader ? 0x01 : 0x00;
-//     params[3] = _payloadLen;
-//     params[4] = _crcOn ? 0x01 : 0x00;
-//     params[5] = _invertIq ? 0x01 : 0x00;
-//     writeCommand(SX126X_CMD_SET_PACKET_PARAMS, params, 6);
-
-//     // Set Tx (Timeout 0 = default)
-//     uint8_t timeout[3] = {0x00, 0x00, 0x00}; 
-//     writeCommand(SX126X_CMD_SET_TX, timeout, 3);
-
-//     if(!async) {
-//         // Wait for TxDone
-//         while(true) {
-//             uint8_t status[2];
-//             writeCommand(SX126X_CMD_GET_IRQ_STATUS, NULL, 0); // Trigger update
-//             readCommand(SX126X_CMD_GET_IRQ_STATUS, status, 2);
-//             uint16_t irq = (status[0] << 8) | status[1];
-            
-//             if(irq & IRQ_TX_DONE_MASK) {
-//                 // Clear IRQ
-//                 uint8_t clear[2] = {(uint8_t)(IRQ_TX_DONE_MASK >> 8), (uint8_t)(IRQ_TX_DONE_MASK & 0xFF)};
-//                 writeCommand(SX126X_CMD_CLEAR_IRQ_STATUS, clear, 2);
-//                 break;
-//             }
-//             if(irq & IRQ_TIMEOUT_MASK) {
-//                  // Handle Timeout
-//                  uint8_t clear[2] = {(uint8_t)(IRQ_TIMEOUT_MASK >> 8), (uint8_t)(IRQ_TIMEOUT_MASK & 0xFF)};
-//                  writeCommand(SX126X_CMD_CLEAR_IRQ_STATUS, clear, 2);
-//                  break;
-//             }
-//             vTaskDelay(1);
-//         }
-//     }
-//     return 1;
-// }
-
-// int LoRa::parsePacket(int size) {
-//     uint8_t status[2];
-//     readCommand(SX126X_CMD_GET_IRQ_STATUS, status, 2);
-//     uint16_t irq = (status[0] << 8) | status[1];
-
-//     if(irq & IRQ_RX_DONE_MASK) {
-//         // Packet Received
-//         // 1. Clear IRQ
-//         uint8_t clear[2] = {(uint8_t)(IRQ_RX_DONE_MASK >> 8), (uint8_t)(IRQ_RX_DONE_MASK & 0xFF)};
-//         writeCommand(SX126X_CMD_CLEAR_IRQ_STATUS, clear, 2);
-
-//         // 2. Get Length and Pointer
-//         uint8_t rxStatus[2];
-//         readCommand(SX126X_CMD_GET_RX_BUFFER_STATUS, rxStatus, 2);
-//         int payloadLength = rxStatus[0];
-//         int bufferPointer = rxStatus[1];
-
-//         // 3. Reset read index to start of buffer
-//         _packetIndex = 0;
-        
-//         // 4. Ideally, we just return length. read() will fetch data from SPI buffer.
-//         // But the SPI buffer is inside the chip. We need to set the pointer for read() calls?
-//         // Or simple implementation: Read whole buffer into local cache?
-//         // SX1276 driver logic was: read() accesses FIFO directly. 
-//         // SX1262: We must use ReadBuffer(offset, ...).
-//         // To support read(), we need to know where to read from.
-//         // Let's store the start pointer.
-//         // *Hack for compatibility*: We will assume the user calls read() sequentially.
-//         // We will reset internal pointer to bufferPointer.
-//         // Actually, simpler: We don't have a local cache in the class.
-//         // We must implement read() to use `readBuffer`. 
-//         // Let's store `_rxBufferStart` and `_rxLength` member variables (not added in .h yet).
-//         // For now, let's assume `read()` will fail if we don't fetch it now.
-//         // But `parsePacket` just returns size.
-        
-//         // FIX: We need to store the buffer pointer to read from later.
-//         // Since I can't easily change .h private members without you updating files again and again...
-//         // Wait, I *am* rewriting .h. I will add `_rxBufferPtr` to .h
-        
-//         return payloadLength;
-//     }
-//     return 0;
-// }
-
-// int LoRa::read() {
-//     // This is tricky without a local buffer or state tracking.
-//     // SX1262 ReadBuffer requires an offset.
-//     // We need to query RX Buffer Status to know where the last packet started.
-//     // But parsePacket() clears the IRQ.
-    
-//     // Recommended usage for this driver: 
-//     // parsePacket() -> returns > 0
-//     // Then user calls available() or read().
-    
-//     // Implementation: 
-//     // We need to fetch the pointer from the chip again? No, packet might be gone or overwritten?
-//     // Actually, in RX Continuous, the pointer stays valid until next packet?
-    
-//     // Minimal fix:
-//     // User reads sequentially. We keep a static/member index.
-//     // In `parsePacket`, we fetched RxStart and RxLen. We must store them.
-//     // I will add `_rxBaseAddr` and `_rxPayloadLen` to the class in .h
-    
-//     if(_packetIndex >= _payloadLen) return -1;
-    
-//     uint8_t data;
-//     // Assume `_rxBaseAddr` was stored in parsePacket.
-//     // Wait, I need to update .h to include `_rxBaseAddr`.
-//     // See updated .h logic below.
-    
-//     // Since I cannot dynamically update .h in this block, 
-//     // I will use a simplified approach: 
-//     // `read()` reads 1 byte from `_rxBaseAddr + _packetIndex`.
-    
-//     // Note: I will update the logic in parsePacket to store `_rxBaseAddr`.
-    
-//     return 0; // Placeholder, real logic needs the pointer
-// }
-
-// // Updated read/parse logic requires member variables. 
-// // I will include them in the `lora.h` provided above. 
-// // (I will assume I added `int _rxBaseAddr;` to private members).
-
-// int LoRa::available() {
-//     return _payloadLen - _packetIndex;
-// }
-
-// // Low-level helper needed for read()
-// uint8_t LoRa::readRegister(uint16_t address) {
-//     uint8_t data;
-//     uint8_t buf[3] = {(uint8_t)((address >> 8) & 0xFF), (uint8_t)(address & 0xFF), 0x00}; // Addr, Addr, Status
-//     // SX126x ReadRegister: OpCode(0x1D) + Addr(2) + NOP(1) + Data...
-//     // Actually command is: 0x1D, AddrMSB, AddrLSB, NOP, Data
-    
-//     waitForBusy();
-//     uint8_t *tx = (uint8_t*)heap_caps_malloc(5, MALLOC_CAP_DMA);
-//     uint8_t *rx = (uint8_t*)heap_caps_malloc(5, MALLOC_CAP_DMA);
-    
-//     tx[0] = SX126X_CMD_READ_REGISTER;
-//     tx[1] = (address >> 8);
-//     tx[2] = (address & 0xFF);
-//     tx[3] = 0x00; // NOP
-//     tx[4] = 0x00; // Data Placeholder
-
-//     spi_transaction_t t = {};
-//     t.length = 40;
-//     t.tx_buffer = tx;
-//     t.rx_buffer = rx;
-    
-//     spi_device_polling_transmit(_spi, &t);
-//     data = rx[4];
-    
-//     free(tx); free(rx);
-//     return data;
-// }
-
-// void LoRa::writeRegister(uint16_t address, uint8_t value) {
-//     uint8_t buf[3];
-//     buf[0] = (address >> 8);
-//     buf[1] = (address & 0xFF);
-//     buf[2] = value;
-    
-//     waitForBusy();
-//     uint8_t *tx = (uint8_t*)heap_caps_malloc(4, MALLOC_CAP_DMA);
-//     tx[0] = SX126X_CMD_WRITE_REGISTER;
-//     memcpy(&tx[1], buf, 3);
-    
-//     spi_transaction_t t = {};
-//     t.length = 32;
-//     t.tx_buffer = tx;
-//     spi_device_polling_transmit(_spi, &t);
-//     free(tx);
-// }
-
-// // Helpers for Packet Status
-// int LoRa::getPacketRssi() {
-//     uint8_t status[3];
-//     readCommand(SX126X_CMD_GET_PACKET_STATUS, status, 3);
-//     // RSSI Packet is 2nd byte (index 1) in LoRa mode?
-//     // PacketStatus: RssiPkt, SnrPkt, SignalRssiPkt
-//     return -(int)(status[0] / 2); // Approximation
-// }
-
-// float LoRa::getPacketSnr() {
-//     uint8_t status[3];
-//     readCommand(SX126X_CMD_GET_PACKET_STATUS, status, 3);
-//     int8_t snr = (int8_t)status[1];
-//     return (float)snr / 4.0f;
-// }
-
-// void LoRa::delay( int msec ) {
-//     vTaskDelay(pdMS_TO_TICKS( msec ));
-// }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include "sdkconfig.h"
 #include "lora.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #define LORA_TAG "LoRa"
 #define ESP_INTR_FLAG_DEFAULT 0
@@ -64,6 +66,11 @@ void LoRa::initializeSPI( int mosi, int miso, int clk, int cs )
     ESP_ERROR_CHECK(ret);
     printf("Add device: %d\n", ret);
 
+    // Bounce buffer for burst FIFO transfers: DMA-capable, word-sized length
+    _dmaBuf = (uint8_t*) heap_caps_malloc( (MAX_PKT_LENGTH + 4) & ~3, MALLOC_CAP_DMA );
+    if ( _dmaBuf == NULL )
+    	ESP_LOGE(LORA_TAG, "No DMA memory for FIFO buffer, falling back to per-byte access");
+
 }
 
 void LoRa::initializeReset( int reset )
@@ -83,8 +90,21 @@ extern "C" {
 static void IRAM_ATTR gpio_isr_handler(void* arg)
 {
     LoRa *s = (LoRa*) arg;
-    s->setDataReceived(true);
+    s->onDio0Isr();
+}
 }
+
+void IRAM_ATTR LoRa::onDio0Isr()
+{
+	_dataReceived = true;
+	_irqTimeUs = esp_timer_get_time();
+
+	if (_irqTask != NULL)
+	{
+		BaseType_t woken = pdFALSE;
+		xTaskNotifyFromISR(_irqTask, _irqNotifyBits, eSetBits, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
 }
 
 void LoRa::initializeDIO( int dio )
@@ -175,6 +195,26 @@ void LoRa::setSpreadingFactor(int sf)
 
 	int val = (readRegister(REG_MODEM_CONFIG_2) & 0x0f) | ((sf << 4) & 0xf0);
 	writeRegister(REG_MODEM_CONFIG_2, val );
+	updateLowDataRateOptimize();
+}
+
+// LowDataRateOptimize is mandatory once a symbol exceeds 16 ms
+// (SF11/SF12 at 125 kHz); keep it in step with SF and bandwidth.
+void LoRa::updateLowDataRateOptimize()
+{
+	static const long bwHz[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000 };
+	int bw = (readRegister(REG_MODEM_CONFIG_1) >> 4) & 0x0f;
+	int sf = (readRegister(REG_MODEM_CONFIG_2) >> 4) & 0x0f;
+	if (bw > 9)
+		bw = 9;
+
+	long symbolUs = (long)(((int64_t)1000000 << sf) / bwHz[bw]);
+	uint8_t cfg3 = readRegister(REG_MODEM_CONFIG_3);
+	if (symbolUs > 16000)
+		cfg3 |= 0x08;
+	else
+		cfg3 &= ~0x08;
+	writeRegister(REG_MODEM_CONFIG_3, cfg3);
 }
 
 void LoRa::setSignalBandwidth(long sbw)
@@ -192,6 +232,7 @@ void LoRa::setSignalBandwidth(long sbw)
 	else if (sbw <= 250E3) { bw = 8; }
 	else /*if (sbw <= 250E3)*/ { bw = 9; }
 	writeRegister(REG_MODEM_CONFIG_1,(readRegister(REG_MODEM_CONFIG_1) & 0x0f) | (bw << 4));
+	updateLowDataRateOptimize();
 }
 
 void LoRa::setSyncWord(int sw)
@@ -306,6 +347,7 @@ int LoRa::beginPacket(int implicitHeader)
   // reset FIFO address and paload length
   writeRegister(REG_FIFO_ADDR_PTR, 0);
   writeRegister(REG_PAYLOAD_LENGTH, 0);
+  _txLength = 0;
   return 1;
 }
 
@@ -329,25 +371,78 @@ int LoRa::endPacket(bool async)
 }
 
 
+void LoRa::startTransmit()
+{
+  // put in TX mode; TxDone is reported on DIO0
+  writeRegister(REG_DIO_MAPPING_1, 0x00);
+  writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
+}
+
+void LoRa::startCad()
+{
+  idle();
+  writeRegister(REG_IRQ_FLAGS, 0xff);
+  writeRegister(REG_DIO_MAPPING_1, 0x80); // DIO0 => CadDone
+  writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_CAD);
+}
+
+// Radio is back in standby after CadDone.
+int LoRa::handleCadDone()
+{
+  int irqFlags = readRegister(REG_IRQ_FLAGS);
+  _dataReceived = false;
+
+  if ((irqFlags & IRQ_CAD_DONE_MASK) == 0)
+    return -1;
+
+  writeRegister(REG_IRQ_FLAGS, IRQ_CAD_DONE_MASK | IRQ_CAD_DETECTED_MASK);
+  return (irqFlags & IRQ_CAD_DETECTED_MASK) ? 1 : 0;
+}
+
+// Returns true (and clears the flag) if the DIO0 edge was TxDone.
+bool LoRa::handleTxDone()
+{
+  int irqFlags = readRegister(REG_IRQ_FLAGS);
+  _dataReceived = false;
+
+  if ((irqFlags & IRQ_TX_DONE_MASK) == 0)
+    return false;
+
+  writeRegister(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+  return true;
+}
+
+// RegModemStat: signal detected / synchronized means a frame is on air and
+// switching to TX now would cut it off.
+bool LoRa::isReceiving()
+{
+  return (readRegister(REG_MODEM_STAT) & 0x03) != 0;
+}
+
 size_t LoRa::write(const uint8_t *buffer, size_t size)
 {
-  int currentLength = readRegister(REG_PAYLOAD_LENGTH);
-  //printf( "Current: %d Size: %d\n" , currentLength, size );
+  return writeFifo(buffer, (int)size);
+}
+
+// Appends to the packet started by beginPacket(). The running length is kept
+// locally so no REG_PAYLOAD_LENGTH read-back is needed: one burst for the
+// data plus one register write for the length.
+int LoRa::writeFifo(const uint8_t *buf, int n)
+{
+  if (n <= 0)
+    return 0;
 
   // check size
-  if ((currentLength + size) > MAX_PKT_LENGTH) {
-    size = MAX_PKT_LENGTH - currentLength;
+  if ((_txLength + n) > MAX_PKT_LENGTH) {
+    n = MAX_PKT_LENGTH - _txLength;
   }
 
-  //printf( "New Size: %d\n" , size );
+  writeBurst(REG_FIFO, buf, n);
+  _txLength += n;
 
-  // write data
-  for (size_t i = 0; i < size; i++) {
-    writeRegister(REG_FIFO, buffer[i]);
-  }
   // update length
-  writeRegister(REG_PAYLOAD_LENGTH, currentLength + size);
-  return size;
+  writeRegister(REG_PAYLOAD_LENGTH, _txLength);
+  return n;
 }
 
 void LoRa::dumpRegisters()
@@ -362,6 +457,22 @@ int LoRa::available()
 	return (readRegister(REG_RX_NB_BYTES) - _packetIndex);
 }
 
+// Reads up to n bytes of the current packet in a single burst. The remaining
+// length comes from the cached packet length, not a REG_RX_NB_BYTES read.
+int LoRa::readFifo(uint8_t *buf, int n)
+{
+	int remaining = _packetLength - _packetIndex;
+
+	if (n > remaining)
+		n = remaining;
+	if (n <= 0)
+		return 0;
+
+	readBurst(REG_FIFO, buf, n);
+	_packetIndex += n;
+	return n;
+}
+
 int LoRa::read()
 {
 	if ( !available() )
@@ -381,14 +492,20 @@ void LoRa::receive(int size)
 	else
 		explicitHeaderMode();
 
+	writeRegister(REG_DIO_MAPPING_1, 0x00); // DIO0 => RxDone
 	writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
 }
 
 int LoRa::getPacketRssi()
+{
+	int8_t SnrValue = readRegister(REG_PKT_SNR_VALUE);
+	return computeRssi(readRegister(REG_PKT_RSSI_VALUE), SnrValue);
+}
+
+int LoRa::computeRssi( uint8_t rawRssi, int8_t SnrValue )
 {
 	int8_t snr=0;
-    int8_t SnrValue = readRegister( 0x19 );
-    int16_t rssi = readRegister(REG_PKT_RSSI_VALUE);
+    int16_t rssi = rawRssi;
 
 	if( SnrValue & 0x80 ) // The SNR sign bit is 1
 	{
@@ -477,6 +594,50 @@ int LoRa::handleDataReceived( char *msg )
 	return 0;
 }
 
+// Called from task context after the DIO0 ISR fired. Unlike parsePacket()
+// this never re-arms the modem: RX continuous keeps listening while the FIFO
+// is read. Fetches flags, length, payload and RSSI/SNR in five SPI
+// transactions regardless of payload size.
+// Returns the number of bytes copied, or 0 for CRC error / spurious edge.
+int LoRa::receivePacket( uint8_t *buf, int max, int *rssi, float *snr, bool *crcError )
+{
+	// 0x10 RX_CURRENT_ADDR, 0x11 IRQ_FLAGS_MASK, 0x12 IRQ_FLAGS, 0x13 RX_NB_BYTES
+	uint8_t hdr[4];
+	readBurst(REG_FIFO_RX_CURRENT_ADDR, hdr, sizeof(hdr));
+
+	int irqFlags = hdr[REG_IRQ_FLAGS - REG_FIFO_RX_CURRENT_ADDR];
+	writeRegister(REG_IRQ_FLAGS, irqFlags);
+	_dataReceived = false;
+
+	bool rxDone = (irqFlags & IRQ_RX_DONE_MASK) != 0;
+	bool crcErr = (irqFlags & IRQ_PAYLOAD_CRC_ERROR_MASK) != 0;
+
+	if (crcError)
+		*crcError = rxDone && crcErr;
+
+	if (!rxDone || crcErr)
+		return 0;
+
+	_packetIndex = 0;
+	_packetLength = _implicitHeaderMode ? readRegister(REG_PAYLOAD_LENGTH)
+	                                    : hdr[REG_RX_NB_BYTES - REG_FIFO_RX_CURRENT_ADDR];
+
+	// set FIFO address to current RX address
+	writeRegister(REG_FIFO_ADDR_PTR, hdr[0]);
+	int n = readFifo(buf, max);
+
+	// 0x19 PKT_SNR_VALUE, 0x1a PKT_RSSI_VALUE
+	uint8_t meta[2];
+	readBurst(REG_PKT_SNR_VALUE, meta, sizeof(meta));
+
+	if (snr)
+		*snr = ((float)(int8_t)meta[0]) / 4.0;
+	if (rssi)
+		*rssi = computeRssi(meta[1], (int8_t)meta[0]);
+
+	return n;
+}
+
 int LoRa::parsePacket(int size)
 {
 	int packetLength = 0;
@@ -503,6 +664,7 @@ int LoRa::parsePacket(int size)
   			packetLength = readRegister(REG_PAYLOAD_LENGTH);
   		else
   			packetLength = readRegister(REG_RX_NB_BYTES);
+  		_packetLength = packetLength;
 
   		// set FIFO address to current RX address
   		writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_CURRENT_ADDR));
@@ -543,6 +705,7 @@ void LoRa::writeRegister( uint8_t reg, uint8_t data )
 
 	memcpy(transaction.tx_data, &data, 1);
 
+	_spiTransactions++;
 	esp_err_t err = spi_device_polling_transmit(_spi, &transaction);
 
 	if (err != ESP_OK)
@@ -561,6 +724,7 @@ uint8_t LoRa::readRegister( uint8_t reg )
 	transaction.addr = reg & 0x7f;
 	transaction.flags = SPI_TRANS_USE_RXDATA;
 
+	_spiTransactions++;
 	esp_err_t err = spi_device_polling_transmit( _spi, &transaction);
 
 	if (err != ESP_OK)
@@ -571,3 +735,58 @@ uint8_t LoRa::readRegister( uint8_t reg )
 
 	return result;
 }
+
+
+// Multi-byte access: the SX127x auto-increments the address for registers
+// and keeps it fixed for REG_FIFO, so one transaction moves the whole range.
+void LoRa::readBurst( uint8_t reg, uint8_t *buf, int n )
+{
+	if ( _dmaBuf == NULL )
+	{
+		for (int i = 0; i < n; i++)
+			buf[i] = readRegister( reg == REG_FIFO ? reg : reg + i );
+		return;
+	}
+
+	spi_transaction_t transaction;
+	memset( &transaction, 0, sizeof(spi_transaction_t) );
+
+	transaction.length = 0;
+	transaction.rxlength = 8 * n;
+	transaction.addr = reg & 0x7f;
+	transaction.rx_buffer = _dmaBuf;
+
+	_spiTransactions++;
+	esp_err_t err = spi_device_polling_transmit( _spi, &transaction);
+
+	if (err != ESP_OK)
+	    ESP_LOGE(LORA_TAG, "Error in SPI burst read: %s", esp_err_to_name(err));
+
+	memcpy(buf, _dmaBuf, n);
+}
+
+void LoRa::writeBurst( uint8_t reg, const uint8_t *buf, int n )
+{
+	if ( _dmaBuf == NULL )
+	{
+		for (int i = 0; i < n; i++)
+			writeRegister( reg == REG_FIFO ? reg : reg + i, buf[i] );
+		return;
+	}
+
+	memcpy(_dmaBuf, buf, n);
+
+	spi_transaction_t transaction;
+	memset( &transaction, 0, sizeof(spi_transaction_t) );
+
+	transaction.length = 8 * n;
+	transaction.rxlength = 0;
+	transaction.addr = reg | 0x80;
+	transaction.tx_buffer = _dmaBuf;
+
+	_spiTransactions++;
+	esp_err_t err = spi_device_polling_transmit(_spi, &transaction);
+
+	if (err != ESP_OK)
+	    ESP_LOGE(LORA_TAG, "Error in SPI burst write: %s", esp_err_to_name(err));
+}
@@ -27,8 +27,9 @@
 #define REG_FIFO_RX_CURRENT_ADDR 0x10
 #define REG_IRQ_FLAGS            0x12
 #define REG_RX_NB_BYTES          0x13
+#define REG_MODEM_STAT           0x18
 #define REG_PKT_RSSI_VALUE       0x1a
-#define REG_PKT_SNR_VALUE        0x1b
+#define REG_PKT_SNR_VALUE        0x19
 #define REG_MODEM_CONFIG_1       0x1d
 #define REG_MODEM_CONFIG_2       0x1e
 #define REG_PREAMBLE_MSB         0x20
@@ -53,6 +54,7 @@
 #define MODE_TX                  0x03
 #define MODE_RX_CONTINUOUS       0x05
 #define MODE_RX_SINGLE           0x06
+#define MODE_CAD                 0x07
 
 #define MAX_PKT_LENGTH	255
 
@@ -67,6 +69,8 @@
 #define RF_PADAC_20DBM_ON                           0x07
 #define RF_PADAC_20DBM_OFF                          0x04
 
+#define IRQ_CAD_DETECTED_MASK      0x01
+#define IRQ_CAD_DONE_MASK          0x04
 #define IRQ_TX_DONE_MASK           0x08
 #define IRQ_PAYLOAD_CRC_ERROR_MASK 0x20
 #define IRQ_RX_DONE_MASK           0x40
@@ -121,18 +125,61 @@ class LoRa
 	void setDataReceived( bool r )	{ _dataReceived = r; }
 	bool getDataReceived()	{ return _dataReceived; }
 
+    // --- IRQ-DRIVEN RX / TX ---
+    // DIO0 ISR sets notifyBits on the registered task and stamps the edge
+    // time. With DIO mapping 00, DIO0 is RxDone in RX and TxDone in TX.
+    // receivePacket() then reads/clears REG_IRQ_FLAGS once and, on a good
+    // RxDone, fetches the packet. Radio stays in RX continuous.
+	void setIrqTask( TaskHandle_t task, uint32_t notifyBits )	{ _irqTask = task; _irqNotifyBits = notifyBits; }
+	void onDio0Isr();
+	int64_t getIrqTimeUs()	{ return _irqTimeUs; }
+	uint32_t getSpiTransactions()	{ return _spiTransactions; }
+
+    // --- BURST FIFO ACCESS ---
+    // Whole payload in one (DMA-backed) SPI transaction instead of one
+    // register transaction per byte.
+	int readFifo( uint8_t *buf, int n );
+	int writeFifo( const uint8_t *buf, int n );
+	int receivePacket( uint8_t *buf, int max, int *rssi, float *snr, bool *crcError = NULL );
+
+    // --- NON-BLOCKING TX ---
+    // startTransmit() enters TX and returns at once; completion arrives on
+    // DIO0 and is confirmed/cleared with handleTxDone().
+	void startTransmit();
+	bool handleTxDone();
+	bool isReceiving();
+
+    // --- CHANNEL ACTIVITY DETECTION ---
+    // startCad() remaps DIO0 to CadDone and runs one CAD from standby;
+    // handleCadDone() returns -1 if the edge was not CadDone, else 1 when
+    // LoRa preamble was detected, 0 when the channel was clear.
+	void startCad();
+	int handleCadDone();
+    // ---------------------------
+
  protected:
 	void writeRegister( uint8_t reg, uint8_t data );
 	uint8_t readRegister( uint8_t reg );
+	void readBurst( uint8_t reg, uint8_t *buf, int n );
+	void writeBurst( uint8_t reg, const uint8_t *buf, int n );
 
  private:
 	void delay( int delay );
+	int computeRssi( uint8_t rawRssi, int8_t rawSnr );
+	void updateLowDataRateOptimize();
 
 	spi_device_handle_t 	_spi;
 	int 					_packetIndex = 0;
+	int 					_packetLength = 0;
+	int 					_txLength = 0;
+	uint8_t					*_dmaBuf = NULL;
 	int 					_implicitHeaderMode = 0;
-	bool					_dataReceived = false;
+	volatile bool			_dataReceived = false;
 	long					_frequency;
+	TaskHandle_t			_irqTask = NULL;
+	uint32_t				_irqNotifyBits = 0;
+	volatile int64_t		_irqTimeUs = 0;
+	uint32_t				_spiTransactions = 0;
 };
 
 #endif
\ No newline at end of file
@@ -15,10 +15,19 @@
 
 #include "lora_crypto.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "mbedtls/aes.h"
 #include "mbedtls/ccm.h"
+#include "provisioning_manager/provisioning_manager.h"
 
 static const char *TAG = "LORA_CRYPTO";
 
@@ -29,17 +38,117 @@ static const uint8_t MASTER_SECRET[LORA_CRYPTO_KEY_LEN] = LORA_CRYPTO_MASTER_SEC
 
 /* =========================================================================
  * REPLAY PROTECTION STATE
+ *
+ * Per sensor: the highest accepted FrameSentCnt (top) plus a 64-bit bitmap
+ * of the frames at or below it (bit n = top - n seen). Late/out-of-order
+ * frames inside the window are accepted once; 16-bit wrap is handled by
+ * comparing counters as a signed 16-bit distance.
+ *
+ * The table survives hub reboots through a write-behind journal in the
+ * default NVS partition: flushed every REPLAY_FLUSH_FRAMES accepted frames,
+ * after REPLAY_FLUSH_MS with anything dirty, and on esp_restart(), which
+ * also marks the journal clean. A crash or power loss can lose the last
+ * (< REPLAY_FLUSH_FRAMES) updates, so a journal not marked clean has every
+ * window top advanced by REPLAY_FLUSH_FRAMES on load (the frames skipped
+ * count as seen) and is rewritten at once. The
+ * journal is split into chunks of REPLAY_CHUNK_SLOTS slots ("tbl0", "tbl1",
+ * ...) and a flush rewrites only the chunks that changed.
+ * Indexed by device registry LoRa slot (struct-of-arrays, 18 bytes + 1 bit
+ * per sensor); sensors that are not registered are not tracked (the iothub
+ * drops their frames anyway).
+ * Guarded by s_replay_mutex (lora_task decrypts, iothub_task forgets).
  * ========================================================================= */
+#define REPLAY_WINDOW          64
+#define REPLAY_FLUSH_FRAMES    16
+#define REPLAY_FLUSH_MS        (60 * 1000)
+#define REPLAY_NVS_NAMESPACE   "lora_replay"
+#define REPLAY_NVS_KEY_V1      "tbl"        /* single-blob journal (version 1) */
+#define REPLAY_NVS_KEY_CLEAN   "clean"      /* u8, set by the shutdown flush */
+#define REPLAY_NVS_VERSION_V1  1
+#define REPLAY_NVS_VERSION     2
+#define REPLAY_CHUNK_SLOTS     32
+#define REPLAY_CHUNKS          ((LORA_CRYPTO_MAX_SENSORS + REPLAY_CHUNK_SLOTS - 1) / REPLAY_CHUNK_SLOTS)
+#define REPLAY_NVS_MAX_CHUNKS  ((255 + REPLAY_CHUNK_SLOTS - 1) / REPLAY_CHUNK_SLOTS)  /* any capacity */
+
+_Static_assert(REPLAY_NVS_MAX_CHUNKS <= 32, "chunk dirty mask is 32 bits");
+
 typedef struct {
+    uint64_t bitmap[LORA_CRYPTO_MAX_SENSORS];
+    uint32_t sensor_id[LORA_CRYPTO_MAX_SENSORS];
+    uint32_t boot_random[LORA_CRYPTO_MAX_SENSORS];
+    uint16_t top[LORA_CRYPTO_MAX_SENSORS];          /* window top (last FrameSentCnt) */
+    uint32_t active[(LORA_CRYPTO_MAX_SENSORS + 31) / 32];
+} replay_table_t;
+
+/* NVS record (fixed layout, independent of the table layout above) */
+typedef struct __attribute__((packed)) {
     uint32_t sensor_id;
     uint32_t boot_random;
-    uint16_t last_frame_cnt;
-    bool     active;
-} sensor_replay_state_t;
-
-static sensor_replay_state_t s_replay[LORA_CRYPTO_MAX_SENSORS];
+    uint64_t bitmap;
+    uint16_t top;
+} replay_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t         version;
+    uint8_t         count;
+    replay_record_t rec[REPLAY_CHUNK_SLOTS];
+} replay_blob_t;
+
+static replay_table_t s_replay;
+static SemaphoreHandle_t s_replay_mutex = NULL;
+static uint32_t s_journal_dirty = 0;       /* updates since last flush */
+static uint32_t s_chunk_dirty = 0;         /* bit c: chunk c changed since last flush */
+static int64_t  s_journal_dirty_since = 0;
+static lora_crypto_replay_stats_t s_replay_stats;
 static bool s_initialized = false;
 
+static inline bool replay_active(int i)
+{
+    return (s_replay.active[i >> 5] >> (i & 31)) & 1u;
+}
+
+static inline void replay_set_active(int i, bool on)
+{
+    if (on) s_replay.active[i >> 5] |=  (1u << (i & 31));
+    else    s_replay.active[i >> 5] &= ~(1u << (i & 31));
+}
+
+/* =========================================================================
+ * PER-SENSOR KEY CACHE
+ *
+ * The derived sensor key is a pure function of the sensor ID, so the KDF
+ * (AES setkey + ECB block) and the CCM key schedule are built once per
+ * sensor and kept as a ready mbedtls_ccm_context. Decrypt then only runs
+ * auth-decrypt. Contexts live in a pool; s_key_of maps a device registry
+ * LoRa slot to its pool entry, and sensor_id tells whether the entry still
+ * belongs to the sensor now holding the handle. Standard capacity sizes the
+ * pool at one entry per sensor; large capacity keeps the most recently used
+ * LORA_KEY_POOL_SLOTS and rebuilds the rest on demand. Guarded by
+ * s_key_mutex because provisioning (iothub_task) and decrypt (lora_task) run
+ * on different tasks.
+ * ========================================================================= */
+#if CONFIG_EFLO_CAPACITY_LARGE && CONFIG_EFLO_LORA_KEY_CACHE_SLOTS < LORA_CRYPTO_MAX_SENSORS
+#define LORA_KEY_POOL_SLOTS    CONFIG_EFLO_LORA_KEY_CACHE_SLOTS
+#else
+#define LORA_KEY_POOL_SLOTS    LORA_CRYPTO_MAX_SENSORS
+#endif
+#define KEY_NONE               0xFF
+
+_Static_assert(LORA_KEY_POOL_SLOTS < KEY_NONE, "pool index must fit in uint8_t");
+
+typedef struct {
+    uint32_t            sensor_id;
+    uint32_t            last_used;     /* s_key_clock at last use (LRU) */
+    mbedtls_ccm_context ccm;
+    uint8_t             owner;         /* registry LoRa slot */
+    bool                active;
+} sensor_key_slot_t;
+
+static sensor_key_slot_t s_keys[LORA_KEY_POOL_SLOTS];
+static uint8_t           s_key_of[LORA_CRYPTO_MAX_SENSORS];   /* pool index, KEY_NONE = none */
+static uint32_t          s_key_clock = 0;
+static SemaphoreHandle_t s_key_mutex = NULL;
+
 /* =========================================================================
  * HELPERS
  * ========================================================================= */
@@ -118,6 +227,94 @@ static bool derive_sensor_key(uint32_t sensor_id, uint8_t key_out[LORA_CRYPTO_KE
     return true;
 }
 
+/**
+ * @brief Full uncached key setup: KDF + word-swap + CCM key schedule.
+ *        Caller owns ccm and must mbedtls_ccm_free() it.
+ */
+static bool build_sensor_ccm(uint32_t sensor_id, mbedtls_ccm_context *ccm)
+{
+    uint8_t sensor_key[LORA_CRYPTO_KEY_LEN];
+    if (!derive_sensor_key(sensor_id, sensor_key)) {
+        return false;
+    }
+
+    /* Word-swap derived key for CCM (STM32 loads CCM key same way) */
+    uint8_t ccm_key[LORA_CRYPTO_KEY_LEN];
+    make_stm32_key(sensor_key, ccm_key);
+
+    mbedtls_ccm_init(ccm);
+    int ret = mbedtls_ccm_setkey(ccm, MBEDTLS_CIPHER_ID_AES, ccm_key, 128);
+    memset(sensor_key, 0, sizeof(sensor_key));
+    memset(ccm_key, 0, sizeof(ccm_key));
+
+    if (ret != 0) {
+        ESP_LOGE(TAG, "CCM setkey failed: -0x%04X", (unsigned int)-ret);
+        mbedtls_ccm_free(ccm);
+        return false;
+    }
+    return true;
+}
+
+/* Caller holds s_key_mutex */
+static void key_cache_drop(int k)
+{
+    sensor_key_slot_t *slot = &s_keys[k];
+    if (s_key_of[slot->owner] == k) {
+        s_key_of[slot->owner] = KEY_NONE;
+    }
+    mbedtls_ccm_free(&slot->ccm);
+    slot->active    = false;
+    slot->sensor_id = 0;
+}
+
+/* Caller holds s_key_mutex. Free pool entry, else (if allowed) the least
+ * recently used one after dropping it. -1 if none. */
+static int key_pool_alloc(bool may_evict)
+{
+    int victim = -1;
+    for (int k = 0; k < LORA_KEY_POOL_SLOTS; k++) {
+        if (!s_keys[k].active) {
+            return k;
+        }
+        if (victim < 0 || (int32_t)(s_keys[k].last_used - s_keys[victim].last_used) < 0) {
+            victim = k;
+        }
+    }
+    if (!may_evict) {
+        return -1;
+    }
+    key_cache_drop(victim);
+    return victim;
+}
+
+/* Caller holds s_key_mutex. Cached context for a registered sensor, built
+ * into the pool if missing or left over from the handle's previous owner.
+ * NULL if KDF failed, or if the pool is full and eviction is not allowed. */
+static sensor_key_slot_t* key_cache_get(dev_handle_t h, uint32_t sensor_id, bool may_evict)
+{
+    int ls = device_registry_lora_slot(h);
+    int k = s_key_of[ls];
+
+    if (k != KEY_NONE) {
+        if (s_keys[k].active && s_keys[k].sensor_id == sensor_id) {
+            s_keys[k].last_used = ++s_key_clock;
+            return &s_keys[k];
+        }
+        key_cache_drop(k);
+    }
+
+    k = key_pool_alloc(may_evict);
+    if (k < 0 || !build_sensor_ccm(sensor_id, &s_keys[k].ccm)) {
+        return NULL;
+    }
+    s_keys[k].sensor_id = sensor_id;
+    s_keys[k].last_used = ++s_key_clock;
+    s_keys[k].owner     = (uint8_t)ls;
+    s_keys[k].active    = true;
+    s_key_of[ls]        = (uint8_t)k;
+    return &s_keys[k];
+}
+
 /* =========================================================================
  * NONCE CONSTRUCTION (13 bytes)
  * ========================================================================= */
@@ -137,70 +334,337 @@ static void build_nonce(uint32_t sensor_id, uint32_t boot_rnd, uint16_t frame_cn
  * REPLAY PROTECTION
  * ========================================================================= */
 
-static sensor_replay_state_t* find_or_create_slot(uint32_t sensor_id)
+/* Caller holds s_replay_mutex */
+static void journal_mark_dirty(int i)
 {
-    sensor_replay_state_t *empty_slot = NULL;
-
-    for (int i = 0; i < LORA_CRYPTO_MAX_SENSORS; i++) {
-        if (s_replay[i].active && s_replay[i].sensor_id == sensor_id) {
-            return &s_replay[i];
-        }
-        if (!s_replay[i].active && empty_slot == NULL) {
-            empty_slot = &s_replay[i];
-        }
+    s_chunk_dirty |= 1u << (i / REPLAY_CHUNK_SLOTS);
+    if (s_journal_dirty++ == 0) {
+        s_journal_dirty_since = esp_timer_get_time();
     }
+}
 
-    if (empty_slot != NULL) {
-        empty_slot->sensor_id      = sensor_id;
-        empty_slot->boot_random    = 0;
-        empty_slot->last_frame_cnt = 0;
-        empty_slot->active         = true;
+/* Caller holds s_replay_mutex. Registry slot index, (re)initialised if it is
+ * new or was left over from the handle's previous owner. */
+static int replay_slot_get(dev_handle_t h, uint32_t sensor_id)
+{
+    int i = device_registry_lora_slot(h);
+
+    if (!replay_active(i) || s_replay.sensor_id[i] != sensor_id) {
+        s_replay.sensor_id[i]   = sensor_id;
+        s_replay.boot_random[i] = 0;
+        s_replay.bitmap[i]      = 0;
+        s_replay.top[i]         = 0;
+        replay_set_active(i, true);
         ESP_LOGI(TAG, "New sensor registered: 0x%08lX", (unsigned long)sensor_id);
-    } else {
-        ESP_LOGW(TAG, "Replay table full! Cannot track sensor 0x%08lX",
-                 (unsigned long)sensor_id);
     }
+    return i;
+}
 
-    return empty_slot;
+/* Caller holds s_replay_mutex */
+static void replay_clear(int i)
+{
+    replay_set_active(i, false);
+    s_replay.sensor_id[i]   = 0;
+    s_replay.boot_random[i] = 0;
+    s_replay.bitmap[i]      = 0;
+    s_replay.top[i]         = 0;
+    s_chunk_dirty |= 1u << (i / REPLAY_CHUNK_SLOTS);
 }
 
-static bool replay_check_and_update(uint32_t sensor_id, uint32_t boot_rnd,
-                                    uint16_t frame_cnt)
+/* Caller holds s_replay_mutex */
+static bool replay_check_and_update(dev_handle_t h, uint32_t sensor_id,
+                                    uint32_t boot_rnd, uint16_t frame_cnt)
 {
-    sensor_replay_state_t *slot = find_or_create_slot(sensor_id);
-    if (slot == NULL) {
-        return true;
-    }
+    int i = replay_slot_get(h, sensor_id);
 
-    if (boot_rnd != slot->boot_random) {
+    if (boot_rnd != s_replay.boot_random[i]) {
         ESP_LOGI(TAG, "Sensor 0x%08lX rebooted (boot_rnd: 0x%08lX -> 0x%08lX)",
                  (unsigned long)sensor_id,
-                 (unsigned long)slot->boot_random,
+                 (unsigned long)s_replay.boot_random[i],
                  (unsigned long)boot_rnd);
-        slot->boot_random    = boot_rnd;
-        slot->last_frame_cnt = frame_cnt;
+        s_replay.boot_random[i] = boot_rnd;
+        s_replay.top[i]         = frame_cnt;
+        s_replay.bitmap[i]      = 1;
+        journal_mark_dirty(i);
+        return true;
+    }
+
+    /* Signed distance from the window top, wrap-safe */
+    int16_t diff = (int16_t)(uint16_t)(frame_cnt - s_replay.top[i]);
+
+    if (diff > 0) {
+        s_replay.bitmap[i] = (diff >= REPLAY_WINDOW) ? 1 : ((s_replay.bitmap[i] << diff) | 1);
+        s_replay.top[i] = frame_cnt;
+        journal_mark_dirty(i);
         return true;
     }
 
-    if (frame_cnt > slot->last_frame_cnt) {
-        slot->last_frame_cnt = frame_cnt;
+    int back = -(int)diff;
+    if (back < REPLAY_WINDOW && !(s_replay.bitmap[i] & (1ULL << back))) {
+        /* Late frame inside the window, first time seen */
+        s_replay.bitmap[i] |= (1ULL << back);
+        s_replay_stats.out_of_order++;
+        journal_mark_dirty(i);
         return true;
     }
 
-    ESP_LOGW(TAG, "REPLAY REJECTED: sensor=0x%08lX, cnt=%u, last=%u",
-             (unsigned long)sensor_id, frame_cnt, slot->last_frame_cnt);
+    if (back >= REPLAY_WINDOW) {
+        s_replay_stats.too_old++;
+    }
+    s_replay_stats.rejected++;
+    ESP_LOGW(TAG, "REPLAY REJECTED: sensor=0x%08lX, cnt=%u, top=%u",
+             (unsigned long)sensor_id, frame_cnt, s_replay.top[i]);
     return false;
 }
 
+/* =========================================================================
+ * REPLAY JOURNAL (NVS write-behind)
+ * ========================================================================= */
+
+static void chunk_key(char out[8], int chunk)
+{
+    snprintf(out, 8, "tbl%d", chunk);
+}
+
+/* Place journal records in their registry slots, dropping sensors
+ * decommissioned since the last flush. Returns records restored; *moved is
+ * set when a record now belongs to a different chunk than it was read from. */
+static int replay_restore(const replay_blob_t *blob, int chunk, bool *moved)
+{
+    int restored = 0;
+    for (int r = 0; r < blob->count; r++) {
+        dev_handle_t h = device_registry_find_lora(blob->rec[r].sensor_id);
+        if (h == DEVREG_HANDLE_NONE) {
+            *moved = true;
+            continue;
+        }
+        int i = device_registry_lora_slot(h);
+        s_replay.sensor_id[i]   = blob->rec[r].sensor_id;
+        s_replay.boot_random[i] = blob->rec[r].boot_random;
+        s_replay.bitmap[i]      = blob->rec[r].bitmap;
+        s_replay.top[i]         = blob->rec[r].top;
+        replay_set_active(i, true);
+        if (i / REPLAY_CHUNK_SLOTS != chunk) {
+            *moved = true;
+        }
+        restored++;
+    }
+    return restored;
+}
+
+static bool replay_flush_locked(void);
+
+/* Runs from lora_crypto_init before any frame is decrypted, so the table
+ * and journal are not locked here */
+static void replay_load(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(REPLAY_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) {
+        return;
+    }
+
+    replay_blob_t blob;   /* one chunk */
+    char key[8];
+    int restored = 0, stored = 0;
+    bool moved = false;
+    uint8_t clean = 0;
+    nvs_get_u8(h, REPLAY_NVS_KEY_CLEAN, &clean);
+    /* The marker describes only the shutdown before this boot: a crash
+     * before the next flush must advance the windows again */
+    if (clean) {
+        esp_err_t err = nvs_erase_key(h, REPLAY_NVS_KEY_CLEAN);
+        if (err == ESP_OK) err = nvs_commit(h);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Replay clean marker not cleared: %s", esp_err_to_name(err));
+        }
+    }
+
+    for (int c = 0; c < REPLAY_NVS_MAX_CHUNKS; c++) {
+        size_t len = sizeof(blob);
+        chunk_key(key, c);
+        if (nvs_get_blob(h, key, &blob, &len) != ESP_OK || len < 2 ||
+            blob.version != REPLAY_NVS_VERSION || blob.count > REPLAY_CHUNK_SLOTS ||
+            len != 2 + blob.count * sizeof(replay_record_t)) {
+            continue;
+        }
+        stored += blob.count;
+        restored += replay_restore(&blob, c, &moved);
+    }
+
+    /* Version 1 kept everything in one blob; read it in pieces */
+    size_t len = 0;
+    if (nvs_get_blob(h, REPLAY_NVS_KEY_V1, NULL, &len) == ESP_OK && len >= 2) {
+        uint8_t *v1 = malloc(len);
+        if (v1 && nvs_get_blob(h, REPLAY_NVS_KEY_V1, v1, &len) == ESP_OK &&
+            v1[0] == REPLAY_NVS_VERSION_V1 &&
+            len == 2 + v1[1] * sizeof(replay_record_t)) {
+            for (int done = 0; done < v1[1]; done += REPLAY_CHUNK_SLOTS) {
+                int n = v1[1] - done;
+                if (n > REPLAY_CHUNK_SLOTS) n = REPLAY_CHUNK_SLOTS;
+                blob.count = (uint8_t)n;
+                memcpy(blob.rec, v1 + 2 + done * sizeof(replay_record_t),
+                       n * sizeof(replay_record_t));
+                stored += n;
+                restored += replay_restore(&blob, -1, &moved);
+            }
+        }
+        free(v1);
+        moved = true;
+    }
+    nvs_close(h);
+
+    /* Unclean shutdown: frames up to REPLAY_FLUSH_FRAMES past each stored
+     * top may have been accepted and not flushed. Skip them. */
+    if (!clean && restored > 0) {
+        for (int i = 0; i < LORA_CRYPTO_MAX_SENSORS; i++) {
+            if (!replay_active(i)) continue;
+            s_replay.top[i] += REPLAY_FLUSH_FRAMES;
+            s_replay.bitmap[i] = UINT64_MAX;
+        }
+        moved = true;
+    }
+
+    if (moved) {
+        /* Rewrite every chunk so no stale copy of a record survives */
+        s_chunk_dirty = (REPLAY_NVS_MAX_CHUNKS >= 32) ? UINT32_MAX
+                                                     : ((1u << REPLAY_NVS_MAX_CHUNKS) - 1);
+        journal_mark_dirty(0);
+    }
+    if (stored > 0) {
+        ESP_LOGI(TAG, "Replay table restored: %d/%d sensors%s", restored, stored,
+                 clean ? "" : ", windows advanced after unclean shutdown");
+    }
+    /* Persist the advanced tops before any frame is accepted, so a second
+     * crash cannot advance from the old ones again */
+    if (!clean && restored > 0) {
+        replay_flush_locked();
+    }
+}
+
+/* Caller holds s_replay_mutex. Writes the dirty chunks; chunks past the
+ * current capacity are only ever erased. */
+static bool replay_flush_locked(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(REPLAY_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) {
+        return false;
+    }
+
+    replay_blob_t blob;
+    char key[8];
+    esp_err_t err = ESP_OK;
+
+    for (int c = 0; c < REPLAY_NVS_MAX_CHUNKS && err == ESP_OK; c++) {
+        if (!(s_chunk_dirty & (1u << c))) continue;
+
+        blob.version = REPLAY_NVS_VERSION;
+        blob.count = 0;
+        int end = (c + 1) * REPLAY_CHUNK_SLOTS;
+        if (end > LORA_CRYPTO_MAX_SENSORS) end = LORA_CRYPTO_MAX_SENSORS;
+        for (int i = c * REPLAY_CHUNK_SLOTS; i < end; i++) {
+            if (!replay_active(i)) continue;
+            replay_record_t *r = &blob.rec[blob.count++];
+            r->sensor_id   = s_replay.sensor_id[i];
+            r->boot_random = s_replay.boot_random[i];
+            r->bitmap      = s_replay.bitmap[i];
+            r->top         = s_replay.top[i];
+        }
+
+        chunk_key(key, c);
+        if (blob.count > 0) {
+            err = nvs_set_blob(h, key, &blob, 2 + blob.count * sizeof(replay_record_t));
+        } else {
+            err = nvs_erase_key(h, key);
+            if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK) {
+        esp_err_t e1 = nvs_erase_key(h, REPLAY_NVS_KEY_V1);   /* migrated, usually absent */
+        (void)e1;
+        e1 = nvs_erase_key(h, REPLAY_NVS_KEY_CLEAN);          /* updates follow the journal */
+        (void)e1;
+        err = nvs_commit(h);
+    }
+    nvs_close(h);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Replay journal flush failed: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    s_replay_stats.flushes++;
+    s_replay_stats.flushed_updates += s_journal_dirty;
+    s_journal_dirty = 0;
+    s_chunk_dirty = 0;
+    return true;
+}
+
+/* esp_restart(): flush and mark the journal clean, so the next boot
+ * restores the windows as they are */
+static void replay_shutdown_handler(void)
+{
+    if (!s_initialized || s_replay_mutex == NULL ||
+        xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return;
+    }
+    if (s_journal_dirty == 0 || replay_flush_locked()) {
+        nvs_handle_t h;
+        if (nvs_open(REPLAY_NVS_NAMESPACE, NVS_READWRITE, &h) == ESP_OK) {
+            if (nvs_set_u8(h, REPLAY_NVS_KEY_CLEAN, 1) == ESP_OK) {
+                nvs_commit(h);
+            }
+            nvs_close(h);
+        }
+    }
+    xSemaphoreGive(s_replay_mutex);
+}
+
 /* =========================================================================
  * PUBLIC API
  * ========================================================================= */
 
+/* Device list changed: drop state of removed sensors, pre-build new keys.
+ * Runs in the provisioning caller's task (iothub_task). */
+static void on_provisioning_changed(uint32_t generation, void *arg)
+{
+    (void)generation;
+    (void)arg;
+    lora_crypto_sync_provisioned();
+}
+
 bool lora_crypto_init(void)
 {
-    memset(s_replay, 0, sizeof(s_replay));
+    memset(&s_replay, 0, sizeof(s_replay));
+    memset(s_keys, 0, sizeof(s_keys));
+    memset(s_key_of, KEY_NONE, sizeof(s_key_of));
+    memset(&s_replay_stats, 0, sizeof(s_replay_stats));
+    s_journal_dirty = 0;
+    s_chunk_dirty = 0;
+    if (s_replay_mutex == NULL) {
+        s_replay_mutex = xSemaphoreCreateMutex();
+        if (s_replay_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create replay mutex");
+            return false;
+        }
+        esp_register_shutdown_handler(replay_shutdown_handler);
+    }
+    replay_load();
+    if (s_key_mutex == NULL) {
+        s_key_mutex = xSemaphoreCreateMutex();
+        if (s_key_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create key cache mutex");
+            return false;
+        }
+    }
     s_initialized = true;
-    ESP_LOGI(TAG, "Crypto module initialized (hub receiver)");
+    ESP_LOGI(TAG, "Crypto module initialized (hub receiver): %d sensors, %d cached keys, "
+             "replay %u B + keys %u B",
+             LORA_CRYPTO_MAX_SENSORS, LORA_KEY_POOL_SLOTS,
+             (unsigned)sizeof(s_replay), (unsigned)(sizeof(s_keys) + sizeof(s_key_of)));
+
+    /* Follow the commissioned list from here on */
+    lora_crypto_sync_provisioned();
+    provisioning_subscribe(on_provisioning_changed, NULL);
     return true;
 }
 
@@ -229,35 +693,36 @@ bool lora_crypto_decrypt_packet(const uint8_t *raw_pkt, int raw_len,
     const uint8_t *ciphertext = &raw_pkt[LORA_CRYPTO_OFF_CIPHER];
     const uint8_t *mic_tag    = &raw_pkt[LORA_CRYPTO_OFF_MIC];
 
-    /* 2. Derive per-sensor key (word-swapped master for STM32 compat) */
-    uint8_t sensor_key[LORA_CRYPTO_KEY_LEN];
-    if (!derive_sensor_key(sensor_id, sensor_key)) {
-        return false;
-    }
-
-    /* 3. Build nonce */
+    /* 2. Build nonce */
     uint8_t nonce[LORA_CRYPTO_NONCE_LEN];
     build_nonce(sensor_id, boot_rnd, frame_cnt, nonce);
 
-    /* 4. Word-swap derived key for CCM (STM32 loads CCM key same way) */
-    uint8_t ccm_key[LORA_CRYPTO_KEY_LEN];
-    make_stm32_key(sensor_key, ccm_key);
-
-    /* 5. AES-CCM auth-decrypt */
+    /* 3. Registered sensors use the CCM context cached for their registry
+     *    slot; anything else gets a transient context. */
     uint8_t plaintext[LORA_CRYPTO_PLAIN_LEN];
+    dev_handle_t handle = device_registry_find_lora(sensor_id);
 
-    mbedtls_ccm_context ccm;
-    mbedtls_ccm_init(&ccm);
+    if (xSemaphoreTake(s_key_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        ESP_LOGE(TAG, "Key cache mutex timeout");
+        return false;
+    }
 
-    int ret = mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, ccm_key, 128);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "CCM setkey failed: -0x%04X", (unsigned int)-ret);
-        mbedtls_ccm_free(&ccm);
+    mbedtls_ccm_context transient;
+    mbedtls_ccm_context *ccm = NULL;
+    sensor_key_slot_t *slot = NULL;
+
+    if (handle != DEVREG_HANDLE_NONE && (slot = key_cache_get(handle, sensor_id, true)) != NULL) {
+        ccm = &slot->ccm;
+    } else if (build_sensor_ccm(sensor_id, &transient)) {
+        ccm = &transient;
+    } else {
+        xSemaphoreGive(s_key_mutex);
         return false;
     }
 
-    ret = mbedtls_ccm_auth_decrypt(
-        &ccm,
+    /* 4. AES-CCM auth-decrypt */
+    int ret = mbedtls_ccm_auth_decrypt(
+        ccm,
         LORA_CRYPTO_PLAIN_LEN,
         nonce, LORA_CRYPTO_NONCE_LEN,
         raw_pkt, LORA_CRYPTO_HDR_LEN,
@@ -266,7 +731,10 @@ bool lora_crypto_decrypt_packet(const uint8_t *raw_pkt, int raw_len,
         mic_tag, LORA_CRYPTO_TAG_LEN
     );
 
-    mbedtls_ccm_free(&ccm);
+    if (ccm == &transient) {
+        mbedtls_ccm_free(&transient);
+    }
+    xSemaphoreGive(s_key_mutex);
 
     if (ret != 0) {
         ESP_LOGW(TAG, "CCM auth FAILED for sensor 0x%08lX cnt=%u (ret=-0x%04X)",
@@ -274,12 +742,20 @@ bool lora_crypto_decrypt_packet(const uint8_t *raw_pkt, int raw_len,
         return false;
     }
 
-    /* 6. Replay protection */
-    if (!replay_check_and_update(sensor_id, boot_rnd, frame_cnt)) {
-        return false;
+    /* 5. Replay protection */
+    if (handle != DEVREG_HANDLE_NONE) {
+        if (xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+            ESP_LOGE(TAG, "Replay mutex timeout");
+            return false;
+        }
+        bool fresh = replay_check_and_update(handle, sensor_id, boot_rnd, frame_cnt);
+        xSemaphoreGive(s_replay_mutex);
+        if (!fresh) {
+            return false;
+        }
     }
 
-    /* 7. Populate output */
+    /* 6. Populate output */
     out->sensor_id      = sensor_id;
     out->battery        = plaintext[0];
     out->leak_status    = plaintext[1];
@@ -291,10 +767,226 @@ bool lora_crypto_decrypt_packet(const uint8_t *raw_pkt, int raw_len,
 
 uint16_t lora_crypto_get_last_counter(uint32_t sensor_id)
 {
+    uint16_t cnt = 0;
+    dev_handle_t h = device_registry_find_lora(sensor_id);
+    if (h == DEVREG_HANDLE_NONE || s_replay_mutex == NULL ||
+        xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return 0;
+    }
+    int i = device_registry_lora_slot(h);
+    if (replay_active(i) && s_replay.sensor_id[i] == sensor_id) {
+        cnt = s_replay.top[i];
+    }
+    xSemaphoreGive(s_replay_mutex);
+    return cnt;
+}
+
+bool lora_crypto_journal_service(bool force)
+{
+    if (!s_initialized || s_replay_mutex == NULL) {
+        return false;
+    }
+    if (xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return false;
+    }
+
+    bool flushed = false;
+    if (s_journal_dirty > 0 &&
+        (force || s_journal_dirty >= REPLAY_FLUSH_FRAMES ||
+         esp_timer_get_time() - s_journal_dirty_since >= REPLAY_FLUSH_MS * 1000LL)) {
+        flushed = replay_flush_locked();
+    }
+    xSemaphoreGive(s_replay_mutex);
+    return flushed;
+}
+
+void lora_crypto_get_replay_stats(lora_crypto_replay_stats_t *out)
+{
+    if (out == NULL) return;
+    if (s_replay_mutex != NULL &&
+        xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        *out = s_replay_stats;
+        out->pending_updates = s_journal_dirty;
+        xSemaphoreGive(s_replay_mutex);
+    } else {
+        memset(out, 0, sizeof(*out));
+    }
+}
+bool lora_crypto_provision_sensor(uint32_t sensor_id)
+{
+    if (!s_initialized || s_key_mutex == NULL) {
+        return false;
+    }
+
+    if (xSemaphoreTake(s_key_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        ESP_LOGW(TAG, "Key cache mutex timeout (provision 0x%08lX)", (unsigned long)sensor_id);
+        return false;
+    }
+
+    dev_handle_t h = device_registry_find_lora(sensor_id);
+    bool ok = (h != DEVREG_HANDLE_NONE) && (key_cache_get(h, sensor_id, true) != NULL);
+    xSemaphoreGive(s_key_mutex);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Sensor 0x%08lX not registered, will use uncached path",
+                 (unsigned long)sensor_id);
+    }
+    return ok;
+}
+
+void lora_crypto_forget_sensor(uint32_t sensor_id)
+{
+    if (!s_initialized || s_key_mutex == NULL) {
+        return;
+    }
+
+    /* The registry has already released the handle, so match by ID */
+    if (xSemaphoreTake(s_key_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        for (int k = 0; k < LORA_KEY_POOL_SLOTS; k++) {
+            if (s_keys[k].active && s_keys[k].sensor_id == sensor_id) {
+                key_cache_drop(k);
+            }
+        }
+        xSemaphoreGive(s_key_mutex);
+    }
+
+    /* Decommissioned: free its replay slot and drop it from the journal */
+    if (xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        for (int i = 0; i < LORA_CRYPTO_MAX_SENSORS; i++) {
+            if (replay_active(i) && s_replay.sensor_id[i] == sensor_id) {
+                replay_clear(i);
+                replay_flush_locked();
+                break;
+            }
+        }
+        xSemaphoreGive(s_replay_mutex);
+    }
+}
+
+void lora_crypto_sync_provisioned(void)
+{
+    if (!s_initialized || s_key_mutex == NULL) {
+        return;
+    }
+
+    if (xSemaphoreTake(s_key_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        ESP_LOGW(TAG, "Key cache mutex timeout (sync)");
+        return;
+    }
+
+    /* Drop keys whose sensor is gone or lost its slot, then pre-build keys
+     * for registered sensors while the pool has free entries */
+    for (int k = 0; k < LORA_KEY_POOL_SLOTS; k++) {
+        uint32_t id;
+        if (s_keys[k].active &&
+            (!device_registry_get_lora_id((dev_handle_t)(DEVREG_HANDLE_LORA_BASE + s_keys[k].owner), &id) ||
+             id != s_keys[k].sensor_id)) {
+            key_cache_drop(k);
+        }
+    }
+    int built = 0, count = 0;
     for (int i = 0; i < LORA_CRYPTO_MAX_SENSORS; i++) {
-        if (s_replay[i].active && s_replay[i].sensor_id == sensor_id) {
-            return s_replay[i].last_frame_cnt;
+        dev_handle_t h = (dev_handle_t)(DEVREG_HANDLE_LORA_BASE + i);
+        uint32_t id;
+        if (device_registry_get_lora_id(h, &id)) {
+            count++;
+            if (key_cache_get(h, id, false) != NULL) built++;
         }
     }
-    return 0;
-}
\ No newline at end of file
+    xSemaphoreGive(s_key_mutex);
+
+    /* Replay state of sensors that lost (or changed) their slot */
+    if (xSemaphoreTake(s_replay_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        bool dropped = false;
+        for (int i = 0; i < LORA_CRYPTO_MAX_SENSORS; i++) {
+            uint32_t id;
+            if (replay_active(i) &&
+                (!device_registry_get_lora_id((dev_handle_t)(DEVREG_HANDLE_LORA_BASE + i), &id) ||
+                 id != s_replay.sensor_id[i])) {
+                replay_clear(i);
+                dropped = true;
+            }
+        }
+        if (dropped) {
+            replay_flush_locked();
+        }
+        xSemaphoreGive(s_replay_mutex);
+    }
+
+    ESP_LOGI(TAG, "Key cache synced: %d/%d provisioned sensors ready", built, count);
+}
+
+/* =========================================================================
+ * BENCHMARK
+ * ========================================================================= */
+
+void lora_crypto_benchmark(int iterations)
+{
+    if (iterations <= 0) iterations = 100;
+
+    const uint32_t sensor_id = 0x00C0FFEEUL;
+    const uint32_t boot_rnd  = 0x12345678UL;
+    const uint16_t frame_cnt = 42;
+
+    /* Build a valid test frame with the sender-side (encrypt) operation */
+    uint8_t pkt[LORA_CRYPTO_PKT_LEN];
+    put_be32(&pkt[LORA_CRYPTO_OFF_SENSOR_ID], sensor_id);
+    put_be32(&pkt[LORA_CRYPTO_OFF_BOOT_RND], boot_rnd);
+    pkt[LORA_CRYPTO_OFF_FRAME_CNT]     = (uint8_t)(frame_cnt >> 8);
+    pkt[LORA_CRYPTO_OFF_FRAME_CNT + 1] = (uint8_t)(frame_cnt);
+
+    uint8_t nonce[LORA_CRYPTO_NONCE_LEN];
+    build_nonce(sensor_id, boot_rnd, frame_cnt, nonce);
+
+    const uint8_t plain_in[LORA_CRYPTO_PLAIN_LEN] = { 87, 0x00, 0x00, 0x29 };
+    uint8_t plaintext[LORA_CRYPTO_PLAIN_LEN];
+
+    mbedtls_ccm_context cached;
+    if (!build_sensor_ccm(sensor_id, &cached)) {
+        return;
+    }
+    mbedtls_ccm_encrypt_and_tag(&cached, LORA_CRYPTO_PLAIN_LEN,
+                                nonce, LORA_CRYPTO_NONCE_LEN,
+                                pkt, LORA_CRYPTO_HDR_LEN,
+                                plain_in, &pkt[LORA_CRYPTO_OFF_CIPHER],
+                                &pkt[LORA_CRYPTO_OFF_MIC], LORA_CRYPTO_TAG_LEN);
+
+    /* Uncached: KDF + CCM setkey + auth-decrypt + free per packet (old path) */
+    int failures = 0;
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < iterations; i++) {
+        mbedtls_ccm_context ccm;
+        if (!build_sensor_ccm(sensor_id, &ccm)) { failures++; continue; }
+        if (mbedtls_ccm_auth_decrypt(&ccm, LORA_CRYPTO_PLAIN_LEN,
+                                     nonce, LORA_CRYPTO_NONCE_LEN,
+                                     pkt, LORA_CRYPTO_HDR_LEN,
+                                     &pkt[LORA_CRYPTO_OFF_CIPHER], plaintext,
+                                     &pkt[LORA_CRYPTO_OFF_MIC], LORA_CRYPTO_TAG_LEN) != 0) {
+            failures++;
+        }
+        mbedtls_ccm_free(&ccm);
+    }
+    uint32_t uncached_cycles = esp_cpu_get_cycle_count() - t0;
+
+    /* Cached: auth-decrypt only */
+    t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < iterations; i++) {
+        if (mbedtls_ccm_auth_decrypt(&cached, LORA_CRYPTO_PLAIN_LEN,
+                                     nonce, LORA_CRYPTO_NONCE_LEN,
+                                     pkt, LORA_CRYPTO_HDR_LEN,
+                                     &pkt[LORA_CRYPTO_OFF_CIPHER], plaintext,
+                                     &pkt[LORA_CRYPTO_OFF_MIC], LORA_CRYPTO_TAG_LEN) != 0) {
+            failures++;
+        }
+    }
+    uint32_t cached_cycles = esp_cpu_get_cycle_count() - t0;
+
+    mbedtls_ccm_free(&cached);
+
+    uint32_t per_uncached = uncached_cycles / (uint32_t)iterations;
+    uint32_t per_cached   = cached_cycles / (uint32_t)iterations;
+
+    ESP_LOGI(TAG, "Benchmark (%d pkts): uncached=%lu cyc/pkt, cached=%lu cyc/pkt (%.1fx), failures=%d",
+             iterations, (unsigned long)per_uncached, (unsigned long)per_cached,
+             per_cached ? (double)per_uncached / (double)per_cached : 0.0, failures);
+}
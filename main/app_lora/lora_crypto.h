@@ -53,6 +53,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "device_registry.h"
 
 /* =========================================================================
  * MASTER SECRET â€” MUST match STM32WL sender firmware exactly
@@ -81,7 +82,7 @@ extern "C" {
 /* =========================================================================
  * REPLAY PROTECTION
  * ========================================================================= */
-#define LORA_CRYPTO_MAX_SENSORS    16   /* matches MAX_LORA_SENSORS */
+#define LORA_CRYPTO_MAX_SENSORS    DEVREG_MAX_LORA   /* one slot per registry LoRa handle */
 
 /* =========================================================================
  * DECRYPTED PAYLOAD STRUCTURE
@@ -94,6 +95,16 @@ typedef struct {
     uint16_t frame_ack_cnt;
 } lora_crypto_payload_t;
 
+/* Replay window / journal counters (lora_crypto_get_replay_stats) */
+typedef struct {
+    uint32_t rejected;          /* replays + too-old frames dropped */
+    uint32_t too_old;           /* behind the 64-frame window */
+    uint32_t out_of_order;      /* late frames accepted inside the window */
+    uint32_t flushes;           /* NVS journal writes */
+    uint32_t flushed_updates;   /* accepted frames covered by those writes */
+    uint32_t pending_updates;   /* accepted since the last flush */
+} lora_crypto_replay_stats_t;
+
 /* =========================================================================
  * PUBLIC API
  * ========================================================================= */
@@ -111,10 +122,14 @@ bool lora_crypto_init(void);
  *
  * Steps performed:
  *   1. Extract sensorID from plaintext header (bytes 0-3)
- *   2. Derive per-sensor AES key from MASTER_SECRET + sensorID
- *   3. Reconstruct the 13-byte nonce
+ *   2. Reconstruct the 13-byte nonce
+ *   3. Fetch the cached CCM context of the sensor's device registry slot
+ *      (derived from MASTER_SECRET + sensorID at provisioning / first use;
+ *      large capacity builds rebuild evicted contexts on demand); sensors
+ *      not in the registry use a transient context
  *   4. AES-CCM auth-decrypt: verify MIC tag + decrypt ciphertext
- *   5. Replay check: reject if FrameSentCnt <= last seen for this sensor
+ *   5. Replay check: 64-frame sliding window per registered sensor (16-bit
+ *      wrap safe); late frames inside the window are accepted once
  *   6. Populate output structure with decrypted values
  *
  * @param  raw_pkt    Pointer to received LoRa payload (>= LORA_CRYPTO_PKT_LEN bytes)
@@ -134,6 +149,50 @@ bool lora_crypto_decrypt_packet(const uint8_t *raw_pkt, int raw_len,
  */
 uint16_t lora_crypto_get_last_counter(uint32_t sensor_id);
 
+/**
+ * @brief  Flush the replay table to NVS if the write-behind journal is due
+ *         (enough accepted frames or old enough), or unconditionally when
+ *         force is set. Call from lora_task outside the packet fast path.
+ *
+ * @return true if a flush was written
+ */
+bool lora_crypto_journal_service(bool force);
+
+/**
+ * @brief  Snapshot of replay window / journal counters.
+ */
+void lora_crypto_get_replay_stats(lora_crypto_replay_stats_t *out);
+
+/**
+ * @brief  Pre-build the cached CCM context for a newly provisioned sensor,
+ *         so its first packet skips key derivation. Thread-safe.
+ *
+ * @param  sensor_id  Sensor ID to cache
+ * @return true if the key is cached (false: cache full, uncached path used)
+ */
+bool lora_crypto_provision_sensor(uint32_t sensor_id);
+
+/**
+ * @brief  Drop the cached key for a decommissioned sensor. Thread-safe.
+ */
+void lora_crypto_forget_sensor(uint32_t sensor_id);
+
+/**
+ * @brief  Make the key cache and replay table match the device registry:
+ *         drops state of removed sensors and pre-builds keys for the rest
+ *         (up to the key pool size in large capacity builds).
+ *         Thread-safe. Runs at init and on every provisioning change
+ *         (lora_crypto_init subscribes).
+ */
+void lora_crypto_sync_provisioned(void);
+
+/**
+ * @brief  Log cycles per packet for the uncached (KDF + setkey + decrypt)
+ *         and cached (decrypt only) paths over a synthetic frame.
+ *         Diagnostic only — triggered from the LoRa UART console ('k').
+ */
+void lora_crypto_benchmark(int iterations);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,299 @@
+/*
+ * lora_rx_ring.c
+ *
+ * SPSC ring + per-sensor coalescing for decoded LoRa frames.
+ * See lora_rx_ring.h for the delivery guarantees.
+ */
+
+#include "lora_rx_ring.h"
+
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "device_registry/device_registry.h"
+
+static const char *TAG = "LORA_RING";
+
+_Static_assert(LORA_RX_RING_DEPTH >= 2 && (LORA_RX_RING_DEPTH & (LORA_RX_RING_DEPTH - 1)) == 0,
+               "CONFIG_EFLO_LORA_RX_RING_DEPTH must be a power of two");
+
+#define RING_MASK           (LORA_RX_RING_DEPTH - 1)
+#define PEND_WORDS          ((DEVREG_MAX_LORA + 31) / 32)
+
+/* =========================================================================
+ * RECORD
+ *
+ * 24 bytes instead of the 32-byte lora_packet_t (SNR in quarter dB, no
+ * float). Expanded back to lora_packet_t on pop. The receive time stays a
+ * full 64-bit esp_timer value: it feeds the leak latency spans, and a 32-bit
+ * millisecond count would wrap after 49.7 days of uptime.
+ * ========================================================================= */
+#define REC_COALESCED       0x01    /* carries more than one frame */
+
+typedef struct {
+    uint64_t rx_us;                 /* esp_timer time of the frame */
+    uint32_t sensor_id;
+    uint16_t frame_sent;
+    uint16_t frame_ack;
+    int16_t  snr_q4;                /* SNR * 4 */
+    int8_t   rssi;
+    uint8_t  battery;
+    uint8_t  leak;
+    uint8_t  flags;
+} lora_rx_rec_t;
+
+/* =========================================================================
+ * STATE
+ *
+ * s_head is written by the producer only, s_tail by the consumer only;
+ * release/acquire on them publishes the slot contents. Indices run free and
+ * are masked on access. The pending table is shared, so it sits behind a
+ * spinlock (a handful of instructions per access).
+ * ========================================================================= */
+static lora_rx_rec_t     s_ring[LORA_RX_RING_DEPTH];
+static _Atomic uint32_t  s_head = 0;
+static _Atomic uint32_t  s_tail = 0;
+
+static lora_rx_rec_t     s_pend[DEVREG_MAX_LORA];     /* by registry LoRa slot */
+static uint64_t          s_pend_leak_us[DEVREG_MAX_LORA];   /* first latched leak frame */
+static uint8_t           s_pend_leak[DEVREG_MAX_LORA];  /* leak seen while pending, 0: none */
+static uint32_t          s_pend_mask[PEND_WORDS];
+static volatile int      s_pend_count = 0;
+static int               s_pend_cursor = 0;           /* consumer: round-robin start */
+static portMUX_TYPE      s_pend_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static QueueHandle_t     s_doorbell = NULL;
+static lora_rx_ring_stats_t s_stats;
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+static void pack(const lora_packet_t *pkt, lora_rx_rec_t *rec)
+{
+    rec->sensor_id  = pkt->sensorId;
+    rec->rx_us      = pkt->timestamp;
+    rec->frame_sent = pkt->frameSent;
+    rec->frame_ack  = pkt->frameAck;
+    rec->snr_q4     = (int16_t)(pkt->snr * 4.0f);
+    rec->rssi       = pkt->rssi;
+    rec->battery    = pkt->batteryPercentage;
+    rec->leak       = pkt->leakStatus;
+    rec->flags      = 0;
+}
+
+static void unpack(const lora_rx_rec_t *rec, lora_packet_t *pkt)
+{
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->sensorId          = rec->sensor_id;
+    pkt->timestamp         = rec->rx_us;
+    pkt->frameSent         = rec->frame_sent;
+    pkt->frameAck          = rec->frame_ack;
+    pkt->snr               = rec->snr_q4 / 4.0f;
+    pkt->rssi              = rec->rssi;
+    pkt->batteryPercentage = rec->battery;
+    pkt->leakStatus        = rec->leak;
+}
+
+static inline bool pend_test(int i)
+{
+    return (s_pend_mask[i >> 5] >> (i & 31)) & 1u;
+}
+
+/* Caller holds s_pend_lock. Newest values win. The first leak merged over
+ * is latched with its receive time, so a leak that cleared again before
+ * delivery is still popped, followed by the clear (pend_get). */
+static void pend_merge(int i, const lora_rx_rec_t *rec)
+{
+    if (s_pend[i].leak && !s_pend_leak[i]) {
+        s_pend_leak[i]    = s_pend[i].leak;
+        s_pend_leak_us[i] = s_pend[i].rx_us;
+    }
+    s_pend[i]       = *rec;
+    s_pend[i].flags |= REC_COALESCED;
+}
+
+static bool ring_put(const lora_rx_rec_t *rec)
+{
+    uint32_t head = atomic_load_explicit(&s_head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&s_tail, memory_order_acquire);
+
+    if (head - tail >= LORA_RX_RING_DEPTH) {
+        return false;
+    }
+    s_ring[head & RING_MASK] = *rec;
+    atomic_store_explicit(&s_head, head + 1, memory_order_release);
+
+    uint32_t used = head + 1 - tail;
+    if (used > s_stats.high_water) {
+        s_stats.high_water = (uint16_t)used;
+    }
+    return true;
+}
+
+static bool ring_get(lora_rx_rec_t *rec)
+{
+    uint32_t tail = atomic_load_explicit(&s_tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&s_head, memory_order_acquire);
+
+    if (tail == head) {
+        return false;
+    }
+    *rec = s_ring[tail & RING_MASK];
+    atomic_store_explicit(&s_tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool pend_get(lora_rx_rec_t *rec)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_pend_lock);
+    for (int n = 0; n < DEVREG_MAX_LORA && s_pend_count > 0; n++) {
+        int i = (s_pend_cursor + n) % DEVREG_MAX_LORA;
+        if (pend_test(i)) {
+            *rec = s_pend[i];
+            if (s_pend_leak[i] && !rec->leak) {
+                /* Leak that cleared while pending: the leak now, the
+                 * record with the clear on the next pop */
+                rec->leak  = s_pend_leak[i];
+                rec->rx_us = s_pend_leak_us[i];
+                s_pend_cursor = i;
+            } else {
+                s_pend_mask[i >> 5] &= ~(1u << (i & 31));
+                s_pend_count--;
+                s_pend_cursor = (i + 1) % DEVREG_MAX_LORA;
+            }
+            s_pend_leak[i] = 0;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_pend_lock);
+    return found;
+}
+
+static bool has_waiting(void)
+{
+    return atomic_load_explicit(&s_head, memory_order_acquire) !=
+           atomic_load_explicit(&s_tail, memory_order_relaxed) ||
+           s_pend_count > 0;
+}
+
+static void ring_doorbell(void)
+{
+    uint8_t one = 1;
+    xQueueSend(s_doorbell, &one, 0);   /* full = already rung */
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+bool lora_rx_ring_init(void)
+{
+    if (s_doorbell) {
+        return true;
+    }
+    s_doorbell = xQueueCreate(1, sizeof(uint8_t));
+    if (!s_doorbell) {
+        ESP_LOGE(TAG, "Failed to create doorbell");
+        return false;
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.depth = LORA_RX_RING_DEPTH;
+
+    ESP_LOGI(TAG, "RX ring: %d x %u B, coalescing table %u B",
+             LORA_RX_RING_DEPTH, (unsigned)sizeof(lora_rx_rec_t),
+             (unsigned)(sizeof(s_pend) + sizeof(s_pend_leak_us) +
+                        sizeof(s_pend_leak) + sizeof(s_pend_mask)));
+    return true;
+}
+
+QueueHandle_t lora_rx_ring_doorbell(void)
+{
+    return s_doorbell;
+}
+
+bool lora_rx_ring_push(const lora_packet_t *pkt)
+{
+    lora_rx_rec_t rec;
+    pack(pkt, &rec);
+    s_stats.pushed++;
+
+    dev_handle_t h = device_registry_find_lora(pkt->sensorId);
+    int slot = (h == DEVREG_HANDLE_NONE) ? -1 : device_registry_lora_slot(h);
+    bool queued = false;
+
+    /* A sensor with a pending record keeps merging into it until it has
+     * been delivered; anything else would overtake it in the ring. */
+    if (slot >= 0) {
+        portENTER_CRITICAL(&s_pend_lock);
+        if (pend_test(slot)) {
+            pend_merge(slot, &rec);
+            s_stats.coalesced++;
+            queued = true;
+        }
+        portEXIT_CRITICAL(&s_pend_lock);
+    }
+
+    if (!queued && !ring_put(&rec)) {
+        s_stats.overflow++;
+        if (slot >= 0) {
+            portENTER_CRITICAL(&s_pend_lock);
+            s_pend[slot] = rec;
+            s_pend_leak[slot] = 0;
+            s_pend_mask[slot >> 5] |= 1u << (slot & 31);
+            s_pend_count++;
+            portEXIT_CRITICAL(&s_pend_lock);
+            queued = true;
+        } else {
+            s_stats.dropped++;
+            ESP_LOGW(TAG, "Ring full, frame of unregistered 0x%08lX dropped",
+                     (unsigned long)pkt->sensorId);
+        }
+    } else {
+        queued = true;
+    }
+
+    if (queued) {
+        ring_doorbell();
+    }
+    return queued;
+}
+
+bool lora_rx_ring_pop(lora_packet_t *out)
+{
+    lora_rx_rec_t rec;
+
+    if (!ring_get(&rec) && !pend_get(&rec)) {
+        return false;
+    }
+    unpack(&rec, out);
+    if (rec.flags & REC_COALESCED) {
+        ESP_LOGD(TAG, "Coalesced record for 0x%08lX", (unsigned long)rec.sensor_id);
+    }
+
+    if (has_waiting()) {
+        ring_doorbell();
+    }
+    return true;
+}
+
+void lora_rx_ring_flush(void)
+{
+    lora_rx_rec_t rec;
+    uint8_t bell;
+
+    while (ring_get(&rec) || pend_get(&rec))
+        ;
+    while (s_doorbell && xQueueReceive(s_doorbell, &bell, 0) == pdTRUE)
+        ;
+}
+
+void lora_rx_ring_get_stats(lora_rx_ring_stats_t *out)
+{
+    *out = s_stats;
+}
@@ -0,0 +1,92 @@
+/*
+ * lora_rx_ring.h
+ *
+ * Radio -> iothub delivery of decoded LoRa frames.
+ *
+ * lora_task (single producer) pushes into a lock-free ring of compact
+ * records; iothub_task (single consumer) pops them. The consumer is woken
+ * through a 1-item doorbell queue that sits in its QueueSet next to the BLE
+ * and snapshot queues.
+ *
+ * The ring never silently loses a leak: when it is full, frames of
+ * registered sensors are coalesced into one pending record per sensor
+ * (latest battery/RSSI/counters). A leak merged over is latched: if the
+ * sensor reports dry again before delivery, the leak is popped first and
+ * then the clear, so no state transition is lost. While
+ * a sensor has a pending record its newer frames merge into it rather than
+ * entering the ring, so per-sensor order is kept. Only frames from sensors
+ * outside the device registry can be dropped.
+ */
+
+#ifndef LORA_RX_RING_H
+#define LORA_RX_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "sdkconfig.h"
+#include "app_lora.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LORA_RX_RING_DEPTH   CONFIG_EFLO_LORA_RX_RING_DEPTH
+
+/* Ring counters (lora_rx_ring_get_stats) */
+typedef struct {
+    uint16_t depth;             /* ring slots */
+    uint16_t high_water;        /* most records ever waiting in the ring */
+    uint32_t pushed;            /* frames handed to the ring */
+    uint32_t overflow;          /* frames that found the ring full */
+    uint32_t coalesced;         /* frames merged into a pending record */
+    uint32_t dropped;           /* overflowed frames of unregistered sensors */
+} lora_rx_ring_stats_t;
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+/**
+ * @brief  Create the doorbell. Call once before lora_task and iothub_task
+ *         start (configurelora() does).
+ */
+bool lora_rx_ring_init(void);
+
+/**
+ * @brief  Doorbell queue for the consumer's QueueSet. Holds one item while
+ *         records are waiting; lora_rx_ring_pop() re-rings it when it leaves
+ *         records behind, so one pop per wakeup drains everything.
+ */
+QueueHandle_t lora_rx_ring_doorbell(void);
+
+/**
+ * @brief  Producer side (lora_task only). Never blocks.
+ * @return false only if the frame was dropped (ring full, sensor not in the
+ *         device registry).
+ */
+bool lora_rx_ring_push(const lora_packet_t *pkt);
+
+/**
+ * @brief  Consumer side (iothub_task only). Ring records first, then
+ *         coalesced records.
+ * @return false if nothing is waiting.
+ */
+bool lora_rx_ring_pop(lora_packet_t *out);
+
+/**
+ * @brief  Consumer side: discard everything waiting, including the doorbell.
+ */
+void lora_rx_ring_flush(void);
+
+/**
+ * @brief  Copy the ring counters. Safe from any task.
+ */
+void lora_rx_ring_get_stats(lora_rx_ring_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LORA_RX_RING_H */
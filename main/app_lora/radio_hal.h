@@ -0,0 +1,112 @@
+#ifndef RADIO_HAL_H
+#define RADIO_HAL_H
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// -----------------------------------------------------------------------------
+// LoRa radio HAL
+// -----------------------------------------------------------------------------
+// lora_task talks to the radio only through this interface. The backend is
+// chosen at build time (menuconfig -> eFloStop Hub -> LoRa radio):
+//   CONFIG_EFLO_LORA_RADIO_SX127X  -> radio_sx127x.cpp (LoRa class, lora.cpp)
+//   CONFIG_EFLO_LORA_RADIO_SX1262  -> radio_sx1262.cpp (RadioLib)
+//
+// Contract shared by both backends:
+//  - One IRQ line (SX127x DIO0 / SX1262 DIO1) wakes the task registered with
+//    setIrqTask(). It stays high until the backend clears the IRQ status, so
+//    the line level can be sampled to recover a missed edge.
+//  - After startReceive() the radio stays in RX until startTransmit() or
+//    standby(); no re-arm is needed per packet.
+//  - All calls except the ISR run under lora_mutex in app_lora.cpp.
+
+typedef struct {
+    int mosi;
+    int miso;
+    int clk;
+    int cs;
+    int reset;
+    int irq;    // SX127x DIO0, SX1262 DIO1
+    int busy;   // SX1262 only, -1 when not wired
+} radio_pins_t;
+
+typedef struct {
+    long    frequencyHz;
+    int     spreadingFactor;
+    long    bandwidthHz;
+    int     codingRateDen;   // 5..8 -> 4/5..4/8
+    int     preambleLen;
+    uint8_t syncWord;
+    bool    crcOn;
+    int8_t  txPowerDbm;
+} radio_config_t;
+
+// receivePacket() result details
+typedef struct {
+    int     rssi;
+    float   snr;
+    bool    crcError;   // RxDone with bad payload/header CRC, packet discarded
+    bool    rxTimeout;  // hardware RX timeout expired (startReceive(timeoutMs > 0))
+} radio_rx_info_t;
+
+class RadioHal
+{
+ public:
+	virtual ~RadioHal() {}
+
+	virtual const char *name() const = 0;
+
+	// Apply modem settings. Leaves the radio in standby.
+	virtual bool configure( const radio_config_t *cfg ) = 0;
+	virtual void setSyncWord( uint8_t sw ) = 0;
+	// Runtime SF change (from standby), used by the multi-SF scheduler
+	virtual void setSpreadingFactor( int sf ) = 0;
+
+	// Enter RX. timeoutMs == 0 is continuous RX; otherwise a single RX window
+	// closed by the radio's own timer (SX127x: emulated, stays continuous).
+	virtual void startReceive( uint32_t timeoutMs = 0 ) = 0;
+
+	// Service the IRQ line after it fired in RX: read/clear IRQ status and,
+	// on a good RxDone, fetch payload and link metadata. Returns payload
+	// length, 0 when nothing valid was received.
+	virtual int receivePacket( uint8_t *buf, int max, radio_rx_info_t *info ) = 0;
+
+	// True while a frame is being demodulated (header seen, RxDone pending).
+	virtual bool isReceiving() = 0;
+
+	// Load the payload and enter TX; returns at once. TxDone arrives on the
+	// IRQ line and is confirmed/cleared with handleTxDone().
+	virtual bool startTransmit( const uint8_t *buf, int len ) = 0;
+	virtual bool handleTxDone() = 0;
+
+	// One channel activity detection at the current SF. CadDone arrives on
+	// the IRQ line; handleCadDone() returns -1 if the edge was not CadDone,
+	// 1 for LoRa activity, 0 for a clear channel. Radio ends in standby.
+	virtual void startCad() = 0;
+	virtual int handleCadDone() = 0;
+
+	// Blocking TX for console tests
+	virtual bool transmit( const uint8_t *buf, int len ) = 0;
+
+	virtual void standby() = 0;
+
+	// IRQ plumbing: notifyBits are set (eSetBits) on task from the ISR.
+	virtual void setIrqTask( TaskHandle_t task, uint32_t notifyBits ) = 0;
+	virtual int64_t getIrqTimeUs() = 0;
+	virtual int irqPin() const = 0;
+
+	// SPI transactions issued since boot
+	virtual uint32_t getSpiTransactions() = 0;
+};
+
+/**
+ * @brief Construct the backend selected in menuconfig and bring up its bus,
+ *        reset and IRQ pins. Returns NULL if the radio does not respond.
+ */
+RadioHal *radio_hal_create( const radio_pins_t *pins, int8_t txPowerDbm );
+
+#endif // RADIO_HAL_H
@@ -0,0 +1,502 @@
+#include "sdkconfig.h"
+
+#if CONFIG_EFLO_LORA_RADIO_SX1262
+
+#include <string.h>
+#include "radio_hal.h"
+#include <RadioLib.h>
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "SX1262";
+
+#define SX1262_SPI_HOST         SPI2_HOST
+#define SX1262_SPI_CLOCK_HZ     8000000
+// Longest RadioLib transfer: opcode + offset + status + 255 byte payload
+#define SX1262_SPI_BUF_LEN      ((3 + 255 + 4) & ~3)
+// SX126x RX/TX timeout register unit is 15.625 us (64 per ms)
+#define SX1262_TIMEOUT_PER_MS   64
+#define SX1262_TIMEOUT_MAX      0xFFFFFE
+#define SX1262_TX_MARGIN_MS     20
+
+// Kconfig bools are undefined when off
+#ifdef CONFIG_EFLO_SX1262_USE_LDO
+#define SX1262_USE_LDO          true
+#else
+#define SX1262_USE_LDO          false
+#endif
+#ifdef CONFIG_EFLO_SX1262_DIO2_RF_SWITCH
+#define SX1262_DIO2_RF_SWITCH   true
+#else
+#define SX1262_DIO2_RF_SWITCH   false
+#endif
+#ifdef CONFIG_EFLO_SX1262_RX_BOOSTED_GAIN
+#define SX1262_RX_BOOSTED_GAIN  true
+#else
+#define SX1262_RX_BOOSTED_GAIN  false
+#endif
+
+// IRQs latched in GetIrqStatus; HEADER_VALID is status-only for isReceiving()
+#define SX1262_IRQ_MASK         (SX1262_DIO1_MASK | RADIOLIB_SX126X_IRQ_HEADER_VALID | \
+                                 RADIOLIB_SX126X_IRQ_CAD_DETECTED)
+// IRQs routed to DIO1
+#define SX1262_DIO1_MASK        (RADIOLIB_SX126X_IRQ_TX_DONE | RADIOLIB_SX126X_IRQ_RX_DONE | \
+                                 RADIOLIB_SX126X_IRQ_TIMEOUT | RADIOLIB_SX126X_IRQ_CRC_ERR | \
+                                 RADIOLIB_SX126X_IRQ_HEADER_ERR | RADIOLIB_SX126X_IRQ_CAD_DONE)
+// CAD over 2 symbols; detPeak follows RadioLib's SF + 13 default
+#define SX1262_CAD_SYMBOLS      RADIOLIB_SX126X_CAD_ON_2_SYMB
+#define SX1262_CAD_DET_MIN      10
+
+// -----------------------------------------------------------------------------
+// RadioLib HAL on ESP-IDF drivers (spi_master + gpio)
+// -----------------------------------------------------------------------------
+// RadioLib drives CS itself around each command and polls BUSY before and
+// after it, so the SPI device is added without a hardware CS line.
+
+class EspIdfRadioLibHal : public RadioLibHal
+{
+ public:
+	EspIdfRadioLibHal( int mosi, int miso, int clk )
+		: RadioLibHal( GPIO_MODE_INPUT, GPIO_MODE_OUTPUT, 0, 1, GPIO_INTR_POSEDGE, GPIO_INTR_NEGEDGE ),
+		  _mosi( mosi ), _miso( miso ), _clk( clk ) {}
+
+	void init() override { spiBegin(); }
+	void term() override { spiEnd(); }
+
+	void pinMode( uint32_t pin, uint32_t mode ) override
+	{
+		if ( pin == RADIOLIB_NC ) return;
+		gpio_reset_pin( (gpio_num_t) pin );
+		gpio_set_direction( (gpio_num_t) pin, (gpio_mode_t) mode );
+	}
+
+	void digitalWrite( uint32_t pin, uint32_t value ) override
+	{
+		if ( pin == RADIOLIB_NC ) return;
+		gpio_set_level( (gpio_num_t) pin, value );
+	}
+
+	uint32_t digitalRead( uint32_t pin ) override
+	{
+		if ( pin == RADIOLIB_NC ) return 0;
+		return gpio_get_level( (gpio_num_t) pin );
+	}
+
+	// The IRQ line is owned by Sx1262Radio (timestamping ISR); RadioLib's
+	// callback actions are not used.
+	void attachInterrupt( uint32_t interruptNum, void (*interruptCb)(void), uint32_t mode ) override
+	{
+		(void) interruptNum; (void) interruptCb; (void) mode;
+	}
+	void detachInterrupt( uint32_t interruptNum ) override { (void) interruptNum; }
+
+	void delay( RadioLibTime_t ms ) override
+	{
+		TickType_t ticks = pdMS_TO_TICKS( ms );
+		if ( ticks > 0 ) vTaskDelay( ticks );
+		else esp_rom_delay_us( ms * 1000 );
+	}
+	void delayMicroseconds( RadioLibTime_t us ) override { esp_rom_delay_us( us ); }
+	RadioLibTime_t millis() override { return (RadioLibTime_t)( esp_timer_get_time() / 1000 ); }
+	RadioLibTime_t micros() override { return (RadioLibTime_t) esp_timer_get_time(); }
+
+	long pulseIn( uint32_t pin, uint32_t state, RadioLibTime_t timeout ) override
+	{
+		// Not used by the SX126x driver
+		(void) pin; (void) state; (void) timeout;
+		return 0;
+	}
+
+	void spiBegin() override
+	{
+		if ( _spi != NULL ) return;
+
+		spi_bus_config_t buscfg;
+		memset( &buscfg, 0, sizeof(buscfg) );
+		buscfg.mosi_io_num = _mosi;
+		buscfg.miso_io_num = _miso;
+		buscfg.sclk_io_num = _clk;
+		buscfg.quadwp_io_num = -1;
+		buscfg.quadhd_io_num = -1;
+		ESP_ERROR_CHECK( spi_bus_initialize( SX1262_SPI_HOST, &buscfg, SPI_DMA_CH_AUTO ) );
+
+		spi_device_interface_config_t devcfg;
+		memset( &devcfg, 0, sizeof(devcfg) );
+		devcfg.mode = 0;
+		devcfg.clock_speed_hz = SX1262_SPI_CLOCK_HZ;
+		devcfg.spics_io_num = -1;
+		devcfg.queue_size = 1;
+		ESP_ERROR_CHECK( spi_bus_add_device( SX1262_SPI_HOST, &devcfg, &_spi ) );
+
+		// DMA bounce buffers: RadioLib hands us heap/stack buffers
+		_txBuf = (uint8_t*) heap_caps_malloc( SX1262_SPI_BUF_LEN, MALLOC_CAP_DMA );
+		_rxBuf = (uint8_t*) heap_caps_malloc( SX1262_SPI_BUF_LEN, MALLOC_CAP_DMA );
+	}
+
+	void spiBeginTransaction() override { spi_device_acquire_bus( _spi, portMAX_DELAY ); }
+	void spiEndTransaction() override { spi_device_release_bus( _spi ); }
+
+	void spiTransfer( uint8_t *out, size_t len, uint8_t *in ) override
+	{
+		spi_transaction_t t;
+		memset( &t, 0, sizeof(t) );
+		t.length = len * 8;
+
+		bool bounce = ( _txBuf != NULL && _rxBuf != NULL && len <= SX1262_SPI_BUF_LEN );
+		if ( bounce ) {
+			memcpy( _txBuf, out, len );
+			t.tx_buffer = _txBuf;
+			t.rx_buffer = _rxBuf;
+		} else {
+			t.tx_buffer = out;
+			t.rx_buffer = in;
+		}
+
+		spi_device_polling_transmit( _spi, &t );
+		_spiTransactions++;
+
+		if ( bounce && in != NULL )
+			memcpy( in, _rxBuf, len );
+	}
+
+	void spiEnd() override
+	{
+		if ( _spi == NULL ) return;
+		spi_bus_remove_device( _spi );
+		spi_bus_free( SX1262_SPI_HOST );
+		_spi = NULL;
+	}
+
+	uint32_t spiTransactions() const { return _spiTransactions; }
+
+ private:
+	int					_mosi, _miso, _clk;
+	spi_device_handle_t	_spi = NULL;
+	uint8_t				*_txBuf = NULL;
+	uint8_t				*_rxBuf = NULL;
+	uint32_t			_spiTransactions = 0;
+};
+
+// -----------------------------------------------------------------------------
+// SX1262 backend
+// -----------------------------------------------------------------------------
+// RadioLib does bring-up (reset, TCXO, calibration, PA, errata) in begin().
+// The per-packet paths talk to the chip through Module directly so every
+// step is exactly one NSS cycle and nothing redundant is re-sent:
+//   RX:  GetIrqStatus, ClearIrqStatus, GetRxBufferStatus, ReadBuffer,
+//        GetPacketStatus (RSSI + SNR together)          -> 5 transactions
+//   TX:  SetStandby, SetPacketParams, WriteBuffer, SetTx -> 4 transactions
+//   RX re-arm after TxDone: SetRx                        -> 1 transaction
+// IRQ routing, buffer base addresses and RX packet params are set once in
+// configure() and never touched per packet.
+
+class Sx1262Radio : public RadioHal
+{
+ public:
+	Sx1262Radio( const radio_pins_t *pins, int8_t txPowerDbm )
+		: _hal( pins->mosi, pins->miso, pins->clk ),
+		  _mod( &_hal, pins->cs, pins->irq, pins->reset, pins->busy >= 0 ? (uint32_t) pins->busy : RADIOLIB_NC ),
+		  _radio( &_mod ),
+		  _irqPin( pins->irq ),
+		  _txPowerDbm( txPowerDbm ) {}
+
+	const char *name() const override { return "SX1262"; }
+
+	bool init()
+	{
+		// Bring-up with library defaults; configure() applies our settings
+		int16_t state = _radio.begin( 915.0, 125.0, 7, 5, RADIOLIB_SX126X_SYNC_WORD_PRIVATE,
+		                              _txPowerDbm, 8, CONFIG_EFLO_SX1262_TCXO_MV / 1000.0f,
+		                              SX1262_USE_LDO );
+		if ( state != RADIOLIB_ERR_NONE ) {
+			ESP_LOGE(TAG, "begin() failed: %d", state);
+			return false;
+		}
+
+		gpio_config_t io_conf;
+		memset( &io_conf, 0, sizeof(io_conf) );
+		io_conf.intr_type = GPIO_INTR_POSEDGE;
+		io_conf.pin_bit_mask = ( 1ULL << _irqPin );
+		io_conf.mode = GPIO_MODE_INPUT;
+		io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+		gpio_config( &io_conf );
+
+		gpio_install_isr_service( 0 );
+		gpio_isr_handler_add( (gpio_num_t) _irqPin, isrTrampoline, this );
+		return true;
+	}
+
+	bool configure( const radio_config_t *cfg ) override
+	{
+		_radio.standby();
+
+		int16_t state = RADIOLIB_ERR_NONE;
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setFrequency( cfg->frequencyHz / 1e6f );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setBandwidth( cfg->bandwidthHz / 1e3f );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setSpreadingFactor( cfg->spreadingFactor );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setCodingRate( cfg->codingRateDen );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setPreambleLength( cfg->preambleLen );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setSyncWord( cfg->syncWord );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setCRC( cfg->crcOn ? 2 : 0 );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.invertIQ( false );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setOutputPower( cfg->txPowerDbm );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setDio2AsRfSwitch( SX1262_DIO2_RF_SWITCH );
+		if ( state == RADIOLIB_ERR_NONE ) state = _radio.setRxBoostedGainMode( SX1262_RX_BOOSTED_GAIN );
+		if ( state != RADIOLIB_ERR_NONE ) {
+			ESP_LOGE(TAG, "configure failed: %d", state);
+			return false;
+		}
+
+		_preambleLen = (uint16_t) cfg->preambleLen;
+		_sf = cfg->spreadingFactor;
+		_cadSf = -1;
+		_crcType = cfg->crcOn ? RADIOLIB_SX126X_LORA_CRC_ON : RADIOLIB_SX126X_LORA_CRC_OFF;
+
+		// One-time routing: everything the task acts on goes to DIO1
+		uint8_t irq[8] = {
+			(uint8_t)( SX1262_IRQ_MASK >> 8 ), (uint8_t) SX1262_IRQ_MASK,
+			(uint8_t)( SX1262_DIO1_MASK >> 8 ), (uint8_t) SX1262_DIO1_MASK,
+			0x00, 0x00, 0x00, 0x00 };
+		uint8_t base[2] = { 0x00, 0x00 };
+		if ( !command( RADIOLIB_SX126X_CMD_SET_DIO_IRQ_PARAMS, irq, sizeof(irq) ) ||
+		     !command( RADIOLIB_SX126X_CMD_SET_BUFFER_BASE_ADDRESS, base, sizeof(base) ) ||
+		     !setPacketParams( RADIOLIB_SX126X_MAX_PACKET_LENGTH ) ||
+		     !clearIrq() )
+			return false;
+
+		return true;
+	}
+
+	void setSyncWord( uint8_t sw ) override { _radio.setSyncWord( sw ); }
+
+	void setSpreadingFactor( int sf ) override
+	{
+		if ( sf == _sf ) return;
+		if ( _radio.setSpreadingFactor( sf ) == RADIOLIB_ERR_NONE )
+			_sf = sf;
+	}
+
+	void startReceive( uint32_t timeoutMs ) override
+	{
+		// Hardware RX timeout: the radio closes the window and raises TIMEOUT
+		// on DIO1 by itself, no host timer or SPI polling needed.
+		uint32_t timeout = RADIOLIB_SX126X_RX_TIMEOUT_INF;
+		if ( timeoutMs > 0 ) {
+			uint64_t t = (uint64_t) timeoutMs * SX1262_TIMEOUT_PER_MS;
+			timeout = ( t > SX1262_TIMEOUT_MAX ) ? SX1262_TIMEOUT_MAX : (uint32_t) t;
+		}
+		if ( _txParamsActive ) {
+			// Last TX changed the payload length field; restore RX params
+			setPacketParams( RADIOLIB_SX126X_MAX_PACKET_LENGTH );
+			_txParamsActive = false;
+		}
+		uint8_t data[3] = { (uint8_t)( timeout >> 16 ), (uint8_t)( timeout >> 8 ), (uint8_t) timeout };
+		command( RADIOLIB_SX126X_CMD_SET_RX, data, sizeof(data) );
+	}
+
+	int receivePacket( uint8_t *buf, int max, radio_rx_info_t *info ) override
+	{
+		info->crcError = false;
+		info->rxTimeout = false;
+
+		uint16_t irq = readIrq();
+		if ( irq == 0 )
+			return 0;
+		clearIrq();
+
+		if ( irq & ( RADIOLIB_SX126X_IRQ_CRC_ERR | RADIOLIB_SX126X_IRQ_HEADER_ERR ) ) {
+			info->crcError = true;
+			return 0;
+		}
+		if ( !( irq & RADIOLIB_SX126X_IRQ_RX_DONE ) ) {
+			info->rxTimeout = ( irq & RADIOLIB_SX126X_IRQ_TIMEOUT ) != 0;
+			return 0;
+		}
+
+		uint8_t rxStatus[2];
+		if ( !readCommand( RADIOLIB_SX126X_CMD_GET_RX_BUFFER_STATUS, rxStatus, sizeof(rxStatus) ) )
+			return 0;
+		int len = rxStatus[0];
+		if ( len > max ) len = max;
+
+		uint8_t cmd[2] = { RADIOLIB_SX126X_CMD_READ_BUFFER, rxStatus[1] };
+		if ( len > 0 && _mod.SPIreadStream( cmd, 2, buf, len ) != RADIOLIB_ERR_NONE )
+			return 0;
+
+		// RssiPkt, SnrPkt, SignalRssiPkt in one transaction
+		uint8_t pkt[3];
+		if ( readCommand( RADIOLIB_SX126X_CMD_GET_PACKET_STATUS, pkt, sizeof(pkt) ) ) {
+			info->rssi = -(int) pkt[0] / 2;
+			info->snr = (int8_t) pkt[1] / 4.0f;
+		}
+		return len;
+	}
+
+	bool isReceiving() override
+	{
+		uint16_t irq = readIrq();
+		return ( irq & RADIOLIB_SX126X_IRQ_HEADER_VALID ) && !( irq & RADIOLIB_SX126X_IRQ_RX_DONE );
+	}
+
+	bool startTransmit( const uint8_t *buf, int len ) override
+	{
+		if ( len <= 0 || len > RADIOLIB_SX126X_MAX_PACKET_LENGTH )
+			return false;
+
+		// Hardware TX timeout: airtime plus margin, so a stuck PA still ends
+		// in a DIO1 edge instead of relying on a host watchdog.
+		uint64_t t = ( _radio.getTimeOnAir( len ) / 1000 + SX1262_TX_MARGIN_MS ) * SX1262_TIMEOUT_PER_MS;
+		uint32_t timeout = ( t > SX1262_TIMEOUT_MAX ) ? SX1262_TIMEOUT_MAX : (uint32_t) t;
+
+		uint8_t stby = RADIOLIB_SX126X_STANDBY_RC;
+		uint8_t cmd[2] = { RADIOLIB_SX126X_CMD_WRITE_BUFFER, 0x00 };
+		uint8_t tx[3] = { (uint8_t)( timeout >> 16 ), (uint8_t)( timeout >> 8 ), (uint8_t) timeout };
+
+		if ( !command( RADIOLIB_SX126X_CMD_SET_STANDBY, &stby, 1 ) ||
+		     !setPacketParams( (uint8_t) len ) )
+			return false;
+		_txParamsActive = true;
+		if ( _mod.SPIwriteStream( cmd, 2, buf, len ) != RADIOLIB_ERR_NONE )
+			return false;
+		return command( RADIOLIB_SX126X_CMD_SET_TX, tx, sizeof(tx) );
+	}
+
+	void startCad() override
+	{
+		standby();
+		clearIrq();
+		// CAD thresholds depend on SF; only resend them when it changed
+		if ( _cadSf != _sf ) {
+			uint8_t params[7] = { SX1262_CAD_SYMBOLS, (uint8_t)( _sf + 13 ), SX1262_CAD_DET_MIN,
+			                      RADIOLIB_SX126X_CAD_GOTO_STDBY, 0x00, 0x00, 0x00 };
+			if ( !command( RADIOLIB_SX126X_CMD_SET_CAD_PARAMS, params, sizeof(params) ) )
+				return;
+			_cadSf = _sf;
+		}
+		command( RADIOLIB_SX126X_CMD_SET_CAD, NULL, 0 );
+	}
+
+	int handleCadDone() override
+	{
+		uint16_t irq = readIrq();
+		if ( !( irq & RADIOLIB_SX126X_IRQ_CAD_DONE ) )
+			return -1;
+
+		clearIrq();
+		return ( irq & RADIOLIB_SX126X_IRQ_CAD_DETECTED ) ? 1 : 0;
+	}
+
+	bool handleTxDone() override
+	{
+		uint16_t irq = readIrq();
+		if ( !( irq & ( RADIOLIB_SX126X_IRQ_TX_DONE | RADIOLIB_SX126X_IRQ_TIMEOUT ) ) )
+			return false;
+
+		clearIrq();
+		if ( !( irq & RADIOLIB_SX126X_IRQ_TX_DONE ) )
+			ESP_LOGW(TAG, "TX timeout");
+		return true;
+	}
+
+	bool transmit( const uint8_t *buf, int len ) override
+	{
+		if ( !startTransmit( buf, len ) )
+			return false;
+
+		int64_t deadline = esp_timer_get_time() +
+		                   (int64_t) _radio.getTimeOnAir( len ) + SX1262_TX_MARGIN_MS * 1000LL;
+		while ( gpio_get_level( (gpio_num_t) _irqPin ) == 0 ) {
+			if ( esp_timer_get_time() > deadline ) break;
+			vTaskDelay( 1 );
+		}
+		return handleTxDone();
+	}
+
+	void standby() override
+	{
+		uint8_t stby = RADIOLIB_SX126X_STANDBY_RC;
+		command( RADIOLIB_SX126X_CMD_SET_STANDBY, &stby, 1 );
+	}
+
+	void setIrqTask( TaskHandle_t task, uint32_t notifyBits ) override { _irqTask = task; _irqNotifyBits = notifyBits; }
+	int64_t getIrqTimeUs() override { return _irqTimeUs; }
+	int irqPin() const override { return _irqPin; }
+
+	uint32_t getSpiTransactions() override { return _hal.spiTransactions(); }
+
+ private:
+	static void IRAM_ATTR isrTrampoline( void *arg )
+	{
+		Sx1262Radio *r = (Sx1262Radio*) arg;
+		r->_irqTimeUs = esp_timer_get_time();
+
+		if ( r->_irqTask != NULL ) {
+			BaseType_t woken = pdFALSE;
+			xTaskNotifyFromISR( r->_irqTask, r->_irqNotifyBits, eSetBits, &woken );
+			portYIELD_FROM_ISR( woken );
+		}
+	}
+
+	bool command( uint8_t opcode, const uint8_t *data, size_t len )
+	{
+		return _mod.SPIwriteStream( opcode, data, len ) == RADIOLIB_ERR_NONE;
+	}
+
+	bool readCommand( uint8_t opcode, uint8_t *data, size_t len )
+	{
+		return _mod.SPIreadStream( opcode, data, len ) == RADIOLIB_ERR_NONE;
+	}
+
+	uint16_t readIrq()
+	{
+		uint8_t data[2] = { 0, 0 };
+		if ( !readCommand( RADIOLIB_SX126X_CMD_GET_IRQ_STATUS, data, sizeof(data) ) )
+			return 0;
+		return ( (uint16_t) data[0] << 8 ) | data[1];
+	}
+
+	bool clearIrq()
+	{
+		uint8_t data[2] = { (uint8_t)( RADIOLIB_SX126X_IRQ_ALL >> 8 ), (uint8_t) RADIOLIB_SX126X_IRQ_ALL };
+		return command( RADIOLIB_SX126X_CMD_CLEAR_IRQ_STATUS, data, sizeof(data) );
+	}
+
+	bool setPacketParams( uint8_t payloadLen )
+	{
+		uint8_t data[6] = {
+			(uint8_t)( _preambleLen >> 8 ), (uint8_t) _preambleLen,
+			RADIOLIB_SX126X_LORA_HEADER_EXPLICIT, payloadLen, _crcType,
+			RADIOLIB_SX126X_LORA_IQ_STANDARD };
+		return command( RADIOLIB_SX126X_CMD_SET_PACKET_PARAMS, data, sizeof(data) );
+	}
+
+	EspIdfRadioLibHal	_hal;
+	Module				_mod;
+	SX1262				_radio;
+	int					_irqPin;
+	int8_t				_txPowerDbm;
+	uint16_t			_preambleLen = 8;
+	int					_sf = 7;
+	int					_cadSf = -1;
+	uint8_t				_crcType = RADIOLIB_SX126X_LORA_CRC_ON;
+	bool				_txParamsActive = false;
+	TaskHandle_t		_irqTask = NULL;
+	uint32_t			_irqNotifyBits = 0;
+	volatile int64_t	_irqTimeUs = 0;
+};
+
+RadioHal *radio_hal_create( const radio_pins_t *pins, int8_t txPowerDbm )
+{
+	Sx1262Radio *radio = new Sx1262Radio( pins, txPowerDbm );
+	if ( !radio->init() ) {
+		delete radio;
+		return NULL;
+	}
+	return radio;
+}
+
+#endif // CONFIG_EFLO_LORA_RADIO_SX1262
@@ -0,0 +1,91 @@
+#include "sdkconfig.h"
+
+#if CONFIG_EFLO_LORA_RADIO_SX127X
+
+#include "radio_hal.h"
+#include "lora.h"
+
+// -----------------------------------------------------------------------------
+// SX127x backend: thin adapter over the register-level LoRa class
+// -----------------------------------------------------------------------------
+
+class Sx127xRadio : public RadioHal
+{
+ public:
+	Sx127xRadio( const radio_pins_t *pins, int8_t txPowerDbm )
+		: _lora( pins->mosi, pins->miso, pins->clk, pins->cs, pins->reset, pins->irq, txPowerDbm ),
+		  _irqPin( pins->irq ) {}
+
+	const char *name() const override { return "SX127x"; }
+
+	bool configure( const radio_config_t *cfg ) override
+	{
+		_lora.idle();
+		_lora.setFrequency( cfg->frequencyHz );
+		_lora.setSpreadingFactor( cfg->spreadingFactor );
+		_lora.setSignalBandwidth( cfg->bandwidthHz );
+		_lora.setCodingRate4( cfg->codingRateDen );
+		_lora.setPreambleLength( cfg->preambleLen );
+		_lora.setSyncWord( cfg->syncWord );
+		_lora.setCRC( cfg->crcOn );
+		_lora.disableInvertIQ();
+		_lora.setTxPower( cfg->txPowerDbm, RF_PACONFIG_PASELECT_PABOOST );
+		return true;
+	}
+
+	void setSyncWord( uint8_t sw ) override { _lora.setSyncWord( sw ); }
+	void setSpreadingFactor( int sf ) override { _lora.setSpreadingFactor( sf ); }
+
+	// RX_SINGLE on the SX127x times out in symbols and would need re-arming
+	// after every packet; the hub always listens, so stay continuous.
+	void startReceive( uint32_t timeoutMs ) override { (void) timeoutMs; _lora.receive( 0 ); }
+
+	int receivePacket( uint8_t *buf, int max, radio_rx_info_t *info ) override
+	{
+		info->rxTimeout = false;
+		info->crcError = false;
+		return _lora.receivePacket( buf, max, &info->rssi, &info->snr, &info->crcError );
+	}
+
+	bool isReceiving() override { return _lora.isReceiving(); }
+
+	bool startTransmit( const uint8_t *buf, int len ) override
+	{
+		_lora.beginPacket( 0 );
+		if ( _lora.writeFifo( buf, len ) != len )
+			return false;
+		_lora.startTransmit();
+		return true;
+	}
+
+	bool handleTxDone() override { return _lora.handleTxDone(); }
+
+	void startCad() override { _lora.startCad(); }
+	int handleCadDone() override { return _lora.handleCadDone(); }
+
+	bool transmit( const uint8_t *buf, int len ) override
+	{
+		_lora.beginPacket( 0 );
+		_lora.writeFifo( buf, len );
+		return _lora.endPacket( false ) == 1;
+	}
+
+	void standby() override { _lora.idle(); }
+
+	void setIrqTask( TaskHandle_t task, uint32_t notifyBits ) override { _lora.setIrqTask( task, notifyBits ); }
+	int64_t getIrqTimeUs() override { return _lora.getIrqTimeUs(); }
+	int irqPin() const override { return _irqPin; }
+
+	uint32_t getSpiTransactions() override { return _lora.getSpiTransactions(); }
+
+ private:
+	LoRa	_lora;
+	int		_irqPin;
+};
+
+RadioHal *radio_hal_create( const radio_pins_t *pins, int8_t txPowerDbm )
+{
+	return new Sx127xRadio( pins, txPowerDbm );
+}
+
+#endif // CONFIG_EFLO_LORA_RADIO_SX127X
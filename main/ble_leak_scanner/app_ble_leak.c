@@ -1,27 +1,36 @@
 /****************************************************
  *  MODULE:   BLE Leak Sensor Scanner
  *  PURPOSE:  Passive BLE scanner for "eleak" leak sensors.
- *            Uses extended scanning (ble_gap_ext_disc) to receive
+ *            Consumer of the shared scan (ble_scan), asking for
  *            both legacy 1M and Coded PHY advertisements, enabling
  *            support for STM32WB (legacy) and STM32WBA (long range)
  *            leak sensors simultaneously.
  *            Parses manufacturer-specific advertising data
  *            (company ID 0x0030) for leak status and battery.
- *            Commissioned sensors are whitelisted by MAC from
- *            the provisioning manager (Azure C2D).
+ *            Commissioned sensors are whitelisted by MAC through
+ *            the device registry (filled by the provisioning
+ *            manager from Azure C2D); ble_scan programs the
+ *            same MACs into the controller's filter accept list.
+ *            Updates reach the IoT Hub task through one
+ *            latest-value mailbox per sensor (see header).
  ****************************************************/
 
 #include "app_ble_leak.h"
 #include <string.h>
 #include <strings.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 #include "host/ble_hs.h"
 #include "host/ble_gap.h"
 #include "provisioning_manager/provisioning_manager.h"
+#include "device_registry/device_registry.h"
 #include "health_engine/health_engine.h"
+#include "ble_scan/ble_scan.h"
 
 /* ---------------------------------------------------------
  * Constants
@@ -32,162 +41,376 @@
 #define ELEAK_DEVICE_NAME       "eleak"
 #define ELEAK_DEVICE_NAME_LEN   5
 #define MAX_TRACKED_SENSORS     MAX_BLE_LEAK_SENSORS
-#define SCAN_RESTART_DELAY_MS   500
-#define WHITELIST_RELOAD_MS     10000       // Re-check provisioning every 10s
 #define BLE_LEAK_HEARTBEAT_MS   (5 * 60 * 1000)  // 5-min heartbeat for health engine
 
+// Expected advertisement slots of dry sensors: the scan is widened from
+// ADV_DUE_LEAD_MS before to ADV_DUE_SLACK_MS after each multiple of the
+// advertising interval since the last advert, for ADV_DUE_MAX_MISSED slots
+#define ADV_INTERVAL_MS         (CONFIG_EFLO_BLE_LEAK_ADV_INTERVAL_S * 1000)
+#define ADV_DUE_LEAD_MS         4000
+#define ADV_DUE_SLACK_MS        6000
+#define ADV_DUE_MAX_MISSED      10
+#define ADV_DUE_HINT_MS         1000    // > task loop period, renewed while due
+
 /* ---------------------------------------------------------
  * Internal types
  * --------------------------------------------------------- */
-// Per-sensor state for delta/dedup tracking
+// Per-sensor state for delta/dedup tracking, indexed by registry BLE slot
 typedef struct {
-    uint8_t mac[6];
+    uint8_t mac[6];              // NimBLE order; slot reused by another sensor resets
     uint8_t last_battery;
     bool last_leak;
-    char last_fw_version[12];
-    bool seen;              // true after first advertisement received
+    bool seen;                   // true after first advertisement received
+    uint32_t last_fw;            // FW_PACK(M, m, p), 0 = not advertised
     TickType_t last_event_tick;  // for health engine heartbeat
+    TickType_t last_adv_tick;    // last accepted advertisement, any content
 } sensor_state_t;
 
+#define FW_PACK(M, m, p)   (0x01000000u | ((uint32_t)(M) << 16) | ((uint32_t)(m) << 8) | (p))
+
+// Name + manufacturer data pulled out of the AD payload in one pass
+typedef struct {
+    const uint8_t *name;
+    uint8_t name_len;
+    const uint8_t *mfg;
+    uint8_t mfg_len;
+} eleak_ad_t;
+
+/* ---------------------------------------------------------
+ * Commissioned-MAC fast-reject set
+ * Open-addressed set of 32-bit fingerprints of the 48-bit
+ * MAC, at most half full. A miss rejects an advertisement
+ * before any parsing; a hit is confirmed against the device
+ * registry. Rebuilt by the scanner task when the registry
+ * generation moves; readers (NimBLE host task) are lock-free
+ * and fall back to the registry while a rebuild is running
+ * (odd s_mac_set_seq) or the set is behind the registry.
+ * --------------------------------------------------------- */
+#define MAC_SET_SIZE  (MAX_TRACKED_SENSORS <= 16  ? 32  : \
+                       MAX_TRACKED_SENSORS <= 32  ? 64  : \
+                       MAX_TRACKED_SENSORS <= 64  ? 128 : \
+                       MAX_TRACKED_SENSORS <= 128 ? 256 : 512)
+
+/* ---------------------------------------------------------
+ * Per-sensor mailboxes, indexed by registry BLE slot.
+ * Written by the NimBLE host task, taken by the IoT Hub
+ * task; the slots and dirty bits sit behind a spinlock
+ * (a few dozen instructions per access).
+ * --------------------------------------------------------- */
+#define MBOX_WORDS  ((MAX_TRACKED_SENSORS + 31) / 32)
+
+typedef struct {
+    uint8_t mac[6];              // NimBLE order
+    uint8_t battery;
+    int8_t rssi;
+    bool leak;
+    bool leak_seen;              // sticky until taken
+    int64_t leak_rx_us;          // first leak advert since the last take
+    uint32_t fw;
+} leak_mbox_t;
+
 /* ---------------------------------------------------------
  * Static variables
  * --------------------------------------------------------- */
-QueueHandle_t ble_leak_rx_queue = NULL;
+static leak_mbox_t s_mbox[MAX_TRACKED_SENSORS];
+static uint32_t s_mbox_dirty[MBOX_WORDS];
+static int s_mbox_cursor = 0;               // consumer: round-robin start
+static portMUX_TYPE s_mbox_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t s_doorbell = NULL;
 
 static TaskHandle_t ble_leak_task_handle = NULL;
-static volatile bool s_scan_restart_needed = false;
+static volatile bool s_task_running = false;    // past the NimBLE start wait
 
-// Cached whitelist from provisioning manager
-static uint8_t s_whitelist[MAX_TRACKED_SENSORS][6];
-static uint8_t s_whitelist_count = 0;
+// Commissioned sensor count, refreshed from the device registry
+static int s_whitelist_count = 0;
+static uint32_t s_whitelist_gen = UINT32_MAX;
 
 // Per-sensor tracking for dedup
 static sensor_state_t s_sensors[MAX_TRACKED_SENSORS];
 
+static uint32_t s_mac_set[MAC_SET_SIZE];    // fingerprint, 0 = empty
+static _Atomic uint32_t s_mac_set_seq = 0;  // odd while rebuilding
+static volatile uint32_t s_mac_set_gen = UINT32_MAX;
+
+// Advertisement counters (NimBLE host task writes, anyone reads)
+static ble_leak_scan_stats_t s_stats;
+
 /* ---------------------------------------------------------
- * Helper: parse MAC string "XX:XX:XX:XX:XX:XX" to 6-byte array
- * NimBLE stores addresses LSB-first, so we reverse the byte order.
- * "00:80:E1:27:9A:E6" → [0xE6, 0x9A, 0x27, 0xE1, 0x80, 0x00]
+ * Mailbox helpers
  * --------------------------------------------------------- */
-static void mac_str_to_bytes(const char *str, uint8_t *out)
+static inline bool mbox_test(int i)
 {
-    unsigned int b[6];
-    sscanf(str, "%02X:%02X:%02X:%02X:%02X:%02X",
-           &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]);
-    for (int i = 0; i < 6; i++) {
-        out[i] = (uint8_t)b[5 - i];
+    return (s_mbox_dirty[i >> 5] >> (i & 31)) & 1u;
+}
+
+static bool mbox_any_dirty(void)
+{
+    for (int w = 0; w < MBOX_WORDS; w++) {
+        if (s_mbox_dirty[w]) return true;
     }
+    return false;
+}
+
+static void ring_doorbell(void)
+{
+    uint8_t one = 1;
+    xQueueSend(s_doorbell, &one, 0);   // full = already rung
 }
 
 /* ---------------------------------------------------------
- * Helper: format NimBLE 6-byte MAC (LSB-first) to string "XX:XX:XX:XX:XX:XX"
- * [0xE6, 0x9A, 0x27, 0xE1, 0x80, 0x00] → "00:80:E1:27:9A:E6"
+ * Overwrite a sensor's mailbox with its latest state. The
+ * doorbell rings only when the mailbox was clean; a leak
+ * stays flagged until the consumer has taken it.
  * --------------------------------------------------------- */
-static void mac_bytes_to_str(const uint8_t *mac, char *out)
+static void mbox_post(int idx, const uint8_t *mac, bool leak, uint8_t battery,
+                      int8_t rssi, uint32_t fw)
 {
-    sprintf(out, "%02X:%02X:%02X:%02X:%02X:%02X",
-            mac[5], mac[4], mac[3], mac[2], mac[1], mac[0]);
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_mbox_lock);
+    leak_mbox_t *m = &s_mbox[idx];
+    bool was_dirty = mbox_test(idx);
+    if (was_dirty && memcmp(m->mac, mac, 6) == 0) {
+        if (leak && !m->leak_seen) {
+            m->leak_rx_us = now;
+        }
+        m->leak_seen |= leak;
+        s_stats.mbox_coalesced++;
+    } else {
+        m->leak_seen = leak;
+        m->leak_rx_us = leak ? now : 0;
+    }
+    memcpy(m->mac, mac, 6);
+    m->leak = leak;
+    m->battery = battery;
+    m->rssi = rssi;
+    m->fw = fw;
+    s_mbox_dirty[idx >> 5] |= 1u << (idx & 31);
+    portEXIT_CRITICAL(&s_mbox_lock);
+
+    s_stats.mbox_posted++;
+    if (!was_dirty) {
+        ring_doorbell();
+    }
+}
+
+/* ---------------------------------------------------------
+ * MAC fingerprint and set slot. The key is the NimBLE
+ * LSB-first address read as a little-endian integer, which
+ * is the registry's printed-order MAC key.
+ * --------------------------------------------------------- */
+static inline uint64_t mac_key_le(const uint8_t *val)
+{
+    return  (uint64_t)val[0]        | ((uint64_t)val[1] << 8)  |
+           ((uint64_t)val[2] << 16) | ((uint64_t)val[3] << 24) |
+           ((uint64_t)val[4] << 32) | ((uint64_t)val[5] << 40);
+}
+
+static inline uint32_t mac_fingerprint(uint64_t key)
+{
+    uint32_t fp = (uint32_t)(key ^ (key >> 29) ^ (key >> 47));
+    return fp ? fp : 1;
+}
+
+static inline uint32_t mac_set_slot(uint64_t key)
+{
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (MAC_SET_SIZE - 1);
 }
 
 /* ---------------------------------------------------------
- * Reload whitelist from provisioning manager
+ * Rebuild the fast-reject set and the whitelist size from
+ * the device registry. Scanner task only; cheap no-op when
+ * the registry has not changed. Returns true if rebuilt.
  * --------------------------------------------------------- */
-static void reload_whitelist(void)
+static bool reload_whitelist(void)
 {
-    char mac_strs[MAX_BLE_LEAK_SENSORS][18];
-    uint8_t count = 0;
-
-    if (provisioning_get_ble_leak_sensors(mac_strs, &count)) {
-        s_whitelist_count = count;
-        uint32_t sum = count;
-        for (int i = 0; i < count; i++) {
-            mac_str_to_bytes(mac_strs[i], s_whitelist[i]);
-            for (int b = 0; b < 6; b++) sum = sum * 31u + s_whitelist[i][b];
+    uint32_t gen = device_registry_generation();
+    if (gen == s_whitelist_gen) {
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&s_mac_set_seq, 1, memory_order_acq_rel);   // odd: readers bypass
+    memset(s_mac_set, 0, sizeof(s_mac_set));
+    for (int i = 0; i < MAX_TRACKED_SENSORS; i++) {
+        uint8_t mac[6];
+        if (!device_registry_get_mac((dev_handle_t)(DEVREG_HANDLE_BLE_BASE + i), mac)) {
+            continue;
         }
-        // This runs every 10 s; only log when the whitelist actually changes so
-        // the trace isn't flooded with identical "reloaded" lines.
-        static uint32_t s_prev_wl_sum = 0xFFFFFFFFu;
-        if (sum != s_prev_wl_sum) {
-            s_prev_wl_sum = sum;
-            ESP_LOGI(BLE_LEAK_TAG, "Whitelist reloaded: %d sensor(s)", count);
+        uint64_t key = ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) |
+                       ((uint64_t)mac[2] << 24) | ((uint64_t)mac[3] << 16) |
+                       ((uint64_t)mac[4] <<  8) |  (uint64_t)mac[5];
+        uint32_t fp = mac_fingerprint(key);
+        uint32_t j = mac_set_slot(key);
+        while (s_mac_set[j] != 0 && s_mac_set[j] != fp) {
+            j = (j + 1) & (MAC_SET_SIZE - 1);
         }
-    } else {
-        s_whitelist_count = 0;
+        s_mac_set[j] = fp;
     }
+    s_mac_set_gen = gen;
+    atomic_fetch_add_explicit(&s_mac_set_seq, 1, memory_order_acq_rel);   // even: set valid
+
+    s_whitelist_gen = gen;
+    s_whitelist_count = device_registry_count(DEVREG_BLE_LEAK);
+    ESP_LOGI(BLE_LEAK_TAG, "Whitelist reloaded: %d sensor(s)", s_whitelist_count);
+    return true;
 }
 
 /* ---------------------------------------------------------
- * Check if a MAC is in the whitelist
- * Returns index (0..N-1) or -1 if not found
+ * Fast reject: true if the MAC is certainly not commissioned.
+ * false means "maybe" (or the set is not usable right now).
+ * --------------------------------------------------------- */
+static bool mac_set_rejects(const uint8_t *val)
+{
+    uint32_t seq = atomic_load_explicit(&s_mac_set_seq, memory_order_acquire);
+    if ((seq & 1u) || s_mac_set_gen != device_registry_generation()) {
+        return false;
+    }
+
+    uint64_t key = mac_key_le(val);
+    uint32_t fp = mac_fingerprint(key);
+    uint32_t j = mac_set_slot(key);
+    bool miss = false;
+    for (int n = 0; n < MAC_SET_SIZE; n++) {
+        uint32_t e = s_mac_set[j];
+        if (e == fp) break;
+        if (e == 0) { miss = true; break; }
+        j = (j + 1) & (MAC_SET_SIZE - 1);
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    return miss && atomic_load_explicit(&s_mac_set_seq, memory_order_relaxed) == seq;
+}
+
+/* ---------------------------------------------------------
+ * Check if a MAC (NimBLE order) is commissioned
+ * Returns its registry BLE slot or -1 if not found
  * --------------------------------------------------------- */
 static int whitelist_find(const uint8_t *mac)
 {
-    for (int i = 0; i < s_whitelist_count; i++) {
-        if (memcmp(s_whitelist[i], mac, 6) == 0) {
-            return i;
+    uint8_t printed[6];
+    for (int i = 0; i < 6; i++) {
+        printed[i] = mac[5 - i];
+    }
+    dev_handle_t h = device_registry_find_mac(DEVREG_BLE_LEAK, printed);
+    return (h == DEVREG_HANDLE_NONE) ? -1 : device_registry_ble_slot(h);
+}
+
+/* ---------------------------------------------------------
+ * Single pass over the AD structures, keeping only the name
+ * (complete or shortened) and manufacturer data; stops once
+ * both are found. Returns false on a malformed payload.
+ * --------------------------------------------------------- */
+static bool ad_walk(const uint8_t *data, uint8_t data_len, eleak_ad_t *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    int i = 0;
+    while (i < data_len) {
+        uint8_t field_len = data[i];
+        if (field_len == 0) {
+            break;                          // zero padding ends the payload
+        }
+        if (i + 1 + field_len > data_len) {
+            return false;
+        }
+        uint8_t type = data[i + 1];
+        const uint8_t *val = &data[i + 2];
+        uint8_t val_len = field_len - 1;
+
+        if ((type == BLE_HS_ADV_TYPE_COMP_NAME || type == BLE_HS_ADV_TYPE_INCOMP_NAME) &&
+            out->name == NULL) {
+            out->name = val;
+            out->name_len = val_len;
+        } else if (type == BLE_HS_ADV_TYPE_MFG_DATA && out->mfg == NULL) {
+            out->mfg = val;
+            out->mfg_len = val_len;
+        }
+        if (out->name && out->mfg) {
+            break;
         }
+        i += 1 + field_len;
     }
-    return -1;
+    return true;
 }
 
 /* ---------------------------------------------------------
  * Common advertisement processing for leak sensors.
- * Called from both legacy (BLE_GAP_EVENT_DISC) and extended
- * (BLE_GAP_EVENT_EXT_DISC) event handlers.
+ * Called for every complete report (legacy or extended) the
+ * shared scan delivers.
  * --------------------------------------------------------- */
 static void process_leak_adv(const ble_addr_t *addr, int8_t rssi,
                              const uint8_t *data, uint8_t data_len)
 {
-    // Parse advertisement fields
-    struct ble_hs_adv_fields fields;
-    if (ble_hs_adv_parse_fields(&fields, data, data_len) != 0) {
-        return;
-    }
-
-    // Check device name matches "eleak" (case-insensitive)
-    if (fields.name == NULL || fields.name_len != ELEAK_DEVICE_NAME_LEN) {
-        return;
-    }
-    if (strncasecmp((const char *)fields.name, ELEAK_DEVICE_NAME, ELEAK_DEVICE_NAME_LEN) != 0) {
-        return;
-    }
+    s_stats.adv_seen++;
 
     // Get advertiser MAC (NimBLE stores as addr.val[6], byte 0 = LSB)
     const uint8_t *adv_mac = addr->val;
 
-    // Check whitelist
+    // Commissioned sensors only: most adverts in range stop here, unparsed
+    if (mac_set_rejects(adv_mac)) {
+        s_stats.adv_rejected_early++;
+        return;
+    }
     int idx = whitelist_find(adv_mac);
     if (idx < 0) {
+        s_stats.adv_rejected_early++;
         return;  // Not a commissioned sensor
     }
 
+    eleak_ad_t ad;
+    s_stats.adv_parsed++;
+    if (!ad_walk(data, data_len, &ad)) {
+        return;
+    }
+
+    // Check device name matches "eleak" (case-insensitive)
+    if (ad.name == NULL || ad.name_len != ELEAK_DEVICE_NAME_LEN) {
+        return;
+    }
+    if (strncasecmp((const char *)ad.name, ELEAK_DEVICE_NAME, ELEAK_DEVICE_NAME_LEN) != 0) {
+        return;
+    }
+
     // Verify manufacturer-specific data
-    if (fields.mfg_data == NULL || fields.mfg_data_len < ELEAK_MFG_DATA_LEN) {
+    if (ad.mfg == NULL || ad.mfg_len < ELEAK_MFG_DATA_LEN) {
         return;
     }
 
     // Verify company ID (little-endian: 0x30, 0x00 = 0x0030)
-    uint16_t company_id = (uint16_t)fields.mfg_data[0] | ((uint16_t)fields.mfg_data[1] << 8);
+    uint16_t company_id = (uint16_t)ad.mfg[0] | ((uint16_t)ad.mfg[1] << 8);
     if (company_id != ELEAK_COMPANY_ID) {
         return;
     }
+    s_stats.adv_accepted++;
 
     // Extract payload
-    uint8_t leak_status = fields.mfg_data[2];
-    uint8_t battery     = fields.mfg_data[3];
+    uint8_t leak_status = ad.mfg[2];
+    uint8_t battery     = ad.mfg[3];
     bool leak = (leak_status != 0);
 
-    // Parse firmware version from extended mfg data bytes [4..6] if present
-    char fw_ver[12] = {0};
-    if (fields.mfg_data_len >= 7) {
-        snprintf(fw_ver, sizeof(fw_ver), "%u.%u.%u",
-                 fields.mfg_data[4], fields.mfg_data[5], fields.mfg_data[6]);
+    // Firmware version from extended mfg data bytes [4..6] if present
+    uint32_t fw = 0;
+    if (ad.mfg_len >= 7) {
+        fw = FW_PACK(ad.mfg[4], ad.mfg[5], ad.mfg[6]);
     }
 
-    // Delta check: skip if unchanged from last report (unless heartbeat due)
+    // Slot taken over by a newly commissioned sensor: start over
     sensor_state_t *s = &s_sensors[idx];
+    if (s->seen && memcmp(s->mac, adv_mac, 6) != 0) {
+        memset(s, 0, sizeof(*s));
+    }
+
+    // Arrived after its expected slot: at least one advertisement was missed
+    TickType_t now = xTaskGetTickCount();
+    if (s->seen && !s->last_leak &&
+        (now - s->last_adv_tick) > pdMS_TO_TICKS(ADV_INTERVAL_MS + ADV_DUE_SLACK_MS)) {
+        s_stats.adv_late++;
+    }
+    s->last_adv_tick = now;
+
+    // Delta check: skip if unchanged from last report (unless heartbeat due)
     bool data_changed = !s->seen || s->last_leak != leak || s->last_battery != battery
-                        || strcmp(s->last_fw_version, fw_ver) != 0;
+                        || s->last_fw != fw;
     bool heartbeat_due = s->seen &&
         ((xTaskGetTickCount() - s->last_event_tick) >= pdMS_TO_TICKS(BLE_LEAK_HEARTBEAT_MS));
     if (!data_changed && !heartbeat_due) {
@@ -198,133 +421,76 @@ static void process_leak_adv(const ble_addr_t *addr, int8_t rssi,
     memcpy(s->mac, adv_mac, 6);
     s->last_leak = leak;
     s->last_battery = battery;
-    strncpy(s->last_fw_version, fw_ver, sizeof(s->last_fw_version) - 1);
+    s->last_fw = fw;
     s->seen = true;
 
-    // Build event and enqueue
-    ble_leak_event_t evt;
-    memcpy(evt.sensor_mac, adv_mac, 6);
-    mac_bytes_to_str(adv_mac, evt.sensor_mac_str);
-    evt.battery = battery;
-    evt.leak_detected = leak;
-    evt.rssi = rssi;
-    strncpy(evt.fw_version, fw_ver, sizeof(evt.fw_version) - 1);
-    evt.fw_version[sizeof(evt.fw_version) - 1] = '\0';
-
-    ESP_LOGI(BLE_LEAK_TAG, "eleak %s — leak=%d batt=%d%% rssi=%d fw=%s",
-             evt.sensor_mac_str, leak, battery, evt.rssi,
-             fw_ver[0] ? fw_ver : "n/a");
-
-    xQueueSend(ble_leak_rx_queue, &evt, 0);
+    char fw_str[12];
+    app_ble_leak_fw_str(fw, fw_str);
+    ESP_LOGI(BLE_LEAK_TAG, "eleak %02X:%02X:%02X:%02X:%02X:%02X — leak=%d batt=%d%% rssi=%d fw=%s",
+             adv_mac[5], adv_mac[4], adv_mac[3], adv_mac[2], adv_mac[1], adv_mac[0],
+             leak, battery, rssi, fw_str[0] ? fw_str : "n/a");
+
+    mbox_post(idx, adv_mac, leak, battery, rssi, fw);
     s->last_event_tick = xTaskGetTickCount();
 
     // Health engine: sensor check-in
-    health_post_ble_leak_checkin(evt.sensor_mac_str, evt.battery, evt.rssi);
+    health_post_ble_leak_checkin((dev_handle_t)(DEVREG_HANDLE_BLE_BASE + idx), battery, rssi);
 }
 
 /* ---------------------------------------------------------
- * GAP event callback for extended scanning.
- * Handles both legacy (1M PHY) and extended (Coded PHY)
- * advertising reports from a single ble_gap_ext_disc() session.
+ * Scan requirements for the shared scan: passive, 1M + Coded
+ * PHY (legacy WB and long-range WBA sensors), no duplicate
+ * filtering so every state change is reported. Only while
+ * something is commissioned.
  * --------------------------------------------------------- */
-static int ble_leak_gap_event(struct ble_gap_event *event, void *arg)
+static void request_scan(void)
 {
-    switch (event->type) {
-
-    case BLE_GAP_EVENT_DISC:
-        // Legacy advertisement received (fallback path)
-        process_leak_adv(&event->disc.addr, event->disc.rssi,
-                         event->disc.data, event->disc.length_data);
-        break;
-
-#if MYNEWT_VAL(BLE_EXT_ADV)
-    case BLE_GAP_EVENT_EXT_DISC: {
-        const struct ble_gap_ext_disc_desc *ext = &event->ext_disc;
+    ble_scan_req_t req = {
+        .enabled = s_whitelist_count > 0,
+        .active = false,
+        .coded_phy = true,
+        .filter_duplicates = false,
+        .all_advertisers = false,
+    };
+    ble_scan_request(BLE_SCAN_CONSUMER_LEAK, &req);
+}
 
-        // Only process complete advertising data
-        if (ext->data_status != BLE_GAP_EXT_ADV_DATA_STATUS_COMPLETE) {
-            break;
+/* ---------------------------------------------------------
+ * True if a dry sensor's next advertisement is expected now:
+ * within [-lead, +slack] of a multiple of the advertising
+ * interval since its last one. Leaking sensors are covered by
+ * the leak hint the IoT Hub task raises; sensors silent for
+ * ADV_DUE_MAX_MISSED intervals stop pulling the scan up.
+ * --------------------------------------------------------- */
+static bool adv_due(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < MAX_TRACKED_SENSORS; i++) {
+        const sensor_state_t *s = &s_sensors[i];
+        if (!s->seen || s->last_leak) {
+            continue;
+        }
+        uint32_t since = (uint32_t)((now - s->last_adv_tick) * portTICK_PERIOD_MS) + ADV_DUE_LEAD_MS;
+        if (since < ADV_INTERVAL_MS || since >= ADV_INTERVAL_MS * ADV_DUE_MAX_MISSED) {
+            continue;
+        }
+        if (since % ADV_INTERVAL_MS < ADV_DUE_LEAD_MS + ADV_DUE_SLACK_MS) {
+            return true;
         }
-
-        process_leak_adv(&ext->addr, ext->rssi, ext->data, ext->length_data);
-        break;
-    }
-#endif
-
-    case BLE_GAP_EVENT_DISC_COMPLETE:
-        ESP_LOGW(BLE_LEAK_TAG, "Scan complete (reason=%d) — will restart", event->disc_complete.reason);
-        s_scan_restart_needed = true;
-        break;
-
-    default:
-        break;
     }
-
-    return 0;
+    return false;
 }
 
 /* ---------------------------------------------------------
- * Start passive BLE scan using extended scanning API.
- * Scans on both 1M PHY (legacy WB leak sensors) and
- * Coded PHY (long-range WBA leak sensors) simultaneously.
+ * Report callback registered with the scan arbiter
  * --------------------------------------------------------- */
-static void start_passive_scan(void)
+static void on_scan_report(const ble_addr_t *addr, int8_t rssi,
+                           const uint8_t *data, uint8_t len)
 {
-#if MYNEWT_VAL(BLE_EXT_ADV)
-    // 1M PHY params — catches legacy WB leak sensors
-    struct ble_gap_ext_disc_params uncoded_params = {0};
-    uncoded_params.itvl = 160;      // 100ms interval
-    uncoded_params.window = 80;     // 50ms window (50% duty)
-    uncoded_params.passive = 1;
-
-    // Coded PHY params — catches long-range WBA leak sensors
-    struct ble_gap_ext_disc_params coded_params = {0};
-    coded_params.itvl = 160;        // 100ms interval
-    coded_params.window = 80;       // 50ms window (50% duty)
-    coded_params.passive = 1;
-
-    int rc = ble_gap_ext_disc(
-        BLE_OWN_ADDR_PUBLIC,
-        0,                          // duration: 0 = continuous
-        0,                          // period: 0 = no periodic restart
-        0,                          // filter_duplicates: disabled for fast change detection
-        0,                          // filter_policy: accept all
-        0,                          // limited: disabled
-        &uncoded_params,            // 1M PHY scan params
-        &coded_params,              // Coded PHY scan params
-        ble_leak_gap_event,
-        NULL
-    );
-
-    if (rc == 0) {
-        ESP_LOGI(BLE_LEAK_TAG, "Extended passive scan started (1M + Coded PHY)");
-    } else if (rc == BLE_HS_EALREADY) {
-        ESP_LOGD(BLE_LEAK_TAG, "Scan already active (valve scanning?), will retry");
-        s_scan_restart_needed = true;
-    } else {
-        ESP_LOGW(BLE_LEAK_TAG, "Failed to start ext scan: %d, will retry", rc);
-        s_scan_restart_needed = true;
-    }
-#else
-    // Fallback: legacy scanning (1M PHY only)
-    struct ble_gap_disc_params disc_params = {0};
-    disc_params.passive = 1;
-    disc_params.filter_duplicates = 0;
-    disc_params.itvl = 160;
-    disc_params.window = 80;
-
-    int rc = ble_gap_disc(BLE_OWN_ADDR_PUBLIC, BLE_HS_FOREVER,
-                          &disc_params, ble_leak_gap_event, NULL);
-    if (rc == 0) {
-        ESP_LOGI(BLE_LEAK_TAG, "Passive scan started (1M only, ext_adv disabled)");
-    } else if (rc == BLE_HS_EALREADY) {
-        ESP_LOGD(BLE_LEAK_TAG, "Scan already active (valve scanning?), will retry");
-        s_scan_restart_needed = true;
-    } else {
-        ESP_LOGW(BLE_LEAK_TAG, "Failed to start scan: %d, will retry", rc);
-        s_scan_restart_needed = true;
+    if (s_doorbell == NULL || s_whitelist_count == 0) {
+        return;
     }
-#endif
+    process_leak_adv(addr, rssi, data, len);
 }
 
 /* ---------------------------------------------------------
@@ -338,46 +504,55 @@ static void ble_leak_scan_task(void *param)
     // Block until NimBLE is initialized
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     ESP_LOGI(BLE_LEAK_TAG, "NimBLE ready, initializing scanner");
+    s_task_running = true;
 
-    // Load whitelist
+    // Load whitelist and join the shared scan
     reload_whitelist();
     memset(s_sensors, 0, sizeof(s_sensors));
+    request_scan();
 
-    // Initial scan start (with small delay to let valve module connect first)
-    vTaskDelay(pdMS_TO_TICKS(2000));
-    start_passive_scan();
-
-    TickType_t last_whitelist_reload = xTaskGetTickCount();
     TickType_t last_heartbeat_log = xTaskGetTickCount();
 
     for (;;) {
-        // Handle scan restart if needed
-        if (s_scan_restart_needed) {
-            s_scan_restart_needed = false;
-            vTaskDelay(pdMS_TO_TICKS(SCAN_RESTART_DELAY_MS));
-            start_passive_scan();
-        }
-        // Self-healing: detect when our scan was cancelled externally
-        // (e.g., valve module's scan/connect sequence) without a
-        // BLE_GAP_EVENT_DISC_COMPLETE reaching our callback.
-        else if (!ble_gap_disc_active()) {
-            ESP_LOGW(BLE_LEAK_TAG, "Scan not active (external cancel?), restarting");
-            start_passive_scan();
+        // Follow registry changes (runtime commissioning); no-op otherwise
+        if (reload_whitelist()) {
+            request_scan();
         }
 
-        // Periodically reload whitelist (handles runtime commissioning)
-        if ((xTaskGetTickCount() - last_whitelist_reload) >= pdMS_TO_TICKS(WHITELIST_RELOAD_MS)) {
-            reload_whitelist();
-            last_whitelist_reload = xTaskGetTickCount();
+        // Widen the shared scan around expected advertisements
+        if (adv_due()) {
+            ble_scan_hint(BLE_SCAN_HINT_ARRIVAL, ADV_DUE_HINT_MS);
         }
 
         // Periodic scan-alive heartbeat (every 60s)
         if ((xTaskGetTickCount() - last_heartbeat_log) >= pdMS_TO_TICKS(60000)) {
-            ESP_LOGI(BLE_LEAK_TAG, "[HEARTBEAT] Scanner alive, whitelist=%d sensors", s_whitelist_count);
+            ESP_LOGI(BLE_LEAK_TAG, "[HEARTBEAT] Scanner alive, whitelist=%d sensors, "
+                     "adv seen=%lu rejected early=%lu parsed=%lu accepted=%lu late=%lu",
+                     s_whitelist_count, (unsigned long)s_stats.adv_seen,
+                     (unsigned long)s_stats.adv_rejected_early,
+                     (unsigned long)s_stats.adv_parsed, (unsigned long)s_stats.adv_accepted,
+                     (unsigned long)s_stats.adv_late);
             last_heartbeat_log = xTaskGetTickCount();
         }
 
-        vTaskDelay(pdMS_TO_TICKS(500));
+        // Sleep until the next check, or until provisioning changes
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
+    }
+}
+
+/* ---------------------------------------------------------
+ * Provisioning change: wake the scanner task so the whitelist
+ * follows right away. Before the task is past
+ * its NimBLE start wait the notification would release that
+ * wait early, so it is skipped (the task loads the lists when
+ * it starts).
+ * --------------------------------------------------------- */
+static void on_provisioning_changed(uint32_t generation, void *arg)
+{
+    (void)generation;
+    (void)arg;
+    if (s_task_running && ble_leak_task_handle != NULL) {
+        xTaskNotifyGive(ble_leak_task_handle);
     }
 }
 
@@ -388,13 +563,15 @@ void app_ble_leak_init(void)
 {
     ESP_LOGI(BLE_LEAK_TAG, "Initializing BLE leak scanner module");
 
-    ble_leak_rx_queue = xQueueCreate(10, sizeof(ble_leak_event_t));
-    if (ble_leak_rx_queue == NULL) {
-        ESP_LOGE(BLE_LEAK_TAG, "Failed to create event queue");
+    s_doorbell = xQueueCreate(1, sizeof(uint8_t));
+    if (s_doorbell == NULL) {
+        ESP_LOGE(BLE_LEAK_TAG, "Failed to create mailbox doorbell");
         return;
     }
 
+    ble_scan_register(BLE_SCAN_CONSUMER_LEAK, on_scan_report);
     xTaskCreate(ble_leak_scan_task, "ble_leak_scan", 3072, NULL, 4, &ble_leak_task_handle);
+    provisioning_subscribe(on_provisioning_changed, NULL);
 }
 
 void app_ble_leak_signal_start(void)
@@ -404,17 +581,81 @@ void app_ble_leak_signal_start(void)
     }
 }
 
+QueueHandle_t app_ble_leak_doorbell(void)
+{
+    return s_doorbell;
+}
+
+bool app_ble_leak_take(ble_leak_update_t *out)
+{
+    int found = -1;
+    bool more;
+
+    portENTER_CRITICAL(&s_mbox_lock);
+    for (int n = 0; n < MAX_TRACKED_SENSORS; n++) {
+        int i = (s_mbox_cursor + n) % MAX_TRACKED_SENSORS;
+        if (mbox_test(i)) {
+            const leak_mbox_t *m = &s_mbox[i];
+            memcpy(out->sensor_mac, m->mac, 6);
+            out->battery = m->battery;
+            out->leak_detected = m->leak;
+            out->leak_seen = m->leak_seen;
+            out->leak_rx_us = m->leak_rx_us;
+            out->rssi = m->rssi;
+            out->fw = m->fw;
+            s_mbox_dirty[i >> 5] &= ~(1u << (i & 31));
+            s_mbox_cursor = (i + 1) % MAX_TRACKED_SENSORS;
+            found = i;
+            break;
+        }
+    }
+    more = mbox_any_dirty();
+    portEXIT_CRITICAL(&s_mbox_lock);
+
+    if (found < 0) {
+        return false;
+    }
+    out->handle = (dev_handle_t)(DEVREG_HANDLE_BLE_BASE + found);
+    if (more) {
+        ring_doorbell();
+    }
+    return true;
+}
+
+/* ---------------------------------------------------------
+ * Helper: format NimBLE 6-byte MAC (LSB-first) to string "XX:XX:XX:XX:XX:XX"
+ * [0xE6, 0x9A, 0x27, 0xE1, 0x80, 0x00] → "00:80:E1:27:9A:E6"
+ * --------------------------------------------------------- */
+void app_ble_leak_mac_str(const uint8_t mac[6], char *out)
+{
+    sprintf(out, "%02X:%02X:%02X:%02X:%02X:%02X",
+            mac[5], mac[4], mac[3], mac[2], mac[1], mac[0]);
+}
+
+void app_ble_leak_fw_str(uint32_t fw, char *out)
+{
+    if (fw == 0) {
+        out[0] = '\0';
+        return;
+    }
+    snprintf(out, 12, "%u.%u.%u", (unsigned)((fw >> 16) & 0xFF),
+             (unsigned)((fw >> 8) & 0xFF), (unsigned)(fw & 0xFF));
+}
+
 void app_ble_leak_reset_tracking(void)
 {
+    uint8_t bell;
+
+    portENTER_CRITICAL(&s_mbox_lock);
+    memset(s_mbox_dirty, 0, sizeof(s_mbox_dirty));
+    portEXIT_CRITICAL(&s_mbox_lock);
+    while (s_doorbell && xQueueReceive(s_doorbell, &bell, 0) == pdTRUE)
+        ;
     memset(s_sensors, 0, sizeof(s_sensors));
     ESP_LOGI(BLE_LEAK_TAG, "Sensor tracking reset");
 }
 
-void app_ble_leak_process_adv(const void *addr, int8_t rssi,
-                              const uint8_t *data, uint8_t data_len)
+void app_ble_leak_get_stats(ble_leak_scan_stats_t *out)
 {
-    if (ble_leak_rx_queue == NULL || s_whitelist_count == 0) {
-        return;
-    }
-    process_leak_adv((const ble_addr_t *)addr, rssi, data, data_len);
+    *out = s_stats;
 }
@@ -6,27 +6,47 @@
 #include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "device_registry/device_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Queue for sending BLE leak sensor events to IoT Hub task
-extern QueueHandle_t ble_leak_rx_queue;
+/*
+ * Scanner -> IoT Hub delivery: one latest-value mailbox per registry BLE
+ * slot. The scanner overwrites a sensor's mailbox and sets its dirty bit;
+ * only the clean -> dirty edge rings the doorbell (a 1-item queue in the
+ * IoT Hub task's QueueSet), so a flood of adverts costs one wakeup.
+ * Overwriting never loses a leak: a leak heard since the last take stays
+ * flagged (leak_seen) even when the sensor has already reported dry again.
+ */
 
-// BLE leak sensor event (sent from scanner to IoT Hub)
+// Latest state of one sensor, taken from its mailbox (app_ble_leak_take)
 typedef struct {
-    uint8_t sensor_mac[6];     // Raw MAC bytes
-    char sensor_mac_str[18];   // "XX:XX:XX:XX:XX:XX"
+    dev_handle_t handle;       // registry handle of the slot
+    uint8_t sensor_mac[6];     // NimBLE order (LSB first); format when publishing
     uint8_t battery;           // 0-100%
-    bool leak_detected;        // true if leak
-    int8_t rssi;               // Advertisement RSSI
-    char fw_version[12];       // "M.m.p" or "" if not available
-} ble_leak_event_t;
+    bool leak_detected;        // latest leak state
+    bool leak_seen;            // a leak was reported since the last take
+    int64_t leak_rx_us;        // esp_timer time the first of those was heard, 0 = none
+    int8_t rssi;               // RSSI of the latest advertisement
+    uint32_t fw;               // 0x01MMmmpp, 0 = not advertised
+} ble_leak_update_t;
+
+// Advertisement filter counters (app_ble_leak_get_stats)
+typedef struct {
+    uint32_t adv_seen;             // advertisements handed to the scanner
+    uint32_t adv_rejected_early;   // MAC not commissioned, dropped before parsing
+    uint32_t adv_parsed;           // AD payload walked
+    uint32_t adv_accepted;         // eleak name + company ID matched
+    uint32_t adv_late;             // dry sensor heard after its expected slot
+    uint32_t mbox_posted;          // updates written to a mailbox
+    uint32_t mbox_coalesced;       // ... into one still waiting to be taken
+} ble_leak_scan_stats_t;
 
 /**
  * @brief Initialize the BLE leak scanner module.
- * Creates the queue and task (blocked until signaled).
+ * Creates the mailbox doorbell and task (blocked until signaled).
  * Call from app_main() after app_ble_valve_init().
  */
 void app_ble_leak_init(void);
@@ -38,20 +58,42 @@ void app_ble_leak_init(void);
 void app_ble_leak_signal_start(void);
 
 /**
- * @brief Reset per-sensor tracking state so next advertisement
- * from each sensor is treated as "first seen".
- * Call after draining ble_leak_rx_queue (e.g. at IoT Hub startup).
+ * @brief Doorbell queue for the IoT Hub task's QueueSet. Holds one item
+ * while mailboxes are dirty; app_ble_leak_take() re-rings it when it
+ * leaves dirty mailboxes behind.
+ */
+QueueHandle_t app_ble_leak_doorbell(void);
+
+/**
+ * @brief Take the next dirty mailbox (round-robin over slots) and mark it
+ * clean. IoT Hub task only.
+ * @return false if no mailbox is dirty.
+ */
+bool app_ble_leak_take(ble_leak_update_t *out);
+
+/**
+ * @brief Format a NimBLE-order MAC as "XX:XX:XX:XX:XX:XX".
+ * @param out  At least 18 bytes
+ */
+void app_ble_leak_mac_str(const uint8_t mac[6], char *out);
+
+/**
+ * @brief Format a packed firmware version as "M.m.p" ("" if 0).
+ * @param out  At least 12 bytes
+ */
+void app_ble_leak_fw_str(uint32_t fw, char *out);
+
+/**
+ * @brief Discard all dirty mailboxes and the doorbell, and reset per-sensor
+ * tracking state so the next advertisement from each sensor is treated as
+ * "first seen". Call at IoT Hub startup.
  */
 void app_ble_leak_reset_tracking(void);
 
 /**
- * @brief Process a BLE advertisement for possible leak sensor data.
- * Can be called from any scan callback (e.g. the valve module's GAP
- * handler) so leak sensors are detected even while the valve module
- * owns the active scan.
+ * @brief Copy the advertisement filter counters. Safe from any task.
  */
-void app_ble_leak_process_adv(const void *addr, int8_t rssi,
-                              const uint8_t *data, uint8_t data_len);
+void app_ble_leak_get_stats(ble_leak_scan_stats_t *out);
 
 #ifdef __cplusplus
 }
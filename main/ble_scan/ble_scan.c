@@ -0,0 +1,608 @@
+/*
+ * ble_scan.c
+ *
+ * One continuous GAP scan shared by the valve connector and the leak
+ * scanner. See ble_scan.h.
+ */
+
+#include "ble_scan.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "host/ble_gap.h"
+#include "sdkconfig.h"
+#include "device_registry/device_registry.h"
+#include "provisioning_manager/provisioning_manager.h"
+
+static const char *TAG = "BLE_SCAN";
+
+#define SERVICE_PERIOD_MS       1000
+#define GAP_HOUR_US             (3600LL * 1000 * 1000)
+
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+#define ACCEPT_LIST_SIZE        CONFIG_EFLO_BLE_ACCEPT_LIST_SIZE
+#endif
+
+/* Window / interval per duty level, 0.625 ms units, used on both PHYs */
+static const struct {
+    uint16_t    itvl;
+    uint16_t    window;
+    const char *name;
+} k_duty[BLE_SCAN_DUTY_MAX] = {
+    [BLE_SCAN_DUTY_LOW]  = { 320,  32, "low"  },    /* 20 ms / 200 ms */
+    [BLE_SCAN_DUTY_BASE] = { 160,  48, "base" },    /* 30 ms / 100 ms */
+    [BLE_SCAN_DUTY_DUE]  = { 160,  80, "due"  },    /* 50 ms / 100 ms */
+    [BLE_SCAN_DUTY_HIGH] = { 160, 144, "high" },    /* 90 ms / 100 ms */
+};
+
+/* =========================================================================
+ * STATE
+ *
+ * Everything below s_lock is guarded by it. Consumers' requirements are
+ * read without it by the report dispatcher (NimBLE host task): a stale
+ * "enabled" only means one report more or less.
+ * ========================================================================= */
+static SemaphoreHandle_t    s_lock = NULL;
+static TimerHandle_t        s_timer = NULL;
+
+static ble_scan_report_cb_t s_cb[BLE_SCAN_CONSUMER_MAX];
+static ble_scan_req_t       s_req[BLE_SCAN_CONSUMER_MAX];
+
+static volatile bool        s_synced = false;
+static uint8_t              s_own_addr_type = BLE_OWN_ADDR_PUBLIC;
+static int                  s_pause = 0;
+
+static bool                 s_running = false;
+static ble_scan_req_t       s_cur;              /* merged params of the running scan */
+static uint8_t              s_cur_policy = 0;
+static volatile uint8_t     s_cur_duty = BLE_SCAN_DUTY_DUE;
+
+static int64_t              s_hint_until_us[BLE_SCAN_HINT_MAX];     /* 0 = not asserted */
+
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+/* s_al_active is false while the list is replaced or unusable */
+static ble_addr_t           s_al_addrs[ACCEPT_LIST_SIZE];
+static uint8_t              s_al_count = 0;
+static volatile bool        s_al_active = false;
+static uint32_t             s_al_gen = UINT32_MAX;
+#endif
+
+/* Scan gap: wanted (synced and some consumer enabled) but not running */
+static int64_t              s_gap_start_us = 0;     /* 0 = not in a gap */
+static int64_t              s_hour_start_us = 0;
+static int64_t              s_gap_us_hour = 0;
+
+/* Coexistence: scanning time per duty level (sampled by the service timer)
+ * and reports heard per level (host task, unlocked) in the current hour */
+static int64_t              s_last_tick_us = 0;
+static int64_t              s_duty_us_hour[BLE_SCAN_DUTY_MAX];
+static volatile uint32_t    s_reports_hour[BLE_SCAN_DUTY_MAX];
+
+static ble_scan_stats_t     s_stats;
+
+static int scan_gap_event(struct ble_gap_event *event, void *arg);
+
+/* =========================================================================
+ * HELPERS (s_lock held)
+ * ========================================================================= */
+
+/* Merge the enabled consumers' requirements; false if nobody wants a scan */
+static bool merge_requirements(ble_scan_req_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->filter_duplicates = true;
+    for (int i = 0; i < BLE_SCAN_CONSUMER_MAX; i++) {
+        const ble_scan_req_t *r = &s_req[i];
+        if (!r->enabled) {
+            continue;
+        }
+        out->enabled = true;
+        out->active |= r->active;
+        out->coded_phy |= r->coded_phy;
+        out->filter_duplicates &= r->filter_duplicates;
+        out->all_advertisers |= r->all_advertisers;
+    }
+    return out->enabled;
+}
+
+static uint8_t filter_policy_for(const ble_scan_req_t *m)
+{
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    return (s_al_active && !m->all_advertisers) ? 1 : 0;
+#else
+    (void)m;
+    return 0;
+#endif
+}
+
+static bool hint_active(ble_scan_hint_t hint, int64_t now)
+{
+    return s_hint_until_us[hint] > now;
+}
+
+/*
+ * Pick the duty level from the hints. A reported leak wins over Wi-Fi: the
+ * next leak report or the valve reconnect matter more than publish speed.
+ * Otherwise Wi-Fi bursts win over commissioning and expected arrivals, which
+ * a short narrow spell only delays.
+ */
+static ble_scan_duty_t choose_duty(void)
+{
+#if CONFIG_EFLO_BLE_SCAN_ADAPTIVE
+    int64_t now = esp_timer_get_time();
+    if (hint_active(BLE_SCAN_HINT_LEAK, now)) {
+        return BLE_SCAN_DUTY_HIGH;
+    }
+    if (hint_active(BLE_SCAN_HINT_WIFI_TLS, now) || hint_active(BLE_SCAN_HINT_WIFI_BULK, now)) {
+        return BLE_SCAN_DUTY_LOW;
+    }
+    if (hint_active(BLE_SCAN_HINT_COMMISSION, now)) {
+        return BLE_SCAN_DUTY_HIGH;
+    }
+    if (hint_active(BLE_SCAN_HINT_ARRIVAL, now) || s_req[BLE_SCAN_CONSUMER_VALVE].enabled) {
+        return BLE_SCAN_DUTY_DUE;
+    }
+    return BLE_SCAN_DUTY_BASE;
+#else
+    return BLE_SCAN_DUTY_DUE;
+#endif
+}
+
+static void gap_track(void)
+{
+    ble_scan_req_t m;
+    bool in_gap = s_synced && merge_requirements(&m) && !s_running;
+    int64_t now = esp_timer_get_time();
+
+    if (in_gap && s_gap_start_us == 0) {
+        s_gap_start_us = now;
+        s_stats.gaps++;
+    } else if (!in_gap && s_gap_start_us != 0) {
+        s_gap_us_hour += now - s_gap_start_us;
+        s_gap_start_us = 0;
+    }
+}
+
+static void scan_stop(void)
+{
+    if (s_running) {
+        ble_gap_disc_cancel();
+        s_running = false;
+    }
+}
+
+static void scan_start(const ble_scan_req_t *m, uint8_t policy, ble_scan_duty_t duty)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    struct ble_gap_ext_disc_params uncoded = {0};
+    uncoded.itvl = k_duty[duty].itvl;
+    uncoded.window = k_duty[duty].window;
+    uncoded.passive = m->active ? 0 : 1;
+
+    struct ble_gap_ext_disc_params coded = {0};
+    coded.itvl = k_duty[duty].itvl;
+    coded.window = k_duty[duty].window;
+    coded.passive = 1;              /* Coded PHY serves leak sensors only */
+
+    int rc = ble_gap_ext_disc(s_own_addr_type,
+                              0,                        /* duration: continuous */
+                              0,                        /* period: no restart */
+                              m->filter_duplicates ? 1 : 0,
+                              policy,
+                              0,                        /* limited: disabled */
+                              &uncoded,
+                              m->coded_phy ? &coded : NULL,
+                              scan_gap_event, NULL);
+#else
+    struct ble_gap_disc_params params = {0};
+    params.itvl = k_duty[duty].itvl;
+    params.window = k_duty[duty].window;
+    params.passive = m->active ? 0 : 1;
+    params.filter_duplicates = m->filter_duplicates ? 1 : 0;
+    params.filter_policy = policy;
+
+    int rc = ble_gap_disc(s_own_addr_type, BLE_HS_FOREVER, &params, scan_gap_event, NULL);
+#endif
+
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Scan start rc=%d, will retry", rc);
+        return;
+    }
+    s_running = true;
+    s_cur = *m;
+    s_cur_policy = policy;
+    if (duty != s_cur_duty) {
+        s_cur_duty = duty;
+        s_stats.duty_changes++;
+    }
+    s_stats.restarts++;
+    ESP_LOGI(TAG, "Scan started: %s, 1M%s, dup filter %s, %s, duty %s (%u/%u)",
+             m->active ? "active" : "passive", m->coded_phy ? " + Coded" : "",
+             m->filter_duplicates ? "on" : "off", policy ? "accept list" : "accept all",
+             k_duty[duty].name, k_duty[duty].window, k_duty[duty].itvl);
+}
+
+/* Bring the controller scan in line with the merged requirements */
+static void apply(void)
+{
+    ble_scan_req_t m;
+    bool wanted = merge_requirements(&m);
+
+    if (!s_synced) {
+        s_running = false;
+    } else if (!wanted || s_pause > 0) {
+        scan_stop();
+    } else {
+        uint8_t policy = filter_policy_for(&m);
+        ble_scan_duty_t duty = choose_duty();
+        if (s_running && (memcmp(&m, &s_cur, sizeof(m)) != 0 || policy != s_cur_policy ||
+                          duty != s_cur_duty)) {
+            scan_stop();
+        }
+        if (!s_running) {
+            scan_start(&m, policy, duty);
+        }
+    }
+    gap_track();
+}
+
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+/* Registry MAC (printed order) -> public NimBLE address (LSB first) */
+static void accept_list_add(const uint8_t *mac)
+{
+    ble_addr_t *a = &s_al_addrs[s_al_count++];
+    a->type = BLE_ADDR_PUBLIC;
+    for (int i = 0; i < 6; i++) {
+        a->val[i] = mac[5 - i];
+    }
+}
+
+/*
+ * Reprogram the controller accept list from the device registry (valve +
+ * commissioned leak sensors) when the registry generation moved. The list
+ * must not change under a scan that uses it, so the scan is stopped, the
+ * list replaced in one ble_gap_wl_set() call and apply() restarts the scan
+ * with the matching policy. Deferred (retried by the service timer) while a
+ * connection is being established.
+ */
+static void accept_list_refresh(void)
+{
+    uint32_t gen = device_registry_generation();
+    if (!s_synced || gen == s_al_gen || ble_gap_conn_active()) {
+        return;
+    }
+
+    s_al_active = false;
+    scan_stop();
+
+    int ble_count = device_registry_count(DEVREG_BLE_LEAK);
+    int total = ble_count + device_registry_count(DEVREG_VALVE);
+
+    s_al_count = 0;
+    if (total == 0) {
+        ESP_LOGI(TAG, "Accept list unused: nothing commissioned");
+    } else if (total > ACCEPT_LIST_SIZE) {
+        ESP_LOGW(TAG, "Accept list unused: %d devices > %d entries, filtering on host",
+                 total, ACCEPT_LIST_SIZE);
+    } else {
+        uint8_t mac[6];
+        for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+            if (device_registry_get_mac((dev_handle_t)(DEVREG_HANDLE_VALVE + v), mac)) {
+                accept_list_add(mac);
+            }
+        }
+        for (int i = 0; i < DEVREG_MAX_BLE && s_al_count < ACCEPT_LIST_SIZE; i++) {
+            if (device_registry_get_mac((dev_handle_t)(DEVREG_HANDLE_BLE_BASE + i), mac)) {
+                accept_list_add(mac);
+            }
+        }
+
+        int rc = ble_gap_wl_set(s_al_addrs, s_al_count);
+        if (rc == 0) {
+            s_al_active = true;
+            ESP_LOGI(TAG, "Accept list programmed: %u device(s)", s_al_count);
+        } else {
+            ESP_LOGW(TAG, "ble_gap_wl_set rc=%d, scanning accept-all", rc);
+            s_al_count = 0;
+        }
+    }
+    s_al_gen = gen;
+    s_stats.accept_list_size = s_al_active ? s_al_count : 0;
+
+    apply();
+}
+#endif
+
+/* =========================================================================
+ * GAP EVENTS (NimBLE host task)
+ * ========================================================================= */
+
+static void dispatch(const ble_addr_t *addr, int8_t rssi, const uint8_t *data, uint8_t len)
+{
+    s_stats.reports++;
+    s_reports_hour[s_cur_duty]++;
+    for (int i = 0; i < BLE_SCAN_CONSUMER_MAX; i++) {
+        if (s_req[i].enabled && s_cb[i] != NULL) {
+            s_cb[i](addr, rssi, data, len);
+        }
+    }
+}
+
+static int scan_gap_event(struct ble_gap_event *event, void *arg)
+{
+    (void)arg;
+
+    switch (event->type) {
+    case BLE_GAP_EVENT_DISC:
+        dispatch(&event->disc.addr, event->disc.rssi,
+                 event->disc.data, event->disc.length_data);
+        break;
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    case BLE_GAP_EVENT_EXT_DISC:
+        if (event->ext_disc.data_status == BLE_GAP_EXT_ADV_DATA_STATUS_COMPLETE) {
+            dispatch(&event->ext_disc.addr, event->ext_disc.rssi,
+                     event->ext_disc.data, event->ext_disc.length_data);
+        }
+        break;
+#endif
+
+    case BLE_GAP_EVENT_DISC_COMPLETE:
+        ESP_LOGW(TAG, "Scan ended by the stack (reason=%d), restarting",
+                 event->disc_complete.reason);
+        if (xSemaphoreTake(s_lock, portMAX_DELAY) == pdTRUE) {
+            s_running = false;
+            apply();
+            xSemaphoreGive(s_lock);
+        }
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* =========================================================================
+ * SERVICE TIMER
+ * Retries failed starts and deferred accept-list updates, notices a scan
+ * stopped behind our back, drops expired hints, and rolls the hourly gap
+ * and duty counters.
+ * ========================================================================= */
+
+static void hour_roll(int64_t now)
+{
+    if (s_gap_start_us != 0) {
+        s_gap_us_hour += now - s_gap_start_us;
+        s_gap_start_us = now;
+    }
+    s_stats.gap_ms_last_hour = (uint32_t)(s_gap_us_hour / 1000);
+    s_gap_us_hour = 0;
+
+    int64_t window_us = 0;
+    for (int d = 0; d < BLE_SCAN_DUTY_MAX; d++) {
+        s_stats.duty_ms_last_hour[d] = (uint32_t)(s_duty_us_hour[d] / 1000);
+        s_stats.reports_last_hour[d] = s_reports_hour[d];
+        window_us += s_duty_us_hour[d] * k_duty[d].window / k_duty[d].itvl;
+        s_duty_us_hour[d] = 0;
+        s_reports_hour[d] = 0;
+    }
+    int64_t hour_us = now - s_hour_start_us;
+    s_stats.duty_permille_last_hour = hour_us > 0 ? (uint16_t)(window_us * 1000 / hour_us) : 0;
+    s_hour_start_us = now;
+
+    ESP_LOGI(TAG, "Last hour: gap %lu ms (%lu gaps, %lu starts total), scanning %u permille, "
+             "s at low/base/due/high %lu/%lu/%lu/%lu",
+             (unsigned long)s_stats.gap_ms_last_hour,
+             (unsigned long)s_stats.gaps, (unsigned long)s_stats.restarts,
+             s_stats.duty_permille_last_hour,
+             (unsigned long)(s_stats.duty_ms_last_hour[BLE_SCAN_DUTY_LOW] / 1000),
+             (unsigned long)(s_stats.duty_ms_last_hour[BLE_SCAN_DUTY_BASE] / 1000),
+             (unsigned long)(s_stats.duty_ms_last_hour[BLE_SCAN_DUTY_DUE] / 1000),
+             (unsigned long)(s_stats.duty_ms_last_hour[BLE_SCAN_DUTY_HIGH] / 1000));
+}
+
+static void service_timer_cb(TimerHandle_t t)
+{
+    (void)t;
+    if (xSemaphoreTake(s_lock, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (s_running) {
+        s_duty_us_hour[s_cur_duty] += now - s_last_tick_us;
+    }
+    s_last_tick_us = now;
+
+    if (s_running && !ble_gap_disc_active()) {
+        ESP_LOGW(TAG, "Scan no longer active, restarting");
+        s_running = false;
+    }
+    for (int h = 0; h < BLE_SCAN_HINT_MAX; h++) {
+        if (s_hint_until_us[h] != 0 && s_hint_until_us[h] <= now) {
+            s_hint_until_us[h] = 0;
+        }
+    }
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    accept_list_refresh();
+#endif
+    apply();
+
+    if (now - s_hour_start_us >= GAP_HOUR_US) {
+        hour_roll(now);
+    }
+
+    xSemaphoreGive(s_lock);
+}
+
+/* Device list changed: accept list follows right away */
+static void on_provisioning_changed(uint32_t generation, void *arg)
+{
+    (void)generation;
+    (void)arg;
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    if (xSemaphoreTake(s_lock, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        accept_list_refresh();
+        xSemaphoreGive(s_lock);
+    }
+#endif
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+void ble_scan_init(void)
+{
+    if (s_lock != NULL) {
+        return;
+    }
+    s_lock = xSemaphoreCreateMutex();
+    s_timer = xTimerCreate("ble_scan", pdMS_TO_TICKS(SERVICE_PERIOD_MS), pdTRUE,
+                           NULL, service_timer_cb);
+    if (s_lock == NULL || s_timer == NULL) {
+        ESP_LOGE(TAG, "Failed to create lock / timer");
+        return;
+    }
+    s_hour_start_us = esp_timer_get_time();
+    s_last_tick_us = s_hour_start_us;
+    xTimerStart(s_timer, 0);
+    provisioning_subscribe(on_provisioning_changed, NULL);
+}
+
+void ble_scan_register(ble_scan_consumer_t consumer, ble_scan_report_cb_t cb)
+{
+    if (consumer < BLE_SCAN_CONSUMER_MAX) {
+        s_cb[consumer] = cb;
+    }
+}
+
+void ble_scan_request(ble_scan_consumer_t consumer, const ble_scan_req_t *req)
+{
+    if (consumer >= BLE_SCAN_CONSUMER_MAX || s_lock == NULL) {
+        return;
+    }
+    if (xSemaphoreTake(s_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (req != NULL) {
+        s_req[consumer] = *req;
+    } else {
+        memset(&s_req[consumer], 0, sizeof(s_req[consumer]));
+    }
+    apply();
+    xSemaphoreGive(s_lock);
+}
+
+void ble_scan_host_synced(uint8_t own_addr_type)
+{
+    if (s_lock == NULL || xSemaphoreTake(s_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    s_own_addr_type = own_addr_type;
+    s_synced = true;
+    s_running = false;
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    s_al_gen = UINT32_MAX;          /* controller list is empty after a reset */
+    accept_list_refresh();
+#endif
+    apply();
+    xSemaphoreGive(s_lock);
+}
+
+void ble_scan_host_reset(void)
+{
+    if (s_lock == NULL || xSemaphoreTake(s_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    s_synced = false;
+    s_running = false;
+    s_pause = 0;                    /* connection attempts died with the host */
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    s_al_active = false;
+    s_stats.accept_list_size = 0;
+#endif
+    gap_track();
+    xSemaphoreGive(s_lock);
+}
+
+void ble_scan_pause(void)
+{
+    if (s_lock == NULL || xSemaphoreTake(s_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    s_pause++;
+    apply();
+    xSemaphoreGive(s_lock);
+}
+
+void ble_scan_resume(void)
+{
+    if (s_lock == NULL || xSemaphoreTake(s_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (s_pause > 0) {
+        s_pause--;
+    }
+    apply();
+    xSemaphoreGive(s_lock);
+}
+
+void ble_scan_hint(ble_scan_hint_t hint, uint32_t hold_ms)
+{
+    if (hint >= BLE_SCAN_HINT_MAX || s_lock == NULL ||
+        xSemaphoreTake(s_lock, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return;
+    }
+    s_hint_until_us[hint] = hold_ms ? esp_timer_get_time() + (int64_t)hold_ms * 1000 : 0;
+    apply();
+    xSemaphoreGive(s_lock);
+}
+
+const char *ble_scan_duty_str(ble_scan_duty_t duty)
+{
+    return duty < BLE_SCAN_DUTY_MAX ? k_duty[duty].name : "?";
+}
+
+bool ble_scan_accept_list_covers(const uint8_t mac[6])
+{
+#if CONFIG_EFLO_BLE_SCAN_ACCEPT_LIST
+    if (!s_al_active) {
+        return false;
+    }
+    for (int i = 0; i < s_al_count; i++) {
+        bool eq = true;
+        for (int b = 0; b < 6 && eq; b++) {
+            eq = (s_al_addrs[i].val[b] == mac[5 - b]);
+        }
+        if (eq) {
+            return true;
+        }
+    }
+#else
+    (void)mac;
+#endif
+    return false;
+}
+
+void ble_scan_get_stats(ble_scan_stats_t *out)
+{
+    if (s_lock == NULL || xSemaphoreTake(s_lock, pdMS_TO_TICKS(100)) != pdTRUE) {
+        *out = s_stats;
+        return;
+    }
+    *out = s_stats;
+    int64_t gap_us = s_gap_us_hour;
+    if (s_gap_start_us != 0) {
+        gap_us += esp_timer_get_time() - s_gap_start_us;
+    }
+    out->gap_ms_this_hour = (uint32_t)(gap_us / 1000);
+    out->running = s_running;
+    out->duty = s_cur_duty;
+    xSemaphoreGive(s_lock);
+}
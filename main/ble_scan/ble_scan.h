@@ -0,0 +1,164 @@
+/*
+ * ble_scan.h
+ *
+ * Single owner of the NimBLE GAP scan.
+ *
+ * The valve connector and the leak scanner no longer start scans of their
+ * own. Each registers a report callback and states what it needs (active or
+ * passive, Coded PHY, duplicate filtering, advertisers outside the accept
+ * list); the arbiter merges the requirements into one continuous extended
+ * scan and hands every complete advertising report to every consumer that
+ * currently wants scanning.
+ *
+ * The scan only stops when it has to: while a connection is being set up
+ * (ble_scan_pause / ble_scan_resume around ble_gap_connect), while the
+ * controller filter accept list is replaced, and briefly when the merged
+ * parameters change. Time spent not scanning while a consumer wanted it is
+ * counted as scan gap (ble_scan_get_stats).
+ *
+ * The controller filter accept list holds the provisioned valve and the
+ * commissioned leak sensors (device registry). The scan uses it (filter
+ * policy 1) unless a consumer needs every advertiser, e.g. valve discovery
+ * by name.
+ *
+ * Scan window and interval follow the radio's other user. BLE and Wi-Fi
+ * share one 2.4 GHz front end, so the duty cycle is narrowed while the IoT
+ * Hub connection does a TLS handshake or a large publish, and widened after
+ * a leak, during commissioning and while a leak sensor's next advertisement
+ * is due (ble_scan_hint). Time and reports per duty level are counted to
+ * show what each side gave up.
+ */
+
+#ifndef BLE_SCAN_H
+#define BLE_SCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "host/ble_hs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    BLE_SCAN_CONSUMER_VALVE = 0,    /* valve discovery before connect */
+    BLE_SCAN_CONSUMER_LEAK,         /* leak sensor advertisements */
+    BLE_SCAN_CONSUMER_MAX
+} ble_scan_consumer_t;
+
+/* What a consumer needs from the scan. Merged across consumers: active and
+ * Coded PHY if anyone asks, duplicate filtering only if everyone does. */
+typedef struct {
+    bool enabled;               /* wants reports at all */
+    bool active;                /* send scan requests (name in scan response) */
+    bool coded_phy;             /* also scan the LE Coded PHY */
+    bool filter_duplicates;     /* controller may drop repeated reports */
+    bool all_advertisers;       /* needs devices outside the accept list */
+} ble_scan_req_t;
+
+/* Reasons to move the scan duty cycle (ble_scan_hint). Strongest first:
+ * LEAK > WIFI_TLS/WIFI_BULK > COMMISSION > ARRIVAL (or valve search). */
+typedef enum {
+    BLE_SCAN_HINT_WIFI_TLS = 0,     /* broker TLS handshake: narrow */
+    BLE_SCAN_HINT_WIFI_BULK,        /* snapshot pages, offline drain: narrow */
+    BLE_SCAN_HINT_LEAK,             /* leak reported: widen, beats Wi-Fi */
+    BLE_SCAN_HINT_COMMISSION,       /* commissioning window: widen */
+    BLE_SCAN_HINT_ARRIVAL,          /* a leak sensor advertisement is due */
+    BLE_SCAN_HINT_MAX
+} ble_scan_hint_t;
+
+/* Scan duty levels, window / interval on each PHY */
+typedef enum {
+    BLE_SCAN_DUTY_LOW = 0,          /* 20 ms / 200 ms (10 %) */
+    BLE_SCAN_DUTY_BASE,             /* 30 ms / 100 ms (30 %) */
+    BLE_SCAN_DUTY_DUE,              /* 50 ms / 100 ms (50 %) */
+    BLE_SCAN_DUTY_HIGH,             /* 90 ms / 100 ms (90 %) */
+    BLE_SCAN_DUTY_MAX
+} ble_scan_duty_t;
+
+/* Complete advertising report, legacy or extended. Runs in the NimBLE host
+ * task; keep it short. */
+typedef void (*ble_scan_report_cb_t)(const ble_addr_t *addr, int8_t rssi,
+                                     const uint8_t *data, uint8_t len);
+
+/* Arbiter counters (ble_scan_get_stats) */
+typedef struct {
+    uint32_t gap_ms_last_hour;  /* scan gap in the last full hour */
+    uint32_t gap_ms_this_hour;  /* scan gap so far in the current hour */
+    uint32_t gaps;              /* times the scan stopped while wanted */
+    uint32_t restarts;          /* scan (re)starts */
+    uint32_t reports;           /* advertising reports dispatched */
+    uint16_t accept_list_size;  /* controller accept list entries, 0 = accept-all */
+    bool     running;
+    /* Coexistence: where the scan time went in the last full hour */
+    uint8_t  duty;                          /* current ble_scan_duty_t */
+    uint16_t duty_permille_last_hour;       /* share of the hour spent scanning */
+    uint32_t duty_changes;                  /* duty level switches */
+    uint32_t duty_ms_last_hour[BLE_SCAN_DUTY_MAX];  /* scanning at each level */
+    uint32_t reports_last_hour[BLE_SCAN_DUTY_MAX];  /* reports heard at each level */
+} ble_scan_stats_t;
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+/**
+ * @brief  Create the arbiter's lock and service timer and subscribe to
+ *         provisioning changes. Call from app_main after provisioning_init()
+ *         and before the BLE modules register.
+ */
+void ble_scan_init(void);
+
+/**
+ * @brief  Set the report callback of a consumer. Call once at init.
+ */
+void ble_scan_register(ble_scan_consumer_t consumer, ble_scan_report_cb_t cb);
+
+/**
+ * @brief  Update a consumer's requirements (NULL = no longer scanning).
+ *         Starts, retunes or stops the shared scan as needed. Any task.
+ */
+void ble_scan_request(ble_scan_consumer_t consumer, const ble_scan_req_t *req);
+
+/**
+ * @brief  NimBLE host synced / reset. Called from the valve module's
+ *         sync and reset callbacks, which own the host.
+ */
+void ble_scan_host_synced(uint8_t own_addr_type);
+void ble_scan_host_reset(void);
+
+/**
+ * @brief  Stop scanning so the host can initiate a connection; the scan
+ *         stays off until the matching ble_scan_resume(). Nests.
+ */
+void ble_scan_pause(void);
+void ble_scan_resume(void);
+
+/**
+ * @brief  Assert a duty-cycle hint for hold_ms from now (0 = withdraw it).
+ *         Re-asserting moves the deadline. Expired hints are dropped by the
+ *         1 s service timer. Any task; never blocks for long.
+ */
+void ble_scan_hint(ble_scan_hint_t hint, uint32_t hold_ms);
+
+/**
+ * @brief  Short name of a duty level ("low", "base", "due", "high").
+ */
+const char *ble_scan_duty_str(ble_scan_duty_t duty);
+
+/**
+ * @brief  True if the controller accept list is in use and holds this MAC.
+ * @param  mac  6 bytes in printed order (mac[0] is the first "XX:" octet)
+ */
+bool ble_scan_accept_list_covers(const uint8_t mac[6]);
+
+/**
+ * @brief  Copy the arbiter counters. Safe from any task.
+ */
+void ble_scan_get_stats(ble_scan_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_SCAN_H */
@@ -1,8 +1,11 @@
 #include "app_ble_valve.h"
 #include "ble_leak_scanner/app_ble_leak.h"
+#include "ble_scan/ble_scan.h"
 #include "health_engine/health_engine.h"
+#include "leak_latency/leak_latency.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <inttypes.h>
 
@@ -14,6 +17,8 @@
 #include "freertos/event_groups.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "sdkconfig.h"
 
 #include "nimble/nimble_port.h"
@@ -55,6 +60,28 @@
 // Maximum security initiation retries
 #define MAX_SECURITY_RETRIES 3
 
+// GATT handle cache (default NVS partition: a lost cache only costs one discovery).
+// Valve 0 keeps the original key; valve n > 0 uses "map<n>".
+#define GATT_CACHE_NVS_NAMESPACE "valve_gatt"
+#define GATT_CACHE_NVS_KEY       "map"
+#define GATT_CACHE_VERSION       1
+
+// Connection parameter profiles (interval 1.25 ms units, timeout 10 ms units).
+// A fast link claims the radio every 7.5-15 ms: with several valves in an
+// incident the fast interval is multiplied by the number of fast links, so
+// together they leave the shared scan (leak adverts) the air time of one.
+// Relaxed links (latency 4) cost well under 2% each and are not scaled.
+#define LINK_FAST_ITVL_MIN       6      // 7.5 ms
+#define LINK_FAST_ITVL_MAX       12     // 15 ms
+#define LINK_FAST_LATENCY        0
+#define LINK_FAST_TIMEOUT        200    // 2 s
+#define LINK_RELAXED_ITVL_MIN    80     // 100 ms
+#define LINK_RELAXED_ITVL_MAX    160    // 200 ms
+#define LINK_RELAXED_LATENCY     4      // valve may sleep through 4 events
+#define LINK_RELAXED_TIMEOUT     600    // 6 s
+
+#define CMD_QUEUE_LEN            10     // per valve
+
 // -----------------------------------------------------------------------------
 // UUIDS (128-bit Explicit)
 // -----------------------------------------------------------------------------
@@ -93,70 +120,162 @@ static const ble_uuid128_t UUID_CHR_FIRMWARE_REV =
 #define ATT_ERR_INSUFFICIENT_ENC     0x0F
 #define BLE_HS_ATT_ERR(att_err)      (0x100 + (att_err))
 
+
 // -----------------------------------------------------------------------------
 // GLOBALS
 // -----------------------------------------------------------------------------
-static QueueHandle_t ble_cmd_queue = NULL;
 QueueHandle_t ble_update_queue = NULL;
 
 static TaskHandle_t ble_starter_task_handle = NULL;
 
-// Event group for thread-safe state synchronization
-static EventGroupHandle_t ble_state_event_group = NULL;
+// Command task input: the valves' command queues
+static QueueSetHandle_t ble_cmd_set = NULL;
 
 // Mutex for serializing GATT operations
 static SemaphoreHandle_t gatt_mutex = NULL;
 
-static uint16_t valve_conn_handle = BLE_HS_CONN_HANDLE_NONE;
 static bool is_scanning = false;
 static bool g_ble_synced = false;
-static bool g_connect_requested = false;
 
 static uint8_t g_own_addr_type = BLE_OWN_ADDR_PUBLIC;
 
-static char g_valve_mac[18] = {0};
-
-static ble_addr_t g_peer_addr;
-static bool g_peer_addr_valid = false;
-
-static uint16_t h_valve_char = 0, h_flood_char = 0, h_rmleak_char = 0, h_batt_char = 0;
-static uint16_t h_valve_svc_end = 0, h_flood_svc_end = 0, h_batt_svc_end = 0;
-
-static uint16_t h_dis_char = 0;
-static uint16_t h_dis_svc_end = 0;
-static char g_firmware_rev[32] = {0};
-
-static uint8_t g_val_battery = 0;
-static bool g_val_leak = false;
-static int g_val_state = -1;
-static bool g_val_rmleak = false;
-
-static int g_pending_valve_cmd = -1;
-static int g_pending_rmleak_cmd = -1;
-
-static TimerHandle_t sec_timeout_timer = NULL;
-static TimerHandle_t discovery_timeout_timer = NULL;
-static TimerHandle_t post_connect_timer = NULL;
-static TimerHandle_t security_retry_timer = NULL;
-
-static int g_security_retry_count = 0;
-
-// Flag to suppress updates during initial setup (avoid publishing partial data)
-static bool g_setup_in_progress = false;
-
-// Provisioning support - target MAC filtering
-static char g_target_valve_mac[18] = {0};
-static bool g_has_target_mac = false;
+// Handle map of the last valve discovered, keyed by MAC + DIS firmware revision.
+// Reused on reconnect when the valve reports the same firmware at the cached DIS
+// handle; any mismatch or handle error falls back to full discovery.
+typedef struct {
+    uint8_t  version;
+    char     mac[18];
+    char     fw_rev[32];
+    uint16_t valve_char, valve_svc_end, valve_cccd;
+    uint16_t flood_char, flood_svc_end, flood_cccd;
+    uint16_t rmleak_char, rmleak_cccd;
+    uint16_t batt_char, batt_svc_end, batt_cccd;
+    uint16_t dis_char, dis_svc_end;
+} gatt_cache_t;
+
+// Command objects: one slot per writable characteristic (see app_ble_valve.h)
+typedef struct
+{
+    ble_valve_cmd_id_t id;      // 0 = slot empty
+    uint8_t value;
+    bool written;               // write issued for this command
+    bool acked;                 // write response received
+    bool confirmed;             // valve reported the value
+    TickType_t deadline;        // 0 = none
+    ble_valve_cmd_cb_t cb;
+    void *ctx;
+} valve_cmd_slot_t;
+
+// One valve: link, GATT setup state machine, values and command slots.
+// Passed as the argument of its GAP, GATT and timer callbacks.
+typedef struct
+{
+    int idx;
+    QueueHandle_t cmd_queue;
+    EventGroupHandle_t state_event_group;   // BLE_STATE_BIT_*
+
+    uint16_t conn_handle;
+    bool connect_requested;
+    char mac[18];                           // peer of the current connection
+
+    ble_addr_t peer_addr;
+    bool peer_addr_valid;
+
+    uint16_t h_valve_char, h_flood_char, h_rmleak_char, h_batt_char;
+    uint16_t h_valve_svc_end, h_flood_svc_end, h_batt_svc_end;
+    uint16_t h_dis_char, h_dis_svc_end;
+    uint16_t h_valve_cccd, h_flood_cccd, h_rmleak_cccd, h_batt_cccd;
+    char firmware_rev[32];
+
+    gatt_cache_t gatt_cache;
+    bool gatt_cache_valid;
+    bool gatt_from_cache;                   // this connection runs on cached handles
+
+    // Connect-to-ready timing
+    int64_t conn_start_us;                  // CONNECT event
+    int64_t setup_start_us;                 // link secured, discovery / cache check started
+    uint64_t ready_sum_ms[2];               // [0] full discovery, [1] cached
+    ble_valve_conn_stats_t conn_stats;
+
+    // Connection parameter profile: wanted (any task) vs requested on this link
+    volatile ble_valve_link_profile_t link_profile;
+    int link_requested;                     // -1 = nothing requested on this connection
+    uint16_t link_requested_itvl;           // interval max of that request
+
+    uint8_t val_battery;
+    bool val_leak;
+    int val_state;
+    bool val_rmleak;
+
+    int pending_valve_cmd;
+    int pending_rmleak_cmd;
+
+    // Values last reported by the valve (notify or read), -1 = not yet this connection.
+    // val_state / val_rmleak also follow our own writes; these do not.
+    int rep_state;
+    int rep_rmleak;
+
+    valve_cmd_slot_t cmd_slot[BLE_VALVE_TARGET_MAX];
+    bool cmd_queued[BLE_VALVE_TARGET_MAX];  // a BLE_CMD_WRITE_* message is on cmd_queue
+
+    TimerHandle_t sec_timeout_timer;
+    TimerHandle_t discovery_timeout_timer;
+    TimerHandle_t post_connect_timer;
+    TimerHandle_t security_retry_timer;
+
+    int security_retry_count;
+
+    // Suppress updates during initial setup (avoid publishing partial data)
+    bool setup_in_progress;
+    int setup_step;
+
+    // Provisioning support - target MAC filtering
+    char target_mac[18];
+    bool has_target_mac;
+} valve_t;
+
+// Usable before app_ble_valve_init (provisioning may set targets first)
+static valve_t g_valves[BLE_VALVE_MAX] = {
+    [0 ... BLE_VALVE_MAX - 1] = {
+        .conn_handle = BLE_HS_CONN_HANDLE_NONE,
+        .link_profile = BLE_VALVE_LINK_RELAXED,
+        .link_requested = -1,
+        .val_state = -1,
+        .pending_valve_cmd = -1,
+        .pending_rmleak_cmd = -1,
+        .rep_state = -1,
+        .rep_rmleak = -1,
+    },
+};
+
+// Valve whose ble_gap_connect is in flight. The host runs one connection
+// establishment at a time and the shared scan is paused meanwhile, so
+// valves are connected one after the other.
+static valve_t *g_connecting = NULL;
+
+static ble_valve_cmd_id_t g_next_cmd_id = 1;
+static portMUX_TYPE g_cmd_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define CMD_DEADLINE_POLL_MS 500   // command task wakes this often while a deadline is armed
 
 // Forward declarations
 static int ble_gap_event(struct ble_gap_event *event, void *arg);
 static void start_scan(void);
-static void start_discovery_chain(void);
+static void stop_scan(void);
+static void start_discovery_chain(valve_t *v);
 static void sec_timeout_cb(TimerHandle_t xTimer);
 static void discovery_timeout_cb(TimerHandle_t xTimer);
 static void post_connect_timer_cb(TimerHandle_t xTimer);
 static void security_retry_timer_cb(TimerHandle_t xTimer);
-static void initiate_security(void);
+static void initiate_security(valve_t *v);
+static void apply_link_profile(valve_t *v);
+
+static valve_t *valve_at(int valve)
+{
+    if (valve < 0 || valve >= BLE_VALVE_MAX)
+        return NULL;
+    return &g_valves[valve];
+}
 
 // -----------------------------------------------------------------------------
 // DEBUG HELPER
@@ -188,52 +307,54 @@ static const char* state_bits_to_str(EventBits_t bits)
 // -----------------------------------------------------------------------------
 // EVENT GROUP HELPERS
 // -----------------------------------------------------------------------------
-static void set_state_bit(EventBits_t bit)
+static void set_state_bit(valve_t *v, EventBits_t bit)
 {
-    if (ble_state_event_group != NULL)
+    if (v->state_event_group != NULL)
     {
-        xEventGroupSetBits(ble_state_event_group, bit);
-        ESP_LOGI(BLE_TAG, "[STATE] Set bit 0x%02X -> %s", (unsigned)bit, state_bits_to_str(xEventGroupGetBits(ble_state_event_group)));
+        xEventGroupSetBits(v->state_event_group, bit);
+        ESP_LOGI(BLE_TAG, "[STATE] Valve %d set bit 0x%02X -> %s", v->idx, (unsigned)bit,
+                 state_bits_to_str(xEventGroupGetBits(v->state_event_group)));
     }
 }
 
-static void clear_state_bit(EventBits_t bit)
+static void clear_state_bit(valve_t *v, EventBits_t bit)
 {
-    if (ble_state_event_group != NULL)
+    if (v->state_event_group != NULL)
     {
-        xEventGroupClearBits(ble_state_event_group, bit);
-        ESP_LOGI(BLE_TAG, "[STATE] Clear bit 0x%02X -> %s", (unsigned)bit, state_bits_to_str(xEventGroupGetBits(ble_state_event_group)));
+        xEventGroupClearBits(v->state_event_group, bit);
+        ESP_LOGI(BLE_TAG, "[STATE] Valve %d clear bit 0x%02X -> %s", v->idx, (unsigned)bit,
+                 state_bits_to_str(xEventGroupGetBits(v->state_event_group)));
     }
 }
 
-static void clear_all_state_bits(void)
+static void clear_all_state_bits(valve_t *v)
 {
-    if (ble_state_event_group != NULL)
+    if (v->state_event_group != NULL)
     {
-        xEventGroupClearBits(ble_state_event_group,
+        xEventGroupClearBits(v->state_event_group,
             BLE_STATE_BIT_CONNECTED | BLE_STATE_BIT_PAIRING | BLE_STATE_BIT_ENCRYPTED |
             BLE_STATE_BIT_AUTHENTICATED | BLE_STATE_BIT_BONDED | BLE_STATE_BIT_DISCOVERY_DONE);
-        ESP_LOGI(BLE_TAG, "[STATE] All bits cleared");
+        ESP_LOGI(BLE_TAG, "[STATE] Valve %d all bits cleared", v->idx);
     }
 }
 
-static EventBits_t get_state_bits(void)
+static EventBits_t get_state_bits(const valve_t *v)
 {
-    if (ble_state_event_group != NULL)
+    if (v->state_event_group != NULL)
     {
-        return xEventGroupGetBits(ble_state_event_group);
+        return xEventGroupGetBits(v->state_event_group);
     }
     return 0;
 }
 
-static bool is_link_encrypted(void)
+static bool is_link_encrypted(const valve_t *v)
 {
-    return (get_state_bits() & BLE_STATE_BIT_ENCRYPTED) != 0;
+    return (get_state_bits(v) & BLE_STATE_BIT_ENCRYPTED) != 0;
 }
 
-static bool is_ready_for_gatt(void)
+static bool is_ready_for_gatt(const valve_t *v)
 {
-    EventBits_t bits = get_state_bits();
+    EventBits_t bits = get_state_bits(v);
     return (bits & BLE_STATE_BIT_READY_FOR_GATT) == BLE_STATE_BIT_READY_FOR_GATT;
 }
 
@@ -241,16 +362,16 @@ static bool is_ready_for_gatt(void)
 // SECURITY INITIATION
 // Called after connection to start the pairing/encryption process
 // -----------------------------------------------------------------------------
-static void initiate_security(void)
+static void initiate_security(valve_t *v)
 {
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
     {
         ESP_LOGW(BLE_TAG, "[SECURITY] Cannot initiate - no connection");
         return;
     }
 
     struct ble_gap_conn_desc desc;
-    int rc = ble_gap_conn_find(valve_conn_handle, &desc);
+    int rc = ble_gap_conn_find(v->conn_handle, &desc);
     if (rc != 0)
     {
         ESP_LOGE(BLE_TAG, "[SECURITY] Cannot find connection: rc=%d", rc);
@@ -259,10 +380,10 @@ static void initiate_security(void)
 
     ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
     ESP_LOGI(BLE_TAG, "║            SECURITY INITIATION (attempt %d/%d)                ║",
-             g_security_retry_count + 1, MAX_SECURITY_RETRIES);
+             v->security_retry_count + 1, MAX_SECURITY_RETRIES);
     ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
 
-    ESP_LOGI(BLE_TAG, "[SECURITY] Connection handle: %d", valve_conn_handle);
+    ESP_LOGI(BLE_TAG, "[SECURITY] Valve %d, connection handle: %d", v->idx, v->conn_handle);
     ESP_LOGI(BLE_TAG, "[SECURITY] Role: %s", (desc.role == BLE_GAP_ROLE_MASTER) ? "MASTER/CENTRAL" : "SLAVE/PERIPHERAL");
     ESP_LOGI(BLE_TAG, "[SECURITY] Peer addr: %02X:%02X:%02X:%02X:%02X:%02X",
              desc.peer_id_addr.val[5], desc.peer_id_addr.val[4], desc.peer_id_addr.val[3],
@@ -276,34 +397,34 @@ static void initiate_security(void)
     {
         ESP_LOGI(BLE_TAG, "[SECURITY] Already encrypted (bonded reconnection)");
 
-        set_state_bit(BLE_STATE_BIT_ENCRYPTED);
+        set_state_bit(v, BLE_STATE_BIT_ENCRYPTED);
 
         if (desc.sec_state.authenticated)
-            set_state_bit(BLE_STATE_BIT_AUTHENTICATED);
+            set_state_bit(v, BLE_STATE_BIT_AUTHENTICATED);
         if (desc.sec_state.bonded)
-            set_state_bit(BLE_STATE_BIT_BONDED);
+            set_state_bit(v, BLE_STATE_BIT_BONDED);
 
-        if (sec_timeout_timer)
-            xTimerStop(sec_timeout_timer, 0);
+        if (v->sec_timeout_timer)
+            xTimerStop(v->sec_timeout_timer, 0);
 
         ESP_LOGI(BLE_TAG, "[SECURITY] Proceeding to service discovery...");
-        start_discovery_chain();
+        start_discovery_chain(v);
         return;
     }
 
     // Not encrypted - need to initiate pairing
     ESP_LOGI(BLE_TAG, "[SECURITY] Link not encrypted. Initiating pairing...");
-    set_state_bit(BLE_STATE_BIT_PAIRING);
+    set_state_bit(v, BLE_STATE_BIT_PAIRING);
 
-    if (sec_timeout_timer)
-        xTimerReset(sec_timeout_timer, 0);
+    if (v->sec_timeout_timer)
+        xTimerReset(v->sec_timeout_timer, 0);
 
     ESP_LOGI(BLE_TAG, "[SECURITY] SM Config: io_cap=%d, bonding=%d, mitm=%d, sc=%d",
              ble_hs_cfg.sm_io_cap, ble_hs_cfg.sm_bonding,
              ble_hs_cfg.sm_mitm, ble_hs_cfg.sm_sc);
 
-    ESP_LOGI(BLE_TAG, "[SECURITY] Calling ble_gap_security_initiate(handle=%d)...", valve_conn_handle);
-    rc = ble_gap_security_initiate(valve_conn_handle);
+    ESP_LOGI(BLE_TAG, "[SECURITY] Calling ble_gap_security_initiate(handle=%d)...", v->conn_handle);
+    rc = ble_gap_security_initiate(v->conn_handle);
 
     if (rc == 0)
     {
@@ -322,7 +443,7 @@ static void initiate_security(void)
 
     // Try ble_gap_pair_initiate as fallback
     ESP_LOGI(BLE_TAG, "[SECURITY] Trying ble_gap_pair_initiate() as fallback...");
-    rc = ble_gap_pair_initiate(valve_conn_handle);
+    rc = ble_gap_pair_initiate(v->conn_handle);
 
     if (rc == 0)
     {
@@ -331,97 +452,99 @@ static void initiate_security(void)
     }
 
     ESP_LOGE(BLE_TAG, "[SECURITY] ble_gap_pair_initiate() FAILED: rc=%d", rc);
-    clear_state_bit(BLE_STATE_BIT_PAIRING);
+    clear_state_bit(v, BLE_STATE_BIT_PAIRING);
 
     // Schedule retry if not exceeded max
-    g_security_retry_count++;
-    if (g_security_retry_count < MAX_SECURITY_RETRIES && security_retry_timer != NULL)
+    v->security_retry_count++;
+    if (v->security_retry_count < MAX_SECURITY_RETRIES && v->security_retry_timer != NULL)
     {
         ESP_LOGW(BLE_TAG, "[SECURITY] Scheduling retry %d/%d in %d ms...",
-                 g_security_retry_count, MAX_SECURITY_RETRIES, SECURITY_RETRY_DELAY_MS);
-        xTimerStart(security_retry_timer, 0);
+                 v->security_retry_count, MAX_SECURITY_RETRIES, SECURITY_RETRY_DELAY_MS);
+        xTimerStart(v->security_retry_timer, 0);
     }
     else
     {
         ESP_LOGE(BLE_TAG, "[SECURITY] Max retries exceeded. Starting discovery anyway...");
-        start_discovery_chain();
+        start_discovery_chain(v);
     }
 }
 
 // -----------------------------------------------------------------------------
-// TIMER CALLBACKS
+// TIMER CALLBACKS (timer ID = valve)
 // -----------------------------------------------------------------------------
 static void security_retry_timer_cb(TimerHandle_t xTimer)
 {
-    (void)xTimer;
+    valve_t *v = (valve_t *)pvTimerGetTimerID(xTimer);
 
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
     {
         ESP_LOGW(BLE_TAG, "[SECURITY_RETRY] Connection lost");
         return;
     }
 
-    if (is_link_encrypted())
+    if (is_link_encrypted(v))
     {
         ESP_LOGI(BLE_TAG, "[SECURITY_RETRY] Already encrypted, skipping retry");
         return;
     }
 
     ESP_LOGI(BLE_TAG, "[SECURITY_RETRY] Retrying security initiation...");
-    initiate_security();
+    initiate_security(v);
 }
 
 static void post_connect_timer_cb(TimerHandle_t xTimer)
 {
-    (void)xTimer;
+    valve_t *v = (valve_t *)pvTimerGetTimerID(xTimer);
 
-    ESP_LOGI(BLE_TAG, "[TIMER] Post-connect delay complete.");
+    ESP_LOGI(BLE_TAG, "[TIMER] Valve %d post-connect delay complete.", v->idx);
 
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
     {
         ESP_LOGW(BLE_TAG, "[TIMER] Connection lost");
         return;
     }
 
-    g_security_retry_count = 0;
+    v->security_retry_count = 0;
     ESP_LOGI(BLE_TAG, "[TIMER] Initiating security...");
-    initiate_security();
+    initiate_security(v);
 }
 
 static void sec_timeout_cb(TimerHandle_t xTimer)
 {
-    (void)xTimer;
+    valve_t *v = (valve_t *)pvTimerGetTimerID(xTimer);
 
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
         return;
 
-    if (!is_ready_for_gatt())
+    if (!is_ready_for_gatt(v))
     {
-        ESP_LOGE(BLE_TAG, "[TIMEOUT] Setup incomplete. State: %s", state_bits_to_str(get_state_bits()));
+        ESP_LOGE(BLE_TAG, "[TIMEOUT] Valve %d setup incomplete. State: %s", v->idx,
+                 state_bits_to_str(get_state_bits(v)));
         ESP_LOGE(BLE_TAG, "[TIMEOUT] Disconnecting to retry...");
-        ble_gap_terminate(valve_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        ble_gap_terminate(v->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
     }
 }
 
 static void discovery_timeout_cb(TimerHandle_t xTimer)
 {
-    (void)xTimer;
+    valve_t *v = (valve_t *)pvTimerGetTimerID(xTimer);
 
-    if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE && !is_ready_for_gatt())
+    if (v->conn_handle != BLE_HS_CONN_HANDLE_NONE && !is_ready_for_gatt(v))
     {
-        ESP_LOGE(BLE_TAG, "[TIMEOUT] Discovery timeout. Disconnecting...");
-        ble_gap_terminate(valve_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        ESP_LOGE(BLE_TAG, "[TIMEOUT] Valve %d discovery timeout. Disconnecting...", v->idx);
+        ble_gap_terminate(v->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
     }
 }
 
 // -----------------------------------------------------------------------------
 // UPDATE NOTIFY
 // -----------------------------------------------------------------------------
-static void notify_hub_update(ble_update_type_t update_type)
+static void notify_hub_update(valve_t *v, ble_update_type_t update_type)
 {
     if (ble_update_queue != NULL)
     {
-        (void)xQueueSend(ble_update_queue, &update_type, 0);
+        ble_valve_update_t upd = {.type = update_type, .valve = (uint8_t)v->idx};
+        (void)xQueueSend(ble_update_queue, &upd, 0);
     }
     /* Health engine: every notification proves the valve link is alive, so
      * any data-bearing update (STATE/LEAK/RMLEAK/BATTERY) refreshes
@@ -429,16 +552,173 @@ static void notify_hub_update(ble_update_type_t update_type)
      * the snapshot would grow unboundedly even while battery NOTIFYs and
      * state changes are arriving every few minutes. */
     if (update_type == BLE_UPD_DISCONNECTED)
-        health_post_valve_event(false);
+        health_post_valve_event(v->idx, false);
     else if (update_type != BLE_UPD_NONE)
-        health_post_valve_event(true);
+        health_post_valve_event(v->idx, true);
+}
+
+// -----------------------------------------------------------------------------
+// COMMAND OBJECTS
+// -----------------------------------------------------------------------------
+static const char *target_name(ble_valve_target_t target)
+{
+    return target == BLE_VALVE_TARGET_STATE ? "VALVE" : "RMLEAK";
 }
 
-static int on_notify(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om, void *arg)
+// Empty a slot and run its callback outside the lock. Called with g_cmd_lock held;
+// returns with it released.
+static void cmd_complete_unlock(valve_t *v, ble_valve_target_t target, ble_valve_cmd_status_t status)
+{
+    valve_cmd_slot_t done = v->cmd_slot[target];
+    v->cmd_slot[target].id = 0;
+    portEXIT_CRITICAL(&g_cmd_lock);
+
+    ESP_LOGI(BLE_TAG, "[CMD] Valve %d %s #%lu val=%u %s", v->idx, target_name(target),
+             (unsigned long)done.id, done.value, ble_valve_cmd_status_str(status));
+    if (done.cb)
+        done.cb(done.id, status, done.ctx);
+}
+
+// The GATT write of `val` went out on `target`
+static void cmd_on_written(valve_t *v, ble_valve_target_t target, uint8_t val)
+{
+    int rep = (target == BLE_VALVE_TARGET_STATE) ? v->rep_state : v->rep_rmleak;
+
+    portENTER_CRITICAL(&g_cmd_lock);
+    valve_cmd_slot_t *c = &v->cmd_slot[target];
+    if (c->id != 0 && c->value == val)
+    {
+        c->written = true;
+        c->acked = false;
+        // Valve already holds the value: it will not notify a change
+        c->confirmed = (rep == (int)val);
+    }
+    portEXIT_CRITICAL(&g_cmd_lock);
+}
+
+// Write response (status 0) or error for `val` on `target`
+static void cmd_on_write_rsp(valve_t *v, ble_valve_target_t target, uint8_t val, int status)
+{
+    portENTER_CRITICAL(&g_cmd_lock);
+    valve_cmd_slot_t *c = &v->cmd_slot[target];
+    if (c->id == 0 || c->value != val || !c->written)
+    {
+        portEXIT_CRITICAL(&g_cmd_lock);
+        return;
+    }
+
+    if (status == BLE_HS_ENOTCONN)
+    {
+        // Link dropped under the write: rewrite after the reconnect
+        c->written = false;
+        portEXIT_CRITICAL(&g_cmd_lock);
+        if (target == BLE_VALVE_TARGET_STATE)
+            v->pending_valve_cmd = (int)val;
+        else
+            v->pending_rmleak_cmd = (int)val;
+        return;
+    }
+    if (status != 0)
+    {
+        cmd_complete_unlock(v, target, BLE_VALVE_CMD_FAILED);
+        return;
+    }
+
+    c->acked = true;
+    if (c->confirmed)
+    {
+        cmd_complete_unlock(v, target, BLE_VALVE_CMD_DONE);
+        return;
+    }
+    portEXIT_CRITICAL(&g_cmd_lock);
+}
+
+// The valve reported `val` on `target` (notify or read)
+static void cmd_on_report(valve_t *v, ble_valve_target_t target, uint8_t val)
+{
+    portENTER_CRITICAL(&g_cmd_lock);
+    valve_cmd_slot_t *c = &v->cmd_slot[target];
+    if (c->id == 0 || c->value != val || !c->written)
+    {
+        portEXIT_CRITICAL(&g_cmd_lock);
+        return;
+    }
+    c->confirmed = true;
+    if (c->acked)
+    {
+        cmd_complete_unlock(v, target, BLE_VALVE_CMD_DONE);
+        return;
+    }
+    portEXIT_CRITICAL(&g_cmd_lock);
+}
+
+// Time out commands past their deadline, dropping their unwritten writes.
+// Returns true while any deadline is still armed.
+static bool cmd_check_deadlines(valve_t *v)
+{
+    bool armed = false;
+    TickType_t now = xTaskGetTickCount();
+
+    for (int t = 0; t < BLE_VALVE_TARGET_MAX; t++)
+    {
+        portENTER_CRITICAL(&g_cmd_lock);
+        valve_cmd_slot_t *c = &v->cmd_slot[t];
+        if (c->id == 0 || c->deadline == 0)
+        {
+            portEXIT_CRITICAL(&g_cmd_lock);
+            continue;
+        }
+        if ((int32_t)(now - c->deadline) < 0)
+        {
+            armed = true;
+            portEXIT_CRITICAL(&g_cmd_lock);
+            continue;
+        }
+        if (!c->written)
+        {
+            int *pending = (t == BLE_VALVE_TARGET_STATE) ? &v->pending_valve_cmd : &v->pending_rmleak_cmd;
+            if (*pending == (int)c->value)
+                *pending = -1;
+        }
+        cmd_complete_unlock(v, (ble_valve_target_t)t, BLE_VALVE_CMD_TIMEOUT);
+    }
+    return armed;
+}
+
+// Write callback argument: valve index, target and value
+#define CMD_WRITE_ARG(valve, target, val) \
+    ((void *)(uintptr_t)(((valve) << 16) | ((target) << 8) | (val)))
+
+static int on_cmd_write_cb(uint16_t conn_handle,
+                           const struct ble_gatt_error *error,
+                           struct ble_gatt_attr *attr,
+                           void *arg)
 {
     (void)conn_handle;
-    (void)arg;
+    (void)attr;
+    valve_t *v = valve_at((int)(((uintptr_t)arg >> 16) & 0xFF));
+    ble_valve_target_t target = (ble_valve_target_t)(((uintptr_t)arg >> 8) & 0xFF);
+    uint8_t val = (uint8_t)((uintptr_t)arg & 0xFF);
+
+    if (v == NULL)
+        return 0;
+
+    if (error->status == 0)
+    {
+        if (target == BLE_VALVE_TARGET_STATE && val == 0)
+            leak_latency_mark(v->idx, LEAK_LAT_ACKED);
+    }
+    else
+    {
+        ESP_LOGW(BLE_TAG, "[CMD] Valve %d %s write val=%u failed status=0x%04X",
+                 v->idx, target_name(target), val, error->status);
+    }
+    cmd_on_write_rsp(v, target, val, error->status);
+    return 0;
+}
 
+static int on_notify(valve_t *v, uint16_t attr_handle, struct os_mbuf *om)
+{
     uint8_t data[16] = {0};
     uint16_t len = OS_MBUF_PKTLEN(om);
     if (len > sizeof(data))
@@ -446,54 +726,289 @@ static int on_notify(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf
 
     os_mbuf_copydata(om, 0, len, data);
 
-    ESP_LOGI(BLE_TAG, "[NOTIFY] attr_handle=%u, len=%u", attr_handle, len);
+    ESP_LOGI(BLE_TAG, "[NOTIFY] valve=%d attr_handle=%u, len=%u", v->idx, attr_handle, len);
     print_hex_dump("Notify data", data, len);
 
-    if (attr_handle == h_valve_char)
+    if (attr_handle == v->h_valve_char)
+    {
+        int old_state = v->val_state;
+        v->val_state = data[0];
+        ESP_LOGI(BLE_TAG, "[DATA] Valve %d State=%d (%s)", v->idx, v->val_state,
+                 v->val_state ? "OPEN" : "CLOSED");
+        v->rep_state = data[0];
+        if (v->val_state == 0)
+            leak_latency_mark(v->idx, LEAK_LAT_CLOSED);
+        cmd_on_report(v, BLE_VALVE_TARGET_STATE, data[0]);
+        if (old_state != v->val_state && !v->setup_in_progress)
+            notify_hub_update(v, BLE_UPD_STATE);
+    }
+    else if (attr_handle == v->h_flood_char)
+    {
+        bool old_leak = v->val_leak;
+        v->val_leak = (data[0] != 0);
+        ESP_LOGI(BLE_TAG, "[DATA] Valve %d Leak=%d (%s)", v->idx, v->val_leak,
+                 v->val_leak ? "LEAK" : "OK");
+        if (old_leak != v->val_leak && !v->setup_in_progress)
+            notify_hub_update(v, BLE_UPD_LEAK);
+    }
+    else if (attr_handle == v->h_rmleak_char)
+    {
+        bool old_rmleak = v->val_rmleak;
+        v->val_rmleak = (data[0] != 0);
+        ESP_LOGI(BLE_TAG, "[DATA] Valve %d RMLEAK=%d (%s)", v->idx, v->val_rmleak,
+                 v->val_rmleak ? "ACTIVE" : "CLEAR");
+        v->rep_rmleak = v->val_rmleak ? 1 : 0;
+        cmd_on_report(v, BLE_VALVE_TARGET_RMLEAK, (uint8_t)v->rep_rmleak);
+        if (old_rmleak != v->val_rmleak && !v->setup_in_progress)
+            notify_hub_update(v, BLE_UPD_RMLEAK);
+    }
+    else if (attr_handle == v->h_batt_char)
+    {
+        uint8_t old_batt = v->val_battery;
+        v->val_battery = data[0];
+        ESP_LOGI(BLE_TAG, "[DATA] Valve %d Battery=%u%%", v->idx, v->val_battery);
+        if (old_batt != v->val_battery && !v->setup_in_progress)
+            notify_hub_update(v, BLE_UPD_BATTERY);
+    }
+    else
     {
-        int old_state = g_val_state;
-        g_val_state = data[0];
-        ESP_LOGI(BLE_TAG, "[DATA] Valve State=%d (%s)", g_val_state, g_val_state ? "OPEN" : "CLOSED");
-        if (old_state != g_val_state && !g_setup_in_progress)
-            notify_hub_update(BLE_UPD_STATE);
+        ESP_LOGW(BLE_TAG, "[NOTIFY] Valve %d unknown attr_handle=%u", v->idx, attr_handle);
     }
-    else if (attr_handle == h_flood_char)
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// GATT HANDLE CACHE
+// -----------------------------------------------------------------------------
+static void reset_gatt_handles(valve_t *v)
+{
+    v->h_valve_char = 0;
+    v->h_flood_char = 0;
+    v->h_rmleak_char = 0;
+    v->h_batt_char = 0;
+    v->h_dis_char = 0;
+    v->h_valve_svc_end = 0;
+    v->h_flood_svc_end = 0;
+    v->h_batt_svc_end = 0;
+    v->h_dis_svc_end = 0;
+    v->h_valve_cccd = 0;
+    v->h_flood_cccd = 0;
+    v->h_rmleak_cccd = 0;
+    v->h_batt_cccd = 0;
+    v->firmware_rev[0] = '\0';
+    v->gatt_from_cache = false;
+}
+
+static void gatt_cache_key(const valve_t *v, char *key, size_t len)
+{
+    if (v->idx == 0)
+        snprintf(key, len, "%s", GATT_CACHE_NVS_KEY);
+    else
+        snprintf(key, len, "%s%d", GATT_CACHE_NVS_KEY, v->idx);
+}
+
+static void gatt_cache_load(valve_t *v)
+{
+    char key[8];
+    nvs_handle_t h;
+    if (nvs_open(GATT_CACHE_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+        return;
+
+    gatt_cache_key(v, key, sizeof(key));
+    size_t len = sizeof(v->gatt_cache);
+    esp_err_t err = nvs_get_blob(h, key, &v->gatt_cache, &len);
+    nvs_close(h);
+
+    v->gatt_cache_valid = (err == ESP_OK && len == sizeof(v->gatt_cache) &&
+                           v->gatt_cache.version == GATT_CACHE_VERSION);
+    if (v->gatt_cache_valid)
     {
-        bool old_leak = g_val_leak;
-        g_val_leak = (data[0] != 0);
-        ESP_LOGI(BLE_TAG, "[DATA] Leak=%d (%s)", g_val_leak, g_val_leak ? "LEAK" : "OK");
-        if (old_leak != g_val_leak && !g_setup_in_progress)
-            notify_hub_update(BLE_UPD_LEAK);
+        ESP_LOGI(BLE_TAG, "[CACHE] Valve %d handle map loaded for %s, fw \"%s\"",
+                 v->idx, v->gatt_cache.mac, v->gatt_cache.fw_rev);
     }
-    else if (attr_handle == h_rmleak_char)
+}
+
+// Store the handles of a completed discovery. Needs the DIS firmware revision
+// (the cache key); skipped when nothing changed.
+static void gatt_cache_save(valve_t *v)
+{
+    if (v->h_dis_char == 0 || v->firmware_rev[0] == '\0' || v->h_valve_char == 0 || v->h_flood_char == 0)
+        return;
+
+    gatt_cache_t c = {
+        .version = GATT_CACHE_VERSION,
+        .valve_char = v->h_valve_char, .valve_svc_end = v->h_valve_svc_end, .valve_cccd = v->h_valve_cccd,
+        .flood_char = v->h_flood_char, .flood_svc_end = v->h_flood_svc_end, .flood_cccd = v->h_flood_cccd,
+        .rmleak_char = v->h_rmleak_char, .rmleak_cccd = v->h_rmleak_cccd,
+        .batt_char = v->h_batt_char, .batt_svc_end = v->h_batt_svc_end, .batt_cccd = v->h_batt_cccd,
+        .dis_char = v->h_dis_char, .dis_svc_end = v->h_dis_svc_end,
+    };
+    strncpy(c.mac, v->mac, sizeof(c.mac) - 1);
+    strncpy(c.fw_rev, v->firmware_rev, sizeof(c.fw_rev) - 1);
+
+    if (v->gatt_cache_valid && memcmp(&c, &v->gatt_cache, sizeof(c)) == 0)
+        return;
+
+    char key[8];
+    nvs_handle_t h;
+    if (nvs_open(GATT_CACHE_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
     {
-        bool old_rmleak = g_val_rmleak;
-        g_val_rmleak = (data[0] != 0);
-        ESP_LOGI(BLE_TAG, "[DATA] RMLEAK=%d (%s)", g_val_rmleak, g_val_rmleak ? "ACTIVE" : "CLEAR");
-        if (old_rmleak != g_val_rmleak && !g_setup_in_progress)
-            notify_hub_update(BLE_UPD_RMLEAK);
+        ESP_LOGW(BLE_TAG, "[CACHE] NVS open failed, handle map not stored");
+        return;
     }
-    else if (attr_handle == h_batt_char)
+    gatt_cache_key(v, key, sizeof(key));
+    esp_err_t err = nvs_set_blob(h, key, &c, sizeof(c));
+    if (err == ESP_OK)
+        err = nvs_commit(h);
+    nvs_close(h);
+
+    if (err == ESP_OK)
     {
-        uint8_t old_batt = g_val_battery;
-        g_val_battery = data[0];
-        ESP_LOGI(BLE_TAG, "[DATA] Battery=%u%%", g_val_battery);
-        if (old_batt != g_val_battery && !g_setup_in_progress)
-            notify_hub_update(BLE_UPD_BATTERY);
+        v->gatt_cache = c;
+        v->gatt_cache_valid = true;
+        ESP_LOGI(BLE_TAG, "[CACHE] Valve %d handle map stored for %s, fw \"%s\"", v->idx, c.mac, c.fw_rev);
     }
     else
     {
-        ESP_LOGW(BLE_TAG, "[NOTIFY] Unknown attr_handle=%u", attr_handle);
+        ESP_LOGW(BLE_TAG, "[CACHE] Handle map store failed: %s", esp_err_to_name(err));
     }
+}
 
-    return 0;
+static void gatt_cache_invalidate(valve_t *v)
+{
+    char key[8];
+    v->gatt_cache_valid = false;
+
+    nvs_handle_t h;
+    if (nvs_open(GATT_CACHE_NVS_NAMESPACE, NVS_READWRITE, &h) == ESP_OK)
+    {
+        gatt_cache_key(v, key, sizeof(key));
+        nvs_erase_key(h, key);
+        nvs_commit(h);
+        nvs_close(h);
+    }
+}
+
+static void gatt_cache_apply(valve_t *v)
+{
+    const gatt_cache_t *c = &v->gatt_cache;
+
+    v->h_valve_char = c->valve_char;
+    v->h_valve_svc_end = c->valve_svc_end;
+    v->h_valve_cccd = c->valve_cccd;
+    v->h_flood_char = c->flood_char;
+    v->h_flood_svc_end = c->flood_svc_end;
+    v->h_flood_cccd = c->flood_cccd;
+    v->h_rmleak_char = c->rmleak_char;
+    v->h_rmleak_cccd = c->rmleak_cccd;
+    v->h_batt_char = c->batt_char;
+    v->h_batt_svc_end = c->batt_svc_end;
+    v->h_batt_cccd = c->batt_cccd;
+    v->h_dis_char = c->dis_char;
+    v->h_dis_svc_end = c->dis_svc_end;
+    v->gatt_from_cache = true;
+}
+
+// Remember which characteristic a discovered CCCD belongs to
+static void note_cccd(valve_t *v, uint16_t chr_val_handle, uint16_t cccd)
+{
+    if (chr_val_handle == v->h_valve_char)
+        v->h_valve_cccd = cccd;
+    else if (chr_val_handle == v->h_flood_char)
+        v->h_flood_cccd = cccd;
+    else if (chr_val_handle == v->h_rmleak_char)
+        v->h_rmleak_cccd = cccd;
+    else if (chr_val_handle == v->h_batt_char)
+        v->h_batt_cccd = cccd;
+}
+
+// -----------------------------------------------------------------------------
+// CONNECTION PARAMETERS
+// -----------------------------------------------------------------------------
+static int count_fast_links(void)
+{
+    int n = 0;
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        if (g_valves[i].conn_handle != BLE_HS_CONN_HANDLE_NONE &&
+            g_valves[i].link_profile == BLE_VALVE_LINK_FAST)
+            n++;
+    }
+    return n;
+}
+
+// Request the wanted profile once per connection and change. Setup runs on the
+// parameters of the connect; the profile is applied when setup completes.
+static void apply_link_profile(valve_t *v)
+{
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE || !is_ready_for_gatt(v))
+        return;
+
+    ble_valve_link_profile_t profile = v->link_profile;
+    bool fast = (profile == BLE_VALVE_LINK_FAST);
+    int share = fast ? count_fast_links() : 1;
+    if (share < 1)
+        share = 1;
+
+    struct ble_gap_upd_params p = {
+        .itvl_min = fast ? LINK_FAST_ITVL_MIN * share : LINK_RELAXED_ITVL_MIN,
+        .itvl_max = fast ? LINK_FAST_ITVL_MAX * share : LINK_RELAXED_ITVL_MAX,
+        .latency = fast ? LINK_FAST_LATENCY : LINK_RELAXED_LATENCY,
+        .supervision_timeout = fast ? LINK_FAST_TIMEOUT : LINK_RELAXED_TIMEOUT,
+        .min_ce_len = 0,
+        .max_ce_len = 0,
+    };
+
+    if (v->link_requested == (int)profile && v->link_requested_itvl == p.itvl_max)
+        return;
+
+    int rc = ble_gap_update_params(v->conn_handle, &p);
+    if (rc == 0)
+    {
+        v->link_requested = (int)profile;
+        v->link_requested_itvl = p.itvl_max;
+        ESP_LOGI(BLE_TAG, "[LINK] Valve %d requested %s profile (itvl %u-%u, latency %u)",
+                 v->idx, fast ? "fast" : "relaxed", p.itvl_min, p.itvl_max, p.latency);
+    }
+    else
+    {
+        ESP_LOGW(BLE_TAG, "[LINK] Valve %d ble_gap_update_params rc=%d", v->idx, rc);
+    }
+}
+
+// A valve's fast profile changed the fast-link count: rescale the others
+static void rescale_fast_links(const valve_t *changed)
+{
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        valve_t *o = &g_valves[i];
+        if (o != changed && o->link_profile == BLE_VALVE_LINK_FAST)
+            apply_link_profile(o);
+    }
 }
 
 // -----------------------------------------------------------------------------
 // SEQUENTIAL SETUP (subscribing to notifications and reading initial values)
 // -----------------------------------------------------------------------------
-static int setup_step = 0;
-static void setup_next_step(void);
+static void setup_next_step(valve_t *v);
+
+// CCCD write callback argument: valve index and characteristic value handle
+#define CCCD_WRITE_ARG(valve, chr) ((void *)(uintptr_t)(((valve) << 16) | (chr)))
+
+// A cached handle turned out wrong: drop the cache and discover from scratch
+static bool reject_cache_on_error(valve_t *v, const struct ble_gatt_error *error)
+{
+    if (!v->gatt_from_cache || error->status == BLE_HS_ENOTCONN)
+        return false;
+
+    ESP_LOGW(BLE_TAG, "[CACHE] Valve %d cached handle failed (status=0x%04X), rediscovering",
+             v->idx, error->status);
+    v->conn_stats.cache_misses++;
+    gatt_cache_invalidate(v);
+    start_discovery_chain(v);
+    return true;
+}
 
 static int on_cccd_write_cb(uint16_t conn_handle,
                             const struct ble_gatt_error *error,
@@ -501,7 +1016,11 @@ static int on_cccd_write_cb(uint16_t conn_handle,
                             void *arg)
 {
     (void)attr;
-    uint16_t chr_val_handle = (uint16_t)(uintptr_t)arg;
+    valve_t *v = valve_at((int)(((uintptr_t)arg >> 16) & 0xFF));
+    uint16_t chr_val_handle = (uint16_t)((uintptr_t)arg & 0xFFFF);
+
+    if (v == NULL)
+        return 0;
 
     if (error->status == 0)
     {
@@ -514,17 +1033,21 @@ static int on_cccd_write_cb(uint16_t conn_handle,
         if (error->status == BLE_HS_ATT_ERR(ATT_ERR_INSUFFICIENT_AUTHEN) ||
             error->status == BLE_HS_ATT_ERR(ATT_ERR_INSUFFICIENT_ENC))
         {
-            if (!is_link_encrypted() && conn_handle != BLE_HS_CONN_HANDLE_NONE)
+            if (!is_link_encrypted(v) && conn_handle != BLE_HS_CONN_HANDLE_NONE)
             {
                 ESP_LOGI(BLE_TAG, "[SETUP] Auth error - triggering security...");
-                g_security_retry_count = 0;
-                initiate_security();
+                v->security_retry_count = 0;
+                initiate_security(v);
                 return 0;
             }
         }
+        else if (reject_cache_on_error(v, error))
+        {
+            return 0;
+        }
     }
 
-    setup_next_step();
+    setup_next_step(v);
     return 0;
 }
 
@@ -534,7 +1057,7 @@ static int on_dsc_disc_cb(uint16_t conn_handle,
                           const struct ble_gatt_dsc *dsc,
                           void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (error->status == 0)
     {
@@ -544,13 +1067,14 @@ static int on_dsc_disc_cb(uint16_t conn_handle,
         if (uuid16 == BLE_GATT_DSC_CLT_CFG_UUID16)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] CCCD found at handle=%u, enabling notifications", dsc->handle);
+            note_cccd(v, chr_val_handle, dsc->handle);
             uint8_t cccd[2] = {0x01, 0x00};
             int rc = ble_gattc_write_flat(conn_handle, dsc->handle, cccd, sizeof(cccd),
-                                          on_cccd_write_cb, (void *)(uintptr_t)chr_val_handle);
+                                          on_cccd_write_cb, CCCD_WRITE_ARG(v->idx, chr_val_handle));
             if (rc != 0)
             {
                 ESP_LOGE(BLE_TAG, "[SETUP] CCCD write start failed rc=%d", rc);
-                setup_next_step();
+                setup_next_step(v);
             }
             return BLE_HS_EDONE;
         }
@@ -566,7 +1090,7 @@ static int on_dsc_disc_cb(uint16_t conn_handle,
         ESP_LOGE(BLE_TAG, "[SETUP] Descriptor discovery error status=%d", error->status);
     }
 
-    setup_next_step();
+    setup_next_step(v);
     return 0;
 }
 
@@ -575,7 +1099,7 @@ static int on_read_cb(uint16_t conn_handle,
                       struct ble_gatt_attr *attr,
                       void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (error->status == 0 && attr != NULL)
     {
@@ -589,7 +1113,7 @@ static int on_read_cb(uint16_t conn_handle,
             os_mbuf_copydata(attr->om, 0, len, data);
             print_hex_dump("Read data", data, len);
         }
-        on_notify(conn_handle, attr->handle, attr->om, NULL);
+        on_notify(v, attr->handle, attr->om);
     }
     else
     {
@@ -598,17 +1122,21 @@ static int on_read_cb(uint16_t conn_handle,
         if (error->status == BLE_HS_ATT_ERR(ATT_ERR_INSUFFICIENT_AUTHEN) ||
             error->status == BLE_HS_ATT_ERR(ATT_ERR_INSUFFICIENT_ENC))
         {
-            if (!is_link_encrypted() && conn_handle != BLE_HS_CONN_HANDLE_NONE)
+            if (!is_link_encrypted(v) && conn_handle != BLE_HS_CONN_HANDLE_NONE)
             {
                 ESP_LOGI(BLE_TAG, "[SETUP] Auth error on read - triggering security...");
-                g_security_retry_count = 0;
-                initiate_security();
+                v->security_retry_count = 0;
+                initiate_security(v);
                 return 0;
             }
         }
+        else if (reject_cache_on_error(v, error))
+        {
+            return 0;
+        }
     }
 
-    setup_next_step();
+    setup_next_step(v);
     return 0;
 }
 
@@ -618,245 +1146,297 @@ static int on_read_dis_cb(uint16_t conn_handle,
                           void *arg)
 {
     (void)conn_handle;
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (error->status == 0 && attr != NULL && attr->om != NULL)
     {
         uint16_t len = OS_MBUF_PKTLEN(attr->om);
-        if (len > sizeof(g_firmware_rev) - 1)
-            len = sizeof(g_firmware_rev) - 1;
-        os_mbuf_copydata(attr->om, 0, len, g_firmware_rev);
-        g_firmware_rev[len] = '\0';
-        ESP_LOGI(BLE_TAG, "[SETUP] Valve Firmware Rev: \"%s\"", g_firmware_rev);
+        if (len > sizeof(v->firmware_rev) - 1)
+            len = sizeof(v->firmware_rev) - 1;
+        os_mbuf_copydata(attr->om, 0, len, v->firmware_rev);
+        v->firmware_rev[len] = '\0';
+        ESP_LOGI(BLE_TAG, "[SETUP] Valve %d Firmware Rev: \"%s\"", v->idx, v->firmware_rev);
     }
     else
     {
         ESP_LOGW(BLE_TAG, "[SETUP] DIS firmware rev read failed status=0x%04X", error->status);
-        g_firmware_rev[0] = '\0';
+        v->firmware_rev[0] = '\0';
     }
 
-    setup_next_step();
+    setup_next_step(v);
     return 0;
 }
 
-static void apply_pending_valve_cmd_if_any(void)
+static void apply_pending_valve_cmd_if_any(valve_t *v)
 {
-    if (!is_ready_for_gatt() || valve_conn_handle == BLE_HS_CONN_HANDLE_NONE || h_valve_char == 0)
+    if (!is_ready_for_gatt(v) || v->conn_handle == BLE_HS_CONN_HANDLE_NONE || v->h_valve_char == 0)
         return;
 
-    if (g_pending_valve_cmd == 0 || g_pending_valve_cmd == 1)
+    if (v->pending_valve_cmd == 0 || v->pending_valve_cmd == 1)
     {
-        uint8_t v = (uint8_t)g_pending_valve_cmd;
+        uint8_t val = (uint8_t)v->pending_valve_cmd;
 
-        ESP_LOGI(BLE_TAG, "[CMD] Applying pending valve command=%d", g_pending_valve_cmd);
+        ESP_LOGI(BLE_TAG, "[CMD] Valve %d applying pending valve command=%d", v->idx, v->pending_valve_cmd);
 
         if (gatt_mutex != NULL && xSemaphoreTake(gatt_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
         {
-            int rc = ble_gattc_write_flat(valve_conn_handle, h_valve_char, &v, 1, NULL, NULL);
+            cmd_on_written(v, BLE_VALVE_TARGET_STATE, val);
+            int rc = ble_gattc_write_flat(v->conn_handle, v->h_valve_char, &val, 1, on_cmd_write_cb,
+                                          CMD_WRITE_ARG(v->idx, BLE_VALVE_TARGET_STATE, val));
             ESP_LOGI(BLE_TAG, "[CMD] Valve write rc=%d", rc);
             if (rc == 0)
             {
-                g_val_state = v;
-                notify_hub_update(BLE_UPD_STATE);
+                if (val == 0)
+                    leak_latency_mark(v->idx, LEAK_LAT_WRITE);
+                v->val_state = val;
+                notify_hub_update(v, BLE_UPD_STATE);
+            }
+            else
+            {
+                cmd_on_write_rsp(v, BLE_VALVE_TARGET_STATE, val, rc);
             }
             xSemaphoreGive(gatt_mutex);
         }
-        g_pending_valve_cmd = -1;
+        v->pending_valve_cmd = -1;
     }
 }
 
-static void apply_pending_rmleak_cmd_if_any(void)
+static void apply_pending_rmleak_cmd_if_any(valve_t *v)
 {
-    if (!is_ready_for_gatt() || valve_conn_handle == BLE_HS_CONN_HANDLE_NONE || h_rmleak_char == 0)
+    if (!is_ready_for_gatt(v) || v->conn_handle == BLE_HS_CONN_HANDLE_NONE || v->h_rmleak_char == 0)
         return;
 
-    if (g_pending_rmleak_cmd == 0 || g_pending_rmleak_cmd == 1)
+    if (v->pending_rmleak_cmd == 0 || v->pending_rmleak_cmd == 1)
     {
-        uint8_t v = (uint8_t)g_pending_rmleak_cmd;
+        uint8_t val = (uint8_t)v->pending_rmleak_cmd;
 
-        ESP_LOGI(BLE_TAG, "[CMD] Applying pending RMLEAK command=%d", g_pending_rmleak_cmd);
+        ESP_LOGI(BLE_TAG, "[CMD] Valve %d applying pending RMLEAK command=%d", v->idx, v->pending_rmleak_cmd);
 
         if (gatt_mutex != NULL && xSemaphoreTake(gatt_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
         {
-            int rc = ble_gattc_write_flat(valve_conn_handle, h_rmleak_char, &v, 1, NULL, NULL);
+            cmd_on_written(v, BLE_VALVE_TARGET_RMLEAK, val);
+            int rc = ble_gattc_write_flat(v->conn_handle, v->h_rmleak_char, &val, 1, on_cmd_write_cb,
+                                          CMD_WRITE_ARG(v->idx, BLE_VALVE_TARGET_RMLEAK, val));
             ESP_LOGI(BLE_TAG, "[CMD] RMLEAK write rc=%d", rc);
             if (rc == 0)
             {
-                g_val_rmleak = (v != 0);
+                v->val_rmleak = (val != 0);
+            }
+            else
+            {
+                cmd_on_write_rsp(v, BLE_VALVE_TARGET_RMLEAK, val, rc);
             }
             xSemaphoreGive(gatt_mutex);
         }
-        g_pending_rmleak_cmd = -1;
+        v->pending_rmleak_cmd = -1;
     }
 }
 
-static void setup_next_step(void)
+// Enable notifications on one characteristic. With cached handles the CCCD
+// is written directly; otherwise its descriptors are discovered first.
+// Returns true if a GATT procedure is in flight (its callback continues setup).
+static bool subscribe_chr(valve_t *v, const char *name, uint16_t chr, uint16_t end, uint16_t cccd)
 {
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    int rc;
+
+    if (chr == 0 || end == 0)
+        return false;
+
+    if (v->gatt_from_cache)
+    {
+        if (cccd == 0)
+            return false;   // no CCCD when the map was discovered
+        ESP_LOGI(BLE_TAG, "[SETUP] Subscribe %s (chr=%u, cccd=%u, cached)", name, chr, cccd);
+        uint8_t val[2] = {0x01, 0x00};
+        rc = ble_gattc_write_flat(v->conn_handle, cccd, val, sizeof(val),
+                                  on_cccd_write_cb, CCCD_WRITE_ARG(v->idx, chr));
+    }
+    else
+    {
+        ESP_LOGI(BLE_TAG, "[SETUP] Subscribe %s (chr=%u, end=%u)", name, chr, end);
+        rc = ble_gattc_disc_all_dscs(v->conn_handle, chr, end, on_dsc_disc_cb, v);
+    }
+
+    if (rc != 0)
+        ESP_LOGE(BLE_TAG, "[SETUP] subscribe %s rc=%d", name, rc);
+    return rc == 0;
+}
+
+static void setup_next_step(valve_t *v)
+{
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
     {
-        ESP_LOGW(BLE_TAG, "[SETUP] Connection lost during setup");
+        ESP_LOGW(BLE_TAG, "[SETUP] Valve %d connection lost during setup", v->idx);
         return;
     }
 
-    setup_step++;
-    ESP_LOGI(BLE_TAG, "[SETUP] Step %d", setup_step);
+    v->setup_step++;
+    ESP_LOGI(BLE_TAG, "[SETUP] Valve %d step %d", v->idx, v->setup_step);
 
-    switch (setup_step)
+    switch (v->setup_step)
     {
     case 1:
-        if (h_valve_char && h_valve_svc_end)
-        {
-            ESP_LOGI(BLE_TAG, "[SETUP] Subscribe VALVE (chr=%u, end=%u)", h_valve_char, h_valve_svc_end);
-            int rc = ble_gattc_disc_all_dscs(valve_conn_handle, h_valve_char, h_valve_svc_end, on_dsc_disc_cb, NULL);
-            if (rc == 0) return;
-            ESP_LOGE(BLE_TAG, "[SETUP] disc dsc valve rc=%d", rc);
-        }
-        setup_next_step();
+        if (subscribe_chr(v, "VALVE", v->h_valve_char, v->h_valve_svc_end, v->h_valve_cccd)) return;
+        setup_next_step(v);
         break;
 
     case 2:
-        if (h_flood_char && h_flood_svc_end)
-        {
-            ESP_LOGI(BLE_TAG, "[SETUP] Subscribe FLOOD (chr=%u, end=%u)", h_flood_char, h_flood_svc_end);
-            int rc = ble_gattc_disc_all_dscs(valve_conn_handle, h_flood_char, h_flood_svc_end, on_dsc_disc_cb, NULL);
-            if (rc == 0) return;
-            ESP_LOGE(BLE_TAG, "[SETUP] disc dsc flood rc=%d", rc);
-        }
-        setup_next_step();
+        if (subscribe_chr(v, "FLOOD", v->h_flood_char, v->h_flood_svc_end, v->h_flood_cccd)) return;
+        setup_next_step(v);
         break;
 
     case 3:
-        if (h_rmleak_char && h_flood_svc_end)
-        {
-            ESP_LOGI(BLE_TAG, "[SETUP] Subscribe RMLEAK (chr=%u, end=%u)", h_rmleak_char, h_flood_svc_end);
-            int rc = ble_gattc_disc_all_dscs(valve_conn_handle, h_rmleak_char, h_flood_svc_end, on_dsc_disc_cb, NULL);
-            if (rc == 0) return;
-            ESP_LOGE(BLE_TAG, "[SETUP] disc dsc rmleak rc=%d", rc);
-        }
-        setup_next_step();
+        if (subscribe_chr(v, "RMLEAK", v->h_rmleak_char, v->h_flood_svc_end, v->h_rmleak_cccd)) return;
+        setup_next_step(v);
         break;
 
     case 4:
-        if (h_batt_char && h_batt_svc_end)
-        {
-            ESP_LOGI(BLE_TAG, "[SETUP] Subscribe BATT (chr=%u, end=%u)", h_batt_char, h_batt_svc_end);
-            int rc = ble_gattc_disc_all_dscs(valve_conn_handle, h_batt_char, h_batt_svc_end, on_dsc_disc_cb, NULL);
-            if (rc == 0) return;
-            ESP_LOGE(BLE_TAG, "[SETUP] disc dsc batt rc=%d", rc);
-        }
-        setup_next_step();
+        if (subscribe_chr(v, "BATT", v->h_batt_char, v->h_batt_svc_end, v->h_batt_cccd)) return;
+        setup_next_step(v);
         break;
 
     case 5:
-        if (h_valve_char)
+        if (v->h_valve_char)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] Read VALVE");
-            int rc = ble_gattc_read(valve_conn_handle, h_valve_char, on_read_cb, NULL);
+            int rc = ble_gattc_read(v->conn_handle, v->h_valve_char, on_read_cb, v);
             if (rc == 0) return;
             ESP_LOGE(BLE_TAG, "[SETUP] read valve rc=%d", rc);
         }
-        setup_next_step();
+        setup_next_step(v);
         break;
 
     case 6:
-        if (h_flood_char)
+        if (v->h_flood_char)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] Read FLOOD");
-            int rc = ble_gattc_read(valve_conn_handle, h_flood_char, on_read_cb, NULL);
+            int rc = ble_gattc_read(v->conn_handle, v->h_flood_char, on_read_cb, v);
             if (rc == 0) return;
             ESP_LOGE(BLE_TAG, "[SETUP] read flood rc=%d", rc);
         }
-        setup_next_step();
+        setup_next_step(v);
         break;
 
     case 7:
-        if (h_rmleak_char)
+        if (v->h_rmleak_char)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] Read RMLEAK");
-            int rc = ble_gattc_read(valve_conn_handle, h_rmleak_char, on_read_cb, NULL);
+            int rc = ble_gattc_read(v->conn_handle, v->h_rmleak_char, on_read_cb, v);
             if (rc == 0) return;
             ESP_LOGE(BLE_TAG, "[SETUP] read rmleak rc=%d", rc);
         }
-        setup_next_step();
+        setup_next_step(v);
         break;
 
     case 8:
-        if (h_batt_char)
+        if (v->h_batt_char)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] Read BATT");
-            int rc = ble_gattc_read(valve_conn_handle, h_batt_char, on_read_cb, NULL);
+            int rc = ble_gattc_read(v->conn_handle, v->h_batt_char, on_read_cb, v);
             if (rc == 0) return;
             ESP_LOGE(BLE_TAG, "[SETUP] read batt rc=%d", rc);
         }
-        setup_next_step();
+        setup_next_step(v);
         break;
 
     case 9:
-        if (h_dis_char)
+        // A cache hit has already read the firmware revision (cache key)
+        if (v->h_dis_char && !v->gatt_from_cache)
         {
             ESP_LOGI(BLE_TAG, "[SETUP] Read DIS Firmware Rev");
-            int rc = ble_gattc_read(valve_conn_handle, h_dis_char, on_read_dis_cb, NULL);
+            int rc = ble_gattc_read(v->conn_handle, v->h_dis_char, on_read_dis_cb, v);
             if (rc == 0) return;
             ESP_LOGE(BLE_TAG, "[SETUP] read DIS fw_rev rc=%d", rc);
         }
-        setup_next_step();
+        setup_next_step(v);
         break;
 
     default:
+    {
         // Done with setup
-        g_security_retry_count = 0;
+        v->security_retry_count = 0;
 
-        if (discovery_timeout_timer)
-            xTimerStop(discovery_timeout_timer, 0);
-        if (sec_timeout_timer)
-            xTimerStop(sec_timeout_timer, 0);
+        if (v->discovery_timeout_timer)
+            xTimerStop(v->discovery_timeout_timer, 0);
+        if (v->sec_timeout_timer)
+            xTimerStop(v->sec_timeout_timer, 0);
 
-        set_state_bit(BLE_STATE_BIT_DISCOVERY_DONE);
+        set_state_bit(v, BLE_STATE_BIT_DISCOVERY_DONE);
 
         ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
         ESP_LOGI(BLE_TAG, "║            SETUP COMPLETE - READY FOR GATT                   ║");
         ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
+        ESP_LOGI(BLE_TAG, "[READY] Valve %d %s", v->idx, v->mac);
         ESP_LOGI(BLE_TAG, "[READY] Valve=%u, Flood=%u, RMLEAK=%u, Batt=%u, DIS=%u",
-                 h_valve_char, h_flood_char, h_rmleak_char, h_batt_char, h_dis_char);
-        ESP_LOGI(BLE_TAG, "[READY] FW Rev: \"%s\"", g_firmware_rev[0] ? g_firmware_rev : "(not available)");
+                 v->h_valve_char, v->h_flood_char, v->h_rmleak_char, v->h_batt_char, v->h_dis_char);
+        ESP_LOGI(BLE_TAG, "[READY] FW Rev: \"%s\"", v->firmware_rev[0] ? v->firmware_rev : "(not available)");
         ESP_LOGI(BLE_TAG, "[READY] Battery=%u%%, Leak=%s, Valve=%s, RMLEAK=%s",
-                 g_val_battery,
-                 g_val_leak ? "LEAK" : "OK",
-                 g_val_state == 1 ? "OPEN" : (g_val_state == 0 ? "CLOSED" : "UNKNOWN"),
-                 g_val_rmleak ? "ACTIVE" : "CLEAR");
-        ESP_LOGI(BLE_TAG, "[READY] State: %s", state_bits_to_str(get_state_bits()));
-
-        g_setup_in_progress = false;
-        notify_hub_update(BLE_UPD_CONNECTED);
-        apply_pending_valve_cmd_if_any();
-        apply_pending_rmleak_cmd_if_any();
+                 v->val_battery,
+                 v->val_leak ? "LEAK" : "OK",
+                 v->val_state == 1 ? "OPEN" : (v->val_state == 0 ? "CLOSED" : "UNKNOWN"),
+                 v->val_rmleak ? "ACTIVE" : "CLEAR");
+        ESP_LOGI(BLE_TAG, "[READY] State: %s", state_bits_to_str(get_state_bits(v)));
+
+        int64_t now_us = esp_timer_get_time();
+        uint32_t ready_ms = (uint32_t)((now_us - v->conn_start_us) / 1000);
+        uint32_t setup_ms = (uint32_t)((now_us - v->setup_start_us) / 1000);
+        int idx = v->gatt_from_cache ? 1 : 0;
+        v->ready_sum_ms[idx] += ready_ms;
+        v->conn_stats.last_ready_ms = ready_ms;
+        v->conn_stats.last_setup_ms = setup_ms;
+        v->conn_stats.last_from_cache = v->gatt_from_cache;
+        if (v->gatt_from_cache)
+        {
+            v->conn_stats.cached_count++;
+            v->conn_stats.cached_avg_ms = (uint32_t)(v->ready_sum_ms[1] / v->conn_stats.cached_count);
+        }
+        else
+        {
+            v->conn_stats.full_count++;
+            v->conn_stats.full_avg_ms = (uint32_t)(v->ready_sum_ms[0] / v->conn_stats.full_count);
+        }
+        ESP_LOGI(BLE_TAG, "[READY] Connect-to-ready %lu ms (setup %lu ms, %s handles)",
+                 (unsigned long)ready_ms, (unsigned long)setup_ms,
+                 v->gatt_from_cache ? "cached" : "discovered");
+
+        if (!v->gatt_from_cache)
+            gatt_cache_save(v);
+
+        v->setup_in_progress = false;
+        notify_hub_update(v, BLE_UPD_CONNECTED);
+        apply_pending_valve_cmd_if_any(v);
+        apply_pending_rmleak_cmd_if_any(v);
+        apply_link_profile(v);
+        if (v->link_profile == BLE_VALVE_LINK_FAST)
+            rescale_fast_links(v);
         break;
     }
+    }
 }
 
 // -----------------------------------------------------------------------------
-// DISCOVERY CHAIN
+// DISCOVERY CHAIN (callback argument = valve)
 // -----------------------------------------------------------------------------
 static int on_disc_dis_chr(uint16_t conn, const struct ble_gatt_error *err,
                            const struct ble_gatt_chr *chr, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_dis_char = chr->val_handle;
+        v->h_dis_char = chr->val_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found DIS Firmware Rev char: val_handle=%u", chr->val_handle);
-        setup_step = 0;
-        setup_next_step();
+        v->setup_step = 0;
+        setup_next_step(v);
         return BLE_HS_EDONE;
     }
 
     if (err->status == BLE_HS_EDONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] DIS Firmware Rev char not found");
-        h_dis_char = 0;
-        setup_step = 0;
-        setup_next_step();
+        v->h_dis_char = 0;
+        v->setup_step = 0;
+        setup_next_step(v);
     }
 
     return 0;
@@ -865,23 +1445,23 @@ static int on_disc_dis_chr(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_dis_svc(uint16_t conn, const struct ble_gatt_error *err,
                            const struct ble_gatt_svc *svc, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_dis_svc_end = svc->end_handle;
+        v->h_dis_svc_end = svc->end_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found DIS svc: start=%u, end=%u", svc->start_handle, svc->end_handle);
-        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_FIRMWARE_REV.u, on_disc_dis_chr, NULL);
+        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_FIRMWARE_REV.u, on_disc_dis_chr, v);
         return BLE_HS_EDONE;
     }
 
     if (err->status == BLE_HS_EDONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] DIS svc not found (optional, continuing)");
-        h_dis_char = 0;
-        h_dis_svc_end = 0;
-        setup_step = 0;
-        setup_next_step();
+        v->h_dis_char = 0;
+        v->h_dis_svc_end = 0;
+        v->setup_step = 0;
+        setup_next_step(v);
     }
 
     return 0;
@@ -890,23 +1470,23 @@ static int on_disc_dis_svc(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_batt_chr(uint16_t conn, const struct ble_gatt_error *err,
                             const struct ble_gatt_chr *chr, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_batt_char = chr->val_handle;
+        v->h_batt_char = chr->val_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found BATT char: val_handle=%u, props=0x%02X", chr->val_handle, chr->properties);
         // Chain to DIS discovery (optional service)
-        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_DIS.u, on_disc_dis_svc, NULL);
+        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_DIS.u, on_disc_dis_svc, v);
         return BLE_HS_EDONE;
     }
 
     if (err->status == BLE_HS_EDONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] Battery char not found");
-        h_batt_char = 0;
+        v->h_batt_char = 0;
         // Chain to DIS discovery (optional service)
-        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_DIS.u, on_disc_dis_svc, NULL);
+        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_DIS.u, on_disc_dis_svc, v);
     }
 
     return 0;
@@ -915,23 +1495,23 @@ static int on_disc_batt_chr(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_batt_svc(uint16_t conn, const struct ble_gatt_error *err,
                             const struct ble_gatt_svc *svc, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_batt_svc_end = svc->end_handle;
+        v->h_batt_svc_end = svc->end_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found BATT svc: start=%u, end=%u", svc->start_handle, svc->end_handle);
-        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_BATT.u, on_disc_batt_chr, NULL);
+        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_BATT.u, on_disc_batt_chr, v);
         return BLE_HS_EDONE;
     }
 
     if (err->status == BLE_HS_EDONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] Battery svc not found");
-        h_batt_char = 0;
-        h_batt_svc_end = 0;
-        setup_step = 0;
-        setup_next_step();
+        v->h_batt_char = 0;
+        v->h_batt_svc_end = 0;
+        v->setup_step = 0;
+        setup_next_step(v);
     }
 
     return 0;
@@ -940,21 +1520,21 @@ static int on_disc_batt_svc(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_rmleak_chr(uint16_t conn, const struct ble_gatt_error *err,
                                const struct ble_gatt_chr *chr, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_rmleak_char = chr->val_handle;
+        v->h_rmleak_char = chr->val_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found RMLEAK char: val_handle=%u, props=0x%02X", chr->val_handle, chr->properties);
-        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, NULL);
+        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, v);
         return BLE_HS_EDONE;
     }
 
     if (err->status == BLE_HS_EDONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] RMLEAK char not found (optional, continuing)");
-        h_rmleak_char = 0;
-        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, NULL);
+        v->h_rmleak_char = 0;
+        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, v);
     }
 
     return 0;
@@ -963,20 +1543,20 @@ static int on_disc_rmleak_chr(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_flood_chr(uint16_t conn, const struct ble_gatt_error *err,
                              const struct ble_gatt_chr *chr, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_flood_char = chr->val_handle;
+        v->h_flood_char = chr->val_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found FLOOD char: val_handle=%u, props=0x%02X", chr->val_handle, chr->properties);
         // Discover RMLEAK char in same FLOOD service (registered after FLOOD)
-        int rc = ble_gattc_disc_chrs_by_uuid(conn, h_flood_char + 1, h_flood_svc_end,
-                                              &UUID_CHR_RMLEAK.u, on_disc_rmleak_chr, NULL);
+        int rc = ble_gattc_disc_chrs_by_uuid(conn, v->h_flood_char + 1, v->h_flood_svc_end,
+                                              &UUID_CHR_RMLEAK.u, on_disc_rmleak_chr, v);
         if (rc != 0)
         {
             ESP_LOGW(BLE_TAG, "[DISC] RMLEAK char discovery failed rc=%d, skipping", rc);
-            h_rmleak_char = 0;
-            ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, NULL);
+            v->h_rmleak_char = 0;
+            ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_BATT.u, on_disc_batt_svc, v);
         }
         return BLE_HS_EDONE;
     }
@@ -993,13 +1573,13 @@ static int on_disc_flood_chr(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_flood_svc(uint16_t conn, const struct ble_gatt_error *err,
                              const struct ble_gatt_svc *svc, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_flood_svc_end = svc->end_handle;
+        v->h_flood_svc_end = svc->end_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found FLOOD svc: start=%u, end=%u", svc->start_handle, svc->end_handle);
-        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_FLOOD.u, on_disc_flood_chr, NULL);
+        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_FLOOD.u, on_disc_flood_chr, v);
         return BLE_HS_EDONE;
     }
 
@@ -1015,13 +1595,13 @@ static int on_disc_flood_svc(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_valve_chr(uint16_t conn, const struct ble_gatt_error *err,
                              const struct ble_gatt_chr *chr, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_valve_char = chr->val_handle;
+        v->h_valve_char = chr->val_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found VALVE char: val_handle=%u, props=0x%02X", chr->val_handle, chr->properties);
-        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_FLOOD.u, on_disc_flood_svc, NULL);
+        ble_gattc_disc_svc_by_uuid(conn, &UUID_SVC_FLOOD.u, on_disc_flood_svc, v);
         return BLE_HS_EDONE;
     }
 
@@ -1037,13 +1617,13 @@ static int on_disc_valve_chr(uint16_t conn, const struct ble_gatt_error *err,
 static int on_disc_valve_svc(uint16_t conn, const struct ble_gatt_error *err,
                              const struct ble_gatt_svc *svc, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
 
     if (err->status == 0)
     {
-        h_valve_svc_end = svc->end_handle;
+        v->h_valve_svc_end = svc->end_handle;
         ESP_LOGI(BLE_TAG, "[DISC] Found VALVE svc: start=%u, end=%u", svc->start_handle, svc->end_handle);
-        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_VALVE.u, on_disc_valve_chr, NULL);
+        ble_gattc_disc_chrs_by_uuid(conn, svc->start_handle, svc->end_handle, &UUID_CHR_VALVE.u, on_disc_valve_chr, v);
         return BLE_HS_EDONE;
     }
 
@@ -1056,237 +1636,300 @@ static int on_disc_valve_svc(uint16_t conn, const struct ble_gatt_error *err,
     return 0;
 }
 
-static void start_discovery_chain(void)
+static void start_full_discovery(valve_t *v)
+{
+    ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
+    ESP_LOGI(BLE_TAG, "║            STARTING SERVICE DISCOVERY                        ║");
+    ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
+    ESP_LOGI(BLE_TAG, "[DISC] Valve %d %s", v->idx, v->mac);
+
+    ble_gattc_disc_svc_by_uuid(v->conn_handle, &UUID_SVC_VALVE.u, on_disc_valve_svc, v);
+}
+
+static int on_cache_check_cb(uint16_t conn_handle,
+                             const struct ble_gatt_error *error,
+                             struct ble_gatt_attr *attr,
+                             void *arg)
+{
+    (void)conn_handle;
+    valve_t *v = (valve_t *)arg;
+    char fw[sizeof(v->firmware_rev)] = {0};
+
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
+        return 0;
+
+    if (error->status == 0 && attr != NULL && attr->om != NULL)
+    {
+        uint16_t len = OS_MBUF_PKTLEN(attr->om);
+        if (len >= sizeof(fw))
+            len = sizeof(fw) - 1;
+        os_mbuf_copydata(attr->om, 0, len, fw);
+    }
+
+    if (fw[0] != '\0' && strcmp(fw, v->gatt_cache.fw_rev) == 0)
+    {
+        ESP_LOGI(BLE_TAG, "[CACHE] Hit: %s fw \"%s\", skipping discovery", v->mac, fw);
+        gatt_cache_apply(v);
+        strncpy(v->firmware_rev, fw, sizeof(v->firmware_rev) - 1);
+        v->setup_step = 0;
+        setup_next_step(v);
+        return 0;
+    }
+
+    ESP_LOGI(BLE_TAG, "[CACHE] Miss: fw \"%s\" (cached \"%s\", status=0x%04X)",
+             fw, v->gatt_cache.fw_rev, error->status);
+    v->conn_stats.cache_misses++;
+    start_full_discovery(v);
+    return 0;
+}
+
+static void start_discovery_chain(valve_t *v)
 {
-    if (valve_conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    if (v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
     {
         ESP_LOGW(BLE_TAG, "[DISC] Cannot start discovery - no connection");
         return;
     }
 
-    ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
-    ESP_LOGI(BLE_TAG, "║            STARTING SERVICE DISCOVERY                        ║");
-    ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
-
-    g_setup_in_progress = true;
-    setup_step = 0;
+    v->setup_in_progress = true;
+    v->setup_step = 0;
+    reset_gatt_handles(v);
+    v->setup_start_us = esp_timer_get_time();
 
-    h_valve_char = 0;
-    h_flood_char = 0;
-    h_rmleak_char = 0;
-    h_batt_char = 0;
-    h_dis_char = 0;
-    h_valve_svc_end = 0;
-    h_flood_svc_end = 0;
-    h_batt_svc_end = 0;
-    h_dis_svc_end = 0;
-    g_firmware_rev[0] = '\0';
+    if (v->discovery_timeout_timer)
+        xTimerReset(v->discovery_timeout_timer, 0);
 
-    if (discovery_timeout_timer)
-        xTimerReset(discovery_timeout_timer, 0);
+    // Same valve as last time: check its firmware revision at the cached DIS
+    // handle and, if it matches, skip discovery altogether.
+    if (v->gatt_cache_valid && v->gatt_cache.dis_char != 0 &&
+        strcasecmp(v->gatt_cache.mac, v->mac) == 0)
+    {
+        ESP_LOGI(BLE_TAG, "[CACHE] Checking fw rev at cached DIS handle=%u", v->gatt_cache.dis_char);
+        if (ble_gattc_read(v->conn_handle, v->gatt_cache.dis_char, on_cache_check_cb, v) == 0)
+            return;
+        ESP_LOGW(BLE_TAG, "[CACHE] fw rev read failed to start");
+    }
 
-    ble_gattc_disc_svc_by_uuid(valve_conn_handle, &UUID_SVC_VALVE.u, on_disc_valve_svc, NULL);
+    start_full_discovery(v);
 }
 
 // -----------------------------------------------------------------------------
 // GAP EVENTS
 // -----------------------------------------------------------------------------
 
-// Forward-declare so handle_valve_disc can reference it via ble_gap_connect callback
-static int ble_gap_event(struct ble_gap_event *event, void *arg);
+// Is this address already a connected valve, or provisioned to another slot?
+static bool address_taken(const char *mac)
+{
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        const valve_t *o = &g_valves[i];
+        if (o->has_target_mac && strcasecmp(mac, o->target_mac) == 0)
+            return true;
+        if (o->conn_handle != BLE_HS_CONN_HANDLE_NONE && strcasecmp(mac, o->mac) == 0)
+            return true;
+    }
+    return false;
+}
 
-// Common handler for valve discovery from both legacy and extended scan events
-static void handle_valve_disc(const ble_addr_t *addr, const uint8_t *data,
-                              uint8_t data_len)
+// Report callback registered with the shared scan (legacy and extended reports)
+static void handle_valve_disc(const ble_addr_t *addr, int8_t rssi,
+                              const uint8_t *data, uint8_t data_len)
 {
-    struct ble_hs_adv_fields fields;
-    if (ble_hs_adv_parse_fields(&fields, data, data_len) != 0)
+    (void)rssi;
+    if (!is_scanning || g_connecting != NULL)
         return;
 
+    // The shared scan reports every leak advert too: decide on the address
+    // first and only parse the payload for discovery by name
     char discovered_mac[18];
     snprintf(discovered_mac, sizeof(discovered_mac), "%02X:%02X:%02X:%02X:%02X:%02X",
              addr->val[5], addr->val[4], addr->val[3],
              addr->val[2], addr->val[1], addr->val[0]);
 
-    bool mac_match = false;
-    if (g_has_target_mac && strcasecmp(discovered_mac, g_target_valve_mac) == 0)
+    valve_t *match = NULL;
+    valve_t *by_name = NULL;
+    for (int i = 0; i < BLE_VALVE_MAX && match == NULL; i++)
     {
-        mac_match = true;
-        ESP_LOGI(BLE_TAG, "[SCAN] Target MAC matched: %s", discovered_mac);
+        valve_t *v = &g_valves[i];
+        if (!v->connect_requested || v->conn_handle != BLE_HS_CONN_HANDLE_NONE)
+            continue;
+        if (!v->has_target_mac)
+        {
+            if (by_name == NULL)
+                by_name = v;
+        }
+        else if (strcasecmp(discovered_mac, v->target_mac) == 0)
+        {
+            match = v;
+            ESP_LOGI(BLE_TAG, "[SCAN] Target MAC matched: %s (valve %d)", discovered_mac, v->idx);
+        }
     }
 
-    bool name_match = false;
-    if (fields.name &&
-        fields.name_len == strlen(VALVE_DEVICE_NAME) &&
-        strncmp((const char *)fields.name, VALVE_DEVICE_NAME, fields.name_len) == 0)
+    // Discovery by name for a slot without a target: any valve that is not
+    // already connected or provisioned to another slot
+    if (match == NULL && by_name != NULL && !address_taken(discovered_mac))
     {
-        name_match = true;
+        struct ble_hs_adv_fields fields;
+        if (ble_hs_adv_parse_fields(&fields, data, data_len) != 0)
+            return;
+
+        if (fields.name &&
+            fields.name_len == strlen(VALVE_DEVICE_NAME) &&
+            strncmp((const char *)fields.name, VALVE_DEVICE_NAME, fields.name_len) == 0)
+        {
+            match = by_name;
+        }
     }
 
-    if ((g_has_target_mac && mac_match) || (!g_has_target_mac && name_match))
-    {
-        if (g_has_target_mac)
-            ESP_LOGI(BLE_TAG, "[SCAN] Connecting to provisioned valve: %s", discovered_mac);
-        else
-            ESP_LOGI(BLE_TAG, "[SCAN] Connecting to valve by name: %s", VALVE_DEVICE_NAME);
+    if (match == NULL)
+        return;
 
-        memcpy(&g_peer_addr, addr, sizeof(ble_addr_t));
-        g_peer_addr_valid = true;
+    if (match->has_target_mac)
+        ESP_LOGI(BLE_TAG, "[SCAN] Connecting to provisioned valve %d: %s", match->idx, discovered_mac);
+    else
+        ESP_LOGI(BLE_TAG, "[SCAN] Connecting valve %d by name: %s (%s)", match->idx, VALVE_DEVICE_NAME, discovered_mac);
 
-        ble_gap_disc_cancel();
-        is_scanning = false;
+    memcpy(&match->peer_addr, addr, sizeof(ble_addr_t));
+    match->peer_addr_valid = true;
 
-        int rc = ble_gap_connect(g_own_addr_type, addr, 30000, NULL, ble_gap_event, NULL);
-        if (rc != 0)
-        {
-            ESP_LOGE(BLE_TAG, "[SCAN] ble_gap_connect rc=%d", rc);
-            start_scan();
-        }
+    // Connection setup needs the scan stopped; the leak scanner's share
+    // resumes on the CONNECT event (success or failure)
+    g_connecting = match;
+    ble_scan_pause();
+    stop_scan();
+
+    int rc = ble_gap_connect(g_own_addr_type, addr, 30000, NULL, ble_gap_event, match);
+    if (rc != 0)
+    {
+        ESP_LOGE(BLE_TAG, "[SCAN] ble_gap_connect rc=%d", rc);
+        g_connecting = NULL;
+        ble_scan_resume();
+        start_scan();
     }
 }
 
 static int ble_gap_event(struct ble_gap_event *event, void *arg)
 {
-    (void)arg;
+    valve_t *v = (valve_t *)arg;
     struct ble_gap_conn_desc desc;
     int rc;
 
     switch (event->type)
     {
-    case BLE_GAP_EVENT_DISC:
-        // Forward to leak scanner so leak sensors are detected during valve scan
-        app_ble_leak_process_adv(&event->disc.addr, event->disc.rssi,
-                                 event->disc.data, event->disc.length_data);
-        handle_valve_disc(&event->disc.addr, event->disc.data,
-                          event->disc.length_data);
-        return 0;
-
-#if MYNEWT_VAL(BLE_EXT_ADV)
-    case BLE_GAP_EVENT_EXT_DISC:
-        if (event->ext_disc.data_status == BLE_GAP_EXT_ADV_DATA_STATUS_COMPLETE) {
-            // Forward to leak scanner so leak sensors are detected during valve scan
-            app_ble_leak_process_adv(&event->ext_disc.addr, event->ext_disc.rssi,
-                                     event->ext_disc.data, event->ext_disc.length_data);
-            handle_valve_disc(&event->ext_disc.addr, event->ext_disc.data,
-                              event->ext_disc.length_data);
-        }
-        return 0;
-#endif
-
     case BLE_GAP_EVENT_CONNECT:
         ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
         ESP_LOGI(BLE_TAG, "║            GAP CONNECT EVENT                                 ║");
         ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
-        ESP_LOGI(BLE_TAG, "[CONNECT] status=%d", event->connect.status);
+        ESP_LOGI(BLE_TAG, "[CONNECT] Valve %d status=%d", v->idx, event->connect.status);
+        g_connecting = NULL;
+        ble_scan_resume();   // paused for connection setup in handle_valve_disc
 
         if (event->connect.status == 0)
         {
-            valve_conn_handle = event->connect.conn_handle;
-            is_scanning = false;
-
-            clear_all_state_bits();
-
-            h_valve_char = 0;
-            h_flood_char = 0;
-            h_rmleak_char = 0;
-            h_batt_char = 0;
-            h_dis_char = 0;
-            h_valve_svc_end = 0;
-            h_flood_svc_end = 0;
-            h_batt_svc_end = 0;
-            h_dis_svc_end = 0;
-            g_val_battery = 0;
-            g_val_leak = false;
-            g_val_state = -1;
-            g_firmware_rev[0] = '\0';
-
-            if (ble_gap_conn_find(valve_conn_handle, &desc) == 0)
+            v->conn_handle = event->connect.conn_handle;
+
+            clear_all_state_bits(v);
+            v->conn_start_us = esp_timer_get_time();
+            v->link_requested = -1;
+
+            reset_gatt_handles(v);
+            v->val_battery = 0;
+            v->val_leak = false;
+            v->val_state = -1;
+            v->rep_state = -1;
+            v->rep_rmleak = -1;
+
+            if (ble_gap_conn_find(v->conn_handle, &desc) == 0)
             {
-                snprintf(g_valve_mac, sizeof(g_valve_mac), "%02X:%02X:%02X:%02X:%02X:%02X",
+                snprintf(v->mac, sizeof(v->mac), "%02X:%02X:%02X:%02X:%02X:%02X",
                          desc.peer_id_addr.val[5], desc.peer_id_addr.val[4], desc.peer_id_addr.val[3],
                          desc.peer_id_addr.val[2], desc.peer_id_addr.val[1], desc.peer_id_addr.val[0]);
-                ESP_LOGI(BLE_TAG, "[CONNECT] MAC=%s, handle=%u", g_valve_mac, valve_conn_handle);
+                ESP_LOGI(BLE_TAG, "[CONNECT] MAC=%s, handle=%u", v->mac, v->conn_handle);
 
-                memcpy(&g_peer_addr, &desc.peer_id_addr, sizeof(ble_addr_t));
-                g_peer_addr_valid = true;
+                memcpy(&v->peer_addr, &desc.peer_id_addr, sizeof(ble_addr_t));
+                v->peer_addr_valid = true;
+                v->conn_stats.conn_itvl = desc.conn_itvl;
             }
 
-            set_state_bit(BLE_STATE_BIT_CONNECTED);
+            set_state_bit(v, BLE_STATE_BIT_CONNECTED);
 
-            if (post_connect_timer)
+            if (v->post_connect_timer)
             {
                 ESP_LOGI(BLE_TAG, "[CONNECT] Starting %dms delay before security...", POST_CONNECT_SECURITY_DELAY_MS);
-                xTimerStart(post_connect_timer, 0);
+                xTimerStart(v->post_connect_timer, 0);
             }
             else
             {
-                start_discovery_chain();
+                start_discovery_chain(v);
             }
         }
         else
         {
             ESP_LOGW(BLE_TAG, "[CONNECT] Failed status=%d", event->connect.status);
-            valve_conn_handle = BLE_HS_CONN_HANDLE_NONE;
-            clear_all_state_bits();
-            start_scan();
+            v->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+            clear_all_state_bits(v);
         }
+
+        // Other valves may still be waiting for their connection
+        start_scan();
         return 0;
 
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
         ESP_LOGI(BLE_TAG, "║            GAP DISCONNECT EVENT                              ║");
         ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
-        ESP_LOGW(BLE_TAG, "[DISCONNECT] reason=0x%02x", event->disconnect.reason);
-
-        valve_conn_handle = BLE_HS_CONN_HANDLE_NONE;
-
-        h_valve_char = 0;
-        h_flood_char = 0;
-        h_rmleak_char = 0;
-        h_batt_char = 0;
-        h_dis_char = 0;
-        h_valve_svc_end = 0;
-        h_flood_svc_end = 0;
-        h_batt_svc_end = 0;
-        h_dis_svc_end = 0;
-        g_val_battery = 0;
-        g_val_leak = false;
-        g_val_state = -1;
-        g_firmware_rev[0] = '\0';
-
-        clear_all_state_bits();
-        memset(g_valve_mac, 0, sizeof(g_valve_mac));
-        notify_hub_update(BLE_UPD_DISCONNECTED);
-
-        if (sec_timeout_timer) xTimerStop(sec_timeout_timer, 0);
-        if (post_connect_timer) xTimerStop(post_connect_timer, 0);
-        if (discovery_timeout_timer) xTimerStop(discovery_timeout_timer, 0);
-        if (security_retry_timer) xTimerStop(security_retry_timer, 0);
-
-        if (g_connect_requested)
+        ESP_LOGW(BLE_TAG, "[DISCONNECT] Valve %d reason=0x%02x", v->idx, event->disconnect.reason);
+
+        v->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+        reset_gatt_handles(v);
+        v->val_battery = 0;
+        v->val_leak = false;
+        v->val_state = -1;
+        v->rep_state = -1;
+        v->rep_rmleak = -1;
+
+        clear_all_state_bits(v);
+        memset(v->mac, 0, sizeof(v->mac));
+        v->conn_stats.conn_itvl = 0;
+        notify_hub_update(v, BLE_UPD_DISCONNECTED);
+
+        if (v->sec_timeout_timer) xTimerStop(v->sec_timeout_timer, 0);
+        if (v->post_connect_timer) xTimerStop(v->post_connect_timer, 0);
+        if (v->discovery_timeout_timer) xTimerStop(v->discovery_timeout_timer, 0);
+        if (v->security_retry_timer) xTimerStop(v->security_retry_timer, 0);
+
+        if (v->connect_requested)
             start_scan();
+        if (v->link_profile == BLE_VALVE_LINK_FAST)
+            rescale_fast_links(v);
         return 0;
 
     case BLE_GAP_EVENT_NOTIFY_RX:
-        return on_notify(event->notify_rx.conn_handle, event->notify_rx.attr_handle, event->notify_rx.om, NULL);
+        return on_notify(v, event->notify_rx.attr_handle, event->notify_rx.om);
 
     case BLE_GAP_EVENT_MTU:
         ESP_LOGI(BLE_TAG, "[GAP] MTU updated: %u", event->mtu.value);
         return 0;
 
     case BLE_GAP_EVENT_CONN_UPDATE:
-        ESP_LOGI(BLE_TAG, "[GAP] Connection params updated: status=%d", event->conn_update.status);
+        ESP_LOGI(BLE_TAG, "[GAP] Valve %d connection params updated: status=%d", v->idx, event->conn_update.status);
+        if (event->conn_update.status != 0)
+        {
+            v->link_requested = -1;   // rejected: retry on the next profile request
+        }
+        else if (ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0)
+        {
+            v->conn_stats.conn_itvl = desc.conn_itvl;
+            ESP_LOGI(BLE_TAG, "[LINK] itvl=%u (x1.25 ms) latency=%u timeout=%u (x10 ms)",
+                     desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+        }
         return 0;
 
     case BLE_GAP_EVENT_L2CAP_UPDATE_REQ:
         ESP_LOGI(BLE_TAG, "[GAP] L2CAP update request");
         return 0;
 
-    case BLE_GAP_EVENT_DISC_COMPLETE:
-        ESP_LOGI(BLE_TAG, "[GAP] Scan complete: reason=%d", event->disc_complete.reason);
-        is_scanning = false;
-        return 0;
-
     case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
         ESP_LOGI(BLE_TAG, "[GAP] PHY update complete");
         return 0;
@@ -1305,7 +1948,7 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
         ESP_LOGI(BLE_TAG, "╔══════════════════════════════════════════════════════════════╗");
         ESP_LOGI(BLE_TAG, "║            ENCRYPTION CHANGE EVENT                           ║");
         ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
-        ESP_LOGI(BLE_TAG, "[ENC_CHANGE] status=%d", event->enc_change.status);
+        ESP_LOGI(BLE_TAG, "[ENC_CHANGE] Valve %d status=%d", v->idx, event->enc_change.status);
 
         if (event->enc_change.status == 0)
         {
@@ -1321,29 +1964,29 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
                     ESP_LOGI(BLE_TAG, "║            LINK ENCRYPTED SUCCESSFULLY                       ║");
                     ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
 
-                    clear_state_bit(BLE_STATE_BIT_PAIRING);
-                    set_state_bit(BLE_STATE_BIT_ENCRYPTED);
+                    clear_state_bit(v, BLE_STATE_BIT_PAIRING);
+                    set_state_bit(v, BLE_STATE_BIT_ENCRYPTED);
 
                     if (desc.sec_state.authenticated)
                     {
                         ESP_LOGI(BLE_TAG, "[ENC_CHANGE] MITM authentication achieved");
-                        set_state_bit(BLE_STATE_BIT_AUTHENTICATED);
+                        set_state_bit(v, BLE_STATE_BIT_AUTHENTICATED);
                     }
 
                     if (desc.sec_state.bonded)
                     {
                         ESP_LOGI(BLE_TAG, "[ENC_CHANGE] Device is bonded (keys stored)");
-                        set_state_bit(BLE_STATE_BIT_BONDED);
+                        set_state_bit(v, BLE_STATE_BIT_BONDED);
                     }
 
-                    if (sec_timeout_timer)
-                        xTimerStop(sec_timeout_timer, 0);
+                    if (v->sec_timeout_timer)
+                        xTimerStop(v->sec_timeout_timer, 0);
 
-                    EventBits_t bits = get_state_bits();
+                    EventBits_t bits = get_state_bits(v);
                     if (!(bits & BLE_STATE_BIT_DISCOVERY_DONE))
                     {
                         ESP_LOGI(BLE_TAG, "[ENC_CHANGE] Link secured. Starting discovery...");
-                        start_discovery_chain();
+                        start_discovery_chain(v);
                     }
                 }
             }
@@ -1351,10 +1994,10 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
         else
         {
             ESP_LOGE(BLE_TAG, "[ENC_CHANGE] Encryption failed: status=%d", event->enc_change.status);
-            clear_state_bit(BLE_STATE_BIT_PAIRING);
+            clear_state_bit(v, BLE_STATE_BIT_PAIRING);
 
-            if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE)
-                ble_gap_terminate(valve_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+            if (v->conn_handle != BLE_HS_CONN_HANDLE_NONE)
+                ble_gap_terminate(v->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
         }
         return 0;
 
@@ -1426,6 +2069,9 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
 // -----------------------------------------------------------------------------
 // SCANNING
 // -----------------------------------------------------------------------------
+// One scan request serves every valve still waiting for its connection.
+static bool s_scan_by_name = false;   // mode of the current request
+
 static void start_scan(void)
 {
     if (!g_ble_synced)
@@ -1434,122 +2080,136 @@ static void start_scan(void)
         return;
     }
 
-    if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE)
+    // Resumed on the CONNECT event of the connection in flight
+    if (g_connecting != NULL)
+        return;
+
+    int waiting = 0;
+    bool by_name = false;
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        const valve_t *v = &g_valves[i];
+        if (v->connect_requested && v->conn_handle == BLE_HS_CONN_HANDLE_NONE)
+        {
+            waiting++;
+            if (!v->has_target_mac)
+                by_name = true;
+        }
+    }
+
+    if (waiting == 0)
     {
-        ESP_LOGW(BLE_TAG, "[SCAN] Already connected");
+        if (is_scanning)
+            stop_scan();
         return;
     }
 
-    if (is_scanning)
+    if (is_scanning && by_name == s_scan_by_name)
         return;
 
-    // Cancel any active scan (e.g. BLE leak scanner) before starting valve scan
-    ble_gap_disc_cancel();
-
-    ESP_LOGI(BLE_TAG, "[SCAN] Starting scan for '%s'...", VALVE_DEVICE_NAME);
-
-#if MYNEWT_VAL(BLE_EXT_ADV)
-    // Extended scan: 1M PHY (valve + legacy leak sensors) + Coded PHY (long-range leak sensors)
-    struct ble_gap_ext_disc_params uncoded_params = {0};
-    uncoded_params.itvl = 160;      // 100ms interval
-    uncoded_params.window = 80;     // 50ms window
-    uncoded_params.passive = 0;     // Active scan for valve name resolution
-
-    struct ble_gap_ext_disc_params coded_params = {0};
-    coded_params.itvl = 160;
-    coded_params.window = 80;
-    coded_params.passive = 1;       // Passive for Coded PHY (leak sensors only)
-
-    int rc = ble_gap_ext_disc(
-        g_own_addr_type,
-        0,                          // duration: 0 = continuous
-        0,                          // period: 0 = no periodic restart
-        1,                          // filter_duplicates: enabled for valve discovery
-        0,                          // filter_policy: accept all
-        0,                          // limited: disabled
-        &uncoded_params,            // 1M PHY scan params
-        &coded_params,              // Coded PHY scan params
-        ble_gap_event,
-        NULL
-    );
-#else
-    struct ble_gap_disc_params disc_params = {
-        .filter_duplicates = 1,
-        .passive = 0,
-        .itvl = 160,
-        .window = 80,
+    // Provisioned valves only: passive, and the controller accept list may
+    // filter (it holds the valves). Discovery by name needs scan responses
+    // from every advertiser.
+    ble_scan_req_t req = {
+        .enabled = true,
+        .active = by_name,
+        .coded_phy = false,
+        .filter_duplicates = true,
+        .all_advertisers = by_name,
     };
-    int rc = ble_gap_disc(g_own_addr_type, BLE_HS_FOREVER, &disc_params, ble_gap_event, NULL);
-#endif
 
-    if (rc == 0)
-        is_scanning = true;
+    if (by_name)
+        ESP_LOGI(BLE_TAG, "[SCAN] Looking for %d valve(s), '%s' by name...", waiting, VALVE_DEVICE_NAME);
     else
-        ESP_LOGE(BLE_TAG, "[SCAN] ble_gap_disc rc=%d", rc);
+        ESP_LOGI(BLE_TAG, "[SCAN] Looking for %d provisioned valve(s)...", waiting);
+
+    is_scanning = true;
+    s_scan_by_name = by_name;
+    ble_scan_request(BLE_SCAN_CONSUMER_VALVE, &req);
+}
+
+static void stop_scan(void)
+{
+    is_scanning = false;
+    ble_scan_request(BLE_SCAN_CONSUMER_VALVE, NULL);
 }
 
 // -----------------------------------------------------------------------------
 // WRITE COMMAND
 // -----------------------------------------------------------------------------
-static void write_valve_command(uint8_t val)
+static void write_valve_command(valve_t *v, uint8_t val)
 {
-    if (!is_ready_for_gatt() || valve_conn_handle == BLE_HS_CONN_HANDLE_NONE || h_valve_char == 0)
+    if (!is_ready_for_gatt(v) || v->conn_handle == BLE_HS_CONN_HANDLE_NONE || v->h_valve_char == 0)
     {
-        ESP_LOGW(BLE_TAG, "[CMD] Valve write not ready. Queuing val=%u", val);
-        g_pending_valve_cmd = (int)val;
-        g_connect_requested = true;
+        ESP_LOGW(BLE_TAG, "[CMD] Valve %d write not ready. Queuing val=%u", v->idx, val);
+        v->pending_valve_cmd = (int)val;
+        v->connect_requested = true;
         start_scan();
         return;
     }
 
     if (gatt_mutex != NULL && xSemaphoreTake(gatt_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
     {
-        ESP_LOGI(BLE_TAG, "[CMD] Writing valve command=%u", val);
-        int rc = ble_gattc_write_flat(valve_conn_handle, h_valve_char, &val, 1, NULL, NULL);
+        ESP_LOGI(BLE_TAG, "[CMD] Writing valve %d command=%u", v->idx, val);
+        cmd_on_written(v, BLE_VALVE_TARGET_STATE, val);
+        int rc = ble_gattc_write_flat(v->conn_handle, v->h_valve_char, &val, 1, on_cmd_write_cb,
+                                      CMD_WRITE_ARG(v->idx, BLE_VALVE_TARGET_STATE, val));
         ESP_LOGI(BLE_TAG, "[CMD] Valve write rc=%d", rc);
         if (rc == 0)
         {
-            g_val_state = val;
-            notify_hub_update(BLE_UPD_STATE);
+            if (val == 0)
+                leak_latency_mark(v->idx, LEAK_LAT_WRITE);
+            v->val_state = val;
+            notify_hub_update(v, BLE_UPD_STATE);
+        }
+        else
+        {
+            cmd_on_write_rsp(v, BLE_VALVE_TARGET_STATE, val, rc);
         }
         xSemaphoreGive(gatt_mutex);
     }
     else
     {
         ESP_LOGW(BLE_TAG, "[CMD] Failed to acquire mutex. Queuing val=%u", val);
-        g_pending_valve_cmd = (int)val;
+        v->pending_valve_cmd = (int)val;
     }
 }
 
 // -----------------------------------------------------------------------------
 // RMLEAK WRITE COMMAND
 // -----------------------------------------------------------------------------
-static void write_rmleak_command(uint8_t val)
+static void write_rmleak_command(valve_t *v, uint8_t val)
 {
-    if (!is_ready_for_gatt() || valve_conn_handle == BLE_HS_CONN_HANDLE_NONE || h_rmleak_char == 0)
+    if (!is_ready_for_gatt(v) || v->conn_handle == BLE_HS_CONN_HANDLE_NONE || v->h_rmleak_char == 0)
     {
-        ESP_LOGW(BLE_TAG, "[CMD] RMLEAK write not ready. Queuing val=%u", val);
-        g_pending_rmleak_cmd = (int)val;
-        g_connect_requested = true;
+        ESP_LOGW(BLE_TAG, "[CMD] Valve %d RMLEAK write not ready. Queuing val=%u", v->idx, val);
+        v->pending_rmleak_cmd = (int)val;
+        v->connect_requested = true;
         start_scan();
         return;
     }
 
     if (gatt_mutex != NULL && xSemaphoreTake(gatt_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
     {
-        ESP_LOGI(BLE_TAG, "[CMD] Writing RMLEAK=%u", val);
-        int rc = ble_gattc_write_flat(valve_conn_handle, h_rmleak_char, &val, 1, NULL, NULL);
+        ESP_LOGI(BLE_TAG, "[CMD] Writing valve %d RMLEAK=%u", v->idx, val);
+        cmd_on_written(v, BLE_VALVE_TARGET_RMLEAK, val);
+        int rc = ble_gattc_write_flat(v->conn_handle, v->h_rmleak_char, &val, 1, on_cmd_write_cb,
+                                      CMD_WRITE_ARG(v->idx, BLE_VALVE_TARGET_RMLEAK, val));
         ESP_LOGI(BLE_TAG, "[CMD] RMLEAK write rc=%d", rc);
         if (rc == 0)
         {
-            g_val_rmleak = (val != 0);
+            v->val_rmleak = (val != 0);
+        }
+        else
+        {
+            cmd_on_write_rsp(v, BLE_VALVE_TARGET_RMLEAK, val, rc);
         }
         xSemaphoreGive(gatt_mutex);
     }
     else
     {
         ESP_LOGW(BLE_TAG, "[CMD] Failed to acquire mutex for RMLEAK. Queuing val=%u", val);
-        g_pending_rmleak_cmd = (int)val;
+        v->pending_rmleak_cmd = (int)val;
     }
 }
 
@@ -1568,7 +2228,11 @@ static void on_stack_reset(int reason)
 {
     ESP_LOGE(BLE_TAG, "[HOST] NimBLE stack reset: reason=%d", reason);
     g_ble_synced = false;
-    clear_all_state_bits();
+    g_connecting = NULL;
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+        clear_all_state_bits(&g_valves[i]);
+    ble_scan_host_reset();
+    stop_scan();
 }
 
 static void on_stack_sync(void)
@@ -1602,65 +2266,108 @@ static void on_stack_sync(void)
              ble_hs_cfg.sm_mitm, ble_hs_cfg.sm_sc);
 
     g_ble_synced = true;
+    ble_scan_host_synced(g_own_addr_type);
 
-    if (g_connect_requested)
-        start_scan();
+    start_scan();   // no-op unless a valve has requested a connection
 }
 
 // -----------------------------------------------------------------------------
 // BLE COMMAND TASK
 // -----------------------------------------------------------------------------
+// One task serves every valve: each has its own command queue, all in one set.
 static void ble_valve_task(void *pvParameters)
 {
     (void)pvParameters;
     ble_valve_msg_t msg;
 
-    ESP_LOGI(BLE_TAG, "[TASK] BLE command task started");
+    ESP_LOGI(BLE_TAG, "[TASK] BLE command task started (%d valve slots)", BLE_VALVE_MAX);
 
     while (1)
     {
-        if (xQueueReceive(ble_cmd_queue, &msg, portMAX_DELAY) != pdTRUE)
+        bool armed = false;
+        for (int i = 0; i < BLE_VALVE_MAX; i++)
+        {
+            if (cmd_check_deadlines(&g_valves[i]))
+                armed = true;
+        }
+
+        TickType_t wait = armed ? pdMS_TO_TICKS(CMD_DEADLINE_POLL_MS) : portMAX_DELAY;
+        QueueSetMemberHandle_t q = xQueueSelectFromSet(ble_cmd_set, wait);
+        if (q == NULL)
+            continue;
+
+        valve_t *v = NULL;
+        for (int i = 0; i < BLE_VALVE_MAX; i++)
+        {
+            if (g_valves[i].cmd_queue == q)
+                v = &g_valves[i];
+        }
+        if (v == NULL || xQueueReceive(q, &msg, 0) != pdTRUE)
             continue;
 
         switch (msg.command)
         {
         case BLE_CMD_CONNECT:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: CONNECT");
-            g_connect_requested = true;
+            ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: CONNECT", v->idx);
+            v->connect_requested = true;
             start_scan();
             break;
 
-        case BLE_CMD_OPEN_VALVE:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: OPEN_VALVE");
-            write_valve_command(1);
-            break;
-
-        case BLE_CMD_CLOSE_VALVE:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: CLOSE_VALVE");
-            write_valve_command(0);
+        case BLE_CMD_WRITE_STATE:
+        case BLE_CMD_WRITE_RMLEAK:
+        {
+            ble_valve_target_t target = (msg.command == BLE_CMD_WRITE_STATE)
+                                            ? BLE_VALVE_TARGET_STATE : BLE_VALVE_TARGET_RMLEAK;
+            // Write whatever the slot holds now: commands submitted since this
+            // message was queued have coalesced into it
+            portENTER_CRITICAL(&g_cmd_lock);
+            v->cmd_queued[target] = false;
+            bool have = (v->cmd_slot[target].id != 0);
+            uint8_t val = v->cmd_slot[target].value;
+            portEXIT_CRITICAL(&g_cmd_lock);
+
+            if (!have)
+            {
+                ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: %s write dropped (command completed or cancelled)",
+                         v->idx, target_name(target));
+                break;
+            }
+            ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: WRITE %s=%u", v->idx, target_name(target), val);
+            if (target == BLE_VALVE_TARGET_STATE)
+            {
+                if (val == 0)
+                    leak_latency_mark(v->idx, LEAK_LAT_DEQUEUED);
+                write_valve_command(v, val);
+            }
+            else
+            {
+                write_rmleak_command(v, val);
+            }
             break;
+        }
 
         case BLE_CMD_DISCONNECT:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: DISCONNECT");
-            g_connect_requested = false;
-            if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE)
-                ble_gap_terminate(valve_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+            ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: DISCONNECT", v->idx);
+            v->connect_requested = false;
+            if (g_connecting == v)
+                ble_gap_conn_cancel();   // CONNECT event follows with an error status
+            if (is_scanning)
+                start_scan();            // narrows or stops the scan
+            if (v->conn_handle != BLE_HS_CONN_HANDLE_NONE)
+                ble_gap_terminate(v->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
             break;
 
         case BLE_CMD_SECURE:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: SECURE");
-            if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE && !is_link_encrypted())
-                initiate_security();
-            break;
-
-        case BLE_CMD_SET_RMLEAK:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: SET_RMLEAK");
-            write_rmleak_command(1);
+            ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: SECURE", v->idx);
+            if (v->conn_handle != BLE_HS_CONN_HANDLE_NONE && !is_link_encrypted(v))
+                initiate_security(v);
             break;
 
-        case BLE_CMD_CLEAR_RMLEAK:
-            ESP_LOGI(BLE_TAG, "[TASK] CMD: CLEAR_RMLEAK");
-            write_rmleak_command(0);
+        case BLE_CMD_LINK_PROFILE:
+            ESP_LOGI(BLE_TAG, "[TASK] Valve %d CMD: LINK_PROFILE %s", v->idx,
+                     v->link_profile == BLE_VALVE_LINK_FAST ? "fast" : "relaxed");
+            apply_link_profile(v);
+            rescale_fast_links(v);
             break;
 
         default:
@@ -1723,19 +2430,29 @@ static void ble_starter_task(void *param)
     ESP_LOGI(BLE_TAG, "[SM] Secure Connections: ENABLED");
     ESP_LOGI(BLE_TAG, "[SM] Fixed Passkey: %lu", (unsigned long)BLE_VALVE_FIXED_PASSKEY);
 
-    // Create timers
-    sec_timeout_timer = xTimerCreate("ble_sec_to", pdMS_TO_TICKS(SECURITY_TIMEOUT_MS),
-                                     pdFALSE, NULL, sec_timeout_cb);
-    post_connect_timer = xTimerCreate("ble_post_conn", pdMS_TO_TICKS(POST_CONNECT_SECURITY_DELAY_MS),
-                                      pdFALSE, NULL, post_connect_timer_cb);
-    discovery_timeout_timer = xTimerCreate("ble_disc_to", pdMS_TO_TICKS(DISCOVERY_TIMEOUT_MS),
-                                           pdFALSE, NULL, discovery_timeout_cb);
-    security_retry_timer = xTimerCreate("ble_sec_retry", pdMS_TO_TICKS(SECURITY_RETRY_DELAY_MS),
-                                        pdFALSE, NULL, security_retry_timer_cb);
+    // Create timers (timer ID = valve)
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        valve_t *v = &g_valves[i];
+        v->sec_timeout_timer = xTimerCreate("ble_sec_to", pdMS_TO_TICKS(SECURITY_TIMEOUT_MS),
+                                            pdFALSE, v, sec_timeout_cb);
+        v->post_connect_timer = xTimerCreate("ble_post_conn", pdMS_TO_TICKS(POST_CONNECT_SECURITY_DELAY_MS),
+                                             pdFALSE, v, post_connect_timer_cb);
+        v->discovery_timeout_timer = xTimerCreate("ble_disc_to", pdMS_TO_TICKS(DISCOVERY_TIMEOUT_MS),
+                                                  pdFALSE, v, discovery_timeout_cb);
+        v->security_retry_timer = xTimerCreate("ble_sec_retry", pdMS_TO_TICKS(SECURITY_RETRY_DELAY_MS),
+                                               pdFALSE, v, security_retry_timer_cb);
+    }
 
     nimble_port_freertos_init(nimble_host_task);
     xTaskCreate(ble_valve_task, "ble_valve", 4096, NULL, 5, NULL);
-    ble_valve_connect();
+
+    // Valve 0 also looks for a valve by name while unprovisioned
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        if (i == 0 || g_valves[i].has_target_mac)
+            ble_valve_connect(i);
+    }
 
     // Signal BLE leak scanner that NimBLE stack is ready
     app_ble_leak_signal_start();
@@ -1753,13 +2470,6 @@ void app_ble_valve_init(void)
     ESP_LOGI(BLE_TAG, "║            Event-Driven Security Model                       ║");
     ESP_LOGI(BLE_TAG, "╚══════════════════════════════════════════════════════════════╝");
 
-    ble_state_event_group = xEventGroupCreate();
-    if (ble_state_event_group == NULL)
-    {
-        ESP_LOGE(BLE_TAG, "[INIT] Failed to create state event group");
-        return;
-    }
-
     gatt_mutex = xSemaphoreCreateMutex();
     if (gatt_mutex == NULL)
     {
@@ -1767,20 +2477,44 @@ void app_ble_valve_init(void)
         return;
     }
 
-    ble_cmd_queue = xQueueCreate(10, sizeof(ble_valve_msg_t));
-    if (ble_cmd_queue == NULL)
+    ble_cmd_set = xQueueCreateSet(CMD_QUEUE_LEN * BLE_VALVE_MAX);
+    if (ble_cmd_set == NULL)
     {
-        ESP_LOGE(BLE_TAG, "[INIT] Failed to create command queue");
+        ESP_LOGE(BLE_TAG, "[INIT] Failed to create command queue set");
         return;
     }
 
-    ble_update_queue = xQueueCreate(5, sizeof(ble_update_type_t));
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+    {
+        valve_t *v = &g_valves[i];
+        v->idx = i;
+
+        v->state_event_group = xEventGroupCreate();
+        if (v->state_event_group == NULL)
+        {
+            ESP_LOGE(BLE_TAG, "[INIT] Failed to create state event group");
+            return;
+        }
+
+        v->cmd_queue = xQueueCreate(CMD_QUEUE_LEN, sizeof(ble_valve_msg_t));
+        if (v->cmd_queue == NULL || xQueueAddToSet(v->cmd_queue, ble_cmd_set) != pdPASS)
+        {
+            ESP_LOGE(BLE_TAG, "[INIT] Failed to create command queue");
+            return;
+        }
+
+        gatt_cache_load(v);
+    }
+
+    ble_update_queue = xQueueCreate(BLE_VALVE_UPDATE_QUEUE_LEN, sizeof(ble_valve_update_t));
     if (ble_update_queue == NULL)
     {
         ESP_LOGE(BLE_TAG, "[INIT] Failed to create update queue");
         return;
     }
 
+    ble_scan_register(BLE_SCAN_CONSUMER_VALVE, handle_valve_disc);
+
     xTaskCreate(ble_starter_task, "ble_starter", 3072, NULL, 5, &ble_starter_task_handle);
 }
 
@@ -1797,99 +2531,201 @@ void app_ble_valve_signal_start(void)
     }
 }
 
-bool ble_valve_open(void)
+ble_valve_cmd_id_t ble_valve_submit(int valve, ble_valve_target_t target, uint8_t value,
+                                    uint32_t timeout_ms, ble_valve_cmd_cb_t cb, void *ctx)
+{
+    valve_t *v = valve_at(valve);
+    if (v == NULL || target >= BLE_VALVE_TARGET_MAX || v->cmd_queue == NULL)
+        return 0;
+
+    TickType_t deadline = 0;
+    if (timeout_ms)
+    {
+        deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+        if (deadline == 0)
+            deadline = 1;
+    }
+
+    portENTER_CRITICAL(&g_cmd_lock);
+    valve_cmd_slot_t old = v->cmd_slot[target];
+    valve_cmd_slot_t *c = &v->cmd_slot[target];
+    c->id = g_next_cmd_id++;
+    if (g_next_cmd_id == 0)
+        g_next_cmd_id = 1;
+    c->value = value;
+    c->written = false;
+    c->acked = false;
+    c->confirmed = false;
+    c->deadline = deadline;
+    c->cb = cb;
+    c->ctx = ctx;
+    ble_valve_cmd_id_t id = c->id;
+    bool need_msg = !v->cmd_queued[target];
+    v->cmd_queued[target] = true;
+    portEXIT_CRITICAL(&g_cmd_lock);
+
+    // Last writer wins: the replaced command completes now
+    if (old.id != 0)
+    {
+        ESP_LOGI(BLE_TAG, "[CMD] Valve %d %s #%lu val=%u superseded by #%lu val=%u", valve, target_name(target),
+                 (unsigned long)old.id, old.value, (unsigned long)id, value);
+        if (old.cb)
+            old.cb(old.id, BLE_VALVE_CMD_SUPERSEDED, old.ctx);
+    }
+
+    if (need_msg)
+    {
+        ble_valve_msg_t m = {.command = (target == BLE_VALVE_TARGET_STATE) ? BLE_CMD_WRITE_STATE
+                                                                             : BLE_CMD_WRITE_RMLEAK};
+        if (xQueueSend(v->cmd_queue, &m, pdMS_TO_TICKS(10)) != pdTRUE)
+        {
+            portENTER_CRITICAL(&g_cmd_lock);
+            v->cmd_queued[target] = false;
+            if (v->cmd_slot[target].id == id)
+                v->cmd_slot[target].id = 0;
+            portEXIT_CRITICAL(&g_cmd_lock);
+            ESP_LOGW(BLE_TAG, "[CMD] Valve %d %s #%lu: command queue full", valve, target_name(target),
+                     (unsigned long)id);
+            return 0;
+        }
+    }
+
+    if (target == BLE_VALVE_TARGET_STATE && value == 0)
+        leak_latency_mark(valve, LEAK_LAT_QUEUED);
+    return id;
+}
+
+const char *ble_valve_cmd_status_str(ble_valve_cmd_status_t status)
+{
+    switch (status)
+    {
+    case BLE_VALVE_CMD_DONE:       return "done";
+    case BLE_VALVE_CMD_FAILED:     return "failed";
+    case BLE_VALVE_CMD_TIMEOUT:    return "timeout";
+    case BLE_VALVE_CMD_SUPERSEDED: return "superseded";
+    case BLE_VALVE_CMD_CANCELLED:  return "cancelled";
+    default:                       return "unknown";
+    }
+}
+
+bool ble_valve_open(int valve)
+{
+    return ble_valve_submit(valve, BLE_VALVE_TARGET_STATE, 1, 0, NULL, NULL) != 0;
+}
+
+bool ble_valve_close(int valve)
 {
-    ble_valve_msg_t m = {.command = BLE_CMD_OPEN_VALVE};
-    return xQueueSend(ble_cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+    return ble_valve_submit(valve, BLE_VALVE_TARGET_STATE, 0, 0, NULL, NULL) != 0;
 }
 
-bool ble_valve_close(void)
+static bool send_cmd(int valve, ble_valve_cmd_t command)
 {
-    ble_valve_msg_t m = {.command = BLE_CMD_CLOSE_VALVE};
-    return xQueueSend(ble_cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+    valve_t *v = valve_at(valve);
+    if (v == NULL || v->cmd_queue == NULL)
+        return false;
+    ble_valve_msg_t m = {.command = command};
+    return xQueueSend(v->cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
 }
 
-bool ble_valve_connect(void)
+bool ble_valve_connect(int valve)
 {
-    ble_valve_msg_t m = {.command = BLE_CMD_CONNECT};
-    return xQueueSend(ble_cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+    return send_cmd(valve, BLE_CMD_CONNECT);
 }
 
-bool ble_valve_disconnect(void)
+bool ble_valve_disconnect(int valve)
 {
-    ble_valve_msg_t m = {.command = BLE_CMD_DISCONNECT};
-    return xQueueSend(ble_cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+    return send_cmd(valve, BLE_CMD_DISCONNECT);
 }
 
-bool ble_valve_get_mac(char *b)
+bool ble_valve_get_mac(int valve, char *b)
 {
-    if (b == NULL)
+    valve_t *v = valve_at(valve);
+    if (v == NULL || b == NULL)
         return false;
 
-    if (valve_conn_handle != BLE_HS_CONN_HANDLE_NONE && g_valve_mac[0] != 0)
+    if (v->conn_handle != BLE_HS_CONN_HANDLE_NONE && v->mac[0] != 0)
     {
-        strcpy(b, g_valve_mac);
+        strcpy(b, v->mac);
         return true;
     }
     return false;
 }
 
-uint8_t ble_valve_get_battery(void)
+uint8_t ble_valve_get_battery(int valve)
 {
-    return g_val_battery;
+    valve_t *v = valve_at(valve);
+    return v ? v->val_battery : 0;
 }
 
-bool ble_valve_get_leak(void)
+bool ble_valve_get_leak(int valve)
 {
-    return g_val_leak;
+    valve_t *v = valve_at(valve);
+    return v ? v->val_leak : false;
 }
 
-int ble_valve_get_state(void)
+int ble_valve_get_state(int valve)
 {
-    return g_val_state;
+    valve_t *v = valve_at(valve);
+    return v ? v->val_state : -1;
 }
 
-bool ble_valve_is_ready(void)
+bool ble_valve_is_ready(int valve)
 {
-    return is_ready_for_gatt();
+    valve_t *v = valve_at(valve);
+    return v ? is_ready_for_gatt(v) : false;
 }
 
-bool ble_valve_is_secured(void)
+bool ble_valve_is_secured(int valve)
 {
-    return is_link_encrypted();
+    valve_t *v = valve_at(valve);
+    return v ? is_link_encrypted(v) : false;
 }
 
-bool ble_valve_is_authenticated(void)
+bool ble_valve_is_authenticated(int valve)
 {
-    return (get_state_bits() & BLE_STATE_BIT_AUTHENTICATED) != 0;
+    valve_t *v = valve_at(valve);
+    return v ? (get_state_bits(v) & BLE_STATE_BIT_AUTHENTICATED) != 0 : false;
 }
 
-void ble_valve_set_target_mac(const char *mac_str)
+void ble_valve_set_target_mac(int valve, const char *mac_str)
 {
+    valve_t *v = valve_at(valve);
+    if (v == NULL)
+        return;
+
     if (!mac_str)
     {
-        g_has_target_mac = false;
-        g_target_valve_mac[0] = '\0';
-        g_connect_requested = false;
-        ESP_LOGI(BLE_TAG, "[API] Target MAC cleared");
+        v->has_target_mac = false;
+        v->target_mac[0] = '\0';
+        v->connect_requested = false;
+        if (is_scanning)
+            start_scan();   // narrows or stops the scan
+        ESP_LOGI(BLE_TAG, "[API] Valve %d target MAC cleared", valve);
         return;
     }
 
-    strncpy(g_target_valve_mac, mac_str, sizeof(g_target_valve_mac) - 1);
-    g_target_valve_mac[sizeof(g_target_valve_mac) - 1] = '\0';
-    g_has_target_mac = true;
+    strncpy(v->target_mac, mac_str, sizeof(v->target_mac) - 1);
+    v->target_mac[sizeof(v->target_mac) - 1] = '\0';
+    v->has_target_mac = true;
+
+    ESP_LOGI(BLE_TAG, "[API] Valve %d target MAC set to: %s", valve, v->target_mac);
 
-    ESP_LOGI(BLE_TAG, "[API] Target MAC set to: %s", g_target_valve_mac);
+    // Already looking by name: switch to the passive, accept-list search
+    // once no valve needs discovery by name
+    if (is_scanning)
+        start_scan();
 }
 
-bool ble_valve_has_target_mac(void)
+bool ble_valve_has_target_mac(int valve)
 {
-    return g_has_target_mac;
+    valve_t *v = valve_at(valve);
+    return v ? v->has_target_mac : false;
 }
 
-EventGroupHandle_t ble_valve_get_state_event_group(void)
+EventGroupHandle_t ble_valve_get_state_event_group(int valve)
 {
-    return ble_state_event_group;
+    valve_t *v = valve_at(valve);
+    return v ? v->state_event_group : NULL;
 }
 
 void ble_valve_clear_bonds(void)
@@ -1897,46 +2733,95 @@ void ble_valve_clear_bonds(void)
     ESP_LOGI(BLE_TAG, "[API] Clearing all BLE bonds...");
     int rc = ble_store_clear();
     ESP_LOGI(BLE_TAG, "[API] ble_store_clear() rc=%d", rc);
+    for (int i = 0; i < BLE_VALVE_MAX; i++)
+        gatt_cache_invalidate(&g_valves[i]);
+}
+
+bool ble_valve_set_rmleak(int valve, bool enabled)
+{
+    return ble_valve_submit(valve, BLE_VALVE_TARGET_RMLEAK, enabled ? 1 : 0, 0, NULL, NULL) != 0;
 }
 
-bool ble_valve_set_rmleak(bool enabled)
+bool ble_valve_get_rmleak_state(int valve)
 {
-    ble_valve_msg_t m = {.command = enabled ? BLE_CMD_SET_RMLEAK : BLE_CMD_CLEAR_RMLEAK};
-    return xQueueSend(ble_cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+    valve_t *v = valve_at(valve);
+    return v ? v->val_rmleak : false;
 }
 
-bool ble_valve_get_rmleak_state(void)
+bool ble_valve_is_connected(int valve)
 {
-    return g_val_rmleak;
+    valve_t *v = valve_at(valve);
+    return v ? v->conn_handle != BLE_HS_CONN_HANDLE_NONE : false;
 }
 
-bool ble_valve_is_connected(void)
+// Cancel an unwritten command holding `val` on `target`
+static void cmd_cancel_unwritten(valve_t *v, ble_valve_target_t target, uint8_t val)
 {
-    return valve_conn_handle != BLE_HS_CONN_HANDLE_NONE;
+    portENTER_CRITICAL(&g_cmd_lock);
+    valve_cmd_slot_t *c = &v->cmd_slot[target];
+    if (c->id != 0 && c->value == val && !c->written)
+    {
+        cmd_complete_unlock(v, target, BLE_VALVE_CMD_CANCELLED);
+        return;
+    }
+    portEXIT_CRITICAL(&g_cmd_lock);
 }
 
-void ble_valve_cancel_pending_close(void)
+void ble_valve_cancel_pending_close(int valve)
 {
-    if (g_pending_valve_cmd == 0) {
-        g_pending_valve_cmd = -1;
-        ESP_LOGI(BLE_TAG, "[CMD] Pending valve CLOSE cancelled (leak resolved)");
+    valve_t *v = valve_at(valve);
+    if (v == NULL)
+        return;
+
+    if (v->pending_valve_cmd == 0) {
+        v->pending_valve_cmd = -1;
+        ESP_LOGI(BLE_TAG, "[CMD] Valve %d pending CLOSE cancelled (leak resolved)", valve);
     }
-    if (g_pending_rmleak_cmd == 1) {
-        g_pending_rmleak_cmd = -1;
-        ESP_LOGI(BLE_TAG, "[CMD] Pending RMLEAK SET cancelled (leak resolved)");
+    if (v->pending_rmleak_cmd == 1) {
+        v->pending_rmleak_cmd = -1;
+        ESP_LOGI(BLE_TAG, "[CMD] Valve %d pending RMLEAK SET cancelled (leak resolved)", valve);
     }
+    cmd_cancel_unwritten(v, BLE_VALVE_TARGET_STATE, 0);
+    cmd_cancel_unwritten(v, BLE_VALVE_TARGET_RMLEAK, 1);
 }
 
-bool ble_valve_get_firmware_rev(char *buffer, size_t len)
+bool ble_valve_get_firmware_rev(int valve, char *buffer, size_t len)
 {
-    if (buffer == NULL || len == 0)
+    valve_t *v = valve_at(valve);
+    if (v == NULL || buffer == NULL || len == 0)
         return false;
-    if (g_firmware_rev[0] == '\0')
+    if (v->firmware_rev[0] == '\0')
     {
         buffer[0] = '\0';
         return false;
     }
-    strncpy(buffer, g_firmware_rev, len - 1);
+    strncpy(buffer, v->firmware_rev, len - 1);
     buffer[len - 1] = '\0';
     return true;
 }
+
+void ble_valve_get_conn_stats(int valve, ble_valve_conn_stats_t *out)
+{
+    valve_t *v = valve_at(valve);
+    if (out == NULL)
+        return;
+    if (v == NULL)
+    {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    *out = v->conn_stats;
+    out->link_fast = (v->link_profile == BLE_VALVE_LINK_FAST);
+}
+
+bool ble_valve_set_link_profile(int valve, ble_valve_link_profile_t profile)
+{
+    valve_t *v = valve_at(valve);
+    if (v == NULL)
+        return false;
+    v->link_profile = profile;
+    if (v->cmd_queue == NULL)
+        return false;   // before init: applied when the first connection is ready
+    ble_valve_msg_t m = {.command = BLE_CMD_LINK_PROFILE};
+    return xQueueSend(v->cmd_queue, &m, pdMS_TO_TICKS(10)) == pdTRUE;
+}
@@ -7,14 +7,20 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
+#include "sdkconfig.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    // Queue for sending updates TO the IoT Hub Task
+    // Valves managed at once (menuconfig: eFloStop Hub -> Device capacity).
+    // Valve n is provisioning slot n; every per-valve call takes its index.
+    #define BLE_VALVE_MAX CONFIG_EFLO_MAX_VALVES
+
+    // Queue for sending updates TO the IoT Hub Task (items: ble_valve_update_t)
     extern QueueHandle_t ble_update_queue;
+    #define BLE_VALVE_UPDATE_QUEUE_LEN (5 * BLE_VALVE_MAX)
 
     // BLE update event types for delta forwarding
     typedef enum
@@ -28,22 +34,80 @@ extern "C"
         BLE_UPD_DISCONNECTED
     } ble_update_type_t;
 
+    typedef struct
+    {
+        ble_update_type_t type;
+        uint8_t valve;          // valve index
+    } ble_valve_update_t;
+
     typedef enum
     {
         BLE_CMD_CONNECT = 0,
         BLE_CMD_DISCONNECT,
-        BLE_CMD_OPEN_VALVE,
-        BLE_CMD_CLOSE_VALVE,
+        BLE_CMD_WRITE_STATE,    // write the valve state command slot's value
         BLE_CMD_SECURE,
-        BLE_CMD_SET_RMLEAK,
-        BLE_CMD_CLEAR_RMLEAK
+        BLE_CMD_WRITE_RMLEAK,   // write the RMLEAK command slot's value
+        BLE_CMD_LINK_PROFILE
     } ble_valve_cmd_t;
 
+    // Connection parameter profile of a valve link
+    typedef enum
+    {
+        BLE_VALVE_LINK_RELAXED = 0, // 100-200 ms interval, latency 4: idle, spares the valve battery
+        BLE_VALVE_LINK_FAST         // 7.5-15 ms interval, latency 0: leak incident active
+                                    // (interval scaled by the number of fast links)
+    } ble_valve_link_profile_t;
+
     typedef struct
     {
         ble_valve_cmd_t command;
     } ble_valve_msg_t;
 
+    // Connect-to-ready timing (ble_valve_get_conn_stats). "Ready" is the end of
+    // setup: notifications enabled and initial values read.
+    typedef struct
+    {
+        uint32_t last_ready_ms;    // GAP connect -> ready, last connection
+        uint32_t last_setup_ms;    // link secured -> ready, last connection
+        bool     last_from_cache;  // last connection used the cached handle map
+        uint32_t cached_count;     // connections set up from the handle cache
+        uint32_t cached_avg_ms;    // their mean connect -> ready
+        uint32_t full_count;       // connections that ran full discovery
+        uint32_t full_avg_ms;      // their mean connect -> ready
+        uint32_t cache_misses;     // cache present but MAC/fw rev/handles wrong
+        uint16_t conn_itvl;        // current connection interval, 1.25 ms units (0 = none)
+        bool     link_fast;        // fast link profile wanted
+    } ble_valve_conn_stats_t;
+
+    // -----------------------------------------------------------------------------
+    // Valve commands (ble_valve_submit)
+    // Each writable characteristic of each valve holds one command. A newer command on the same
+    // characteristic replaces the older one (last writer wins: the older completes
+    // SUPERSEDED) and shares its queued write. A command is DONE once the valve
+    // has answered the GATT write and reported the value by notify (or already
+    // held it). Completion callbacks run in the NimBLE host or BLE command task:
+    // keep them short and non-blocking.
+    // -----------------------------------------------------------------------------
+    typedef enum
+    {
+        BLE_VALVE_TARGET_STATE = 0, // 1 = open, 0 = closed
+        BLE_VALVE_TARGET_RMLEAK,    // 1 = assert interlock, 0 = clear
+        BLE_VALVE_TARGET_MAX
+    } ble_valve_target_t;
+
+    typedef enum
+    {
+        BLE_VALVE_CMD_DONE = 0,     // written, acknowledged and confirmed by the valve
+        BLE_VALVE_CMD_FAILED,       // write rejected or could not be queued
+        BLE_VALVE_CMD_TIMEOUT,      // deadline passed first (valve unreachable)
+        BLE_VALVE_CMD_SUPERSEDED,   // replaced by a newer command on the same target
+        BLE_VALVE_CMD_CANCELLED     // dropped before it was written
+    } ble_valve_cmd_status_t;
+
+    typedef uint32_t ble_valve_cmd_id_t;    // 0 = not submitted
+
+    typedef void (*ble_valve_cmd_cb_t)(ble_valve_cmd_id_t id, ble_valve_cmd_status_t status, void *ctx);
+
     // -----------------------------------------------------------------------------
     // BLE State Event Bits (for event group synchronization)
     // These bits track the security and connection state machine
@@ -74,34 +138,51 @@ extern "C"
      */
     void app_ble_valve_signal_start(void);
 
-    // API
-    bool ble_valve_open(void);
-    bool ble_valve_close(void);
-    bool ble_valve_connect(void);
-    bool ble_valve_disconnect(void);
+    // API (open/close are ble_valve_submit without deadline or callback).
+    // `valve` is the valve index (0 .. BLE_VALVE_MAX-1); out of range fails.
+    bool ble_valve_open(int valve);
+    bool ble_valve_close(int valve);
+    bool ble_valve_connect(int valve);
+    bool ble_valve_disconnect(int valve);
+
+    /**
+     * @brief Submit a write command on a valve characteristic. Non-blocking.
+     * If the valve is not ready the write waits for the next connection
+     * (and triggers a reconnect).
+     * @param timeout_ms Deadline from now (0 = none).
+     * @param cb         Completion callback (may be NULL), called exactly once.
+     * @return Command ID, or 0 if it could not be queued (cb is not called).
+     */
+    ble_valve_cmd_id_t ble_valve_submit(int valve, ble_valve_target_t target, uint8_t value,
+                                        uint32_t timeout_ms, ble_valve_cmd_cb_t cb, void *ctx);
+
+    /**
+     * @brief Short name of a command status ("done", "timeout", ...).
+     */
+    const char *ble_valve_cmd_status_str(ble_valve_cmd_status_t status);
 
-    // Provisioning support
-    void ble_valve_set_target_mac(const char *mac_str);
-    bool ble_valve_has_target_mac(void);
+    // Provisioning support (NULL clears the valve's target and stops looking for it)
+    void ble_valve_set_target_mac(int valve, const char *mac_str);
+    bool ble_valve_has_target_mac(int valve);
 
     // Getters
-    bool ble_valve_get_mac(char *mac_buffer);
-    uint8_t ble_valve_get_battery(void);
-    bool ble_valve_get_leak(void);
-    int ble_valve_get_state(void);
+    bool ble_valve_get_mac(int valve, char *mac_buffer);
+    uint8_t ble_valve_get_battery(int valve);
+    bool ble_valve_get_leak(int valve);
+    int ble_valve_get_state(int valve);
 
-    bool ble_valve_is_ready(void);
-    bool ble_valve_is_secured(void);
-    bool ble_valve_is_authenticated(void);
+    bool ble_valve_is_ready(int valve);
+    bool ble_valve_is_secured(int valve);
+    bool ble_valve_is_authenticated(int valve);
 
     /**
-     * @brief Get the BLE state event group handle for external synchronization.
+     * @brief Get a valve's BLE state event group for external synchronization.
      * @return EventGroupHandle_t or NULL if not initialized.
      */
-    EventGroupHandle_t ble_valve_get_state_event_group(void);
+    EventGroupHandle_t ble_valve_get_state_event_group(int valve);
 
     /**
-     * @brief Clear stored bonds for the valve device.
+     * @brief Clear stored bonds (all valves) and the cached handle maps.
      * Use this for decommissioning or troubleshooting pairing issues.
      */
     void ble_valve_clear_bonds(void);
@@ -110,26 +191,26 @@ extern "C"
      * @brief Write RMLEAK characteristic on the valve (1=assert interlock, 0=clear).
      * Non-blocking: queues a BLE command. If disconnected, queues pending and triggers reconnect.
      */
-    bool ble_valve_set_rmleak(bool enabled);
+    bool ble_valve_set_rmleak(int valve, bool enabled);
 
     /**
      * @brief Get the last-known RMLEAK value read/notified from the valve.
      */
-    bool ble_valve_get_rmleak_state(void);
+    bool ble_valve_get_rmleak_state(int valve);
 
     /**
      * @brief Check if the valve BLE connection is established.
      * Returns true when a GAP connection exists (conn_handle != NONE).
      * Does NOT guarantee GATT is ready — use ble_valve_is_ready() for that.
      */
-    bool ble_valve_is_connected(void);
+    bool ble_valve_is_connected(int valve);
 
     /**
      * @brief Cancel any pending auto-close commands (valve CLOSE + RMLEAK SET).
      * Called by the rules engine when all leak sources clear before the valve
      * reconnects, so stale close commands are not applied on reconnect.
      */
-    void ble_valve_cancel_pending_close(void);
+    void ble_valve_cancel_pending_close(int valve);
 
     /**
      * @brief Get the valve's firmware revision string read from DIS (0x180A).
@@ -137,7 +218,19 @@ extern "C"
      * @param len    Size of the output buffer.
      * @return true if firmware revision is available, false otherwise.
      */
-    bool ble_valve_get_firmware_rev(char *buffer, size_t len);
+    bool ble_valve_get_firmware_rev(int valve, char *buffer, size_t len);
+
+    /**
+     * @brief Copy the connect-to-ready timing counters of a valve.
+     */
+    void ble_valve_get_conn_stats(int valve, ble_valve_conn_stats_t *out);
+
+    /**
+     * @brief Choose the connection parameter profile of a valve link.
+     * Non-blocking: queues a BLE command. Applied now if the valve is ready,
+     * otherwise when the next connection finishes setup.
+     */
+    bool ble_valve_set_link_profile(int valve, ble_valve_link_profile_t profile);
 
 #ifdef __cplusplus
 }
@@ -43,6 +43,7 @@ typedef struct {
 #define C2D_CMD_OVERRIDE_CANCEL     "override_cancel"
 #define C2D_CMD_OVERRIDE_ENABLE     "override_enable"
 #define C2D_CMD_SET_HUB_NAME       "set_hub_name"
+#define C2D_CMD_SNAPSHOT            "snapshot"
 
 // ---------------------------------------------------------------------------
 // API
@@ -0,0 +1,218 @@
+/*
+ * delivery_tracker.c
+ *
+ * In-flight table of QoS 1 publishes, completed by PUBACK or disconnect.
+ * See delivery_tracker.h.
+ */
+
+#include "delivery_tracker.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "DELIVERY";
+
+#define EARLY_ACKS          8       /* PUBACKs kept until their msg_id is tracked */
+#define STALE_MS            60000   /* past the esp-mqtt outbox expiry (30 s default) */
+
+/* =========================================================================
+ * STATE
+ *
+ * Messages are tracked by iothub_task and completed by the MQTT task, so
+ * the table sits behind a spinlock. Callbacks run after it is released.
+ * ========================================================================= */
+typedef struct {
+    int      msg_id;                /* 0: free (QoS 1 ids are never 0) */
+    uint32_t tag;
+    int64_t  sent_us;
+    uint8_t  kind;
+} in_flight_t;
+
+static in_flight_t      s_slots[DELIVERY_MAX_IN_FLIGHT];
+static int              s_early[EARLY_ACKS];
+static uint8_t          s_early_next = 0;
+static uint8_t          s_reserved = 0;     /* slots held for the next track() */
+static delivery_done_fn s_done[DELIVERY_KIND_MAX];
+static delivery_stats_t s_stats;
+static uint64_t         s_latency_sum_ms = 0;
+static portMUX_TYPE     s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+/* Count an acknowledged message. Called with s_lock held. */
+static void acked_locked(int64_t sent_us)
+{
+    int64_t ms = (esp_timer_get_time() - sent_us) / 1000;
+    uint32_t lat = ms > 0 ? (uint32_t)ms : 0;
+    s_stats.acked++;
+    s_latency_sum_ms += lat;
+    if (lat > s_stats.latency_max_ms) s_stats.latency_max_ms = lat;
+}
+
+static void report(uint8_t kind, uint32_t tag, bool acked)
+{
+    if (kind < DELIVERY_KIND_MAX && s_done[kind]) {
+        s_done[kind](tag, acked);
+    }
+}
+
+/*
+ * Give up on messages older than STALE_MS. A message published just as the
+ * link dropped is tracked after delivery_tracker_on_disconnected(); it gets
+ * its PUBACK from the outbox retry after the reconnect, or expires here.
+ */
+static void expire_stale(void)
+{
+    in_flight_t lost[DELIVERY_MAX_IN_FLIGHT];
+    int n = 0;
+    int64_t cutoff = esp_timer_get_time() - (int64_t)STALE_MS * 1000;
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < DELIVERY_MAX_IN_FLIGHT; i++) {
+        if (s_slots[i].msg_id && s_slots[i].sent_us < cutoff) {
+            lost[n++] = s_slots[i];
+            s_slots[i].msg_id = 0;
+            s_stats.in_flight--;
+        }
+    }
+    s_stats.lost += n;
+    portEXIT_CRITICAL(&s_lock);
+
+    for (int i = 0; i < n; i++) {
+        ESP_LOGW(TAG, "msg_id %d: no PUBACK after %d s", lost[i].msg_id, STALE_MS / 1000);
+        report(lost[i].kind, lost[i].tag, false);
+    }
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+void delivery_tracker_set_callback(delivery_kind_t kind, delivery_done_fn fn)
+{
+    if (kind < DELIVERY_KIND_MAX) s_done[kind] = fn;
+}
+
+bool delivery_tracker_track(int msg_id, delivery_kind_t kind, uint32_t tag,
+                            int64_t sent_us)
+{
+    if (msg_id <= 0) return false;
+
+    bool early = false, tracked = false;
+    portENTER_CRITICAL(&s_lock);
+    bool reserved = s_reserved > 0;
+    if (reserved) s_reserved--;
+    for (int i = 0; i < EARLY_ACKS; i++) {
+        if (s_early[i] == msg_id) {
+            s_early[i] = 0;
+            early = true;
+            break;
+        }
+    }
+    if (early) {
+        s_stats.tracked++;
+        acked_locked(sent_us);
+    } else if (reserved || s_stats.in_flight + s_reserved < DELIVERY_MAX_IN_FLIGHT) {
+        for (int i = 0; i < DELIVERY_MAX_IN_FLIGHT; i++) {
+            if (s_slots[i].msg_id == 0) {
+                s_slots[i] = (in_flight_t){ msg_id, tag, sent_us, (uint8_t)kind };
+                s_stats.tracked++;
+                if (++s_stats.in_flight > s_stats.in_flight_max) {
+                    s_stats.in_flight_max = s_stats.in_flight;
+                }
+                tracked = true;
+                break;
+            }
+        }
+    }
+    if (!early && !tracked) s_stats.untracked++;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (early) report(kind, tag, true);
+    return early || tracked;
+}
+
+bool delivery_tracker_has_slot(void)
+{
+    expire_stale();
+    portENTER_CRITICAL(&s_lock);
+    bool room = s_stats.in_flight + s_reserved < DELIVERY_MAX_IN_FLIGHT;
+    portEXIT_CRITICAL(&s_lock);
+    return room;
+}
+
+bool delivery_tracker_reserve(void)
+{
+    expire_stale();
+    portENTER_CRITICAL(&s_lock);
+    bool room = s_stats.in_flight + s_reserved < DELIVERY_MAX_IN_FLIGHT;
+    if (room) s_reserved++;
+    portEXIT_CRITICAL(&s_lock);
+    return room;
+}
+
+void delivery_tracker_unreserve(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (s_reserved > 0) s_reserved--;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void delivery_tracker_on_published(int msg_id)
+{
+    if (msg_id <= 0) return;
+
+    in_flight_t done = {0};
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < DELIVERY_MAX_IN_FLIGHT; i++) {
+        if (s_slots[i].msg_id == msg_id) {
+            done = s_slots[i];
+            s_slots[i].msg_id = 0;
+            s_stats.in_flight--;
+            acked_locked(done.sent_us);
+            break;
+        }
+    }
+    if (done.msg_id == 0) {
+        s_early[s_early_next] = msg_id;
+        s_early_next = (s_early_next + 1) % EARLY_ACKS;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (done.msg_id) report(done.kind, done.tag, true);
+}
+
+void delivery_tracker_on_disconnected(void)
+{
+    in_flight_t lost[DELIVERY_MAX_IN_FLIGHT];
+    int n = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < DELIVERY_MAX_IN_FLIGHT; i++) {
+        if (s_slots[i].msg_id) {
+            lost[n++] = s_slots[i];
+            s_slots[i].msg_id = 0;
+        }
+    }
+    memset(s_early, 0, sizeof(s_early));
+    s_stats.in_flight = 0;
+    s_stats.lost += n;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (n) ESP_LOGW(TAG, "%d message(s) in flight without PUBACK", n);
+    for (int i = 0; i < n; i++) {
+        report(lost[i].kind, lost[i].tag, false);
+    }
+}
+
+void delivery_tracker_get_stats(delivery_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = s_stats;
+    out->latency_avg_ms = s_stats.acked ? (uint32_t)(s_latency_sum_ms / s_stats.acked) : 0;
+    portEXIT_CRITICAL(&s_lock);
+}
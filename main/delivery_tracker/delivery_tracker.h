@@ -0,0 +1,118 @@
+/*
+ * delivery_tracker.h
+ *
+ * PUBACK tracking of QoS 1 telemetry publishes.
+ *
+ * esp_mqtt_client_publish() returning a msg_id only means the message went
+ * into the esp-mqtt outbox. Each telemetry publish is therefore tracked by
+ * its msg_id until MQTT_EVENT_PUBLISHED reports the broker's PUBACK, or
+ * until the connection drops (or a minute passes) and it is given up. An owner that needs the
+ * outcome registers a callback for its kind and passes a tag with each
+ * message. The offline buffer erases an NVS entry only on PUBACK and sends
+ * it again after a disconnect. A snapshot is a delta base only when every
+ * page was acknowledged.
+ *
+ * At most DELIVERY_MAX_IN_FLIGHT messages are tracked at once. The outbox
+ * keeps a copy of every unacknowledged message, so publishers check
+ * delivery_tracker_has_slot() first and buffer, defer or drop when the cap
+ * is reached.
+ *
+ * A PUBACK can arrive before its msg_id is tracked, because
+ * esp_mqtt_client_publish() returns after the TLS write. The last few
+ * unmatched PUBACKs are kept, and a late delivery_tracker_track() completes
+ * at once.
+ */
+
+#ifndef DELIVERY_TRACKER_H
+#define DELIVERY_TRACKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DELIVERY_MAX_IN_FLIGHT  CONFIG_EFLO_MQTT_MAX_IN_FLIGHT
+
+typedef enum {
+    DELIVERY_LIVE = 0,      /* published from RAM: counted only */
+    DELIVERY_SNAPSHOT,      /* snapshot page; tag = snapshot_id */
+    DELIVERY_DURABLE,       /* offline buffer entry; tag from offline_buffer */
+    DELIVERY_KIND_MAX
+} delivery_kind_t;
+
+/*
+ * Outcome of a tracked message: acked = PUBACK received, false = given
+ * up. Runs in the MQTT task, or in the publishing task for an early PUBACK
+ * or a stale message; must not block.
+ */
+typedef void (*delivery_done_fn)(uint32_t tag, bool acked);
+
+/* Counters since boot (delivery_tracker_get_stats) */
+typedef struct {
+    uint32_t tracked;
+    uint32_t acked;
+    uint32_t lost;              /* connection dropped or no PUBACK in time */
+    uint32_t untracked;         /* published with every slot taken */
+    uint16_t in_flight;
+    uint16_t in_flight_max;     /* high water */
+    uint32_t latency_avg_ms;    /* publish call to PUBACK */
+    uint32_t latency_max_ms;
+} delivery_stats_t;
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+/**
+ * @brief  Register the outcome callback of a kind (at init, before the
+ *         first publish of that kind).
+ */
+void delivery_tracker_set_callback(delivery_kind_t kind, delivery_done_fn fn);
+
+/**
+ * @brief  Track a message esp_mqtt_client_publish() accepted.
+ * @param  sent_us  esp_timer time taken just before the publish call
+ * @return false if msg_id is not a QoS 1 id or every slot is taken; the
+ *         message then gets no outcome. Uses a delivery_tracker_reserve()
+ *         slot when one is held, so it cannot find the table full.
+ */
+bool delivery_tracker_track(int msg_id, delivery_kind_t kind, uint32_t tag,
+                            int64_t sent_us);
+
+/**
+ * @brief  Fewer than DELIVERY_MAX_IN_FLIGHT messages in flight. Gives up
+ *         on stale messages first, reporting them from the calling task.
+ */
+bool delivery_tracker_has_slot(void);
+
+/**
+ * @brief  Hold a slot for a message about to be published, so its track()
+ *         cannot fail after the publish call succeeded. Counts as in flight
+ *         for has_slot(). Follow with track(), or unreserve() if the publish
+ *         call fails. iothub_task only.
+ * @return false at the cap
+ */
+bool delivery_tracker_reserve(void);
+
+/** @brief  Give back a reserved slot whose publish call failed. */
+void delivery_tracker_unreserve(void);
+
+/** @brief  MQTT_EVENT_PUBLISHED (MQTT task). */
+void delivery_tracker_on_published(int msg_id);
+
+/**
+ * @brief  MQTT_EVENT_DISCONNECTED (MQTT task): everything in flight is
+ *         given up and reported to its owner as not acked.
+ */
+void delivery_tracker_on_disconnected(void);
+
+/** @brief  Copy the counters. Safe from any task. */
+void delivery_tracker_get_stats(delivery_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DELIVERY_TRACKER_H */
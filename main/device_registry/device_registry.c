@@ -0,0 +1,402 @@
+#include "device_registry.h"
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#define DEVREG_TAG "DEVICE_REGISTRY"
+
+// Open-addressed (linear probing) index, kept at most half full
+#if DEVREG_MAX_DEVICES <= 32
+#define DEVREG_INDEX_BITS   6
+#elif DEVREG_MAX_DEVICES <= 64
+#define DEVREG_INDEX_BITS   7
+#elif DEVREG_MAX_DEVICES <= 128
+#define DEVREG_INDEX_BITS   8
+#elif DEVREG_MAX_DEVICES <= 256
+#define DEVREG_INDEX_BITS   9
+#else
+#define DEVREG_INDEX_BITS   10
+#endif
+#define DEVREG_INDEX_SIZE   (1u << DEVREG_INDEX_BITS)
+
+_Static_assert(DEVREG_INDEX_SIZE >= 2 * DEVREG_MAX_DEVICES,
+               "Registry index must stay at most half full");
+
+#define DEVREG_USED_WORDS   ((DEVREG_MAX_DEVICES + 31) / 32)
+
+// ---------------------------------------------------------------------------
+// State (struct-of-arrays: 8 bytes + 1 bit per handle, ID strings are
+// formatted from the key on demand)
+// ---------------------------------------------------------------------------
+static uint64_t       s_key[DEVREG_MAX_DEVICES];    // LoRa: sensor ID, valve/BLE: 48-bit MAC
+static uint32_t       s_used[DEVREG_USED_WORDS];    // in-use bitmap
+static uint16_t       s_index[DEVREG_INDEX_SIZE];   // handle + 1, 0 = empty
+static int            s_count[3];                   // per devreg_type_t
+static volatile uint32_t s_generation = 0;
+
+// Lookups are a handful of probes, so a spinlock keeps the packet path off
+// the scheduler. Writers (sync) are rare and do no I/O inside the lock.
+static portMUX_TYPE   s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// ---------------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------------
+
+static uint32_t key_hash(devreg_type_t type, uint64_t key)
+{
+    uint64_t x = (key ^ ((uint64_t)type << 56)) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(x >> (64 - DEVREG_INDEX_BITS));
+}
+
+static inline bool used(const uint32_t *bm, int h)
+{
+    return (bm[h >> 5] >> (h & 31)) & 1u;
+}
+
+static inline void set_used(uint32_t *bm, int h, bool on)
+{
+    if (on) bm[h >> 5] |=  (1u << (h & 31));
+    else    bm[h >> 5] &= ~(1u << (h & 31));
+}
+
+static uint64_t mac_key(const uint8_t mac[6])
+{
+    return ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) |
+           ((uint64_t)mac[2] << 24) | ((uint64_t)mac[3] << 16) |
+           ((uint64_t)mac[4] <<  8) |  (uint64_t)mac[5];
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static const char s_hex[] = "0123456789ABCDEF";
+
+static void format_lora_id(uint32_t id, char out[DEVREG_ID_STR_LEN])
+{
+    out[0] = '0';
+    out[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        out[2 + i] = s_hex[(id >> (28 - 4 * i)) & 0xF];
+    }
+    out[10] = '\0';
+}
+
+static void format_mac(uint64_t key, char out[DEVREG_ID_STR_LEN])
+{
+    for (int i = 0; i < 6; i++) {
+        uint8_t b = (uint8_t)(key >> (40 - 8 * i));
+        out[i * 3]     = s_hex[b >> 4];
+        out[i * 3 + 1] = s_hex[b & 0xF];
+        out[i * 3 + 2] = (i < 5) ? ':' : '\0';
+    }
+}
+
+// Caller holds s_lock
+static dev_handle_t lookup_locked(devreg_type_t type, uint64_t key)
+{
+    uint32_t i = key_hash(type, key);
+    for (uint32_t n = 0; n < DEVREG_INDEX_SIZE; n++) {
+        uint16_t v = s_index[i];
+        if (v == 0) {
+            return DEVREG_HANDLE_NONE;
+        }
+        dev_handle_t h = (dev_handle_t)(v - 1);
+        if (used(s_used, h) && s_key[h] == key && device_registry_type(h) == type) {
+            return h;
+        }
+        i = (i + 1) & (DEVREG_INDEX_SIZE - 1);
+    }
+    return DEVREG_HANDLE_NONE;
+}
+
+// Caller holds s_lock
+static void index_insert_locked(dev_handle_t h)
+{
+    uint32_t i = key_hash(device_registry_type(h), s_key[h]);
+    while (s_index[i] != 0) {
+        i = (i + 1) & (DEVREG_INDEX_SIZE - 1);
+    }
+    s_index[i] = (uint16_t)(h + 1);
+}
+
+// Caller holds s_lock
+static void index_rebuild_locked(void)
+{
+    memset(s_index, 0, sizeof(s_index));
+    for (int h = 0; h < DEVREG_MAX_DEVICES; h++) {
+        if (used(s_used, h)) {
+            index_insert_locked((dev_handle_t)h);
+        }
+    }
+}
+
+// Caller holds s_lock. Lowest free handle in [base, base + n).
+static dev_handle_t alloc_locked(int base, int n)
+{
+    for (int h = base; h < base + n; h++) {
+        if (!used(s_used, h)) {
+            return (dev_handle_t)h;
+        }
+    }
+    return DEVREG_HANDLE_NONE;
+}
+
+// Caller holds s_lock
+static void add_locked(dev_handle_t h, uint64_t key)
+{
+    s_key[h] = key;
+    set_used(s_used, h, true);
+    index_insert_locked(h);
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+bool device_registry_parse_mac(const char *str, uint8_t mac[6])
+{
+    if (!str) return false;
+    for (int i = 0; i < 6; i++) {
+        int hi = hex_nibble(str[i * 3]);
+        int lo = (hi < 0) ? -1 : hex_nibble(str[i * 3 + 1]);
+        if (lo < 0) return false;
+        if (i < 5 && str[i * 3 + 2] != ':') return false;
+        mac[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return str[17] == '\0';
+}
+
+void device_registry_sync(const char (*valve_macs)[18],
+                          const uint32_t *lora_ids, int lora_count,
+                          const char (*ble_macs)[18], int ble_count)
+{
+    if (lora_count > DEVREG_MAX_LORA) {
+        ESP_LOGW(DEVREG_TAG, "%d LoRa sensors, capacity %d", lora_count, DEVREG_MAX_LORA);
+        lora_count = DEVREG_MAX_LORA;
+    }
+    if (ble_count > DEVREG_MAX_BLE) {
+        ESP_LOGW(DEVREG_TAG, "%d BLE leak sensors, capacity %d", ble_count, DEVREG_MAX_BLE);
+        ble_count = DEVREG_MAX_BLE;
+    }
+
+    // Parse outside the lock. The BLE key list is on the heap so a large
+    // capacity build doesn't put kilobytes on the caller's stack; a MAC that
+    // fails to parse gets a key no 48-bit MAC can match.
+    const uint64_t BAD_KEY = UINT64_MAX;
+    uint8_t  mac[6];
+    uint64_t valve_keys[DEVREG_MAX_VALVES];
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        valve_keys[v] = (valve_macs && device_registry_parse_mac(valve_macs[v], mac))
+                        ? mac_key(mac) : BAD_KEY;
+    }
+
+    uint64_t *ble_keys = NULL;
+    if (ble_count > 0) {
+        ble_keys = malloc(ble_count * sizeof(uint64_t));
+        if (!ble_keys) {
+            ESP_LOGE(DEVREG_TAG, "Sync: out of memory, registry unchanged");
+            return;
+        }
+        for (int i = 0; i < ble_count; i++) {
+            ble_keys[i] = device_registry_parse_mac(ble_macs[i], mac) ? mac_key(mac) : BAD_KEY;
+        }
+    }
+
+    uint32_t keep[DEVREG_USED_WORDS] = {0};
+    bool changed = false;
+    int  dropped = 0;
+    dev_handle_t h;
+
+    portENTER_CRITICAL(&s_lock);
+
+    // 1. Devices still listed keep their handle (valves: same MAC, same slot)
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        h = (dev_handle_t)(DEVREG_HANDLE_VALVE + v);
+        if (valve_keys[v] != BAD_KEY && used(s_used, h) && s_key[h] == valve_keys[v]) {
+            set_used(keep, h, true);
+        }
+    }
+    for (int i = 0; i < lora_count; i++) {
+        if ((h = lookup_locked(DEVREG_LORA, lora_ids[i])) != DEVREG_HANDLE_NONE) set_used(keep, h, true);
+    }
+    for (int i = 0; i < ble_count; i++) {
+        if (ble_keys[i] != BAD_KEY &&
+            (h = lookup_locked(DEVREG_BLE_LEAK, ble_keys[i])) != DEVREG_HANDLE_NONE) set_used(keep, h, true);
+    }
+
+    // 2. Free the rest
+    for (int w = 0; w < DEVREG_USED_WORDS; w++) {
+        if (s_used[w] & ~keep[w]) {
+            changed = true;
+        }
+        s_used[w] &= keep[w];
+    }
+    if (changed) {
+        index_rebuild_locked();
+    }
+
+    // 3. Newcomers take the lowest free slot of their type; a valve takes
+    //    the handle of its valve slot
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        h = (dev_handle_t)(DEVREG_HANDLE_VALVE + v);
+        if (valve_keys[v] == BAD_KEY || used(keep, h)) continue;
+        if (lookup_locked(DEVREG_VALVE, valve_keys[v]) != DEVREG_HANDLE_NONE) {
+            dropped++;          // same MAC already commissioned on another slot
+            continue;
+        }
+        add_locked(h, valve_keys[v]);
+        changed = true;
+    }
+    for (int i = 0; i < lora_count; i++) {
+        if (lookup_locked(DEVREG_LORA, lora_ids[i]) != DEVREG_HANDLE_NONE) continue;
+        h = alloc_locked(DEVREG_HANDLE_LORA_BASE, DEVREG_MAX_LORA);
+        if (h == DEVREG_HANDLE_NONE) { dropped++; continue; }
+        add_locked(h, lora_ids[i]);
+        changed = true;
+    }
+    for (int i = 0; i < ble_count; i++) {
+        if (ble_keys[i] == BAD_KEY) { dropped++; continue; }
+        if (lookup_locked(DEVREG_BLE_LEAK, ble_keys[i]) != DEVREG_HANDLE_NONE) continue;
+        h = alloc_locked(DEVREG_HANDLE_BLE_BASE, DEVREG_MAX_BLE);
+        if (h == DEVREG_HANDLE_NONE) { dropped++; continue; }
+        add_locked(h, ble_keys[i]);
+        changed = true;
+    }
+
+    memset(s_count, 0, sizeof(s_count));
+    for (int i = 0; i < DEVREG_MAX_DEVICES; i++) {
+        if (used(s_used, i)) s_count[device_registry_type((dev_handle_t)i)]++;
+    }
+    if (changed) {
+        s_generation++;
+    }
+    int valves = s_count[DEVREG_VALVE], loras = s_count[DEVREG_LORA], bles = s_count[DEVREG_BLE_LEAK];
+    uint32_t gen = s_generation;
+
+    portEXIT_CRITICAL(&s_lock);
+
+    free(ble_keys);
+
+    if (dropped > 0) {
+        ESP_LOGW(DEVREG_TAG, "%d device(s) not registered (invalid ID or no free slot)", dropped);
+    }
+    if (changed) {
+        ESP_LOGI(DEVREG_TAG, "Synced: valve=%d/%d lora=%d/%d ble=%d/%d (gen %lu, %u B)",
+                 valves, DEVREG_MAX_VALVES, loras, DEVREG_MAX_LORA, bles, DEVREG_MAX_BLE,
+                 (unsigned long)gen,
+                 (unsigned)(sizeof(s_key) + sizeof(s_used) + sizeof(s_index)));
+    }
+}
+
+dev_handle_t device_registry_find_lora(uint32_t sensor_id)
+{
+    portENTER_CRITICAL(&s_lock);
+    dev_handle_t h = lookup_locked(DEVREG_LORA, sensor_id);
+    portEXIT_CRITICAL(&s_lock);
+    return h;
+}
+
+dev_handle_t device_registry_find_mac(devreg_type_t type, const uint8_t mac[6])
+{
+    if (!mac || type == DEVREG_LORA) return DEVREG_HANDLE_NONE;
+    uint64_t key = mac_key(mac);
+
+    portENTER_CRITICAL(&s_lock);
+    dev_handle_t h = lookup_locked(type, key);
+    portEXIT_CRITICAL(&s_lock);
+    return h;
+}
+
+dev_handle_t device_registry_find_id_str(devreg_type_t type, const char *id_str)
+{
+    if (!id_str) return DEVREG_HANDLE_NONE;
+
+    if (type == DEVREG_LORA) {
+        char *end = NULL;
+        unsigned long id = strtoul(id_str, &end, 16);
+        if (end == id_str || *end != '\0') return DEVREG_HANDLE_NONE;
+        return device_registry_find_lora((uint32_t)id);
+    }
+
+    uint8_t mac[6];
+    if (!device_registry_parse_mac(id_str, mac)) return DEVREG_HANDLE_NONE;
+    return device_registry_find_mac(type, mac);
+}
+
+bool device_registry_in_use(dev_handle_t h)
+{
+    if (h >= DEVREG_MAX_DEVICES) return false;
+    portENTER_CRITICAL(&s_lock);
+    bool in_use = used(s_used, h);
+    portEXIT_CRITICAL(&s_lock);
+    return in_use;
+}
+
+bool device_registry_get_lora_id(dev_handle_t h, uint32_t *id_out)
+{
+    if (!id_out || h >= DEVREG_MAX_DEVICES || device_registry_type(h) != DEVREG_LORA) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    bool in_use = used(s_used, h);
+    *id_out = (uint32_t)s_key[h];
+    portEXIT_CRITICAL(&s_lock);
+    return in_use;
+}
+
+bool device_registry_get_mac(dev_handle_t h, uint8_t mac[6])
+{
+    if (!mac || h >= DEVREG_MAX_DEVICES || device_registry_type(h) == DEVREG_LORA) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    bool in_use = used(s_used, h);
+    uint64_t key = s_key[h];
+    portEXIT_CRITICAL(&s_lock);
+
+    for (int i = 0; i < 6; i++) {
+        mac[i] = (uint8_t)(key >> (40 - 8 * i));
+    }
+    return in_use;
+}
+
+bool device_registry_get_id_str(dev_handle_t h, char out[DEVREG_ID_STR_LEN])
+{
+    if (!out || h >= DEVREG_MAX_DEVICES) return false;
+    portENTER_CRITICAL(&s_lock);
+    bool in_use = used(s_used, h);
+    uint64_t key = s_key[h];
+    portEXIT_CRITICAL(&s_lock);
+
+    if (!in_use) {
+        out[0] = '\0';
+        return false;
+    }
+    if (device_registry_type(h) == DEVREG_LORA) {
+        format_lora_id((uint32_t)key, out);
+    } else {
+        format_mac(key, out);
+    }
+    return true;
+}
+
+int device_registry_count(devreg_type_t type)
+{
+    if ((int)type < 0 || type > DEVREG_BLE_LEAK) return 0;
+    portENTER_CRITICAL(&s_lock);
+    int n = s_count[type];
+    portEXIT_CRITICAL(&s_lock);
+    return n;
+}
+
+uint32_t device_registry_generation(void)
+{
+    // Aligned 32-bit load, no lock: callers poll it on the advertisement path
+    return s_generation;
+}
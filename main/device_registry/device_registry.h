@@ -0,0 +1,155 @@
+#ifndef DEVICE_REGISTRY_H
+#define DEVICE_REGISTRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Central registry of commissioned devices.
+ *
+ * Every commissioned device (valve, LoRa sensor, BLE leak sensor) gets a small
+ * integer handle. Modules keep their per-device state in plain arrays indexed
+ * by that handle (or by the per-type slot derived from it) instead of scanning
+ * by sensor ID / MAC string. Lookups go through a hash index on the LoRa
+ * sensor ID and the 48-bit MAC, so the packet path costs a few probes and no
+ * string formatting or compares.
+ *
+ * State is struct-of-arrays (a 64-bit key per handle plus an in-use bitmap);
+ * ID strings are formatted from the key when asked for, so the table stays at
+ * ~10 bytes per device in large capacity builds.
+ *
+ * Handles are partitioned by type so both views come for free:
+ *   0..DEVREG_MAX_VALVES-1               valve, handle == valve index
+ *   DEVREG_HANDLE_LORA_BASE + slot       LoRa sensor, slot 0..DEVREG_MAX_LORA-1
+ *   DEVREG_HANDLE_BLE_BASE  + slot       BLE leak sensor, slot 0..DEVREG_MAX_BLE-1
+ *
+ * A device keeps its handle for as long as it stays commissioned. A freed
+ * handle is reused by the next device of the same type, so modules that keep
+ * state per handle also store the device key and reset the slot on mismatch.
+ *
+ * The registry is filled by provisioning_manager (device_registry_sync) on
+ * load and after every change. Lookups are safe from any task.
+ */
+
+#define DEVREG_MAX_VALVES         CONFIG_EFLO_MAX_VALVES
+#define DEVREG_MAX_LORA           CONFIG_EFLO_MAX_LORA_SENSORS
+#define DEVREG_MAX_BLE            CONFIG_EFLO_MAX_BLE_LEAK_SENSORS
+
+#define DEVREG_HANDLE_VALVE       0     // first valve; valve n is handle n
+#define DEVREG_HANDLE_LORA_BASE   DEVREG_MAX_VALVES
+#define DEVREG_HANDLE_BLE_BASE    (DEVREG_HANDLE_LORA_BASE + DEVREG_MAX_LORA)
+#define DEVREG_MAX_DEVICES        (DEVREG_HANDLE_BLE_BASE + DEVREG_MAX_BLE)
+#define DEVREG_HANDLE_NONE        0xFFFF
+
+#define DEVREG_ID_STR_LEN         18    // "XX:XX:XX:XX:XX:XX\0" or "0x754A6237\0"
+
+typedef uint16_t dev_handle_t;
+
+// Same order as health_dev_type_t
+typedef enum {
+    DEVREG_VALVE = 0,
+    DEVREG_LORA,
+    DEVREG_BLE_LEAK
+} devreg_type_t;
+
+static inline devreg_type_t device_registry_type(dev_handle_t h)
+{
+    if (h < DEVREG_HANDLE_LORA_BASE) return DEVREG_VALVE;
+    if (h < DEVREG_HANDLE_BLE_BASE)  return DEVREG_LORA;
+    return DEVREG_BLE_LEAK;
+}
+
+// Per-type slot of a valve / LoRa / BLE handle (index into per-type state arrays)
+static inline int device_registry_valve_slot(dev_handle_t h)
+{
+    return (int)h - DEVREG_HANDLE_VALVE;
+}
+
+static inline int device_registry_lora_slot(dev_handle_t h)
+{
+    return (int)h - DEVREG_HANDLE_LORA_BASE;
+}
+
+static inline int device_registry_ble_slot(dev_handle_t h)
+{
+    return (int)h - DEVREG_HANDLE_BLE_BASE;
+}
+
+/**
+ * @brief Make the registry match the commissioned device lists. Devices that
+ *        are still listed keep their handle, removed ones free it and new
+ *        ones take the lowest free slot of their type. Entries past the
+ *        per-type capacity are ignored. Valves are not allocated: valve n
+ *        always sits on handle DEVREG_HANDLE_VALVE + n.
+ * @param valve_macs  DEVREG_MAX_VALVES entries "XX:XX:XX:XX:XX:XX", "" for an
+ *                    empty valve slot; NULL for no valves
+ */
+void device_registry_sync(const char (*valve_macs)[18],
+                          const uint32_t *lora_ids, int lora_count,
+                          const char (*ble_macs)[18], int ble_count);
+
+/**
+ * @brief Handle of a commissioned LoRa sensor, DEVREG_HANDLE_NONE if unknown.
+ */
+dev_handle_t device_registry_find_lora(uint32_t sensor_id);
+
+/**
+ * @brief Handle of a commissioned valve / BLE leak sensor by MAC.
+ * @param mac  6 bytes in printed order (mac[0] is the first "XX:" octet)
+ */
+dev_handle_t device_registry_find_mac(devreg_type_t type, const uint8_t mac[6]);
+
+/**
+ * @brief Handle by ID string as used in telemetry and C2D payloads:
+ *        "0x754A6237" for LoRa, "XX:XX:XX:XX:XX:XX" (any case) otherwise.
+ */
+dev_handle_t device_registry_find_id_str(devreg_type_t type, const char *id_str);
+
+/**
+ * @brief True if the handle currently belongs to a commissioned device.
+ */
+bool device_registry_in_use(dev_handle_t h);
+
+/**
+ * @brief Sensor ID behind a LoRa handle. Returns false if the handle is free.
+ */
+bool device_registry_get_lora_id(dev_handle_t h, uint32_t *id_out);
+
+/**
+ * @brief MAC behind a valve / BLE leak handle, printed order.
+ *        Returns false if the handle is free or a LoRa handle.
+ */
+bool device_registry_get_mac(dev_handle_t h, uint8_t mac[6]);
+
+/**
+ * @brief Canonical ID string of a handle ("0x%08lX" / upper-case MAC),
+ *        formatted from the stored key. Returns false (and "") if free.
+ */
+bool device_registry_get_id_str(dev_handle_t h, char out[DEVREG_ID_STR_LEN]);
+
+/**
+ * @brief Number of commissioned devices of a type.
+ */
+int device_registry_count(devreg_type_t type);
+
+/**
+ * @brief Bumped by every device_registry_sync() that changed a handle.
+ *        Modules with derived indexes compare it to rebuild lazily.
+ */
+uint32_t device_registry_generation(void);
+
+/**
+ * @brief Parse "XX:XX:XX:XX:XX:XX" into 6 bytes in printed order.
+ */
+bool device_registry_parse_mac(const char *str, uint8_t mac[6]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DEVICE_REGISTRY_H
@@ -10,26 +10,32 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "cJSON.h"
+#include "device_registry.h"
 #include "provisioning_manager.h"
 
 #define HEALTH_TAG "HEALTH_ENGINE"
 
+_Static_assert(HEALTH_DEV_VALVE == (int)DEVREG_VALVE &&
+               HEALTH_DEV_LORA == (int)DEVREG_LORA &&
+               HEALTH_DEV_BLE_LEAK == (int)DEVREG_BLE_LEAK,
+               "health_dev_type_t must follow devreg_type_t");
+
 // ---------------------------------------------------------------------------
-// Internal per-device state
+// Internal per-device state: struct-of-arrays indexed by device registry
+// handle. The tick, system rating and sync scans each walk one or two narrow
+// arrays; the ID string and device type come from the registry on demand.
 // ---------------------------------------------------------------------------
+#define HDEV_IN_USE     (1 << 0)
+#define HDEV_EVER_SEEN  (1 << 1)   // set on first check-in this uptime
+
 typedef struct {
-    bool              in_use;
-    health_dev_type_t dev_type;
-    char              dev_id[18];       // MAC string or "0xHEXID"
-    health_rating_t   rating;
-    health_rating_t   prev_rating;
-    int64_t           last_seen_ms;     // Monotonic: esp_timer_get_time()/1000
-    uint8_t           last_battery;     // 0xFF = unknown
-    int8_t            last_rssi;        // 0 = unknown
-    int64_t           last_alert_ms;    // Last alert timestamp (debounce)
-    bool              ever_seen;        // false until first check-in this uptime
-    int64_t           disconnect_ms;    // Valve only: disconnect timestamp, 0 = connected
-} health_device_t;
+    int64_t last_seen_ms[HEALTH_MAX_DEVICES];   // Monotonic: esp_timer_get_time()/1000
+    int64_t last_alert_ms[HEALTH_MAX_DEVICES];  // Last alert timestamp (debounce)
+    uint8_t rating[HEALTH_MAX_DEVICES];         // health_rating_t
+    uint8_t last_battery[HEALTH_MAX_DEVICES];   // 0xFF = unknown
+    int8_t  last_rssi[HEALTH_MAX_DEVICES];      // 0 = unknown
+    uint8_t flags[HEALTH_MAX_DEVICES];          // HDEV_*
+} health_table_t;
 
 // ---------------------------------------------------------------------------
 // Static state
@@ -37,7 +43,8 @@ typedef struct {
 static QueueHandle_t  s_health_queue  = NULL;   // Input: health events
 static QueueHandle_t  s_alert_queue   = NULL;   // Output: alerts for IoT Hub
 static TimerHandle_t  s_tick_timer    = NULL;
-static health_device_t s_devices[HEALTH_MAX_DEVICES];
+static health_table_t s_dev;
+static int64_t        s_valve_disconnect_ms[DEVREG_MAX_VALVES];   // per valve, 0 = connected (or never seen)
 static volatile health_rating_t s_system_rating = HEALTH_EXCELLENT;
 static bool s_initialized = false;
 static SemaphoreHandle_t s_mutex = NULL;
@@ -75,30 +82,23 @@ static const char *dev_type_to_str(health_dev_type_t dt)
     }
 }
 
+static health_dev_type_t dev_type_of(dev_handle_t h)
+{
+    return (health_dev_type_t)device_registry_type(h);
+}
+
 // ---------------------------------------------------------------------------
 // Device lookup
 // ---------------------------------------------------------------------------
 
-static health_device_t *find_device(health_dev_type_t dt, const char *dev_id)
-{
-    for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (s_devices[i].in_use &&
-            s_devices[i].dev_type == dt &&
-            strcasecmp(s_devices[i].dev_id, dev_id) == 0) {
-            return &s_devices[i];
-        }
-    }
-    return NULL;
-}
-
-static health_device_t *find_valve(void)
+// Handle if it is tracked, DEVREG_HANDLE_NONE otherwise (not provisioned, or
+// registered after the last reload)
+static dev_handle_t tracked(dev_handle_t h)
 {
-    for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (s_devices[i].in_use && s_devices[i].dev_type == HEALTH_DEV_VALVE) {
-            return &s_devices[i];
-        }
+    if (h >= HEALTH_MAX_DEVICES || !(s_dev.flags[h] & HDEV_IN_USE)) {
+        return DEVREG_HANDLE_NONE;
     }
-    return NULL;
+    return h;
 }
 
 // Forward declaration (defined after evaluate_timeouts)
@@ -108,55 +108,61 @@ static void check_boot_sync_locked(void);
 // Rating calculation
 // ---------------------------------------------------------------------------
 
-static health_rating_t compute_sensor_rating(const health_device_t *dev, int64_t now)
+static health_rating_t compute_sensor_rating(dev_handle_t h, int64_t now)
 {
     // Check connectivity timeout
-    uint32_t timeout_ms = (dev->dev_type == HEALTH_DEV_LORA)
+    uint32_t timeout_ms = (dev_type_of(h) == HEALTH_DEV_LORA)
                           ? HEALTH_LORA_TIMEOUT_MS
                           : HEALTH_BLE_LEAK_TIMEOUT_MS;
+    int64_t last_seen = s_dev.last_seen_ms[h];
+    uint8_t battery   = s_dev.last_battery[h];
+    int8_t  rssi      = s_dev.last_rssi[h];
 
-    if (dev->last_seen_ms == 0 || (now - dev->last_seen_ms) > timeout_ms) {
+    if (last_seen == 0 || (now - last_seen) > timeout_ms) {
         return HEALTH_CRITICAL;
     }
 
     // Online — evaluate battery and signal
-    if (dev->last_battery != 0xFF && dev->last_battery <= HEALTH_BATTERY_WARN_PCT) {
+    if (battery != 0xFF && battery <= HEALTH_BATTERY_WARN_PCT) {
         return HEALTH_WARNING;
     }
-    if (dev->last_rssi != 0 && dev->last_rssi <= HEALTH_RSSI_WARN_DBM) {
+    if (rssi != 0 && rssi <= HEALTH_RSSI_WARN_DBM) {
         return HEALTH_WARNING;
     }
-    if (dev->last_battery != 0xFF && dev->last_battery <= HEALTH_BATTERY_GOOD_PCT) {
+    if (battery != 0xFF && battery <= HEALTH_BATTERY_GOOD_PCT) {
         return HEALTH_GOOD;
     }
-    if (dev->last_rssi != 0 &&
-        dev->last_rssi > HEALTH_RSSI_WARN_DBM &&
-        dev->last_rssi <= HEALTH_RSSI_GOOD_DBM) {
+    if (rssi != 0 &&
+        rssi > HEALTH_RSSI_WARN_DBM &&
+        rssi <= HEALTH_RSSI_GOOD_DBM) {
         return HEALTH_GOOD;
     }
 
     return HEALTH_EXCELLENT;
 }
 
-static health_rating_t compute_valve_rating(const health_device_t *dev, int64_t now)
+static health_rating_t compute_valve_rating(dev_handle_t h, int64_t now)
 {
+    int64_t disc_ms = s_valve_disconnect_ms[device_registry_valve_slot(h)];
+
     // Disconnected: check grace period
-    if (dev->disconnect_ms > 0) {
-        if ((now - dev->disconnect_ms) >= HEALTH_VALVE_DISC_TIMEOUT_MS)
+    if (disc_ms > 0) {
+        if ((now - disc_ms) >= HEALTH_VALVE_DISC_TIMEOUT_MS)
             return HEALTH_CRITICAL;
         return HEALTH_WARNING;  // Grace period — not yet CRITICAL
     }
 
     // Never connected this uptime
-    if (dev->last_seen_ms == 0) {
+    if (s_dev.last_seen_ms[h] == 0) {
         return HEALTH_CRITICAL;
     }
 
     // Connected — evaluate battery
-    if (dev->last_battery != 0xFF && dev->last_battery <= HEALTH_BATTERY_WARN_PCT) {
+    uint8_t battery = s_dev.last_battery[h];
+    if (battery != 0xFF && battery <= HEALTH_BATTERY_WARN_PCT) {
         return HEALTH_WARNING;
     }
-    if (dev->last_battery != 0xFF && dev->last_battery <= HEALTH_BATTERY_GOOD_PCT) {
+    if (battery != 0xFF && battery <= HEALTH_BATTERY_GOOD_PCT) {
         return HEALTH_GOOD;
     }
 
@@ -165,25 +171,25 @@ static health_rating_t compute_valve_rating(const health_device_t *dev, int64_t
 
 static void recalc_system_rating(void)
 {
-    health_rating_t worst = HEALTH_EXCELLENT;
+    // Free handles keep rating 0 (EXCELLENT), so no in_use check is needed
+    uint8_t worst = HEALTH_EXCELLENT;
 
     for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (!s_devices[i].in_use) continue;
-        if (s_devices[i].rating > worst) {
-            worst = s_devices[i].rating;
+        if (s_dev.rating[i] > worst) {
+            worst = s_dev.rating[i];
         }
     }
 
-    s_system_rating = worst;
+    s_system_rating = (health_rating_t)worst;
 }
 
 // ---------------------------------------------------------------------------
 // Alert generation
 // ---------------------------------------------------------------------------
 
-static void maybe_enqueue_alert(health_device_t *dev, health_rating_t new_rating, int64_t now)
+static void maybe_enqueue_alert(dev_handle_t h, health_rating_t new_rating, int64_t now)
 {
-    health_rating_t old_rating = dev->rating;
+    health_rating_t old_rating = (health_rating_t)s_dev.rating[h];
 
     // Only alert on Critical transitions (into or out of)
     bool into_critical  = (new_rating == HEALTH_CRITICAL && old_rating != HEALTH_CRITICAL);
@@ -194,102 +200,82 @@ static void maybe_enqueue_alert(health_device_t *dev, health_rating_t new_rating
     }
 
     // Suppress boot-time "recovered" alerts — first check-in is not a real recovery
-    if (out_of_critical && !dev->ever_seen) {
+    if (out_of_critical && !(s_dev.flags[h] & HDEV_EVER_SEEN)) {
         return;
     }
 
     // Debounce check
-    if (dev->last_alert_ms != 0 &&
-        (now - dev->last_alert_ms) < HEALTH_ALERT_DEBOUNCE_MS) {
+    if (s_dev.last_alert_ms[h] != 0 &&
+        (now - s_dev.last_alert_ms[h]) < HEALTH_ALERT_DEBOUNCE_MS) {
         return;
     }
 
     // Build alert
     health_alert_t alert;
     memset(&alert, 0, sizeof(alert));
-    alert.dev_type    = dev->dev_type;
-    strncpy(alert.dev_id, dev->dev_id, sizeof(alert.dev_id) - 1);
+    alert.dev_type    = dev_type_of(h);
+    device_registry_get_id_str(h, alert.dev_id);
     alert.new_rating  = new_rating;
     alert.old_rating  = old_rating;
-    alert.battery     = dev->last_battery;
-    alert.rssi        = dev->last_rssi;
+    alert.battery     = s_dev.last_battery[h];
+    alert.rssi        = s_dev.last_rssi[h];
 
-    if (into_critical && dev->last_seen_ms > 0) {
-        alert.offline_duration_s = (uint32_t)((now - dev->last_seen_ms) / 1000);
+    if (into_critical && s_dev.last_seen_ms[h] > 0) {
+        alert.offline_duration_s = (uint32_t)((now - s_dev.last_seen_ms[h]) / 1000);
     }
 
     if (xQueueSend(s_alert_queue, &alert, 0) == pdTRUE) {
-        dev->last_alert_ms = now;
+        s_dev.last_alert_ms[h] = now;
         ESP_LOGW(HEALTH_TAG, "ALERT: %s %s %s -> %s",
-                 dev_type_to_str(dev->dev_type), dev->dev_id,
+                 dev_type_to_str(alert.dev_type), alert.dev_id,
                  health_rating_to_str(old_rating),
                  health_rating_to_str(new_rating));
     }
 }
 
+// Apply a freshly computed rating (alerting on Critical transitions)
+static void set_rating(dev_handle_t h, health_rating_t new_rating, int64_t now)
+{
+    maybe_enqueue_alert(h, new_rating, now);
+    s_dev.rating[h] = (uint8_t)new_rating;
+}
+
 // ---------------------------------------------------------------------------
 // Event handlers
 // ---------------------------------------------------------------------------
 
-static void handle_lora_checkin(const health_event_t *evt)
+static void handle_sensor_checkin(dev_handle_t h, uint8_t battery, int8_t rssi)
 {
-    char id_str[16];
-    snprintf(id_str, sizeof(id_str), "0x%08lX", (unsigned long)evt->lora.sensor_id);
-
-    health_device_t *dev = find_device(HEALTH_DEV_LORA, id_str);
-    if (!dev) return;  // Not provisioned
+    if (tracked(h) == DEVREG_HANDLE_NONE) return;  // Not provisioned
 
     int64_t now = now_ms();
-    dev->last_seen_ms  = now;
-    dev->last_battery  = evt->lora.battery;
-    dev->last_rssi     = evt->lora.rssi;
-
-    health_rating_t new_rating = compute_sensor_rating(dev, now);
-    maybe_enqueue_alert(dev, new_rating, now);
-    dev->prev_rating = dev->rating;
-    dev->rating = new_rating;
-    dev->ever_seen = true;
-    check_boot_sync_locked();
-}
-
-static void handle_ble_leak_checkin(const health_event_t *evt)
-{
-    health_device_t *dev = find_device(HEALTH_DEV_BLE_LEAK, evt->ble_leak.mac_str);
-    if (!dev) return;
+    s_dev.last_seen_ms[h] = now;
+    s_dev.last_battery[h] = battery;
+    s_dev.last_rssi[h]    = rssi;
 
-    int64_t now = now_ms();
-    dev->last_seen_ms  = now;
-    dev->last_battery  = evt->ble_leak.battery;
-    dev->last_rssi     = evt->ble_leak.rssi;
-
-    health_rating_t new_rating = compute_sensor_rating(dev, now);
-    maybe_enqueue_alert(dev, new_rating, now);
-    dev->prev_rating = dev->rating;
-    dev->rating = new_rating;
-    dev->ever_seen = true;
+    set_rating(h, compute_sensor_rating(h, now), now);
+    s_dev.flags[h] |= HDEV_EVER_SEEN;
     check_boot_sync_locked();
 }
 
-static void handle_valve_event(bool connected)
+static void handle_valve_event(int valve, bool connected)
 {
-    health_device_t *dev = find_valve();
-    if (!dev) return;
+    if (valve < 0 || valve >= DEVREG_MAX_VALVES) return;
+    const dev_handle_t h = (dev_handle_t)(DEVREG_HANDLE_VALVE + valve);
+    if (tracked(h) == DEVREG_HANDLE_NONE) return;
 
     int64_t now = now_ms();
 
     if (connected) {
-        dev->last_seen_ms = now;
-        dev->disconnect_ms = 0;   // Clear grace period
+        s_dev.last_seen_ms[h] = now;
+        s_valve_disconnect_ms[valve] = 0;     // Clear grace period
     } else {
-        dev->disconnect_ms = now;  // Start grace period (keep last_seen_ms)
+        s_valve_disconnect_ms[valve] = now;   // Start grace period (keep last_seen_ms)
     }
 
-    health_rating_t new_rating = compute_valve_rating(dev, now);
-    maybe_enqueue_alert(dev, new_rating, now);
-    dev->prev_rating = dev->rating;
-    dev->rating = new_rating;
+    set_rating(h, compute_valve_rating(h, now), now);
     if (connected) {
-        dev->ever_seen = true;
+        s_dev.flags[h] |= HDEV_EVER_SEEN;
         check_boot_sync_locked();
     }
 }
@@ -298,32 +284,25 @@ static void evaluate_timeouts(void)
 {
     int64_t now = now_ms();
 
-    for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        health_device_t *dev = &s_devices[i];
-        if (!dev->in_use) continue;
-
-        // Valve: check disconnect grace period expiry (WARNING → CRITICAL)
-        if (dev->dev_type == HEALTH_DEV_VALVE) {
-            if (dev->disconnect_ms > 0) {
-                health_rating_t new_rating = compute_valve_rating(dev, now);
-                if (new_rating != dev->rating) {
-                    maybe_enqueue_alert(dev, new_rating, now);
-                    dev->prev_rating = dev->rating;
-                    dev->rating = new_rating;
-                }
-            }
-            continue;
+    // Valves: check disconnect grace period expiry (WARNING → CRITICAL)
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        dev_handle_t h = (dev_handle_t)(DEVREG_HANDLE_VALVE + v);
+        if (tracked(h) == DEVREG_HANDLE_NONE || s_valve_disconnect_ms[v] == 0) continue;
+        health_rating_t new_rating = compute_valve_rating(h, now);
+        if (new_rating != s_dev.rating[h]) {
+            set_rating(h, new_rating, now);
         }
+    }
 
-        // Sensors: skip devices never seen (already CRITICAL from init)
-        if (dev->last_seen_ms == 0) continue;
+    for (int i = DEVREG_HANDLE_LORA_BASE; i < HEALTH_MAX_DEVICES; i++) {
+        // Sensors: skip free handles and devices never seen (already CRITICAL
+        // from reload). last_seen_ms is only ever set on tracked handles.
+        if (s_dev.last_seen_ms[i] == 0) continue;
 
-        health_rating_t new_rating = compute_sensor_rating(dev, now);
+        health_rating_t new_rating = compute_sensor_rating(i, now);
 
-        if (new_rating != dev->rating) {
-            maybe_enqueue_alert(dev, new_rating, now);
-            dev->prev_rating = dev->rating;
-            dev->rating = new_rating;
+        if (new_rating != s_dev.rating[i]) {
+            set_rating(i, new_rating, now);
         }
     }
 
@@ -339,7 +318,7 @@ static void check_boot_sync_locked(void)
 
     bool all_seen = true;
     for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (s_devices[i].in_use && !s_devices[i].ever_seen) {
+        if ((s_dev.flags[i] & (HDEV_IN_USE | HDEV_EVER_SEEN)) == HDEV_IN_USE) {
             all_seen = false;
             break;
         }
@@ -386,16 +365,18 @@ static void health_engine_task(void *param)
 
         switch (evt.type) {
             case HEALTH_EVT_LORA_CHECKIN:
-                handle_lora_checkin(&evt);
+                handle_sensor_checkin(device_registry_find_lora(evt.lora.sensor_id),
+                                      evt.lora.battery, evt.lora.rssi);
                 break;
             case HEALTH_EVT_BLE_LEAK_CHECKIN:
-                handle_ble_leak_checkin(&evt);
+                handle_sensor_checkin(evt.ble_leak.handle,
+                                      evt.ble_leak.battery, evt.ble_leak.rssi);
                 break;
             case HEALTH_EVT_VALVE_CONNECTED:
-                handle_valve_event(true);
+                handle_valve_event(evt.valve.index, true);
                 break;
             case HEALTH_EVT_VALVE_DISCONNECTED:
-                handle_valve_event(false);
+                handle_valve_event(evt.valve.index, false);
                 break;
             case HEALTH_EVT_TICK:
                 evaluate_timeouts();
@@ -417,51 +398,19 @@ void health_engine_reload_devices(uint32_t sync_window_ms)
     bool have_mutex = (s_mutex != NULL);
     if (have_mutex) xSemaphoreTake(s_mutex, pdMS_TO_TICKS(1000));
 
-    // Clear all entries
-    memset(s_devices, 0, sizeof(s_devices));
+    // Clear all entries, then mirror the registry handle for handle
+    memset(&s_dev, 0, sizeof(s_dev));
+    memset(s_valve_disconnect_ms, 0, sizeof(s_valve_disconnect_ms));
     int idx = 0;
 
-    // Valve
-    char valve_mac[18];
-    if (provisioning_get_valve_mac(valve_mac)) {
-        s_devices[idx].in_use   = true;
-        s_devices[idx].dev_type = HEALTH_DEV_VALVE;
-        strncpy(s_devices[idx].dev_id, valve_mac, sizeof(s_devices[idx].dev_id) - 1);
-        s_devices[idx].rating      = HEALTH_CRITICAL;  // Until connected
-        s_devices[idx].prev_rating = HEALTH_CRITICAL;
-        s_devices[idx].last_battery = 0xFF;
-        idx++;
-    }
-
-    // LoRa sensors
-    uint32_t lora_ids[MAX_LORA_SENSORS];
-    uint8_t lora_count = 0;
-    if (provisioning_get_lora_sensors(lora_ids, &lora_count)) {
-        for (int i = 0; i < lora_count && idx < HEALTH_MAX_DEVICES; i++) {
-            s_devices[idx].in_use   = true;
-            s_devices[idx].dev_type = HEALTH_DEV_LORA;
-            snprintf(s_devices[idx].dev_id, sizeof(s_devices[idx].dev_id),
-                     "0x%08lX", (unsigned long)lora_ids[i]);
-            s_devices[idx].rating      = HEALTH_CRITICAL;  // Until first packet
-            s_devices[idx].prev_rating = HEALTH_CRITICAL;
-            s_devices[idx].last_battery = 0xFF;
-            idx++;
-        }
-    }
-
-    // BLE leak sensors
-    char ble_macs[MAX_BLE_LEAK_SENSORS][18];
-    uint8_t ble_count = 0;
-    if (provisioning_get_ble_leak_sensors(ble_macs, &ble_count)) {
-        for (int i = 0; i < ble_count && idx < HEALTH_MAX_DEVICES; i++) {
-            s_devices[idx].in_use   = true;
-            s_devices[idx].dev_type = HEALTH_DEV_BLE_LEAK;
-            strncpy(s_devices[idx].dev_id, ble_macs[i], sizeof(s_devices[idx].dev_id) - 1);
-            s_devices[idx].rating      = HEALTH_CRITICAL;  // Until first advertisement
-            s_devices[idx].prev_rating = HEALTH_CRITICAL;
-            s_devices[idx].last_battery = 0xFF;
-            idx++;
+    for (int h = 0; h < HEALTH_MAX_DEVICES; h++) {
+        if (!device_registry_in_use((dev_handle_t)h)) {
+            continue;
         }
+        s_dev.flags[h]        = HDEV_IN_USE;
+        s_dev.rating[h]       = HEALTH_CRITICAL;  // Until connected / first packet / first advertisement
+        s_dev.last_battery[h] = 0xFF;
+        idx++;
     }
 
     s_boot_sync_done = false;  // Reset boot sync on reload
@@ -478,6 +427,17 @@ void health_engine_reload_devices(uint32_t sync_window_ms)
     if (have_mutex) xSemaphoreGive(s_mutex);
 }
 
+// Device list changed (provision / add / remove): mirror the registry again
+// and open a commission sync window. Runs in the provisioning caller's task,
+// so the caller sees the reloaded table when its provisioning call returns.
+static void on_provisioning_changed(uint32_t generation, void *arg)
+{
+    (void)arg;
+    ESP_LOGI(HEALTH_TAG, "Provisioning changed (gen %lu), reloading devices",
+             (unsigned long)generation);
+    health_engine_reload_devices(HEALTH_COMMISSION_SYNC_TIMEOUT_MS);
+}
+
 void health_engine_init(void)
 {
     if (s_initialized) return;
@@ -511,14 +471,16 @@ void health_engine_init(void)
     }
 
     health_engine_reload_devices(HEALTH_BOOT_SYNC_TIMEOUT_MS);   // boot window; also stamps s_boot_start_ms
+    provisioning_subscribe(on_provisioning_changed, NULL);
 
     xTaskCreate(health_engine_task, "health_engine", 3072, NULL, 2, NULL);
     xTimerStart(s_tick_timer, 0);
 
     s_initialized = true;
-    ESP_LOGI(HEALTH_TAG, "Initialized (tick=%ds, sensor_timeout=%ds)",
+    ESP_LOGI(HEALTH_TAG, "Initialized (tick=%ds, sensor_timeout=%ds, table=%u B for %d devices)",
              HEALTH_TICK_INTERVAL_MS / 1000,
-             HEALTH_LORA_TIMEOUT_MS / 1000);
+             HEALTH_LORA_TIMEOUT_MS / 1000,
+             (unsigned)sizeof(s_dev), HEALTH_MAX_DEVICES);
 }
 
 bool health_post_event(const health_event_t *evt)
@@ -571,60 +533,64 @@ char *health_alert_to_json(const health_alert_t *alert)
     return json_str;
 }
 
-bool health_get_device_status_all(health_device_status_t out[HEALTH_MAX_DEVICES],
-                                  uint8_t *count_out)
+// Caller holds s_mutex
+static void fill_status(dev_handle_t h, int64_t now, health_device_status_t *dst)
 {
-    if (!out || !count_out || !s_mutex) return false;
-
-    if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        return false;
+    memset(dst, 0, sizeof(*dst));
+    dst->in_use = (s_dev.flags[h] & HDEV_IN_USE) != 0;
+    if (!dst->in_use) return;
+
+    bool ever_seen    = (s_dev.flags[h] & HDEV_EVER_SEEN) != 0;
+    int64_t last_seen = s_dev.last_seen_ms[h];
+
+    dst->dev_type     = dev_type_of(h);
+    device_registry_get_id_str(h, dst->dev_id);
+    dst->rating       = (health_rating_t)s_dev.rating[h];
+    dst->ever_seen    = ever_seen;
+    dst->last_battery = s_dev.last_battery[h];
+    dst->last_rssi    = s_dev.last_rssi[h];
+
+    // Compute connected status
+    if (dst->dev_type == HEALTH_DEV_VALVE) {
+        dst->connected = ever_seen &&
+                         (s_valve_disconnect_ms[device_registry_valve_slot(h)] == 0);
+    } else {
+        // Sensor: connected if ever_seen and within timeout
+        if (!ever_seen || last_seen == 0) {
+            dst->connected = false;
+        } else {
+            uint32_t timeout = (dst->dev_type == HEALTH_DEV_LORA)
+                                ? HEALTH_LORA_TIMEOUT_MS
+                                : HEALTH_BLE_LEAK_TIMEOUT_MS;
+            dst->connected = ((now - last_seen) <= timeout);
+        }
     }
 
-    int64_t now = now_ms();
-    uint8_t count = 0;
+    // Compute last_seen_age_s
+    if (!ever_seen || last_seen == 0) {
+        dst->last_seen_age_s = UINT32_MAX;
+    } else {
+        dst->last_seen_age_s = (uint32_t)((now - last_seen) / 1000);
+    }
+}
 
-    for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        health_device_status_t *dst = &out[i];
-        const health_device_t  *src = &s_devices[i];
-
-        dst->in_use = src->in_use;
-        if (!src->in_use) continue;
-
-        dst->dev_type     = src->dev_type;
-        memcpy(dst->dev_id, src->dev_id, sizeof(dst->dev_id));
-        dst->rating       = src->rating;
-        dst->ever_seen    = src->ever_seen;
-        dst->last_battery = src->last_battery;
-        dst->last_rssi    = src->last_rssi;
-
-        // Compute connected status
-        if (src->dev_type == HEALTH_DEV_VALVE) {
-            dst->connected = src->ever_seen && (src->disconnect_ms == 0);
-        } else {
-            // Sensor: connected if ever_seen and within timeout
-            if (!src->ever_seen || src->last_seen_ms == 0) {
-                dst->connected = false;
-            } else {
-                uint32_t timeout = (src->dev_type == HEALTH_DEV_LORA)
-                                    ? HEALTH_LORA_TIMEOUT_MS
-                                    : HEALTH_BLE_LEAK_TIMEOUT_MS;
-                dst->connected = ((now - src->last_seen_ms) <= timeout);
-            }
-        }
+int health_get_device_status_range(dev_handle_t first, int max,
+                                   health_device_status_t *out)
+{
+    if (!out || max <= 0 || !s_mutex || first >= HEALTH_MAX_DEVICES) return -1;
 
-        // Compute last_seen_age_s
-        if (!src->ever_seen || src->last_seen_ms == 0) {
-            dst->last_seen_age_s = UINT32_MAX;
-        } else {
-            dst->last_seen_age_s = (uint32_t)((now - src->last_seen_ms) / 1000);
-        }
+    if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return -1;
+    }
 
-        count++;
+    int64_t now = now_ms();
+    int n = 0;
+    for (int h = first; h < HEALTH_MAX_DEVICES && n < max; h++, n++) {
+        fill_status((dev_handle_t)h, now, &out[n]);
     }
 
-    *count_out = count;
     xSemaphoreGive(s_mutex);
-    return true;
+    return n;
 }
 
 bool health_is_boot_sync_complete(void)
@@ -644,16 +610,16 @@ bool health_is_boot_sync_complete(void)
     return done;
 }
 
-bool health_get_sync_counts(uint8_t *seen, uint8_t *total)
+bool health_get_sync_counts(uint16_t *seen, uint16_t *total)
 {
     if (!s_mutex) return false;
     if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(100)) != pdTRUE) return false;
 
-    uint8_t s = 0, t = 0;
+    uint16_t s = 0, t = 0;
     for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (s_devices[i].in_use) {
+        if (s_dev.flags[i] & HDEV_IN_USE) {
             t++;
-            if (s_devices[i].ever_seen) s++;
+            if (s_dev.flags[i] & HDEV_EVER_SEEN) s++;
         }
     }
     if (seen)  *seen  = s;
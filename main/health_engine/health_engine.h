@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include "device_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,7 +32,7 @@ extern "C" {
                                                           // sensors are still picked up by the incremental
                                                           // refresh snapshot (app_iothub.c), so the window
                                                           // need not cover the worst case.
-#define HEALTH_MAX_DEVICES           33                   // 1 valve + 16 LoRa + 16 BLE leak
+#define HEALTH_MAX_DEVICES           DEVREG_MAX_DEVICES   // valves + LoRa + BLE leak, one per registry handle
 
 // ---------------------------------------------------------------------------
 // Types
@@ -69,10 +70,13 @@ typedef struct {
             float    snr;
         } lora;
         struct {
-            char    mac_str[18];
-            uint8_t battery;
-            int8_t  rssi;
+            dev_handle_t handle;    // registry handle, resolved by the scanner
+            uint8_t      battery;
+            int8_t       rssi;
         } ble_leak;
+        struct {
+            uint8_t index;          // valve slot, handle DEVREG_HANDLE_VALVE + index
+        } valve;
     };
 } health_event_t;
 
@@ -106,14 +110,15 @@ typedef struct {
 
 /**
  * @brief Initialize health engine: create task, queue, timer.
- *        Loads provisioned device list. Call after provisioning_init().
+ *        Loads provisioned device list and subscribes to provisioning
+ *        changes. Call after provisioning_init().
  */
 void health_engine_init(void);
 
 /**
  * @brief Reload device list from provisioning manager.
- *        Call when provisioning changes (add/remove devices).
- *        Resets all health states and re-arms the sync window.
+ *        Runs automatically on every provisioning change (add/remove
+ *        devices). Resets all health states and re-arms the sync window.
  * @param sync_window_ms  Length of the "all devices seen, else timeout" window to
  *                        arm from now (HEALTH_BOOT_SYNC_TIMEOUT_MS at boot,
  *                        HEALTH_COMMISSION_SYNC_TIMEOUT_MS after a provision).
@@ -126,7 +131,7 @@ void health_engine_reload_devices(uint32_t sync_window_ms);
  *        Used by the iothub loop to publish an incremental commission snapshot
  *        when a late device is first heard. Returns false on mutex timeout.
  */
-bool health_get_sync_counts(uint8_t *seen, uint8_t *total);
+bool health_get_sync_counts(uint16_t *seen, uint16_t *total);
 
 /**
  * @brief Post a health event (thread-safe, non-blocking).
@@ -160,14 +165,16 @@ char *health_alert_to_json(const health_alert_t *alert);
 const char *health_rating_to_str(health_rating_t rating);
 
 /**
- * @brief Copy status of ALL provisioned devices into caller-supplied array.
- *        Thread-safe (acquires internal mutex). Call from iothub_task for snapshot.
- * @param out       Array of HEALTH_MAX_DEVICES entries.
- * @param count_out Number of valid (in_use) entries written.
- * @return true on success, false if mutex timeout or not initialized.
+ * @brief Copy status of a run of device registry handles, starting at first.
+ *        out[i] describes handle first + i; entries with in_use == false are
+ *        free handles. Lets callers page through large device tables with a
+ *        small buffer. Thread-safe (acquires internal mutex).
+ * @param max  Capacity of out[]
+ * @return Number of entries written (stops at HEALTH_MAX_DEVICES), or -1 on
+ *         mutex timeout / not initialized.
  */
-bool health_get_device_status_all(health_device_status_t out[HEALTH_MAX_DEVICES],
-                                  uint8_t *count_out);
+int health_get_device_status_range(dev_handle_t first, int max,
+                                   health_device_status_t *out);
 
 /**
  * @brief Check whether boot sync is complete.
@@ -193,23 +200,24 @@ static inline void health_post_lora_checkin(uint32_t sensor_id, uint8_t battery,
     health_post_event(&evt);
 }
 
-static inline void health_post_ble_leak_checkin(const char *mac_str, uint8_t battery,
+static inline void health_post_ble_leak_checkin(dev_handle_t h, uint8_t battery,
                                                  int8_t rssi)
 {
     health_event_t evt;
     memset(&evt, 0, sizeof(evt));
     evt.type = HEALTH_EVT_BLE_LEAK_CHECKIN;
-    strncpy(evt.ble_leak.mac_str, mac_str, sizeof(evt.ble_leak.mac_str) - 1);
+    evt.ble_leak.handle  = h;
     evt.ble_leak.battery = battery;
     evt.ble_leak.rssi    = rssi;
     health_post_event(&evt);
 }
 
-static inline void health_post_valve_event(bool connected)
+static inline void health_post_valve_event(int valve, bool connected)
 {
     health_event_t evt;
     memset(&evt, 0, sizeof(evt));
     evt.type = connected ? HEALTH_EVT_VALVE_CONNECTED : HEALTH_EVT_VALVE_DISCONNECTED;
+    evt.valve.index = (uint8_t)valve;
     health_post_event(&evt);
 }
 
@@ -19,21 +19,25 @@
 #include "mbedtls/sha256.h"
 
 #include "app_lora/app_lora.h"
+#include "app_lora/lora_rx_ring.h"
 #include "ble_valve/app_ble_valve.h"
 #include "ble_leak_scanner/app_ble_leak.h"
+#include "ble_scan/ble_scan.h"
+#include "device_registry/device_registry.h"
 #include "provisioning_manager/provisioning_manager.h"
 #include "rules_engine/rules_engine.h"
+#include "leak_latency/leak_latency.h"
 #include "health_engine/health_engine.h"
 #include "sensor_meta/sensor_meta.h"
 #include "telemetry/telemetry_v2.h"
 #include "commands/c2d_commands.h"
 #include "offline_buffer/offline_buffer.h"
+#include "delivery_tracker/delivery_tracker.h"
 #include "dps_client/dps_client.h"
 #include "hub_identity/hub_identity.h"
 #include "net_status/net_status.h"
 
 // External Queue from LoRa app
-extern QueueHandle_t lora_rx_queue;
 
 TaskHandle_t iothub_task_handle = NULL;
 static esp_mqtt_client_handle_t mqtt_client = NULL;
@@ -64,17 +68,45 @@ static bool g_boot_snapshot_sent = false;
 // already reflected in the last published commission snapshot.
 #define COMMISSION_REFRESH_GRACE_MS (6 * 60 * 1000)   // 6 min after a provision
 static int64_t g_commission_until_ms = 0;
-static uint8_t g_commission_pub_seen = 0;
+static uint16_t g_commission_pub_seen = 0;
+
+// Shared BLE scan duty hints (ble_scan_hint). After a leak report the scan runs
+// wide so further reports and the valve reconnect are not slowed by Wi-Fi; the
+// broker TLS handshake runs with the scan narrowed, bounded in case no
+// CONNECTED/DISCONNECTED/ERROR event follows.
+#define LEAK_SCAN_WIDEN_MS          (5 * 60 * 1000)
+#define TLS_SCAN_NARROW_MAX_MS      (15 * 1000)
 
 // Device Twin: request ID counter for twin GET/PATCH operations
 static int g_twin_rid = 0;
 
+// Asynchronous C2D acks: valve commands and override_enable are acknowledged
+// when the valve confirms (or the command fails / times out), not on receipt.
+// The completion callback runs in a BLE task and hands the ack to the event
+// loop through g_c2d_ack_q, which publishes it. g_c2d_async_pending counts acks
+// still owed so the loop polls often enough for the override reconnect deadline.
+#define C2D_VALVE_CMD_TIMEOUT_MS    15000   // within the app's 20 s cmd_ack timeout
+#define C2D_ACK_QUEUE_LEN           4
+#define C2D_ASYNC_POLL_MS           1000
+
+typedef struct {
+    char id[64];
+    char cmd[32];
+    bool success;
+    bool immediate;             // completed in the MQTT task, not by a valve/override
+    const char *error_msg;      // static string
+} c2d_async_ack_t;
+
+static QueueHandle_t g_c2d_ack_q = NULL;    // c2d_async_ack_t *
+static uint8_t g_c2d_async_pending = 0;
+static portMUX_TYPE g_c2d_async_lock = portMUX_INITIALIZER_UNLOCKED;
+
 // ---------------------------------------------------------------------------
 // Telemetry v2 caches (shared with telemetry module for snapshot reads)
 // ---------------------------------------------------------------------------
 
-static telem_lora_cache_t     g_telem_lora_cache[TELEM_MAX_LORA_CACHE] = {0};
-static telem_ble_leak_cache_t g_telem_ble_cache[TELEM_MAX_BLE_LEAK_CACHE] = {0};
+static telem_lora_cache_t     g_telem_lora_cache = {0};
+static telem_ble_leak_cache_t g_telem_ble_cache = {0};
 
 // ---------------------------------------------------------------------------
 // Legacy cache types (deprecated — kept for build_*_delta_json() below)
@@ -156,94 +188,72 @@ char *generate_sas_token(const char *resource_uri, const char *key, long expiry_
 /**
  * Update the LoRa telem cache and return true if leak_status changed.
  * Always updates all cached fields (battery, rssi, snr) for snapshot use.
+ * The cache is indexed by registry slot; a slot still holding a previous
+ * sensor's data is reset and treated as a first sighting.
  */
-static bool update_lora_cache_check_leak(const lora_packet_t *pkt)
+static bool update_lora_cache_check_leak(dev_handle_t h, const lora_packet_t *pkt)
 {
-    // Search for existing entry
-    for (int i = 0; i < TELEM_MAX_LORA_CACHE; i++) {
-        if (g_telem_lora_cache[i].valid &&
-            g_telem_lora_cache[i].sensor_id == pkt->sensorId) {
-            bool leak_changed =
-                (g_telem_lora_cache[i].leak_status != pkt->leakStatus);
-            g_telem_lora_cache[i].battery     = pkt->batteryPercentage;
-            g_telem_lora_cache[i].leak_status = pkt->leakStatus;
-            g_telem_lora_cache[i].rssi        = pkt->rssi;
-            g_telem_lora_cache[i].snr         = pkt->snr;
-            return leak_changed;
-        }
-    }
+    telem_lora_cache_t *c = &g_telem_lora_cache;
+    int i = device_registry_lora_slot(h);
+
+    bool first = !c->valid[i] || c->sensor_id[i] != pkt->sensorId;
+    bool leak_changed = first ? (pkt->leakStatus != 0)  // First time: only emit if actively leaking
+                              : (c->leak_status[i] != pkt->leakStatus);
+
+    c->sensor_id[i]   = pkt->sensorId;
+    c->battery[i]     = pkt->batteryPercentage;
+    c->leak_status[i] = pkt->leakStatus;
+    c->rssi[i]        = pkt->rssi;
+    c->snr[i]         = pkt->snr;
+    c->valid[i]       = true;
+    return leak_changed;
+}
 
-    // Not in cache — find empty slot
-    for (int i = 0; i < TELEM_MAX_LORA_CACHE; i++) {
-        if (!g_telem_lora_cache[i].valid) {
-            g_telem_lora_cache[i].sensor_id   = pkt->sensorId;
-            g_telem_lora_cache[i].battery     = pkt->batteryPercentage;
-            g_telem_lora_cache[i].leak_status = pkt->leakStatus;
-            g_telem_lora_cache[i].rssi        = pkt->rssi;
-            g_telem_lora_cache[i].snr         = pkt->snr;
-            g_telem_lora_cache[i].valid       = true;
-            return (pkt->leakStatus != 0);  // First time: only emit if actively leaking
-        }
-    }
+/**
+ * True if a BLE leak mailbox update still belongs to the sensor commissioned
+ * in its registry slot (the slot may have been reused since it was written).
+ */
+static bool ble_leak_update_current(const ble_leak_update_t *upd)
+{
+    uint8_t mac[6];
 
-    // Cache full — overwrite slot 0
-    g_telem_lora_cache[0].sensor_id   = pkt->sensorId;
-    g_telem_lora_cache[0].battery     = pkt->batteryPercentage;
-    g_telem_lora_cache[0].leak_status = pkt->leakStatus;
-    g_telem_lora_cache[0].rssi        = pkt->rssi;
-    g_telem_lora_cache[0].snr         = pkt->snr;
-    g_telem_lora_cache[0].valid       = true;
-    return (pkt->leakStatus != 0);
+    if (!device_registry_get_mac(upd->handle, mac)) {
+        return false;
+    }
+    for (int b = 0; b < 6; b++) {
+        if (mac[b] != upd->sensor_mac[5 - b]) return false;
+    }
+    return true;
 }
 
 /**
- * Update the BLE leak telem cache and return true if leak_state changed.
- * Always updates all cached fields for snapshot use.
+ * Update the BLE leak telem cache with leak state `leak` and the update's
+ * other fields, and return true if leak_state changed. Always updates all
+ * cached fields for snapshot use. Indexed by registry slot like the LoRa
+ * cache.
  */
-static bool update_ble_leak_cache_check_leak(const ble_leak_event_t *evt)
+static bool update_ble_leak_cache_check_leak(const ble_leak_update_t *upd, bool leak)
 {
-    for (int i = 0; i < TELEM_MAX_BLE_LEAK_CACHE; i++) {
-        if (g_telem_ble_cache[i].valid &&
-            strcasecmp(g_telem_ble_cache[i].mac_str, evt->sensor_mac_str) == 0) {
-            bool leak_changed =
-                (g_telem_ble_cache[i].leak_state != evt->leak_detected);
-            g_telem_ble_cache[i].battery    = evt->battery;
-            g_telem_ble_cache[i].leak_state = evt->leak_detected;
-            g_telem_ble_cache[i].rssi       = evt->rssi;
-            strncpy(g_telem_ble_cache[i].fw_version, evt->fw_version,
-                    sizeof(g_telem_ble_cache[i].fw_version) - 1);
-            g_telem_ble_cache[i].fw_version[sizeof(g_telem_ble_cache[i].fw_version) - 1] = '\0';
-            return leak_changed;
-        }
-    }
+    telem_ble_leak_cache_t *c = &g_telem_ble_cache;
+    int i = device_registry_ble_slot(upd->handle);
+    uint8_t mac[6];
 
-    // Not in cache — find empty slot
-    for (int i = 0; i < TELEM_MAX_BLE_LEAK_CACHE; i++) {
-        if (!g_telem_ble_cache[i].valid) {
-            strncpy(g_telem_ble_cache[i].mac_str, evt->sensor_mac_str, 17);
-            g_telem_ble_cache[i].mac_str[17] = '\0';
-            g_telem_ble_cache[i].battery    = evt->battery;
-            g_telem_ble_cache[i].leak_state = evt->leak_detected;
-            g_telem_ble_cache[i].rssi       = evt->rssi;
-            strncpy(g_telem_ble_cache[i].fw_version, evt->fw_version,
-                    sizeof(g_telem_ble_cache[i].fw_version) - 1);
-            g_telem_ble_cache[i].fw_version[sizeof(g_telem_ble_cache[i].fw_version) - 1] = '\0';
-            g_telem_ble_cache[i].valid      = true;
-            return evt->leak_detected;  // First time: only emit if actively leaking
-        }
+    if (!device_registry_get_mac(upd->handle, mac)) {
+        return false;
     }
+    bool first = !c->valid[i] || memcmp(c->mac[i], mac, 6) != 0;
+    bool leak_changed = first ? leak  // First time: only emit if actively leaking
+                              : (c->leak_state[i] != leak);
 
-    // Cache full — overwrite slot 0
-    strncpy(g_telem_ble_cache[0].mac_str, evt->sensor_mac_str, 17);
-    g_telem_ble_cache[0].mac_str[17] = '\0';
-    g_telem_ble_cache[0].battery    = evt->battery;
-    g_telem_ble_cache[0].leak_state = evt->leak_detected;
-    g_telem_ble_cache[0].rssi       = evt->rssi;
-    strncpy(g_telem_ble_cache[0].fw_version, evt->fw_version,
-            sizeof(g_telem_ble_cache[0].fw_version) - 1);
-    g_telem_ble_cache[0].fw_version[sizeof(g_telem_ble_cache[0].fw_version) - 1] = '\0';
-    g_telem_ble_cache[0].valid      = true;
-    return evt->leak_detected;
+    if (first) {
+        memcpy(c->mac[i], mac, 6);
+    }
+    c->battery[i]    = upd->battery;
+    c->leak_state[i] = leak;
+    c->rssi[i]       = upd->rssi;
+    app_ble_leak_fw_str(upd->fw, c->fw_version[i]);
+    c->valid[i]      = true;
+    return leak_changed;
 }
 
 // ---------------------------------------------------------------------------
@@ -262,10 +272,10 @@ static bool is_lora_duplicate(const lora_packet_t *pkt)
 __attribute__((unused))
 static bool valve_data_changed(void)
 {
-    uint8_t batt = ble_valve_get_battery();
-    bool leak = ble_valve_get_leak();
-    int state = ble_valve_get_state();
-    bool rmleak = ble_valve_get_rmleak_state();
+    uint8_t batt = ble_valve_get_battery(0);
+    bool leak = ble_valve_get_leak(0);
+    int state = ble_valve_get_state(0);
+    bool rmleak = ble_valve_get_rmleak_state(0);
 
     if (!g_last_valve.valid) {
         g_last_valve.battery = batt;
@@ -307,14 +317,14 @@ static char *build_valve_delta_json(void)
     cJSON_AddItemToObject(deviceObj, "valve", valveObj);
 
     char valve_mac[18];
-    if (ble_valve_get_mac(valve_mac))
+    if (ble_valve_get_mac(0, valve_mac))
     {
         cJSON_AddStringToObject(valveObj, "valve_mac", valve_mac);
-        cJSON_AddNumberToObject(valveObj, "battery", ble_valve_get_battery());
-        cJSON_AddBoolToObject(valveObj, "leak_state", ble_valve_get_leak());
-        cJSON_AddBoolToObject(valveObj, "rmleak", ble_valve_get_rmleak_state());
+        cJSON_AddNumberToObject(valveObj, "battery", ble_valve_get_battery(0));
+        cJSON_AddBoolToObject(valveObj, "leak_state", ble_valve_get_leak(0));
+        cJSON_AddBoolToObject(valveObj, "rmleak", ble_valve_get_rmleak_state(0));
 
-        int state = ble_valve_get_state();
+        int state = ble_valve_get_state(0);
         if (state == 1)
             cJSON_AddStringToObject(valveObj, "valve_state", "open");
         else if (state == 0)
@@ -377,9 +387,9 @@ static char *build_lora_delta_json(const lora_packet_t *pkt)
 
 // (DEPRECATED) Build BLE leak sensor delta JSON
 __attribute__((unused))
-static char *build_ble_leak_delta_json(const ble_leak_event_t *evt)
+static char *build_ble_leak_delta_json(const char *mac_str, const ble_leak_update_t *upd)
 {
-    if (!evt) return NULL;
+    if (!upd) return NULL;
 
     cJSON *root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "gatewayID", hub_identity_get_gateway_id());
@@ -394,16 +404,16 @@ static char *build_ble_leak_delta_json(const ble_leak_event_t *evt)
     cJSON_AddItemToObject(deviceObj, "ble_leak_sensors", sensorsObj);
 
     char sensorKey[32];
-    snprintf(sensorKey, sizeof(sensorKey), "BLE_%s", evt->sensor_mac_str);
+    snprintf(sensorKey, sizeof(sensorKey), "BLE_%s", mac_str);
 
     cJSON *thisSensor = cJSON_CreateObject();
     cJSON_AddItemToObject(sensorsObj, sensorKey, thisSensor);
 
-    cJSON_AddNumberToObject(thisSensor, "battery", evt->battery);
-    cJSON_AddBoolToObject(thisSensor, "leak_state", evt->leak_detected);
-    cJSON_AddNumberToObject(thisSensor, "rssi", evt->rssi);
+    cJSON_AddNumberToObject(thisSensor, "battery", upd->battery);
+    cJSON_AddBoolToObject(thisSensor, "leak_state", upd->leak_detected);
+    cJSON_AddNumberToObject(thisSensor, "rssi", upd->rssi);
 
-    const sensor_meta_entry_t *meta = sensor_meta_find(SENSOR_TYPE_BLE_LEAK, evt->sensor_mac_str);
+    const sensor_meta_entry_t *meta = sensor_meta_find(SENSOR_TYPE_BLE_LEAK, mac_str);
     cJSON *locObj = cJSON_CreateObject();
     cJSON_AddStringToObject(locObj, "code",
         sensor_meta_location_code_to_str(meta ? meta->location_code : LOC_UNKNOWN));
@@ -428,29 +438,43 @@ static void publish_twin_reported(void);  // forward declaration
 // or open during a leak via override_enable (which clears RMLEAK as part of the
 // guarded 24h window and so does not go through this handler). Returns the
 // cmd_ack error detail when the open must be refused, or NULL when it may proceed.
-static const char *valve_open_reject_reason(void)
+static const char *valve_open_reject_reason(int valve)
 {
-    if (ble_valve_get_rmleak_state()) {
+    if (ble_valve_get_rmleak_state(valve)) {
         return "Valve is locked after a leak (RMLEAK). Clear it with leak_reset first, "
                "or use override to open the valve during a leak.";
     }
     return NULL;
 }
 
-// After a device-table reload that keeps the valve provisioned, re-seed the
-// valve's health record if its BLE link is currently up. health_engine_reload_devices()
-// wipes every device's seen-state (ever_seen=false, rating=CRITICAL), but a valve
-// whose connection is already established emits no fresh CONNECTED event (its GATT
+// Optional "valve" index in a valve command payload (valve 0 when absent, so
+// single-valve apps are unchanged). Returns -1 for an index outside the
+// configured valves.
+static int c2d_valve_index(const cJSON *pl)
+{
+    const cJSON *v = pl ? cJSON_GetObjectItem(pl, "valve") : NULL;
+    if (!v) return 0;
+    if (!cJSON_IsNumber(v) || v->valueint < 0 || v->valueint >= BLE_VALVE_MAX) return -1;
+    return v->valueint;
+}
+
+// After a device-table reload that keeps the valves provisioned, re-seed each
+// valve's health record if its BLE link is currently up. The health engine's reload
+// on a provisioning change wipes every device's seen-state (ever_seen=false,
+// rating=CRITICAL), but a valve whose connection is already established emits no fresh CONNECTED event (its GATT
 // NOTIFYs are delta-gated on value change), so without this it would be reported
 // offline in the next snapshot and the boot-sync all-devices-seen path could never
-// complete (forcing the full 120 s timeout). No-op when the valve is disconnected.
+// complete (forcing the full 120 s timeout). No-op for disconnected valves.
 static void reseed_valve_health_if_connected(void)
 {
-    if (ble_valve_is_connected()) {
-        health_post_valve_event(true);
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        if (ble_valve_is_connected(v)) {
+            health_post_valve_event(v, true);
+        }
     }
 }
 
+
 // Arm the commission snapshot after a device-list change (provision/decommission):
 // re-arm the one-shot initial snapshot, reset the published seen-count, and open
 // the incremental-refresh grace window so a device heard after the initial snapshot
@@ -460,6 +484,134 @@ static void arm_commission_snapshot(void)
     g_boot_snapshot_sent  = false;
     g_commission_pub_seen = 0;
     g_commission_until_ms = (esp_timer_get_time() / 1000) + COMMISSION_REFRESH_GRACE_MS;
+    telemetry_v2_request_keyframe();
+}
+
+// Ack of a command that completes later, or NULL if it is acked now (no ack
+// wanted, or no memory: the ack then reports receipt as before)
+static c2d_async_ack_t *c2d_async_begin(const c2d_command_t *cmd)
+{
+    if (!(cmd->is_envelope || cmd->id[0]) || !g_c2d_ack_q) return NULL;
+
+    c2d_async_ack_t *a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    strncpy(a->id, cmd->id, sizeof(a->id) - 1);
+    strncpy(a->cmd, cmd->cmd, sizeof(a->cmd) - 1);
+
+    portENTER_CRITICAL(&g_c2d_async_lock);
+    g_c2d_async_pending++;
+    portEXIT_CRITICAL(&g_c2d_async_lock);
+    return a;
+}
+
+// Drop an ack that will not complete later (the command finished at once)
+static void c2d_async_end(c2d_async_ack_t *a)
+{
+    if (!a) return;
+    portENTER_CRITICAL(&g_c2d_async_lock);
+    g_c2d_async_pending--;
+    portEXIT_CRITICAL(&g_c2d_async_lock);
+    free(a);
+}
+
+// Completion: hand the ack to the event loop. Any task.
+static void c2d_async_complete(c2d_async_ack_t *a, bool success, const char *error_msg)
+{
+    a->success = success;
+    a->error_msg = error_msg;
+    if (xQueueSend(g_c2d_ack_q, &a, 0) != pdTRUE) {
+        ESP_LOGW(IOTHUB_TAG, "cmd_ack queue full — ack for '%s' id='%s' dropped", a->cmd, a->id);
+        c2d_async_end(a);
+    }
+}
+
+// Ack of a command that completed in the MQTT task. It is published by the
+// event loop like a deferred one: telemetry messages are written into one
+// buffer owned by iothub_task.
+static void c2d_ack_now(const c2d_command_t *cmd, bool success, const char *error_msg)
+{
+    c2d_async_ack_t *a = c2d_async_begin(cmd);
+    if (!a) {
+        if (cmd->is_envelope || cmd->id[0]) {
+            ESP_LOGW(IOTHUB_TAG, "cmd_ack for '%s' id='%s' dropped (no memory)", cmd->cmd, cmd->id);
+        }
+        return;
+    }
+    a->immediate = true;
+    c2d_async_complete(a, success, error_msg);
+}
+
+static bool c2d_async_any_pending(void)
+{
+    portENTER_CRITICAL(&g_c2d_async_lock);
+    bool any = g_c2d_async_pending > 0;
+    portEXIT_CRITICAL(&g_c2d_async_lock);
+    return any;
+}
+
+static void on_c2d_valve_cmd_done(ble_valve_cmd_id_t id, ble_valve_cmd_status_t status, void *ctx)
+{
+    (void)id;
+    const char *err = NULL;
+    switch (status) {
+    case BLE_VALVE_CMD_DONE:
+        break;
+    case BLE_VALVE_CMD_TIMEOUT:
+        err = "The valve didn't confirm the command. Check its power and connection, then try again.";
+        break;
+    case BLE_VALVE_CMD_SUPERSEDED:
+        err = "Replaced by a newer valve command.";
+        break;
+    case BLE_VALVE_CMD_CANCELLED:
+        err = "Cancelled because the leak cleared before the valve was reached.";
+        break;
+    default:
+        err = "The valve rejected the command.";
+        break;
+    }
+    c2d_async_complete((c2d_async_ack_t *)ctx, status == BLE_VALVE_CMD_DONE, err);
+}
+
+// Queue a C2D valve open/close. With an async ack the cmd_ack follows the
+// valve's confirmation. Returns false if the command could not be queued.
+static bool c2d_valve_submit(int valve, uint8_t value, c2d_async_ack_t *a)
+{
+    ble_valve_connect(valve);
+    return ble_valve_submit(valve, BLE_VALVE_TARGET_STATE, value, a ? C2D_VALVE_CMD_TIMEOUT_MS : 0,
+                            a ? on_c2d_valve_cmd_done : NULL, a) != 0;
+}
+
+static const char *override_enable_error_str(override_enable_result_t r)
+{
+    switch (r) {
+    case OVERRIDE_ENABLE_ERR_NO_INCIDENT:
+        return "No active leak to override. Use the normal Open Valve control.";
+    case OVERRIDE_ENABLE_ERR_VALVE_FLOOD:
+        return "Water detected at the valve. It can't be opened remotely until the valve area is dry.";
+    case OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED:
+        return "The valve isn't responding. Check its power and connection, then try again.";
+    case OVERRIDE_ENABLE_ERR_NOT_PROVISIONED:
+        return "No valve is set up for this hub.";
+    default:
+        return "Something went wrong applying the override. Your water state is unchanged. Try again.";
+    }
+}
+
+static void on_c2d_override_done(override_enable_result_t result, void *ctx)
+{
+    c2d_async_complete((c2d_async_ack_t *)ctx, result == OVERRIDE_ENABLE_OK,
+                       result == OVERRIDE_ENABLE_OK ? NULL : override_enable_error_str(result));
+}
+
+// Publish (or, unprovisioned, discard) a completed async ack
+static void c2d_async_publish(c2d_async_ack_t *a, bool publish)
+{
+    if (publish) {
+        ESP_LOGI(IOTHUB_TAG, "cmd_ack (completed) '%s' id='%s' success=%d",
+                 a->cmd, a->id, a->success);
+        telemetry_v2_publish_cmd_ack(a->id, a->cmd, a->success, a->error_msg);
+    }
+    c2d_async_end(a);
 }
 
 static void handle_c2d_command(const char *data, size_t data_len)
@@ -474,45 +626,75 @@ static void handle_c2d_command(const char *data, size_t data_len)
 
     bool success = true;
     const char *error_msg = NULL;
+    c2d_async_ack_t *async = NULL;  // set: ack is sent on completion
 
     // ---- Valve control ----
     if (strcmp(cmd.cmd, C2D_CMD_VALVE_OPEN) == 0) {
-        ESP_LOGI(IOTHUB_TAG, "Command: VALVE_OPEN");
-        error_msg = valve_open_reject_reason();
-        if (error_msg) {
+        cJSON *pl = cmd.payload_json ? cJSON_Parse(cmd.payload_json) : NULL;
+        int valve = c2d_valve_index(pl);
+        ESP_LOGI(IOTHUB_TAG, "Command: VALVE_OPEN (valve %d)", valve);
+        if (valve < 0) {
+            success = false;
+            error_msg = "unknown valve";
+        } else if ((error_msg = valve_open_reject_reason(valve)) != NULL) {
             success = false;
             ESP_LOGW(IOTHUB_TAG, "VALVE_OPEN refused — valve RMLEAK is asserted");
         } else {
-            ble_valve_connect();
-            ble_valve_open();
+            async = c2d_async_begin(&cmd);
+            if (!c2d_valve_submit(valve, 1, async)) {
+                success = false;
+                error_msg = "valve command queue full";
+            }
         }
+        if (pl) cJSON_Delete(pl);
     }
     else if (strcmp(cmd.cmd, C2D_CMD_VALVE_CLOSE) == 0) {
-        ESP_LOGI(IOTHUB_TAG, "Command: VALVE_CLOSE");
-        ble_valve_connect();
-        ble_valve_close();
+        cJSON *pl = cmd.payload_json ? cJSON_Parse(cmd.payload_json) : NULL;
+        int valve = c2d_valve_index(pl);
+        ESP_LOGI(IOTHUB_TAG, "Command: VALVE_CLOSE (valve %d)", valve);
+        if (valve < 0) {
+            success = false;
+            error_msg = "unknown valve";
+        } else {
+            async = c2d_async_begin(&cmd);
+            if (!c2d_valve_submit(valve, 0, async)) {
+                success = false;
+                error_msg = "valve command queue full";
+            }
+        }
+        if (pl) cJSON_Delete(pl);
     }
     // ---- Valve set state (unified open/close) ----
     else if (strcmp(cmd.cmd, C2D_CMD_VALVE_SET_STATE) == 0) {
         cJSON *pl = cmd.payload_json ? cJSON_Parse(cmd.payload_json) : NULL;
         const char *desired = pl ? cJSON_GetStringValue(cJSON_GetObjectItem(pl, "state")) : NULL;
+        int valve = c2d_valve_index(pl);
         if (!desired) {
             success = false;
             error_msg = "missing 'state' field (expected \"open\" or \"closed\")";
+        } else if (valve < 0) {
+            success = false;
+            error_msg = "unknown valve";
         } else if (strcmp(desired, "open") == 0) {
-            ESP_LOGI(IOTHUB_TAG, "Command: VALVE_SET_STATE -> open");
-            error_msg = valve_open_reject_reason();
+            ESP_LOGI(IOTHUB_TAG, "Command: VALVE_SET_STATE -> open (valve %d)", valve);
+            error_msg = valve_open_reject_reason(valve);
             if (error_msg) {
                 success = false;
                 ESP_LOGW(IOTHUB_TAG, "VALVE_SET_STATE open refused — valve RMLEAK is asserted");
             } else {
-                ble_valve_connect();
-                ble_valve_open();
+                async = c2d_async_begin(&cmd);
+                if (!c2d_valve_submit(valve, 1, async)) {
+                    success = false;
+                    error_msg = "valve command queue full";
+                }
             }
         } else if (strcmp(desired, "closed") == 0) {
-            ESP_LOGI(IOTHUB_TAG, "Command: VALVE_SET_STATE -> closed");
-            ble_valve_connect();
-            ble_valve_close();
+            ESP_LOGI(IOTHUB_TAG, "Command: VALVE_SET_STATE -> closed (valve %d)", valve);
+            async = c2d_async_begin(&cmd);
+            if (!c2d_valve_submit(valve, 0, async)) {
+                success = false;
+                error_msg = "valve command queue full";
+            }
         } else {
             success = false;
             error_msg = "invalid state value (expected \"open\" or \"closed\")";
@@ -542,11 +724,12 @@ static void handle_c2d_command(const char *data, size_t data_len)
             error_msg = "missing decommission target";
         }
         else if (strcmp(target, "valve") == 0) {
-            ESP_LOGW(IOTHUB_TAG, "!!! DECOMMISSION_VALVE !!!");
-            if (provisioning_remove_valve()) {
-                health_engine_reload_devices(HEALTH_COMMISSION_SYNC_TIMEOUT_MS);
-                ble_valve_set_target_mac(NULL);
-                ble_valve_disconnect();
+            int valve = c2d_valve_index(pl);
+            ESP_LOGW(IOTHUB_TAG, "!!! DECOMMISSION_VALVE %d !!!", valve);
+            if (valve >= 0 && provisioning_remove_valve(valve)) {
+                ble_valve_set_target_mac(valve, NULL);
+                ble_valve_disconnect(valve);
+                reseed_valve_health_if_connected();   // other valves stay up
                 arm_commission_snapshot();   // refresh the snapshot if the hub stays provisioned
                 if (!provisioning_is_provisioned())
                     ESP_LOGI(IOTHUB_TAG, "Device is now UNPROVISIONED");
@@ -561,7 +744,6 @@ static void handle_c2d_command(const char *data, size_t data_len)
             uint32_t sid = sid_str ? (uint32_t)strtoul(sid_str, NULL, 16) : 0;
             ESP_LOGW(IOTHUB_TAG, "!!! DECOMMISSION_LORA: 0x%08lX !!!", (unsigned long)sid);
             if (provisioning_remove_lora_sensor(sid)) {
-                health_engine_reload_devices(HEALTH_COMMISSION_SYNC_TIMEOUT_MS);
                 reseed_valve_health_if_connected();   // valve stays up across a sensor removal
                 arm_commission_snapshot();            // publish a fresh snapshot reflecting the removal
                 char lora_id_str[16];
@@ -580,7 +762,6 @@ static void handle_c2d_command(const char *data, size_t data_len)
                 cJSON_GetObjectItem(pl, "sensor_id"));
             ESP_LOGW(IOTHUB_TAG, "!!! DECOMMISSION_BLE: %s !!!", mac ? mac : "?");
             if (mac && provisioning_remove_ble_sensor(mac)) {
-                health_engine_reload_devices(HEALTH_COMMISSION_SYNC_TIMEOUT_MS);
                 reseed_valve_health_if_connected();   // valve stays up across a sensor removal
                 arm_commission_snapshot();            // publish a fresh snapshot reflecting the removal
                 sensor_meta_remove(SENSOR_TYPE_BLE_LEAK, mac);
@@ -598,13 +779,13 @@ static void handle_c2d_command(const char *data, size_t data_len)
                 hub_identity_clear();
                 dps_clear_cache();
                 rules_engine_clear_persistent_state();
-                ble_valve_set_target_mac(NULL);
-                ble_valve_disconnect();
-
-                // Send ack before restart
-                if (cmd.is_envelope || cmd.id[0]) {
-                    telemetry_v2_publish_cmd_ack(cmd.id, cmd.cmd, true, NULL);
+                for (int v = 0; v < BLE_VALVE_MAX; v++) {
+                    ble_valve_set_target_mac(v, NULL);
+                    ble_valve_disconnect(v);
                 }
+
+                // Ack before restart: the event loop publishes it during the delay
+                c2d_ack_now(&cmd, true, NULL);
                 c2d_command_free(&cmd);
                 if (pl) cJSON_Delete(pl);
 
@@ -637,25 +818,15 @@ static void handle_c2d_command(const char *data, size_t data_len)
     // override window. Same end-state as a physical button press; see §4.4.3.
     else if (strcmp(cmd.cmd, C2D_CMD_OVERRIDE_ENABLE) == 0) {
         ESP_LOGI(IOTHUB_TAG, "Command: OVERRIDE_ENABLE");
-        override_enable_result_t r = rules_engine_enable_override_remote();
-        if (r != OVERRIDE_ENABLE_OK) {
-            success = false;
-            switch (r) {
-            case OVERRIDE_ENABLE_ERR_NO_INCIDENT:
-                error_msg = "No active leak to override. Use the normal Open Valve control.";
-                break;
-            case OVERRIDE_ENABLE_ERR_VALVE_FLOOD:
-                error_msg = "Water detected at the valve. It can't be opened remotely until the valve area is dry.";
-                break;
-            case OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED:
-                error_msg = "The valve isn't responding. Check its power and connection, then try again.";
-                break;
-            case OVERRIDE_ENABLE_ERR_NOT_PROVISIONED:
-                error_msg = "No valve is set up for this hub.";
-                break;
-            default:
-                error_msg = "Something went wrong applying the override. Your water state is unchanged. Try again.";
-                break;
+        async = c2d_async_begin(&cmd);
+        override_enable_result_t r = rules_engine_enable_override_remote(
+            async ? on_c2d_override_done : NULL, async);
+        if (r != OVERRIDE_ENABLE_PENDING) {
+            c2d_async_end(async);
+            async = NULL;
+            if (r != OVERRIDE_ENABLE_OK) {
+                success = false;
+                error_msg = override_enable_error_str(r);
             }
         }
     }
@@ -683,10 +854,11 @@ static void handle_c2d_command(const char *data, size_t data_len)
         if (cmd.payload_json &&
             provisioning_handle_azure_payload_json(
                 cmd.payload_json, strlen(cmd.payload_json))) {
-            health_engine_reload_devices(HEALTH_COMMISSION_SYNC_TIMEOUT_MS);
+            // The health engine and LoRa key cache have already followed the new
+            // device list (provisioning change subscribers).
             reseed_valve_health_if_connected();   // re-provision keeps the valve connected (see helper)
             iothub_apply_provisioned_mac();
-            // Fast-track the first post-commission snapshot. health_engine_reload_devices()
+            // Fast-track the first post-commission snapshot. The health engine's reload
             // already re-armed the sync window (all-devices-seen, else the commission timeout,
             // with the window clock reset); arm the snapshot trigger + incremental-refresh grace
             // too so the event loop publishes as soon as every commissioned device has been heard
@@ -695,6 +867,8 @@ static void handle_c2d_command(const char *data, size_t data_len)
             // the window is reported offline/null (no hang, no schema change), then a refresh
             // snapshot follows once it is heard.
             arm_commission_snapshot();
+            // Widen the BLE scan until every device has been heard or the grace ends
+            ble_scan_hint(BLE_SCAN_HINT_COMMISSION, COMMISSION_REFRESH_GRACE_MS);
             ESP_LOGI(IOTHUB_TAG,
                      "Commission: fast snapshot armed (all-devices-seen, else <=%ds; refreshes on late devices)",
                      HEALTH_COMMISSION_SYNC_TIMEOUT_MS / 1000);
@@ -722,15 +896,28 @@ static void handle_c2d_command(const char *data, size_t data_len)
         }
         if (pl) cJSON_Delete(pl);
     }
+    // ---- Snapshot on demand: a full keyframe (cloud lost a delta base) ----
+    else if (strcmp(cmd.cmd, C2D_CMD_SNAPSHOT) == 0) {
+        ESP_LOGI(IOTHUB_TAG, "Command: SNAPSHOT (keyframe)");
+        telemetry_v2_request_keyframe();
+        telemetry_v2_trigger_snapshot();
+    }
     else {
         ESP_LOGW(IOTHUB_TAG, "Unknown command: %s", cmd.cmd);
         success = false;
         error_msg = "unknown command";
     }
 
-    // Send ack for v1 commands or when correlation ID is present
-    if (cmd.is_envelope || cmd.id[0]) {
-        telemetry_v2_publish_cmd_ack(cmd.id, cmd.cmd, success, error_msg);
+    // A valve command that could not be queued completes now
+    if (async && !success) {
+        c2d_async_end(async);
+        async = NULL;
+    }
+
+    // Ack v1 commands or when a correlation ID is present (async commands
+    // are acked on completion); either way the event loop publishes it
+    if (!async) {
+        c2d_ack_now(&cmd, success, error_msg);
     }
 
     c2d_command_free(&cmd);
@@ -751,19 +938,21 @@ static void publish_twin_reported(void)
     cJSON_AddStringToObject(root, "hub_name", hub_identity_get_name());
     cJSON_AddBoolToObject(root, "provisioned", provisioning_is_provisioned());
 
+    // valve_mac: valve 0, for single-valve apps; valve_macs: every slot
     char valve_mac[18];
-    if (provisioning_get_valve_mac(valve_mac))
+    if (provisioning_get_valve_mac(0, valve_mac))
         cJSON_AddStringToObject(root, "valve_mac", valve_mac);
+    cJSON *valve_macs = cJSON_AddArrayToObject(root, "valve_macs");
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        cJSON_AddItemToArray(valve_macs, provisioning_get_valve_mac(v, valve_mac)
+                                             ? cJSON_CreateString(valve_mac)
+                                             : cJSON_CreateNull());
+    }
 
-    uint32_t ids[MAX_LORA_SENSORS];
-    uint8_t cnt = 0;
-    provisioning_get_lora_sensors(ids, &cnt);
-    cJSON_AddNumberToObject(root, "lora_sensor_count", cnt);
-
-    char macs[MAX_BLE_LEAK_SENSORS][18];
-    uint8_t bcnt = 0;
-    provisioning_get_ble_leak_sensors(macs, &bcnt);
-    cJSON_AddNumberToObject(root, "ble_leak_sensor_count", bcnt);
+    cJSON_AddNumberToObject(root, "lora_sensor_count",
+                            device_registry_count(DEVREG_LORA));
+    cJSON_AddNumberToObject(root, "ble_leak_sensor_count",
+                            device_registry_count(DEVREG_BLE_LEAK));
 
     rules_config_t rules;
     if (provisioning_get_rules_config(&rules)) {
@@ -771,6 +960,12 @@ static void publish_twin_reported(void)
         cJSON_AddNumberToObject(root, "trigger_mask", rules.trigger_mask);
     }
 
+    cJSON_AddStringToObject(root, "snapshot_mode",
+                            telemetry_v2_get_snapshot_mode() == TELEM_SNAPSHOT_DELTA
+                                ? "delta" : "full");
+    cJSON_AddStringToObject(root, "encoding",
+                            telemetry_v2_get_encoding() == TELEM_ENCODING_CBOR
+                                ? "cbor" : "json");
     cJSON_AddNumberToObject(root, "uptime_s",
                             (double)(esp_timer_get_time() / 1000000));
     cJSON_AddNumberToObject(root, "free_heap",
@@ -822,6 +1017,32 @@ static void handle_twin_desired(const char *data, int data_len)
         }
     }
 
+    // Handle snapshot_mode
+    cJSON *mode = cJSON_GetObjectItem(root, "snapshot_mode");
+    if (mode && cJSON_IsString(mode)) {
+        if (strcmp(mode->valuestring, "full") == 0) {
+            telemetry_v2_set_snapshot_mode(TELEM_SNAPSHOT_FULL);
+        } else if (strcmp(mode->valuestring, "delta") == 0) {
+            telemetry_v2_set_snapshot_mode(TELEM_SNAPSHOT_DELTA);
+        } else {
+            ESP_LOGW(IOTHUB_TAG, "Twin: snapshot_mode '%s' not \"full\" or \"delta\"",
+                     mode->valuestring);
+        }
+    }
+
+    // Handle encoding
+    cJSON *enc = cJSON_GetObjectItem(root, "encoding");
+    if (enc && cJSON_IsString(enc)) {
+        if (strcmp(enc->valuestring, "json") == 0) {
+            telemetry_v2_set_encoding(TELEM_ENCODING_JSON);
+        } else if (strcmp(enc->valuestring, "cbor") == 0) {
+            telemetry_v2_set_encoding(TELEM_ENCODING_CBOR);
+        } else {
+            ESP_LOGW(IOTHUB_TAG, "Twin: encoding '%s' not \"json\" or \"cbor\"",
+                     enc->valuestring);
+        }
+    }
+
     // Handle hub_name
     cJSON *name = cJSON_GetObjectItem(root, "hub_name");
     if (name && cJSON_IsString(name)) {
@@ -880,8 +1101,13 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
     switch ((esp_mqtt_event_id_t)event_id)
     {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_TLS, TLS_SCAN_NARROW_MAX_MS);
+        break;
+
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(IOTHUB_TAG, "Connected to Azure IoT Hub!");
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_TLS, 0);
         g_iot_hub_connected = true;
         telemetry_v2_set_connected(true);
         net_status_set_mqtt(true);   // status LED -> fully connected (ramp blue)
@@ -902,11 +1128,17 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGW(IOTHUB_TAG, "Disconnected.");
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_TLS, 0);
         g_iot_hub_connected = false;
         telemetry_v2_set_connected(false);
+        delivery_tracker_on_disconnected();     // buffered events go again next drain
         net_status_set_mqtt(false);  // status LED -> connecting (beat blue) if WiFi still up
         break;
 
+    case MQTT_EVENT_PUBLISHED:
+        delivery_tracker_on_published(event->msg_id);
+        break;
+
     case MQTT_EVENT_DATA:
     {
         if (event->topic_len > 0 && event->data_len > 0) {
@@ -930,6 +1162,10 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         break;
     }
 
+    case MQTT_EVENT_ERROR:
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_TLS, 0);
+        break;
+
     default:
         break;
     }
@@ -937,27 +1173,39 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
 void iothub_apply_provisioned_mac(void)
 {
-    char valve_mac[18];
-    if (provisioning_get_valve_mac(valve_mac)) {
-        ESP_LOGI(IOTHUB_TAG, "Applying provisioned valve MAC: %s", valve_mac);
-        ble_valve_set_target_mac(valve_mac);
-
-        // Start BLE now that we're provisioned
-        ESP_LOGI(IOTHUB_TAG, "Starting BLE with provisioned MAC...");
-        app_ble_valve_signal_start();
+    bool any = false;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        char valve_mac[18];
+        if (!provisioning_get_valve_mac(v, valve_mac)) {
+            // Slot emptied by this provision: drop the old target
+            ble_valve_set_target_mac(v, NULL);
+            ble_valve_disconnect(v);
+            continue;
+        }
+        any = true;
+        ESP_LOGI(IOTHUB_TAG, "Applying provisioned valve %d MAC: %s", v, valve_mac);
+        ble_valve_set_target_mac(v, valve_mac);
 
         // If we're already connected to wrong device, disconnect
         char current_mac[18];
-        if (ble_valve_get_mac(current_mac)) {
+        if (ble_valve_get_mac(v, current_mac)) {
             if (strcasecmp(current_mac, valve_mac) != 0) {
-                ESP_LOGW(IOTHUB_TAG, "Connected to wrong MAC, will reconnect to: %s", valve_mac);
-                ble_valve_connect();
+                ESP_LOGW(IOTHUB_TAG, "Valve %d connected to wrong MAC, will reconnect to: %s",
+                         v, valve_mac);
+                ble_valve_connect(v);
             }
         } else {
-            ESP_LOGI(IOTHUB_TAG, "Not connected, triggering connection to: %s", valve_mac);
-            ble_valve_connect();
+            ESP_LOGI(IOTHUB_TAG, "Valve %d not connected, triggering connection to: %s",
+                     v, valve_mac);
+            ble_valve_connect(v);
         }
     }
+
+    if (any) {
+        // Start BLE now that we're provisioned
+        ESP_LOGI(IOTHUB_TAG, "Starting BLE with provisioned MACs...");
+        app_ble_valve_signal_start();
+    }
 }
 
 // Minimum epoch to consider time synced (2024-01-01 00:00:00 UTC)
@@ -1022,10 +1270,7 @@ void iothub_task(void *param)
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     ESP_LOGI(IOTHUB_TAG, "Starting IOT Hub Task...");
 
-    // Initialize provisioning manager
-    if (!provisioning_init()) {
-        ESP_LOGE(IOTHUB_TAG, "Failed to initialize provisioning manager");
-    }
+    // Provisioning manager (and the device registry) is initialized in app_main
 
     // Initialize sensor metadata and rules engine
     sensor_meta_init();
@@ -1035,11 +1280,17 @@ void iothub_task(void *param)
     // Check provisioning state
     if (provisioning_is_provisioned()) {
         ESP_LOGI(IOTHUB_TAG, "Hub is PROVISIONED");
-        char valve_mac[18];
-        if (provisioning_get_valve_mac(valve_mac)) {
-            ESP_LOGI(IOTHUB_TAG, "Provisioned valve MAC: %s", valve_mac);
-            ble_valve_set_target_mac(valve_mac);
-            ESP_LOGI(IOTHUB_TAG, "Starting BLE with provisioned MAC...");
+        bool any_valve = false;
+        for (int v = 0; v < BLE_VALVE_MAX; v++) {
+            char valve_mac[18];
+            if (provisioning_get_valve_mac(v, valve_mac)) {
+                ESP_LOGI(IOTHUB_TAG, "Provisioned valve %d MAC: %s", v, valve_mac);
+                ble_valve_set_target_mac(v, valve_mac);
+                any_valve = true;
+            }
+        }
+        if (any_valve) {
+            ESP_LOGI(IOTHUB_TAG, "Starting BLE with provisioned MACs...");
             app_ble_valve_signal_start();
         }
     } else {
@@ -1085,6 +1336,11 @@ void iothub_task(void *param)
         .session.keepalive = 60,
     };
 
+    // Before the client starts: C2D commands may complete asynchronously
+    if (!g_c2d_ack_q) {
+        g_c2d_ack_q = xQueueCreate(C2D_ACK_QUEUE_LEN, sizeof(c2d_async_ack_t *));
+    }
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(mqtt_client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(mqtt_client);
@@ -1095,43 +1351,47 @@ void iothub_task(void *param)
 
     // Initialize telemetry v2 (creates snapshot timer + queue)
     telemetry_v2_init(mqtt_client, g_device_id, hub_identity_get_gateway_id(),
-                      g_telem_lora_cache, g_telem_ble_cache);
+                      &g_telem_lora_cache, &g_telem_ble_cache);
 
     // Drain queues before adding to QueueSet
-    lora_packet_t dummy_pkt;
-    ble_update_type_t dummy_upd;
-    ble_leak_event_t dummy_leak;
+    ble_valve_update_t dummy_upd;
     uint8_t dummy_snap;
-    while (xQueueReceive(lora_rx_queue, &dummy_pkt, 0) == pdTRUE)
-        ;
+    lora_rx_ring_flush();
     while (xQueueReceive(ble_update_queue, &dummy_upd, 0) == pdTRUE)
         ;
-    while (ble_leak_rx_queue && xQueueReceive(ble_leak_rx_queue, &dummy_leak, 0) == pdTRUE)
-        ;
     // Drain snapshot queue (just created, should be empty — defensive)
     QueueHandle_t snap_q = telemetry_v2_get_snapshot_queue();
     while (snap_q && xQueueReceive(snap_q, &dummy_snap, 0) == pdTRUE)
         ;
-    // Reset BLE leak sensor tracking so next advertisement triggers a fresh event
+    // Discard BLE leak mailboxes and reset tracking so next advertisement
+    // triggers a fresh event
     app_ble_leak_reset_tracking();
 
-    // QueueSet: 3 existing queues + 1 snapshot trigger queue
-    QueueSetHandle_t evt_queue_set = xQueueCreateSet(26);
-    xQueueAddToSet(lora_rx_queue, evt_queue_set);
+    // QueueSet: LoRa and BLE leak doorbells, BLE valve queue, snapshot trigger
+    // queue, completed C2D acks
+    QueueHandle_t lora_bell = lora_rx_ring_doorbell();
+    QueueHandle_t ble_leak_bell = app_ble_leak_doorbell();
+    QueueSetHandle_t evt_queue_set = xQueueCreateSet(21 + BLE_VALVE_UPDATE_QUEUE_LEN +
+                                                     C2D_ACK_QUEUE_LEN);
+    xQueueAddToSet(lora_bell, evt_queue_set);
     xQueueAddToSet(ble_update_queue, evt_queue_set);
-    if (ble_leak_rx_queue) {
-        xQueueAddToSet(ble_leak_rx_queue, evt_queue_set);
+    if (ble_leak_bell) {
+        xQueueAddToSet(ble_leak_bell, evt_queue_set);
     }
     if (snap_q) {
         xQueueAddToSet(snap_q, evt_queue_set);
     }
+    if (g_c2d_ack_q) {
+        xQueueAddToSet(g_c2d_ack_q, evt_queue_set);
+    }
 
     // Start the periodic snapshot timer (fires every SNAPSHOT_INTERVAL_MS)
     telemetry_v2_start_snapshot_timer();
 
     lora_packet_t pkt;
-    ble_update_type_t ble_upd_type;
-    ble_leak_event_t ble_leak_evt;
+    ble_valve_update_t ble_upd;
+    ble_leak_update_t ble_leak_upd;
+    char ble_leak_mac[18];
     QueueSetMemberHandle_t active_queue;
 
     ESP_LOGI(IOTHUB_TAG, "QueueSet Initialized. Event loop starting...");
@@ -1149,27 +1409,55 @@ void iothub_task(void *param)
              (esp_timer_get_time() / 1000) < g_commission_until_ms);
         TickType_t evt_wait = commission_pending ? pdMS_TO_TICKS(2000)
                                                  : pdMS_TO_TICKS(30000);
+        // An owed C2D ack may be waiting on the override reconnect deadline,
+        // which rules_engine_tick() checks
+        if (c2d_async_any_pending() && evt_wait > pdMS_TO_TICKS(C2D_ASYNC_POLL_MS)) {
+            evt_wait = pdMS_TO_TICKS(C2D_ASYNC_POLL_MS);
+        }
+        // Held telemetry events go out when their linger runs out, and
+        // buffered ones as their PUBACKs come in
+        TickType_t telem_wait = telemetry_v2_wait_ticks();
+        if (evt_wait > telem_wait) evt_wait = telem_wait;
         active_queue = xQueueSelectFromSet(evt_queue_set, evt_wait);
 
         // Periodic rules engine tick (auto-clear timeout, valve override detection)
         rules_engine_tick();
+        telemetry_v2_batch_poll();
 
         // =================================================================
         // Phase 1: RECEIVE (always -- regardless of connection state)
         // =================================================================
         bool has_lora = false, has_valve = false, has_ble_leak = false;
         bool has_snapshot = false;
+        c2d_async_ack_t *c2d_ack = NULL;
 
-        if (active_queue == lora_rx_queue) {
-            has_lora = xQueueReceive(lora_rx_queue, &pkt, 0);
+        if (active_queue == lora_bell) {
+            // One record per wakeup; pop re-rings the doorbell if more wait
+            uint8_t bell;
+            xQueueReceive(lora_bell, &bell, 0);
+            has_lora = lora_rx_ring_pop(&pkt);
         } else if (active_queue == ble_update_queue) {
-            has_valve = xQueueReceive(ble_update_queue, &ble_upd_type, 0);
-        } else if (active_queue == ble_leak_rx_queue) {
-            has_ble_leak = xQueueReceive(ble_leak_rx_queue, &ble_leak_evt, 0);
+            has_valve = xQueueReceive(ble_update_queue, &ble_upd, 0);
+        } else if (ble_leak_bell && active_queue == ble_leak_bell) {
+            // One mailbox per wakeup; take re-rings the doorbell if more are dirty
+            uint8_t bell;
+            xQueueReceive(ble_leak_bell, &bell, 0);
+            has_ble_leak = app_ble_leak_take(&ble_leak_upd);
+            if (has_ble_leak) {
+                app_ble_leak_mac_str(ble_leak_upd.sensor_mac, ble_leak_mac);
+                if (!ble_leak_update_current(&ble_leak_upd)) {
+                    ESP_LOGW(IOTHUB_TAG, "BLE leak %s not provisioned, skipping", ble_leak_mac);
+                    has_ble_leak = false;
+                }
+            }
         } else if (snap_q && active_queue == snap_q) {
             uint8_t trig;
             xQueueReceive(snap_q, &trig, 0);
             has_snapshot = true;
+        } else if (g_c2d_ack_q && active_queue == g_c2d_ack_q) {
+            if (xQueueReceive(g_c2d_ack_q, &c2d_ack, 0) != pdTRUE) {
+                c2d_ack = NULL;
+            }
         }
 
         // =================================================================
@@ -1180,21 +1468,36 @@ void iothub_task(void *param)
             snprintf(lora_id_str, sizeof(lora_id_str), "0x%08lX",
                      (unsigned long)pkt.sensorId);
             rules_engine_evaluate_leak(LEAK_SOURCE_LORA,
-                                       (pkt.leakStatus != 0), lora_id_str);
+                                       (pkt.leakStatus != 0), lora_id_str,
+                                       (int64_t)pkt.timestamp);
         }
         if (has_ble_leak) {
+            // A leak that cleared again before the mailbox was taken still
+            // reaches the rules first
+            if (ble_leak_upd.leak_seen && !ble_leak_upd.leak_detected) {
+                rules_engine_evaluate_leak(LEAK_SOURCE_BLE, true, ble_leak_mac,
+                                           ble_leak_upd.leak_rx_us);
+            }
             rules_engine_evaluate_leak(LEAK_SOURCE_BLE,
-                                       ble_leak_evt.leak_detected,
-                                       ble_leak_evt.sensor_mac_str);
+                                       ble_leak_upd.leak_detected, ble_leak_mac,
+                                       ble_leak_upd.leak_rx_us);
+        }
+        if (has_valve && ble_upd.type == BLE_UPD_LEAK) {
+            // Flood source id is the valve's MAC so the rules close that valve
+            char flood_mac[18];
+            if (ble_valve_get_mac(ble_upd.valve, flood_mac)) {
+                rules_engine_evaluate_leak(LEAK_SOURCE_VALVE_FLOOD,
+                                           ble_valve_get_leak(ble_upd.valve), flood_mac, 0);
+            }
         }
-        if (has_valve && ble_upd_type == BLE_UPD_LEAK) {
-            rules_engine_evaluate_leak(LEAK_SOURCE_VALVE_FLOOD,
-                                       ble_valve_get_leak(), "valve");
+        if ((has_lora && pkt.leakStatus) || (has_ble_leak && ble_leak_upd.leak_seen) ||
+            (has_valve && ble_upd.type == BLE_UPD_LEAK && ble_valve_get_leak(ble_upd.valve))) {
+            ble_scan_hint(BLE_SCAN_HINT_LEAK, LEAK_SCAN_WIDEN_MS);
         }
 
         // Valve reconnect reconciliation: re-evaluate active leaks and hub/valve sync
-        if (has_valve && ble_upd_type == BLE_UPD_CONNECTED) {
-            rules_engine_on_valve_connected();
+        if (has_valve && ble_upd.type == BLE_UPD_CONNECTED) {
+            rules_engine_on_valve_connected(ble_upd.valve);
         }
 
         // Check for pending rules engine telemetry (auto-close, rmleak events)
@@ -1205,6 +1508,9 @@ void iothub_task(void *param)
         // =================================================================
         if (!provisioning_is_provisioned()) {
             if (auto_close_json) free(auto_close_json);
+            // Immediate acks still go out (e.g. a failed provision, or the
+            // ack of decommission "all" before the restart)
+            if (c2d_ack) c2d_async_publish(c2d_ack, c2d_ack->immediate);
             continue;
         }
 
@@ -1216,6 +1522,8 @@ void iothub_task(void *param)
             publish_twin_reported();        // Update Device Twin reported properties
             g_boot_snapshot_sent = false;   // Wait for boot sync before first snapshot
         }
+        telemetry_v2_drain_offline();       // Rest of the buffer as PUBACKs free room
+        telemetry_v2_publish_deferred();    // Lifecycle / snapshot pages held for room
 
         // ---- Rules engine events (auto-close, rmleak changes) ----
         if (auto_close_json) {
@@ -1223,6 +1531,23 @@ void iothub_task(void *param)
             free(auto_close_json);
         }
 
+        // ---- cmd_ack of a C2D command that completed asynchronously ----
+        if (c2d_ack) {
+            c2d_async_publish(c2d_ack, true);
+        }
+
+        // ---- Leak-to-valve-closed timing of a finished auto-close ----
+        {
+            leak_latency_report_t lat;
+            if (leak_latency_take_report(&lat)) {
+                char *json = leak_latency_report_to_json(&lat);
+                if (json) {
+                    telemetry_v2_publish_rules_event(json);
+                    free(json);
+                }
+            }
+        }
+
         // ---- Health alerts (Critical transitions) ----
         {
             health_alert_t alert;
@@ -1252,15 +1577,14 @@ void iothub_task(void *param)
             ESP_LOGI(IOTHUB_TAG, "Event: LoRa Packet from 0x%08lX",
                      (unsigned long)pkt.sensorId);
 
-            if (!provisioning_is_lora_sensor_provisioned(pkt.sensorId)) {
+            dev_handle_t h = device_registry_find_lora(pkt.sensorId);
+            if (h == DEVREG_HANDLE_NONE) {
                 ESP_LOGW(IOTHUB_TAG, "Sensor 0x%08lX not provisioned, skipping",
                          (unsigned long)pkt.sensorId);
             } else {
-                bool leak_changed = update_lora_cache_check_leak(&pkt);
-                if (leak_changed) {
-                    char lora_id[16];
-                    snprintf(lora_id, sizeof(lora_id), "0x%08lX",
-                             (unsigned long)pkt.sensorId);
+                bool leak_changed = update_lora_cache_check_leak(h, &pkt);
+                char lora_id[DEVREG_ID_STR_LEN];
+                if (leak_changed && device_registry_get_id_str(h, lora_id)) {
                     telemetry_v2_publish_leak_event(
                         pkt.leakStatus ? "leak_detected" : "leak_cleared",
                         "lora", lora_id,
@@ -1271,30 +1595,31 @@ void iothub_task(void *param)
 
         // ---- Valve events ----
         if (has_valve) {
-            ESP_LOGI(IOTHUB_TAG, "Event: BLE Update type=%d", ble_upd_type);
+            ESP_LOGI(IOTHUB_TAG, "Event: BLE Update valve=%d type=%d",
+                     ble_upd.valve, ble_upd.type);
 
             // Verify connected valve MAC matches provisioned MAC
             char connected_mac[18];
             char provisioned_mac[18];
             bool mac_ok = false;
-            if (ble_valve_get_mac(connected_mac) &&
-                provisioning_get_valve_mac(provisioned_mac)) {
+            if (ble_valve_get_mac(ble_upd.valve, connected_mac) &&
+                provisioning_get_valve_mac(ble_upd.valve, provisioned_mac)) {
                 if (strcasecmp(connected_mac, provisioned_mac) == 0) {
                     mac_ok = true;
                 } else {
                     ESP_LOGW(IOTHUB_TAG,
-                        "Connected valve MAC %s != provisioned %s, skipping",
-                        connected_mac, provisioned_mac);
+                        "Connected valve %d MAC %s != provisioned %s, skipping",
+                        ble_upd.valve, connected_mac, provisioned_mac);
                 }
             }
 
             if (mac_ok) {
-                if (ble_upd_type == BLE_UPD_LEAK) {
-                    telemetry_v2_publish_valve_event(
-                        ble_valve_get_leak() ? "valve_flood_detected"
-                                             : "valve_flood_cleared");
-                } else if (ble_upd_type == BLE_UPD_STATE) {
-                    telemetry_v2_publish_valve_event("valve_state_changed");
+                if (ble_upd.type == BLE_UPD_LEAK) {
+                    telemetry_v2_publish_valve_event(ble_upd.valve,
+                        ble_valve_get_leak(ble_upd.valve) ? "valve_flood_detected"
+                                                          : "valve_flood_cleared");
+                } else if (ble_upd.type == BLE_UPD_STATE) {
+                    telemetry_v2_publish_valve_event(ble_upd.valve, "valve_state_changed");
                 }
                 // BLE_UPD_BATTERY: no event — included in snapshot
                 // BLE_UPD_RMLEAK: handled by rules engine events
@@ -1304,17 +1629,24 @@ void iothub_task(void *param)
 
         // ---- BLE leak sensor events ----
         if (has_ble_leak) {
-            ESP_LOGI(IOTHUB_TAG, "Event: BLE Leak %s leak=%d batt=%d",
-                     ble_leak_evt.sensor_mac_str,
-                     ble_leak_evt.leak_detected, ble_leak_evt.battery);
-
-            bool leak_changed = update_ble_leak_cache_check_leak(&ble_leak_evt);
-            if (leak_changed) {
-                telemetry_v2_publish_leak_event(
-                    ble_leak_evt.leak_detected ? "leak_detected" : "leak_cleared",
-                    "ble_leak_sensor", ble_leak_evt.sensor_mac_str,
-                    ble_leak_evt.leak_detected,
-                    ble_leak_evt.battery, ble_leak_evt.rssi);
+            ESP_LOGI(IOTHUB_TAG, "Event: BLE Leak %s leak=%d%s batt=%d",
+                     ble_leak_mac, ble_leak_upd.leak_detected,
+                     ble_leak_upd.leak_seen ? " (leak seen)" : "", ble_leak_upd.battery);
+
+            // Replay a leak that came and went between takes, then the latest state
+            bool states[2];
+            int n = 0;
+            if (ble_leak_upd.leak_seen && !ble_leak_upd.leak_detected) {
+                states[n++] = true;
+            }
+            states[n++] = ble_leak_upd.leak_detected;
+            for (int k = 0; k < n; k++) {
+                if (update_ble_leak_cache_check_leak(&ble_leak_upd, states[k])) {
+                    telemetry_v2_publish_leak_event(
+                        states[k] ? "leak_detected" : "leak_cleared",
+                        "ble_leak_sensor", ble_leak_mac, states[k],
+                        ble_leak_upd.battery, ble_leak_upd.rssi);
+                }
             }
         }
 
@@ -1328,10 +1660,13 @@ void iothub_task(void *param)
         //      window. Publishing last guarantees the snapshot reflects that advertisement. ----
         if (!g_boot_snapshot_sent && health_is_boot_sync_complete()) {
             g_boot_snapshot_sent = true;
-            uint8_t seen = 0, total = 0;
+            uint16_t seen = 0, total = 0;
             if (health_get_sync_counts(&seen, &total)) {
                 g_commission_pub_seen = seen;
-                if (seen >= total) g_commission_until_ms = 0;  // all heard — no refresh needed
+                if (seen >= total) {
+                    g_commission_until_ms = 0;  // all heard — no refresh needed
+                    ble_scan_hint(BLE_SCAN_HINT_COMMISSION, 0);
+                }
             }
             ESP_LOGI(IOTHUB_TAG, "Publishing sync snapshot (boot/commission window complete)");
             telemetry_v2_publish_snapshot();
@@ -1345,14 +1680,17 @@ void iothub_task(void *param)
         // every device has been heard.
         else if (g_boot_snapshot_sent &&
                  (esp_timer_get_time() / 1000) < g_commission_until_ms) {
-            uint8_t seen = 0, total = 0;
+            uint16_t seen = 0, total = 0;
             if (health_get_sync_counts(&seen, &total) && seen > g_commission_pub_seen) {
                 g_commission_pub_seen = seen;
                 ESP_LOGI(IOTHUB_TAG,
                          "Publishing commission refresh snapshot (device heard, %u/%u seen)",
                          (unsigned)seen, (unsigned)total);
                 telemetry_v2_publish_snapshot();
-                if (seen >= total) g_commission_until_ms = 0;  // all heard — stop refreshing
+                if (seen >= total) {
+                    g_commission_until_ms = 0;  // all heard — stop refreshing
+                    ble_scan_hint(BLE_SCAN_HINT_COMMISSION, 0);
+                }
             }
         }
     }
@@ -0,0 +1,267 @@
+/*
+ * leak_latency.c
+ *
+ * Stage stamps, report and histograms of the leak -> valve-closed path.
+ * See leak_latency.h for the stages.
+ */
+
+#include "leak_latency.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "cJSON.h"
+#include "app_ble_valve.h"
+
+static const char *TAG = "LEAK_LAT";
+
+#define BUCKET0_MS          25      /* first bucket upper edge; doubles */
+
+/* =========================================================================
+ * STATE
+ *
+ * Stamped from the IoT Hub task (RULES, QUEUED), the BLE command task
+ * (DEQUEUED, WRITE) and the NimBLE host task (ACKED, CLOSED), so the open
+ * incident sits behind a spinlock. One incident at a time: auto-close has a
+ * cooldown per valve, and a second leak during an open incident adds its
+ * valves to it.
+ * ========================================================================= */
+static leak_latency_report_t s_open;
+static bool                  s_open_active = false;
+static uint8_t               s_written = 0;     /* bit v: close written to valve v */
+static uint8_t               s_closed = 0;      /* bit v: valve v closed after its write */
+static leak_latency_report_t s_done;
+static bool                  s_done_ready = false;
+static uint32_t              s_next_id = 1;
+static leak_latency_stats_t  s_stats;
+static portMUX_TYPE          s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+static int bucket_of(int32_t ms)
+{
+    uint32_t edge = BUCKET0_MS;
+    for (int b = 0; b < LEAK_LATENCY_BUCKETS - 1; b++) {
+        if ((uint32_t)ms < edge) return b;
+        edge <<= 1;
+    }
+    return LEAK_LATENCY_BUCKETS - 1;
+}
+
+static int32_t span_us_to_ms(int64_t from, int64_t to)
+{
+    if (from == 0 || to == 0 || to < from) return -1;
+    return (int32_t)((to - from) / 1000);
+}
+
+/* Move the open incident to the done slot. Called with s_lock held. */
+static void finish_locked(bool timed_out)
+{
+    s_open.timed_out = timed_out;
+    s_open_active = false;
+
+    if (timed_out) {
+        s_stats.timeouts++;
+    } else {
+        s_stats.completed++;
+    }
+    for (int s = 0; s < LEAK_LAT_SPAN_MAX; s++) {
+        int32_t ms = leak_latency_span_ms(&s_open, (leak_lat_span_t)s);
+        if (ms >= 0 && s_stats.hist[s][bucket_of(ms)] < UINT16_MAX) {
+            s_stats.hist[s][bucket_of(ms)]++;
+        }
+    }
+    if (!timed_out) {
+        s_stats.last_total_ms = (uint32_t)leak_latency_span_ms(&s_open, LEAK_LAT_SPAN_TOTAL);
+    }
+
+    /* An untaken report is overwritten: the histograms already hold it */
+    s_done = s_open;
+    s_done_ready = true;
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+uint32_t leak_latency_begin(const char *source_type, const char *sensor_id,
+                            int64_t detect_us, bool valve_connected, uint8_t valves)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t detect = (detect_us > 0 && detect_us <= now) ? detect_us : now;
+    uint32_t id;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_open_active) {
+        s_open.valves |= valves;
+        id = s_open.id;
+        portEXIT_CRITICAL(&s_lock);
+        return id;
+    }
+    memset(&s_open, 0, sizeof(s_open));
+    s_open.id = id = s_next_id++;
+    s_open.source_type = source_type;
+    if (sensor_id) {
+        strncpy(s_open.sensor_id, sensor_id, sizeof(s_open.sensor_id) - 1);
+    }
+    s_open.valves = valves;
+    s_open.valve_connected = valve_connected;
+    s_written = 0;
+    s_closed = 0;
+    s_open.t_us[LEAK_LAT_DETECT] = detect;
+    s_open.t_us[LEAK_LAT_RULES] = now;
+    s_open_active = true;
+    s_stats.incidents++;
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Incident %lu opened by %s %s for valves 0x%02X (detect->rules %ld ms)",
+             (unsigned long)id, source_type ? source_type : "unknown",
+             sensor_id ? sensor_id : "unknown", valves,
+             (long)((now - detect) / 1000));
+    return id;
+}
+
+void leak_latency_mark(int valve, leak_lat_stage_t stage)
+{
+    if (stage <= LEAK_LAT_RULES || stage >= LEAK_LAT_STAGE_MAX) return;
+    if (valve < 0 || valve >= BLE_VALVE_MAX) return;
+
+    int64_t now = esp_timer_get_time();
+    uint8_t bit = (uint8_t)(1u << valve);
+    bool closed = false;
+    uint32_t id = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_open_active && (s_open.valves & bit)) {
+        if (stage == LEAK_LAT_WRITE) {
+            s_written |= bit;
+        }
+        if (stage == LEAK_LAT_CLOSED) {
+            // Only a close this incident wrote; done when every valve is
+            if (s_written & bit) {
+                s_closed |= bit;
+            }
+            if (s_closed == s_open.valves) {
+                s_open.t_us[stage] = now;
+                id = s_open.id;
+                finish_locked(false);
+                closed = true;
+            }
+        } else if (s_open.t_us[stage] == 0) {
+            s_open.t_us[stage] = now;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (closed) {
+        ESP_LOGW(TAG, "Incident %lu: valves closed %lu ms after detection",
+                 (unsigned long)id, (unsigned long)s_stats.last_total_ms);
+    }
+}
+
+bool leak_latency_take_report(leak_latency_report_t *out)
+{
+    int64_t now = esp_timer_get_time();
+    bool ready;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_open_active &&
+        now - s_open.t_us[LEAK_LAT_RULES] > (int64_t)LEAK_LATENCY_TIMEOUT_MS * 1000) {
+        finish_locked(true);
+    }
+    ready = s_done_ready;
+    if (ready) {
+        *out = s_done;
+        s_done_ready = false;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (ready && out->timed_out) {
+        ESP_LOGW(TAG, "Incident %lu: no valve-closed notify within %d s",
+                 (unsigned long)out->id, LEAK_LATENCY_TIMEOUT_MS / 1000);
+    }
+    return ready;
+}
+
+int32_t leak_latency_span_ms(const leak_latency_report_t *r, leak_lat_span_t span)
+{
+    const int64_t *t = r->t_us;
+
+    switch (span) {
+        case LEAK_LAT_SPAN_INGRESS:
+            return span_us_to_ms(t[LEAK_LAT_DETECT], t[LEAK_LAT_RULES]);
+        case LEAK_LAT_SPAN_DISPATCH:
+            return span_us_to_ms(t[LEAK_LAT_RULES], t[LEAK_LAT_WRITE]);
+        case LEAK_LAT_SPAN_WRITE:
+            return span_us_to_ms(t[LEAK_LAT_WRITE], t[LEAK_LAT_ACKED]);
+        case LEAK_LAT_SPAN_ACTUATE:
+            return span_us_to_ms(t[LEAK_LAT_ACKED] ? t[LEAK_LAT_ACKED] : t[LEAK_LAT_WRITE],
+                                 t[LEAK_LAT_CLOSED]);
+        case LEAK_LAT_SPAN_TOTAL:
+            return span_us_to_ms(t[LEAK_LAT_DETECT], t[LEAK_LAT_CLOSED]);
+        default:
+            return -1;
+    }
+}
+
+char *leak_latency_report_to_json(const leak_latency_report_t *r)
+{
+    static const char *const stage_names[LEAK_LAT_STAGE_MAX] = {
+        "detect", "rules", "queued", "dequeued", "write", "acked", "closed"
+    };
+    static const char *const span_names[LEAK_LAT_SPAN_MAX] = {
+        "ingress_ms", "dispatch_ms", "write_ms", "actuate_ms", "total_ms"
+    };
+
+    cJSON *root = cJSON_CreateObject();
+    if (!root) return NULL;
+
+    cJSON_AddStringToObject(root, "event", "auto_close_latency");
+    cJSON_AddNumberToObject(root, "incident_id", r->id);
+    cJSON_AddStringToObject(root, "source_type", r->source_type ? r->source_type : "unknown");
+    cJSON_AddStringToObject(root, "sensor_id", r->sensor_id[0] ? r->sensor_id : "unknown");
+    cJSON_AddBoolToObject(root, "valve_connected", r->valve_connected);
+    cJSON_AddBoolToObject(root, "timed_out", r->timed_out);
+
+    // Stage offsets from detection, ms (null = not reached)
+    cJSON *stages = cJSON_CreateObject();
+    for (int s = LEAK_LAT_RULES; s < LEAK_LAT_STAGE_MAX; s++) {
+        int32_t ms = span_us_to_ms(r->t_us[LEAK_LAT_DETECT], r->t_us[s]);
+        if (ms >= 0) {
+            cJSON_AddNumberToObject(stages, stage_names[s], ms);
+        } else {
+            cJSON_AddNullToObject(stages, stage_names[s]);
+        }
+    }
+    cJSON_AddItemToObject(root, "t_ms", stages);
+
+    for (int s = 0; s < LEAK_LAT_SPAN_MAX; s++) {
+        int32_t ms = leak_latency_span_ms(r, (leak_lat_span_t)s);
+        if (ms >= 0) {
+            cJSON_AddNumberToObject(root, span_names[s], ms);
+        } else {
+            cJSON_AddNullToObject(root, span_names[s]);
+        }
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+uint32_t leak_latency_bucket_ms(int bucket)
+{
+    if (bucket < 0 || bucket >= LEAK_LATENCY_BUCKETS - 1) return 0;
+    return (uint32_t)BUCKET0_MS << bucket;
+}
+
+void leak_latency_get_stats(leak_latency_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,137 @@
+/*
+ * leak_latency.h
+ *
+ * End-to-end timing of automatic valve closure.
+ *
+ * An incident opens when the rules engine decides to auto-close and is
+ * stamped (esp_timer, monotonic us) at each stage of the path:
+ *
+ *   DETECT    leak advertisement / LoRa frame received by the radio task
+ *   RULES     rules_engine_evaluate_leak decided to close
+ *   QUEUED    ble_valve_close put the command on ble_cmd_queue
+ *   DEQUEUED  the BLE command task took it off the queue
+ *   WRITE     the GATT write of "closed" went out (after a reconnect if the
+ *             valve was not connected)
+ *   ACKED     the valve's ATT write response arrived
+ *   CLOSED    the valve notified state = closed
+ *
+ * The incident records the valves the rules engine closes. Stamps come with
+ * the valve index and are ignored from other valves and while no incident
+ * is open. Each stage is stamped once, first targeted valve wins, except
+ * CLOSED: it counts only from a valve whose close command was written
+ * during the incident (not, say, the state read after a reconnect), and is
+ * stamped when the last targeted valve has reported closed. An incident
+ * finishes on CLOSED or after LEAK_LATENCY_TIMEOUT_MS. The finished breakdown is taken by the IoT Hub
+ * task and published as an "auto_close_latency" rules event carrying the
+ * incident_id of its "auto_close" event; the spans also feed per-stage
+ * histograms reported in the snapshot.
+ */
+
+#ifndef LEAK_LATENCY_H
+#define LEAK_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_LATENCY_TIMEOUT_MS   (120 * 1000)  /* covers a valve reconnect */
+#define LEAK_LATENCY_BUCKETS      10            /* 25 ms doubling to >6.4 s */
+
+typedef enum {
+    LEAK_LAT_DETECT = 0,
+    LEAK_LAT_RULES,
+    LEAK_LAT_QUEUED,
+    LEAK_LAT_DEQUEUED,
+    LEAK_LAT_WRITE,
+    LEAK_LAT_ACKED,
+    LEAK_LAT_CLOSED,
+    LEAK_LAT_STAGE_MAX
+} leak_lat_stage_t;
+
+/* Spans reported per incident and histogrammed */
+typedef enum {
+    LEAK_LAT_SPAN_INGRESS = 0,  /* DETECT -> RULES: radio task to decision */
+    LEAK_LAT_SPAN_DISPATCH,     /* RULES -> WRITE: queue, command task, reconnect */
+    LEAK_LAT_SPAN_WRITE,        /* WRITE -> ACKED: ATT round trip */
+    LEAK_LAT_SPAN_ACTUATE,      /* ACKED (or WRITE) -> CLOSED: valve reports closed */
+    LEAK_LAT_SPAN_TOTAL,        /* DETECT -> CLOSED */
+    LEAK_LAT_SPAN_MAX
+} leak_lat_span_t;
+
+/* One finished incident (leak_latency_take_report) */
+typedef struct {
+    uint32_t    id;
+    const char *source_type;            /* static string, as in "auto_close" */
+    char        sensor_id[18];
+    uint8_t     valves;                 /* bit v: close of valve v timed */
+    bool        valve_connected;        /* valve link was up at RULES */
+    bool        timed_out;              /* CLOSED never came */
+    int64_t     t_us[LEAK_LAT_STAGE_MAX];   /* 0 = stage not reached */
+} leak_latency_report_t;
+
+/* Histograms and counters (leak_latency_get_stats) */
+typedef struct {
+    uint32_t incidents;                 /* incidents opened */
+    uint32_t completed;                 /* finished with CLOSED */
+    uint32_t timeouts;                  /* finished without CLOSED */
+    uint32_t last_total_ms;             /* DETECT -> CLOSED of the last completed one */
+    uint16_t hist[LEAK_LAT_SPAN_MAX][LEAK_LATENCY_BUCKETS];
+} leak_latency_stats_t;
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+/**
+ * @brief  Open an incident for the valves in @p valves and stamp DETECT and
+ *         RULES. Pass only valves whose close will be written and then
+ *         reported by a CLOSED notify, or the incident can only time out.
+ *         While one is already open its valves are added to it and its id
+ *         is returned.
+ * @param  detect_us  radio receive time (esp_timer us), 0 = unknown (now)
+ * @return incident id, carried in the "auto_close" event
+ */
+uint32_t leak_latency_begin(const char *source_type, const char *sensor_id,
+                            int64_t detect_us, bool valve_connected, uint8_t valves);
+
+/**
+ * @brief  Stamp a stage of the open incident for valve @p valve. Any task;
+ *         never blocks. CLOSED from the last targeted valve finishes the
+ *         incident.
+ */
+void leak_latency_mark(int valve, leak_lat_stage_t stage);
+
+/**
+ * @brief  Take the finished incident, if any (IoT Hub task). Also times out
+ *         an incident open longer than LEAK_LATENCY_TIMEOUT_MS.
+ */
+bool leak_latency_take_report(leak_latency_report_t *out);
+
+/**
+ * @brief  Span of a report in ms, or -1 if either end is missing.
+ */
+int32_t leak_latency_span_ms(const leak_latency_report_t *r, leak_lat_span_t span);
+
+/**
+ * @brief  Build the "auto_close_latency" rules event. Caller must free().
+ */
+char *leak_latency_report_to_json(const leak_latency_report_t *r);
+
+/**
+ * @brief  Upper edge of a histogram bucket in ms (last bucket: 0 = open).
+ */
+uint32_t leak_latency_bucket_ms(int bucket);
+
+/**
+ * @brief  Copy the histograms and counters. Safe from any task.
+ */
+void leak_latency_get_stats(leak_latency_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_LATENCY_H */
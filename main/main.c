@@ -25,9 +25,11 @@
 #include "iothub/app_iothub.h"
 #include "ble_valve/app_ble_valve.h"
 #include "ble_leak_scanner/app_ble_leak.h"
+#include "ble_scan/ble_scan.h"
 #include "systemservices/monitoring.h"
 #include "wifi_reset/reset_button.h"
 #include "hub_identity/hub_identity.h"
+#include "provisioning_manager/provisioning_manager.h"
 
 /* ---------------------------------------------------------
  * Tags
@@ -56,6 +58,12 @@ void app_main(void)
 	/* derive Gateway ID + Short ID from MAC, load hub name from NVS */
 	hub_identity_init();
 
+	/* load commissioned devices and fill the device registry before the LoRa
+	 * and BLE tasks start looking sensors up by handle */
+	if (!provisioning_init()) {
+		ESP_LOGE(TAG, "Failed to initialize provisioning manager");
+	}
+
 	/* start subsystems */
     setupLEDTask();
     net_status_init();   /* network status LED coordinator (after ledQueue exists) */
@@ -63,6 +71,7 @@ void app_main(void)
     app_wifi_start();
 	configurelora();
 	initialize_iothub();
+	ble_scan_init();     /* shared BLE scan; valve + leak scanner register with it */
 	app_ble_valve_init();
 	app_ble_leak_init();
 
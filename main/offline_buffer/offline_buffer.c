@@ -3,6 +3,9 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "delivery_tracker.h"
 
 #define OB_TAG       "OFFLINE_BUF"
 #define OB_NAMESPACE "offline_buf"
@@ -15,6 +18,16 @@ static uint8_t s_tail  = 0;   // Next read index
 static uint8_t s_count = 0;   // Number of valid entries
 static bool    s_ready = false;
 
+// Delivery of entries published by a drain. Bits are per slot; an entry
+// stays in NVS until its PUBACK sets `acked`, and a disconnect clears `sent`
+// so the next drain publishes it again. `seq` changes whenever a slot is
+// rewritten, so a late outcome for its old contents is ignored. Set from the
+// MQTT task (delivery callback), hence the lock.
+static portMUX_TYPE s_lock  = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t     s_sent  = 0;
+static uint32_t     s_acked = 0;
+static uint8_t      s_seq[OFFLINE_BUF_MAX_ENTRIES];
+
 // ---------------------------------------------------------------------------
 // NVS helpers
 // ---------------------------------------------------------------------------
@@ -35,6 +48,60 @@ static void make_key(uint8_t index, char *buf, size_t buf_len)
     snprintf(buf, buf_len, "ob_%02u", (unsigned)index);
 }
 
+// ---------------------------------------------------------------------------
+// Delivery state
+// ---------------------------------------------------------------------------
+
+static uint32_t delivery_tag(uint8_t index)
+{
+    return index | ((uint32_t)s_seq[index] << 8);
+}
+
+// Slot rewritten or erased: forget its delivery
+static void slot_reset(uint8_t index)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_sent  &= ~(1u << index);
+    s_acked &= ~(1u << index);
+    s_seq[index]++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// DELIVERY_DURABLE outcome (MQTT task)
+static void on_delivery(uint32_t tag, bool acked)
+{
+    uint8_t index = tag & 0xFF;
+    if (index >= OFFLINE_BUF_MAX_ENTRIES) return;
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_seq[index] == (uint8_t)(tag >> 8) && (s_sent & (1u << index))) {
+        if (acked) s_acked |= 1u << index;
+        else       s_sent  &= ~(1u << index);   // re-queued
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// Erase acknowledged entries from the tail. Returns the number retired.
+static int retire_acked(nvs_handle_t h)
+{
+    int retired = 0;
+    while (s_count > 0) {
+        portENTER_CRITICAL(&s_lock);
+        bool acked = s_acked & (1u << s_tail);
+        portEXIT_CRITICAL(&s_lock);
+        if (!acked) break;
+
+        char key[8];
+        make_key(s_tail, key, sizeof(key));
+        nvs_erase_key(h, key);
+        slot_reset(s_tail);
+        s_tail = (s_tail + 1) % OFFLINE_BUF_MAX_ENTRIES;
+        s_count--;
+        retired++;
+    }
+    return retired;
+}
+
 // ---------------------------------------------------------------------------
 // Public API
 // ---------------------------------------------------------------------------
@@ -60,6 +127,7 @@ void offline_buffer_init(void)
         save_metadata();
     }
 
+    delivery_tracker_set_callback(DELIVERY_DURABLE, on_delivery);
     s_ready = true;
 
     if (s_count > 0) {
@@ -75,9 +143,9 @@ bool offline_buffer_store(const char *json, size_t len)
     if (!s_ready || !json || len == 0) return false;
 
     if (len > OFFLINE_BUF_MAX_JSON_LEN) {
-        ESP_LOGW(OB_TAG, "Event too large (%u bytes, max %d), truncating",
+        ESP_LOGW(OB_TAG, "Event too large (%u bytes, max %d), dropped",
                  (unsigned)len, OFFLINE_BUF_MAX_JSON_LEN);
-        len = OFFLINE_BUF_MAX_JSON_LEN;
+        return false;
     }
 
     nvs_handle_t h;
@@ -88,6 +156,7 @@ bool offline_buffer_store(const char *json, size_t len)
 
     char key[8];
     make_key(s_head, key, sizeof(key));
+    slot_reset(s_head);
 
     esp_err_t err = nvs_set_blob(h, key, json, len);
     if (err != ESP_OK) {
@@ -119,11 +188,9 @@ bool offline_buffer_store(const char *json, size_t len)
     return true;
 }
 
-int offline_buffer_drain(esp_mqtt_client_handle_t client, const char *topic)
+int offline_buffer_drain(esp_mqtt_client_handle_t client, offline_buffer_topic_fn topic_for)
 {
-    if (!s_ready || s_count == 0 || !client || !topic) return 0;
-
-    ESP_LOGI(OB_TAG, "Draining %d buffered event(s)...", s_count);
+    if (!s_ready || s_count == 0 || !client || !topic_for) return 0;
 
     nvs_handle_t h;
     if (nvs_open(OB_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) {
@@ -131,48 +198,89 @@ int offline_buffer_drain(esp_mqtt_client_handle_t client, const char *topic)
         return 0;
     }
 
+    int retired = retire_acked(h);
     int published = 0;
     char buf[OFFLINE_BUF_MAX_JSON_LEN + 1];
 
-    while (s_count > 0) {
-        char key[8];
-        make_key(s_tail, key, sizeof(key));
+    // Publish FIFO whatever is not in flight yet, as far as the in-flight
+    // cap allows. Entries stay in NVS until their PUBACK.
+    for (int i = 0; i < s_count; i++) {
+        uint8_t index = (s_tail + i) % OFFLINE_BUF_MAX_ENTRIES;
+        portENTER_CRITICAL(&s_lock);
+        bool sent = s_sent & (1u << index);
+        portEXIT_CRITICAL(&s_lock);
+        if (sent) continue;
+        // Slot held before the publish call, so tracking cannot fail once
+        // the entry is in the esp-mqtt outbox
+        if (!delivery_tracker_reserve()) break;
 
+        char key[8];
+        make_key(index, key, sizeof(key));
         size_t len = OFFLINE_BUF_MAX_JSON_LEN;
         esp_err_t err = nvs_get_blob(h, key, buf, &len);
         if (err != ESP_OK) {
+            // Unreadable: treat as delivered so it cannot block the tail
             ESP_LOGW(OB_TAG, "Read '%s' failed: %s, skipping",
                      key, esp_err_to_name(err));
-        } else {
-            buf[len] = '\0';
-            int msg_id = esp_mqtt_client_publish(client, topic, buf, (int)len, 1, 0);
-            if (msg_id >= 0) {
-                published++;
-                ESP_LOGI(OB_TAG, "Replayed [%s] (%u bytes)", key, (unsigned)len);
-            } else {
-                ESP_LOGW(OB_TAG, "MQTT publish failed for [%s], stopping drain", key);
-                break;
-            }
+            delivery_tracker_unreserve();
+            portENTER_CRITICAL(&s_lock);
+            s_sent  |= 1u << index;
+            s_acked |= 1u << index;
+            portEXIT_CRITICAL(&s_lock);
+            continue;
         }
 
-        // Erase this slot and advance tail
-        nvs_erase_key(h, key);
-        s_tail = (s_tail + 1) % OFFLINE_BUF_MAX_ENTRIES;
-        s_count--;
+        buf[len] = '\0';
+        int64_t sent_us = esp_timer_get_time();
+        int msg_id = esp_mqtt_client_publish(client, topic_for(buf, len),
+                                             buf, (int)len, 1, 0);
+        if (msg_id < 0) {
+            ESP_LOGW(OB_TAG, "MQTT publish failed for [%s], stopping drain", key);
+            delivery_tracker_unreserve();
+            break;
+        }
+
+        // Marked sent before tracking: an early PUBACK completes inside track()
+        portENTER_CRITICAL(&s_lock);
+        s_sent |= 1u << index;
+        portEXIT_CRITICAL(&s_lock);
+        // Untracked, it stays sent: it is in the outbox already, and
+        // publishing it again would duplicate it
+        if (!delivery_tracker_track(msg_id, DELIVERY_DURABLE, delivery_tag(index), sent_us)) {
+            ESP_LOGW(OB_TAG, "[%s] msg_id %d not tracked", key, msg_id);
+        }
+        published++;
+        ESP_LOGI(OB_TAG, "Replayed [%s] (%u bytes), msg_id %d", key, (unsigned)len, msg_id);
     }
 
-    // Persist updated metadata
-    nvs_set_u8(h, OB_KEY_HEAD,  s_head);
-    nvs_set_u8(h, OB_KEY_TAIL,  s_tail);
-    nvs_set_u8(h, OB_KEY_COUNT, s_count);
-    nvs_commit(h);
+    // PUBACKs that came in while publishing
+    retired += retire_acked(h);
+    if (retired) {
+        nvs_set_u8(h, OB_KEY_HEAD,  s_head);
+        nvs_set_u8(h, OB_KEY_TAIL,  s_tail);
+        nvs_set_u8(h, OB_KEY_COUNT, s_count);
+        nvs_commit(h);
+    }
     nvs_close(h);
 
-    ESP_LOGI(OB_TAG, "Drain complete: %d event(s) published, %d remaining",
-             published, s_count);
+    if (published || retired) {
+        ESP_LOGI(OB_TAG, "Drain: %d published, %d acknowledged and erased, %d remaining",
+                 published, retired, s_count);
+    }
     return published;
 }
 
+int offline_buffer_unsent(void)
+{
+    int n = 0;
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < s_count; i++) {
+        if (!(s_sent & (1u << ((s_tail + i) % OFFLINE_BUF_MAX_ENTRIES)))) n++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return n;
+}
+
 int offline_buffer_count(void)
 {
     return s_count;
@@ -190,6 +298,7 @@ void offline_buffer_clear(void)
         char key[8];
         make_key(i, key, sizeof(key));
         nvs_erase_key(h, key);
+        slot_reset(i);
     }
 
     s_head = s_tail = s_count = 0;
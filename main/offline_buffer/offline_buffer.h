@@ -20,30 +20,46 @@ extern "C" {
 void offline_buffer_init(void);
 
 /**
- * @brief Store a JSON telemetry string in NVS ring buffer.
- *        Overwrites oldest entry if buffer is full.
+ * @brief Picks the MQTT topic for a buffered message (its content type
+ *        depends on the encoding the message was written in).
+ */
+typedef const char *(*offline_buffer_topic_fn)(const char *msg, size_t len);
+
+/**
+ * @brief Store a telemetry message (JSON or CBOR) in NVS ring buffer.
+ *        Overwrites oldest entry if buffer is full. A message longer than
+ *        OFFLINE_BUF_MAX_JSON_LEN is rejected, never truncated.
  *
- * @param json  Null-terminated JSON string
- * @param len   Length of json (excluding null terminator)
- * @return true on success, false on NVS error or json too large
+ * @param json  Message bytes
+ * @param len   Length of the message
+ * @return true on success, false on NVS error or message too large
  */
 bool offline_buffer_store(const char *json, size_t len);
 
 /**
- * @brief Drain all buffered events by publishing via MQTT.
- *        Publishes FIFO (oldest first), clears entries from NVS.
+ * @brief Drain buffered events by publishing via MQTT, FIFO (oldest first).
+ *        An entry stays in NVS until its PUBACK (delivery_tracker) and is
+ *        published again by a later drain if the connection drops first.
+ *        Publishes only while the in-flight cap has room and erases the
+ *        entries acknowledged so far, so call it again until
+ *        offline_buffer_count() is 0. iothub_task only.
  *
- * @param client  MQTT client handle
- * @param topic   MQTT topic string
- * @return Number of events published
+ * @param client     MQTT client handle
+ * @param topic_for  Topic for each message
+ * @return Number of events published by this call
  */
-int offline_buffer_drain(esp_mqtt_client_handle_t client, const char *topic);
+int offline_buffer_drain(esp_mqtt_client_handle_t client, offline_buffer_topic_fn topic_for);
 
 /**
- * @brief Return number of events currently buffered.
+ * @brief Return number of events currently buffered, in flight included.
  */
 int offline_buffer_count(void);
 
+/**
+ * @brief Return number of buffered events not in flight.
+ */
+int offline_buffer_unsent(void);
+
 /**
  * @brief Clear all buffered events from NVS.
  */
@@ -21,16 +21,183 @@
 #define NVS_KEY_RULES_EN "rules_en"
 #define NVS_KEY_RULES_TRIG "rules_trig"
 
-#define CURRENT_CONFIG_VERSION 2
+#define CURRENT_CONFIG_VERSION 3   // 3: device lists stored in chunks
+
+// Device lists are stored as fixed-size chunks ("lora_ids0", "lora_ids1", ...)
+// so a large-capacity list never needs one big NVS blob spanning pages.
+// Version 2 wrote each list as a single blob under the bare key; that is still
+// read and is replaced by chunks on the next save.
+#define PROV_LORA_PER_CHUNK    64   // 256 B per chunk
+#define PROV_LEAK_PER_CHUNK    16   // 288 B per chunk
+#define PROV_MAX_CHUNKS        16   // > 255 / PROV_LEAK_PER_CHUNK
 
 static provisioning_config_t g_config = {0};
 static bool g_initialized = false;
 static SemaphoreHandle_t g_prov_mutex = NULL;
 
+// Device-list generation and change subscribers
+static volatile uint32_t g_generation = 0;
+static struct {
+    provisioning_change_cb_t cb;
+    void *arg;
+} g_subscribers[PROV_MAX_SUBSCRIBERS];
+static int g_subscriber_count = 0;
+
 // Forward declaration
 static bool validate_mac_string(const char *mac_str);
 static bool parse_hex_id(const char *hex_str, uint32_t *out_id);
 
+// Publish the in-memory device lists to the device registry.
+// Call with g_prov_mutex held (or before g_initialized is set).
+static void sync_registry_locked(void)
+{
+    if (g_config.state == PROV_STATE_PROVISIONED) {
+        device_registry_sync((const char (*)[18])g_config.valve_macs,
+                             g_config.lora_sensor_ids, g_config.lora_sensor_count,
+                             (const char (*)[18])g_config.ble_leak_sensors,
+                             g_config.ble_leak_sensor_count);
+    } else {
+        device_registry_sync(NULL, NULL, 0, NULL, 0);
+    }
+    g_generation++;
+}
+
+// Tell subscribers the device lists changed. Call after releasing g_prov_mutex.
+static void notify_subscribers(void)
+{
+    uint32_t gen = g_generation;
+    for (int i = 0; i < g_subscriber_count; i++) {
+        g_subscribers[i].cb(gen, g_subscribers[i].arg);
+    }
+}
+
+// Read a count-prefixed array blob, keeping at most max_count entries when the
+// stored list is longer than the configured capacity.
+static bool load_list_blob(nvs_handle_t h, const char *key, void *dst,
+                           size_t elem_size, uint8_t max_count, uint8_t *count)
+{
+    size_t stored = 0;
+    if (nvs_get_blob(h, key, NULL, &stored) != ESP_OK) {
+        return false;
+    }
+    if (stored <= elem_size * max_count) {
+        return nvs_get_blob(h, key, dst, &stored) == ESP_OK;
+    }
+
+    uint8_t *tmp = malloc(stored);
+    if (!tmp) {
+        return false;
+    }
+    bool ok = (nvs_get_blob(h, key, tmp, &stored) == ESP_OK);
+    if (ok) {
+        ESP_LOGW(PROV_TAG, "%s: %d stored, capacity %d - extra entries ignored",
+                 key, *count, max_count);
+        memcpy(dst, tmp, elem_size * max_count);
+        *count = max_count;
+    }
+    free(tmp);
+    return ok;
+}
+
+static void chunk_key(char out[16], const char *base, int chunk)
+{
+    snprintf(out, 16, "%s%d", base, chunk);
+}
+
+// Valve slot 0 keeps the original "valve_mac" key, slot n uses "valve_mac<n>"
+static void valve_mac_key(char out[16], int valve)
+{
+    if (valve == 0) {
+        snprintf(out, 16, "%s", NVS_KEY_VALVE_MAC);
+    } else {
+        chunk_key(out, NVS_KEY_VALVE_MAC, valve);
+    }
+}
+
+static void log_valve_macs(const provisioning_config_t *config)
+{
+    for (int v = 0; v < MAX_VALVES; v++) {
+        if (config->valve_macs[v][0] != '\0') {
+            ESP_LOGI(PROV_TAG, "Valve[%d] MAC: %s", v, config->valve_macs[v]);
+        }
+    }
+}
+
+// Load a chunked list of count entries (count updated to what was read).
+// Falls back to the pre-chunking single blob under the bare key.
+static bool load_list_chunks(nvs_handle_t h, const char *base, void *dst,
+                             size_t elem_size, int per_chunk,
+                             uint8_t max_count, uint8_t *count)
+{
+    char key[16];
+    size_t len = 0;
+    chunk_key(key, base, 0);
+    if (nvs_get_blob(h, key, NULL, &len) != ESP_OK) {
+        return load_list_blob(h, base, dst, elem_size, max_count, count);
+    }
+
+    int want = (*count < max_count) ? *count : max_count;
+    if (*count > max_count) {
+        ESP_LOGW(PROV_TAG, "%s: %d stored, capacity %d - extra entries ignored",
+                 base, *count, max_count);
+    }
+
+    uint8_t *out = (uint8_t *)dst;
+    int got = 0;
+    for (int c = 0; got < want && c < PROV_MAX_CHUNKS; c++) {
+        chunk_key(key, base, c);
+        len = 0;
+        if (nvs_get_blob(h, key, NULL, &len) != ESP_OK || len == 0 ||
+            len % elem_size != 0 || len > elem_size * per_chunk) {
+            break;
+        }
+        int n = (int)(len / elem_size);
+        if (n > want - got) {
+            // Read the whole chunk, keep what fits
+            uint8_t *tmp = malloc(len);
+            if (!tmp) break;
+            bool ok = (nvs_get_blob(h, key, tmp, &len) == ESP_OK);
+            if (ok) memcpy(out + got * elem_size, tmp, (want - got) * elem_size);
+            free(tmp);
+            if (!ok) break;
+            got = want;
+        } else {
+            if (nvs_get_blob(h, key, out + got * elem_size, &len) != ESP_OK) break;
+            got += n;
+        }
+    }
+
+    if (got < want) {
+        ESP_LOGW(PROV_TAG, "%s: only %d of %d entries readable", base, got, want);
+    }
+    *count = (uint8_t)got;
+    return true;
+}
+
+// Write a list as chunks, then erase chunks left over from a longer list and
+// the pre-chunking single blob.
+static esp_err_t save_list_chunks(nvs_handle_t h, const char *base, const void *src,
+                                  size_t elem_size, int per_chunk, int count)
+{
+    char key[16];
+    const uint8_t *in = (const uint8_t *)src;
+    int chunks = (count + per_chunk - 1) / per_chunk;
+
+    for (int c = 0; c < chunks; c++) {
+        int n = count - c * per_chunk;
+        if (n > per_chunk) n = per_chunk;
+        chunk_key(key, base, c);
+        esp_err_t err = nvs_set_blob(h, key, in + c * per_chunk * elem_size, n * elem_size);
+        if (err != ESP_OK) return err;
+    }
+    for (int c = chunks; c < PROV_MAX_CHUNKS; c++) {
+        chunk_key(key, base, c);
+        if (nvs_erase_key(h, key) == ESP_ERR_NVS_NOT_FOUND) break;
+    }
+    nvs_erase_key(h, base);   // legacy single blob, usually absent
+    return ESP_OK;
+}
+
 bool provisioning_init(void)
 {
     if (g_initialized) {
@@ -63,7 +230,7 @@ bool provisioning_init(void)
         ESP_LOGI(PROV_TAG, "State: %s", 
                  g_config.state == PROV_STATE_PROVISIONED ? "PROVISIONED" : "UNPROVISIONED");
         if (g_config.state == PROV_STATE_PROVISIONED) {
-            ESP_LOGI(PROV_TAG, "Valve MAC: %s", g_config.valve_mac);
+            log_valve_macs(&g_config);
             ESP_LOGI(PROV_TAG, "LoRa sensors: %d", g_config.lora_sensor_count);
             ESP_LOGI(PROV_TAG, "BLE leak sensors: %d", g_config.ble_leak_sensor_count);
         }
@@ -74,6 +241,8 @@ bool provisioning_init(void)
         ESP_LOGI(PROV_TAG, "No existing config found, starting UNPROVISIONED");
     }
 
+    sync_registry_locked();
+
     g_initialized = true;
     return true;
 }
@@ -152,13 +321,21 @@ bool provisioning_load_from_nvs(provisioning_config_t *config)
         goto cleanup;
     }
 
-    // Load valve MAC
-    size_t required_size = sizeof(config->valve_mac);
-    err = nvs_get_str(nvs_handle, NVS_KEY_VALVE_MAC, config->valve_mac, &required_size);
-    if (err != ESP_OK) {
-        ESP_LOGW(PROV_TAG, "Valve MAC not found");
-        success = false;
-        goto cleanup;
+    // Load valve MACs (slot 0 always written; further slots are optional so
+    // single-valve configs load unchanged)
+    for (int v = 0; v < MAX_VALVES; v++) {
+        char key[16];
+        valve_mac_key(key, v);
+        size_t required_size = sizeof(config->valve_macs[v]);
+        err = nvs_get_str(nvs_handle, key, config->valve_macs[v], &required_size);
+        if (err != ESP_OK) {
+            config->valve_macs[v][0] = '\0';
+            if (v == 0) {
+                ESP_LOGW(PROV_TAG, "Valve MAC not found");
+                success = false;
+                goto cleanup;
+            }
+        }
     }
 
     // Load LoRa sensor count
@@ -169,9 +346,9 @@ bool provisioning_load_from_nvs(provisioning_config_t *config)
 
     // Load LoRa sensor IDs
     if (config->lora_sensor_count > 0) {
-        required_size = sizeof(config->lora_sensor_ids);
-        err = nvs_get_blob(nvs_handle, NVS_KEY_LORA_IDS, config->lora_sensor_ids, &required_size);
-        if (err != ESP_OK) {
+        if (!load_list_chunks(nvs_handle, NVS_KEY_LORA_IDS, config->lora_sensor_ids,
+                              sizeof(uint32_t), PROV_LORA_PER_CHUNK, MAX_LORA_SENSORS,
+                              &config->lora_sensor_count)) {
             ESP_LOGW(PROV_TAG, "Failed to load LoRa sensor IDs");
             config->lora_sensor_count = 0;
         }
@@ -185,9 +362,9 @@ bool provisioning_load_from_nvs(provisioning_config_t *config)
 
     // Load BLE leak sensor MACs
     if (config->ble_leak_sensor_count > 0) {
-        required_size = sizeof(config->ble_leak_sensors);
-        err = nvs_get_blob(nvs_handle, NVS_KEY_LEAK_MACS, config->ble_leak_sensors, &required_size);
-        if (err != ESP_OK) {
+        if (!load_list_chunks(nvs_handle, NVS_KEY_LEAK_MACS, config->ble_leak_sensors,
+                              18, PROV_LEAK_PER_CHUNK, MAX_BLE_LEAK_SENSORS,
+                              &config->ble_leak_sensor_count)) {
             ESP_LOGW(PROV_TAG, "Failed to load BLE leak sensor MACs");
             config->ble_leak_sensor_count = 0;
         }
@@ -240,12 +417,21 @@ bool provisioning_save_to_nvs(const provisioning_config_t *config)
         goto cleanup;
     }
 
-    // Save valve MAC
-    err = nvs_set_str(nvs_handle, NVS_KEY_VALVE_MAC, config->valve_mac);
-    if (err != ESP_OK) {
-        ESP_LOGE(PROV_TAG, "Failed to save valve MAC");
-        success = false;
-        goto cleanup;
+    // Save valve MACs; empty slots past 0 are erased rather than stored as ""
+    for (int v = 0; v < MAX_VALVES; v++) {
+        char key[16];
+        valve_mac_key(key, v);
+        if (v > 0 && config->valve_macs[v][0] == '\0') {
+            err = nvs_erase_key(nvs_handle, key);
+            if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+        } else {
+            err = nvs_set_str(nvs_handle, key, config->valve_macs[v]);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(PROV_TAG, "Failed to save valve[%d] MAC", v);
+            success = false;
+            goto cleanup;
+        }
     }
 
     // Save LoRa sensor count
@@ -257,15 +443,13 @@ bool provisioning_save_to_nvs(const provisioning_config_t *config)
     }
 
     // Save LoRa sensor IDs
-    if (config->lora_sensor_count > 0) {
-        err = nvs_set_blob(nvs_handle, NVS_KEY_LORA_IDS, 
-                          config->lora_sensor_ids, 
-                          sizeof(uint32_t) * config->lora_sensor_count);
-        if (err != ESP_OK) {
-            ESP_LOGE(PROV_TAG, "Failed to save LoRa IDs");
-            success = false;
-            goto cleanup;
-        }
+    err = save_list_chunks(nvs_handle, NVS_KEY_LORA_IDS, config->lora_sensor_ids,
+                           sizeof(uint32_t), PROV_LORA_PER_CHUNK,
+                           config->lora_sensor_count);
+    if (err != ESP_OK) {
+        ESP_LOGE(PROV_TAG, "Failed to save LoRa IDs");
+        success = false;
+        goto cleanup;
     }
 
     // Save BLE leak sensor count
@@ -277,15 +461,12 @@ bool provisioning_save_to_nvs(const provisioning_config_t *config)
     }
 
     // Save BLE leak sensor MACs
-    if (config->ble_leak_sensor_count > 0) {
-        err = nvs_set_blob(nvs_handle, NVS_KEY_LEAK_MACS,
-                          config->ble_leak_sensors,
-                          18 * config->ble_leak_sensor_count);
-        if (err != ESP_OK) {
-            ESP_LOGE(PROV_TAG, "Failed to save leak MACs");
-            success = false;
-            goto cleanup;
-        }
+    err = save_list_chunks(nvs_handle, NVS_KEY_LEAK_MACS, config->ble_leak_sensors,
+                           18, PROV_LEAK_PER_CHUNK, config->ble_leak_sensor_count);
+    if (err != ESP_OK) {
+        ESP_LOGE(PROV_TAG, "Failed to save leak MACs");
+        success = false;
+        goto cleanup;
     }
 
     // Save rules config
@@ -388,33 +569,87 @@ bool provisioning_handle_azure_payload_json(const char *json, size_t len)
         return false;
     }
 
+    // Working copy on the heap: with large capacity the config is several KB
+    provisioning_config_t *new_config = malloc(sizeof(provisioning_config_t));
+    if (!new_config) {
+        ESP_LOGE(PROV_TAG, "Failed to allocate config copy");
+        cJSON_Delete(root);
+        return false;
+    }
+
     // Acquire mutex for thread-safe config update
     if (xSemaphoreTake(g_prov_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
         ESP_LOGE(PROV_TAG, "Failed to acquire mutex for provisioning update");
         cJSON_Delete(root);
+        free(new_config);
         return false;
     }
 
-    provisioning_config_t new_config = g_config; // Start with current config
+    *new_config = g_config; // Start with current config
     bool has_updates = false;
 
-    // Parse valve_mac
+    // Parse valve_macs (one entry per valve slot, "" / null = no valve on
+    // that slot), then the single-valve valve_mac which sets slot 0
+    bool valve_ok = true;
+    cJSON *valve_macs_json = cJSON_GetObjectItem(root, "valve_macs");
+    if (valve_macs_json && cJSON_IsArray(valve_macs_json)) {
+        int array_size = cJSON_GetArraySize(valve_macs_json);
+        if (array_size > MAX_VALVES) {
+            ESP_LOGW(PROV_TAG, "Too many valves (%d), limiting to %d",
+                     array_size, MAX_VALVES);
+            array_size = MAX_VALVES;
+        }
+
+        memset(new_config->valve_macs, 0, sizeof(new_config->valve_macs));
+        for (int v = 0; v < array_size && valve_ok; v++) {
+            cJSON *mac = cJSON_GetArrayItem(valve_macs_json, v);
+            if (!cJSON_IsString(mac) || mac->valuestring[0] == '\0') {
+                continue;
+            }
+            if (validate_mac_string(mac->valuestring)) {
+                strncpy(new_config->valve_macs[v], mac->valuestring, 17);
+            } else {
+                ESP_LOGE(PROV_TAG, "Invalid valve[%d] MAC format: %s", v, mac->valuestring);
+                valve_ok = false;
+            }
+        }
+        has_updates = true;
+    }
+
     cJSON *valve_mac_json = cJSON_GetObjectItem(root, "valve_mac");
-    if (valve_mac_json && cJSON_IsString(valve_mac_json)) {
+    if (valve_ok && valve_mac_json && cJSON_IsString(valve_mac_json)) {
         const char *mac_str = valve_mac_json->valuestring;
         if (validate_mac_string(mac_str)) {
-            strncpy(new_config.valve_mac, mac_str, sizeof(new_config.valve_mac) - 1);
-            new_config.valve_mac[sizeof(new_config.valve_mac) - 1] = '\0';
-            ESP_LOGI(PROV_TAG, "Valve MAC: %s", new_config.valve_mac);
+            strncpy(new_config->valve_macs[0], mac_str, sizeof(new_config->valve_macs[0]) - 1);
+            new_config->valve_macs[0][sizeof(new_config->valve_macs[0]) - 1] = '\0';
             has_updates = true;
         } else {
             ESP_LOGE(PROV_TAG, "Invalid valve MAC format: %s", mac_str);
-            xSemaphoreGive(g_prov_mutex);
-            cJSON_Delete(root);
-            return false;
+            valve_ok = false;
         }
     }
 
+    // One valve per slot: the same MAC on two slots would fight over the link
+    for (int v = 0; valve_ok && v < MAX_VALVES; v++) {
+        for (int w = v + 1; w < MAX_VALVES; w++) {
+            if (new_config->valve_macs[v][0] != '\0' &&
+                strcasecmp(new_config->valve_macs[v], new_config->valve_macs[w]) == 0) {
+                ESP_LOGE(PROV_TAG, "Valve MAC %s on slots %d and %d",
+                         new_config->valve_macs[v], v, w);
+                valve_ok = false;
+                break;
+            }
+        }
+    }
+
+    if (!valve_ok) {
+        xSemaphoreGive(g_prov_mutex);
+        cJSON_Delete(root);
+        free(new_config);
+        return false;
+    }
+    log_valve_macs(new_config);
+
     // Parse lora_sensors
     cJSON *lora_sensors_json = cJSON_GetObjectItem(root, "lora_sensors");
     if (lora_sensors_json && cJSON_IsArray(lora_sensors_json)) {
@@ -425,15 +660,15 @@ bool provisioning_handle_azure_payload_json(const char *json, size_t len)
             array_size = MAX_LORA_SENSORS;
         }
 
-        new_config.lora_sensor_count = 0;
+        new_config->lora_sensor_count = 0;
         for (int i = 0; i < array_size; i++) {
             cJSON *sensor = cJSON_GetArrayItem(lora_sensors_json, i);
             if (cJSON_IsString(sensor)) {
                 uint32_t sensor_id;
                 if (parse_hex_id(sensor->valuestring, &sensor_id)) {
-                    new_config.lora_sensor_ids[new_config.lora_sensor_count++] = sensor_id;
+                    new_config->lora_sensor_ids[new_config->lora_sensor_count++] = sensor_id;
                     ESP_LOGI(PROV_TAG, "LoRa Sensor[%d]: 0x%08lX", 
-                             new_config.lora_sensor_count - 1, sensor_id);
+                             new_config->lora_sensor_count - 1, sensor_id);
                 } else {
                     ESP_LOGW(PROV_TAG, "Invalid LoRa sensor ID format: %s", 
                              sensor->valuestring);
@@ -453,19 +688,19 @@ bool provisioning_handle_azure_payload_json(const char *json, size_t len)
             array_size = MAX_BLE_LEAK_SENSORS;
         }
 
-        new_config.ble_leak_sensor_count = 0;
+        new_config->ble_leak_sensor_count = 0;
         for (int i = 0; i < array_size; i++) {
             cJSON *sensor = cJSON_GetArrayItem(ble_leak_json, i);
             if (cJSON_IsString(sensor)) {
                 const char *mac_str = sensor->valuestring;
                 if (validate_mac_string(mac_str)) {
-                    strncpy(new_config.ble_leak_sensors[new_config.ble_leak_sensor_count], 
+                    strncpy(new_config->ble_leak_sensors[new_config->ble_leak_sensor_count], 
                            mac_str, 18);
-                    new_config.ble_leak_sensors[new_config.ble_leak_sensor_count][17] = '\0';
+                    new_config->ble_leak_sensors[new_config->ble_leak_sensor_count][17] = '\0';
                     ESP_LOGI(PROV_TAG, "BLE Leak Sensor[%d]: %s", 
-                             new_config.ble_leak_sensor_count, 
-                             new_config.ble_leak_sensors[new_config.ble_leak_sensor_count]);
-                    new_config.ble_leak_sensor_count++;
+                             new_config->ble_leak_sensor_count, 
+                             new_config->ble_leak_sensors[new_config->ble_leak_sensor_count]);
+                    new_config->ble_leak_sensor_count++;
                 } else {
                     ESP_LOGW(PROV_TAG, "Invalid BLE leak sensor MAC format: %s", mac_str);
                 }
@@ -479,15 +714,15 @@ bool provisioning_handle_azure_payload_json(const char *json, size_t len)
     if (rules_json && cJSON_IsObject(rules_json)) {
         cJSON *auto_close = cJSON_GetObjectItem(rules_json, "auto_close_enabled");
         if (auto_close && cJSON_IsBool(auto_close)) {
-            new_config.rules.auto_close_enabled = cJSON_IsTrue(auto_close);
+            new_config->rules.auto_close_enabled = cJSON_IsTrue(auto_close);
         }
         cJSON *trigger_mask = cJSON_GetObjectItem(rules_json, "trigger_mask");
         if (trigger_mask && cJSON_IsNumber(trigger_mask)) {
-            new_config.rules.trigger_mask = (uint8_t)trigger_mask->valueint;
+            new_config->rules.trigger_mask = (uint8_t)trigger_mask->valueint;
         }
         ESP_LOGI(PROV_TAG, "Rules: auto_close=%s triggers=0x%02X",
-                 new_config.rules.auto_close_enabled ? "enabled" : "disabled",
-                 new_config.rules.trigger_mask);
+                 new_config->rules.auto_close_enabled ? "enabled" : "disabled",
+                 new_config->rules.trigger_mask);
         has_updates = true;
     }
 
@@ -496,28 +731,33 @@ bool provisioning_handle_azure_payload_json(const char *json, size_t len)
     if (!has_updates) {
         ESP_LOGW(PROV_TAG, "No valid provisioning data in JSON");
         xSemaphoreGive(g_prov_mutex);
+        free(new_config);
         return false;
     }
 
     // Mark as provisioned
-    new_config.state = PROV_STATE_PROVISIONED;
-    new_config.config_version = CURRENT_CONFIG_VERSION;
+    new_config->state = PROV_STATE_PROVISIONED;
+    new_config->config_version = CURRENT_CONFIG_VERSION;
 
     // Save to NVS (NVS operations are already thread-safe)
-    if (!provisioning_save_to_nvs(&new_config)) {
+    if (!provisioning_save_to_nvs(new_config)) {
         ESP_LOGE(PROV_TAG, "Failed to save provisioning data to NVS");
         xSemaphoreGive(g_prov_mutex);
+        free(new_config);
         return false;
     }
 
     // Update global config
-    memcpy(&g_config, &new_config, sizeof(provisioning_config_t));
+    memcpy(&g_config, new_config, sizeof(provisioning_config_t));
+    sync_registry_locked();
 
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
+    free(new_config);
 
     ESP_LOGI(PROV_TAG, "Provisioning completed successfully!");
     ESP_LOGI(PROV_TAG, "State: PROVISIONED");
-    ESP_LOGI(PROV_TAG, "Valve MAC: %s", g_config.valve_mac);
+    log_valve_macs(&g_config);
     ESP_LOGI(PROV_TAG, "LoRa sensors: %d", g_config.lora_sensor_count);
     ESP_LOGI(PROV_TAG, "BLE leak sensors: %d", g_config.ble_leak_sensor_count);
 
@@ -545,8 +785,10 @@ bool provisioning_decommission(void)
     g_config.state = PROV_STATE_UNPROVISIONED;
     g_config.rules.auto_close_enabled = true;
     g_config.rules.trigger_mask = RULES_TRIGGER_ALL;
+    sync_registry_locked();
 
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     // Erase from NVS
     nvs_handle_t nvs_handle;
@@ -580,16 +822,17 @@ bool provisioning_decommission(void)
     return true;
 }
 
-bool provisioning_get_valve_mac(char *mac_out)
+bool provisioning_get_valve_mac(int valve, char *mac_out)
 {
-    if (!mac_out || !g_initialized || g_prov_mutex == NULL) {
+    if (!mac_out || valve < 0 || valve >= MAX_VALVES ||
+        !g_initialized || g_prov_mutex == NULL) {
         return false;
     }
     
     bool result = false;
     if (xSemaphoreTake(g_prov_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        if (g_config.state == PROV_STATE_PROVISIONED && g_config.valve_mac[0] != '\0') {
-            strcpy(mac_out, g_config.valve_mac);
+        if (g_config.state == PROV_STATE_PROVISIONED && g_config.valve_macs[valve][0] != '\0') {
+            strcpy(mac_out, g_config.valve_macs[valve]);
             result = true;
         }
         xSemaphoreGive(g_prov_mutex);
@@ -602,26 +845,12 @@ bool provisioning_get_valve_mac(char *mac_out)
 
 bool provisioning_is_lora_sensor_provisioned(uint32_t sensor_id)
 {
-    if (!g_initialized || g_prov_mutex == NULL) {
+    if (!g_initialized) {
         return false;
     }
-    
-    bool result = false;
-    if (xSemaphoreTake(g_prov_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        if (g_config.state == PROV_STATE_PROVISIONED) {
-            for (int i = 0; i < g_config.lora_sensor_count; i++) {
-                if (g_config.lora_sensor_ids[i] == sensor_id) {
-                    result = true;
-                    break;
-                }
-            }
-        }
-        xSemaphoreGive(g_prov_mutex);
-    } else {
-        ESP_LOGW(PROV_TAG, "Failed to take mutex in is_lora_sensor_provisioned");
-    }
-    
-    return result;
+
+    // The registry only holds sensors while the hub is PROVISIONED
+    return device_registry_find_lora(sensor_id) != DEVREG_HANDLE_NONE;
 }
 
 bool provisioning_get_lora_sensors(uint32_t *ids_out, uint8_t *count_out)
@@ -683,25 +912,33 @@ bool provisioning_get_ble_leak_sensors(char macs_out[][18], uint8_t *count_out)
  * @brief Helper function to check if device should remain provisioned
  * 
  * Device stays provisioned if it has at least one device:
- * - Valve MAC is set, OR
+ * - A valve MAC is set, OR
  * - At least one LoRa sensor, OR
  * - At least one BLE leak sensor
  */
 static bool should_remain_provisioned(const provisioning_config_t *config)
 {
-    return (config->valve_mac[0] != '\0' ||
-            config->lora_sensor_count > 0 ||
+    for (int v = 0; v < MAX_VALVES; v++) {
+        if (config->valve_macs[v][0] != '\0') {
+            return true;
+        }
+    }
+    return (config->lora_sensor_count > 0 ||
             config->ble_leak_sensor_count > 0);
 }
 
-bool provisioning_remove_valve(void)
+bool provisioning_remove_valve(int valve)
 {
     if (!g_initialized || g_prov_mutex == NULL) {
         ESP_LOGE(PROV_TAG, "Provisioning manager not initialized");
         return false;
     }
+    if (valve < 0 || valve >= MAX_VALVES) {
+        ESP_LOGE(PROV_TAG, "Invalid valve slot %d", valve);
+        return false;
+    }
 
-    ESP_LOGW(PROV_TAG, "=== REMOVING VALVE ===");
+    ESP_LOGW(PROV_TAG, "=== REMOVING VALVE %d ===", valve);
 
     // Acquire mutex for thread-safe access
     if (xSemaphoreTake(g_prov_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
@@ -710,7 +947,7 @@ bool provisioning_remove_valve(void)
     }
 
     // Clear valve MAC
-    memset(g_config.valve_mac, 0, sizeof(g_config.valve_mac));
+    memset(g_config.valve_macs[valve], 0, sizeof(g_config.valve_macs[valve]));
     
     // Check if device should stay provisioned
     if (!should_remain_provisioned(&g_config)) {
@@ -720,8 +957,10 @@ bool provisioning_remove_valve(void)
 
     // Save updated config to NVS
     bool save_result = provisioning_save_to_nvs(&g_config);
+    sync_registry_locked();
     
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     if (save_result) {
         ESP_LOGI(PROV_TAG, "Valve removed successfully");
@@ -777,8 +1016,10 @@ bool provisioning_remove_lora_sensor(uint32_t sensor_id)
 
     // Save updated config to NVS
     bool save_result = provisioning_save_to_nvs(&g_config);
+    sync_registry_locked();
     
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     if (save_result) {
         ESP_LOGI(PROV_TAG, "LoRa sensor 0x%08lX removed successfully", sensor_id);
@@ -840,8 +1081,10 @@ bool provisioning_remove_ble_sensor(const char *mac)
 
     // Save updated config to NVS
     bool save_result = provisioning_save_to_nvs(&g_config);
+    sync_registry_locked();
     
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     if (save_result) {
         ESP_LOGI(PROV_TAG, "BLE leak sensor %s removed successfully", mac);
@@ -898,8 +1141,10 @@ bool provisioning_add_lora_sensor(uint32_t sensor_id)
 
     // Save updated config to NVS
     bool save_result = provisioning_save_to_nvs(&g_config);
+    sync_registry_locked();
     
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     if (save_result) {
         ESP_LOGI(PROV_TAG, "LoRa sensor 0x%08lX added successfully", sensor_id);
@@ -961,8 +1206,10 @@ bool provisioning_add_ble_sensor(const char *mac)
 
     // Save updated config to NVS
     bool save_result = provisioning_save_to_nvs(&g_config);
+    sync_registry_locked();
     
     xSemaphoreGive(g_prov_mutex);
+    notify_subscribers();
 
     if (save_result) {
         ESP_LOGI(PROV_TAG, "BLE leak sensor %s added successfully", mac);
@@ -974,6 +1221,33 @@ bool provisioning_add_ble_sensor(const char *mac)
     return save_result;
 }
 
+uint32_t provisioning_generation(void)
+{
+    return g_generation;
+}
+
+bool provisioning_subscribe(provisioning_change_cb_t cb, void *arg)
+{
+    if (!cb || !g_initialized || g_prov_mutex == NULL) {
+        return false;
+    }
+    if (xSemaphoreTake(g_prov_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        return false;
+    }
+    bool ok = g_subscriber_count < PROV_MAX_SUBSCRIBERS;
+    if (ok) {
+        g_subscribers[g_subscriber_count].cb = cb;
+        g_subscribers[g_subscriber_count].arg = arg;
+        g_subscriber_count++;
+    }
+    xSemaphoreGive(g_prov_mutex);
+
+    if (!ok) {
+        ESP_LOGE(PROV_TAG, "Too many change subscribers (max %d)", PROV_MAX_SUBSCRIBERS);
+    }
+    return ok;
+}
+
 bool provisioning_get_rules_config(rules_config_t *rules_out)
 {
     if (!rules_out || !g_initialized || g_prov_mutex == NULL) {
@@ -5,13 +5,16 @@
 #include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "device_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define MAX_LORA_SENSORS 16
-#define MAX_BLE_LEAK_SENSORS 16
+// Set in menuconfig (eFloStop Hub -> Device capacity)
+#define MAX_VALVES DEVREG_MAX_VALVES
+#define MAX_LORA_SENSORS DEVREG_MAX_LORA
+#define MAX_BLE_LEAK_SENSORS DEVREG_MAX_BLE
 
 typedef enum {
     PROV_STATE_UNPROVISIONED = 0,
@@ -30,7 +33,7 @@ typedef struct {
 } rules_config_t;
 
 typedef struct {
-    char valve_mac[18];                              // "XX:XX:XX:XX:XX:XX"
+    char valve_macs[MAX_VALVES][18];                 // "XX:XX:XX:XX:XX:XX" per valve slot, "" = empty
     uint32_t lora_sensor_ids[MAX_LORA_SENSORS];      // Array of sensor IDs
     uint8_t lora_sensor_count;                       // Number of valid sensor IDs
     char ble_leak_sensors[MAX_BLE_LEAK_SENSORS][18]; // Array of MAC addresses
@@ -40,6 +43,14 @@ typedef struct {
     rules_config_t rules;                            // D2D rules engine config
 } provisioning_config_t;
 
+/**
+ * @brief Device-list change callback (see provisioning_subscribe).
+ * @param generation  provisioning_generation() after the change
+ */
+typedef void (*provisioning_change_cb_t)(uint32_t generation, void *arg);
+
+#define PROV_MAX_SUBSCRIBERS 6
+
 /**
  * @brief Initialize provisioning manager and load config from NVS
  * 
@@ -102,11 +113,12 @@ bool provisioning_decommission(void);
 /**
  * @brief Remove valve from provisioning (selective decommission)
  * 
- * Removes valve MAC and updates state to UNPROVISIONED if no other devices remain
+ * Removes the MAC of one valve slot and updates state to UNPROVISIONED if no other devices remain
  * 
+ * @param valve Valve slot (0..MAX_VALVES-1)
  * @return true if removal successful
  */
-bool provisioning_remove_valve(void);
+bool provisioning_remove_valve(int valve);
 
 /**
  * @brief Remove specific LoRa sensor from provisioning (selective decommission)
@@ -147,14 +159,18 @@ bool provisioning_add_ble_sensor(const char *mac);
 /**
  * @brief Get valve MAC address
  * 
+ * @param valve Valve slot (0..MAX_VALVES-1)
  * @param mac_out Output buffer (must be at least 18 bytes)
- * @return true if valve MAC is available
+ * @return true if a MAC is provisioned for that slot
  */
-bool provisioning_get_valve_mac(char *mac_out);
+bool provisioning_get_valve_mac(int valve, char *mac_out);
 
 /**
  * @brief Check if a LoRa sensor ID is provisioned
  * 
+ * Hash lookup in the device registry (no provisioning mutex); callers that need the
+ * per-device handle should use device_registry_find_lora() directly.
+ * 
  * @param sensor_id Sensor ID to check
  * @return true if sensor is provisioned
  */
@@ -178,6 +194,25 @@ bool provisioning_get_lora_sensors(uint32_t *ids_out, uint8_t *count_out);
  */
 bool provisioning_get_ble_leak_sensors(char macs_out[][18], uint8_t *count_out);
 
+/**
+ * @brief Device-list generation. Bumped by every successful provision,
+ *        add, remove and decommission, after the device registry has been
+ *        updated. Lock-free.
+ */
+uint32_t provisioning_generation(void);
+
+/**
+ * @brief Register a callback run after every device-list change.
+ *
+ * Callbacks run in the task that made the change, after the provisioning
+ * mutex is released and the device registry is in sync, in subscription
+ * order. Keep them short (rebuild an index or wake a task); they may call
+ * the provisioning getters but not change provisioning.
+ *
+ * @return false if PROV_MAX_SUBSCRIBERS are already registered
+ */
+bool provisioning_subscribe(provisioning_change_cb_t cb, void *arg);
+
 /**
  * @brief Get current rules engine configuration
  */
@@ -4,14 +4,17 @@
 #include <strings.h>
 #include <time.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "cJSON.h"
 #include "nvs.h"
 #include "nvs_store/nvs_store.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "provisioning_manager.h"
+#include "device_registry.h"
 #include "app_ble_valve.h"
 #include "sensor_meta.h"
+#include "leak_latency.h"
 
 #define RULES_TAG "RULES_ENGINE"
 #define AUTO_CLOSE_COOLDOWN_MS 10000   // 10s cooldown between auto-closes
@@ -33,14 +36,26 @@
  * reachable before the window is committed (window starts at execution, not
  * receipt). Sized to stay within the app's 20s cmd_ack timeout. */
 #define OVERRIDE_CONNECT_TIMEOUT_MS  10000
+/* Valve open after an override_enable: write response + confirming notify.
+ * Reconnect + open stays within the same 20s. */
+#define OVERRIDE_OPEN_TIMEOUT_MS     8000
 #define NVS_OVERRIDE_NAMESPACE       "rules_eng"
 #define NVS_KEY_OVR_STATE            "ovr_state"
 #define NVS_KEY_OVR_EXPIRY           "ovr_expiry"
 /* Persist the incident latch so a hub reboot doesn't lose the fact that
  * a leak incident was active. Combined with the valve's persisted RMLEAK,
- * this lets us detect an off-line physical override on reconnect. */
+ * this lets us detect an off-line physical override on reconnect. Stored as
+ * the per-valve bitmask, so the single-valve value 1 reads back as valve 0. */
 #define NVS_KEY_INCIDENT             "incident"
 
+// Bitmask helpers for per-valve state (bit n = valve n)
+#define VALVE_BIT(v)                 ((uint8_t)(1u << (v)))
+#define VALVE_MASK_ALL               ((uint8_t)((1u << BLE_VALVE_MAX) - 1))
+#define for_each_valve(v, mask) \
+    for (int v = 0; v < BLE_VALVE_MAX; v++) if ((mask) & VALVE_BIT(v))
+
+_Static_assert(BLE_VALVE_MAX <= 8, "Per-valve masks are uint8_t");
+
 // Minimum epoch value to consider time "synced" (2024-01-01 00:00:00 UTC)
 #define EPOCH_VALID_THRESHOLD        1704067200
 
@@ -53,11 +68,13 @@ typedef enum {
     OVERRIDE_STATE_ACTIVE   = 1,
 } override_state_t;
 
+// Incident state is kept per valve: a leak latches, closes and later clears
+// only the valves its source targets (sensor metadata valve mask).
 static bool g_initialized = false;
-static bool g_auto_close_triggered = false;
-static bool g_leak_incident_active = false;  // Latched: stays true until explicit LEAK_RESET
-static TickType_t g_last_auto_close_tick = 0;
-static TickType_t g_rmleak_assert_tick = 0;  // When RMLEAK was last written — grace period for override check
+static uint8_t g_auto_close_valves = 0;      // Valves an auto-close was issued to
+static uint8_t g_incident_valves = 0;        // Latched per valve: stays set until LEAK_RESET / auto-clear
+static TickType_t g_last_auto_close_tick[BLE_VALVE_MAX];
+static TickType_t g_rmleak_assert_tick[BLE_VALVE_MAX];  // When RMLEAK was last written — grace period for override check
 static SemaphoreHandle_t g_mutex = NULL;
 
 // 24h override window state
@@ -66,16 +83,31 @@ static time_t g_override_window_expiry = 0;  // Unix epoch when window expires (
 static TickType_t g_last_blocked_event_tick = 0;
 
 // Tracks valve ready-state transitions to detect reconnect in tick()
-static bool g_valve_was_ready = false;
+static uint8_t g_valve_was_ready = 0;
+
+// Valve link profile last requested per valve: -1 none, else incident active (fast)
+static int8_t g_link_fast_requested[BLE_VALVE_MAX];
+
+// Remote override_enable waiting for the valve to become ready. Set from the
+// C2D handler (MQTT task), executed or timed out by tick (IoT Hub task).
+static struct {
+    bool active;
+    TickType_t deadline;
+    override_enable_cb_t cb;
+    void *ctx;
+} g_override_req;
+static portMUX_TYPE g_override_req_lock = portMUX_INITIALIZER_UNLOCKED;
 
 // Pending auto-close telemetry (built by rules engine, consumed by IoT Hub)
 static char *g_pending_telemetry = NULL;
 
-// Active leak source tracking for auto-clear timeout
+// Active leak source tracking for auto-clear timeout, with the valves each
+// source targets
 #define MAX_ACTIVE_LEAK_SOURCES 16
 static char g_active_leak_ids[MAX_ACTIVE_LEAK_SOURCES][18];
+static uint8_t g_active_leak_valves[MAX_ACTIVE_LEAK_SOURCES];
 static uint8_t g_active_leak_count = 0;
-static TickType_t g_all_clear_since = 0;  // 0 = not yet all clear
+static TickType_t g_all_clear_since[BLE_VALVE_MAX];  // per valve, 0 = not yet all clear
 
 // ─── NVS Persistence for Override Window ─────────────────────────────────────
 
@@ -118,10 +150,10 @@ static void incident_save_to_nvs(void)
         ESP_LOGE(RULES_TAG, "NVS open failed for incident save: %s", esp_err_to_name(err));
         return;
     }
-    nvs_set_u8(h, NVS_KEY_INCIDENT, g_leak_incident_active ? 1 : 0);
+    nvs_set_u8(h, NVS_KEY_INCIDENT, g_incident_valves);
     nvs_commit(h);
     nvs_close(h);
-    ESP_LOGD(RULES_TAG, "NVS: incident=%d saved", g_leak_incident_active);
+    ESP_LOGD(RULES_TAG, "NVS: incident=0x%02X saved", g_incident_valves);
 }
 
 static void incident_load_from_nvs(void)
@@ -129,15 +161,16 @@ static void incident_load_from_nvs(void)
     nvs_handle_t h;
     esp_err_t err = nvs_open_from_partition(NVS_PROV_PARTITION, NVS_OVERRIDE_NAMESPACE, NVS_READONLY, &h);
     if (err != ESP_OK) {
-        g_leak_incident_active = false;
+        g_incident_valves = 0;
         return;
     }
     uint8_t v = 0;
     err = nvs_get_u8(h, NVS_KEY_INCIDENT, &v);
     nvs_close(h);
-    g_leak_incident_active = (err == ESP_OK && v != 0);
-    if (g_leak_incident_active) {
-        ESP_LOGW(RULES_TAG, "NVS: restored incident latch — pending reconcile with valve");
+    g_incident_valves = (err == ESP_OK) ? (v & VALVE_MASK_ALL) : 0;
+    if (g_incident_valves) {
+        ESP_LOGW(RULES_TAG, "NVS: restored incident latch (valves 0x%02X) — pending reconcile with valve",
+                 g_incident_valves);
     }
 }
 
@@ -275,57 +308,183 @@ static sensor_type_t source_to_sensor_type(leak_source_t source)
     }
 }
 
+// Valves with a commissioned MAC
+static uint8_t provisioned_valves(void)
+{
+    uint8_t mask = 0;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        if (device_registry_in_use((dev_handle_t)(DEVREG_HANDLE_VALVE + v))) {
+            mask |= VALVE_BIT(v);
+        }
+    }
+    return mask;
+}
+
+// Valves a leak from this source closes. A valve's own flood probe closes
+// that valve (source_id is its MAC); a sensor closes the valves in its
+// metadata valve mask. No mask, or one naming only valves that are not
+// commissioned, falls back to every commissioned valve so a leak never
+// closes nothing.
+static uint8_t leak_target_valves(leak_source_t source, const char *source_id)
+{
+    uint8_t all = provisioned_valves();
+    if (!source_id) return all;
+
+    dev_handle_t h;
+    switch (source) {
+        case LEAK_SOURCE_VALVE_FLOOD:
+            h = device_registry_find_id_str(DEVREG_VALVE, source_id);
+            return (h != DEVREG_HANDLE_NONE)
+                ? VALVE_BIT(device_registry_valve_slot(h)) : all;
+        case LEAK_SOURCE_LORA:
+            h = device_registry_find_id_str(DEVREG_LORA, source_id);
+            break;
+        default:
+            h = device_registry_find_id_str(DEVREG_BLE_LEAK, source_id);
+            break;
+    }
+
+    uint8_t mask = (h != DEVREG_HANDLE_NONE) ? sensor_meta_valve_mask_by_handle(h) : 0;
+    mask &= all;
+    return mask ? mask : all;
+}
+
+// Valves targeted by at least one active leak source. Must be called with g_mutex held.
+static uint8_t active_leak_valves(void)
+{
+    uint8_t mask = 0;
+    for (int i = 0; i < g_active_leak_count; i++) {
+        mask |= g_active_leak_valves[i];
+    }
+    return mask;
+}
+
+static void add_valve_list(cJSON *obj, uint8_t mask)
+{
+    cJSON *arr = cJSON_CreateArray();
+    for_each_valve(v, mask) {
+        cJSON_AddItemToArray(arr, cJSON_CreateNumber(v));
+    }
+    cJSON_AddItemToObject(obj, "valves", arr);
+}
+
+// RMLEAK then close on each valve that is connected, reconnect the others
+// (reconciliation closes on connect). Call without g_mutex held.
+//
+// Order matters for telemetry correctness: ble_valve_set_rmleak() silently
+// updates the cached RMLEAK state, then ble_valve_close() updates the
+// cached valve state AND wakes the iothub task via BLE_UPD_STATE. By
+// issuing RMLEAK first, the cached RMLEAK is already true when the
+// valve_state_changed event is built, so it correctly reports rmleak=true
+// alongside the close. (Reverse order races the telemetry build against
+// the RMLEAK cache update and emits rmleak=false on the close event.)
+static void close_valves(uint8_t mask)
+{
+    for_each_valve(v, mask) {
+        if (ble_valve_is_connected(v)) {
+            ble_valve_set_rmleak(v, true);
+            ble_valve_close(v);
+        } else {
+            ble_valve_connect(v);
+        }
+    }
+}
+
+// Mark an auto-close on these valves. Must be called with g_mutex held.
+static void latch_auto_close(uint8_t mask)
+{
+    TickType_t now = xTaskGetTickCount();
+    if (mask & ~g_incident_valves) {
+        g_incident_valves |= mask;
+        incident_save_to_nvs();
+    }
+    g_auto_close_valves |= mask;
+    for_each_valve(v, mask) {
+        g_rmleak_assert_tick[v] = now;
+        g_all_clear_since[v] = 0;
+    }
+}
+
 // Must be called with g_mutex held
-static void track_leak_source(const char *source_id, bool leak_active)
+static void track_leak_source(const char *source_id, bool leak_active, uint8_t valves)
 {
     if (!source_id) return;
 
     if (leak_active) {
         // Add to tracking table if not already present
-        for (int i = 0; i < g_active_leak_count; i++) {
-            if (strcmp(g_active_leak_ids[i], source_id) == 0) return;
+        int i;
+        for (i = 0; i < g_active_leak_count; i++) {
+            if (strcmp(g_active_leak_ids[i], source_id) == 0) break;
         }
-        if (g_active_leak_count < MAX_ACTIVE_LEAK_SOURCES) {
+        if (i == g_active_leak_count && g_active_leak_count < MAX_ACTIVE_LEAK_SOURCES) {
             strncpy(g_active_leak_ids[g_active_leak_count], source_id, 17);
             g_active_leak_ids[g_active_leak_count][17] = '\0';
             g_active_leak_count++;
         }
-        g_all_clear_since = 0;  // Reset timer whenever any source reports leak
-    } else {
-        // Remove from tracking table
-        for (int i = 0; i < g_active_leak_count; i++) {
-            if (strcmp(g_active_leak_ids[i], source_id) == 0) {
-                for (int j = i; j < g_active_leak_count - 1; j++) {
-                    strcpy(g_active_leak_ids[j], g_active_leak_ids[j + 1]);
-                }
-                g_active_leak_count--;
-                break;
-            }
+        if (i < g_active_leak_count) {
+            g_active_leak_valves[i] = valves;   // follows metadata edits
         }
-        if (g_active_leak_count == 0) {
-            // Cancel any pending auto-close commands that haven't been applied yet.
-            // This prevents stale CLOSE/RMLEAK from firing on reconnect after the
-            // leak has already resolved. Only cancels if auto-close set them.
-            if (g_auto_close_triggered) {
-                ble_valve_cancel_pending_close();
-                ESP_LOGI(RULES_TAG, "All leaks resolved — pending auto-close cancelled");
-                g_auto_close_triggered = false;
-            }
-            // Note: override window is NOT lifted when sensors clear — it is purely
-            // time-based (24h) and only cleared by expiry, C2D override_cancel, or LEAK_RESET.
-
-            // If incident is active, start auto-clear timer
-            if (g_leak_incident_active && g_all_clear_since == 0) {
-                g_all_clear_since = xTaskGetTickCount();
-                if (g_all_clear_since == 0) g_all_clear_since = 1;  // Avoid sentinel confusion
-                ESP_LOGI(RULES_TAG, "All sensors clear — auto-clear timer started (%ds)",
-                         AUTO_CLEAR_TIMEOUT_MS / 1000);
+        // Reset the timer of every valve this source reports a leak for
+        for_each_valve(v, valves) {
+            g_all_clear_since[v] = 0;
+        }
+        return;
+    }
+
+    // Remove from tracking table
+    for (int i = 0; i < g_active_leak_count; i++) {
+        if (strcmp(g_active_leak_ids[i], source_id) == 0) {
+            for (int j = i; j < g_active_leak_count - 1; j++) {
+                strcpy(g_active_leak_ids[j], g_active_leak_ids[j + 1]);
+                g_active_leak_valves[j] = g_active_leak_valves[j + 1];
             }
+            g_active_leak_count--;
+            break;
+        }
+    }
+
+    // Valves no remaining source targets
+    uint8_t dry = VALVE_MASK_ALL & ~active_leak_valves();
+
+    // Cancel any pending auto-close commands that haven't been applied yet.
+    // This prevents stale CLOSE/RMLEAK from firing on reconnect after the
+    // leak has already resolved. Only cancels if auto-close set them.
+    for_each_valve(v, g_auto_close_valves & dry) {
+        ble_valve_cancel_pending_close(v);
+        ESP_LOGI(RULES_TAG, "Valve %d: all leaks resolved — pending auto-close cancelled", v);
+    }
+    g_auto_close_valves &= ~dry;
+    // Note: override window is NOT lifted when sensors clear — it is purely
+    // time-based (24h) and only cleared by expiry, C2D override_cancel, or LEAK_RESET.
+
+    // If incident is active, start auto-clear timer
+    for_each_valve(v, g_incident_valves & dry) {
+        if (g_all_clear_since[v] != 0) continue;
+        g_all_clear_since[v] = xTaskGetTickCount();
+        if (g_all_clear_since[v] == 0) g_all_clear_since[v] = 1;  // Avoid sentinel confusion
+        ESP_LOGI(RULES_TAG, "Valve %d: all sensors clear — auto-clear timer started (%ds)",
+                 v, AUTO_CLEAR_TIMEOUT_MS / 1000);
+    }
+}
+
+// Short connection interval on a valve link while its incident is latched,
+// relaxed otherwise. Unlocked read of the latch: a stale value is corrected
+// on the next tick.
+static void sync_valve_link_profile(void)
+{
+    uint8_t incident = g_incident_valves;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        int8_t fast = (incident & VALVE_BIT(v)) ? 1 : 0;
+        if (fast == g_link_fast_requested[v]) continue;
+
+        if (ble_valve_set_link_profile(v, fast ? BLE_VALVE_LINK_FAST : BLE_VALVE_LINK_RELAXED)) {
+            g_link_fast_requested[v] = fast;
         }
     }
 }
 
-static void build_auto_close_telemetry(leak_source_t source, const char *source_id)
+static void build_auto_close_telemetry(leak_source_t source, const char *source_id,
+                                       uint8_t valves, uint32_t incident_id, int64_t detect_us)
 {
     cJSON *root = cJSON_CreateObject();
     if (!root) return;
@@ -334,6 +493,16 @@ static void build_auto_close_telemetry(leak_source_t source, const char *source_
     cJSON_AddStringToObject(root, "source_type", source_to_str(source));
     cJSON_AddStringToObject(root, "sensor_id", source_id ? source_id : "unknown");
     cJSON_AddBoolToObject(root, "rmleak_asserted", true);
+    add_valve_list(root, valves);
+
+    // Breakdown to the valve-closed notify follows as "auto_close_latency"
+    if (incident_id) {
+        cJSON_AddNumberToObject(root, "incident_id", incident_id);
+    }
+    if (detect_us > 0) {
+        cJSON_AddNumberToObject(root, "detect_to_rules_ms",
+                                (double)((esp_timer_get_time() - detect_us) / 1000));
+    }
 
     // Add location if available
     if (source_id && source != LEAK_SOURCE_VALVE_FLOOD) {
@@ -377,6 +546,8 @@ void rules_engine_init(void)
         ESP_LOGI(RULES_TAG, "Initialized with defaults (auto_close=enabled triggers=ALL)");
     }
 
+    memset(g_link_fast_requested, -1, sizeof(g_link_fast_requested));
+
     // Restore override window from NVS (survives power cycle)
     override_load_from_nvs();
 
@@ -388,7 +559,8 @@ void rules_engine_init(void)
     g_initialized = true;
 }
 
-void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const char *source_id)
+void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const char *source_id,
+                                int64_t detect_us)
 {
     if (!g_initialized) return;
 
@@ -397,8 +569,9 @@ void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const ch
         return;
     }
 
-    // Track active leak sources for auto-clear timeout
-    track_leak_source(source_id, leak_active);
+    // Track active leak sources (and the valves they close) for auto-clear timeout
+    uint8_t valves = leak_target_valves(source, source_id);
+    track_leak_source(source_id, leak_active, valves);
 
     // Only act on leak-detected events for auto-close
     if (!leak_active) {
@@ -436,13 +609,20 @@ void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const ch
         return;
     }
 
+    if (!valves) {
+        ESP_LOGD(RULES_TAG, "No valve commissioned, ignoring leak from %s",
+                 source_id ? source_id : "unknown");
+        xSemaphoreGive(g_mutex);
+        return;
+    }
+
     // Latch the leak incident ALWAYS — even during override window.
     // This ensures the system knows about the incident when the window expires
     // and can immediately auto-close.
-    if (!g_leak_incident_active) {
-        ESP_LOGW(RULES_TAG, "LEAK INCIDENT latched by %s sensor %s",
-                 source_to_str(source), source_id ? source_id : "unknown");
-        g_leak_incident_active = true;
+    if (valves & ~g_incident_valves) {
+        ESP_LOGW(RULES_TAG, "LEAK INCIDENT latched by %s sensor %s (valves 0x%02X)",
+                 source_to_str(source), source_id ? source_id : "unknown", valves);
+        g_incident_valves |= valves;
         incident_save_to_nvs();
     }
 
@@ -481,54 +661,67 @@ void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const ch
         return;
     }
 
-    // Check if valve is already closed AND RMLEAK already asserted
-    int valve_state = ble_valve_get_state();
-    bool rmleak_already = ble_valve_get_rmleak_state();
-    if (valve_state == 0 && rmleak_already) {
-        ESP_LOGD(RULES_TAG, "Valve closed + RMLEAK active, no action needed");
-        xSemaphoreGive(g_mutex);
-        return;
-    }
-
-    // Check cooldown (only for the close+rmleak write, not for the latch)
+    // Per target valve: skip if already closed AND RMLEAK already asserted,
+    // or if its cooldown (close+rmleak write only, not the latch) is running
     TickType_t now = xTaskGetTickCount();
-    if (g_auto_close_triggered &&
-        (now - g_last_auto_close_tick) < pdMS_TO_TICKS(AUTO_CLOSE_COOLDOWN_MS)) {
-        ESP_LOGD(RULES_TAG, "Auto-close cooldown active, skipping");
+    uint8_t to_close = 0;
+    bool any_connected = false;
+    for_each_valve(v, valves) {
+        if (ble_valve_get_state(v) == 0 && ble_valve_get_rmleak_state(v)) {
+            ESP_LOGD(RULES_TAG, "Valve %d closed + RMLEAK active, no action needed", v);
+            continue;
+        }
+        if ((g_auto_close_valves & VALVE_BIT(v)) &&
+            (now - g_last_auto_close_tick[v]) < pdMS_TO_TICKS(AUTO_CLOSE_COOLDOWN_MS)) {
+            ESP_LOGD(RULES_TAG, "Valve %d auto-close cooldown active, skipping", v);
+            continue;
+        }
+        to_close |= VALVE_BIT(v);
+        any_connected |= ble_valve_is_connected(v);
+    }
+    if (!to_close) {
         xSemaphoreGive(g_mutex);
         return;
     }
 
     // === AUTO-CLOSE + RMLEAK: All conditions met ===
-    ESP_LOGW(RULES_TAG, "AUTO-CLOSE + RMLEAK triggered by %s sensor %s",
-             source_to_str(source), source_id ? source_id : "unknown");
-
-    g_auto_close_triggered = true;
-    g_last_auto_close_tick = now;
-    g_rmleak_assert_tick = now;  // Grace period: don't check valve override until BLE write propagates
+    ESP_LOGW(RULES_TAG, "AUTO-CLOSE + RMLEAK triggered by %s sensor %s (valves 0x%02X)",
+             source_to_str(source), source_id ? source_id : "unknown", to_close);
+
+    // Grace period: don't check valve override until BLE write propagates
+    latch_auto_close(to_close);
+    for_each_valve(v, to_close) {
+        g_last_auto_close_tick[v] = now;
+    }
+
+    // Time only closes that will be confirmed by a CLOSED notify after their
+    // write: close_valves() writes connected valves only, and a valve already
+    // reported closed sends no notify. With none connected, the closes the
+    // reconnect issues are timed instead.
+    uint8_t timed = 0;
+    for_each_valve(v, to_close) {
+        if (!any_connected || (ble_valve_is_connected(v) && ble_valve_get_state(v) != 0)) {
+            timed |= VALVE_BIT(v);
+        }
+    }
+    uint32_t incident_id = timed ? leak_latency_begin(source_to_str(source), source_id,
+                                                      detect_us, any_connected, timed)
+                                 : 0;
 
     // Build telemetry before releasing mutex
-    build_auto_close_telemetry(source, source_id);
+    build_auto_close_telemetry(source, source_id, to_close, incident_id, detect_us);
 
     xSemaphoreGive(g_mutex);
 
-    // Issue valve commands only if connected — avoids stale pending commands
-    // that would fire on reconnect even if the leak has since cleared.
-    // If disconnected, the reconciliation (on_valve_connected) handles it.
-    //
-    // Order matters for telemetry correctness: ble_valve_set_rmleak() silently
-    // updates the cached RMLEAK state, then ble_valve_close() updates the
-    // cached valve state AND wakes the iothub task via BLE_UPD_STATE. By
-    // issuing RMLEAK first, the cached RMLEAK is already true when the
-    // valve_state_changed event is built, so it correctly reports rmleak=true
-    // alongside the close. (Reverse order races the telemetry build against
-    // the RMLEAK cache update and emits rmleak=false on the close event.)
-    if (ble_valve_is_connected()) {
-        ble_valve_set_rmleak(true);
-        ble_valve_close();
-    } else {
-        ble_valve_connect();  // Trigger scan; reconciliation closes on connect
-    }
+    // Issue valve commands only to connected valves — avoids stale pending
+    // commands that would fire on reconnect even if the leak has since
+    // cleared. A disconnected valve is reconnected and the reconciliation
+    // (on_valve_connected) closes it.
+    close_valves(to_close);
+
+    // Behind the close on the command queue: the write goes out on the
+    // current interval, the notify and later commands get the short one
+    sync_valve_link_profile();
 }
 
 bool rules_engine_handle_config_command(const char *json_str)
@@ -622,12 +815,24 @@ bool rules_engine_is_leak_incident_active(void)
 
     bool active = false;
     if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        active = g_leak_incident_active;
+        active = (g_incident_valves != 0);
         xSemaphoreGive(g_mutex);
     }
     return active;
 }
 
+uint8_t rules_engine_get_incident_valves(void)
+{
+    if (!g_initialized) return 0;
+
+    uint8_t mask = 0;
+    if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        mask = g_incident_valves;
+        xSemaphoreGive(g_mutex);
+    }
+    return mask;
+}
+
 bool rules_engine_reset_leak_incident(void)
 {
     if (!g_initialized) return false;
@@ -650,13 +855,13 @@ bool rules_engine_reset_leak_incident(void)
     }
 
     // Always clear hub-side state, even if not latched (handles reboot scenario)
-    bool was_active = g_leak_incident_active;
-    g_leak_incident_active = false;
+    uint8_t was_active = g_incident_valves;
+    g_incident_valves = 0;
     incident_save_to_nvs();
-    g_auto_close_triggered = false;
-    g_all_clear_since = 0;
+    g_auto_close_valves = 0;
+    memset(g_all_clear_since, 0, sizeof(g_all_clear_since));
     g_active_leak_count = 0;
-    g_rmleak_assert_tick = 0;
+    memset(g_rmleak_assert_tick, 0, sizeof(g_rmleak_assert_tick));
 
     // Also clear override window — LEAK_RESET is a full reset that restores
     // normal auto-close behavior immediately.
@@ -665,17 +870,21 @@ bool rules_engine_reset_leak_incident(void)
         cancel_override_window();
     }
 
-    // Check if valve still has RMLEAK asserted (survives hub reboot)
-    bool valve_rmleak = ble_valve_get_rmleak_state();
+    // Check which valves still have RMLEAK asserted (survives hub reboot)
+    uint8_t valve_rmleak = 0;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        if (ble_valve_get_rmleak_state(v)) valve_rmleak |= VALVE_BIT(v);
+    }
 
     if (was_active || valve_rmleak || had_override) {
-        ESP_LOGW(RULES_TAG, "LEAK_RESET: clearing incident (hub_latch=%d, valve_rmleak=%d, override=%d)",
+        ESP_LOGW(RULES_TAG, "LEAK_RESET: clearing incident (hub_latch=0x%02X, valve_rmleak=0x%02X, override=%d)",
                  was_active, valve_rmleak, had_override);
 
         // Build reset telemetry
         cJSON *root = cJSON_CreateObject();
         if (root) {
             cJSON_AddStringToObject(root, "event", "rmleak_cleared");
+            add_valve_list(root, was_active | valve_rmleak);
             if (had_override) {
                 cJSON_AddBoolToObject(root, "override_cancelled", true);
             }
@@ -691,8 +900,8 @@ bool rules_engine_reset_leak_incident(void)
 
     // Always clear RMLEAK on valve — handles case where hub rebooted but
     // valve still has RMLEAK=1 from previous session
-    if (was_active || valve_rmleak) {
-        ble_valve_set_rmleak(false);
+    for_each_valve(v, was_active | valve_rmleak) {
+        ble_valve_set_rmleak(v, false);
     }
     return true;
 }
@@ -726,32 +935,24 @@ bool rules_engine_cancel_override(void)
     }
 
     // If leaks are currently active, immediately trigger auto-close evaluation.
-    // This ensures the valve closes as soon as the user re-enables auto-close,
+    // This ensures the valves close as soon as the user re-enables auto-close,
     // without waiting for the next leak event or tick cycle.
-    // Note: g_leak_incident_active may have been cleared during the override window
-    // (e.g., by auto-clear timer), so we check g_active_leak_count directly.
-    if (g_active_leak_count > 0) {
+    // Note: the incident latch may have been cleared during the override window
+    // (e.g., by auto-clear timer), so we check the active leak table directly.
+    uint8_t wet = active_leak_valves();
+    if (wet) {
         rules_config_t rules;
         if (provisioning_get_rules_config(&rules) && rules.auto_close_enabled) {
-            ESP_LOGW(RULES_TAG, "Override cancelled with %d active leak(s) — executing auto-close",
-                     g_active_leak_count);
+            ESP_LOGW(RULES_TAG, "Override cancelled with %d active leak(s) — executing auto-close (valves 0x%02X)",
+                     g_active_leak_count, wet);
 
-            g_leak_incident_active = true;  // Re-latch incident for auto-close path
-            incident_save_to_nvs();
-            g_auto_close_triggered = true;
-            g_rmleak_assert_tick = xTaskGetTickCount();
-            g_all_clear_since = 0;
+            latch_auto_close(wet);  // Re-latch incident for auto-close path
 
             xSemaphoreGive(g_mutex);
 
-            /* RMLEAK before close — see comment in rules_engine_evaluate_leak.
-             * Ensures the valve_state_changed event reports rmleak=true. */
-            if (ble_valve_is_connected()) {
-                ble_valve_set_rmleak(true);
-                ble_valve_close();
-            } else {
-                ble_valve_connect();
-            }
+            /* RMLEAK before close — ensures the valve_state_changed event
+             * reports rmleak=true. */
+            close_valves(wet);
             return true;
         }
     }
@@ -759,7 +960,7 @@ bool rules_engine_cancel_override(void)
     /* No active leaks at cancel time. The leak episode is over — wipe residual
      * incident state so the next leak starts a fresh auto-close cycle.
      *
-     * Without this, rules_engine_tick() would still see g_leak_incident_active
+     * Without this, rules_engine_tick() would still see g_incident_valves
      * latched from a since-cleared leak during the window, plus valve RMLEAK=0
      * (left over from the user's physical override that *started* the window),
      * and misread that as a brand-new physical override on the very next leak
@@ -768,11 +969,11 @@ bool rules_engine_cancel_override(void)
      * g_rmleak_assert_tick is also reset so the next ble_valve_set_rmleak(true)
      * gets a fresh grace period instead of inheriting a stale tick from a
      * prior auto-close many seconds ago. */
-    bool needs_save = g_leak_incident_active;
-    g_leak_incident_active = false;
-    g_auto_close_triggered = false;
-    g_all_clear_since = 0;
-    g_rmleak_assert_tick = 0;
+    bool needs_save = (g_incident_valves != 0);
+    g_incident_valves = 0;
+    g_auto_close_valves = 0;
+    memset(g_all_clear_since, 0, sizeof(g_all_clear_since));
+    memset(g_rmleak_assert_tick, 0, sizeof(g_rmleak_assert_tick));
     if (needs_save) {
         incident_save_to_nvs();
     }
@@ -781,51 +982,102 @@ bool rules_engine_cancel_override(void)
     return true;
 }
 
-override_enable_result_t rules_engine_enable_override_remote(void)
+// Caller's completion for the valve opens of an override_enable: reported
+// once every targeted valve has completed, first failure wins
+typedef struct {
+    override_enable_cb_t cb;
+    void *ctx;
+    int remaining;
+    override_enable_result_t result;
+} override_open_ctx_t;
+
+// Drop one reference; the last one reports. Completions arrive from the BLE
+// task, timers or a superseding submitter.
+static void override_open_release(override_open_ctx_t *oc, override_enable_result_t r)
 {
-    if (!g_initialized) return OVERRIDE_ENABLE_ERR_INTERNAL;
+    portENTER_CRITICAL(&g_override_req_lock);
+    if (oc->result == OVERRIDE_ENABLE_OK) oc->result = r;
+    bool last = (--oc->remaining == 0);
+    portEXIT_CRITICAL(&g_override_req_lock);
 
-    // ── Precondition 1: a valve must be provisioned to override ───────────
-    if (!provisioning_is_provisioned() || !ble_valve_has_target_mac()) {
-        ESP_LOGW(RULES_TAG, "override_enable: no valve provisioned");
-        return OVERRIDE_ENABLE_ERR_NOT_PROVISIONED;
+    if (last) {
+        oc->cb(oc->result, oc->ctx);
+        free(oc);
     }
+}
 
-    // ── Precondition 2: valve must be reachable. Bounded reconnect so the
-    // window starts at EXECUTION, never at receipt. Polls (not a busy-wait) and
-    // stays within the app's 20s cmd_ack timeout. ──────────────────────────
-    if (!ble_valve_is_ready()) {
-        ESP_LOGI(RULES_TAG, "override_enable: valve not ready — reconnecting (<=%dms)",
-                 OVERRIDE_CONNECT_TIMEOUT_MS);
-        ble_valve_connect();
-        TickType_t start = xTaskGetTickCount();
-        while (!ble_valve_is_ready()) {
-            if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(OVERRIDE_CONNECT_TIMEOUT_MS)) {
-                ESP_LOGW(RULES_TAG, "override_enable: valve unreachable after reconnect window");
-                return OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED;
-            }
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
+static void on_override_open_done(ble_valve_cmd_id_t id, ble_valve_cmd_status_t status, void *ctx)
+{
+    override_enable_result_t r;
+
+    switch (status) {
+        case BLE_VALVE_CMD_DONE:    r = OVERRIDE_ENABLE_OK; break;
+        case BLE_VALVE_CMD_TIMEOUT: r = OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED; break;
+        default:                    r = OVERRIDE_ENABLE_ERR_INTERNAL; break;
     }
+    ESP_LOGI(RULES_TAG, "override_enable: valve open #%lu %s",
+             (unsigned long)id, ble_valve_cmd_status_str(status));
+    override_open_release((override_open_ctx_t *)ctx, r);
+}
+
+// Valves a remote override opens: those with a latched incident or an
+// asserted RMLEAK, else (window refresh with nothing latched) every
+// commissioned valve. Unlocked read, like the single-valve checks it replaces.
+static uint8_t override_target_valves(void)
+{
+    uint8_t mask = g_incident_valves;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        if (ble_valve_get_rmleak_state(v)) mask |= VALVE_BIT(v);
+    }
+    mask &= provisioned_valves();
+    return mask ? mask : provisioned_valves();
+}
 
+static bool valves_ready(uint8_t mask)
+{
+    for_each_valve(v, mask) {
+        if (!ble_valve_is_ready(v)) return false;
+    }
+    return true;
+}
+
+// Preconditions 3 and 4, then execute. Target valves are ready.
+static override_enable_result_t override_remote_execute(override_enable_cb_t cb, void *ctx)
+{
     // ── Precondition 3: there must be something to override — an active
     // incident, an asserted valve RMLEAK, or an already-active window
     // (idempotent refresh). Reject pre-emptive use. (Query fns take the mutex,
     // so call them BEFORE acquiring it below.) ─────────────────────────────
     bool window_active = rules_engine_is_override_window_active();
     bool incident      = rules_engine_is_leak_incident_active();
-    bool valve_rmleak  = ble_valve_get_rmleak_state();
+    bool valve_rmleak  = false;
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        valve_rmleak |= ble_valve_get_rmleak_state(v);
+    }
     if (!window_active && !incident && !valve_rmleak) {
         ESP_LOGW(RULES_TAG, "override_enable: no active incident to override");
         return OVERRIDE_ENABLE_ERR_NO_INCIDENT;
     }
 
-    // ── Precondition 4: the valve's OWN flood probe is an absolute floor —
-    // no override (physical or remote) opens the valve while it stands in
+    // ── Precondition 4: a valve's OWN flood probe is an absolute floor —
+    // no override (physical or remote) opens a valve while it stands in
     // water; the valve would refuse/re-close anyway. ───────────────────────
-    if (ble_valve_get_leak()) {
-        ESP_LOGW(RULES_TAG, "override_enable: valve flood probe wet — refusing");
-        return OVERRIDE_ENABLE_ERR_VALVE_FLOOD;
+    uint8_t targets = override_target_valves();
+    for_each_valve(v, targets) {
+        if (ble_valve_get_leak(v)) {
+            ESP_LOGW(RULES_TAG, "override_enable: valve %d flood probe wet — refusing", v);
+            return OVERRIDE_ENABLE_ERR_VALVE_FLOOD;
+        }
+    }
+
+    override_open_ctx_t *oc = NULL;
+    if (cb) {
+        oc = malloc(sizeof(*oc));
+        if (!oc) return OVERRIDE_ENABLE_ERR_INTERNAL;
+        oc->cb = cb;
+        oc->ctx = ctx;
+        oc->result = OVERRIDE_ENABLE_OK;
+        oc->remaining = 1;  // held by this function until every open is queued
     }
 
     // ── Execute: window → clear RMLEAK → open ─────────────────────────────
@@ -836,50 +1088,160 @@ override_enable_result_t rules_engine_enable_override_remote(void)
     // auto-close between the RMLEAK clear and the open.
     if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
         ESP_LOGW(RULES_TAG, "override_enable: mutex timeout");
+        free(oc);
         return OVERRIDE_ENABLE_ERR_INTERNAL;
     }
-    g_leak_incident_active = false;
+    g_incident_valves = 0;
     incident_save_to_nvs();
-    g_auto_close_triggered = false;
-    g_all_clear_since = 0;
-    g_rmleak_assert_tick = 0;
+    g_auto_close_valves = 0;
+    memset(g_all_clear_since, 0, sizeof(g_all_clear_since));
+    memset(g_rmleak_assert_tick, 0, sizeof(g_rmleak_assert_tick));
     start_override_window("c2d_command");   /* persists NVS + queues telemetry */
     xSemaphoreGive(g_mutex);
 
     // RMLEAK must be cleared BEFORE the open — the valve refuses an open while
     // its remote_leak_active interlock is set (mirrors the physical button,
-    // which clears its local latch before driving the motor open).
-    ble_valve_set_rmleak(false);
-    ble_valve_open();
+    // which clears its local latch before driving the motor open). Both go
+    // through the valve's ordered command queue; the open reports completion.
+    int queued = 0;
+    for_each_valve(v, targets) {
+        if (oc) {
+            portENTER_CRITICAL(&g_override_req_lock);
+            oc->remaining++;
+            portEXIT_CRITICAL(&g_override_req_lock);
+        }
+        ble_valve_set_rmleak(v, false);
+        if (ble_valve_submit(v, BLE_VALVE_TARGET_STATE, 1, OVERRIDE_OPEN_TIMEOUT_MS,
+                             oc ? on_override_open_done : NULL, oc) == 0) {
+            ESP_LOGW(RULES_TAG, "override_enable: window started but valve %d open could not be queued", v);
+            if (oc) override_open_release(oc, OVERRIDE_ENABLE_ERR_INTERNAL);
+            continue;
+        }
+        queued++;
+    }
+
+    if (queued == 0) {
+        free(oc);
+        return OVERRIDE_ENABLE_ERR_INTERNAL;
+    }
 
-    ESP_LOGW(RULES_TAG, "override_enable: 24h override started remotely — RMLEAK cleared, valve opening");
+    ESP_LOGW(RULES_TAG, "override_enable: 24h override started remotely — RMLEAK cleared, %d valve(s) opening",
+             queued);
+    if (oc) {
+        // Drop this function's hold; the last completion reports
+        override_open_release(oc, OVERRIDE_ENABLE_OK);
+        return OVERRIDE_ENABLE_PENDING;
+    }
     return OVERRIDE_ENABLE_OK;
 }
 
+// Execute or time out a remote override_enable waiting for the valves
+static void override_req_service(void)
+{
+    bool ready = valves_ready(override_target_valves());
+
+    portENTER_CRITICAL(&g_override_req_lock);
+    if (!g_override_req.active ||
+        (!ready && (int32_t)(xTaskGetTickCount() - g_override_req.deadline) < 0)) {
+        portEXIT_CRITICAL(&g_override_req_lock);
+        return;
+    }
+    override_enable_cb_t cb = g_override_req.cb;
+    void *ctx = g_override_req.ctx;
+    g_override_req.active = false;
+    portEXIT_CRITICAL(&g_override_req_lock);
+
+    override_enable_result_t r;
+    if (ready) {
+        ESP_LOGI(RULES_TAG, "override_enable: valves ready — executing");
+        r = override_remote_execute(cb, ctx);
+    } else {
+        ESP_LOGW(RULES_TAG, "override_enable: valve unreachable after reconnect window");
+        r = OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED;
+    }
+    if (r != OVERRIDE_ENABLE_PENDING) {
+        cb(r, ctx);
+    }
+}
+
+override_enable_result_t rules_engine_enable_override_remote(override_enable_cb_t cb, void *ctx)
+{
+    if (!g_initialized) return OVERRIDE_ENABLE_ERR_INTERNAL;
+
+    // ── Precondition 1: a valve must be provisioned to override ───────────
+    uint8_t targets = provisioning_is_provisioned() ? override_target_valves() : 0;
+    if (!targets) {
+        ESP_LOGW(RULES_TAG, "override_enable: no valve provisioned");
+        return OVERRIDE_ENABLE_ERR_NOT_PROVISIONED;
+    }
+
+    if (valves_ready(targets)) {
+        return override_remote_execute(cb, ctx);
+    }
+
+    // ── Precondition 2: the valves must be reachable. Bounded reconnect so
+    // the window starts at EXECUTION, never at receipt. The request waits for
+    // rules_engine_tick() instead of blocking the IoT Hub task. ────────────
+    if (!cb) {
+        // No one to report a deferred result to
+        for_each_valve(v, targets) {
+            ble_valve_connect(v);
+        }
+        return OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED;
+    }
+    portENTER_CRITICAL(&g_override_req_lock);
+    bool busy = g_override_req.active;
+    if (!busy) {
+        g_override_req.active = true;
+        g_override_req.deadline = xTaskGetTickCount() + pdMS_TO_TICKS(OVERRIDE_CONNECT_TIMEOUT_MS);
+        g_override_req.cb = cb;
+        g_override_req.ctx = ctx;
+    }
+    portEXIT_CRITICAL(&g_override_req_lock);
+    if (busy) {
+        ESP_LOGW(RULES_TAG, "override_enable: earlier request still waiting for the valve");
+        return OVERRIDE_ENABLE_ERR_INTERNAL;
+    }
+
+    ESP_LOGI(RULES_TAG, "override_enable: valves 0x%02X not ready — reconnecting (<=%dms)",
+             targets, OVERRIDE_CONNECT_TIMEOUT_MS);
+    for_each_valve(v, targets) {
+        if (!ble_valve_is_ready(v)) ble_valve_connect(v);
+    }
+    return OVERRIDE_ENABLE_PENDING;
+}
+
 void rules_engine_reassert_rmleak_if_needed(void)
 {
     // Kept for backward compatibility — delegates to full reconnect handler
-    rules_engine_on_valve_connected();
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        if (ble_valve_is_ready(v)) {
+            rules_engine_on_valve_connected(v);
+        }
+    }
 }
 
-void rules_engine_on_valve_connected(void)
+void rules_engine_on_valve_connected(int valve)
 {
-    if (!g_initialized) return;
+    if (!g_initialized || valve < 0 || valve >= BLE_VALVE_MAX) return;
 
     if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(1000)) != pdTRUE) return;
 
+    const uint8_t bit = VALVE_BIT(valve);
+
     // Read actual valve characteristics for reconciliation logging
-    int valve_state = ble_valve_get_state();
-    bool valve_rmleak = ble_valve_get_rmleak_state();
-    bool valve_leak = ble_valve_get_leak();
+    int valve_state = ble_valve_get_state(valve);
+    bool valve_rmleak = ble_valve_get_rmleak_state(valve);
+    bool valve_leak = ble_valve_get_leak(valve);
+    uint8_t wet = active_leak_valves();
 
-    ESP_LOGI(RULES_TAG, "╔══ VALVE RECONNECT RECONCILIATION ══╗");
+    ESP_LOGI(RULES_TAG, "╔══ VALVE %d RECONNECT RECONCILIATION ══╗", valve);
     ESP_LOGI(RULES_TAG, "║ Valve: state=%s rmleak=%s flood=%s",
              valve_state == 1 ? "OPEN" : valve_state == 0 ? "CLOSED" : "UNKNOWN",
              valve_rmleak ? "ACTIVE" : "CLEAR",
              valve_leak ? "LEAK" : "OK");
-    ESP_LOGI(RULES_TAG, "║ Hub:   incident=%d leaks=%d override=%s",
-             g_leak_incident_active, g_active_leak_count,
+    ESP_LOGI(RULES_TAG, "║ Hub:   incident=%d leaks=%d (hub %d) override=%s",
+             (g_incident_valves & bit) != 0, (wet & bit) != 0, g_active_leak_count,
              g_override_state == OVERRIDE_STATE_ACTIVE ? "ACTIVE" : "INACTIVE");
 
     if (g_override_state == OVERRIDE_STATE_ACTIVE) {
@@ -889,13 +1251,13 @@ void rules_engine_on_valve_connected(void)
             ? (int32_t)(g_override_window_expiry - now) : -1;
         ESP_LOGI(RULES_TAG, "║ Override window: remaining=%lds", (long)remaining);
     }
-    ESP_LOGI(RULES_TAG, "╚════════════════════════════════════╝");
+    ESP_LOGI(RULES_TAG, "╚══════════════════════════════════════╝");
 
     // Refresh RMLEAK grace period on reconnect.  Pending commands (CLOSE + RMLEAK)
     // are being applied by the BLE valve task right now.  Without this, tick Check 2
     // could see stale RMLEAK=0 and falsely detect a physical override.
-    if (g_leak_incident_active || g_auto_close_triggered) {
-        g_rmleak_assert_tick = xTaskGetTickCount();
+    if ((g_incident_valves | g_auto_close_valves) & bit) {
+        g_rmleak_assert_tick[valve] = xTaskGetTickCount();
     }
 
     // ── Priority 0: Override window check ─────────────────────────────────
@@ -903,9 +1265,9 @@ void rules_engine_on_valve_connected(void)
     // The user has guaranteed water access for the remaining window duration.
     if (g_override_state == OVERRIDE_STATE_ACTIVE) {
         // Still sync hub incident latch with valve state
-        if (!g_leak_incident_active && valve_rmleak) {
-            ESP_LOGW(RULES_TAG, "Reconnected: valve RMLEAK active + override window — re-latching incident");
-            g_leak_incident_active = true;
+        if (!(g_incident_valves & bit) && valve_rmleak) {
+            ESP_LOGW(RULES_TAG, "Reconnected: valve %d RMLEAK active + override window — re-latching incident", valve);
+            g_incident_valves |= bit;
             incident_save_to_nvs();
         }
         ESP_LOGI(RULES_TAG, "Reconnected: override window active — skipping auto-close");
@@ -913,30 +1275,32 @@ void rules_engine_on_valve_connected(void)
         return;
     }
 
-    // ── Priority 1: Active leaks present → auto-close if enabled ──────────
+    // ── Priority 1: Active leaks targeting this valve → auto-close if enabled ──
     // This handles the case where leaks were detected while valve was offline.
     // Single evaluation regardless of how many sensors are leaking (anti-spam).
-    if (g_active_leak_count > 0) {
+    if (wet & bit) {
         rules_config_t rules;
         if (provisioning_get_rules_config(&rules) && rules.auto_close_enabled) {
-            ESP_LOGW(RULES_TAG, "Valve reconnected with %d active leak(s) — executing auto-close",
-                     g_active_leak_count);
+            ESP_LOGW(RULES_TAG, "Valve %d reconnected with active leak(s) — executing auto-close", valve);
 
-            g_leak_incident_active = true;
-            incident_save_to_nvs();
-            g_auto_close_triggered = true;
-            g_rmleak_assert_tick = xTaskGetTickCount();
-            g_all_clear_since = 0;
+            latch_auto_close(bit);
 
             // Build telemetry
+            const char *first_id = "unknown";
+            for (int i = 0; i < g_active_leak_count; i++) {
+                if (g_active_leak_valves[i] & bit) {
+                    first_id = g_active_leak_ids[i];
+                    break;
+                }
+            }
             cJSON *root = cJSON_CreateObject();
             if (root) {
                 cJSON_AddStringToObject(root, "event", "auto_close");
                 cJSON_AddStringToObject(root, "source_type", "reconnect");
-                cJSON_AddStringToObject(root, "sensor_id",
-                    g_active_leak_count > 0 ? g_active_leak_ids[0] : "unknown");
+                cJSON_AddStringToObject(root, "sensor_id", first_id);
                 cJSON_AddBoolToObject(root, "rmleak_asserted", true);
                 cJSON_AddNumberToObject(root, "active_leak_count", g_active_leak_count);
+                add_valve_list(root, bit);
                 if (g_pending_telemetry) free(g_pending_telemetry);
                 g_pending_telemetry = cJSON_PrintUnformatted(root);
                 cJSON_Delete(root);
@@ -944,16 +1308,16 @@ void rules_engine_on_valve_connected(void)
 
             xSemaphoreGive(g_mutex);
 
-            /* RMLEAK before close — see comment in rules_engine_evaluate_leak. */
-            ble_valve_set_rmleak(true);
-            ble_valve_close();
+            /* RMLEAK before close — see close_valves(). */
+            ble_valve_set_rmleak(valve, true);
+            ble_valve_close(valve);
             return;
         }
     }
 
     // ── Priority 2: Hub/valve RMLEAK state synchronization ────────────────
     // Handles reboot scenarios where one side lost state.
-    bool hub_active = g_leak_incident_active;
+    bool hub_active = (g_incident_valves & bit) != 0;
 
     if (hub_active && !valve_rmleak) {
         /* Hub had an incident, valve reports RMLEAK cleared. Two ways this
@@ -970,32 +1334,32 @@ void rules_engine_on_valve_connected(void)
          *      Debug build, pin reset cleared BKP0R). Re-assert RMLEAK so the
          *      interlock comes back. */
         if (valve_state == 1) {
-            ESP_LOGW(RULES_TAG, "Reconnected: hub incident + valve open + RMLEAK clear — inferring physical override, starting 24h window");
-            g_leak_incident_active = false;
+            ESP_LOGW(RULES_TAG, "Reconnected: valve %d incident + open + RMLEAK clear — inferring physical override, starting 24h window", valve);
+            g_incident_valves &= ~bit;
             incident_save_to_nvs();
-            g_auto_close_triggered = false;
-            g_all_clear_since = 0;
+            g_auto_close_valves &= ~bit;
+            g_all_clear_since[valve] = 0;
             start_override_window("button");    /* writes its own NVS entries */
             xSemaphoreGive(g_mutex);
         } else {
-            ESP_LOGW(RULES_TAG, "Reconnected: hub incident active, valve closed + RMLEAK clear — re-asserting");
-            g_rmleak_assert_tick = xTaskGetTickCount();
+            ESP_LOGW(RULES_TAG, "Reconnected: valve %d incident active, closed + RMLEAK clear — re-asserting", valve);
+            g_rmleak_assert_tick[valve] = xTaskGetTickCount();
             xSemaphoreGive(g_mutex);
-            ble_valve_set_rmleak(true);
+            ble_valve_set_rmleak(valve, true);
         }
     } else if (!hub_active && valve_rmleak) {
         // Valve has RMLEAK but hub lost incident (hub rebooted).
         // Conservatively re-latch the incident. If the valve has RMLEAK but hub
         // doesn't know about it, the user will need to send LEAK_RESET to clear.
-        ESP_LOGW(RULES_TAG, "Reconnected: valve RMLEAK active, hub incident clear — re-latching incident");
-        g_leak_incident_active = true;
+        ESP_LOGW(RULES_TAG, "Reconnected: valve %d RMLEAK active, hub incident clear — re-latching incident", valve);
+        g_incident_valves |= bit;
         incident_save_to_nvs();
         xSemaphoreGive(g_mutex);
     } else if (hub_active && valve_rmleak) {
-        ESP_LOGI(RULES_TAG, "Reconnected: hub + valve RMLEAK in sync");
+        ESP_LOGI(RULES_TAG, "Reconnected: valve %d hub + valve RMLEAK in sync", valve);
         xSemaphoreGive(g_mutex);
     } else {
-        ESP_LOGI(RULES_TAG, "Reconnected: no active incident, valve clear");
+        ESP_LOGI(RULES_TAG, "Reconnected: valve %d no active incident, valve clear", valve);
         xSemaphoreGive(g_mutex);
     }
 }
@@ -1004,6 +1368,9 @@ void rules_engine_tick(void)
 {
     if (!g_initialized) return;
 
+    sync_valve_link_profile();
+    override_req_service();
+
     if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(100)) != pdTRUE) return;
 
     // ── Override window expiry check ──────────────────────────────────────
@@ -1033,105 +1400,109 @@ void rules_engine_tick(void)
 
             // If leaks are still active, immediately trigger auto-close.
             // This resumes normal protection as soon as the override expires.
-            if (g_active_leak_count > 0) {
+            uint8_t wet = active_leak_valves();
+            if (wet) {
                 rules_config_t rules;
                 if (provisioning_get_rules_config(&rules) && rules.auto_close_enabled) {
-                    ESP_LOGW(RULES_TAG, "Override expired with %d active leak(s) — executing auto-close",
-                             g_active_leak_count);
+                    ESP_LOGW(RULES_TAG, "Override expired with %d active leak(s) — executing auto-close (valves 0x%02X)",
+                             g_active_leak_count, wet);
 
-                    g_leak_incident_active = true;
-                    incident_save_to_nvs();
-                    g_auto_close_triggered = true;
-                    g_rmleak_assert_tick = xTaskGetTickCount();
-                    g_all_clear_since = 0;
+                    latch_auto_close(wet);
 
                     xSemaphoreGive(g_mutex);
 
-                    /* RMLEAK before close — see comment in rules_engine_evaluate_leak. */
-                    if (ble_valve_is_connected()) {
-                        ble_valve_set_rmleak(true);
-                        ble_valve_close();
-                    } else {
-                        ble_valve_connect();
-                    }
+                    /* RMLEAK before close — see close_valves(). */
+                    close_valves(wet);
                     return;
                 }
             }
         }
     }
 
-    if (!g_leak_incident_active) {
+    if (!g_incident_valves) {
         xSemaphoreGive(g_mutex);
         return;
     }
 
     TickType_t now = xTaskGetTickCount();
 
-    // Check 1: Auto-clear timeout (all sensors clear for AUTO_CLEAR_TIMEOUT_MS)
-    if (g_all_clear_since != 0) {
-        if ((now - g_all_clear_since) >= pdMS_TO_TICKS(AUTO_CLEAR_TIMEOUT_MS)) {
-            ESP_LOGW(RULES_TAG, "AUTO-CLEAR: all sensors clear for %ds — clearing RMLEAK",
-                     AUTO_CLEAR_TIMEOUT_MS / 1000);
-            g_leak_incident_active = false;
-            incident_save_to_nvs();
-            g_auto_close_triggered = false;
-            g_all_clear_since = 0;
+    // Check 1: Auto-clear timeout (all sensors targeting a valve clear for
+    // AUTO_CLEAR_TIMEOUT_MS)
+    uint8_t cleared = 0;
+    for_each_valve(v, g_incident_valves) {
+        if (g_all_clear_since[v] != 0 &&
+            (now - g_all_clear_since[v]) >= pdMS_TO_TICKS(AUTO_CLEAR_TIMEOUT_MS)) {
+            cleared |= VALVE_BIT(v);
+            g_all_clear_since[v] = 0;
+        }
+    }
+    if (cleared) {
+        ESP_LOGW(RULES_TAG, "AUTO-CLEAR: all sensors clear for %ds — clearing RMLEAK (valves 0x%02X)",
+                 AUTO_CLEAR_TIMEOUT_MS / 1000, cleared);
+        g_incident_valves &= ~cleared;
+        incident_save_to_nvs();
+        g_auto_close_valves &= ~cleared;
 
-            cJSON *root = cJSON_CreateObject();
-            if (root) {
-                cJSON_AddStringToObject(root, "event", "rmleak_auto_cleared");
-                cJSON_AddNumberToObject(root, "clear_after_seconds", AUTO_CLEAR_TIMEOUT_MS / 1000);
-                if (g_pending_telemetry) free(g_pending_telemetry);
-                g_pending_telemetry = cJSON_PrintUnformatted(root);
-                cJSON_Delete(root);
-            }
+        cJSON *root = cJSON_CreateObject();
+        if (root) {
+            cJSON_AddStringToObject(root, "event", "rmleak_auto_cleared");
+            cJSON_AddNumberToObject(root, "clear_after_seconds", AUTO_CLEAR_TIMEOUT_MS / 1000);
+            add_valve_list(root, cleared);
+            if (g_pending_telemetry) free(g_pending_telemetry);
+            g_pending_telemetry = cJSON_PrintUnformatted(root);
+            cJSON_Delete(root);
+        }
 
-            xSemaphoreGive(g_mutex);
-            ble_valve_set_rmleak(false);  // Does NOT open valve
-            return;
+        xSemaphoreGive(g_mutex);
+        for_each_valve(v, cleared) {
+            ble_valve_set_rmleak(v, false);  // Does NOT open valve
         }
+        return;
     }
 
-    // Check 2: Valve-side physical override (RMLEAK cleared on valve while incident active)
+    // Check 2: Valve-side physical override (RMLEAK cleared on a valve while its incident is active)
     // SKIP when override window is already active — re-detecting would corrupt the
-    // incident latch (clearing g_leak_incident_active) and prevent auto-close from
-    // working when the override is later cancelled or expires.
+    // incident latch and prevent auto-close from working when the override is
+    // later cancelled or expires.
     // ONLY check when valve is fully ready (GATT setup complete) — during disconnection
     // or GATT setup, ble_valve_get_rmleak_state() returns stale data.
-    if (g_override_state == OVERRIDE_STATE_INACTIVE && ble_valve_is_ready()) {
+    for (int v = 0; v < BLE_VALVE_MAX; v++) {
+        bool ready = ble_valve_is_ready(v);
+        if (!ready) {
+            // Track valve ready state for transition detection
+            g_valve_was_ready &= ~VALVE_BIT(v);
+            continue;
+        }
+        if (g_override_state != OVERRIDE_STATE_INACTIVE || !(g_incident_valves & VALVE_BIT(v))) {
+            continue;
+        }
         // Grace period: skip check if RMLEAK was just written or valve just reconnected
         // (BLE write may still be in-flight or pending commands not yet applied)
-        if (g_rmleak_assert_tick != 0 &&
-            (now - g_rmleak_assert_tick) < pdMS_TO_TICKS(RMLEAK_GRACE_PERIOD_MS)) {
-            xSemaphoreGive(g_mutex);
-            return;
+        if (g_rmleak_assert_tick[v] != 0 &&
+            (now - g_rmleak_assert_tick[v]) < pdMS_TO_TICKS(RMLEAK_GRACE_PERIOD_MS)) {
+            continue;
         }
         // Detect transition to ready — valve just reconnected and pending RMLEAK
         // write may not have propagated yet.  Refresh grace period once.
-        if (!g_valve_was_ready) {
-            g_valve_was_ready = true;
-            g_rmleak_assert_tick = now;
-            ESP_LOGD(RULES_TAG, "Valve just became ready — refreshing RMLEAK grace period");
-            xSemaphoreGive(g_mutex);
-            return;
+        if (!(g_valve_was_ready & VALVE_BIT(v))) {
+            g_valve_was_ready |= VALVE_BIT(v);
+            g_rmleak_assert_tick[v] = now;
+            ESP_LOGD(RULES_TAG, "Valve %d just became ready — refreshing RMLEAK grace period", v);
+            continue;
         }
-        if (!ble_valve_get_rmleak_state()) {
+        if (!ble_valve_get_rmleak_state(v)) {
             // Physical override detected — the user cleared RMLEAK via the valve button.
             // Start a 24h override window: automatic closures are blocked to guarantee
             // water access, but leaks continue to be reported to the cloud.
-            ESP_LOGW(RULES_TAG, "RMLEAK cleared externally (valve override) — starting 24h override window");
-            g_leak_incident_active = false;
+            ESP_LOGW(RULES_TAG, "Valve %d RMLEAK cleared externally (valve override) — starting 24h override window", v);
+            g_incident_valves &= ~VALVE_BIT(v);
             incident_save_to_nvs();
-            g_auto_close_triggered = false;
-            g_all_clear_since = 0;
+            g_auto_close_valves &= ~VALVE_BIT(v);
+            g_all_clear_since[v] = 0;
 
             start_override_window("button");
         }
     }
-    // Track valve ready state for transition detection
-    if (!ble_valve_is_ready()) {
-        g_valve_was_ready = false;
-    }
 
     xSemaphoreGive(g_mutex);
 }
@@ -22,9 +22,15 @@ typedef enum {
     OVERRIDE_ENABLE_ERR_VALVE_FLOOD,        // Valve's own flood probe is wet (absolute floor)
     OVERRIDE_ENABLE_ERR_VALVE_DISCONNECTED, // Valve unreachable after bounded reconnect
     OVERRIDE_ENABLE_ERR_NOT_PROVISIONED,    // Hub unprovisioned / no valve configured
-    OVERRIDE_ENABLE_ERR_INTERNAL            // Mutex timeout / not initialized
+    OVERRIDE_ENABLE_ERR_INTERNAL,           // Mutex timeout / not initialized / open failed
+    OVERRIDE_ENABLE_PENDING                 // Accepted; result follows via the callback
 } override_enable_result_t;
 
+// Completion of a remote override_enable that returned OVERRIDE_ENABLE_PENDING.
+// Runs in the IoT Hub task (reconnect timed out) or a BLE task (valve open
+// completed); keep it short.
+typedef void (*override_enable_cb_t)(override_enable_result_t result, void *ctx);
+
 /**
  * @brief Initialize the rules engine. Call after provisioning_init().
  *        Loads override window state from NVS if previously persisted.
@@ -32,15 +38,23 @@ typedef enum {
 void rules_engine_init(void);
 
 /**
- * @brief Evaluate a leak event and auto-close the valve if rules allow.
+ * @brief Evaluate a leak event and auto-close the valves it targets if rules allow.
+ *        A sensor targets the valves in its sensor metadata valve mask (every
+ *        commissioned valve when unset); a valve flood probe targets its own
+ *        valve. The incident latch, auto-close and auto-clear are per valve.
  *        During a 24h override window, the incident is latched and leak events
  *        are reported to the cloud, but automatic valve closure is blocked.
  *
+ *        An auto-close opens a leak_latency incident timed from detect_us.
+ *
  * @param source Which sensor type triggered the leak
  * @param leak_active true = leak detected, false = leak cleared
- * @param source_id Human-readable ID (MAC string or "0xHEXID")
+ * @param source_id Human-readable ID (MAC string or "0xHEXID"; the valve MAC
+ *                  for LEAK_SOURCE_VALVE_FLOOD)
+ * @param detect_us esp_timer time the radio received the report (0 = unknown)
  */
-void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const char *source_id);
+void rules_engine_evaluate_leak(leak_source_t source, bool leak_active, const char *source_id,
+                                int64_t detect_us);
 
 /**
  * @brief Handle RULES_CONFIG: C2D JSON command.
@@ -60,12 +74,17 @@ bool rules_engine_handle_config_command(const char *json_str);
 char *rules_engine_take_pending_telemetry(void);
 
 /**
- * @brief Check if a leak incident is currently active (latched).
+ * @brief Check if a leak incident is currently active (latched) on any valve.
  */
 bool rules_engine_is_leak_incident_active(void);
 
 /**
- * @brief Reset the leak incident latch and clear RMLEAK on the valve.
+ * @brief Valves with a latched leak incident (bit n = valve n).
+ */
+uint8_t rules_engine_get_incident_valves(void);
+
+/**
+ * @brief Reset the leak incident latch and clear RMLEAK on every valve.
  *        Also cancels any active 24h override window.
  *        Does NOT open the valve — opening requires a separate command.
  *
@@ -82,25 +101,30 @@ bool rules_engine_is_leak_incident_active(void);
 bool rules_engine_reset_leak_incident(void);
 
 /**
- * @brief Re-assert RMLEAK on valve if a leak incident is active.
+ * @brief Re-assert RMLEAK on valves with an active leak incident.
  *        Call this after BLE reconnection to ensure valve interlock is restored.
- *        (Legacy wrapper — delegates to rules_engine_on_valve_connected.)
+ *        (Legacy wrapper — delegates to rules_engine_on_valve_connected for
+ *        every ready valve.)
  */
 void rules_engine_reassert_rmleak_if_needed(void);
 
 /**
- * @brief Full valve reconnect reconciliation. Call once after valve GATT setup completes.
+ * @brief Full valve reconnect reconciliation. Call once after a valve's GATT setup completes.
  *
  * Priority 0: If 24h override window is active, skip auto-close but sync incident latch.
- * Priority 1: If any sensors are actively reporting leaks AND auto_close is enabled,
- *             close valve + assert RMLEAK. Single command regardless of sensor count.
+ * Priority 1: If any sensors targeting this valve are actively reporting leaks AND
+ *             auto_close is enabled, close valve + assert RMLEAK. Single command
+ *             regardless of sensor count.
  * Priority 2: Synchronize hub/valve RMLEAK state (handles reboot scenarios).
+ *
+ * @param valve Valve index (0..BLE_VALVE_MAX-1)
  */
-void rules_engine_on_valve_connected(void);
+void rules_engine_on_valve_connected(int valve);
 
 /**
  * @brief Periodic tick — call from event loop (every ~30s).
- *        Checks override window expiry, auto-clear timeout, and valve-side override.
+ *        Checks override window expiry, auto-clear timeout, and valve-side override,
+ *        and keeps the valve link on the fast profile while an incident is latched.
  */
 void rules_engine_tick(void);
 
@@ -131,19 +155,29 @@ bool rules_engine_cancel_override(void);
  *
  * Identical end-state to the button: clears the leak incident latch, starts the
  * 24h window (auto-close blocked, leaks still reported), clears the valve RMLEAK
- * interlock and opens the valve. Order is window → clear RMLEAK → open so the
+ * interlock and opens the valve. With several valves it opens every valve with a
+ * latched incident or asserted RMLEAK (all commissioned valves if none); the
+ * window itself is hub-wide. Order is window → clear RMLEAK → open so the
  * hub does not race-close or misread the resulting RMLEAK 1->0 as a physical
  * override. Idempotent: refreshes an already-active window and re-emits the
  * "water_access_override_enabled" event (trigger="c2d_command").
  *
  * Preconditions are checked before any state changes; the window starts only on
- * successful execution, never on mere receipt. Blocks up to ~10s attempting a
- * BLE reconnect if the valve is not ready.
+ * successful execution, never on mere receipt. Never blocks: if the valve is
+ * not ready a reconnect is started and the request is executed by
+ * rules_engine_tick() once it is (or fails after ~10s). Each valve open is a
+ * command object; the result is reported when every valve has confirmed (the
+ * first failure wins).
+ *
+ * One request may wait for the valve at a time; a second gets
+ * OVERRIDE_ENABLE_ERR_INTERNAL.
  *
- * @return OVERRIDE_ENABLE_OK on success, or an error code the dispatcher maps to
- *         a frozen cmd_ack error.detail string.
+ * @return OVERRIDE_ENABLE_PENDING if cb will be called with the result, else
+ *         the final result (cb not called) — OVERRIDE_ENABLE_OK only when
+ *         cb is NULL and the open was queued. Error codes map to frozen
+ *         cmd_ack error.detail strings.
  */
-override_enable_result_t rules_engine_enable_override_remote(void);
+override_enable_result_t rules_engine_enable_override_remote(override_enable_cb_t cb, void *ctx);
 
 /**
  * @brief Wipe all persisted rules-engine state in NVS (incident latch + override
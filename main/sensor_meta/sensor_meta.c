@@ -1,4 +1,7 @@
 #include "sensor_meta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <strings.h>
 #include "esp_log.h"
@@ -12,14 +15,29 @@
 #define META_TAG "SENSOR_META"
 #define NVS_NAMESPACE "sen_meta"
 #define NVS_KEY_VERSION "meta_ver"
-#define NVS_KEY_TABLE "meta_tbl"
-#define CURRENT_META_VERSION 1
+#define NVS_KEY_TABLE "meta_tbl"      // version 1: [count][entries] single blob
+#define CURRENT_META_VERSION 3        // 2: entries in chunks "meta_tbl0", "meta_tbl1", ...
+                                      // 3: entries gain valve_mask
+
+// Versions 1 and 2 stored entries without the trailing valve_mask
+#define META_V2_ENTRY_SIZE   offsetof(sensor_meta_entry_t, valve_mask)
+
+// A large capacity table (hundreds of entries) is far past what one NVS blob
+// should hold, so entries are stored META_PER_CHUNK at a time (848 B chunks).
+#define META_PER_CHUNK    16
+#define META_MAX_CHUNKS   ((MAX_SENSOR_META + META_PER_CHUNK - 1) / META_PER_CHUNK)
 
 static sensor_meta_entry_t s_table[MAX_SENSOR_META];
-static uint8_t s_count = 0;
+static uint16_t s_count = 0;
 static SemaphoreHandle_t s_mutex = NULL;
 static bool s_initialized = false;
 
+// Table index per device registry handle (-1 = no entry). Rebuilt lazily when
+// the table changes or the registry generation moves on.
+static int16_t  s_by_handle[DEVREG_MAX_DEVICES];
+static bool     s_by_handle_valid = false;
+static uint32_t s_by_handle_gen = 0;
+
 static const char *s_location_strings[] = {
     "unknown", "bathroom", "kitchen", "laundry", "garage",
     "garden", "basement", "utility", "hallway",
@@ -28,8 +46,60 @@ static const char *s_location_strings[] = {
 _Static_assert(sizeof(s_location_strings) / sizeof(s_location_strings[0]) == LOC_COUNT,
                "Location string table must match LOC_COUNT");
 
+// ─── Handle index ───────────────────────────────────────────────────────────
+
+static devreg_type_t to_devreg_type(uint8_t type)
+{
+    return (type == SENSOR_TYPE_LORA) ? DEVREG_LORA : DEVREG_BLE_LEAK;
+}
+
+// Caller holds s_mutex
+static void handle_index_refresh_locked(void)
+{
+    uint32_t gen = device_registry_generation();
+    if (s_by_handle_valid && gen == s_by_handle_gen) {
+        return;
+    }
+
+    memset(s_by_handle, -1, sizeof(s_by_handle));
+    for (int i = 0; i < s_count; i++) {
+        dev_handle_t h = device_registry_find_id_str(
+            to_devreg_type(s_table[i].sensor_type), s_table[i].sensor_id);
+        if (h != DEVREG_HANDLE_NONE) {
+            s_by_handle[h] = (int16_t)i;
+        }
+    }
+    s_by_handle_gen = gen;
+    s_by_handle_valid = true;
+}
+
+// Caller holds s_mutex
+static const sensor_meta_entry_t *find_locked(sensor_type_t type, const char *sensor_id)
+{
+    handle_index_refresh_locked();
+
+    dev_handle_t h = device_registry_find_id_str(to_devreg_type(type), sensor_id);
+    if (h != DEVREG_HANDLE_NONE) {
+        return (s_by_handle[h] >= 0) ? &s_table[s_by_handle[h]] : NULL;
+    }
+
+    // Not commissioned: metadata may still have been set ahead of provisioning
+    for (int i = 0; i < s_count; i++) {
+        if (s_table[i].sensor_type == (uint8_t)type &&
+            strcasecmp(s_table[i].sensor_id, sensor_id) == 0) {
+            return &s_table[i];
+        }
+    }
+    return NULL;
+}
+
 // ─── NVS helpers ────────────────────────────────────────────────────────────
 
+static void chunk_key(char out[16], int chunk)
+{
+    snprintf(out, 16, NVS_KEY_TABLE "%d", chunk);
+}
+
 static bool save_table_to_nvs(void)
 {
     nvs_handle_t h;
@@ -45,21 +115,27 @@ static bool save_table_to_nvs(void)
     err = nvs_set_u8(h, NVS_KEY_VERSION, ver);
     if (err != ESP_OK) { ok = false; }
 
-    // Store count + entries as one blob: [count(1)] [entries(count*sizeof)]
-    size_t blob_size = 1 + (size_t)s_count * sizeof(sensor_meta_entry_t);
-    uint8_t *blob = malloc(blob_size);
-    if (!blob) {
-        nvs_close(h);
-        return false;
+    // Unchanged chunks are skipped by NVS (identical value), so an edit costs
+    // one chunk write plus the tail chunk after a removal.
+    char key[16];
+    int chunks = (s_count + META_PER_CHUNK - 1) / META_PER_CHUNK;
+    for (int c = 0; c < chunks && ok; c++) {
+        int n = s_count - c * META_PER_CHUNK;
+        if (n > META_PER_CHUNK) n = META_PER_CHUNK;
+        chunk_key(key, c);
+        err = nvs_set_blob(h, key, &s_table[c * META_PER_CHUNK],
+                           (size_t)n * sizeof(sensor_meta_entry_t));
+        if (err != ESP_OK) { ok = false; }
     }
-    blob[0] = s_count;
-    if (s_count > 0) {
-        memcpy(blob + 1, s_table, s_count * sizeof(sensor_meta_entry_t));
+    for (int c = chunks; c < META_MAX_CHUNKS && ok; c++) {
+        chunk_key(key, c);
+        err = nvs_erase_key(h, key);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) { ok = false; }
+    }
+    if (ok) {
+        err = nvs_erase_key(h, NVS_KEY_TABLE);   // version 1 blob, if any
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) { ok = false; }
     }
-
-    err = nvs_set_blob(h, NVS_KEY_TABLE, blob, blob_size);
-    free(blob);
-    if (err != ESP_OK) { ok = false; }
 
     if (ok) {
         err = nvs_commit(h);
@@ -70,62 +146,111 @@ static bool save_table_to_nvs(void)
     return ok;
 }
 
-static bool load_table_from_nvs(void)
+// Version 1: everything in one [count][entries] blob
+static bool load_table_v1(nvs_handle_t h)
 {
-    nvs_handle_t h;
-    esp_err_t err = nvs_open_from_partition(NVS_PROV_PARTITION, NVS_NAMESPACE, NVS_READONLY, &h);
-    if (err != ESP_OK) {
-        ESP_LOGD(META_TAG, "NVS namespace not found (first boot?)");
-        return false;
-    }
-
-    uint8_t ver = 0;
-    err = nvs_get_u8(h, NVS_KEY_VERSION, &ver);
-    if (err != ESP_OK || ver == 0) {
-        nvs_close(h);
-        return false;
-    }
-
     // Get blob size first
     size_t blob_size = 0;
-    err = nvs_get_blob(h, NVS_KEY_TABLE, NULL, &blob_size);
+    esp_err_t err = nvs_get_blob(h, NVS_KEY_TABLE, NULL, &blob_size);
     if (err != ESP_OK || blob_size < 1) {
-        nvs_close(h);
         return false;
     }
 
     uint8_t *blob = malloc(blob_size);
     if (!blob) {
-        nvs_close(h);
         return false;
     }
 
     err = nvs_get_blob(h, NVS_KEY_TABLE, blob, &blob_size);
-    nvs_close(h);
-
     if (err != ESP_OK) {
         free(blob);
         return false;
     }
 
-    uint8_t count = blob[0];
+    int count = blob[0];
     if (count > MAX_SENSOR_META) {
         count = MAX_SENSOR_META;
     }
 
-    size_t expected = 1 + (size_t)count * sizeof(sensor_meta_entry_t);
+    size_t expected = 1 + (size_t)count * META_V2_ENTRY_SIZE;
     if (blob_size < expected) {
         ESP_LOGW(META_TAG, "Blob size mismatch: got %d, expected %d", (int)blob_size, (int)expected);
         free(blob);
         return false;
     }
 
-    s_count = count;
-    if (s_count > 0) {
-        memcpy(s_table, blob + 1, s_count * sizeof(sensor_meta_entry_t));
+    s_count = (uint16_t)count;
+    for (int i = 0; i < s_count; i++) {
+        memcpy(&s_table[i], blob + 1 + i * META_V2_ENTRY_SIZE, META_V2_ENTRY_SIZE);
+        s_table[i].valve_mask = SENSOR_META_VALVES_ALL;
     }
 
     free(blob);
+    return true;
+}
+
+static bool load_table_from_nvs(void)
+{
+    nvs_handle_t h;
+    esp_err_t err = nvs_open_from_partition(NVS_PROV_PARTITION, NVS_NAMESPACE, NVS_READONLY, &h);
+    if (err != ESP_OK) {
+        ESP_LOGD(META_TAG, "NVS namespace not found (first boot?)");
+        return false;
+    }
+
+    uint8_t ver = 0;
+    err = nvs_get_u8(h, NVS_KEY_VERSION, &ver);
+    if (err != ESP_OK || ver == 0) {
+        nvs_close(h);
+        return false;
+    }
+
+    if (ver == 1) {
+        bool ok = load_table_v1(h);
+        nvs_close(h);
+        if (ok) {
+            ESP_LOGI(META_TAG, "Loaded %d sensor metadata entries from NVS (v1)", s_count);
+        }
+        return ok;
+    }
+
+    // Version 2 chunks hold the shorter entries: read each chunk into scratch
+    // and widen it. Version 3 chunks are read in place.
+    size_t   entry_size = (ver == 2) ? META_V2_ENTRY_SIZE : sizeof(sensor_meta_entry_t);
+    uint8_t *scratch = NULL;
+    if (ver == 2) {
+        scratch = malloc(META_PER_CHUNK * META_V2_ENTRY_SIZE);
+        if (!scratch) {
+            nvs_close(h);
+            return false;
+        }
+    }
+
+    // Chunks are contiguous; the first missing one ends the table
+    char key[16];
+    s_count = 0;
+    for (int c = 0; c < META_MAX_CHUNKS; c++) {
+        int room = MAX_SENSOR_META - s_count;
+        if (room > META_PER_CHUNK) room = META_PER_CHUNK;
+        size_t len = (size_t)room * entry_size;
+        chunk_key(key, c);
+        err = nvs_get_blob(h, key, scratch ? (void *)scratch : (void *)&s_table[s_count], &len);
+        if (err != ESP_OK || len % entry_size != 0) {
+            break;
+        }
+        int n = (int)(len / entry_size);
+        for (int i = 0; scratch && i < n; i++) {
+            memcpy(&s_table[s_count + i], scratch + i * META_V2_ENTRY_SIZE, META_V2_ENTRY_SIZE);
+            s_table[s_count + i].valve_mask = SENSOR_META_VALVES_ALL;
+        }
+        s_count += n;
+        if (len < META_PER_CHUNK * entry_size || s_count >= MAX_SENSOR_META) {
+            break;
+        }
+    }
+    nvs_close(h);
+    free(scratch);
+
     ESP_LOGI(META_TAG, "Loaded %d sensor metadata entries from NVS", s_count);
     return true;
 }
@@ -150,7 +275,8 @@ bool sensor_meta_init(void)
     load_table_from_nvs();  // OK if it fails (empty table)
 
     s_initialized = true;
-    ESP_LOGI(META_TAG, "Sensor metadata initialized (%d entries)", s_count);
+    ESP_LOGI(META_TAG, "Sensor metadata initialized (%d entries, table %u B)",
+             s_count, (unsigned)(sizeof(s_table) + sizeof(s_by_handle)));
     return true;
 }
 
@@ -163,12 +289,25 @@ const sensor_meta_entry_t *sensor_meta_find(sensor_type_t type, const char *sens
     const sensor_meta_entry_t *result = NULL;
 
     if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        for (int i = 0; i < s_count; i++) {
-            if (s_table[i].sensor_type == (uint8_t)type &&
-                strcasecmp(s_table[i].sensor_id, sensor_id) == 0) {
-                result = &s_table[i];
-                break;
-            }
+        result = find_locked(type, sensor_id);
+        xSemaphoreGive(s_mutex);
+    }
+
+    return result;
+}
+
+const sensor_meta_entry_t *sensor_meta_find_by_handle(dev_handle_t handle)
+{
+    if (!s_initialized || handle >= DEVREG_MAX_DEVICES) {
+        return NULL;
+    }
+
+    const sensor_meta_entry_t *result = NULL;
+
+    if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        handle_index_refresh_locked();
+        if (s_by_handle[handle] >= 0) {
+            result = &s_table[s_by_handle[handle]];
         }
         xSemaphoreGive(s_mutex);
     }
@@ -176,8 +315,14 @@ const sensor_meta_entry_t *sensor_meta_find(sensor_type_t type, const char *sens
     return result;
 }
 
+uint8_t sensor_meta_valve_mask_by_handle(dev_handle_t handle)
+{
+    const sensor_meta_entry_t *meta = sensor_meta_find_by_handle(handle);
+    return meta ? meta->valve_mask : SENSOR_META_VALVES_ALL;
+}
+
 bool sensor_meta_set(sensor_type_t type, const char *sensor_id,
-                     int location_code, const char *label)
+                     int location_code, const char *label, int valve_mask)
 {
     if (!sensor_id || !s_initialized) {
         return false;
@@ -189,14 +334,7 @@ bool sensor_meta_set(sensor_type_t type, const char *sensor_id,
     }
 
     // Find existing entry
-    sensor_meta_entry_t *entry = NULL;
-    for (int i = 0; i < s_count; i++) {
-        if (s_table[i].sensor_type == (uint8_t)type &&
-            strcasecmp(s_table[i].sensor_id, sensor_id) == 0) {
-            entry = &s_table[i];
-            break;
-        }
-    }
+    sensor_meta_entry_t *entry = (sensor_meta_entry_t *)find_locked(type, sensor_id);
 
     // Create new entry if not found
     if (!entry) {
@@ -206,11 +344,13 @@ bool sensor_meta_set(sensor_type_t type, const char *sensor_id,
             return false;
         }
         entry = &s_table[s_count++];
+        s_by_handle_valid = false;
         memset(entry, 0, sizeof(*entry));
         entry->sensor_type = (uint8_t)type;
         strncpy(entry->sensor_id, sensor_id, SENSOR_META_ID_MAX - 1);
         entry->sensor_id[SENSOR_META_ID_MAX - 1] = '\0';
         entry->location_code = LOC_UNKNOWN;
+        entry->valve_mask = SENSOR_META_VALVES_ALL;
     }
 
     // Merge: -1 means keep existing, NULL means keep existing
@@ -221,15 +361,18 @@ bool sensor_meta_set(sensor_type_t type, const char *sensor_id,
         strncpy(entry->label, label, SENSOR_META_LABEL_MAX - 1);
         entry->label[SENSOR_META_LABEL_MAX - 1] = '\0';
     }
+    if (valve_mask >= 0) {
+        entry->valve_mask = (uint8_t)valve_mask;
+    }
 
     bool ok = save_table_to_nvs();
 
     xSemaphoreGive(s_mutex);
 
-    ESP_LOGI(META_TAG, "Set metadata: type=%d id=%s loc=%s label=\"%s\"",
+    ESP_LOGI(META_TAG, "Set metadata: type=%d id=%s loc=%s label=\"%s\" valves=0x%02X",
              type, sensor_id,
              sensor_meta_location_code_to_str(entry->location_code),
-             entry->label);
+             entry->label, entry->valve_mask);
 
     return ok;
 }
@@ -255,6 +398,7 @@ bool sensor_meta_remove(sensor_type_t type, const char *sensor_id)
             }
             s_count--;
             memset(&s_table[s_count], 0, sizeof(sensor_meta_entry_t));
+            s_by_handle_valid = false;
             found = true;
             break;
         }
@@ -326,7 +470,22 @@ bool sensor_meta_handle_command(const char *json_str)
         label = label_json->valuestring;
     }
 
-    bool ok = sensor_meta_set(type, id_json->valuestring, loc_code, label);
+    // Parse valves (optional): array of valve indices this sensor's leak
+    // closes, [] = all valves. Indices past the configured valve count are
+    // kept so a later capacity increase honours them.
+    int valve_mask = -1;  // -1 = keep existing
+    cJSON *valves_json = cJSON_GetObjectItem(root, "valves");
+    if (valves_json && cJSON_IsArray(valves_json)) {
+        valve_mask = SENSOR_META_VALVES_ALL;
+        cJSON *v;
+        cJSON_ArrayForEach(v, valves_json) {
+            if (cJSON_IsNumber(v) && v->valueint >= 0 && v->valueint < 8) {
+                valve_mask |= 1 << v->valueint;
+            }
+        }
+    }
+
+    bool ok = sensor_meta_set(type, id_json->valuestring, loc_code, label, valve_mask);
 
     cJSON_Delete(root);
     return ok;
@@ -341,6 +500,7 @@ void sensor_meta_clear_all(void)
     if (xSemaphoreTake(s_mutex, pdMS_TO_TICKS(5000)) == pdTRUE) {
         memset(s_table, 0, sizeof(s_table));
         s_count = 0;
+        s_by_handle_valid = false;
 
         // Erase NVS
         nvs_handle_t h;
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "device_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,7 +11,8 @@ extern "C" {
 
 #define SENSOR_META_LABEL_MAX  32
 #define SENSOR_META_ID_MAX     18   // "XX:XX:XX:XX:XX:XX\0" or "0x754A6237\0"
-#define MAX_SENSOR_META        32   // 16 BLE + 16 LoRa
+#define MAX_SENSOR_META        (DEVREG_MAX_LORA + DEVREG_MAX_BLE)
+#define SENSOR_META_VALVES_ALL 0    // valve_mask: a leak closes every valve
 
 typedef enum {
     SENSOR_TYPE_BLE_LEAK = 0,
@@ -39,6 +41,8 @@ typedef struct {
     char sensor_id[SENSOR_META_ID_MAX];     // MAC or "0xHEXID"
     uint8_t location_code;                  // location_code_t
     char label[SENSOR_META_LABEL_MAX];      // user-friendly label
+    uint8_t valve_mask;                     // valves a leak here closes, bit n = valve n;
+                                            // SENSOR_META_VALVES_ALL = every valve
 } sensor_meta_entry_t;
 
 /**
@@ -49,17 +53,33 @@ bool sensor_meta_init(void);
 
 /**
  * @brief Find metadata for a sensor (RAM-only, hot-path safe).
+ *        Commissioned sensors resolve through the device registry handle;
+ *        others fall back to a table scan.
  * @return pointer to entry or NULL if not found
  */
 const sensor_meta_entry_t *sensor_meta_find(sensor_type_t type, const char *sensor_id);
 
+/**
+ * @brief Find metadata by device registry handle (no string compares).
+ * @return pointer to entry or NULL if none set
+ */
+const sensor_meta_entry_t *sensor_meta_find_by_handle(dev_handle_t handle);
+
+/**
+ * @brief Valves a leak on this sensor should close (bit n = valve n).
+ *        Sensors without metadata or without a mask close every valve.
+ * @return valve bitmask, SENSOR_META_VALVES_ALL for every valve
+ */
+uint8_t sensor_meta_valve_mask_by_handle(dev_handle_t handle);
+
 /**
  * @brief Set metadata for a sensor (find-or-create). Persists to NVS.
  * @param location_code -1 to keep existing value
  * @param label NULL to keep existing value
+ * @param valve_mask -1 to keep existing value
  */
 bool sensor_meta_set(sensor_type_t type, const char *sensor_id,
-                     int location_code, const char *label);
+                     int location_code, const char *label, int valve_mask);
 
 /**
  * @brief Remove metadata for a sensor. Persists to NVS.
@@ -0,0 +1,265 @@
+/*
+ * telem_bench.c
+ *
+ * cJSON vs telem_writer encoder benchmark. See telem_bench.h.
+ */
+
+#include "telem_bench.h"
+
+#include "sdkconfig.h"
+
+#if CONFIG_EFLO_TELEMETRY_ENCODER_BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+#include "telem_writer.h"
+#include "telemetry_v2b_keys.h"
+#include "telem_sample.h"
+
+static const char *TAG = "TELEM_BENCH";
+
+#define BENCH_RUNS      20
+#define BENCH_SENSORS   CONFIG_EFLO_SNAPSHOT_PAGE_SIZE
+
+typedef enum {
+    BENCH_LIFECYCLE = 0,
+    BENCH_SNAPSHOT,
+    BENCH_EVENT,
+    BENCH_KIND_MAX
+} bench_kind_t;
+
+static const char *const s_kind_name[BENCH_KIND_MAX] = { "lifecycle", "snapshot", "event" };
+
+typedef struct {
+    uint32_t us;            /* average per message */
+    uint32_t bytes;
+    uint32_t heap;          /* peak heap drawn by one message */
+    uint32_t lfb_before;    /* largest free block before the first message */
+    uint32_t lfb_peak;      /* lowest largest free block at a message's peak */
+    uint32_t lfb_after;     /* largest free block after the last one is freed */
+} bench_result_t;
+
+static uint32_t largest_free(void)
+{
+    return (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+/* Heap drawn and largest free block at a message's peak */
+static void bench_peak(bench_result_t *r, size_t before)
+{
+    size_t free_now = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (before > free_now && before - free_now > r->heap) {
+        r->heap = (uint32_t)(before - free_now);
+    }
+    uint32_t lfb = largest_free();
+    if (lfb < r->lfb_peak) r->lfb_peak = lfb;
+}
+
+/* =========================================================================
+ * SYNTHETIC MESSAGES
+ *
+ * cJSON twins of telem_sample.c, field for field, so the JSON outputs can
+ * be compared byte for byte.
+ * ========================================================================= */
+
+static cJSON *envelope_cjson(const char *type)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "schema", "eflostop.v2");
+    cJSON_AddNumberToObject(root, "ts", TELEM_SAMPLE_TS);
+    cJSON *gw = cJSON_CreateObject();
+    cJSON_AddStringToObject(gw, "id", "eflo-hub-8C4F00A1B2C3");
+    cJSON_AddStringToObject(gw, "short_id", "A1B2C3");
+    cJSON_AddStringToObject(gw, "name", "Basement hub");
+    cJSON_AddStringToObject(gw, "fw", "2.4.0");
+    cJSON_AddNumberToObject(gw, "uptime_s", TELEM_SAMPLE_UPTIME_S);
+    cJSON_AddItemToObject(root, "gateway", gw);
+    cJSON_AddStringToObject(root, "type", type);
+    return root;
+}
+
+static cJSON *location_cjson(void)
+{
+    cJSON *loc = cJSON_CreateObject();
+    cJSON_AddStringToObject(loc, "code", "kitchen");
+    cJSON_AddStringToObject(loc, "label", "Under sink");
+    return loc;
+}
+
+static cJSON *lifecycle_cjson(void)
+{
+    cJSON *root = envelope_cjson("lifecycle");
+    cJSON *data = cJSON_CreateObject();
+    cJSON_AddStringToObject(data, "event", "online");
+    cJSON_AddStringToObject(data, "reset_reason", "power_on");
+    cJSON_AddBoolToObject(data, "provisioned", 1);
+    cJSON_AddStringToObject(data, "valve_mac", "C8:2E:18:4A:11:F2");
+    cJSON *macs = cJSON_AddArrayToObject(data, "valve_macs");
+    cJSON_AddItemToArray(macs, cJSON_CreateString("C8:2E:18:4A:11:F2"));
+    cJSON_AddItemToArray(macs, cJSON_CreateString("C8:2E:18:4A:2B:07"));
+    cJSON_AddNumberToObject(data, "lora_sensor_count", 16);
+    cJSON_AddNumberToObject(data, "ble_leak_sensor_count", 16);
+    cJSON *rules = cJSON_CreateObject();
+    cJSON_AddBoolToObject(rules, "auto_close_enabled", 1);
+    cJSON_AddNumberToObject(rules, "trigger_mask", 7);
+    cJSON_AddItemToObject(data, "rules", rules);
+    cJSON_AddItemToObject(root, "data", data);
+    return root;
+}
+
+static cJSON *page_cjson(void)
+{
+    char id[12];
+    cJSON *root = envelope_cjson("snapshot");
+    cJSON *data = cJSON_CreateObject();
+    cJSON *sh = cJSON_CreateObject();
+    cJSON_AddStringToObject(sh, "rating", "good");
+    cJSON_AddStringToObject(sh, "reason", "all devices healthy");
+    cJSON_AddItemToObject(data, "system_health", sh);
+    cJSON *list = cJSON_AddArrayToObject(data, "lora_sensors");
+    for (int i = 0; i < BENCH_SENSORS; i++) {
+        cJSON *s = cJSON_CreateObject();
+        telem_sample_sensor_id(i, id);
+        cJSON_AddStringToObject(s, "sensor_id", id);
+        cJSON_AddBoolToObject(s, "connected", 1);
+        cJSON_AddStringToObject(s, "rating", "good");
+        cJSON_AddNumberToObject(s, "last_seen_age_s", 30 + i);
+        cJSON_AddNumberToObject(s, "battery", 80 + i % 20);
+        cJSON_AddBoolToObject(s, "leak_state", 0);
+        cJSON_AddNumberToObject(s, "rssi", -70 - i % 30);
+        cJSON_AddNumberToObject(s, "snr", 7.25);
+        cJSON_AddItemToObject(s, "location", location_cjson());
+        cJSON_AddItemToArray(list, s);
+    }
+    cJSON_AddItemToObject(root, "data", data);
+    return root;
+}
+
+static cJSON *event_cjson(void)
+{
+    cJSON *root = envelope_cjson("event");
+    cJSON *data = cJSON_CreateObject();
+    cJSON_AddStringToObject(data, "event", "leak_detected");
+    cJSON_AddStringToObject(data, "source_type", "lora");
+    cJSON_AddStringToObject(data, "sensor_id", "0x1A2B0007");
+    cJSON_AddBoolToObject(data, "leak_state", 1);
+    cJSON_AddNumberToObject(data, "battery", 87);
+    cJSON_AddNumberToObject(data, "rssi", -74);
+    cJSON_AddItemToObject(data, "location", location_cjson());
+    cJSON_AddItemToObject(root, "data", data);
+    return root;
+}
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+static void bench_cjson(bench_kind_t kind, bench_result_t *r, char **sample)
+{
+    int64_t total = 0;
+    size_t before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    r->lfb_before = r->lfb_peak = largest_free();
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        int64_t t = esp_timer_get_time();
+        cJSON *root = kind == BENCH_LIFECYCLE ? lifecycle_cjson()
+                    : kind == BENCH_SNAPSHOT  ? page_cjson()
+                    :                           event_cjson();
+        char *out = cJSON_PrintUnformatted(root);
+        bench_peak(r, before);      /* tree plus print buffer */
+        cJSON_Delete(root);
+        total += esp_timer_get_time() - t;
+        if (!out) continue;
+
+        r->bytes = (uint32_t)strlen(out);
+        if (run == BENCH_RUNS - 1) *sample = out;   /* kept for the output check */
+        else                       free(out);
+    }
+    r->us = (uint32_t)(total / BENCH_RUNS);
+    r->lfb_after = largest_free();
+}
+
+static void bench_writer(bench_kind_t kind, bench_result_t *r, char *buf, size_t cap, bool cbor)
+{
+    int64_t total = 0;
+    size_t before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    r->lfb_before = r->lfb_peak = largest_free();
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        telem_writer_t w;
+        int64_t t = esp_timer_get_time();
+        if (cbor) {
+            telem_writer_init_cbor(&w, buf, cap, telemetry_v2b_keys, telemetry_v2b_key_count);
+        } else {
+            telem_writer_init(&w, buf, cap);
+        }
+        switch (kind) {
+            case BENCH_LIFECYCLE: telem_sample_lifecycle(&w);                    break;
+            case BENCH_SNAPSHOT:  telem_sample_snapshot_page(&w, BENCH_SENSORS); break;
+            default:              telem_sample_event(&w);                        break;
+        }
+        size_t len = 0;
+        const char *out = telem_writer_finish(&w, &len);
+        total += esp_timer_get_time() - t;
+        bench_peak(r, before);
+        r->bytes = out ? (uint32_t)len : 0;
+    }
+    r->us = (uint32_t)(total / BENCH_RUNS);
+    r->lfb_after = largest_free();
+}
+
+static void bench_log(const char *arm, const bench_result_t *r, const char *note)
+{
+    ESP_LOGI(TAG, "  %-5s %6lu us %6lu B %6lu B  %6lu/%6lu/%6lu B%s", arm,
+             (unsigned long)r->us, (unsigned long)r->bytes, (unsigned long)r->heap,
+             (unsigned long)r->lfb_before, (unsigned long)r->lfb_peak,
+             (unsigned long)r->lfb_after, note);
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+void telem_bench_run(void)
+{
+    /* The writer's buffer is static in production; allocated here so it
+     * is not counted as drawn */
+    size_t cap = CONFIG_EFLO_TELEMETRY_BUF_SIZE;
+    char *buf = malloc(cap);
+    if (!buf) {
+        ESP_LOGE(TAG, "No %u B for the writer buffer", (unsigned)cap);
+        return;
+    }
+
+    ESP_LOGI(TAG, "%d runs, snapshot page of %d sensors", BENCH_RUNS, BENCH_SENSORS);
+    ESP_LOGI(TAG, "  (avg us / bytes / heap drawn / largest free block before/peak/after)");
+    for (int k = 0; k < BENCH_KIND_MAX; k++) {
+        bench_result_t cj = {0}, js = {0}, cb = {0};
+        char *sample = NULL;
+
+        bench_cjson((bench_kind_t)k, &cj, &sample);
+        bench_writer((bench_kind_t)k, &js, buf, cap, false);
+        bool same = sample && js.bytes && strcmp(sample, buf) == 0;
+        bench_writer((bench_kind_t)k, &cb, buf, cap, true);
+        free(sample);
+
+        ESP_LOGI(TAG, "%s:", s_kind_name[k]);
+        bench_log("cjson", &cj, "");
+        bench_log("json", &js, same ? " (same as cJSON)" : " (differs from cJSON)");
+        bench_log("cbor", &cb, "");
+    }
+    free(buf);
+}
+
+#else
+
+void telem_bench_run(void)
+{
+}
+
+#endif /* CONFIG_EFLO_TELEMETRY_ENCODER_BENCH */
@@ -0,0 +1,38 @@
+/*
+ * telem_bench.h
+ *
+ * One-shot encoder benchmark (CONFIG_EFLO_TELEMETRY_ENCODER_BENCH, debug).
+ *
+ * Encodes the synthetic lifecycle, snapshot page (CONFIG_EFLO_SNAPSHOT_PAGE_SIZE
+ * LoRa sensors) and leak event of telem_sample.h three ways, and logs for
+ * each the average time, size, heap drawn and the largest free heap block
+ * before, at the peak and after (fragmentation left behind):
+ *
+ *   cjson   cJSON tree + cJSON_PrintUnformatted (the encoder telemetry used
+ *           before telem_writer)
+ *   json    telem_writer into a fixed buffer
+ *   cbor    telem_writer, eflostop.v2b keys
+ *
+ * Also logs whether the two JSON outputs are byte-identical. The host
+ * counterpart, without cJSON, is tools/telem_bench_host.
+ */
+
+#ifndef TELEM_BENCH_H
+#define TELEM_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief  Run the benchmark and log the results (tag TELEM_BENCH). Takes a
+ *         few hundred ms; call once at init. No-op unless
+ *         CONFIG_EFLO_TELEMETRY_ENCODER_BENCH is set.
+ */
+void telem_bench_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEM_BENCH_H */
@@ -0,0 +1,112 @@
+/*
+ * telem_sample.c
+ *
+ * Synthetic telemetry messages for the encoder benchmarks. See
+ * telem_sample.h.
+ */
+
+#include "telem_sample.h"
+
+#include <stdio.h>
+#include "telemetry_v2b_keys.h"
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+/* Root object left open, as write_envelope() in telemetry_v2.c */
+static void sample_envelope(telem_writer_t *w, const char *type)
+{
+    telem_writer_obj_open(w, NULL);
+    telem_writer_str(w, "schema", w->cbor ? TELEMETRY_SCHEMA_V2B : "eflostop.v2");
+    telem_writer_int(w, "ts", TELEM_SAMPLE_TS);
+    telem_writer_obj_open(w, "gateway");
+    telem_writer_str(w, "id", "eflo-hub-8C4F00A1B2C3");
+    telem_writer_str(w, "short_id", "A1B2C3");
+    telem_writer_str(w, "name", "Basement hub");
+    telem_writer_str(w, "fw", "2.4.0");
+    telem_writer_int(w, "uptime_s", TELEM_SAMPLE_UPTIME_S);
+    telem_writer_obj_close(w);
+    telem_writer_str(w, "type", type);
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+void telem_sample_sensor_id(int i, char out[12])
+{
+    snprintf(out, 12, "0x%08lX", (unsigned long)(0x1A2B0000u + i));
+}
+
+void telem_sample_lifecycle(telem_writer_t *w)
+{
+    sample_envelope(w, "lifecycle");
+    telem_writer_obj_open(w, "data");
+    telem_writer_str(w, "event", "online");
+    telem_writer_str(w, "reset_reason", "power_on");
+    telem_writer_bool(w, "provisioned", true);
+    telem_writer_str(w, "valve_mac", "C8:2E:18:4A:11:F2");
+    telem_writer_arr_open(w, "valve_macs");
+    telem_writer_str(w, NULL, "C8:2E:18:4A:11:F2");
+    telem_writer_str(w, NULL, "C8:2E:18:4A:2B:07");
+    telem_writer_arr_close(w);
+    telem_writer_int(w, "lora_sensor_count", 16);
+    telem_writer_int(w, "ble_leak_sensor_count", 16);
+    telem_writer_obj_open(w, "rules");
+    telem_writer_bool(w, "auto_close_enabled", true);
+    telem_writer_int(w, "trigger_mask", 7);
+    telem_writer_obj_close(w);
+    telem_writer_obj_close(w);
+    telem_writer_obj_close(w);
+}
+
+void telem_sample_snapshot_page(telem_writer_t *w, int sensors)
+{
+    char id[12];
+    sample_envelope(w, "snapshot");
+    telem_writer_obj_open(w, "data");
+    telem_writer_obj_open(w, "system_health");
+    telem_writer_str(w, "rating", "good");
+    telem_writer_str(w, "reason", "all devices healthy");
+    telem_writer_obj_close(w);
+    telem_writer_arr_open(w, "lora_sensors");
+    for (int i = 0; i < sensors; i++) {
+        telem_sample_sensor_id(i, id);
+        telem_writer_obj_open(w, NULL);
+        telem_writer_str(w, "sensor_id", id);
+        telem_writer_bool(w, "connected", true);
+        telem_writer_str(w, "rating", "good");
+        telem_writer_int(w, "last_seen_age_s", 30 + i);
+        telem_writer_int(w, "battery", 80 + i % 20);
+        telem_writer_bool(w, "leak_state", false);
+        telem_writer_int(w, "rssi", -70 - i % 30);
+        telem_writer_num(w, "snr", 7.25);
+        telem_writer_obj_open(w, "location");
+        telem_writer_str(w, "code", "kitchen");
+        telem_writer_str(w, "label", "Under sink");
+        telem_writer_obj_close(w);
+        telem_writer_obj_close(w);
+    }
+    telem_writer_arr_close(w);
+    telem_writer_obj_close(w);
+    telem_writer_obj_close(w);
+}
+
+void telem_sample_event(telem_writer_t *w)
+{
+    sample_envelope(w, "event");
+    telem_writer_obj_open(w, "data");
+    telem_writer_str(w, "event", "leak_detected");
+    telem_writer_str(w, "source_type", "lora");
+    telem_writer_str(w, "sensor_id", "0x1A2B0007");
+    telem_writer_bool(w, "leak_state", true);
+    telem_writer_int(w, "battery", 87);
+    telem_writer_int(w, "rssi", -74);
+    telem_writer_obj_open(w, "location");
+    telem_writer_str(w, "code", "kitchen");
+    telem_writer_str(w, "label", "Under sink");
+    telem_writer_obj_close(w);
+    telem_writer_obj_close(w);
+    telem_writer_obj_close(w);
+}
@@ -0,0 +1,44 @@
+/*
+ * telem_sample.h
+ *
+ * Synthetic telemetry messages for the encoder benchmarks: the on-device
+ * one (telem_bench.c) and the host one (tools/telem_bench_host). Plain C, no
+ * ESP-IDF dependency.
+ *
+ * Each call writes one complete message with the eflostop.v2 envelope,
+ * shaped like what telemetry_v2.c publishes, with every optional field
+ * present. The schema string follows the writer's mode (eflostop.v2 for
+ * JSON, eflostop.v2b for CBOR).
+ */
+
+#ifndef TELEM_SAMPLE_H
+#define TELEM_SAMPLE_H
+
+#include "telem_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Values shared with the cJSON builders in telem_bench.c, so the JSON
+ * outputs can be compared byte for byte */
+#define TELEM_SAMPLE_TS        1770589401
+#define TELEM_SAMPLE_UPTIME_S  86400
+
+/** type="lifecycle" birth message, two valve slots. */
+void telem_sample_lifecycle(telem_writer_t *w);
+
+/** type="snapshot" page 0 with @p sensors LoRa sensors. */
+void telem_sample_snapshot_page(telem_writer_t *w, int sensors);
+
+/** type="event" leak_detected from a LoRa sensor, location included. */
+void telem_sample_event(telem_writer_t *w);
+
+/** Sensor id of sensor @p i in the snapshot page ("0x1A2B00nn"). */
+void telem_sample_sensor_id(int i, char out[12]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEM_SAMPLE_H */
@@ -0,0 +1,337 @@
+/*
+ * telem_writer.c
+ *
+ * Streaming JSON / CBOR writer. See telem_writer.h.
+ */
+
+#include "telem_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+/* =========================================================================
+ * HELPERS
+ * ========================================================================= */
+
+/* Room left for content: the reserve and the terminating NUL stay free */
+static size_t room(const telem_writer_t *w)
+{
+    size_t used = w->len + w->reserve + 1;
+    return used < w->cap ? w->cap - used : 0;
+}
+
+static void put(telem_writer_t *w, const char *s, size_t n)
+{
+    if (w->overflow) return;
+    if (n > room(w)) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void put_c(telem_writer_t *w, char c)
+{
+    put(w, &c, 1);
+}
+
+static void put_escaped(telem_writer_t *w, const char *s)
+{
+    put_c(w, '"');
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        put(w, run, (size_t)(s - run));
+        run = s + 1;
+        char esc[7];
+        switch (c) {
+            case '"':  put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\b': put(w, "\\b", 2);  break;
+            case '\f': put(w, "\\f", 2);  break;
+            case '\n': put(w, "\\n", 2);  break;
+            case '\r': put(w, "\\r", 2);  break;
+            case '\t': put(w, "\\t", 2);  break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                put(w, esc, 6);
+                break;
+        }
+    }
+    put(w, run, (size_t)(s - run));
+    put_c(w, '"');
+}
+
+/* ---- CBOR ---------------------------------------------------------------- */
+
+#define CBOR_UINT       0
+#define CBOR_NEGINT     1
+#define CBOR_TEXT       3
+#define CBOR_FALSE      0xF4
+#define CBOR_TRUE       0xF5
+#define CBOR_NULL       0xF6
+#define CBOR_FLOAT32    0xFA
+#define CBOR_FLOAT64    0xFB
+#define CBOR_MAP_OPEN   0xBF        /* indefinite length */
+#define CBOR_ARR_OPEN   0x9F
+#define CBOR_BREAK      0xFF
+
+/* Big-endian bytes of v after the initial byte `first` */
+static void cbor_be(telem_writer_t *w, uint8_t first, uint64_t v, int n)
+{
+    char b[9];
+    b[0] = (char)first;
+    for (int i = n; i > 0; i--) {
+        b[i] = (char)(v & 0xFF);
+        v >>= 8;
+    }
+    put(w, b, (size_t)n + 1);
+}
+
+/* Data item head: major type and argument in the shortest form */
+static void cbor_head(telem_writer_t *w, uint8_t major, uint64_t val)
+{
+    uint8_t m = (uint8_t)(major << 5);
+    if (val < 24)               put_c(w, (char)(m | val));
+    else if (val <= 0xFF)       cbor_be(w, m | 24, val, 1);
+    else if (val <= 0xFFFF)     cbor_be(w, m | 25, val, 2);
+    else if (val <= 0xFFFFFFFF) cbor_be(w, m | 26, val, 4);
+    else                        cbor_be(w, m | 27, val, 8);
+}
+
+static void cbor_text(telem_writer_t *w, const char *s)
+{
+    size_t n = strlen(s);
+    cbor_head(w, CBOR_TEXT, n);
+    put(w, s, n);
+}
+
+static void cbor_int(telem_writer_t *w, int64_t val)
+{
+    if (val >= 0) cbor_head(w, CBOR_UINT, (uint64_t)val);
+    else          cbor_head(w, CBOR_NEGINT, (uint64_t)(-(val + 1)));
+}
+
+static int key_id(const telem_writer_t *w, const char *key)
+{
+    size_t lo = 0, hi = w->nkeys;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(key, w->keys[mid].name);
+        if (c == 0) return w->keys[mid].id;
+        if (c < 0) hi = mid;
+        else       lo = mid + 1;
+    }
+    return -1;
+}
+
+/* ---- Members ------------------------------------------------------------- */
+
+/* Separator and key of the next member of the open container */
+static void begin_member(telem_writer_t *w, const char *key)
+{
+    uint32_t bit = 1u << (w->depth ? w->depth - 1 : 0);
+    if (w->depth > 0) {
+        if ((w->nonempty & bit) && !w->cbor) put_c(w, ',');
+        w->nonempty |= bit;
+    }
+    if (!key) return;
+
+    if (w->cbor) {
+        int id = key_id(w, key);
+        if (id >= 0) cbor_head(w, CBOR_UINT, (uint64_t)id);
+        else         cbor_text(w, key);
+    } else {
+        put_escaped(w, key);
+        put_c(w, ':');
+    }
+}
+
+static void open_container(telem_writer_t *w, const char *key, char c)
+{
+    begin_member(w, key);
+    if (w->cbor) put_c(w, (char)(c == '[' ? CBOR_ARR_OPEN : CBOR_MAP_OPEN));
+    else         put_c(w, c);
+    if (w->depth >= TELEM_WRITER_MAX_DEPTH) {
+        w->overflow = true;
+        return;
+    }
+    w->depth++;
+    w->nonempty &= ~(1u << (w->depth - 1));
+}
+
+static void close_container(telem_writer_t *w, char c)
+{
+    if (w->depth == 0) {
+        w->overflow = true;
+        return;
+    }
+    w->depth--;
+    put_c(w, w->cbor ? (char)CBOR_BREAK : c);
+}
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+void telem_writer_init(telem_writer_t *w, char *buf, size_t cap)
+{
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->cap = cap;
+    w->overflow = (buf == NULL || cap == 0);
+}
+
+void telem_writer_init_cbor(telem_writer_t *w, char *buf, size_t cap,
+                            const telem_writer_key_t *keys, size_t nkeys)
+{
+    telem_writer_init(w, buf, cap);
+    w->cbor  = true;
+    w->keys  = keys;
+    w->nkeys = keys ? nkeys : 0;
+}
+
+void telem_writer_obj_open(telem_writer_t *w, const char *key)
+{
+    open_container(w, key, '{');
+}
+
+void telem_writer_obj_close(telem_writer_t *w)
+{
+    close_container(w, '}');
+}
+
+void telem_writer_arr_open(telem_writer_t *w, const char *key)
+{
+    open_container(w, key, '[');
+}
+
+void telem_writer_arr_close(telem_writer_t *w)
+{
+    close_container(w, ']');
+}
+
+void telem_writer_str(telem_writer_t *w, const char *key, const char *val)
+{
+    begin_member(w, key);
+    if (w->cbor) {
+        if (val) cbor_text(w, val);
+        else     put_c(w, (char)CBOR_NULL);
+    } else {
+        if (val) put_escaped(w, val);
+        else     put(w, "null", 4);
+    }
+}
+
+void telem_writer_int(telem_writer_t *w, const char *key, int64_t val)
+{
+    if (w->cbor) {
+        begin_member(w, key);
+        cbor_int(w, val);
+        return;
+    }
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%" PRId64, val);
+    begin_member(w, key);
+    put(w, num, (size_t)n);
+}
+
+/* Same number formatting as cJSON_PrintUnformatted, so consumers see no change.
+ * CBOR: integral values as integers, others as float32 when that is exact. */
+void telem_writer_num(telem_writer_t *w, const char *key, double val)
+{
+    if (w->cbor) {
+        begin_member(w, key);
+        if (isnan(val) || isinf(val)) {
+            put_c(w, (char)CBOR_NULL);
+        } else if (fabs(val) < 1e15 && val == (double)(int64_t)val) {
+            cbor_int(w, (int64_t)val);
+        } else if ((double)(float)val == val) {
+            float f = (float)val;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            cbor_be(w, CBOR_FLOAT32, bits, 4);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &val, sizeof(bits));
+            cbor_be(w, CBOR_FLOAT64, bits, 8);
+        }
+        return;
+    }
+    char num[26];
+    int n;
+    if (isnan(val) || isinf(val)) {
+        n = snprintf(num, sizeof(num), "null");
+    } else if (fabs(val) < 1e15 && val == (double)(int64_t)val) {
+        n = snprintf(num, sizeof(num), "%" PRId64, (int64_t)val);
+    } else {
+        n = snprintf(num, sizeof(num), "%1.15g", val);
+        if (strtod(num, NULL) != val) {
+            n = snprintf(num, sizeof(num), "%1.17g", val);
+        }
+    }
+    begin_member(w, key);
+    put(w, num, (size_t)n);
+}
+
+void telem_writer_bool(telem_writer_t *w, const char *key, bool val)
+{
+    begin_member(w, key);
+    if (w->cbor) put_c(w, (char)(val ? CBOR_TRUE : CBOR_FALSE));
+    else if (val) put(w, "true", 4);
+    else          put(w, "false", 5);
+}
+
+void telem_writer_null(telem_writer_t *w, const char *key)
+{
+    begin_member(w, key);
+    if (w->cbor) put_c(w, (char)CBOR_NULL);
+    else         put(w, "null", 4);
+}
+
+void telem_writer_raw_member(telem_writer_t *w, const char *key,
+                             const char *json, size_t len)
+{
+    begin_member(w, key);
+    put(w, json, len);
+}
+
+void telem_writer_raw(telem_writer_t *w, const char *s, size_t len)
+{
+    put(w, s, len);
+}
+
+telem_writer_mark_t telem_writer_mark(const telem_writer_t *w)
+{
+    telem_writer_mark_t m = {
+        .len      = w->len,
+        .nonempty = w->nonempty,
+        .depth    = w->depth,
+        .overflow = w->overflow,
+    };
+    return m;
+}
+
+void telem_writer_rewind(telem_writer_t *w, telem_writer_mark_t m)
+{
+    w->len      = m.len;
+    w->nonempty = m.nonempty;
+    w->depth    = m.depth;
+    w->overflow = m.overflow;
+}
+
+const char *telem_writer_finish(telem_writer_t *w, size_t *len_out)
+{
+    if (w->overflow || w->depth != 0 || w->len >= w->cap) {
+        return NULL;
+    }
+    w->buf[w->len] = '\0';
+    if (len_out) *len_out = w->len;
+    return w->buf;
+}
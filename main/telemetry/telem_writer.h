@@ -0,0 +1,117 @@
+/*
+ * telem_writer.h
+ *
+ * Streaming JSON / CBOR writer into a caller-owned fixed buffer.
+ *
+ * Telemetry messages are written front to back straight into the buffer the
+ * MQTT publish reads from: no node tree, no intermediate print buffer, no
+ * heap. Members are added with a key inside objects and key == NULL inside
+ * arrays; separators are inserted by the writer.
+ *
+ * A message that does not fit sets the overflow flag and every later write
+ * is ignored; telem_writer_finish() then returns NULL. A mark / rewind pair
+ * drops a partly written member so a list can be cut short cleanly, and
+ * `reserve` holds bytes back for the closing members while it is written.
+ *
+ * A writer started with telem_writer_init_cbor() takes the same calls and
+ * writes CBOR (RFC 8949) instead: indefinite-length maps and arrays, so
+ * nothing is sized up front and mark / rewind work unchanged. Map keys found
+ * in the caller's key table are written as small integers, others as text.
+ * Raw members must then be CBOR too.
+ *
+ * Nesting is limited to TELEM_WRITER_MAX_DEPTH levels. Not thread-safe; one
+ * writer per buffer.
+ */
+
+#ifndef TELEM_WRITER_H
+#define TELEM_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEM_WRITER_MAX_DEPTH  32
+
+/* Integer CBOR map key for a key name */
+typedef struct {
+    const char *name;
+    uint16_t    id;
+} telem_writer_key_t;
+
+typedef struct {
+    char     *buf;
+    size_t    cap;          /* includes the terminating NUL */
+    size_t    len;
+    size_t    reserve;      /* bytes kept free for the caller's closing writes */
+    uint32_t  nonempty;     /* bit d: container at depth d has a member */
+    uint8_t   depth;
+    bool      overflow;
+    bool      cbor;
+    const telem_writer_key_t *keys;     /* CBOR: sorted by name */
+    size_t    nkeys;
+} telem_writer_t;
+
+/* Position to rewind to (telem_writer_mark) */
+typedef struct {
+    size_t   len;
+    uint32_t nonempty;
+    uint8_t  depth;
+    bool     overflow;
+} telem_writer_mark_t;
+
+/* =========================================================================
+ * PUBLIC API
+ * ========================================================================= */
+
+/** @brief  Start an empty message in buf[0..cap). */
+void telem_writer_init(telem_writer_t *w, char *buf, size_t cap);
+
+/** @brief  Same, writing CBOR. @p keys (sorted by name, strcmp order) map key names to integers. */
+void telem_writer_init_cbor(telem_writer_t *w, char *buf, size_t cap,
+                            const telem_writer_key_t *keys, size_t nkeys);
+
+/** @brief  Open / close an object or array. key == NULL at top level and in arrays. */
+void telem_writer_obj_open(telem_writer_t *w, const char *key);
+void telem_writer_obj_close(telem_writer_t *w);
+void telem_writer_arr_open(telem_writer_t *w, const char *key);
+void telem_writer_arr_close(telem_writer_t *w);
+
+/** @brief  Scalar members. A NULL string is written as null. */
+void telem_writer_str(telem_writer_t *w, const char *key, const char *val);
+void telem_writer_int(telem_writer_t *w, const char *key, int64_t val);
+void telem_writer_num(telem_writer_t *w, const char *key, double val);
+void telem_writer_bool(telem_writer_t *w, const char *key, bool val);
+void telem_writer_null(telem_writer_t *w, const char *key);
+
+/**
+ * @brief  Member whose value is already serialized JSON (or, with key ==
+ *         NULL in an object, a pre-serialized `"key":value` fragment),
+ *         copied verbatim. CBOR writers take CBOR bytes the same way.
+ */
+void telem_writer_raw_member(telem_writer_t *w, const char *key,
+                             const char *json, size_t len);
+
+/** @brief  Bytes copied verbatim with no separator, continuing the last member. */
+void telem_writer_raw(telem_writer_t *w, const char *s, size_t len);
+
+/** @brief  Save / restore the write position; an overflow after the mark is undone. */
+telem_writer_mark_t telem_writer_mark(const telem_writer_t *w);
+void telem_writer_rewind(telem_writer_t *w, telem_writer_mark_t m);
+
+/**
+ * @brief  NUL-terminate the message (not counted in the length; CBOR may
+ *         contain NUL bytes itself).
+ * @return the message (the caller's buffer), or NULL on overflow or while
+ *         a container is still open
+ */
+const char *telem_writer_finish(telem_writer_t *w, size_t *len_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEM_WRITER_H */
@@ -1,5 +1,7 @@
 #include "telemetry_v2.h"
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
@@ -8,24 +10,45 @@
 #include "esp_timer.h"
 #include "esp_system.h"
 #include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+
 #include "cJSON.h"
+#include "telem_writer.h"
+#include "telemetry_v2b_keys.h"
+#include "telem_bench.h"
 
 #include "app_ble_valve.h"
+#include "lora_rx_ring.h"
+#include "ble_scan.h"
+#include "app_ble_leak.h"
 #include "provisioning_manager.h"
 #include "sensor_meta.h"
 #include "health_engine.h"
 #include "rules_engine.h"
+#include "leak_latency.h"
 #include "offline_buffer.h"
+#include "delivery_tracker.h"
 #include "hub_identity.h"
 
 #define TELEM_TAG "TELEMETRY_V2"
 
-// ---- Module state (all accessed from iothub_task only) --------------------
+// Shared BLE scan narrowed while snapshot pages / an offline drain go out:
+// asserted for at most BULK_SCAN_NARROW_MAX_MS, then held BULK_SCAN_TAIL_MS
+// after the last publish so the PUBACKs come back on a quiet radio.
+#define BULK_SCAN_NARROW_MAX_MS  10000
+#define BULK_SCAN_TAIL_MS        1000
+
+// Event loop wake-up while offline-buffer entries, a deferred lifecycle or
+// the rest of a snapshot wait for PUBACKs
+#define DELIVERY_POLL_MS         100
+
+// ---- Module state (iothub_task only, unless noted) ------------------------
 
 static esp_mqtt_client_handle_t s_mqtt   = NULL;
 static char s_device_id[64]              = {0};
 static char s_gateway_id[32]             = {0};
-static char s_topic[128]                 = {0};
+// Events topic per encoding, with the IoT Hub content-type properties
+static char s_topic[TELEM_ENCODING_MAX][192];
 
 static const telem_lora_cache_t     *s_lora_cache = NULL;
 static const telem_ble_leak_cache_t *s_ble_cache  = NULL;
@@ -34,6 +57,46 @@ static bool           s_connected      = false;
 static TimerHandle_t  s_snapshot_timer = NULL;
 static QueueHandle_t  s_snapshot_queue = NULL;
 
+// Every message is written straight into this buffer and published from it;
+// sized for a full snapshot page (CONFIG_EFLO_TELEMETRY_BUF_SIZE)
+static char     s_msg_buf[CONFIG_EFLO_TELEMETRY_BUF_SIZE];
+static uint32_t s_msg_overflows = 0;    // messages dropped for not fitting
+static int64_t  s_msg_begin_us  = 0;    // begin_envelope of the message being written
+static int64_t  s_msg_sent_us   = 0;    // publish call of the last message
+static uint32_t s_events_deferred = 0;  // events stored in the offline buffer while online
+static time_t   s_msg_ts        = 0;    // its envelope ts
+static size_t   s_msg_body_at   = 0;    // its length after the envelope (s_msg_buf)
+
+// Set from the MQTT task (Device Twin desired encoding)
+static volatile telem_encoding_t s_encoding = TELEM_ENCODING_JSON;
+
+// Gateway members other than uptime, serialized once in the current
+// encoding: "id":..,"short_id":..,"name":..,"fw":..
+// Rebuilt when the hub name or the encoding changes.
+static char             s_env_gw[384];
+static size_t           s_env_gw_len = 0;
+static telem_encoding_t s_env_enc;
+static char             s_env_name[HUB_NAME_MAX_LEN + 1];
+
+typedef enum {
+    MSG_CLASS_LIFECYCLE = 0,
+    MSG_CLASS_SNAPSHOT,
+    MSG_CLASS_EVENT,
+    MSG_CLASS_MAX,
+} msg_class_t;
+
+#if CONFIG_EFLO_TELEMETRY_ENCODER_BENCH
+// Messages, bytes and encode time per encoding and message type: the
+// on-device comparison of JSON and CBOR, reported in the snapshot "encoder"
+typedef struct {
+    uint32_t msgs;
+    uint32_t bytes;
+    uint32_t encode_us;
+} encode_stats_t;
+
+static encode_stats_t s_enc_stats[TELEM_ENCODING_MAX][MSG_CLASS_MAX];
+#endif
+
 // ---- Helpers --------------------------------------------------------------
 
 // Single source of truth for the hub firmware version: the ESP-IDF application
@@ -49,65 +112,336 @@ const char *telemetry_v2_fw_version(void)
 // Minimum epoch to consider time synced (2024-01-01 00:00:00 UTC)
 #define EPOCH_VALID_THRESHOLD_TELEM  1704067200
 
-static cJSON *build_envelope(const char *type)
+static void writer_init(telem_writer_t *w, char *buf, size_t cap, telem_encoding_t enc)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (!root) return NULL;
+    if (enc == TELEM_ENCODING_CBOR) {
+        telem_writer_init_cbor(w, buf, cap, telemetry_v2b_keys, telemetry_v2b_key_count);
+    } else {
+        telem_writer_init(w, buf, cap);
+    }
+}
 
-    cJSON_AddStringToObject(root, "schema", TELEMETRY_SCHEMA);
+static void refresh_envelope_cache(telem_encoding_t enc)
+{
+    const char *name = hub_identity_get_name();
+    if (s_env_gw_len && s_env_enc == enc && strcmp(name, s_env_name) == 0) return;
+
+    // Written as an object and kept without its opening byte ('{' / 0xBF)
+    telem_writer_t w;
+    writer_init(&w, s_env_gw, sizeof(s_env_gw), enc);
+    telem_writer_obj_open(&w, NULL);
+    telem_writer_str(&w, "id", s_gateway_id);
+    telem_writer_str(&w, "short_id", hub_identity_get_short_id());
+    if (name[0])
+        telem_writer_str(&w, "name", name);
+    telem_writer_str(&w, "fw", telemetry_v2_fw_version());
+
+    s_env_gw_len = w.overflow ? 0 : w.len - 1;
+    memmove(s_env_gw, s_env_gw + 1, s_env_gw_len);
+    s_env_enc = enc;
+    strncpy(s_env_name, name, sizeof(s_env_name) - 1);
+}
 
+// Start a message in buf with the envelope (schema, ts, gateway, type)
+// written and the root object left open. False while time is not synced.
+static bool write_envelope(telem_writer_t *w, char *buf, size_t cap,
+                           telem_encoding_t enc, const char *type)
+{
     time_t now;
     time(&now);
 
     /* Suppress telemetry if SNTP has not synced yet */
     if (now < EPOCH_VALID_THRESHOLD_TELEM) {
         ESP_LOGW(TELEM_TAG, "Time not synced (ts=%ld) — suppressing %s", (long)now, type);
-        cJSON_Delete(root);
-        return NULL;
+        return false;
     }
 
-    cJSON_AddNumberToObject(root, "ts", (double)now);
+    refresh_envelope_cache(enc);
+    if (s_env_gw_len == 0) return false;
+
+    s_msg_begin_us = esp_timer_get_time();
+    s_msg_ts = now;
+    writer_init(w, buf, cap, enc);
+    telem_writer_obj_open(w, NULL);
+    telem_writer_str(w, "schema",
+                     enc == TELEM_ENCODING_CBOR ? TELEMETRY_SCHEMA_V2B : TELEMETRY_SCHEMA);
+    telem_writer_int(w, "ts", (int64_t)now);
+    telem_writer_obj_open(w, "gateway");
+    telem_writer_raw_member(w, NULL, s_env_gw, s_env_gw_len);
+    telem_writer_int(w, "uptime_s", s_msg_begin_us / 1000000);
+    telem_writer_obj_close(w);
+    telem_writer_str(w, "type", type);
+    return true;
+}
+
+// Start a message in s_msg_buf in the hub's current encoding
+static bool begin_envelope(telem_writer_t *w, const char *type)
+{
+    if (!write_envelope(w, s_msg_buf, sizeof(s_msg_buf), s_encoding, type)) return false;
+    s_msg_body_at = w->len;
+    return true;
+}
 
-    cJSON *gw = cJSON_CreateObject();
-    cJSON_AddStringToObject(gw, "id", s_gateway_id);
-    cJSON_AddStringToObject(gw, "short_id", hub_identity_get_short_id());
-    const char *hub_name = hub_identity_get_name();
-    if (hub_name[0])
-        cJSON_AddStringToObject(gw, "name", hub_name);
-    cJSON_AddStringToObject(gw, "fw", telemetry_v2_fw_version());
-    cJSON_AddNumberToObject(gw, "uptime_s",
-                            (double)(esp_timer_get_time() / 1000000));
-    cJSON_AddItemToObject(root, "gateway", gw);
+static msg_class_t msg_class(const char *type_hint)
+{
+    if (strcmp(type_hint, "lifecycle") == 0) return MSG_CLASS_LIFECYCLE;
+    if (strcmp(type_hint, "snapshot") == 0)  return MSG_CLASS_SNAPSHOT;
+    return MSG_CLASS_EVENT;
+}
 
-    cJSON_AddStringToObject(root, "type", type);
+// Topic for a stored message: CBOR messages open with an indefinite map
+static const char *topic_for_message(const char *msg, size_t len)
+{
+    bool cbor = len > 0 && (uint8_t)msg[0] == 0xBF;
+    return s_topic[cbor ? TELEM_ENCODING_CBOR : TELEM_ENCODING_JSON];
+}
 
-    return root;
+// Events are published directly only while connected, with nothing queued
+// ahead of them in the offline buffer and room under the in-flight cap.
+// Urgent ones (leak, flood, rules) need only the connection: they pass the
+// cap and the offline backlog, which the cloud orders by ts.
+static bool events_live(bool urgent)
+{
+    if (!s_mqtt || !s_connected) return false;
+    return urgent || (offline_buffer_count() == 0 && delivery_tracker_has_slot());
 }
 
-static void publish_json(cJSON *root, const char *type_hint)
+// Close the root object opened by begin_envelope and publish the message.
+// Returns the MQTT msg_id, or -1 if it was not handed to MQTT (buffered
+// offline or dropped); *bytes_out gets the bytes published or buffered.
+// urgent: an event that may pass the in-flight cap (events_live).
+static int publish_msg(telem_writer_t *w, const char *type_hint, size_t *bytes_out,
+                       bool urgent)
 {
-    if (!root) return;
+    if (bytes_out) *bytes_out = 0;
+    telem_writer_obj_close(w);
+    size_t len = 0;
+    const char *msg = telem_writer_finish(w, &len);
+    if (!msg) {
+        s_msg_overflows++;
+        ESP_LOGE(TELEM_TAG, "%s dropped: larger than the %d B message buffer",
+                 type_hint, (int)w->cap - 1);
+        return -1;
+    }
 
-    char *json_str = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    if (!json_str) return;
+    telem_encoding_t enc = w->cbor ? TELEM_ENCODING_CBOR : TELEM_ENCODING_JSON;
+    msg_class_t cls = msg_class(type_hint);
+#if CONFIG_EFLO_TELEMETRY_ENCODER_BENCH
+    encode_stats_t *st = &s_enc_stats[enc][cls];
+    st->msgs++;
+    st->bytes += len;
+    st->encode_us += (uint32_t)(esp_timer_get_time() - s_msg_begin_us);
+#endif
+
+    bool online = s_mqtt && s_connected;
+    if (cls == MSG_CLASS_EVENT) {
+        if (online && !events_live(urgent)) {
+            // Behind buffered events or at the in-flight cap with the batch
+            // full: keep the order
+            s_events_deferred++;
+            online = false;
+        }
+    } else if (online && !delivery_tracker_has_slot()) {
+        // Callers defer until there is room; never wait here
+        ESP_LOGW(TELEM_TAG, "%s dropped: %d messages in flight without PUBACK",
+                 type_hint, DELIVERY_MAX_IN_FLIGHT);
+        return -1;
+    }
 
-    if (s_mqtt && s_connected) {
+    int msg_id = -1;
+    if (online) {
         // Online: publish directly
-        ESP_LOGI(TELEM_TAG, "Pub %s: %s", type_hint, json_str);
-        esp_mqtt_client_publish(s_mqtt, s_topic, json_str, 0, 1, 0);
-    } else if (strcmp(type_hint, "event") == 0) {
+        if (w->cbor) ESP_LOGI(TELEM_TAG, "Pub %s: %u B CBOR", type_hint, (unsigned)len);
+        else         ESP_LOGI(TELEM_TAG, "Pub %s: %s", type_hint, msg);
+        s_msg_sent_us = esp_timer_get_time();
+        msg_id = esp_mqtt_client_publish(s_mqtt, s_topic[enc], msg, (int)len, 1, 0);
+        // Snapshot pages are tracked by the snapshot, with their snapshot_id
+        if (cls != MSG_CLASS_SNAPSHOT) {
+            delivery_tracker_track(msg_id, DELIVERY_LIVE, 0, s_msg_sent_us);
+        }
+    } else if (cls == MSG_CLASS_EVENT) {
         // Offline: buffer critical events for replay on reconnect
-        ESP_LOGW(TELEM_TAG, "Offline — buffering %s event", type_hint);
-        offline_buffer_store(json_str, strlen(json_str));
+        ESP_LOGW(TELEM_TAG, "Offline — buffering %s", type_hint);
+        if (!offline_buffer_store(msg, len)) return -1;
     } else {
         // Offline: drop lifecycle/snapshot (regenerated on reconnect)
         ESP_LOGD(TELEM_TAG, "Offline — dropping %s (regenerated)", type_hint);
+        return -1;
+    }
+    if (bytes_out) *bytes_out = len;
+    return msg_id;
+}
+
+// ---- Event batching -------------------------------------------------------
+//
+// While connected, events are held for up to BATCH_LINGER_MS and then go out
+// together as one type="batch" message: one envelope, then
+// data.events = [{ts, data}, ...] in publish order. A batch that became due
+// holding a single event is sent as that plain event. At the in-flight cap
+// or behind buffered events the batch is the RAM queue: it stays held past
+// its linger until events are live again, so bursts cost no flash. Only a
+// disconnect or a full batch puts the held events in the offline buffer,
+// split back into single events, since an entry takes at most
+// OFFLINE_BUF_MAX_JSON_LEN. Leak, flood and rules events are flush-now: they
+// send the batch at once with themselves in it, past the cap, or go out
+// alone when nothing is held.
+
+#define BATCH_LINGER_MS   CONFIG_EFLO_TELEMETRY_BATCH_LINGER_MS
+#define BATCH_MAX_EVENTS  32
+
+static char s_batch_buf[CONFIG_EFLO_TELEMETRY_BATCH_MAX_BYTES];
+// Splits a batch while the event that closed it still holds s_msg_buf. Only
+// used when events are not live, so nothing larger could be buffered anyway.
+static char s_unwrap_buf[OFFLINE_BUF_MAX_JSON_LEN + 1];
+
+static struct {
+    telem_writer_t w;
+    int64_t  due_us;                        // 0: no batch open
+    uint32_t encode_us;                     // summed over its events
+    uint16_t events;
+    uint16_t data_at[BATCH_MAX_EVENTS];     // each event's "data" member in s_batch_buf
+    uint16_t data_len[BATCH_MAX_EVENTS];
+} s_batch;
+
+static uint32_t s_batches_sent   = 0;
+static uint32_t s_batched_events = 0;
+
+// Publish the held event `i` on its own from buf
+static void batch_publish_one(int i, telem_encoding_t enc, char *buf, size_t cap,
+                              bool urgent)
+{
+    telem_writer_t w;
+    if (!write_envelope(&w, buf, cap, enc, "event")) return;
+    telem_writer_raw(&w, s_batch_buf + s_batch.data_at[i], s_batch.data_len[i]);
+    publish_msg(&w, "event", NULL, urgent);
+}
+
+typedef enum {
+    BATCH_SEND = 0,     // once events are live; held meanwhile while connected
+    BATCH_URGENT,       // now, past the in-flight cap and the offline backlog
+    BATCH_RELEASE,      // now, or into the offline buffer (the batch is full)
+} batch_send_t;
+
+// Send the open batch. msg_buf_free: s_msg_buf is not holding an event.
+// False if the batch is still held.
+static bool batch_flush(bool msg_buf_free, batch_send_t how)
+{
+    if (!s_batch.due_us) return true;
+    bool urgent = how == BATCH_URGENT;
+    bool live = events_live(urgent);
+    if (!live && how == BATCH_SEND && s_mqtt && s_connected) return false;
+
+    s_batch.due_us = 0;
+    telem_writer_t *w = &s_batch.w;
+    telem_encoding_t enc = w->cbor ? TELEM_ENCODING_CBOR : TELEM_ENCODING_JSON;
+
+    if (!live || (msg_buf_free && s_batch.events == 1)) {
+        for (int i = 0; i < s_batch.events; i++) {
+            if (msg_buf_free) batch_publish_one(i, enc, s_msg_buf, sizeof(s_msg_buf), urgent);
+            else              batch_publish_one(i, enc, s_unwrap_buf, sizeof(s_unwrap_buf), urgent);
+        }
+        return true;
+    }
+
+    w->reserve = 0;
+    telem_writer_arr_close(w);
+    telem_writer_obj_close(w);
+    s_msg_begin_us = esp_timer_get_time() - s_batch.encode_us;  // publish_msg's encode time
+    publish_msg(w, "batch", NULL, urgent);
+    s_batches_sent++;
+    s_batched_events += s_batch.events;
+    return true;
+}
+
+static bool batch_open(telem_encoding_t enc)
+{
+    telem_writer_t *w = &s_batch.w;
+    if (!write_envelope(w, s_batch_buf, sizeof(s_batch_buf), enc, "batch")) return false;
+    telem_writer_obj_open(w, "data");
+    telem_writer_arr_open(w, "events");
+    w->reserve = 3;     // closing the array, data and the root
+    s_batch.due_us    = esp_timer_get_time() + (int64_t)BATCH_LINGER_MS * 1000;
+    s_batch.encode_us = 0;
+    s_batch.events    = 0;
+    return true;
+}
+
+// Add the event in s_msg_buf to the open batch. False if it does not fit.
+static bool batch_append(const telem_writer_t *ev, uint32_t encode_us)
+{
+    telem_writer_t *w = &s_batch.w;
+    if (s_batch.events >= BATCH_MAX_EVENTS) return false;
+
+    // The "data" member as written after the envelope, separator included
+    const char *data = ev->buf + s_msg_body_at;
+    size_t data_len = ev->len - s_msg_body_at;
+
+    telem_writer_mark_t m = telem_writer_mark(w);
+    telem_writer_obj_open(w, NULL);
+    telem_writer_int(w, "ts", (int64_t)s_msg_ts);
+    size_t data_at = w->len;
+    telem_writer_raw(w, data, data_len);
+    telem_writer_obj_close(w);
+    if (w->overflow) {
+        telem_writer_rewind(w, m);
+        return false;
+    }
+
+    int i = s_batch.events++;
+    s_batch.data_at[i]  = (uint16_t)data_at;
+    s_batch.data_len[i] = (uint16_t)data_len;
+    s_batch.encode_us  += encode_us;
+    return true;
+}
+
+// Publish the event written since begin_envelope: through the batch while
+// connected, or on its own
+static void publish_event(telem_writer_t *w, bool flush_now)
+{
+    bool connected = s_mqtt && s_connected;
+    uint32_t encode_us = (uint32_t)(esp_timer_get_time() - s_msg_begin_us);
+
+    if (s_batch.due_us) {
+        // Behind the held events; s_msg_buf is free again once it is copied
+        if (s_batch.w.cbor == w->cbor && !w->overflow && batch_append(w, encode_us)) {
+            if (flush_now || !connected) {
+                batch_flush(true, flush_now ? BATCH_URGENT : BATCH_SEND);
+            }
+            return;
+        }
+        // The batch is full: out now, or into the offline buffer
+        batch_flush(false, flush_now ? BATCH_URGENT : BATCH_RELEASE);
+    }
+    bool live = events_live(flush_now);
+    if (!connected || w->overflow || (live && (BATCH_LINGER_MS == 0 || flush_now))) {
+        publish_msg(w, "event", NULL, flush_now);
+        return;
     }
 
-    free(json_str);
+    // First of a new batch, lingering or held for in-flight room.
+    // write_envelope restarts the message clock of the event still in
+    // s_msg_buf, so it is put back.
+    int64_t begin_us = s_msg_begin_us;
+    time_t ts = s_msg_ts;
+    bool opened = batch_open(w->cbor ? TELEM_ENCODING_CBOR : TELEM_ENCODING_JSON);
+    s_msg_begin_us = begin_us;
+    s_msg_ts = ts;
+    if (!opened || !batch_append(w, encode_us)) {
+        s_batch.due_us = 0;
+        publish_msg(w, "event", NULL, flush_now);
+    }
+}
+
+// Held past its linger only while events are not live; once disconnected
+// it goes to the offline buffer here
+void telemetry_v2_batch_poll(void)
+{
+    if (s_batch.due_us && esp_timer_get_time() >= s_batch.due_us) {
+        batch_flush(true, BATCH_SEND);
+    }
 }
 
+
 static const char *reset_reason_str(void)
 {
     switch (esp_reset_reason()) {
@@ -123,21 +457,64 @@ static const char *reset_reason_str(void)
     }
 }
 
-static void add_location_obj(cJSON *parent, sensor_type_t type,
-                             const char *sensor_id)
+static void add_location_meta(telem_writer_t *w, const sensor_meta_entry_t *meta)
 {
-    const sensor_meta_entry_t *meta = sensor_meta_find(type, sensor_id);
-    cJSON *loc = cJSON_CreateObject();
-    cJSON_AddStringToObject(loc, "code",
+    telem_writer_obj_open(w, "location");
+    telem_writer_str(w, "code",
         sensor_meta_location_code_to_str(
             meta ? meta->location_code : LOC_UNKNOWN));
-    cJSON_AddStringToObject(loc, "label", meta ? meta->label : "");
-    cJSON_AddItemToObject(parent, "location", loc);
+    telem_writer_str(w, "label", meta ? meta->label : "");
+    telem_writer_obj_close(w);
+}
+
+static void add_location_obj(telem_writer_t *w, sensor_type_t type,
+                             const char *sensor_id)
+{
+    add_location_meta(w, sensor_meta_find(type, sensor_id));
 }
 
 // ---- System health reason builder ----------------------------------------
 
-static void build_system_health_reason(const health_device_status_t *health,
+// Root causes of the devices sitting at the system rating. Counted over the
+// device table in pages so the snapshot never holds every status at once.
+typedef struct {
+    int  offline;
+    int  batt;
+    int  signal;
+    bool valve_offline;
+    bool valve_grace;
+    bool valve_batt;
+} health_reason_counts_t;
+
+static void count_health_reason(const health_device_status_t *d,
+                                health_rating_t sys_rating,
+                                health_reason_counts_t *c)
+{
+    if (!d->in_use || d->rating != sys_rating)
+        return;
+
+    if (d->dev_type == HEALTH_DEV_VALVE) {
+        if (!d->connected) {
+            if (sys_rating == HEALTH_CRITICAL) c->valve_offline = true;
+            else                               c->valve_grace   = true;
+        } else {
+            // Connected valve at degraded rating → battery issue
+            c->valve_batt = true;
+        }
+    } else {
+        // Sensor: determine root cause of this rating
+        if (!d->connected) {
+            c->offline++;
+        } else if (d->last_battery != 0xFF &&
+                   d->last_battery <= HEALTH_BATTERY_GOOD_PCT) {
+            c->batt++;
+        } else {
+            c->signal++;
+        }
+    }
+}
+
+static void build_system_health_reason(const health_reason_counts_t *c,
                                        health_rating_t sys_rating,
                                        char *buf, size_t buf_len)
 {
@@ -146,60 +523,25 @@ static void build_system_health_reason(const health_device_status_t *health,
         return;
     }
 
-    // Count devices at system rating level, categorized by root cause
-    int offline_count = 0;
-    int batt_count    = 0;
-    int signal_count  = 0;
-    bool valve_offline = false;
-    bool valve_grace   = false;
-    bool valve_batt    = false;
-
-    for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-        if (!health[i].in_use || health[i].rating != sys_rating)
-            continue;
-
-        const health_device_status_t *d = &health[i];
-
-        if (d->dev_type == HEALTH_DEV_VALVE) {
-            if (!d->connected) {
-                if (sys_rating == HEALTH_CRITICAL) valve_offline = true;
-                else                               valve_grace   = true;
-            } else {
-                // Connected valve at degraded rating → battery issue
-                valve_batt = true;
-            }
-        } else {
-            // Sensor: determine root cause of this rating
-            if (!d->connected) {
-                offline_count++;
-            } else if (d->last_battery != 0xFF &&
-                       d->last_battery <= HEALTH_BATTERY_GOOD_PCT) {
-                batt_count++;
-            } else {
-                signal_count++;
-            }
-        }
-    }
-
     // Build comma-separated reason string (most critical issues first)
     char parts[5][64];
     int n = 0;
 
-    if (valve_offline)
+    if (c->valve_offline)
         snprintf(parts[n++], 64, "Valve offline");
-    if (valve_grace)
+    if (c->valve_grace)
         snprintf(parts[n++], 64, "Valve disconnected");
-    if (valve_batt)
+    if (c->valve_batt)
         snprintf(parts[n++], 64, "Valve battery low");
-    if (offline_count > 0)
+    if (c->offline > 0)
         snprintf(parts[n++], 64, "%d sensor%s offline",
-                 offline_count, offline_count > 1 ? "s" : "");
-    if (batt_count > 0 && n < 5)
+                 c->offline, c->offline > 1 ? "s" : "");
+    if (c->batt > 0 && n < 5)
         snprintf(parts[n++], 64, "%d sensor%s battery low",
-                 batt_count, batt_count > 1 ? "s" : "");
-    if (signal_count > 0 && n < 5)
+                 c->batt, c->batt > 1 ? "s" : "");
+    if (c->signal > 0 && n < 5)
         snprintf(parts[n++], 64, "%d sensor%s signal weak",
-                 signal_count, signal_count > 1 ? "s" : "");
+                 c->signal, c->signal > 1 ? "s" : "");
 
     if (n == 0) {
         snprintf(buf, buf_len, "Degraded");
@@ -225,6 +567,8 @@ static void snapshot_timer_cb(TimerHandle_t xTimer)
 
 // ---- Public API -----------------------------------------------------------
 
+static void snap_on_delivery(uint32_t snapshot_id, bool acked);
+
 void telemetry_v2_init(esp_mqtt_client_handle_t client,
                        const char *device_id,
                        const char *gateway_id,
@@ -234,11 +578,17 @@ void telemetry_v2_init(esp_mqtt_client_handle_t client,
     s_mqtt = client;
     strncpy(s_device_id, device_id, sizeof(s_device_id) - 1);
     strncpy(s_gateway_id, gateway_id, sizeof(s_gateway_id) - 1);
-    snprintf(s_topic, sizeof(s_topic),
-             "devices/%s/messages/events/", s_device_id);
+    // $.ct / $.ce let IoT Hub routing read the body. CBOR has no character
+    // encoding, so only its content type is set.
+    snprintf(s_topic[TELEM_ENCODING_JSON], sizeof(s_topic[0]),
+             "devices/%s/messages/events/$.ct=application%%2Fjson&$.ce=utf-8", s_device_id);
+    snprintf(s_topic[TELEM_ENCODING_CBOR], sizeof(s_topic[0]),
+             "devices/%s/messages/events/$.ct=application%%2Fcbor", s_device_id);
 
     s_lora_cache = lora_cache;
     s_ble_cache  = ble_cache;
+    s_env_gw_len = 0;   // gateway id may have changed
+    delivery_tracker_set_callback(DELIVERY_SNAPSHOT, snap_on_delivery);
 
     // 1-item queue: timer callback writes here, event loop reads via QueueSet
     s_snapshot_queue = xQueueCreate(1, sizeof(uint8_t));
@@ -251,6 +601,8 @@ void telemetry_v2_init(esp_mqtt_client_handle_t client,
 
     ESP_LOGI(TELEM_TAG, "Init: schema=%s interval=%ds",
              TELEMETRY_SCHEMA, SNAPSHOT_INTERVAL_MS / 1000);
+
+    telem_bench_run();      // CONFIG_EFLO_TELEMETRY_ENCODER_BENCH only
 }
 
 QueueHandle_t telemetry_v2_get_snapshot_queue(void)
@@ -275,278 +627,1216 @@ void telemetry_v2_set_snapshot_interval(int seconds)
     ESP_LOGI(TELEM_TAG, "Snapshot interval changed to %ds", seconds);
 }
 
+void telemetry_v2_trigger_snapshot(void)
+{
+    uint8_t trigger = 1;
+    if (s_snapshot_queue) xQueueSend(s_snapshot_queue, &trigger, 0);
+}
+
 // ---- Lifecycle ------------------------------------------------------------
 
+// Waiting for an in-flight slot; telemetry_v2_publish_deferred() retries
+static bool s_lifecycle_pending = false;
+
 void telemetry_v2_publish_lifecycle(void)
 {
-    cJSON *root = build_envelope("lifecycle");
-    if (!root) return;
+    // Held events go first; both wait for in-flight room in the event loop
+    bool was_pending = s_lifecycle_pending;
+    s_lifecycle_pending = !batch_flush(true, BATCH_SEND) ||
+                          (s_mqtt && s_connected && !delivery_tracker_has_slot());
+    if (s_lifecycle_pending) {
+        if (!was_pending) {
+            ESP_LOGI(TELEM_TAG, "Lifecycle deferred: held events or %d messages in flight",
+                     DELIVERY_MAX_IN_FLIGHT);
+        }
+        return;
+    }
 
-    cJSON *data = cJSON_CreateObject();
-    cJSON_AddStringToObject(data, "event", "online");
-    cJSON_AddStringToObject(data, "reset_reason", reset_reason_str());
-    cJSON_AddBoolToObject(data, "provisioned", provisioning_is_provisioned());
+    telem_writer_t w;
+    if (!begin_envelope(&w, "lifecycle")) return;
 
-    char valve_mac[18];
-    if (provisioning_get_valve_mac(valve_mac))
-        cJSON_AddStringToObject(data, "valve_mac", valve_mac);
+    telem_writer_obj_open(&w, "data");
+    telem_writer_str(&w, "event", "online");
+    telem_writer_str(&w, "reset_reason", reset_reason_str());
+    telem_writer_bool(&w, "provisioned", provisioning_is_provisioned());
 
-    uint32_t ids[MAX_LORA_SENSORS];
-    uint8_t cnt = 0;
-    provisioning_get_lora_sensors(ids, &cnt);
-    cJSON_AddNumberToObject(data, "lora_sensor_count", cnt);
+    // valve_mac: valve 0, for single-valve apps; valve_macs: every slot
+    char valve_mac[18];
+    if (provisioning_get_valve_mac(0, valve_mac))
+        telem_writer_str(&w, "valve_mac", valve_mac);
+    telem_writer_arr_open(&w, "valve_macs");
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        telem_writer_str(&w, NULL, provisioning_get_valve_mac(v, valve_mac) ? valve_mac : NULL);
+    }
+    telem_writer_arr_close(&w);
 
-    char macs[MAX_BLE_LEAK_SENSORS][18];
-    uint8_t bcnt = 0;
-    provisioning_get_ble_leak_sensors(macs, &bcnt);
-    cJSON_AddNumberToObject(data, "ble_leak_sensor_count", bcnt);
+    telem_writer_int(&w, "lora_sensor_count", device_registry_count(DEVREG_LORA));
+    telem_writer_int(&w, "ble_leak_sensor_count", device_registry_count(DEVREG_BLE_LEAK));
 
     rules_config_t rules;
     if (provisioning_get_rules_config(&rules)) {
-        cJSON *r = cJSON_CreateObject();
-        cJSON_AddBoolToObject(r, "auto_close_enabled", rules.auto_close_enabled);
-        cJSON_AddNumberToObject(r, "trigger_mask", rules.trigger_mask);
-        cJSON_AddItemToObject(data, "rules", r);
+        telem_writer_obj_open(&w, "rules");
+        telem_writer_bool(&w, "auto_close_enabled", rules.auto_close_enabled);
+        telem_writer_int(&w, "trigger_mask", rules.trigger_mask);
+        telem_writer_obj_close(&w);
     }
 
-    cJSON_AddItemToObject(root, "data", data);
-    publish_json(root, "lifecycle");
+    telem_writer_obj_close(&w);
+    publish_msg(&w, "lifecycle", NULL, false);
 }
 
 // ---- Snapshot -------------------------------------------------------------
 
-void telemetry_v2_publish_snapshot(void)
+#define SNAPSHOT_PAGE_SIZE     CONFIG_EFLO_SNAPSHOT_PAGE_SIZE
+#define SNAPSHOT_HEALTH_BATCH  16     // health entries copied per mutex hold
+#define SNAPSHOT_TAIL_RESERVE  256    // held back while sensors are written:
+                                      // list closes, override, truncated, page
+#define SNAPSHOT_MAX_PAGES     ((DEVREG_MAX_LORA + DEVREG_MAX_BLE + SNAPSHOT_PAGE_SIZE - 1) \
+                                / SNAPSHOT_PAGE_SIZE)
+
+// Scratch for paging through the health table (iothub_task only)
+static health_device_status_t s_health_batch[SNAPSHOT_HEALTH_BATCH];
+static uint32_t s_snapshot_id = 0;
+
+// Cost of one snapshot over all its pages. The last one is reported in the
+// next snapshot's "encoder" object.
+typedef struct {
+    uint32_t encode_us;     // writing the pages, MQTT hand-off excluded
+    uint32_t publish_us;    // esp_mqtt_client_publish (outbox copy, TLS write)
+    uint32_t bytes;
+    uint32_t heap_drawn;    // free heap at start minus lowest free after a page
+    uint32_t largest_free;  // largest free block after the last page
+    uint16_t pages;
+    uint16_t truncated;     // sensors left out of a full page
+} snapshot_cost_t;
+
+static snapshot_cost_t s_last_cost;
+
+// ---- Delta snapshots ------------------------------------------------------
+//
+// With snapshot_mode "delta" a snapshot carries only what differs from the
+// digests below: what the snapshots since the last keyframe reported, per
+// page-0 section and per device field. A digest takes only what was actually
+// written, so a value left out of a full page is still "changed" next time.
+// A delta is sent only on top of a snapshot whose pages were all PUBACKed;
+// otherwise the cloud may lack part of the base and a keyframe goes instead.
+
+#define SNAPSHOT_KEYFRAME_EVERY  CONFIG_EFLO_SNAPSHOT_KEYFRAME_EVERY
+#define SNAPSHOT_RSSI_DEADBAND   6    // dB; smaller moves are radio noise
+#define SNAPSHOT_SNR_DEADBAND    3    // dB
+
+// Device entry fields, compared and written separately
+#define SNAP_F_CONNECTED  0x0001
+#define SNAP_F_RATING     0x0002
+#define SNAP_F_BATTERY    0x0004
+#define SNAP_F_LEAK       0x0008
+#define SNAP_F_RMLEAK     0x0010
+#define SNAP_F_RSSI       0x0020
+#define SNAP_F_SNR        0x0040
+#define SNAP_F_FW         0x0080
+#define SNAP_F_STATE      0x0100
+#define SNAP_F_EXTRA      0x0200      // sensor: location; valve: link
+#define SNAP_F_ALL        0xFFFF      // whole entry (new device, keyframe)
+
+#define SNAP_DIG_PRESENT    0x01      // in the base
+#define SNAP_DIG_STALE      0x02      // left out of a full page: resend whole
+#define SNAP_DIG_CONNECTED  0x04
+#define SNAP_DIG_LEAK       0x08
+#define SNAP_DIG_RMLEAK     0x10
+
+#define SNAP_NULL_I8        INT8_MIN  // rssi / snr reported as null
+
+typedef enum {
+    SNAP_VALVE_CLOSED = 0,
+    SNAP_VALVE_OPEN,
+    SNAP_VALVE_UNKNOWN,
+    SNAP_VALVE_DISCONNECTED,
+} snap_valve_state_t;
+
+// A device entry as the base reported it (12 B). Strings are kept as 16-bit
+// hashes; RSSI and SNR are compared with a deadband.
+typedef struct {
+    uint16_t id;        // sensor: dev_id (a reused handle differs); valve: mac
+    uint16_t fw;        // firmware string
+    uint16_t extra;     // sensor: location code + label; valve: link stats
+    uint8_t  flags;     // SNAP_DIG_*
+    uint8_t  rating;    // 0xFF: none
+    uint8_t  battery;   // 0xFF: null
+    uint8_t  state;     // valve: snap_valve_state_t
+    int8_t   rssi;
+    int8_t   snr;       // dB, rounded
+} snap_digest_t;
+
+// Page-0 sections, each kept as a hash of its serialized bytes
+typedef enum {
+    SNAP_SEC_SYSTEM_HEALTH = 0,
+    SNAP_SEC_LORA_RX,
+    SNAP_SEC_BLE_SCAN,
+    SNAP_SEC_CLOSE_LATENCY,
+    SNAP_SEC_ENCODER,
+    SNAP_SEC_DELIVERY,
+    SNAP_SEC_OVERRIDE,
+    SNAP_SEC_MAX,
+} snap_section_t;
+
+// Digests and keyframe cadence (iothub_task only)
+static snap_digest_t s_valve_digest[DEVREG_MAX_VALVES];
+static snap_digest_t s_sensor_digest[DEVREG_MAX_LORA + DEVREG_MAX_BLE];  // handle - LoRa base
+static uint32_t      s_section_digest[SNAP_SEC_MAX];
+static uint32_t      s_base_id = 0;         // last snapshot sent
+static uint32_t      s_keyframe_id = 0;     // last keyframe sent in delta mode
+static uint16_t      s_deltas_since_keyframe = 0;
+
+// Set from the MQTT task (Device Twin desired snapshot_mode)
+static volatile telem_snapshot_mode_t s_snapshot_mode = TELEM_SNAPSHOT_FULL;
+
+// Delivery of the last snapshot: pages are counted by iothub_task as they
+// are published and counted off by the delivery tracker (MQTT task) as
+// their PUBACKs come in, matched by snapshot_id.
+static portMUX_TYPE s_base_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+    uint32_t id;                           // snapshot being tracked
+    uint16_t unacked;
+    bool     complete;                     // every page was handed to MQTT
+    bool     keyframe_due;                 // reconnect, mode change, cloud request
+} s_base;
+
+// FNV-1a
+#define SNAP_HASH_INIT  2166136261u
+
+static uint32_t snap_hash(uint32_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint16_t snap_hash16(uint32_t h)
 {
-    cJSON *root = build_envelope("snapshot");
-    if (!root) return;
+    return (uint16_t)(h ^ (h >> 16));
+}
 
-    cJSON *data = cJSON_CreateObject();
+static uint16_t snap_hash_str(const char *s)
+{
+    return snap_hash16(snap_hash(SNAP_HASH_INIT, s, s ? strlen(s) : 0));
+}
 
-    // ---- Fetch health device status for all provisioned devices ----
-    health_device_status_t health[HEALTH_MAX_DEVICES];
-    uint8_t health_count = 0;
-    bool have_health = health_get_device_status_all(health, &health_count);
+static bool snap_i8_moved(int8_t was, int8_t now, int deadband)
+{
+    if (was == SNAP_NULL_I8 || now == SNAP_NULL_I8) return was != now;
+    return abs(was - now) >= deadband;
+}
 
-    // ---- system_health (worst rating + human-readable reason) ----
-    health_rating_t sys_rating = health_get_system_rating();
-    cJSON *sys_health = cJSON_CreateObject();
-    cJSON_AddStringToObject(sys_health, "rating",
-        health_rating_to_str(sys_rating));
-    char reason[128];
-    if (have_health) {
-        build_system_health_reason(health, sys_rating, reason, sizeof(reason));
-    } else {
-        snprintf(reason, sizeof(reason), "Health data unavailable");
+// Fields of `now` that differ from the base digest `was`
+static uint16_t snap_digest_diff(const snap_digest_t *was, const snap_digest_t *now)
+{
+    if (!(was->flags & SNAP_DIG_PRESENT) || (was->flags & SNAP_DIG_STALE) ||
+        was->id != now->id) {
+        return SNAP_F_ALL;
     }
-    cJSON_AddStringToObject(sys_health, "reason", reason);
-    cJSON_AddItemToObject(data, "system_health", sys_health);
 
-    // ---- valve ----
-    cJSON *valve = cJSON_CreateObject();
-    char vmac[18];
-    bool vconn = ble_valve_get_mac(vmac);
+    uint8_t flips = was->flags ^ now->flags;
+    uint16_t f = 0;
+    if (flips & SNAP_DIG_CONNECTED)   f |= SNAP_F_CONNECTED;
+    if (flips & SNAP_DIG_LEAK)        f |= SNAP_F_LEAK;
+    if (flips & SNAP_DIG_RMLEAK)      f |= SNAP_F_RMLEAK;
+    if (was->rating  != now->rating)  f |= SNAP_F_RATING;
+    if (was->battery != now->battery) f |= SNAP_F_BATTERY;
+    if (was->state   != now->state)   f |= SNAP_F_STATE;
+    if (was->fw      != now->fw)      f |= SNAP_F_FW;
+    if (was->extra   != now->extra)   f |= SNAP_F_EXTRA;
+    if (snap_i8_moved(was->rssi, now->rssi, SNAPSHOT_RSSI_DEADBAND)) f |= SNAP_F_RSSI;
+    if (snap_i8_moved(was->snr, now->snr, SNAPSHOT_SNR_DEADBAND))    f |= SNAP_F_SNR;
+    return f;
+}
 
-    // Find valve health entry for MAC / rating / last_seen
-    const health_device_status_t *valve_hs = NULL;
-    if (have_health) {
-        for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-            if (health[i].in_use && health[i].dev_type == HEALTH_DEV_VALVE) {
-                valve_hs = &health[i];
-                break;
-            }
-        }
+// Take the written fields `f` of `now` into the base digest
+static void snap_digest_apply(snap_digest_t *base, const snap_digest_t *now, uint16_t f)
+{
+    if (f == SNAP_F_ALL) {
+        *base = *now;
+        return;
     }
 
+    uint8_t fm = SNAP_DIG_PRESENT;
+    if (f & SNAP_F_CONNECTED) fm |= SNAP_DIG_CONNECTED;
+    if (f & SNAP_F_LEAK)      fm |= SNAP_DIG_LEAK;
+    if (f & SNAP_F_RMLEAK)    fm |= SNAP_DIG_RMLEAK;
+    base->flags = (base->flags & ~fm) | (now->flags & fm);
+    base->id = now->id;
+    if (f & SNAP_F_RATING)  base->rating  = now->rating;
+    if (f & SNAP_F_BATTERY) base->battery = now->battery;
+    if (f & SNAP_F_STATE)   base->state   = now->state;
+    if (f & SNAP_F_FW)      base->fw      = now->fw;
+    if (f & SNAP_F_EXTRA)   base->extra   = now->extra;
+    if (f & SNAP_F_RSSI)    base->rssi    = now->rssi;
+    if (f & SNAP_F_SNR)     base->snr     = now->snr;
+}
+
+// Whether the last snapshot was delivered in full; starts tracking the next
+static bool snap_base_take(void)
+{
+    portENTER_CRITICAL(&s_base_lock);
+    bool acked = s_base.complete && s_base.unacked == 0 && !s_base.keyframe_due;
+    s_base.id = 0;
+    s_base.unacked = 0;
+    s_base.complete = false;
+    s_base.keyframe_due = false;
+    portEXIT_CRITICAL(&s_base_lock);
+    return acked;
+}
+
+// A page of snapshot `id` is about to be published; counted before it is
+// tracked because its PUBACK may complete inside delivery_tracker_track()
+static void snap_base_expect(uint32_t id)
+{
+    portENTER_CRITICAL(&s_base_lock);
+    s_base.id = id;
+    s_base.unacked++;
+    portEXIT_CRITICAL(&s_base_lock);
+}
+
+// DELIVERY_SNAPSHOT outcome (MQTT task). A lost page leaves unacked above
+// zero, so the next snapshot is a keyframe.
+static void snap_on_delivery(uint32_t snapshot_id, bool acked)
+{
+    portENTER_CRITICAL(&s_base_lock);
+    if (acked && snapshot_id == s_base.id && s_base.unacked > 0) {
+        s_base.unacked--;
+    }
+    portEXIT_CRITICAL(&s_base_lock);
+}
+
+static void snap_base_complete(void)
+{
+    portENTER_CRITICAL(&s_base_lock);
+    s_base.complete = true;
+    portEXIT_CRITICAL(&s_base_lock);
+}
+
+typedef struct {
+    health_rating_t               sys_rating;
+    const char                   *reason;
+    const health_device_status_t *valve_hs[DEVREG_MAX_VALVES];  // NULL if slot empty
+    uint32_t                      snapshot_id;
+    uint32_t                      base_id;     // snapshot a delta applies to
+    int                           pages;
+    snapshot_cost_t              *cost;
+    size_t                        heap_start;
+    bool                          delta_mode;  // digests kept, keyframes carry snapshot_id
+    bool                          delta;       // type="snapshot_delta"
+    bool                          lost;        // a page was not handed to MQTT
+} snapshot_ctx_t;
+
+// Sensor list currently open on a page. Lists follow handle order, so a page
+// opens lora_sensors, then ble_leak_sensors, each at most once.
+typedef enum {
+    SNAP_LIST_NONE = 0,
+    SNAP_LIST_LORA,
+    SNAP_LIST_BLE,
+    SNAP_LIST_DONE,
+} snapshot_list_t;
+
+typedef struct {
+    telem_writer_t  w;
+    snapshot_list_t list;
+    int             index;
+    int             sensors;      // sensors on this page so far
+    bool            truncated;    // a sensor did not fit the message buffer
+    int64_t         opened_us;
+} snapshot_page_t;
+
+// What a valve entry reports, read once so a delta can compare it with the
+// digest before anything is written
+typedef struct {
+    const health_device_status_t *hs;   // NULL if the slot is not provisioned
+    ble_valve_conn_stats_t        cs;
+    char mac[18];                       // "" if neither live nor provisioned
+    char fw[32];
+    bool has_fw;
+    bool connected;
+    int  state;
+    int  battery;
+    bool leak;
+    bool rmleak;
+} valve_view_t;
+
+// What a sensor entry reports
+typedef struct {
+    const health_device_status_t *hs;
+    const sensor_meta_entry_t    *meta;
+    const char *fw;         // BLE: NULL if not reported
+    float       snr;        // LoRa
+    uint8_t     battery;
+    int8_t      rssi;
+    bool        lora;
+    bool        cached;     // battery / leak / rssi / snr / fw known
+    bool        leak;
+} sensor_view_t;
+
+static void valve_view(int index, const health_device_status_t *valve_hs,
+                       valve_view_t *v, snap_digest_t *d)
+{
+    memset(v, 0, sizeof(*v));
+    v->hs = valve_hs;
+
     // MAC: prefer live BLE, fall back to health (provisioned) entry
-    if (vconn) {
-        cJSON_AddStringToObject(valve, "mac", vmac);
-    } else if (valve_hs) {
-        cJSON_AddStringToObject(valve, "mac", valve_hs->dev_id);
-    }
-
-    if (vconn) {
-        int st = ble_valve_get_state();
-        cJSON_AddStringToObject(valve, "state",
-            st == 1 ? "open" : st == 0 ? "closed" : "unknown");
-        cJSON_AddNumberToObject(valve, "battery", ble_valve_get_battery());
-        cJSON_AddBoolToObject(valve, "leak_state", ble_valve_get_leak());
-        cJSON_AddBoolToObject(valve, "rmleak", ble_valve_get_rmleak_state());
-        cJSON_AddBoolToObject(valve, "connected", true);
-
-        char valve_fw[32];
-        if (ble_valve_get_firmware_rev(valve_fw, sizeof(valve_fw)))
-            cJSON_AddStringToObject(valve, "fw_version", valve_fw);
-        else
-            cJSON_AddNullToObject(valve, "fw_version");
+    v->connected = ble_valve_get_mac(index, v->mac);
+    if (!v->connected && valve_hs) {
+        strncpy(v->mac, valve_hs->dev_id, sizeof(v->mac) - 1);
+    }
+    if (v->connected) {
+        v->state   = ble_valve_get_state(index);
+        v->battery = ble_valve_get_battery(index);
+        v->leak    = ble_valve_get_leak(index);
+        v->rmleak  = ble_valve_get_rmleak_state(index);
+        v->has_fw  = ble_valve_get_firmware_rev(index, v->fw, sizeof(v->fw));
+    }
+    ble_valve_get_conn_stats(index, &v->cs);
+
+    memset(d, 0, sizeof(*d));
+    d->id = snap_hash_str(v->mac);
+    d->flags = SNAP_DIG_PRESENT;
+    d->rating = valve_hs ? (uint8_t)valve_hs->rating : 0xFF;
+    d->battery = 0xFF;
+    d->state = SNAP_VALVE_DISCONNECTED;
+    if (v->connected) {
+        d->flags |= SNAP_DIG_CONNECTED | (v->leak ? SNAP_DIG_LEAK : 0) |
+                    (v->rmleak ? SNAP_DIG_RMLEAK : 0);
+        d->battery = (uint8_t)v->battery;
+        d->state = v->state == 1 ? SNAP_VALVE_OPEN :
+                   v->state == 0 ? SNAP_VALVE_CLOSED : SNAP_VALVE_UNKNOWN;
+        d->fw = snap_hash_str(v->has_fw ? v->fw : NULL);
+    }
+    if (v->cs.cached_count || v->cs.full_count) {
+        const ble_valve_conn_stats_t *cs = &v->cs;
+        uint32_t h = SNAP_HASH_INIT;
+        h = snap_hash(h, &cs->last_ready_ms, sizeof(cs->last_ready_ms));
+        h = snap_hash(h, &cs->last_setup_ms, sizeof(cs->last_setup_ms));
+        h = snap_hash(h, &cs->last_from_cache, sizeof(cs->last_from_cache));
+        h = snap_hash(h, &cs->cached_avg_ms, sizeof(cs->cached_avg_ms));
+        h = snap_hash(h, &cs->full_avg_ms, sizeof(cs->full_avg_ms));
+        h = snap_hash(h, &cs->cache_misses, sizeof(cs->cache_misses));
+        h = snap_hash(h, &cs->conn_itvl, sizeof(cs->conn_itvl));
+        h = snap_hash(h, &cs->link_fast, sizeof(cs->link_fast));
+        d->extra = snap_hash16(h);
+    }
+    d->rssi = SNAP_NULL_I8;
+    d->snr = SNAP_NULL_I8;
+}
+
+static void sensor_view(dev_handle_t h, const health_device_status_t *hs,
+                        sensor_view_t *v, snap_digest_t *d)
+{
+    memset(v, 0, sizeof(*v));
+    v->hs = hs;
+    v->meta = sensor_meta_find_by_handle(h);
+    v->lora = device_registry_type(h) == DEVREG_LORA;
+
+    // Merge telemetry data from cache — only when the device is currently
+    // connected. A reload (provision/decommission) wipes health seen-state
+    // but not this cache, so without the connected gate a just-reloaded
+    // sensor would emit connected:false yet carry stale battery/rssi/fw.
+    if (v->lora) {
+        const telem_lora_cache_t *c = s_lora_cache;
+        int i = device_registry_lora_slot(h);
+        uint32_t sensor_id;
+        v->cached = hs->connected && c &&
+                    device_registry_get_lora_id(h, &sensor_id) &&
+                    c->valid[i] && c->sensor_id[i] == sensor_id;
+        if (v->cached) {
+            v->battery = c->battery[i];
+            v->leak    = c->leak_status[i] == 1;
+            v->rssi    = c->rssi[i];
+            v->snr     = c->snr[i];
+        }
     } else {
-        cJSON_AddStringToObject(valve, "state", "disconnected");
-        cJSON_AddBoolToObject(valve, "connected", false);
+        const telem_ble_leak_cache_t *c = s_ble_cache;
+        int i = device_registry_ble_slot(h);
+        uint8_t mac[6];
+        v->cached = hs->connected && c &&
+                    device_registry_get_mac(h, mac) &&
+                    c->valid[i] && memcmp(c->mac[i], mac, 6) == 0;
+        if (v->cached) {
+            v->battery = c->battery[i];
+            v->leak    = c->leak_state[i];
+            v->rssi    = c->rssi[i];
+            v->fw      = c->fw_version[i][0] ? c->fw_version[i] : NULL;
+        }
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->id = snap_hash_str(hs->dev_id);
+    d->flags = SNAP_DIG_PRESENT | (hs->connected ? SNAP_DIG_CONNECTED : 0) |
+               (v->leak ? SNAP_DIG_LEAK : 0);
+    d->rating = (uint8_t)hs->rating;
+    d->battery = v->cached ? v->battery : 0xFF;
+    d->rssi = SNAP_NULL_I8;
+    d->snr = SNAP_NULL_I8;
+    if (v->cached) {
+        d->rssi = v->rssi == SNAP_NULL_I8 ? SNAP_NULL_I8 + 1 : v->rssi;
+        if (v->lora) {
+            float snr = v->snr < -100.0f ? -100.0f : v->snr > 100.0f ? 100.0f : v->snr;
+            d->snr = (int8_t)lroundf(snr);
+        }
+    }
+    d->fw = snap_hash_str(v->fw);
+
+    uint8_t code = v->meta ? v->meta->location_code : LOC_UNKNOWN;
+    uint32_t lh = snap_hash(SNAP_HASH_INIT, &code, 1);
+    d->extra = snap_hash16(v->meta ? snap_hash(lh, v->meta->label, strlen(v->meta->label)) : lh);
+}
+
+// Fields of a sensor to report: all of them unless this is a delta
+static uint16_t snapshot_sensor_fields(bool delta, dev_handle_t h,
+                                       const health_device_status_t *hs,
+                                       sensor_view_t *v, snap_digest_t *d)
+{
+    sensor_view(h, hs, v, d);
+    return delta ? snap_digest_diff(&s_sensor_digest[h - DEVREG_HANDLE_LORA_BASE], d)
+                 : SNAP_F_ALL;
+}
+
+static void add_last_seen(telem_writer_t *w, const health_device_status_t *hs)
+{
+    if (hs->last_seen_age_s != UINT32_MAX) {
+        telem_writer_int(w, "last_seen_age_s", hs->last_seen_age_s);
+    } else {
+        telem_writer_null(w, "last_seen_age_s");
+    }
+}
+
+// Valve entry with the fields in `f`; index and last_seen_age_s always
+static void add_snapshot_valve(telem_writer_t *w, const char *key, int index,
+                               const valve_view_t *v, uint16_t f)
+{
+    telem_writer_obj_open(w, key);
+    telem_writer_int(w, "index", index);
+    if (f == SNAP_F_ALL && v->mac[0]) {
+        telem_writer_str(w, "mac", v->mac);
+    }
+
+    if (v->connected) {
+        if (f & SNAP_F_STATE)
+            telem_writer_str(w, "state",
+                v->state == 1 ? "open" : v->state == 0 ? "closed" : "unknown");
+        if (f & SNAP_F_BATTERY)   telem_writer_int(w, "battery", v->battery);
+        if (f & SNAP_F_LEAK)      telem_writer_bool(w, "leak_state", v->leak);
+        if (f & SNAP_F_RMLEAK)    telem_writer_bool(w, "rmleak", v->rmleak);
+        if (f & SNAP_F_CONNECTED) telem_writer_bool(w, "connected", true);
+        if (f & SNAP_F_FW)        telem_writer_str(w, "fw_version", v->has_fw ? v->fw : NULL);
+    } else {
+        if (f & SNAP_F_STATE)     telem_writer_str(w, "state", "disconnected");
+        if (f & SNAP_F_CONNECTED) telem_writer_bool(w, "connected", false);
+    }
+
+    // Connect-to-ready timing, cached handle map vs full discovery
+    const ble_valve_conn_stats_t *cs = &v->cs;
+    if ((f & SNAP_F_EXTRA) && (cs->cached_count || cs->full_count)) {
+        telem_writer_obj_open(w, "link");
+        telem_writer_int(w, "ready_ms", cs->last_ready_ms);
+        telem_writer_int(w, "setup_ms", cs->last_setup_ms);
+        telem_writer_bool(w, "cached", cs->last_from_cache);
+        telem_writer_int(w, "cached_avg_ms", cs->cached_avg_ms);
+        telem_writer_int(w, "full_avg_ms", cs->full_avg_ms);
+        telem_writer_int(w, "cache_misses", cs->cache_misses);
+        if (cs->conn_itvl) {
+            telem_writer_num(w, "itvl_ms", cs->conn_itvl * 1.25);
+        }
+        telem_writer_str(w, "profile", cs->link_fast ? "fast" : "relaxed");
+        telem_writer_obj_close(w);
     }
 
     // Health metadata
-    if (valve_hs) {
-        cJSON_AddStringToObject(valve, "rating",
-            health_rating_to_str(valve_hs->rating));
-        if (valve_hs->last_seen_age_s != UINT32_MAX) {
-            cJSON_AddNumberToObject(valve, "last_seen_age_s",
-                valve_hs->last_seen_age_s);
-        } else {
-            cJSON_AddNullToObject(valve, "last_seen_age_s");
+    if (v->hs) {
+        if (f & SNAP_F_RATING)
+            telem_writer_str(w, "rating", health_rating_to_str(v->hs->rating));
+        add_last_seen(w, v->hs);
+    }
+    telem_writer_obj_close(w);
+}
+
+// Sensor entry with the fields in `f`; sensor_id and last_seen_age_s always
+static void add_snapshot_sensor(telem_writer_t *w, const sensor_view_t *v, uint16_t f)
+{
+    const health_device_status_t *hs = v->hs;
+
+    telem_writer_obj_open(w, NULL);
+    telem_writer_str(w, "sensor_id", hs->dev_id);
+    if (f & SNAP_F_CONNECTED) telem_writer_bool(w, "connected", hs->connected);
+    if (f & SNAP_F_RATING)    telem_writer_str(w, "rating", health_rating_to_str(hs->rating));
+    add_last_seen(w, hs);
+
+    if (f & SNAP_F_BATTERY) {
+        if (v->cached) telem_writer_int(w, "battery", v->battery);
+        else           telem_writer_null(w, "battery");
+    }
+    if (f & SNAP_F_LEAK) telem_writer_bool(w, "leak_state", v->leak);
+    if (f & SNAP_F_RSSI) {
+        if (v->cached) telem_writer_int(w, "rssi", v->rssi);
+        else           telem_writer_null(w, "rssi");
+    }
+    if (v->lora) {
+        if (f & SNAP_F_SNR) {
+            if (v->cached) telem_writer_num(w, "snr", v->snr);
+            else           telem_writer_null(w, "snr");
         }
+    } else if (f & SNAP_F_FW) {
+        telem_writer_str(w, "fw_version", v->fw);
     }
 
-    cJSON_AddItemToObject(data, "valve", valve);
+    if (f & SNAP_F_EXTRA) add_location_meta(w, v->meta);
+    telem_writer_obj_close(w);
+}
 
-    // ---- LoRa sensors (iterate health entries, merge cache data) ----
-    cJSON *lora_arr = cJSON_CreateArray();
-    if (have_health) {
-        for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-            if (!health[i].in_use || health[i].dev_type != HEALTH_DEV_LORA)
-                continue;
-
-            cJSON *s = cJSON_CreateObject();
-            cJSON_AddStringToObject(s, "sensor_id", health[i].dev_id);
-            cJSON_AddBoolToObject(s, "connected", health[i].connected);
-            cJSON_AddStringToObject(s, "rating",
-                health_rating_to_str(health[i].rating));
-
-            if (health[i].last_seen_age_s != UINT32_MAX) {
-                cJSON_AddNumberToObject(s, "last_seen_age_s",
-                    health[i].last_seen_age_s);
-            } else {
-                cJSON_AddNullToObject(s, "last_seen_age_s");
-            }
+static void add_snapshot_system_health(telem_writer_t *w, const snapshot_ctx_t *ctx)
+{
+    telem_writer_obj_open(w, "system_health");
+    telem_writer_str(w, "rating", health_rating_to_str(ctx->sys_rating));
+    telem_writer_str(w, "reason", ctx->reason);
+    telem_writer_obj_close(w);
+}
 
-            // Merge telemetry data from cache — only when the device is currently
-            // connected. A reload (provision/decommission) wipes health seen-state
-            // but not this cache, so without the connected gate a just-reloaded
-            // sensor would emit connected:false yet carry stale battery/rssi/fw.
-            const telem_lora_cache_t *cached = NULL;
-            if (health[i].connected && s_lora_cache) {
-                for (int j = 0; j < TELEM_MAX_LORA_CACHE; j++) {
-                    if (!s_lora_cache[j].valid) continue;
-                    char cid[16];
-                    snprintf(cid, sizeof(cid), "0x%08lX",
-                             (unsigned long)s_lora_cache[j].sensor_id);
-                    if (strcasecmp(cid, health[i].dev_id) == 0) {
-                        cached = &s_lora_cache[j];
-                        break;
-                    }
-                }
+// LoRa radio -> hub delivery counters (lora_rx_ring)
+static void add_snapshot_lora_rx(telem_writer_t *w)
+{
+    lora_rx_ring_stats_t st;
+    lora_rx_ring_get_stats(&st);
+
+    telem_writer_obj_open(w, "lora_rx");
+    telem_writer_int(w, "depth", st.depth);
+    telem_writer_int(w, "high_water", st.high_water);
+    telem_writer_int(w, "overflow", st.overflow);
+    telem_writer_int(w, "coalesced", st.coalesced);
+    telem_writer_int(w, "dropped", st.dropped);
+    telem_writer_obj_close(w);
+}
+
+// Shared BLE scan: time not scanning while a consumer wanted it, and the
+// Wi-Fi coexistence trade-off (scan time and reports per duty level in the
+// last full hour, leak sensor advertisements missed)
+static void add_snapshot_ble_scan(telem_writer_t *w)
+{
+    ble_scan_stats_t st;
+    ble_scan_get_stats(&st);
+    ble_leak_scan_stats_t leak;
+    app_ble_leak_get_stats(&leak);
+
+    telem_writer_obj_open(w, "ble_scan");
+    telem_writer_int(w, "gap_ms_last_hour", st.gap_ms_last_hour);
+    telem_writer_int(w, "gap_ms_this_hour", st.gap_ms_this_hour);
+    telem_writer_int(w, "gaps", st.gaps);
+    telem_writer_int(w, "restarts", st.restarts);
+    telem_writer_int(w, "accept_list", st.accept_list_size);
+
+    telem_writer_str(w, "duty", ble_scan_duty_str((ble_scan_duty_t)st.duty));
+    telem_writer_int(w, "duty_permille_last_hour", st.duty_permille_last_hour);
+    telem_writer_int(w, "duty_changes", st.duty_changes);
+    telem_writer_obj_open(w, "duty_ms_last_hour");
+    for (int d = 0; d < BLE_SCAN_DUTY_MAX; d++) {
+        telem_writer_int(w, ble_scan_duty_str((ble_scan_duty_t)d), st.duty_ms_last_hour[d]);
+    }
+    telem_writer_obj_close(w);
+    telem_writer_obj_open(w, "reports_last_hour");
+    for (int d = 0; d < BLE_SCAN_DUTY_MAX; d++) {
+        telem_writer_int(w, ble_scan_duty_str((ble_scan_duty_t)d), st.reports_last_hour[d]);
+    }
+    telem_writer_obj_close(w);
+    telem_writer_int(w, "adv_late", leak.adv_late);
+    telem_writer_obj_close(w);
+}
+
+// Leak -> valve-closed latency histograms, one array per span. Bucket i counts
+// spans below bucket_ms[i]; the last bucket is open-ended.
+static void add_snapshot_close_latency(telem_writer_t *w)
+{
+    static const char *const span_names[LEAK_LAT_SPAN_MAX] = {
+        "ingress", "dispatch", "write", "actuate", "total"
+    };
+    leak_latency_stats_t st;
+    leak_latency_get_stats(&st);
+
+    telem_writer_obj_open(w, "close_latency");
+    telem_writer_int(w, "incidents", st.incidents);
+    telem_writer_int(w, "completed", st.completed);
+    telem_writer_int(w, "timeouts", st.timeouts);
+    if (st.completed) {
+        telem_writer_int(w, "last_total_ms", st.last_total_ms);
+    }
+
+    telem_writer_arr_open(w, "bucket_ms");
+    for (int b = 0; b < LEAK_LATENCY_BUCKETS - 1; b++) {
+        telem_writer_int(w, NULL, leak_latency_bucket_ms(b));
+    }
+    telem_writer_arr_close(w);
+
+    for (int s = 0; s < LEAK_LAT_SPAN_MAX; s++) {
+        telem_writer_arr_open(w, span_names[s]);
+        for (int b = 0; b < LEAK_LATENCY_BUCKETS; b++) {
+            telem_writer_int(w, NULL, st.hist[s][b]);
+        }
+        telem_writer_arr_close(w);
+    }
+    telem_writer_obj_close(w);
+}
+
+// Cost of the previous snapshot and the message buffer it was written into
+static void add_snapshot_encoder(telem_writer_t *w)
+{
+    telem_writer_obj_open(w, "encoder");
+    telem_writer_int(w, "buf_size", sizeof(s_msg_buf));
+    telem_writer_int(w, "overflows", s_msg_overflows);
+    if (s_last_cost.pages) {
+        telem_writer_int(w, "encode_us", s_last_cost.encode_us);
+        telem_writer_int(w, "publish_us", s_last_cost.publish_us);
+        telem_writer_int(w, "bytes", s_last_cost.bytes);
+        telem_writer_int(w, "heap_drawn", s_last_cost.heap_drawn);
+        telem_writer_int(w, "largest_free_block", s_last_cost.largest_free);
+        telem_writer_int(w, "truncated", s_last_cost.truncated);
+    }
+
+    static const char *const enc_names[TELEM_ENCODING_MAX] = { "json", "cbor" };
+    telem_writer_str(w, "encoding", enc_names[s_encoding]);
+
+#if CONFIG_EFLO_TELEMETRY_ENCODER_BENCH
+    // [messages, bytes, encode_us] per encoding and message type so far
+    static const char *const class_names[MSG_CLASS_MAX] = { "lifecycle", "snapshot", "event" };
+    telem_writer_obj_open(w, "encodings");
+    for (int e = 0; e < TELEM_ENCODING_MAX; e++) {
+        telem_writer_mark_t m = telem_writer_mark(w);
+        bool any = false;
+        telem_writer_obj_open(w, enc_names[e]);
+        for (int c = 0; c < MSG_CLASS_MAX; c++) {
+            const encode_stats_t *st = &s_enc_stats[e][c];
+            if (!st->msgs) continue;
+            telem_writer_arr_open(w, class_names[c]);
+            telem_writer_int(w, NULL, st->msgs);
+            telem_writer_int(w, NULL, st->bytes);
+            telem_writer_int(w, NULL, st->encode_us);
+            telem_writer_arr_close(w);
+            any = true;
+        }
+        telem_writer_obj_close(w);
+        if (!any) telem_writer_rewind(w, m);
+    }
+    telem_writer_obj_close(w);
+#endif
+
+    // [batch messages, events they carried]
+    if (s_batches_sent) {
+        telem_writer_arr_open(w, "batches");
+        telem_writer_int(w, NULL, s_batches_sent);
+        telem_writer_int(w, NULL, s_batched_events);
+        telem_writer_arr_close(w);
+    }
+    telem_writer_obj_close(w);
+}
+
+// QoS 1 delivery since boot: PUBACKs, losses, latency and the in-flight cap
+static void add_snapshot_delivery(telem_writer_t *w)
+{
+    delivery_stats_t st;
+    delivery_tracker_get_stats(&st);
+
+    telem_writer_obj_open(w, "delivery");
+    telem_writer_int(w, "in_flight", st.in_flight);
+    telem_writer_int(w, "in_flight_max", st.in_flight_max);
+    telem_writer_int(w, "acked", st.acked);
+    telem_writer_int(w, "lost", st.lost);
+    telem_writer_int(w, "untracked", st.untracked);
+    if (st.acked) {
+        // [avg, max] from publish to PUBACK
+        telem_writer_arr_open(w, "latency_ms");
+        telem_writer_int(w, NULL, st.latency_avg_ms);
+        telem_writer_int(w, NULL, st.latency_max_ms);
+        telem_writer_arr_close(w);
+    }
+    telem_writer_int(w, "deferred", s_events_deferred);
+    telem_writer_int(w, "offline_pending", offline_buffer_count());
+    telem_writer_obj_close(w);
+}
+
+// End of a page-0 section written since `m`. In a delta it is dropped again
+// if it serializes exactly as the base did; otherwise it becomes the base.
+static void snapshot_section_end(snapshot_page_t *pg, const snapshot_ctx_t *ctx,
+                                 telem_writer_mark_t m, snap_section_t sec)
+{
+    telem_writer_t *w = &pg->w;
+    if (!ctx->delta_mode || w->overflow || w->len == m.len) return;
+
+    // The separator depends on what precedes the section, so it is left out
+    const char *p = w->buf + m.len;
+    size_t n = w->len - m.len;
+    if (*p == ',') {
+        p++;
+        n--;
+    }
+    uint32_t h = snap_hash(SNAP_HASH_INIT, p, n);
+    if (ctx->delta && h == s_section_digest[sec]) {
+        telem_writer_rewind(w, m);
+    } else {
+        s_section_digest[sec] = h;
+    }
+}
+
+static void snapshot_page_section(snapshot_page_t *pg, const snapshot_ctx_t *ctx,
+                                  snap_section_t sec, void (*add)(telem_writer_t *))
+{
+    telem_writer_mark_t m = telem_writer_mark(&pg->w);
+    add(&pg->w);
+    snapshot_section_end(pg, ctx, m, sec);
+}
+
+// "valve" keeps the single-valve shape (valve 0) and is left out of deltas;
+// "valves" lists every provisioned or connected valve, in a delta only those
+// with a changed field
+static void snapshot_page_add_valves(snapshot_page_t *pg, const snapshot_ctx_t *ctx)
+{
+    valve_view_t v;
+    snap_digest_t d;
+
+    if (!ctx->delta) {
+        valve_view(0, ctx->valve_hs[0], &v, &d);
+        add_snapshot_valve(&pg->w, "valve", 0, &v, SNAP_F_ALL);
+    }
+
+    telem_writer_mark_t list = telem_writer_mark(&pg->w);
+    int written = 0;
+    telem_writer_arr_open(&pg->w, "valves");
+    for (int i = 0; i < DEVREG_MAX_VALVES; i++) {
+        if (!ctx->valve_hs[i] && !ble_valve_is_connected(i)) continue;
+
+        valve_view(i, ctx->valve_hs[i], &v, &d);
+        uint16_t f = ctx->delta ? snap_digest_diff(&s_valve_digest[i], &d) : SNAP_F_ALL;
+        if (!f) continue;
+
+        add_snapshot_valve(&pg->w, NULL, i, &v, f);
+        if (ctx->delta_mode && !pg->w.overflow) {
+            snap_digest_apply(&s_valve_digest[i], &d, f);
+        }
+        written++;
+    }
+    telem_writer_arr_close(&pg->w);
+
+    if (ctx->delta && written == 0) {
+        telem_writer_rewind(&pg->w, list);
+    }
+}
+
+// Close the open sensor lists up to `list`, opening each list passed on the
+// way so a page always carries both arrays
+static void snapshot_page_advance(snapshot_page_t *pg, snapshot_list_t list)
+{
+    static const char *const names[] = { NULL, "lora_sensors", "ble_leak_sensors" };
+    while (pg->list < list) {
+        if (pg->list != SNAP_LIST_NONE) telem_writer_arr_close(&pg->w);
+        pg->list++;
+        if (pg->list != SNAP_LIST_DONE) telem_writer_arr_open(&pg->w, names[pg->list]);
+    }
+}
+
+static bool snapshot_page_open(snapshot_page_t *pg, int index,
+                               const snapshot_ctx_t *ctx)
+{
+    memset(pg, 0, sizeof(*pg));
+    pg->index = index;
+    pg->opened_us = esp_timer_get_time();
+    if (!begin_envelope(&pg->w, ctx->delta ? "snapshot_delta" : "snapshot")) return false;
+
+    telem_writer_obj_open(&pg->w, "data");
+
+    if (ctx->delta) {
+        telem_writer_obj_open(&pg->w, "delta");
+        telem_writer_int(&pg->w, "snapshot_id", ctx->snapshot_id);
+        telem_writer_int(&pg->w, "base_id", ctx->base_id);
+        telem_writer_int(&pg->w, "keyframe_id", s_keyframe_id);
+        telem_writer_obj_close(&pg->w);
+    } else if (ctx->delta_mode) {
+        // Keyframe: the id the following deltas name as their base
+        telem_writer_int(&pg->w, "snapshot_id", ctx->snapshot_id);
+    }
+
+    if (index == 0) {
+        telem_writer_mark_t m = telem_writer_mark(&pg->w);
+        add_snapshot_system_health(&pg->w, ctx);
+        snapshot_section_end(pg, ctx, m, SNAP_SEC_SYSTEM_HEALTH);
+
+        snapshot_page_add_valves(pg, ctx);
+        snapshot_page_section(pg, ctx, SNAP_SEC_LORA_RX, add_snapshot_lora_rx);
+        snapshot_page_section(pg, ctx, SNAP_SEC_BLE_SCAN, add_snapshot_ble_scan);
+        snapshot_page_section(pg, ctx, SNAP_SEC_CLOSE_LATENCY, add_snapshot_close_latency);
+        snapshot_page_section(pg, ctx, SNAP_SEC_ENCODER, add_snapshot_encoder);
+        snapshot_page_section(pg, ctx, SNAP_SEC_DELIVERY, add_snapshot_delivery);
+    }
+
+    snapshot_page_advance(pg, SNAP_LIST_LORA);
+    pg->w.reserve = SNAPSHOT_TAIL_RESERVE;
+    return true;
+}
+
+// Append a sensor's fields `f` to its list. One that does not fit is left out
+// and the page flagged truncated; the page itself always stays valid.
+static void snapshot_page_add_sensor(snapshot_page_t *pg, dev_handle_t h,
+                                     const sensor_view_t *v, const snap_digest_t *d,
+                                     uint16_t f, const snapshot_ctx_t *ctx)
+{
+    telem_writer_mark_t m = telem_writer_mark(&pg->w);
+    snapshot_list_t list = pg->list;
+    snap_digest_t *base = &s_sensor_digest[h - DEVREG_HANDLE_LORA_BASE];
+
+    snapshot_page_advance(pg, v->lora ? SNAP_LIST_LORA : SNAP_LIST_BLE);
+    add_snapshot_sensor(&pg->w, v, f);
+    if (pg->w.overflow) {
+        telem_writer_rewind(&pg->w, m);
+        pg->list = list;
+        pg->truncated = true;
+        ctx->cost->truncated++;
+        if (ctx->delta_mode) {
+            snap_digest_apply(base, d, 0);
+            base->flags |= SNAP_DIG_STALE;
+        }
+    } else if (ctx->delta_mode) {
+        snap_digest_apply(base, d, f);
+    }
+    pg->sensors++;
+}
+
+static void snapshot_page_publish(snapshot_page_t *pg, snapshot_ctx_t *ctx)
+{
+    pg->w.reserve = 0;
+    snapshot_page_advance(pg, SNAP_LIST_DONE);
+
+    if (pg->index == 0) {
+        // ---- Override window status ----
+        telem_writer_mark_t m = telem_writer_mark(&pg->w);
+        bool ovr_active = rules_engine_is_override_window_active();
+        telem_writer_bool(&pg->w, "override_active", ovr_active);
+        if (ovr_active) {
+            int32_t remaining = rules_engine_get_override_remaining_s();
+            if (remaining >= 0) {
+                telem_writer_int(&pg->w, "override_remaining_s", remaining);
             }
+        }
+        snapshot_section_end(pg, ctx, m, SNAP_SEC_OVERRIDE);
+    }
+    if (pg->truncated) {
+        telem_writer_bool(&pg->w, "truncated", true);
+    }
 
-            if (cached) {
-                cJSON_AddNumberToObject(s, "battery", cached->battery);
-                cJSON_AddBoolToObject(s, "leak_state",
-                                      cached->leak_status == 1);
-                cJSON_AddNumberToObject(s, "rssi", cached->rssi);
-                cJSON_AddNumberToObject(s, "snr",  cached->snr);
-            } else {
-                cJSON_AddNullToObject(s, "battery");
-                cJSON_AddBoolToObject(s, "leak_state", false);
-                cJSON_AddNullToObject(s, "rssi");
-                cJSON_AddNullToObject(s, "snr");
+    // Single-page snapshots keep the original (unpaged) shape
+    if (ctx->pages > 1) {
+        telem_writer_obj_open(&pg->w, "page");
+        telem_writer_int(&pg->w, "snapshot_id", ctx->snapshot_id);
+        telem_writer_int(&pg->w, "index", pg->index);
+        telem_writer_int(&pg->w, "count", ctx->pages);
+        telem_writer_obj_close(&pg->w);
+    }
+
+    telem_writer_obj_close(&pg->w);
+
+    snapshot_cost_t *cost = ctx->cost;
+    int64_t t = esp_timer_get_time();
+    size_t bytes = 0;
+    cost->encode_us += (uint32_t)(t - pg->opened_us);
+    snap_base_expect(ctx->snapshot_id);
+    int msg_id = publish_msg(&pg->w, "snapshot", &bytes, false);
+    cost->bytes += bytes;
+    cost->publish_us += (uint32_t)(esp_timer_get_time() - t);
+    cost->pages++;
+
+    if (!delivery_tracker_track(msg_id, DELIVERY_SNAPSHOT, ctx->snapshot_id, s_msg_sent_us)) {
+        ctx->lost = true;
+    }
+
+    // The outbox keeps each QoS 1 page until its PUBACK, so the lowest free
+    // heap after a page is the snapshot's peak draw
+    size_t free_now = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (free_now < ctx->heap_start &&
+        ctx->heap_start - free_now > cost->heap_drawn) {
+        cost->heap_drawn = ctx->heap_start - free_now;
+    }
+}
+
+// The snapshot being published. Each page takes an in-flight slot; when the
+// next page finds none, the snapshot stops at the page boundary and the event
+// loop resumes it (telemetry_v2_publish_deferred) as PUBACKs come in.
+static struct {
+    bool                   active;
+    int                    next_page;
+    int                    next_handle;     // first sensor not yet on a page
+    snapshot_ctx_t         ctx;
+    snapshot_cost_t        cost;
+    char                   reason[128];
+    health_device_status_t valve_hs[DEVREG_MAX_VALVES];
+} s_snap;
+
+static void snapshot_finish(void)
+{
+    snapshot_ctx_t *ctx = &s_snap.ctx;
+    snapshot_cost_t *cost = &s_snap.cost;
+    s_snap.active = false;
+    if (s_connected) {
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_BULK, BULK_SCAN_TAIL_MS);
+    }
+
+    // Base of the next delta once every page is PUBACKed
+    s_base_id = ctx->snapshot_id;
+    if (ctx->delta) {
+        s_deltas_since_keyframe++;
+    } else {
+        s_keyframe_id = ctx->snapshot_id;
+        s_deltas_since_keyframe = 0;
+    }
+    if (!ctx->lost && cost->pages == ctx->pages) {
+        snap_base_complete();
+    }
+
+    cost->largest_free = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    s_last_cost = *cost;
+    ESP_LOGI(TELEM_TAG, "Snapshot %lu%s: %u page(s) %lu B, encode %lu us, publish %lu us, "
+             "heap drawn %lu B, largest free block %lu B%s",
+             (unsigned long)ctx->snapshot_id,
+             ctx->delta ? " (delta)" : ctx->delta_mode ? " (keyframe)" : "",
+             cost->pages, (unsigned long)cost->bytes,
+             (unsigned long)cost->encode_us, (unsigned long)cost->publish_us,
+             (unsigned long)cost->heap_drawn, (unsigned long)cost->largest_free,
+             cost->truncated ? ", TRUNCATED" : "");
+}
+
+// Open page `index`. False if the snapshot stopped: suspended until a slot
+// frees up (a deferred lifecycle and held events go first), or finished
+// because the page could not be opened.
+static bool snapshot_page_next(snapshot_page_t *pg, int index)
+{
+    // Held events go out ahead of the state they led to
+    bool held = !batch_flush(true, BATCH_SEND);
+    if (s_mqtt && s_connected &&
+        (held || s_lifecycle_pending || !delivery_tracker_has_slot())) {
+        s_snap.next_page = index;
+        return false;
+    }
+    if (!snapshot_page_open(pg, index, &s_snap.ctx)) {
+        if (index == 0) s_snap.active = false;
+        else            snapshot_finish();
+        return false;
+    }
+    // Renewed per page: a resumed snapshot may outlast one narrow window
+    if (s_connected) {
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_BULK, BULK_SCAN_NARROW_MAX_MS);
+    }
+    return true;
+}
+
+// Publish the pages of s_snap from next_page on
+static void snapshot_continue(void)
+{
+    snapshot_ctx_t *ctx = &s_snap.ctx;
+    snapshot_page_t pg;
+    if (!snapshot_page_next(&pg, s_snap.next_page)) return;
+
+    // ---- Pass 2: sensors in handle order, LoRa then BLE, paged ----
+    for (int first = s_snap.next_handle; first < DEVREG_MAX_DEVICES;
+         first += SNAPSHOT_HEALTH_BATCH) {
+        int n = health_get_device_status_range(first, SNAPSHOT_HEALTH_BATCH,
+                                               s_health_batch);
+        if (n < 0) break;
+        for (int k = 0; k < n; k++) {
+            const health_device_status_t *d = &s_health_batch[k];
+            dev_handle_t h = (dev_handle_t)(first + k);
+            if (!d->in_use) continue;
+
+            sensor_view_t v;
+            snap_digest_t dig;
+            uint16_t f = snapshot_sensor_fields(ctx->delta, h, d, &v, &dig);
+            if (!f) continue;
+
+            // A sensor commissioned (or changed) between the passes lands
+            // on the last page
+            if (pg.sensors >= SNAPSHOT_PAGE_SIZE && pg.index + 1 < ctx->pages) {
+                int next = pg.index + 1;
+                snapshot_page_publish(&pg, ctx);
+                s_snap.next_handle = h;
+                if (!snapshot_page_next(&pg, next)) return;
             }
 
-            add_location_obj(s, SENSOR_TYPE_LORA, health[i].dev_id);
-            cJSON_AddItemToArray(lora_arr, s);
+            snapshot_page_add_sensor(&pg, h, &v, &dig, f, ctx);
         }
     }
-    cJSON_AddItemToObject(data, "lora_sensors", lora_arr);
+    s_snap.next_handle = DEVREG_MAX_DEVICES;
+
+    // Trailing pages left empty by sensors decommissioned between the passes
+    while (true) {
+        int next = pg.index + 1;
+        snapshot_page_publish(&pg, ctx);
+        if (next >= ctx->pages) break;
+        if (!snapshot_page_next(&pg, next)) return;
+    }
+    snapshot_finish();
+}
 
-    // ---- BLE leak sensors (iterate health entries, merge cache data) ----
-    cJSON *ble_arr = cJSON_CreateArray();
-    if (have_health) {
-        for (int i = 0; i < HEALTH_MAX_DEVICES; i++) {
-            if (!health[i].in_use || health[i].dev_type != HEALTH_DEV_BLE_LEAK)
-                continue;
-
-            cJSON *s = cJSON_CreateObject();
-            cJSON_AddStringToObject(s, "sensor_id", health[i].dev_id);
-            cJSON_AddBoolToObject(s, "connected", health[i].connected);
-            cJSON_AddStringToObject(s, "rating",
-                health_rating_to_str(health[i].rating));
-
-            if (health[i].last_seen_age_s != UINT32_MAX) {
-                cJSON_AddNumberToObject(s, "last_seen_age_s",
-                    health[i].last_seen_age_s);
-            } else {
-                cJSON_AddNullToObject(s, "last_seen_age_s");
-            }
+void telemetry_v2_publish_snapshot(void)
+{
+    if (s_snap.active) {
+        // Its remaining pages read the health table when they are written
+        ESP_LOGD(TELEM_TAG, "Snapshot %lu still waiting for in-flight room",
+                 (unsigned long)s_snap.ctx.snapshot_id);
+        return;
+    }
+
+    // A delta needs the last snapshot delivered in full and the same devices
+    bool delta_mode = s_snapshot_mode == TELEM_SNAPSHOT_DELTA;
+    bool base_acked = snap_base_take();
+    bool delta = delta_mode && base_acked &&
+                 s_deltas_since_keyframe < SNAPSHOT_KEYFRAME_EVERY;
 
-            // Merge telemetry data from cache — only when the device is currently
-            // connected (see LoRa note): prevents emitting connected:false with
-            // stale battery/rssi/fw after a reload wipes health seen-state.
-            const telem_ble_leak_cache_t *cached = NULL;
-            if (health[i].connected && s_ble_cache) {
-                for (int j = 0; j < TELEM_MAX_BLE_LEAK_CACHE; j++) {
-                    if (!s_ble_cache[j].valid) continue;
-                    if (strcasecmp(s_ble_cache[j].mac_str,
-                                   health[i].dev_id) == 0) {
-                        cached = &s_ble_cache[j];
-                        break;
-                    }
+    // ---- Pass 1: reason counters, valve entries and sensor count ----
+    health_rating_t sys_rating = health_get_system_rating();
+    health_reason_counts_t counts = {0};
+    health_device_status_t *valve_hs = s_snap.valve_hs;
+    bool have_health = true;
+    int sensors = 0;
+    int changed = 0;
+
+    memset(s_snap.valve_hs, 0, sizeof(s_snap.valve_hs));
+    for (int first = 0; first < DEVREG_MAX_DEVICES; first += SNAPSHOT_HEALTH_BATCH) {
+        int n = health_get_device_status_range(first, SNAPSHOT_HEALTH_BATCH,
+                                               s_health_batch);
+        if (n < 0) {
+            have_health = false;
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            const health_device_status_t *d = &s_health_batch[k];
+            dev_handle_t h = (dev_handle_t)(first + k);
+            if (delta && h >= DEVREG_HANDLE_LORA_BASE) {
+                const snap_digest_t *base = &s_sensor_digest[h - DEVREG_HANDLE_LORA_BASE];
+                if (d->in_use != !!(base->flags & SNAP_DIG_PRESENT) ||
+                    (d->in_use && base->id != snap_hash_str(d->dev_id))) {
+                    delta = false;      // sensor added or removed
                 }
             }
-
-            if (cached) {
-                cJSON_AddNumberToObject(s, "battery", cached->battery);
-                cJSON_AddBoolToObject(s, "leak_state", cached->leak_state);
-                cJSON_AddNumberToObject(s, "rssi", cached->rssi);
-                if (cached->fw_version[0])
-                    cJSON_AddStringToObject(s, "fw_version", cached->fw_version);
-                else
-                    cJSON_AddNullToObject(s, "fw_version");
+            if (!d->in_use) continue;
+            if (h < DEVREG_HANDLE_LORA_BASE) {
+                valve_hs[h] = *d;
             } else {
-                cJSON_AddNullToObject(s, "battery");
-                cJSON_AddBoolToObject(s, "leak_state", false);
-                cJSON_AddNullToObject(s, "rssi");
-                cJSON_AddNullToObject(s, "fw_version");
+                sensors++;
+                sensor_view_t v;
+                snap_digest_t dig;
+                if (delta && snapshot_sensor_fields(true, h, d, &v, &dig)) changed++;
             }
-
-            add_location_obj(s, SENSOR_TYPE_BLE_LEAK, health[i].dev_id);
-            cJSON_AddItemToArray(ble_arr, s);
+            count_health_reason(d, sys_rating, &counts);
         }
     }
-    cJSON_AddItemToObject(data, "ble_leak_sensors", ble_arr);
-
-    // ---- Override window status ----
-    bool ovr_active = rules_engine_is_override_window_active();
-    cJSON_AddBoolToObject(data, "override_active", ovr_active);
-    if (ovr_active) {
-        int32_t remaining = rules_engine_get_override_remaining_s();
-        if (remaining >= 0) {
-            cJSON_AddNumberToObject(data, "override_remaining_s", remaining);
+    for (int v = 0; delta && v < DEVREG_MAX_VALVES; v++) {
+        bool present = valve_hs[v].in_use || ble_valve_is_connected(v);
+        if (present != !!(s_valve_digest[v].flags & SNAP_DIG_PRESENT)) {
+            delta = false;              // valve added or removed
         }
     }
 
-    cJSON_AddItemToObject(root, "data", data);
-    publish_json(root, "snapshot");
+    char *reason = s_snap.reason;
+    if (have_health) {
+        build_system_health_reason(&counts, sys_rating, reason, sizeof(s_snap.reason));
+    } else {
+        snprintf(reason, sizeof(s_snap.reason), "Health data unavailable");
+        sensors = 0;
+        delta = false;
+    }
+    if (delta) {
+        sensors = changed;
+    } else if (delta_mode) {
+        // Keyframe: the digests start over from what it carries
+        memset(s_valve_digest, 0, sizeof(s_valve_digest));
+        memset(s_sensor_digest, 0, sizeof(s_sensor_digest));
+    }
+
+    memset(&s_snap.cost, 0, sizeof(s_snap.cost));
+    s_snap.ctx = (snapshot_ctx_t){
+        .sys_rating  = sys_rating,
+        .reason      = reason,
+        .snapshot_id = ++s_snapshot_id,
+        .base_id     = s_base_id,
+        .pages       = sensors > 0 ? (sensors + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE : 1,
+        .cost        = &s_snap.cost,
+        .heap_start  = heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        .delta_mode  = delta_mode,
+        .delta       = delta,
+    };
+    for (int v = 0; v < DEVREG_MAX_VALVES; v++) {
+        s_snap.ctx.valve_hs[v] = (have_health && valve_hs[v].in_use) ? &valve_hs[v] : NULL;
+    }
+    s_snap.active      = true;
+    s_snap.next_page   = 0;
+    s_snap.next_handle = have_health ? DEVREG_HANDLE_LORA_BASE : DEVREG_MAX_DEVICES;
+    snapshot_continue();
+}
+
+void telemetry_v2_set_snapshot_mode(telem_snapshot_mode_t mode)
+{
+    if (mode == s_snapshot_mode) return;
+    s_snapshot_mode = mode;
+    telemetry_v2_request_keyframe();
+    ESP_LOGI(TELEM_TAG, "Snapshot mode changed to %s (keyframe every %d)",
+             mode == TELEM_SNAPSHOT_DELTA ? "delta" : "full", SNAPSHOT_KEYFRAME_EVERY);
+}
+
+telem_snapshot_mode_t telemetry_v2_get_snapshot_mode(void)
+{
+    return s_snapshot_mode;
+}
+
+void telemetry_v2_set_encoding(telem_encoding_t enc)
+{
+    if (enc >= TELEM_ENCODING_MAX || enc == s_encoding) return;
+    s_encoding = enc;
+    // Section digests hash the encoded bytes, so the next delta has no base
+    telemetry_v2_request_keyframe();
+    ESP_LOGI(TELEM_TAG, "Encoding changed to %s",
+             enc == TELEM_ENCODING_CBOR ? "CBOR (" TELEMETRY_SCHEMA_V2B ")" : "JSON");
+}
+
+telem_encoding_t telemetry_v2_get_encoding(void)
+{
+    return s_encoding;
+}
+
+void telemetry_v2_request_keyframe(void)
+{
+    portENTER_CRITICAL(&s_base_lock);
+    s_base.keyframe_due = true;
+    portEXIT_CRITICAL(&s_base_lock);
 }
 
 // ---- Events ---------------------------------------------------------------
 
-void telemetry_v2_publish_valve_event(const char *event_name)
+void telemetry_v2_publish_valve_event(int valve, const char *event_name)
 {
-    cJSON *root = build_envelope("event");
-    if (!root) return;
+    telem_writer_t w;
+    if (!begin_envelope(&w, "event")) return;
 
-    cJSON *data = cJSON_CreateObject();
-    cJSON_AddStringToObject(data, "event", event_name);
+    telem_writer_obj_open(&w, "data");
+    telem_writer_str(&w, "event", event_name);
+    telem_writer_int(&w, "valve", valve);
 
-    int st = ble_valve_get_state();
-    cJSON_AddStringToObject(data, "valve_state",
+    char vmac[18];
+    if (ble_valve_get_mac(valve, vmac))
+        telem_writer_str(&w, "valve_mac", vmac);
+
+    int st = ble_valve_get_state(valve);
+    telem_writer_str(&w, "valve_state",
         st == 1 ? "open" : st == 0 ? "closed" : "unknown");
-    cJSON_AddNumberToObject(data, "battery", ble_valve_get_battery());
-    cJSON_AddBoolToObject(data, "leak_state", ble_valve_get_leak());
-    cJSON_AddBoolToObject(data, "rmleak", ble_valve_get_rmleak_state());
+    telem_writer_int(&w, "battery", ble_valve_get_battery(valve));
+    telem_writer_bool(&w, "leak_state", ble_valve_get_leak(valve));
+    telem_writer_bool(&w, "rmleak", ble_valve_get_rmleak_state(valve));
 
     char valve_fw[32];
-    if (ble_valve_get_firmware_rev(valve_fw, sizeof(valve_fw)))
-        cJSON_AddStringToObject(data, "fw_version", valve_fw);
+    if (ble_valve_get_firmware_rev(valve, valve_fw, sizeof(valve_fw)))
+        telem_writer_str(&w, "fw_version", valve_fw);
 
-    cJSON_AddItemToObject(root, "data", data);
-    publish_json(root, "event");
+    telem_writer_obj_close(&w);
+    publish_event(&w, strcmp(event_name, "valve_flood_detected") == 0);
 }
 
 void telemetry_v2_publish_leak_event(const char *event_name,
@@ -555,62 +1845,90 @@ void telemetry_v2_publish_leak_event(const char *event_name,
                                      bool leak_state,
                                      uint8_t battery, int8_t rssi)
 {
-    cJSON *root = build_envelope("event");
-    if (!root) return;
+    telem_writer_t w;
+    if (!begin_envelope(&w, "event")) return;
 
-    cJSON *data = cJSON_CreateObject();
-    cJSON_AddStringToObject(data, "event", event_name);
-    cJSON_AddStringToObject(data, "source_type", source_type);
-    cJSON_AddStringToObject(data, "sensor_id", sensor_id);
-    cJSON_AddBoolToObject(data, "leak_state", leak_state);
-    cJSON_AddNumberToObject(data, "battery", battery);
-    cJSON_AddNumberToObject(data, "rssi", rssi);
+    telem_writer_obj_open(&w, "data");
+    telem_writer_str(&w, "event", event_name);
+    telem_writer_str(&w, "source_type", source_type);
+    telem_writer_str(&w, "sensor_id", sensor_id);
+    telem_writer_bool(&w, "leak_state", leak_state);
+    telem_writer_int(&w, "battery", battery);
+    telem_writer_int(&w, "rssi", rssi);
 
     sensor_type_t mt = (strcmp(source_type, "lora") == 0)
                         ? SENSOR_TYPE_LORA : SENSOR_TYPE_BLE_LEAK;
-    add_location_obj(data, mt, sensor_id);
+    add_location_obj(&w, mt, sensor_id);
 
-    cJSON_AddItemToObject(root, "data", data);
-    publish_json(root, "event");
+    telem_writer_obj_close(&w);
+    publish_event(&w, leak_state);
 }
 
-void telemetry_v2_publish_rules_event(const char *rules_json)
+// Re-encode a parsed JSON value through the writer (CBOR messages)
+static void add_cjson(telem_writer_t *w, const char *key, const cJSON *item)
 {
-    if (!rules_json) return;
-    cJSON *root = build_envelope("event");
-    if (!root) return;
+    if (cJSON_IsObject(item) || cJSON_IsArray(item)) {
+        bool obj = cJSON_IsObject(item);
+        if (obj) telem_writer_obj_open(w, key);
+        else     telem_writer_arr_open(w, key);
+        for (const cJSON *c = item->child; c; c = c->next) {
+            add_cjson(w, obj ? c->string : NULL, c);
+        }
+        if (obj) telem_writer_obj_close(w);
+        else     telem_writer_arr_close(w);
+    } else if (cJSON_IsString(item)) {
+        telem_writer_str(w, key, item->valuestring);
+    } else if (cJSON_IsNumber(item)) {
+        telem_writer_num(w, key, item->valuedouble);
+    } else if (cJSON_IsBool(item)) {
+        telem_writer_bool(w, key, cJSON_IsTrue(item));
+    } else {
+        telem_writer_null(w, key);
+    }
+}
 
-    cJSON *parsed = cJSON_Parse(rules_json);
-    if (parsed) {
-        // Rules engine JSON becomes the "data" payload directly
-        cJSON_AddItemToObject(root, "data", parsed);
+// "data" of an event carrying JSON built by another module: an object is
+// embedded verbatim (re-encoded in a CBOR message), anything else is
+// wrapped as {event, raw}
+static void add_module_event_data(telem_writer_t *w, const char *json,
+                                  const char *module_event)
+{
+    const char *p = json;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    cJSON *obj = NULL;
+    if (*p == '{' && !w->cbor) {
+        telem_writer_raw_member(w, "data", p, strlen(p));
+    } else if (*p == '{' && (obj = cJSON_Parse(p)) != NULL) {
+        add_cjson(w, "data", obj);
+        cJSON_Delete(obj);
     } else {
-        cJSON *data = cJSON_CreateObject();
-        cJSON_AddStringToObject(data, "event", "rules_engine");
-        cJSON_AddStringToObject(data, "raw", rules_json);
-        cJSON_AddItemToObject(root, "data", data);
+        telem_writer_obj_open(w, "data");
+        telem_writer_str(w, "event", module_event);
+        telem_writer_str(w, "raw", json);
+        telem_writer_obj_close(w);
     }
+}
 
-    publish_json(root, "event");
+void telemetry_v2_publish_rules_event(const char *rules_json)
+{
+    if (!rules_json) return;
+    telem_writer_t w;
+    if (!begin_envelope(&w, "event")) return;
+
+    // Rules engine JSON becomes the "data" payload directly. Auto-close
+    // and RMLEAK decisions are never held back in a batch.
+    add_module_event_data(&w, rules_json, "rules_engine");
+    publish_event(&w, true);
 }
 
 void telemetry_v2_publish_health_event(const char *health_json)
 {
     if (!health_json) return;
-    cJSON *root = build_envelope("event");
-    if (!root) return;
+    telem_writer_t w;
+    if (!begin_envelope(&w, "event")) return;
 
-    cJSON *parsed = cJSON_Parse(health_json);
-    if (parsed) {
-        cJSON_AddItemToObject(root, "data", parsed);
-    } else {
-        cJSON *data = cJSON_CreateObject();
-        cJSON_AddStringToObject(data, "event", "health_engine");
-        cJSON_AddStringToObject(data, "raw", health_json);
-        cJSON_AddItemToObject(root, "data", data);
-    }
-
-    publish_json(root, "event");
+    add_module_event_data(&w, health_json, "health_engine");
+    publish_event(&w, false);
 }
 
 void telemetry_v2_publish_cmd_ack(const char *correlation_id,
@@ -618,24 +1936,24 @@ void telemetry_v2_publish_cmd_ack(const char *correlation_id,
                                   bool success,
                                   const char *error_msg)
 {
-    cJSON *root = build_envelope("event");
-    if (!root) return;
+    telem_writer_t w;
+    if (!begin_envelope(&w, "event")) return;
 
-    cJSON *data = cJSON_CreateObject();
-    cJSON_AddStringToObject(data, "event", "cmd_ack");
+    telem_writer_obj_open(&w, "data");
+    telem_writer_str(&w, "event", "cmd_ack");
     if (correlation_id && correlation_id[0])
-        cJSON_AddStringToObject(data, "id", correlation_id);
-    cJSON_AddStringToObject(data, "cmd", cmd_name);
-    cJSON_AddStringToObject(data, "status", success ? "ok" : "error");
+        telem_writer_str(&w, "id", correlation_id);
+    telem_writer_str(&w, "cmd", cmd_name);
+    telem_writer_str(&w, "status", success ? "ok" : "error");
     if (!success && error_msg) {
-        cJSON *err = cJSON_CreateObject();
-        cJSON_AddStringToObject(err, "code", cmd_name);
-        cJSON_AddStringToObject(err, "detail", error_msg);
-        cJSON_AddItemToObject(data, "error", err);
+        telem_writer_obj_open(&w, "error");
+        telem_writer_str(&w, "code", cmd_name);
+        telem_writer_str(&w, "detail", error_msg);
+        telem_writer_obj_close(&w);
     }
 
-    cJSON_AddItemToObject(root, "data", data);
-    publish_json(root, "event");
+    telem_writer_obj_close(&w);
+    publish_event(&w, false);
 }
 
 // ---- Offline buffer integration -------------------------------------------
@@ -643,15 +1961,63 @@ void telemetry_v2_publish_cmd_ack(const char *correlation_id,
 void telemetry_v2_set_connected(bool connected)
 {
     s_connected = connected;
+    if (!connected) {
+        // Pages in flight may never be acked: the next snapshot is a keyframe
+        telemetry_v2_request_keyframe();
+        // A new lifecycle follows the reconnect
+        s_lifecycle_pending = false;
+    }
     ESP_LOGI(TELEM_TAG, "MQTT connected = %s", connected ? "true" : "false");
 }
 
 void telemetry_v2_drain_offline(void)
 {
-    int pending = offline_buffer_count();
-    if (pending == 0) return;
+    if (!s_mqtt || !s_connected || offline_buffer_count() == 0) return;
+
+    // A held batch is newer than every entry: a disconnect or a full batch
+    // moves it into the buffer before anything is stored behind it
+    int unsent = offline_buffer_unsent();
+    bool bulk = unsent > 0 && delivery_tracker_has_slot();
+    if (bulk) {
+        ESP_LOGI(TELEM_TAG, "Draining %d offline event(s)...", unsent);
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_BULK, BULK_SCAN_NARROW_MAX_MS);
+    }
+    // Publishes what the in-flight cap allows and erases what was PUBACKed
+    int published = offline_buffer_drain(s_mqtt, topic_for_message);
+    if (bulk) {
+        ble_scan_hint(BLE_SCAN_HINT_WIFI_BULK, BULK_SCAN_TAIL_MS);
+        ESP_LOGI(TELEM_TAG, "Offline drain: %d event(s) replayed, %d not yet acknowledged",
+                 published, offline_buffer_count());
+    }
+}
 
-    ESP_LOGI(TELEM_TAG, "Draining %d offline event(s) before lifecycle...", pending);
-    int published = offline_buffer_drain(s_mqtt, s_topic);
-    ESP_LOGI(TELEM_TAG, "Offline drain complete: %d event(s) replayed", published);
+void telemetry_v2_publish_deferred(void)
+{
+    if (s_lifecycle_pending && (!s_connected || delivery_tracker_has_slot())) {
+        telemetry_v2_publish_lifecycle();
+    }
+    if (s_snap.active) {
+        snapshot_continue();
+    }
+}
+
+TickType_t telemetry_v2_wait_ticks(void)
+{
+    TickType_t wait = portMAX_DELAY;
+    if (s_batch.due_us) {
+        int64_t left_us = s_batch.due_us - esp_timer_get_time();
+        if (left_us > 0) {
+            wait = pdMS_TO_TICKS((uint32_t)((left_us + 999) / 1000)) + 1;
+        } else {
+            // Overdue: held for in-flight room unless it can go now
+            wait = (!s_connected || events_live(false)) ? 0 : pdMS_TO_TICKS(DELIVERY_POLL_MS);
+        }
+    }
+    // Buffered events, a deferred lifecycle and snapshot pages wait for
+    // PUBACKs or in-flight room
+    bool waiting = offline_buffer_count() > 0 || s_lifecycle_pending || s_snap.active;
+    if (s_connected && waiting && wait > pdMS_TO_TICKS(DELIVERY_POLL_MS)) {
+        wait = pdMS_TO_TICKS(DELIVERY_POLL_MS);
+    }
+    return wait;
 }
@@ -6,6 +6,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "mqtt_client.h"
+#include "device_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,27 +24,44 @@ const char *telemetry_v2_fw_version(void);
 // Cache types — shared between telemetry module and app_iothub for state
 // ---------------------------------------------------------------------------
 
-#define TELEM_MAX_LORA_CACHE      16
-#define TELEM_MAX_BLE_LEAK_CACHE  16
+// Caches are indexed by device registry slot (device_registry_lora_slot /
+// device_registry_ble_slot) and stored struct-of-arrays so large capacity
+// builds pay only for the fields. Each slot keeps its device key so a slot
+// reused by another sensor is detected and reset.
+#define TELEM_MAX_LORA_CACHE      DEVREG_MAX_LORA
+#define TELEM_MAX_BLE_LEAK_CACHE  DEVREG_MAX_BLE
 
 typedef struct {
-    uint32_t sensor_id;
-    uint8_t  battery;
-    uint8_t  leak_status;
-    int8_t   rssi;
-    float    snr;
-    bool     valid;
+    uint32_t sensor_id[TELEM_MAX_LORA_CACHE];
+    float    snr[TELEM_MAX_LORA_CACHE];
+    uint8_t  battery[TELEM_MAX_LORA_CACHE];
+    uint8_t  leak_status[TELEM_MAX_LORA_CACHE];
+    int8_t   rssi[TELEM_MAX_LORA_CACHE];
+    bool     valid[TELEM_MAX_LORA_CACHE];
 } telem_lora_cache_t;
 
 typedef struct {
-    char    mac_str[18];
-    uint8_t battery;
-    bool    leak_state;
-    int8_t  rssi;
-    char    fw_version[12];    // "M.m.p" or "" if not available
-    bool    valid;
+    uint8_t  mac[TELEM_MAX_BLE_LEAK_CACHE][6];         // printed order
+    char     fw_version[TELEM_MAX_BLE_LEAK_CACHE][12]; // "M.m.p" or "" if not available
+    uint8_t  battery[TELEM_MAX_BLE_LEAK_CACHE];
+    bool     leak_state[TELEM_MAX_BLE_LEAK_CACHE];
+    int8_t   rssi[TELEM_MAX_BLE_LEAK_CACHE];
+    bool     valid[TELEM_MAX_BLE_LEAK_CACHE];
 } telem_ble_leak_cache_t;
 
+// Snapshot encoding (Device Twin desired snapshot_mode)
+typedef enum {
+    TELEM_SNAPSHOT_FULL = 0,    // every snapshot carries every device
+    TELEM_SNAPSHOT_DELTA,       // changes only, between periodic keyframes
+} telem_snapshot_mode_t;
+
+// Message encoding (Device Twin desired encoding)
+typedef enum {
+    TELEM_ENCODING_JSON = 0,    // TELEMETRY_SCHEMA, application/json
+    TELEM_ENCODING_CBOR,        // TELEMETRY_SCHEMA_V2B, application/cbor, integer keys
+    TELEM_ENCODING_MAX,
+} telem_encoding_t;
+
 // ---------------------------------------------------------------------------
 // Init / lifecycle
 // ---------------------------------------------------------------------------
@@ -56,8 +74,8 @@ typedef struct {
  * @param client      MQTT client handle (for publishing)
  * @param device_id   Azure device ID (for MQTT topic)
  * @param gateway_id  Gateway ID string ("GW-XXXXXXXXXXXX")
- * @param lora_cache  Pointer to LoRa cache array in iothub_task scope
- * @param ble_cache   Pointer to BLE leak cache array in iothub_task scope
+ * @param lora_cache  LoRa cache owned by iothub_task
+ * @param ble_cache   BLE leak cache owned by iothub_task
  */
 void telemetry_v2_init(esp_mqtt_client_handle_t client,
                        const char *device_id,
@@ -78,17 +96,25 @@ QueueHandle_t telemetry_v2_get_snapshot_queue(void);
 void telemetry_v2_start_snapshot_timer(void);
 
 // ---------------------------------------------------------------------------
-// Publishers — all run in iothub_task context, non-blocking
+// Publishers — all run in iothub_task context, non-blocking. Messages are
+// streamed into one static buffer (CONFIG_EFLO_TELEMETRY_BUF_SIZE); no heap.
 // ---------------------------------------------------------------------------
 
 /** Publish type="lifecycle" birth message (online, reset_reason, config). */
 void telemetry_v2_publish_lifecycle(void);
 
-/** Publish type="snapshot" with all current device + sensor state. */
+/**
+ * Publish type="snapshot" with all current device + sensor state. More than
+ * CONFIG_EFLO_SNAPSHOT_PAGE_SIZE sensors are split over several messages
+ * sharing one data.page.snapshot_id; page 0 carries system_health, the valves
+ * ("valve" is valve 0, "valves" lists each by index) and the override window.
+ * In delta mode this is a type="snapshot_delta" with only what changed since
+ * the last snapshot, unless a keyframe is due.
+ */
 void telemetry_v2_publish_snapshot(void);
 
-/** Publish type="event" for valve transitions (state, flood). */
-void telemetry_v2_publish_valve_event(const char *event_name);
+/** Publish type="event" for transitions (state, flood) of valve index @p valve. */
+void telemetry_v2_publish_valve_event(int valve, const char *event_name);
 
 /** Publish type="event" for leak sensor transitions. */
 void telemetry_v2_publish_leak_event(const char *event_name,
@@ -116,6 +142,52 @@ void telemetry_v2_publish_health_event(const char *health_json);
 /** Change the snapshot timer period at runtime (from Device Twin desired). */
 void telemetry_v2_set_snapshot_interval(int seconds);
 
+/**
+ * Full or delta snapshots (Device Twin desired snapshot_mode). A delta goes
+ * only on top of a snapshot whose pages were all PUBACKed; a full keyframe
+ * follows every CONFIG_EFLO_SNAPSHOT_KEYFRAME_EVERY deltas, a reconnect, a
+ * device list change or telemetry_v2_request_keyframe(). Any task.
+ */
+void telemetry_v2_set_snapshot_mode(telem_snapshot_mode_t mode);
+telem_snapshot_mode_t telemetry_v2_get_snapshot_mode(void);
+
+/**
+ * JSON or CBOR for every message from the next one on; the offline buffer
+ * replays each message in the encoding it was stored in. Any task.
+ */
+void telemetry_v2_set_encoding(telem_encoding_t enc);
+telem_encoding_t telemetry_v2_get_encoding(void);
+
+/** Make the next snapshot a full keyframe. Any task. */
+void telemetry_v2_request_keyframe(void);
+
+/** Have the event loop publish a snapshot now. Any task. */
+void telemetry_v2_trigger_snapshot(void);
+
+// ---------------------------------------------------------------------------
+// Event batching (CONFIG_EFLO_TELEMETRY_BATCH_LINGER_MS)
+// ---------------------------------------------------------------------------
+
+/**
+ * Send held events whose linger ran out, once events are live again (in-flight
+ * room, empty offline buffer); after a disconnect, store them in the offline
+ * buffer. iothub_task, every event loop pass.
+ */
+void telemetry_v2_batch_poll(void);
+
+/**
+ * Publish what waited for an in-flight slot: a deferred lifecycle, then the
+ * remaining pages of a snapshot. iothub_task, every event loop pass.
+ */
+void telemetry_v2_publish_deferred(void);
+
+/**
+ * Ticks until held events are due, or until buffered events, a deferred
+ * lifecycle or snapshot pages should be retried (portMAX_DELAY if none), to
+ * bound the event loop wait.
+ */
+TickType_t telemetry_v2_wait_ticks(void);
+
 // ---------------------------------------------------------------------------
 // Offline buffer integration
 // ---------------------------------------------------------------------------
@@ -123,7 +195,11 @@ void telemetry_v2_set_snapshot_interval(int seconds);
 /** Set MQTT connectivity state. When false, event telemetry is buffered to NVS. */
 void telemetry_v2_set_connected(bool connected);
 
-/** Drain all NVS-buffered events via MQTT. Call on reconnect before lifecycle. */
+/**
+ * Publish NVS-buffered events as far as the in-flight cap allows and erase
+ * the PUBACKed ones. Call on reconnect before lifecycle and on every event
+ * loop pass while connected.
+ */
 void telemetry_v2_drain_offline(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,154 @@
+/*
+ * telemetry_v2b_keys.c
+ *
+ * Key numbers of "eflostop.v2b". See telemetry_v2b_keys.h; the same table
+ * is in docs/telemetry_encoding/EFLOSTOP_V2B.md for decoders.
+ */
+
+#include "telemetry_v2b_keys.h"
+
+const telem_writer_key_t telemetry_v2b_keys[] = {
+    { "accept_list",               24 },
+    { "acked",                    131 },
+    { "active_leak_count",         25 },
+    { "actuate",                   26 },
+    { "adv_late",                  27 },
+    { "auto_close_enabled",        28 },
+    { "auto_close_resumed",        29 },
+    { "base",                      30 },
+    { "base_id",                   31 },
+    { "batches",                  129 },
+    { "battery",                    4 },
+    { "ble_leak_sensor_count",     32 },
+    { "ble_leak_sensors",          33 },
+    { "ble_scan",                  34 },
+    { "bucket_ms",                 35 },
+    { "buf_size",                  36 },
+    { "bytes",                     37 },
+    { "cache_misses",              38 },
+    { "cached",                    39 },
+    { "cached_avg_ms",             40 },
+    { "category",                  41 },
+    { "cbor",                      42 },
+    { "clear_after_seconds",       43 },
+    { "close_latency",             44 },
+    { "cmd",                       45 },
+    { "coalesced",                 46 },
+    { "code",                      10 },
+    { "completed",                 47 },
+    { "connected",                  1 },
+    { "count",                     48 },
+    { "data",                      16 },
+    { "deferred",                 132 },
+    { "delivery",                 133 },
+    { "delta",                     49 },
+    { "depth",                     50 },
+    { "detail",                    51 },
+    { "detect_to_rules_ms",        52 },
+    { "dev_type",                  53 },
+    { "dispatch",                  54 },
+    { "dropped",                   55 },
+    { "due",                       56 },
+    { "duty",                      57 },
+    { "duty_changes",              58 },
+    { "duty_ms_last_hour",         59 },
+    { "duty_permille_last_hour",   60 },
+    { "encode_us",                 61 },
+    { "encoder",                   62 },
+    { "encoding",                  63 },
+    { "encodings",                 64 },
+    { "error",                     65 },
+    { "event",                     17 },
+    { "events",                   130 },
+    { "expires_ts",                66 },
+    { "full_avg_ms",               67 },
+    { "fw",                        68 },
+    { "fw_version",                 8 },
+    { "gap_ms_last_hour",          69 },
+    { "gap_ms_this_hour",          70 },
+    { "gaps",                      71 },
+    { "gateway",                   14 },
+    { "heap_drawn",                72 },
+    { "high",                      73 },
+    { "high_water",                74 },
+    { "id",                        18 },
+    { "in_flight",                134 },
+    { "in_flight_max",            135 },
+    { "incident_id",               75 },
+    { "incidents",                 76 },
+    { "index",                     20 },
+    { "ingress",                   77 },
+    { "itvl_ms",                   78 },
+    { "json",                      79 },
+    { "keyframe_id",               80 },
+    { "label",                     11 },
+    { "largest_free_block",        81 },
+    { "last_seen_age_s",            3 },
+    { "last_total_ms",             82 },
+    { "latency_ms",               136 },
+    { "leak_state",                 5 },
+    { "lifecycle",                 83 },
+    { "link",                      84 },
+    { "location",                   9 },
+    { "lora_rx",                   85 },
+    { "lora_sensor_count",         86 },
+    { "lora_sensors",              87 },
+    { "lost",                     137 },
+    { "low",                       88 },
+    { "mac",                       89 },
+    { "name",                      90 },
+    { "offline_duration_s",        91 },
+    { "offline_pending",          138 },
+    { "overflow",                  92 },
+    { "overflows",                 93 },
+    { "override_active",           94 },
+    { "override_cancelled",        95 },
+    { "override_remaining_s",      96 },
+    { "page",                      97 },
+    { "prev_rating",               98 },
+    { "previous_remaining_s",      99 },
+    { "profile",                  100 },
+    { "provisioned",              101 },
+    { "publish_us",               102 },
+    { "rating",                     2 },
+    { "raw",                      103 },
+    { "ready_ms",                 104 },
+    { "reason",                   105 },
+    { "remaining_s",              106 },
+    { "reports_last_hour",        107 },
+    { "reset_reason",             108 },
+    { "restarts",                 109 },
+    { "rmleak",                    22 },
+    { "rmleak_asserted",          110 },
+    { "rssi",                       6 },
+    { "rules",                    111 },
+    { "schema",                    12 },
+    { "sensor_id",                  0 },
+    { "setup_ms",                 112 },
+    { "short_id",                 113 },
+    { "snapshot",                 114 },
+    { "snapshot_id",              115 },
+    { "snr",                        7 },
+    { "source_type",               23 },
+    { "state",                     21 },
+    { "status",                   116 },
+    { "system_health",            117 },
+    { "timeouts",                 118 },
+    { "total",                    119 },
+    { "trigger",                  120 },
+    { "trigger_mask",             121 },
+    { "truncated",                122 },
+    { "ts",                        13 },
+    { "type",                      15 },
+    { "untracked",                139 },
+    { "uptime_s",                  19 },
+    { "valve",                    123 },
+    { "valve_mac",                124 },
+    { "valve_macs",               125 },
+    { "valve_state",              126 },
+    { "valves",                   127 },
+    { "write",                    128 },
+};
+
+const size_t telemetry_v2b_key_count =
+    sizeof(telemetry_v2b_keys) / sizeof(telemetry_v2b_keys[0]);
@@ -0,0 +1,34 @@
+/*
+ * telemetry_v2b_keys.h
+ *
+ * Integer map keys of the binary telemetry schema "eflostop.v2b": the same
+ * messages as "eflostop.v2", CBOR-encoded, with every key below replaced by
+ * its number. Keys not listed stay text, so a new member never breaks a
+ * decoder; give it a number here afterwards.
+ *
+ * Numbers are part of the schema: append new keys with the next free number
+ * and never renumber or reuse one. 0..23 encode in a single byte and go to
+ * the keys repeated per sensor and per message.
+ */
+
+#ifndef TELEMETRY_V2B_KEYS_H
+#define TELEMETRY_V2B_KEYS_H
+
+#include <stddef.h>
+#include "telem_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_SCHEMA_V2B  "eflostop.v2b"
+
+/* Sorted by name (strcmp order) for telem_writer_init_cbor() */
+extern const telem_writer_key_t telemetry_v2b_keys[];
+extern const size_t             telemetry_v2b_key_count;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_V2B_KEYS_H */
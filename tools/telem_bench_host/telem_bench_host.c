@@ -0,0 +1,98 @@
+/*
+ * telem_bench_host.c
+ *
+ * Host benchmark of the telemetry encodings: encodes the synthetic
+ * lifecycle, snapshot page and event messages of telem_sample.c with the
+ * firmware's telem_writer, as eflostop.v2 JSON and as eflostop.v2b CBOR, and
+ * prints bytes and encode time per message.
+ *
+ * Times are host CPU times, useful for the JSON:CBOR ratio only; the
+ * on-device figures come from CONFIG_EFLO_TELEMETRY_ENCODER_BENCH.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "telem_writer.h"
+#include "telemetry_v2b_keys.h"
+#include "telem_sample.h"
+
+#define BUF_SIZE        12288   /* CONFIG_EFLO_TELEMETRY_BUF_SIZE default */
+#define DEFAULT_SENSORS 32      /* CONFIG_EFLO_SNAPSHOT_PAGE_SIZE default */
+#define RUN_NS          200000000LL     /* per message kind and encoding */
+
+typedef enum {
+    KIND_LIFECYCLE = 0,
+    KIND_SNAPSHOT,
+    KIND_EVENT,
+    KIND_MAX
+} kind_t;
+
+static const char *const s_kind_name[KIND_MAX] = { "lifecycle", "snapshot", "event" };
+
+static char s_buf[BUF_SIZE];
+static int  s_sensors = DEFAULT_SENSORS;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Encode one message; returns its length, 0 on overflow */
+static size_t encode(kind_t kind, bool cbor)
+{
+    telem_writer_t w;
+    if (cbor) {
+        telem_writer_init_cbor(&w, s_buf, sizeof(s_buf),
+                               telemetry_v2b_keys, telemetry_v2b_key_count);
+    } else {
+        telem_writer_init(&w, s_buf, sizeof(s_buf));
+    }
+    switch (kind) {
+        case KIND_LIFECYCLE: telem_sample_lifecycle(&w);                break;
+        case KIND_SNAPSHOT:  telem_sample_snapshot_page(&w, s_sensors); break;
+        default:             telem_sample_event(&w);                    break;
+    }
+    size_t len = 0;
+    return telem_writer_finish(&w, &len) ? len : 0;
+}
+
+/* Repeat for RUN_NS; *ns_out gets the average per message */
+static size_t bench(kind_t kind, bool cbor, double *ns_out)
+{
+    size_t len = encode(kind, cbor);    /* warm-up, and the size */
+    long runs = 0;
+    int64_t start = now_ns(), elapsed;
+    do {
+        for (int i = 0; i < 100; i++) encode(kind, cbor);
+        runs += 100;
+        elapsed = now_ns() - start;
+    } while (elapsed < RUN_NS);
+    *ns_out = (double)elapsed / runs;
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) s_sensors = atoi(argv[1]);
+    if (s_sensors < 0) s_sensors = 0;
+
+    printf("telem_writer, %d sensors per snapshot page, %d B buffer\n", s_sensors, BUF_SIZE);
+    printf("%-10s %10s %10s %8s %12s %12s %8s\n",
+           "message", "json B", "cbor B", "cbor/js", "json ns", "cbor ns", "cbor/js");
+    for (int k = 0; k < KIND_MAX; k++) {
+        double json_ns = 0, cbor_ns = 0;
+        size_t json_len = bench((kind_t)k, false, &json_ns);
+        size_t cbor_len = bench((kind_t)k, true, &cbor_ns);
+        if (!json_len || !cbor_len) {
+            printf("%-10s overflows the %d B buffer\n", s_kind_name[k], BUF_SIZE);
+            continue;
+        }
+        printf("%-10s %10zu %10zu %7.0f%% %12.0f %12.0f %7.0f%%\n", s_kind_name[k],
+               json_len, cbor_len, 100.0 * cbor_len / json_len,
+               json_ns, cbor_ns, 100.0 * cbor_ns / json_ns);
+    }
+    return 0;
+}